@@ -0,0 +1,142 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "heap.h"
+
+/*
+ * Allocation-rate microbenchmark: every thread allocates small
+ * instances and int arrays that die immediately. Work is split into
+ * rounds that fit into the heap; between rounds all threads meet at a
+ * barrier and the heap is reset, which is what a copying collector
+ * does when nothing survives.
+ */
+
+#define DEFAULT_THREADS 4
+#define DEFAULT_ALLOCATIONS 20000000ULL
+#define HEAP_CAPACITY (128 * 1024 * 1024)
+#define MAX_OBJECT_SIZE 56
+
+static struct class_layout small_layout = {.instance_size = 24};
+static struct class_layout medium_layout = {.instance_size = 48};
+
+struct bench_thread {
+  pthread_t thread;
+  struct heap* heap;
+  pthread_barrier_t* barrier;
+  int is_leader;
+  unsigned long long allocations;
+  unsigned long long per_round;
+  unsigned long long bytes;
+  int failed;
+};
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void* bench_worker(void* arg) {
+  struct bench_thread* self = arg;
+  const struct class_layout* int_array = class_layout_for_array(T_INT);
+  unsigned long long done = 0;
+  unsigned long long i;
+
+  heap_attach_thread(self->heap);
+  while (done < self->allocations) {
+    for (i = 0; i < self->per_round && done < self->allocations; i++, done++) {
+      void* obj;
+      switch (i & 3) {
+        case 0:
+        case 1:
+          obj = heap_new_instance(self->heap, &small_layout);
+          self->bytes += small_layout.instance_size;
+          break;
+        case 2:
+          obj = heap_new_instance(self->heap, &medium_layout);
+          self->bytes += medium_layout.instance_size;
+          break;
+        default:
+          obj = heap_new_array(self->heap, int_array, 8);
+          self->bytes += class_layout_array_size(int_array, 8);
+          break;
+      }
+      if (obj == NULL) {
+        self->failed = 1;
+      }
+    }
+
+    /* All threads are stopped here, so the leader may drop everything */
+    pthread_barrier_wait(self->barrier);
+    if (self->is_leader) {
+      heap_retire_tlabs(self->heap);
+      heap_reset(self->heap);
+    }
+    pthread_barrier_wait(self->barrier);
+  }
+  heap_detach_thread(self->heap);
+  return NULL;
+}
+
+int main(int argc, char* argv[]) {
+  int threads = argc > 1 ? atoi(argv[1]) : DEFAULT_THREADS;
+  unsigned long long per_thread =
+      argc > 2 ? strtoull(argv[2], NULL, 10) : DEFAULT_ALLOCATIONS;
+  unsigned long long total_allocations = 0;
+  unsigned long long total_bytes = 0;
+  unsigned long long per_round;
+  struct bench_thread* workers;
+  pthread_barrier_t barrier;
+  struct heap heap;
+  double start, elapsed;
+  int i;
+
+  if (threads <= 0 || heap_init(&heap, HEAP_CAPACITY, 0) != 0) {
+    return EXIT_FAILURE;
+  }
+  per_round = (HEAP_CAPACITY / (size_t)threads - 2 * heap.tlab_size) /
+              MAX_OBJECT_SIZE;
+
+  workers = calloc((size_t)threads, sizeof(*workers));
+  if (workers == NULL) {
+    return EXIT_FAILURE;
+  }
+  pthread_barrier_init(&barrier, NULL, (unsigned)threads);
+
+  start = now_seconds();
+  for (i = 0; i < threads; i++) {
+    workers[i].heap = &heap;
+    workers[i].barrier = &barrier;
+    workers[i].is_leader = i == 0;
+    workers[i].allocations = per_thread;
+    workers[i].per_round = per_round;
+    pthread_create(&workers[i].thread, NULL, bench_worker, &workers[i]);
+  }
+  for (i = 0; i < threads; i++) {
+    pthread_join(workers[i].thread, NULL);
+    total_allocations += workers[i].allocations;
+    total_bytes += workers[i].bytes;
+    if (workers[i].failed) {
+      printf("thread %d ran out of memory\n", i);
+    }
+  }
+  elapsed = now_seconds() - start;
+
+  printf("alloc_bench: threads=%d allocations=%llu time=%.3fs\n", threads,
+         total_allocations, elapsed);
+  printf("  rate: %.1f M allocations/s, %.1f MB/s\n",
+         (double)total_allocations / elapsed / 1e6,
+         (double)total_bytes / elapsed / (1024.0 * 1024.0));
+  printf("  tlab refills: %llu, large allocations: %llu\n",
+         (unsigned long long)atomic_load(&heap.tlab_refills),
+         (unsigned long long)atomic_load(&heap.slow_allocations));
+
+  pthread_barrier_destroy(&barrier);
+  free(workers);
+  heap_destroy(&heap);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,365 @@
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "attribute_info.h"
+#include "class_loader.h"
+#include "class_writer.h"
+#include "constant_pool.h"
+
+/*
+ * Class loading benchmark: writes a generated class path to a
+ * temporary directory, java/lang/Object, CLASS_INTERFACES interfaces
+ * and a tree of `classes` classes where Cn extends C((n - 1) / 4) and
+ * implements I(n % CLASS_INTERFACES), every class with `methods`
+ * looping methods to verify. Threads then load all classes through a
+ * fresh loader, each taking every threads-th class from the last one
+ * so they keep meeting in the shared superclasses. The same load runs
+ * with one global lock around every load, as a VM serialized on
+ * class loading would, and finally the threads look up every loaded
+ * class in the dictionary. The parallel load runs once more with a
+ * class cache in the class path directory, filled by a first load,
+ * so every class comes from its verified image.
+ */
+
+#define DEFAULT_CLASSES 1024
+#define DEFAULT_METHODS 32
+#define DEFAULT_ROUNDS 5
+#define CLASS_INTERFACES 16
+#define MAX_THREADS 8
+#define LOOKUP_ROUNDS 200
+
+struct worker {
+  pthread_t thread;
+  struct class_loader* loader;
+  int index;
+  int threads;
+  int serialized;
+  int failed;
+};
+
+static pthread_mutex_t global_lock = PTHREAD_MUTEX_INITIALIZER;
+static char directory[] = "/tmp/class_load_bench.XXXXXX";
+static int class_count = DEFAULT_CLASSES;
+static int method_count = DEFAULT_METHODS;
+static char cache_dir[64];
+
+/* static int mN(int n) { int s = 0; for (int i = 0; i < n; i++) s += i; } */
+static void put_method(struct buffer* methods, uint16_t name,
+                       uint16_t descriptor, uint16_t code_name,
+                       uint16_t table_name) {
+  put_u2(methods, ACC_STATIC);
+  put_u2(methods, name);
+  put_u2(methods, descriptor);
+  put_u2(methods, 1);
+
+  put_u2(methods, code_name);
+  put_u4(methods, 12 + 21 + 6 + 8);
+  put_u2(methods, 2); /* max_stack */
+  put_u2(methods, 3); /* max_locals */
+  put_u4(methods, 21);
+  put_u1(methods, 0x03); /* iconst_0 */
+  put_u1(methods, 0x3c); /* istore_1 */
+  put_u1(methods, 0x03); /* iconst_0 */
+  put_u1(methods, 0x3d); /* istore_2 */
+  put_u1(methods, 0x1c); /* 4: iload_2 */
+  put_u1(methods, 0x1a); /* iload_0 */
+  put_u1(methods, 0xa2); /* 6: if_icmpge 19 */
+  put_u2(methods, 13);
+  put_u1(methods, 0x1b); /* iload_1 */
+  put_u1(methods, 0x1c); /* iload_2 */
+  put_u1(methods, 0x60); /* iadd */
+  put_u1(methods, 0x3c); /* istore_1 */
+  put_u1(methods, 0x84); /* iinc 2 1 */
+  put_u1(methods, 2);
+  put_u1(methods, 1);
+  put_u1(methods, 0xa7); /* 16: goto 4 */
+  put_u2(methods, (uint16_t)-12);
+  put_u1(methods, 0x1b); /* 19: iload_1 */
+  put_u1(methods, 0xac); /* ireturn */
+  put_u2(methods, 0); /* exception_table_length */
+  put_u2(methods, 1); /* attributes_count */
+  put_u2(methods, table_name);
+  put_u4(methods, 8);
+  put_u2(methods, 2);
+  put_u1(methods, APPEND_FRAME_MIN + 1); /* at 4: + int s, int i */
+  put_u2(methods, 4);
+  put_u1(methods, ITEM_Integer);
+  put_u1(methods, ITEM_Integer);
+  put_u1(methods, SAME_FRAME_MIN + 14); /* at 19: same */
+}
+
+static void write_class(const char* name, const char* super,
+                        const char* interface, uint16_t flags, int methods) {
+  struct buffer pool = {0};
+  struct buffer code = {0};
+  struct buffer class = {0};
+  uint16_t count = 1;
+  uint16_t this_class, super_class = 0, interface_class = 0;
+  uint16_t descriptor, code_name, table_name;
+  char path[4096];
+  char method[16];
+  FILE* file;
+  int i;
+
+  this_class = put_class(&pool, &count, name);
+  if (super != NULL) {
+    super_class = put_class(&pool, &count, super);
+  }
+  if (interface != NULL) {
+    interface_class = put_class(&pool, &count, interface);
+  }
+  descriptor = put_utf8(&pool, &count, "(I)I");
+  code_name = put_utf8(&pool, &count, "Code");
+  table_name = put_utf8(&pool, &count, "StackMapTable");
+  for (i = 0; i < methods; i++) {
+    snprintf(method, sizeof(method), "m%d", i);
+    put_method(&code, put_utf8(&pool, &count, method), descriptor, code_name,
+               table_name);
+  }
+
+  put_u4(&class, 0xCAFEBABE);
+  put_u2(&class, 0);
+  put_u2(&class, 52);
+  put_u2(&class, count);
+  put_bytes(&class, pool.data, pool.size);
+  put_u2(&class, flags);
+  put_u2(&class, this_class);
+  put_u2(&class, super_class);
+  put_u2(&class, interface != NULL);
+  if (interface != NULL) {
+    put_u2(&class, interface_class);
+  }
+  put_u2(&class, 0); /* fields */
+  put_u2(&class, (uint16_t)methods);
+  put_bytes(&class, code.data, code.size);
+  put_u2(&class, 0); /* attributes */
+
+  snprintf(path, sizeof(path), "%s/%s.class", directory, name);
+  file = fopen(path, "wb");
+  if (file == NULL ||
+      fwrite(class.data, 1, class.size, file) != class.size) {
+    printf("can't write %s\n", path);
+    exit(EXIT_FAILURE);
+  }
+  fclose(file);
+  free(pool.data);
+  free(code.data);
+  free(class.data);
+}
+
+static void write_class_path(void) {
+  char name[32];
+  char super[32];
+  char interface[32];
+  char path[4096];
+  int i;
+
+  snprintf(path, sizeof(path), "%s/java", directory);
+  mkdir(path, 0755);
+  snprintf(path, sizeof(path), "%s/java/lang", directory);
+  mkdir(path, 0755);
+  write_class("java/lang/Object", NULL, NULL, 0x0021, 0);
+  for (i = 0; i < CLASS_INTERFACES; i++) {
+    snprintf(name, sizeof(name), "I%d", i);
+    write_class(name, "java/lang/Object", NULL, 0x0601, 0);
+  }
+  for (i = 0; i < class_count; i++) {
+    snprintf(name, sizeof(name), "C%d", i);
+    snprintf(super, sizeof(super), "C%d", (i - 1) / 4);
+    snprintf(interface, sizeof(interface), "I%d", i % CLASS_INTERFACES);
+    write_class(name, i == 0 ? "java/lang/Object" : super, interface, 0x0021,
+                method_count);
+  }
+}
+
+static void remove_class_path(void) {
+  DIR* cache = opendir(cache_dir);
+  struct dirent* entry;
+  char path[4096];
+  int i;
+
+  while (cache != NULL && (entry = readdir(cache)) != NULL) {
+    if (entry->d_name[0] != '.') {
+      snprintf(path, sizeof(path), "%s/%s", cache_dir, entry->d_name);
+      unlink(path);
+    }
+  }
+  if (cache != NULL) {
+    closedir(cache);
+    rmdir(cache_dir);
+  }
+
+  for (i = 0; i < class_count; i++) {
+    snprintf(path, sizeof(path), "%s/C%d.class", directory, i);
+    unlink(path);
+  }
+  for (i = 0; i < CLASS_INTERFACES; i++) {
+    snprintf(path, sizeof(path), "%s/I%d.class", directory, i);
+    unlink(path);
+  }
+  snprintf(path, sizeof(path), "%s/java/lang/Object.class", directory);
+  unlink(path);
+  snprintf(path, sizeof(path), "%s/java/lang", directory);
+  rmdir(path);
+  snprintf(path, sizeof(path), "%s/java", directory);
+  rmdir(path);
+  rmdir(directory);
+}
+
+static void* load_classes(void* arg) {
+  struct worker* worker = arg;
+  struct class_file* class;
+  char name[32];
+  int i;
+
+  for (i = class_count - 1 - worker->index; i >= 0; i -= worker->threads) {
+    int length = snprintf(name, sizeof(name), "C%d", i);
+
+    if (worker->serialized) {
+      pthread_mutex_lock(&global_lock);
+    }
+    worker->failed |= class_loader_load(worker->loader, (uint8_t*)name,
+                                        (uint16_t)length, &class) != 0;
+    if (worker->serialized) {
+      pthread_mutex_unlock(&global_lock);
+    }
+  }
+  return NULL;
+}
+
+static void* find_classes(void* arg) {
+  struct worker* worker = arg;
+  char name[32];
+  int r, i;
+
+  for (r = 0; r < LOOKUP_ROUNDS; r++) {
+    for (i = worker->index; i < class_count; i += worker->threads) {
+      int length = snprintf(name, sizeof(name), "C%d", i);
+      worker->failed |= class_loader_find(worker->loader, (uint8_t*)name,
+                                          (uint16_t)length) == NULL;
+    }
+  }
+  return NULL;
+}
+
+/* Seconds for the threads to run `body` over the loader */
+static double run(struct class_loader* loader, void* (*body)(void*),
+                  int threads, int serialized) {
+  struct worker workers[MAX_THREADS];
+  double start = now_seconds();
+  int failed = 0;
+  int i;
+
+  for (i = 0; i < threads; i++) {
+    workers[i] = (struct worker){.loader = loader,
+                                 .index = i,
+                                 .threads = threads,
+                                 .serialized = serialized};
+    pthread_create(&workers[i].thread, NULL, body, &workers[i]);
+  }
+  for (i = 0; i < threads; i++) {
+    pthread_join(workers[i].thread, NULL);
+    failed |= workers[i].failed;
+  }
+  if (failed) {
+    printf("class_load_bench: a class didn't load\n");
+    exit(EXIT_FAILURE);
+  }
+  return now_seconds() - start;
+}
+
+/* Best load time of the rounds, each with a fresh loader */
+static double load_time(int threads, int serialized, int rounds,
+                        struct class_cache* cache,
+                        struct class_loader_stats* stats) {
+  double best = 0;
+  int r;
+
+  for (r = 0; r < rounds; r++) {
+    struct class_loader loader;
+    double time;
+
+    if (class_loader_init(&loader, directory) != 0) {
+      exit(EXIT_FAILURE);
+    }
+    loader.cache = cache;
+    time = run(&loader, load_classes, threads, serialized);
+    if (r == 0 || time < best) {
+      best = time;
+      class_loader_get_stats(&loader, stats);
+    }
+    class_loader_destroy(&loader);
+  }
+  return best;
+}
+
+int main(int argc, char* argv[]) {
+  int rounds = DEFAULT_ROUNDS;
+  struct class_loader_stats stats;
+  struct class_loader loader;
+  struct class_cache cache;
+  double serial_time = 0;
+  int threads;
+  int i;
+
+  for (i = 1; i < argc; i++) {
+    if (strncmp(argv[i], "--rounds=", 9) == 0) {
+      rounds = atoi(argv[i] + 9);
+    } else if (strncmp(argv[i], "--classes=", 10) == 0) {
+      class_count = atoi(argv[i] + 10);
+    } else if (strncmp(argv[i], "--methods=", 10) == 0) {
+      method_count = atoi(argv[i] + 10);
+    }
+  }
+  if (mkdtemp(directory) == NULL) {
+    return EXIT_FAILURE;
+  }
+  write_class_path();
+  snprintf(cache_dir, sizeof(cache_dir), "%s/cache", directory);
+  if (class_cache_init(&cache, cache_dir) != 0) {
+    return EXIT_FAILURE;
+  }
+  load_time(1, 0, 1, &cache, &stats);
+
+  printf("class_load_bench: classes=%d methods=%d rounds=%d cpus=%ld\n",
+         class_count, method_count, rounds, sysconf(_SC_NPROCESSORS_ONLN));
+  for (threads = 1; threads <= MAX_THREADS; threads *= 2) {
+    double locked = load_time(threads, 1, rounds, NULL, &stats);
+    double cached = load_time(threads, 0, rounds, &cache, &stats);
+    double parallel = load_time(threads, 0, rounds, NULL, &stats);
+
+    if (threads == 1) {
+      serial_time = parallel;
+    }
+    printf("  %d threads: global lock %.3f ms, placeholders %.3f ms "
+           "(%.2fx of 1 thread), cached %.3f ms, loaded=%llu waits=%llu "
+           "grows=%llu\n",
+           threads, locked * 1e3, parallel * 1e3, serial_time / parallel,
+           cached * 1e3, (unsigned long long)stats.loaded,
+           (unsigned long long)stats.waits, (unsigned long long)stats.grows);
+  }
+  printf("  ");
+  class_cache_print_stats(&cache);
+  class_cache_destroy(&cache);
+
+  if (class_loader_init(&loader, directory) != 0) {
+    return EXIT_FAILURE;
+  }
+  run(&loader, load_classes, 1, 0);
+  for (threads = 1; threads <= MAX_THREADS; threads *= 2) {
+    double time = run(&loader, find_classes, threads, 0);
+    printf("  dictionary lookups, %d threads: %.1f ns per lookup\n", threads,
+           time * 1e9 / ((double)LOOKUP_ROUNDS * class_count));
+  }
+  class_loader_destroy(&loader);
+  remove_class_path();
+  return 0;
+}
@@ -0,0 +1,79 @@
+#ifndef SHIP_JVM_CLASS_WRITER_H
+#define SHIP_JVM_CLASS_WRITER_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "constant_pool.h"
+
+/*
+ * Writing class files for the benchmarks that generate their classes:
+ * big-endian values into a growing buffer and the constant pool
+ * entries they all need. Out of memory ends the benchmark
+ */
+
+struct buffer {
+  uint8_t* data;
+  size_t size;
+  size_t capacity;
+};
+
+static inline double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static inline void put_bytes(struct buffer* buffer, const void* bytes,
+                             size_t n) {
+  /* an empty buffer has no data to copy from or to */
+  if (n == 0) {
+    return;
+  }
+  if (buffer->size + n > buffer->capacity) {
+    buffer->capacity = (buffer->size + n) * 2;
+    buffer->data = realloc(buffer->data, buffer->capacity);
+    if (buffer->data == NULL) {
+      printf("out of memory\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  memcpy(buffer->data + buffer->size, bytes, n);
+  buffer->size += n;
+}
+
+static inline void put_u1(struct buffer* buffer, uint8_t value) {
+  put_bytes(buffer, &value, 1);
+}
+
+static inline void put_u2(struct buffer* buffer, uint16_t value) {
+  put_u1(buffer, (uint8_t)(value >> 8));
+  put_u1(buffer, (uint8_t)value);
+}
+
+static inline void put_u4(struct buffer* buffer, uint32_t value) {
+  put_u2(buffer, (uint16_t)(value >> 16));
+  put_u2(buffer, (uint16_t)value);
+}
+
+/* Pool entries return their index, `count` is the next free one */
+static inline uint16_t put_utf8(struct buffer* pool, uint16_t* count,
+                                const char* text) {
+  put_u1(pool, UTF8);
+  put_u2(pool, (uint16_t)strlen(text));
+  put_bytes(pool, text, strlen(text));
+  return (*count)++;
+}
+
+static inline uint16_t put_class(struct buffer* pool, uint16_t* count,
+                                 const char* name) {
+  uint16_t utf8 = put_utf8(pool, count, name);
+  put_u1(pool, CLASS);
+  put_u2(pool, utf8);
+  return (*count)++;
+}
+
+#endif
@@ -0,0 +1,92 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "mark_compact.h"
+
+/*
+ * Old generation benchmark: builds a large linked graph that is
+ * promoted right away, drops half of it and runs full collections
+ * with a growing number of workers. Prints per worker statistics.
+ */
+
+#define YOUNG_SIZE (8 * 1024 * 1024)
+#define OLD_SIZE (512 * 1024 * 1024)
+#define LISTS 4096
+#define DEFAULT_NODES 4000000
+
+static uint32_t node_refs[] = {sizeof(struct object_header)};
+static struct class_layout node_layout = {
+    .instance_size = 48, .ref_count = 1, .ref_offsets = node_refs};
+
+static int build_graph(struct gc_heap* gh, struct object_header** lists,
+                       long nodes) {
+  long i;
+
+  for (i = 0; i < nodes; i++) {
+    uint32_t index = (uint32_t)(i % LISTS);
+    struct object_header* node = heap_new_instance(&gh->eden, &node_layout);
+    struct array_header* heads;
+    struct object_header** slots;
+
+    if (node == NULL) {
+      return 1;
+    }
+    /* Loaded after the allocation, which may have moved the array */
+    heads = (struct array_header*)*lists;
+    slots = (struct object_header**)(heads + 1);
+    gc_store_field(gh, node, node_refs[0], slots[index]);
+    gc_store_element(gh, heads, index, node);
+  }
+  return 0;
+}
+
+int main(int argc, char* argv[]) {
+  long nodes = argc > 1 ? atol(argv[1]) : DEFAULT_NODES;
+  unsigned max_workers = argc > 2 ? (unsigned)atoi(argv[2]) : 4;
+  struct object_header* lists = NULL;
+  struct gc_heap gh;
+  unsigned workers;
+
+  if (gc_heap_init(&gh, YOUNG_SIZE, OLD_SIZE) != 0) {
+    return EXIT_FAILURE;
+  }
+  gh.tenuring_threshold = 1;
+  gc_add_root(&gh, &lists);
+  lists = (struct object_header*)heap_new_array(
+      &gh.eden, class_layout_for_array(T_OBJECT), LISTS);
+
+  if (build_graph(&gh, &lists, nodes) != 0 || gc_scavenge(&gh) != 0) {
+    printf("out of memory while building the graph\n");
+    return EXIT_FAILURE;
+  }
+  printf("full_gc_bench: %ld nodes, old generation %.1f MB\n", nodes,
+         (double)(gh.old.top - gh.old.base) / (1024.0 * 1024.0));
+
+  for (workers = 1; workers <= max_workers; workers *= 2) {
+    struct mark_compact mc;
+    struct array_header* heads;
+    uint32_t i;
+
+    if (mark_compact_init(&mc, &gh, workers) != 0) {
+      return EXIT_FAILURE;
+    }
+
+    /* Every round drops half of the remaining lists */
+    heads = (struct array_header*)lists;
+    for (i = workers - 1; i < LISTS; i += 2 * workers) {
+      gc_store_element(&gh, heads, i, NULL);
+    }
+
+    heap_retire_tlabs(&gh.eden);
+    if (mark_compact_collect(&mc) != 0) {
+      return EXIT_FAILURE;
+    }
+    mark_compact_print_stats(&mc);
+    mark_compact_destroy(&mc);
+  }
+
+  gc_heap_destroy(&gh);
+  return EXIT_SUCCESS;
+}
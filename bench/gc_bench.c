@@ -0,0 +1,99 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "gc.h"
+
+/*
+ * Scavenger benchmark: allocates short linked chains where most nodes
+ * die immediately and a fraction is kept for a while in a rooted ring
+ * array. The ring ends up in the old generation, so its stores go
+ * through the card barrier. Reports allocation rate and pause
+ * percentiles of the young collections.
+ */
+
+#define DEFAULT_ALLOCATIONS 50000000ULL
+#define YOUNG_SIZE (16 * 1024 * 1024)
+#define OLD_SIZE (256 * 1024 * 1024)
+#define RING_SIZE (1 << 14)
+#define KEEP_ONE_IN 16
+
+static uint32_t node_refs[] = {sizeof(struct object_header)};
+static struct class_layout node_layout = {
+    .instance_size = 40, .ref_count = 1, .ref_offsets = node_refs};
+
+static double now_seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static uint32_t next_random(uint32_t* state) {
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return *state = x;
+}
+
+int main(int argc, char* argv[]) {
+  unsigned long long allocations =
+      argc > 1 ? strtoull(argv[1], NULL, 10) : DEFAULT_ALLOCATIONS;
+  struct object_header* ring = NULL;
+  struct object_header* previous = NULL;
+  uint32_t random = 2463534242u;
+  unsigned long long i;
+  struct gc_heap gh;
+  double start, elapsed;
+
+  if (gc_heap_init(&gh, YOUNG_SIZE, OLD_SIZE) != 0) {
+    return EXIT_FAILURE;
+  }
+  gc_add_root(&gh, &ring);
+  gc_add_root(&gh, &previous);
+
+  ring = (struct object_header*)heap_new_array(
+      &gh.eden, class_layout_for_array(T_OBJECT), RING_SIZE);
+
+  start = now_seconds();
+  for (i = 0; i < allocations; i++) {
+    struct object_header* node = heap_new_instance(&gh.eden, &node_layout);
+    uint32_t r;
+
+    if (node == NULL) {
+      printf("out of memory after %llu allocations\n", i);
+      break;
+    }
+    /* Chains of four nodes, young->young stores */
+    gc_store_field(&gh, node, node_refs[0], (i & 3) ? previous : NULL);
+    previous = node;
+
+    r = next_random(&random);
+    if (r % KEEP_ONE_IN == 0) {
+      gc_store_element(&gh, (struct array_header*)ring,
+                       (r >> 8) % RING_SIZE, node);
+    }
+  }
+  elapsed = now_seconds() - start;
+
+  printf("gc_bench: allocations=%llu time=%.3fs\n", i, elapsed);
+  printf("  rate: %.1f M allocations/s, %.1f MB/s\n",
+         (double)i / elapsed / 1e6,
+         (double)i * node_layout.instance_size / elapsed / (1024.0 * 1024.0));
+  printf("  scavenges: %llu, survived: %.1f MB, promoted: %.1f MB, "
+         "dirty cards: %llu\n",
+         (unsigned long long)gh.stats.scavenges,
+         (double)gh.stats.survived_bytes / (1024.0 * 1024.0),
+         (double)gh.stats.promoted_bytes / (1024.0 * 1024.0),
+         (unsigned long long)gh.stats.dirty_cards);
+  printf("  pause us: p50=%.1f p90=%.1f p99=%.1f max=%.1f\n",
+         (double)gc_pause_percentile(&gh, 50) / 1e3,
+         (double)gc_pause_percentile(&gh, 90) / 1e3,
+         (double)gc_pause_percentile(&gh, 99) / 1e3,
+         (double)gc_pause_percentile(&gh, 100) / 1e3);
+
+  gc_heap_destroy(&gh);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,406 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "class_writer.h"
+#include "classfile_parser.h"
+#include "class_layout.h"
+#include "interpreter.h"
+#include "opt_jit.h"
+#include "template_jit.h"
+#include "tiering.h"
+#include "verifier.h"
+
+/*
+ * JIT benchmark: runs the loops of a generated class in the
+ * interpreter alone, without and with superinstructions, with the
+ * template JIT, with the optimizing JIT and
+ * under the tiering policy with both compilers on background threads.
+ *
+ *   static int add(int a, int b) { return a + b; }
+ *   static int loop(int n) {
+ *     int s = 0;
+ *     for (int i = 0; i < n; i++) s = add(s, i);
+ *     return s;
+ *   }
+ *   static int arith(int n) {
+ *     int s = 0;
+ *     for (int i = 0; i < n; i++) s = (s * 31 + i) ^ (i >> 2);
+ *     return s;
+ *   }
+ *   static int sum(int[] a, int n) {
+ *     int s = 0;
+ *     for (int i = 0; i < a.length; i++) s += a[i] * n + (n >> 1);
+ *     return s;
+ *   }
+ */
+
+#define DEFAULT_ITERATIONS 5000000
+#define ROUNDS 5
+
+/*
+ * Static int method. Loops have their head at 4 and exit at
+ * `loop_end`, both get a stack map frame with the arguments and s, i
+ */
+static void put_method(struct buffer* methods, uint16_t name,
+                       uint16_t descriptor, uint16_t code_name,
+                       uint16_t table_name, uint16_t max_stack,
+                       uint16_t max_locals, const uint8_t* code,
+                       uint32_t code_length, uint16_t loop_end) {
+  uint32_t table_length = loop_end != 0 ? 2 + 5 + 1 : 0;
+
+  put_u2(methods, ACC_PUBLIC | ACC_STATIC);
+  put_u2(methods, name);
+  put_u2(methods, descriptor);
+  put_u2(methods, 1);
+
+  put_u2(methods, code_name);
+  put_u4(methods, 12 + code_length +
+                      (table_length != 0 ? 6 + table_length : 0));
+  put_u2(methods, max_stack);
+  put_u2(methods, max_locals);
+  put_u4(methods, code_length);
+  put_bytes(methods, code, code_length);
+  put_u2(methods, 0); /* exception_table_length */
+  if (table_length == 0) {
+    put_u2(methods, 0);
+    return;
+  }
+  put_u2(methods, 1);
+  put_u2(methods, table_name);
+  put_u4(methods, table_length);
+  put_u2(methods, 2);
+  put_u1(methods, APPEND_FRAME_MIN + 1); /* at 4: + int s, int i */
+  put_u2(methods, 4);
+  put_u1(methods, ITEM_Integer);
+  put_u1(methods, ITEM_Integer);
+  put_u1(methods, (uint8_t)(loop_end - 4 - 1)); /* same frame */
+}
+
+static struct buffer make_class(void) {
+  static const uint8_t add[] = {
+      0x1a, /* iload_0 */
+      0x1b, /* iload_1 */
+      0x60, /* iadd */
+      0xac, /* ireturn */
+  };
+  uint8_t loop[] = {
+      0x03, 0x3c,       /* s = 0 */
+      0x03, 0x3d,       /* i = 0 */
+      0x1c, 0x1a,       /* 4: iload_2, iload_0 */
+      0xa2, 0x00, 0x0f, /* if_icmpge 21 */
+      0x1b, 0x1c,       /* iload_1, iload_2 */
+      0xb8, 0x00, 0x00, /* invokestatic add, patched below */
+      0x3c,             /* istore_1 */
+      0x84, 0x02, 0x01, /* iinc 2 1 */
+      0xa7, 0xff, 0xf2, /* goto 4 */
+      0x1b, 0xac,       /* 21: iload_1, ireturn */
+  };
+  static const uint8_t arith[] = {
+      0x03, 0x3c,       /* s = 0 */
+      0x03, 0x3d,       /* i = 0 */
+      0x1c, 0x1a,       /* 4: iload_2, iload_0 */
+      0xa2, 0x00, 0x14, /* if_icmpge 26 */
+      0x1b, 0x10, 0x1f, /* iload_1, bipush 31 */
+      0x68,             /* imul */
+      0x1c, 0x60,       /* iload_2, iadd */
+      0x1c, 0x05, 0x7a, /* iload_2, iconst_2, ishr */
+      0x82,             /* ixor */
+      0x3c,             /* istore_1 */
+      0x84, 0x02, 0x01, /* iinc 2 1 */
+      0xa7, 0xff, 0xed, /* goto 4 */
+      0x1b, 0xac,       /* 26: iload_1, ireturn */
+  };
+  static const uint8_t sum[] = {
+      0x03, 0x3d,       /* s = 0 */
+      0x03, 0x3e,       /* i = 0 */
+      0x1d, 0x2a, 0xbe, /* 4: iload_3, aload_0, arraylength */
+      0xa2, 0x00, 0x15, /* if_icmpge 28 */
+      0x1c,             /* iload_2 */
+      0x2a, 0x1d, 0x2e, /* aload_0, iload_3, iaload */
+      0x1b, 0x68, 0x60, /* iload_1, imul, iadd */
+      0x1b, 0x04, 0x7a, /* iload_1, iconst_1, ishr */
+      0x60,             /* iadd */
+      0x3d,             /* istore_2 */
+      0x84, 0x03, 0x01, /* iinc 3 1 */
+      0xa7, 0xff, 0xeb, /* goto 4 */
+      0x1c, 0xac,       /* 28: iload_2, ireturn */
+  };
+  struct buffer pool = {0};
+  struct buffer methods = {0};
+  struct buffer class = {0};
+  uint16_t count = 1;
+  uint16_t this_class, object, code_name, table_name, add_name, add_desc;
+  uint16_t name_and_type, add_ref, int_desc;
+
+  put_utf8(&pool, &count, "Add");
+  put_u1(&pool, CLASS);
+  put_u2(&pool, (uint16_t)(count - 1));
+  this_class = count++;
+  put_utf8(&pool, &count, "java/lang/Object");
+  put_u1(&pool, CLASS);
+  put_u2(&pool, (uint16_t)(count - 1));
+  object = count++;
+  code_name = put_utf8(&pool, &count, "Code");
+  table_name = put_utf8(&pool, &count, "StackMapTable");
+  add_name = put_utf8(&pool, &count, "add");
+  add_desc = put_utf8(&pool, &count, "(II)I");
+  put_u1(&pool, NAME_AND_TYPE);
+  put_u2(&pool, add_name);
+  put_u2(&pool, add_desc);
+  name_and_type = count++;
+  put_u1(&pool, METHOD_REF);
+  put_u2(&pool, this_class);
+  put_u2(&pool, name_and_type);
+  add_ref = count++;
+  int_desc = put_utf8(&pool, &count, "(I)I");
+
+  loop[12] = (uint8_t)(add_ref >> 8);
+  loop[13] = (uint8_t)add_ref;
+  put_method(&methods, add_name, add_desc, code_name, table_name, 2, 2, add,
+             sizeof(add), 0);
+  put_method(&methods, put_utf8(&pool, &count, "loop"), int_desc, code_name,
+             table_name, 2, 3, loop, sizeof(loop), 21);
+  put_method(&methods, put_utf8(&pool, &count, "arith"), int_desc,
+             code_name, table_name, 3, 3, arith, sizeof(arith), 26);
+  put_method(&methods, put_utf8(&pool, &count, "sum"),
+             put_utf8(&pool, &count, "([II)I"), code_name, table_name, 3, 4,
+             sum, sizeof(sum), 28);
+
+  put_u4(&class, 0xCAFEBABE);
+  put_u2(&class, 0);
+  put_u2(&class, 52);
+  put_u2(&class, count);
+  put_bytes(&class, pool.data, pool.size);
+  put_u2(&class, 0x0021);
+  put_u2(&class, this_class);
+  put_u2(&class, object);
+  put_u2(&class, 0); /* interfaces */
+  put_u2(&class, 0); /* fields */
+  put_u2(&class, 4);
+  put_bytes(&class, methods.data, methods.size);
+  put_u2(&class, 0); /* attributes */
+
+  free(pool.data);
+  free(methods.data);
+  return class;
+}
+
+static int load(const struct buffer* bytes, struct class_file* class) {
+  Loader loader = {.buffer = bytes->data, .size = bytes->size};
+  struct verifier verifier;
+  int err;
+
+  init_class_file(class);
+  err = parse_class(&loader, class);
+  if (err == 0) {
+    verifier_init(&verifier);
+    err = verify_class(&verifier, class);
+    verifier_destroy(&verifier);
+  }
+  if (err != 0) {
+    free_class_file(class);
+    printf("can't load generated class\n");
+  }
+  return err;
+}
+
+/* Interpreter with its own copy of the class, one per configuration */
+struct runner {
+  struct class_file class;
+  struct interpreter interp;
+  struct interp_thread thread;
+};
+
+static int runner_init(struct runner* runner, const struct buffer* bytes) {
+  if (load(bytes, &runner->class) != 0) {
+    return -1;
+  }
+  if (interpreter_init(&runner->interp, NULL) != 0 ||
+      interp_thread_init(&runner->thread, &runner->interp, 0) != 0) {
+    return -1;
+  }
+  return 0;
+}
+
+static void runner_destroy(struct runner* runner) {
+  interp_thread_destroy(&runner->thread);
+  /* the class leaves the interpreter's hierarchy first */
+  free_class_file(&runner->class);
+  interpreter_destroy(&runner->interp);
+}
+
+/* int[] of `length` elements outside of any heap, the benchmark never GCs */
+static struct array_header* make_array(int32_t length) {
+  const struct class_layout* layout = class_layout_for_array(T_INT);
+  struct array_header* array =
+      calloc(1, class_layout_array_size(layout, (uint32_t)length));
+  int32_t* elements;
+  int32_t i;
+
+  if (array == NULL) {
+    printf("out of memory\n");
+    exit(EXIT_FAILURE);
+  }
+  array->header.mark = MARK_UNLOCKED;
+  array->header.layout = layout;
+  array->length = (uint32_t)length;
+  elements = (int32_t*)(array + 1);
+  for (i = 0; i < length; i++) {
+    elements[i] = i & 1023;
+  }
+  return array;
+}
+
+/*
+ * Best seconds per call of the method over ROUNDS calls, `first` gets
+ * the first call, which only OSR speeds up. With a policy the compiles
+ * queued by a round finish before the next one
+ */
+static double run(struct runner* runner, struct tier_policy* policy,
+                  const char* name, const char* descriptor,
+                  union java_value* args, int32_t* result, double* first) {
+  struct method_info* method =
+      class_find_method(&runner->class, name, descriptor);
+  double best = 0;
+  int round;
+
+  for (round = 0; round < ROUNDS; round++) {
+    union java_value value;
+    double start = now_seconds();
+    double elapsed;
+
+    if (interp_invoke(&runner->thread, &runner->class, method, args,
+                      &value) != 0) {
+      printf("%s failed\n", name);
+      exit(EXIT_FAILURE);
+    }
+    elapsed = now_seconds() - start;
+    if (round == 0) {
+      *first = elapsed;
+    }
+    if (round == 0 || elapsed < best) {
+      best = elapsed;
+    }
+    *result = value.i;
+    if (policy != NULL) {
+      tier_policy_drain(policy);
+    }
+  }
+  return best;
+}
+
+int main(int argc, char* argv[]) {
+  static const char* const methods[][2] = {
+      {"loop", "(I)I"}, {"arith", "(I)I"}, {"sum", "([II)I"}};
+  int32_t n = argc > 1 ? atoi(argv[1]) : DEFAULT_ITERATIONS;
+  struct buffer bytes = make_class();
+  struct array_header* array = make_array(n);
+  struct runner plain;
+  struct runner interpreted;
+  struct runner baseline;
+  struct runner optimized;
+  struct runner tiered;
+  struct template_jit template_jit;
+  struct opt_jit opt_jit;
+  struct template_jit tiered_baseline;
+  struct opt_jit tiered_opt;
+  struct tier_policy policy;
+  int mismatches = 0;
+  size_t i;
+
+  if (runner_init(&plain, &bytes) != 0 ||
+      runner_init(&interpreted, &bytes) != 0 ||
+      runner_init(&baseline, &bytes) != 0 ||
+      runner_init(&optimized, &bytes) != 0 ||
+      runner_init(&tiered, &bytes) != 0 ||
+      template_jit_init(&template_jit, &baseline.interp, 0) != 0 ||
+      opt_jit_init(&opt_jit, &optimized.interp, 0) != 0 ||
+      template_jit_init(&tiered_baseline, &tiered.interp, 0) != 0 ||
+      opt_jit_init(&tiered_opt, &tiered.interp, 0) != 0 ||
+      tier_policy_init(&policy, &tiered.interp, &tiered_baseline, &tiered_opt,
+                       NULL) != 0) {
+    return EXIT_FAILURE;
+  }
+  plain.interp.superinstructions = 0;
+
+  printf("%d iterations, best of %d\n", n, ROUNDS);
+  for (i = 0; i < sizeof(methods) / sizeof(*methods); i++) {
+    union java_value args[2];
+    int32_t expected;
+    int32_t plain_result;
+    int32_t baseline_result;
+    int32_t optimized_result;
+    int32_t tiered_result;
+    double plain_time;
+    double interpreted_time;
+    double baseline_time;
+    double optimized_time;
+    double tiered_time;
+    double interpreted_first;
+    double first;
+    int matches;
+
+    if (methods[i][1][1] == '[') {
+      args[0].ref = &array->header;
+      args[1].i = 3;
+    } else {
+      args[0].i = n;
+    }
+    plain_time = run(&plain, NULL, methods[i][0], methods[i][1], args,
+                     &plain_result, &first);
+    interpreted_time = run(&interpreted, NULL, methods[i][0], methods[i][1],
+                           args, &expected, &interpreted_first);
+    baseline_time = run(&baseline, NULL, methods[i][0], methods[i][1], args,
+                        &baseline_result, &first);
+    optimized_time = run(&optimized, NULL, methods[i][0], methods[i][1], args,
+                         &optimized_result, &first);
+    tiered_time = run(&tiered, &policy, methods[i][0], methods[i][1], args,
+                      &tiered_result, &first);
+    matches = plain_result == expected && baseline_result == expected &&
+              optimized_result == expected && tiered_result == expected;
+    mismatches += !matches;
+
+    printf("%-6s plain: %8.3f ms | interpreter: %8.3f ms %6.2f ns/iter "
+           "%4.2fx | jit: %8.3f ms "
+           "%6.2f ns/iter %5.1fx | opt: %8.3f ms %6.2f ns/iter %5.1fx | "
+           "tiered: %8.3f ms %5.1fx, first call %8.3f ms %5.1fx%s\n",
+           methods[i][0], plain_time * 1e3, interpreted_time * 1e3,
+           interpreted_time * 1e9 / n, plain_time / interpreted_time,
+           baseline_time * 1e3, baseline_time * 1e9 / n,
+           interpreted_time / baseline_time, optimized_time * 1e3,
+           optimized_time * 1e9 / n, interpreted_time / optimized_time,
+           tiered_time * 1e3, interpreted_time / tiered_time, first * 1e3,
+           interpreted_first / first, matches ? "" : " RESULT MISMATCH");
+  }
+  printf("superinstructions: %llu\n",
+         (unsigned long long)interpreted.interp.fused);
+  printf("compiled calls: jit %llu of %llu, opt %llu of %llu invocations, "
+         "tiered osr entries %llu\n",
+         (unsigned long long)baseline.thread.stats.compiled_calls,
+         (unsigned long long)baseline.thread.stats.invocations,
+         (unsigned long long)optimized.thread.stats.compiled_calls,
+         (unsigned long long)optimized.thread.stats.invocations,
+         (unsigned long long)tiered.thread.stats.osr_entries);
+  template_jit_print_stats(&template_jit);
+  opt_jit_print_stats(&opt_jit);
+  tier_policy_print_stats(&policy);
+
+  tier_policy_destroy(&policy);
+  opt_jit_destroy(&tiered_opt);
+  template_jit_destroy(&tiered_baseline);
+  opt_jit_destroy(&opt_jit);
+  template_jit_destroy(&template_jit);
+  runner_destroy(&tiered);
+  runner_destroy(&optimized);
+  runner_destroy(&baseline);
+  runner_destroy(&interpreted);
+  runner_destroy(&plain);
+  free(array);
+  free(bytes.data);
+  /* the only place the engines are compared, a miscompile must fail */
+  return mismatches == 0 ? 0 : EXIT_FAILURE;
+}
@@ -0,0 +1,365 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "attribute_info.h"
+#include "class_init.h"
+#include "class_loader.h"
+#include "class_writer.h"
+#include "constant_pool.h"
+#include "interpreter.h"
+
+/*
+ * Startup benchmark: writes a class path of `classes` classes Fn,
+ * each with a static int v that <clinit> computes with a loop of
+ * `work` iterations. Fn adds the v of F(n - CHAINS) to it, so the
+ * classes form CHAINS independent chains. Every CYCLE_EVERY-th link of
+ * a chain also has a static int next() reading F(n + CHAINS).v, which
+ * is never called but makes a cycle of the graph without running
+ * anything. All classes are
+ * loaded up front, then a fresh interpreter links and initializes
+ * them in order on one thread, and in parallel on 2, 4 and 8 threads.
+ * The sum of the v checks that every run computed the same.
+ */
+
+#define DEFAULT_CLASSES 512
+#define DEFAULT_WORK 4000
+#define DEFAULT_ROUNDS 5
+#define CHAINS 16
+#define CYCLE_EVERY 8
+#define MAX_THREADS 8
+
+static char directory[] = "/tmp/startup_bench.XXXXXX";
+static int class_count = DEFAULT_CLASSES;
+static int work = DEFAULT_WORK;
+
+static uint16_t put_field_ref(struct buffer* pool, uint16_t* count,
+                              uint16_t class, uint16_t name_and_type) {
+  put_u1(pool, FIELD_REF);
+  put_u2(pool, class);
+  put_u2(pool, name_and_type);
+  return (*count)++;
+}
+
+/*
+ * static { int s = 0; for (int i = 0; i < work; i++) s += i;
+ *          v = s + dep.v; }
+ */
+static void put_clinit(struct buffer* methods, uint16_t name,
+                       uint16_t descriptor, uint16_t code_name,
+                       uint16_t table_name, uint16_t work_index,
+                       uint16_t own_v, uint16_t dep_v) {
+  uint32_t length = dep_v != 0 ? 30 : 26;
+
+  put_u2(methods, ACC_STATIC);
+  put_u2(methods, name);
+  put_u2(methods, descriptor);
+  put_u2(methods, 1);
+
+  put_u2(methods, code_name);
+  put_u4(methods, 12 + length + 6 + 8);
+  put_u2(methods, 2); /* max_stack */
+  put_u2(methods, 2); /* max_locals */
+  put_u4(methods, length);
+  put_u1(methods, 0x03); /* iconst_0 */
+  put_u1(methods, 0x3b); /* istore_0 */
+  put_u1(methods, 0x03); /* iconst_0 */
+  put_u1(methods, 0x3c); /* istore_1 */
+  put_u1(methods, 0x1b); /* 4: iload_1 */
+  put_u1(methods, 0x13); /* ldc_w work */
+  put_u2(methods, work_index);
+  put_u1(methods, 0xa2); /* 8: if_icmpge 21 */
+  put_u2(methods, 13);
+  put_u1(methods, 0x1a); /* iload_0 */
+  put_u1(methods, 0x1b); /* iload_1 */
+  put_u1(methods, 0x60); /* iadd */
+  put_u1(methods, 0x3b); /* istore_0 */
+  put_u1(methods, 0x84); /* iinc 1 1 */
+  put_u1(methods, 1);
+  put_u1(methods, 1);
+  put_u1(methods, 0xa7); /* 18: goto 4 */
+  put_u2(methods, (uint16_t)-14);
+  put_u1(methods, 0x1a); /* 21: iload_0 */
+  if (dep_v != 0) {
+    put_u1(methods, 0xb2); /* getstatic dep.v */
+    put_u2(methods, dep_v);
+    put_u1(methods, 0x60); /* iadd */
+  }
+  put_u1(methods, 0xb3); /* putstatic v */
+  put_u2(methods, own_v);
+  put_u1(methods, 0xb1); /* return */
+  put_u2(methods, 0); /* exception_table_length */
+  put_u2(methods, 1); /* attributes_count */
+  put_u2(methods, table_name);
+  put_u4(methods, 8);
+  put_u2(methods, 2);
+  put_u1(methods, APPEND_FRAME_MIN + 1); /* at 4: + int s, int i */
+  put_u2(methods, 4);
+  put_u1(methods, ITEM_Integer);
+  put_u1(methods, ITEM_Integer);
+  put_u1(methods, SAME_FRAME_MIN + 16); /* at 21: same */
+}
+
+/* static int next() { return next.v; } */
+static void put_next(struct buffer* methods, uint16_t name,
+                     uint16_t descriptor, uint16_t code_name,
+                     uint16_t next_v) {
+  put_u2(methods, ACC_STATIC);
+  put_u2(methods, name);
+  put_u2(methods, descriptor);
+  put_u2(methods, 1);
+
+  put_u2(methods, code_name);
+  put_u4(methods, 12 + 4);
+  put_u2(methods, 1); /* max_stack */
+  put_u2(methods, 0); /* max_locals */
+  put_u4(methods, 4);
+  put_u1(methods, 0xb2); /* getstatic next.v */
+  put_u2(methods, next_v);
+  put_u1(methods, 0xac); /* ireturn */
+  put_u2(methods, 0); /* exception_table_length */
+  put_u2(methods, 0); /* attributes_count */
+}
+
+static void write_file(const char* name, const struct buffer* class) {
+  char path[4096];
+  FILE* file;
+
+  snprintf(path, sizeof(path), "%s/%s.class", directory, name);
+  file = fopen(path, "wb");
+  if (file == NULL ||
+      fwrite(class->data, 1, class->size, file) != class->size) {
+    printf("can't write %s\n", path);
+    exit(EXIT_FAILURE);
+  }
+  fclose(file);
+}
+
+static void write_object(void) {
+  struct buffer pool = {0};
+  struct buffer class = {0};
+  uint16_t count = 1;
+  uint16_t this_class = put_class(&pool, &count, "java/lang/Object");
+
+  put_u4(&class, 0xCAFEBABE);
+  put_u2(&class, 0);
+  put_u2(&class, 52);
+  put_u2(&class, count);
+  put_bytes(&class, pool.data, pool.size);
+  put_u2(&class, 0x0021);
+  put_u2(&class, this_class);
+  put_u2(&class, 0); /* no superclass */
+  put_u2(&class, 0); /* interfaces */
+  put_u2(&class, 0); /* fields */
+  put_u2(&class, 0); /* methods */
+  put_u2(&class, 0); /* attributes */
+  write_file("java/lang/Object", &class);
+  free(pool.data);
+  free(class.data);
+}
+
+static void write_class(int n) {
+  struct buffer pool = {0};
+  struct buffer code = {0};
+  struct buffer class = {0};
+  uint16_t count = 1;
+  uint16_t this_class, super_class, v_name, int_type, v_type;
+  uint16_t own_v, dep_v = 0, next_v = 0, work_index;
+  uint16_t clinit_name, void_type, code_name, table_name;
+  char name[32];
+
+  snprintf(name, sizeof(name), "F%d", n);
+  this_class = put_class(&pool, &count, name);
+  super_class = put_class(&pool, &count, "java/lang/Object");
+  v_name = put_utf8(&pool, &count, "v");
+  int_type = put_utf8(&pool, &count, "I");
+  put_u1(&pool, NAME_AND_TYPE);
+  put_u2(&pool, v_name);
+  put_u2(&pool, int_type);
+  v_type = count++;
+  own_v = put_field_ref(&pool, &count, this_class, v_type);
+  if (n >= CHAINS) {
+    char dep[32];
+    snprintf(dep, sizeof(dep), "F%d", n - CHAINS);
+    dep_v = put_field_ref(&pool, &count, put_class(&pool, &count, dep),
+                          v_type);
+  }
+  if ((n / CHAINS) % CYCLE_EVERY == 0 && n + CHAINS < class_count) {
+    char next[32];
+    snprintf(next, sizeof(next), "F%d", n + CHAINS);
+    next_v = put_field_ref(&pool, &count, put_class(&pool, &count, next),
+                           v_type);
+  }
+  put_u1(&pool, INTEGER);
+  put_u4(&pool, (uint32_t)work);
+  work_index = count++;
+  clinit_name = put_utf8(&pool, &count, "<clinit>");
+  void_type = put_utf8(&pool, &count, "()V");
+  code_name = put_utf8(&pool, &count, "Code");
+  table_name = put_utf8(&pool, &count, "StackMapTable");
+  put_clinit(&code, clinit_name, void_type, code_name, table_name,
+             work_index, own_v, dep_v);
+  if (next_v != 0) {
+    put_next(&code, put_utf8(&pool, &count, "next"),
+             put_utf8(&pool, &count, "()I"), code_name, next_v);
+  }
+
+  put_u4(&class, 0xCAFEBABE);
+  put_u2(&class, 0);
+  put_u2(&class, 52);
+  put_u2(&class, count);
+  put_bytes(&class, pool.data, pool.size);
+  put_u2(&class, 0x0021);
+  put_u2(&class, this_class);
+  put_u2(&class, super_class);
+  put_u2(&class, 0); /* interfaces */
+  put_u2(&class, 1); /* fields: static int v */
+  put_u2(&class, ACC_STATIC);
+  put_u2(&class, v_name);
+  put_u2(&class, int_type);
+  put_u2(&class, 0);
+  put_u2(&class, next_v != 0 ? 2 : 1); /* methods */
+  put_bytes(&class, code.data, code.size);
+  put_u2(&class, 0); /* attributes */
+  write_file(name, &class);
+  free(pool.data);
+  free(code.data);
+  free(class.data);
+}
+
+static void write_class_path(void) {
+  char path[4096];
+  int i;
+
+  snprintf(path, sizeof(path), "%s/java", directory);
+  mkdir(path, 0755);
+  snprintf(path, sizeof(path), "%s/java/lang", directory);
+  mkdir(path, 0755);
+  write_object();
+  for (i = 0; i < class_count; i++) {
+    write_class(i);
+  }
+}
+
+static void remove_class_path(void) {
+  char path[4096];
+  int i;
+
+  for (i = 0; i < class_count; i++) {
+    snprintf(path, sizeof(path), "%s/F%d.class", directory, i);
+    unlink(path);
+  }
+  snprintf(path, sizeof(path), "%s/java/lang/Object.class", directory);
+  unlink(path);
+  snprintf(path, sizeof(path), "%s/java/lang", directory);
+  rmdir(path);
+  snprintf(path, sizeof(path), "%s/java", directory);
+  rmdir(path);
+  rmdir(directory);
+}
+
+/* Seconds to link and initialize every class, best of the rounds */
+static double startup_time(int threads, int rounds, uint64_t* sum,
+                           struct class_init_stats* stats) {
+  struct class_file** classes =
+      malloc((size_t)class_count * sizeof(struct class_file*));
+  double best = 0;
+  int r, i;
+
+  if (classes == NULL) {
+    exit(EXIT_FAILURE);
+  }
+  for (r = 0; r < rounds; r++) {
+    struct class_loader loader;
+    struct interpreter interp;
+    struct interp_thread thread;
+    double start, time;
+    char name[32];
+
+    if (class_loader_init(&loader, directory) != 0 ||
+        interpreter_init(&interp, NULL) != 0 ||
+        interp_thread_init(&thread, &interp, 0) != 0) {
+      exit(EXIT_FAILURE);
+    }
+    interp.resolve_class = class_loader_resolve;
+    interp.resolve_ctx = &loader;
+    for (i = 0; i < class_count; i++) {
+      int length = snprintf(name, sizeof(name), "F%d", i);
+      if (class_loader_load(&loader, (uint8_t*)name, (uint16_t)length,
+                            &classes[i]) != 0) {
+        printf("startup_bench: %s didn't load\n", name);
+        exit(EXIT_FAILURE);
+      }
+    }
+
+    start = now_seconds();
+    if (class_init_all(&thread, classes, (uint32_t)class_count,
+                       (uint32_t)threads, stats) != 0) {
+      printf("startup_bench: %u classes failed to initialize\n",
+             stats->failed);
+      exit(EXIT_FAILURE);
+    }
+    time = now_seconds() - start;
+    if (r == 0 || time < best) {
+      best = time;
+    }
+
+    *sum = 0;
+    for (i = 0; i < class_count; i++) {
+      *sum += (uint32_t)classes[i]->runtime->statics[0].i;
+    }
+    interp_thread_destroy(&thread);
+    class_loader_destroy(&loader);
+    interpreter_destroy(&interp);
+  }
+  free(classes);
+  return best;
+}
+
+int main(int argc, char* argv[]) {
+  int rounds = DEFAULT_ROUNDS;
+  struct class_init_stats stats;
+  double serial_time;
+  uint64_t serial_sum, sum;
+  int threads;
+  int i;
+
+  for (i = 1; i < argc; i++) {
+    if (strncmp(argv[i], "--rounds=", 9) == 0) {
+      rounds = atoi(argv[i] + 9);
+    } else if (strncmp(argv[i], "--classes=", 10) == 0) {
+      class_count = atoi(argv[i] + 10);
+    } else if (strncmp(argv[i], "--work=", 7) == 0) {
+      work = atoi(argv[i] + 7);
+    }
+  }
+  if (class_count < 1 || rounds < 1 || mkdtemp(directory) == NULL) {
+    return EXIT_FAILURE;
+  }
+  write_class_path();
+
+  printf("startup_bench: classes=%d work=%d chains=%d rounds=%d cpus=%ld\n",
+         class_count, work, CHAINS, rounds, sysconf(_SC_NPROCESSORS_ONLN));
+  serial_time = startup_time(1, rounds, &serial_sum, &stats);
+  printf("  in order, 1 thread: %.3f ms\n", serial_time * 1e3);
+  for (threads = 2; threads <= MAX_THREADS; threads *= 2) {
+    double time = startup_time(threads, rounds, &sum, &stats);
+
+    if (sum != serial_sum) {
+      printf("startup_bench: %d threads computed different statics\n",
+             threads);
+      return EXIT_FAILURE;
+    }
+    printf("  parallel, %d threads: %.3f ms (%.2fx), graph of %u classes, "
+           "%u components, largest %u\n",
+           threads, time * 1e3, serial_time / time, stats.reached,
+           stats.components, stats.largest);
+  }
+  remove_class_path();
+  return 0;
+}
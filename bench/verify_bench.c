@@ -0,0 +1,685 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "class_archive.h"
+#include "class_cache.h"
+#include "class_layout.h"
+#include "class_writer.h"
+#include "classfile_parser.h"
+#include "descriptor.h"
+#include "verifier.h"
+
+/*
+ * Class loading benchmark: parses and verifies a corpus of class files
+ * held in memory and reports the share of verification in load time.
+ * The corpus is every class file given on the command line (files or
+ * directories, tests/ by default) plus a generated class with many
+ * looping methods, each with its own StackMapTable. The same corpus is
+ * then loaded through a class cache in a temporary directory, once
+ * cold and `rounds` times warm, and from a class archive that is
+ * mapped and searched for every class `rounds` times.
+ *
+ * Before that, small generated classes that break the type rules the
+ * StackMapTable can't show, array element kinds, the class of a
+ * receiver or argument and the class a handler catches, must fail verification at load or at link
+ * time and their well-typed twins must pass.
+ */
+
+#define DEFAULT_ROUNDS 200
+#define SYNTH_METHODS 2000
+#define SYNTH_BODY 16 /* arithmetic groups inside every loop */
+#define MAX_CORPUS 1024
+
+struct corpus_entry {
+  uint8_t* bytes;
+  size_t size;
+};
+
+static struct corpus_entry corpus[MAX_CORPUS];
+static size_t corpus_count;
+
+/*
+ * static Object mN(Object a, int n) {
+ *   Object x = null;
+ *   for (int i = 0; i < n; i++) { x = new Object(); i * 2 ... }
+ *   return x;
+ * }
+ */
+static void put_synth_method(struct buffer* methods, uint16_t name,
+                             uint16_t descriptor, uint16_t code_name,
+                             uint16_t table_name, uint16_t object,
+                             uint16_t init) {
+  uint16_t end = 17 + 4 * SYNTH_BODY + 6;
+  uint32_t code_length = end + 2u;
+  uint32_t table_length = 2 + 6 + 1 + 3;
+  int i;
+
+  put_u2(methods, ACC_STATIC);
+  put_u2(methods, name);
+  put_u2(methods, descriptor);
+  put_u2(methods, 1);
+
+  put_u2(methods, code_name);
+  put_u4(methods, 12 + code_length + 6 + table_length);
+  put_u2(methods, 2); /* max_stack */
+  put_u2(methods, 4); /* max_locals */
+  put_u4(methods, code_length);
+
+  put_u1(methods, 0x01); /* aconst_null */
+  put_u1(methods, 0x4d); /* astore_2 */
+  put_u1(methods, 0x03); /* iconst_0 */
+  put_u1(methods, 0x3e); /* istore_3 */
+  put_u1(methods, 0x1d); /* 4: iload_3 */
+  put_u1(methods, 0x1b); /* iload_1 */
+  put_u1(methods, 0xa2); /* if_icmpge end */
+  put_u2(methods, (uint16_t)(end - 6));
+  put_u1(methods, 0xbb); /* new java/lang/Object */
+  put_u2(methods, object);
+  put_u1(methods, 0x59); /* dup */
+  put_u1(methods, 0xb7); /* invokespecial <init> */
+  put_u2(methods, init);
+  put_u1(methods, 0x4d); /* astore_2 */
+  for (i = 0; i < SYNTH_BODY; i++) {
+    put_u1(methods, 0x1d); /* iload_3 */
+    put_u1(methods, 0x05); /* iconst_2 */
+    put_u1(methods, 0x68); /* imul */
+    put_u1(methods, 0x57); /* pop */
+  }
+  put_u1(methods, 0x84); /* iinc 3 1 */
+  put_u1(methods, 3);
+  put_u1(methods, 1);
+  put_u1(methods, 0xa7); /* goto 4 */
+  put_u2(methods, (uint16_t)(4 - (end - 3)));
+  put_u1(methods, 0x2c); /* end: aload_2 */
+  put_u1(methods, 0xb0); /* areturn */
+
+  put_u2(methods, 0); /* exception_table_length */
+  put_u2(methods, 1); /* attributes_count */
+  put_u2(methods, table_name);
+  put_u4(methods, table_length);
+  put_u2(methods, 2);
+  put_u1(methods, APPEND_FRAME_MIN + 1); /* at 4: + Object x, int i */
+  put_u2(methods, 4);
+  put_u1(methods, ITEM_Object);
+  put_u2(methods, object);
+  put_u1(methods, ITEM_Integer);
+  put_u1(methods, CHOP_FRAME_MAX); /* at end: - int i */
+  put_u2(methods, (uint16_t)(end - 4 - 1));
+}
+
+static void add_synth_class(void) {
+  struct buffer pool = {0};
+  struct buffer methods = {0};
+  struct buffer class = {0};
+  uint16_t count = 1;
+  uint16_t object_name, object, this_name, this_class, init_name, void_desc;
+  uint16_t name_and_type, init, code_name, table_name, descriptor;
+  char name[16];
+  int i;
+
+  object_name = put_utf8(&pool, &count, "java/lang/Object");
+  put_u1(&pool, CLASS);
+  put_u2(&pool, object_name);
+  object = count++;
+  this_name = put_utf8(&pool, &count, "Synth");
+  put_u1(&pool, CLASS);
+  put_u2(&pool, this_name);
+  this_class = count++;
+  init_name = put_utf8(&pool, &count, "<init>");
+  void_desc = put_utf8(&pool, &count, "()V");
+  put_u1(&pool, NAME_AND_TYPE);
+  put_u2(&pool, init_name);
+  put_u2(&pool, void_desc);
+  name_and_type = count++;
+  put_u1(&pool, METHOD_REF);
+  put_u2(&pool, object);
+  put_u2(&pool, name_and_type);
+  init = count++;
+  code_name = put_utf8(&pool, &count, "Code");
+  table_name = put_utf8(&pool, &count, "StackMapTable");
+  descriptor =
+      put_utf8(&pool, &count, "(Ljava/lang/Object;I)Ljava/lang/Object;");
+
+  for (i = 0; i < SYNTH_METHODS; i++) {
+    snprintf(name, sizeof(name), "m%d", i);
+    put_synth_method(&methods, put_utf8(&pool, &count, name), descriptor,
+                     code_name, table_name, object, init);
+  }
+
+  put_u4(&class, 0xCAFEBABE);
+  put_u2(&class, 0);
+  put_u2(&class, 52);
+  put_u2(&class, count);
+  put_bytes(&class, pool.data, pool.size);
+  put_u2(&class, 0x0021);
+  put_u2(&class, this_class);
+  put_u2(&class, object);
+  put_u2(&class, 0); /* interfaces */
+  put_u2(&class, 0); /* fields */
+  put_u2(&class, SYNTH_METHODS);
+  put_bytes(&class, methods.data, methods.size);
+  put_u2(&class, 0); /* attributes */
+
+  free(pool.data);
+  free(methods.data);
+  corpus[corpus_count].bytes = class.data;
+  corpus[corpus_count++].size = class.size;
+}
+
+static int parse_entry(const struct corpus_entry* entry,
+                       struct class_file* class) {
+  Loader loader = {.buffer = entry->bytes, .size = entry->size};
+
+  init_class_file(class);
+  if (parse_class(&loader, class) != 0) {
+    free_class_file(class);
+    return 1;
+  }
+  return 0;
+}
+
+/* Type checks */
+
+/*
+ * The member reference a test method uses is the first constant so
+ * its index is known: class name, class, name, descriptor,
+ * name and type and the reference itself
+ */
+#define TEST_REF 6
+
+struct test_method {
+  const char* what;
+  int valid; /* passes verification with the classes linked */
+  const char* descriptor;
+  uint8_t ref_tag; /* 0 when the code refers to no member */
+  const char* ref_class;
+  const char* ref_name;
+  const char* ref_descriptor;
+  uint8_t max_stack;
+  uint8_t max_locals;
+  uint8_t code_length;
+  uint8_t code[8];
+};
+
+/* class A { int f; }, class B { int f; void m(); } and class C extends A */
+static const struct test_method test_methods[] = {
+    /* iconst_1, newarray int, iconst_0, daload, pop2, return */
+    {"daload from int[]", 0, "()V", 0, NULL, NULL, NULL, 2, 0, 7,
+     {0x04, 0xbc, T_INT, 0x03, 0x31, 0x58, 0xb1}},
+    /* iconst_1, newarray int, iconst_0, lconst_0, lastore, return */
+    {"lastore into int[]", 0, "()V", 0, NULL, NULL, NULL, 4, 0, 7,
+     {0x04, 0xbc, T_INT, 0x03, 0x09, 0x50, 0xb1}},
+    /* iconst_1, newarray int, iconst_0, aaload, pop, return */
+    {"aaload from int[]", 0, "()V", 0, NULL, NULL, NULL, 2, 0, 7,
+     {0x04, 0xbc, T_INT, 0x03, 0x32, 0x57, 0xb1}},
+    /* iconst_1, newarray char, iconst_0, baload, pop, return */
+    {"baload from char[]", 0, "()V", 0, NULL, NULL, NULL, 2, 0, 7,
+     {0x04, 0xbc, T_CHAR, 0x03, 0x33, 0x57, 0xb1}},
+    /* iconst_1, newarray boolean, iconst_0, baload, pop, return */
+    {"baload from boolean[]", 1, "()V", 0, NULL, NULL, NULL, 2, 0, 7,
+     {0x04, 0xbc, T_BOOLEAN, 0x03, 0x33, 0x57, 0xb1}},
+    /* aload_0, getfield, ireturn */
+    {"getfield B.f on an A", 0, "(LA;)I", FIELD_REF, "B", "f", "I", 1, 1, 5,
+     {0x2a, 0xb4, 0, TEST_REF, 0xac}},
+    {"getfield A.f on a C", 1, "(LC;)I", FIELD_REF, "A", "f", "I", 1, 1, 5,
+     {0x2a, 0xb4, 0, TEST_REF, 0xac}},
+    /* aload_0, iconst_0, putfield, return */
+    {"putfield B.f on an A", 0, "(LA;)V", FIELD_REF, "B", "f", "I", 2, 1, 6,
+     {0x2a, 0x03, 0xb5, 0, TEST_REF, 0xb1}},
+    /* aload_0, invokevirtual, return */
+    {"invokevirtual B.m on an A", 0, "(LA;)V", METHOD_REF, "B", "m", "()V", 1,
+     1, 5, {0x2a, 0xb6, 0, TEST_REF, 0xb1}},
+    /* aload_0, invokestatic, return */
+    {"A passed as a B", 0, "(LA;)V", METHOD_REF, "B", "take", "(LB;)V", 1, 1,
+     5, {0x2a, 0xb8, 0, TEST_REF, 0xb1}},
+    /* aload_0, areturn */
+    {"A returned as a B", 0, "(LA;)LB;", 0, NULL, NULL, NULL, 1, 1, 2,
+     {0x2a, 0xb0}},
+    {"C returned as an A", 1, "(LC;)LA;", 0, NULL, NULL, NULL, 1, 1, 2,
+     {0x2a, 0xb0}},
+};
+
+/* A class with the pool built so far and `methods_count` methods */
+static void finish_class(struct buffer* class, struct buffer* pool,
+                         uint16_t count, const char* name, const char* super,
+                         const struct buffer* methods,
+                         uint16_t methods_count) {
+  uint16_t this_class = put_class(pool, &count, name);
+  uint16_t super_class = put_class(pool, &count, super);
+
+  put_u4(class, 0xCAFEBABE);
+  put_u2(class, 0);
+  put_u2(class, 52);
+  put_u2(class, count);
+  put_bytes(class, pool->data, pool->size);
+  put_u2(class, 0x0021);
+  put_u2(class, this_class);
+  put_u2(class, super_class);
+  put_u2(class, 0); /* interfaces */
+  put_u2(class, 0); /* fields */
+  put_u2(class, methods_count);
+  put_bytes(class, methods->data, methods->size);
+  put_u2(class, 0); /* attributes */
+}
+
+/* `static <descriptor> test()` in class T */
+static void build_test_class(struct buffer* class,
+                             const struct test_method* test) {
+  struct buffer pool = {0};
+  struct buffer methods = {0};
+  uint16_t count = 1;
+  uint16_t name, descriptor, code_name;
+
+  if (test->ref_tag != 0) {
+    uint16_t ref_class = put_class(&pool, &count, test->ref_class);
+    uint16_t ref_name = put_utf8(&pool, &count, test->ref_name);
+    uint16_t ref_descriptor = put_utf8(&pool, &count, test->ref_descriptor);
+
+    put_u1(&pool, NAME_AND_TYPE);
+    put_u2(&pool, ref_name);
+    put_u2(&pool, ref_descriptor);
+    count++;
+    put_u1(&pool, test->ref_tag);
+    put_u2(&pool, ref_class);
+    put_u2(&pool, (uint16_t)(count - 1));
+    count++;
+  }
+  name = put_utf8(&pool, &count, "test");
+  descriptor = put_utf8(&pool, &count, test->descriptor);
+  code_name = put_utf8(&pool, &count, "Code");
+
+  put_u2(&methods, ACC_STATIC);
+  put_u2(&methods, name);
+  put_u2(&methods, descriptor);
+  put_u2(&methods, 1);
+  put_u2(&methods, code_name);
+  put_u4(&methods, 12u + test->code_length);
+  put_u2(&methods, test->max_stack);
+  put_u2(&methods, test->max_locals);
+  put_u4(&methods, test->code_length);
+  put_bytes(&methods, test->code, test->code_length);
+  put_u2(&methods, 0); /* exception_table_length */
+  put_u2(&methods, 0); /* attributes_count */
+
+  finish_class(class, &pool, count, "T", "java/lang/Object", &methods, 1);
+  free(pool.data);
+  free(methods.data);
+}
+
+/*
+ * `static void test()` whose return is covered by a handler catching
+ * `catch_class` (any Throwable when NULL) into a frame holding a
+ * `frame_type`: return, handler: pop, return
+ */
+struct test_handler {
+  const char* what;
+  int valid;
+  const char* catch_class;
+  const char* frame_type;
+};
+
+static const struct test_handler test_handlers[] = {
+    {"any Throwable caught into an int[]", 0, NULL, "[I"},
+    {"int[] caught", 0, "[I", "java/lang/Object"},
+    {"A caught into a C", 0, "A", "C"},
+    {"C caught into an A", 1, "C", "A"},
+};
+
+static void build_handler_class(struct buffer* class,
+                                const struct test_handler* test) {
+  static const uint8_t code[] = {0xb1, 0x57, 0xb1};
+  struct buffer pool = {0};
+  struct buffer methods = {0};
+  uint16_t count = 1;
+  uint16_t catch_class = test->catch_class != NULL
+                             ? put_class(&pool, &count, test->catch_class)
+                             : 0;
+  uint16_t frame_type = put_class(&pool, &count, test->frame_type);
+  uint16_t name = put_utf8(&pool, &count, "test");
+  uint16_t descriptor = put_utf8(&pool, &count, "()V");
+  uint16_t code_name = put_utf8(&pool, &count, "Code");
+  uint16_t table_name = put_utf8(&pool, &count, "StackMapTable");
+
+  put_u2(&methods, ACC_STATIC);
+  put_u2(&methods, name);
+  put_u2(&methods, descriptor);
+  put_u2(&methods, 1);
+  put_u2(&methods, code_name);
+  put_u4(&methods, 12u + sizeof(code) + 8 + 6 + 6);
+  put_u2(&methods, 1); /* max_stack */
+  put_u2(&methods, 0); /* max_locals */
+  put_u4(&methods, sizeof(code));
+  put_bytes(&methods, code, sizeof(code));
+  put_u2(&methods, 1); /* exception_table_length */
+  put_u2(&methods, 0);
+  put_u2(&methods, 1);
+  put_u2(&methods, 1);
+  put_u2(&methods, catch_class);
+  put_u2(&methods, 1); /* attributes_count */
+  put_u2(&methods, table_name);
+  put_u4(&methods, 6);
+  put_u2(&methods, 1);
+  put_u1(&methods, SAME_LOCALS_1_STACK_ITEM_MIN + 1); /* at 1: exception */
+  put_u1(&methods, ITEM_Object);
+  put_u2(&methods, frame_type);
+
+  finish_class(class, &pool, count, "T", "java/lang/Object", &methods, 1);
+  free(pool.data);
+  free(methods.data);
+}
+
+static int parse_buffer(const struct buffer* buffer, struct class_file* class) {
+  struct corpus_entry entry = {.bytes = buffer->data, .size = buffer->size};
+  return parse_entry(&entry, class);
+}
+
+/* The classes the test methods refer to, by name */
+static struct class_file test_classes[3];
+static const char* const test_class_names[] = {"A", "B", "C"};
+
+static struct class_file* resolve_test_class(const uint8_t* name,
+                                             uint16_t length, void* ctx) {
+  size_t i;
+
+  (void)ctx;
+  for (i = 0; i < 3; i++) {
+    if (is_string_match((const char*)name, length, test_class_names[i])) {
+      return &test_classes[i];
+    }
+  }
+  return NULL;
+}
+
+/* Returns 1 if the test class was verified the wrong way */
+static int check_test_class(struct verifier* verifier, struct buffer* buffer,
+                            const char* what, int expected) {
+  struct class_file class;
+  int valid;
+
+  if (parse_buffer(buffer, &class) != 0) {
+    exit(EXIT_FAILURE);
+  }
+  valid = verify_class(verifier, &class) == 0 &&
+          verify_class_links(verifier, &class, resolve_test_class, NULL) == 0;
+  free_class_file(&class);
+  free(buffer->data);
+  if (valid != expected) {
+    printf("verify_bench: %s was %s\n", what, valid ? "accepted" : "rejected");
+    return 1;
+  }
+  return 0;
+}
+
+/* Returns how many test methods were verified the wrong way */
+static int check_type_rules(struct verifier* verifier) {
+  static const char* const supers[] = {"java/lang/Object",
+                                       "java/lang/Object", "A"};
+  int wrong = 0;
+  size_t i;
+
+  for (i = 0; i < 3; i++) {
+    struct buffer class = {0};
+    struct buffer pool = {0};
+    struct buffer methods = {0};
+
+    finish_class(&class, &pool, 1, test_class_names[i], supers[i], &methods,
+                 0);
+    if (parse_buffer(&class, &test_classes[i]) != 0) {
+      exit(EXIT_FAILURE);
+    }
+    free(class.data);
+    free(pool.data);
+  }
+
+  for (i = 0; i < sizeof(test_methods) / sizeof(test_methods[0]); i++) {
+    struct buffer buffer = {0};
+
+    build_test_class(&buffer, &test_methods[i]);
+    wrong += check_test_class(verifier, &buffer, test_methods[i].what,
+                              test_methods[i].valid);
+  }
+  for (i = 0; i < sizeof(test_handlers) / sizeof(test_handlers[0]); i++) {
+    struct buffer buffer = {0};
+
+    build_handler_class(&buffer, &test_handlers[i]);
+    wrong += check_test_class(verifier, &buffer, test_handlers[i].what,
+                              test_handlers[i].valid);
+  }
+
+  for (i = 0; i < 3; i++) {
+    free_class_file(&test_classes[i]);
+  }
+  return wrong;
+}
+
+static void add_file(const char* path) {
+  FILE* file = fopen(path, "rb");
+  long size;
+
+  if (file == NULL || corpus_count == MAX_CORPUS) {
+    if (file != NULL) {
+      fclose(file);
+    }
+    return;
+  }
+  fseek(file, 0, SEEK_END);
+  size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  corpus[corpus_count].bytes = malloc((size_t)size);
+  corpus[corpus_count].size = (size_t)size;
+  if (corpus[corpus_count].bytes != NULL &&
+      fread(corpus[corpus_count].bytes, 1, (size_t)size, file) ==
+          (size_t)size) {
+    corpus_count++;
+  }
+  fclose(file);
+}
+
+static void add_path(const char* path) {
+  DIR* dir = opendir(path);
+  struct dirent* entry;
+  char file[4096];
+
+  if (dir == NULL) {
+    add_file(path);
+    return;
+  }
+  while ((entry = readdir(dir)) != NULL) {
+    size_t length = strlen(entry->d_name);
+    if (length > 6 && strcmp(entry->d_name + length - 6, ".class") == 0) {
+      snprintf(file, sizeof(file), "%s/%s", path, entry->d_name);
+      add_file(file);
+    }
+  }
+  closedir(dir);
+}
+
+/* Loads the corpus through the cache, returns seconds per pass */
+static double cached_load(struct class_cache* cache, int rounds) {
+  double start = now_seconds();
+  size_t i;
+  int r;
+
+  for (r = 0; r < rounds; r++) {
+    for (i = 0; i < corpus_count; i++) {
+      struct class_file class;
+      if (class_cache_load(cache, corpus[i].bytes, corpus[i].size, &class) !=
+          0) {
+        exit(EXIT_FAILURE);
+      }
+      free_class_file(&class);
+    }
+  }
+  return (now_seconds() - start) / rounds;
+}
+
+/* Maps the archive and finds every class, returns seconds per pass */
+static double archive_load(const char* path, struct class_file* classes,
+                           int rounds, int* relocated) {
+  double start = now_seconds();
+  struct UTF8_info* name;
+  char binary_name[1024];
+  size_t i;
+  int r;
+
+  for (r = 0; r < rounds; r++) {
+    struct class_archive archive;
+
+    if (class_archive_map(&archive, path) != 0) {
+      exit(EXIT_FAILURE);
+    }
+    *relocated = archive.relocated;
+    for (i = 0; i < corpus_count; i++) {
+      struct class_file class;
+
+      name = constant_class_name(&classes[i], classes[i].this_class);
+      snprintf(binary_name, sizeof(binary_name), "%.*s", name->lenght,
+               (const char*)name->bytes);
+      if (class_archive_find(&archive, binary_name, 0, &class) != 0) {
+        exit(EXIT_FAILURE);
+      }
+      free_class_file(&class);
+    }
+    class_archive_unmap(&archive);
+  }
+  return (now_seconds() - start) / rounds;
+}
+
+static void remove_directory(const char* path) {
+  DIR* dir = opendir(path);
+  struct dirent* entry;
+  char file[4096];
+
+  if (dir == NULL) {
+    return;
+  }
+  while ((entry = readdir(dir)) != NULL) {
+    if (entry->d_name[0] != '.') {
+      snprintf(file, sizeof(file), "%s/%s", path, entry->d_name);
+      unlink(file);
+    }
+  }
+  closedir(dir);
+  rmdir(path);
+}
+
+int main(int argc, char* argv[]) {
+  int rounds = DEFAULT_ROUNDS;
+  struct class_file* classes;
+  struct verifier verifier;
+  struct class_cache cache;
+  char cache_dir[] = "/tmp/verify_bench.XXXXXX";
+  char archive_path[4096];
+  double start, parse_time, verify_time, cold_time, warm_time, archive_time;
+  int relocated = 0;
+  size_t bytes = 0;
+  size_t i;
+  int r;
+
+  for (r = 1; r < argc; r++) {
+    if (strncmp(argv[r], "--rounds=", 9) == 0) {
+      rounds = atoi(argv[r] + 9);
+    } else {
+      add_path(argv[r]);
+    }
+  }
+  if (corpus_count == 0) {
+    add_path("tests");
+  }
+  add_synth_class();
+
+  classes = calloc(corpus_count, sizeof(struct class_file));
+  if (classes == NULL) {
+    return EXIT_FAILURE;
+  }
+  for (i = 0; i < corpus_count; i++) {
+    bytes += corpus[i].size;
+    if (parse_entry(&corpus[i], &classes[i]) != 0) {
+      return EXIT_FAILURE;
+    }
+  }
+
+  start = now_seconds();
+  for (r = 0; r < rounds; r++) {
+    for (i = 0; i < corpus_count; i++) {
+      struct class_file class;
+      if (parse_entry(&corpus[i], &class) != 0) {
+        return EXIT_FAILURE;
+      }
+      free_class_file(&class);
+    }
+  }
+  parse_time = (now_seconds() - start) / rounds;
+
+  verifier_init(&verifier);
+  if (check_type_rules(&verifier) != 0) {
+    return EXIT_FAILURE;
+  }
+  verifier.stats = (struct verifier_stats){0};
+  start = now_seconds();
+  for (r = 0; r < rounds; r++) {
+    for (i = 0; i < corpus_count; i++) {
+      if (verify_class(&verifier, &classes[i]) != 0) {
+        return EXIT_FAILURE;
+      }
+    }
+  }
+  verify_time = (now_seconds() - start) / rounds;
+
+  if (mkdtemp(cache_dir) == NULL ||
+      class_cache_init(&cache, cache_dir) != 0) {
+    return EXIT_FAILURE;
+  }
+  cold_time = cached_load(&cache, 1);
+  warm_time = cached_load(&cache, rounds);
+
+  snprintf(archive_path, sizeof(archive_path), "%s/classes.jsa", cache_dir);
+  if (class_archive_link(classes, corpus_count) != 0 ||
+      class_archive_dump(archive_path, classes, corpus_count, NULL) != 0) {
+    return EXIT_FAILURE;
+  }
+  archive_time = archive_load(archive_path, classes, rounds, &relocated);
+
+  printf("verify_bench: classes=%zu bytes=%zu rounds=%d\n", corpus_count,
+         bytes, rounds);
+  printf("  methods=%llu instructions=%llu frames=%llu code=%llu bytes\n",
+         (unsigned long long)(verifier.stats.methods / (uint64_t)rounds),
+         (unsigned long long)(verifier.stats.instructions / (uint64_t)rounds),
+         (unsigned long long)(verifier.stats.frames / (uint64_t)rounds),
+         (unsigned long long)(verifier.stats.code_bytes / (uint64_t)rounds));
+  printf("  parse:  %.3f ms per corpus, %.1f MB/s\n", parse_time * 1e3,
+         (double)bytes / parse_time / 1e6);
+  printf("  verify: %.3f ms per corpus, %.1f M instructions/s, "
+         "%zu type rule checks passed\n",
+         verify_time * 1e3,
+         (double)verifier.stats.instructions / rounds / verify_time / 1e6,
+         sizeof(test_methods) / sizeof(test_methods[0]) +
+             sizeof(test_handlers) / sizeof(test_handlers[0]));
+  printf("  verification share of load time: %.1f%%\n",
+         100.0 * verify_time / (parse_time + verify_time));
+  printf("  cached: cold %.3f ms, warm %.3f ms per corpus, %.1fx faster "
+         "than parse + verify\n",
+         cold_time * 1e3, warm_time * 1e3,
+         (parse_time + verify_time) / warm_time);
+  class_cache_print_stats(&cache);
+  printf("  archive: %.3f ms per corpus (%s), %.1fx faster than parse + "
+         "verify\n",
+         archive_time * 1e3, relocated ? "relocated" : "mapped at base",
+         (parse_time + verify_time) / archive_time);
+
+  class_cache_destroy(&cache);
+  remove_directory(cache_dir);
+  verifier_destroy(&verifier);
+  for (i = 0; i < corpus_count; i++) {
+    free_class_file(&classes[i]);
+    free(corpus[i].bytes);
+  }
+  free(classes);
+  return 0;
+}
@@ -46,6 +46,10 @@
 #define ACC_ANNOTATION  0x2000
 #define ACC_ENUM        0x4000
 
+/* Method access flags */
+#define ACC_SYNCHRONIZED 0x0020
+#define ACC_NATIVE       0x0100
+
 #define ATTRIBUTE_ConstantValue 0
 #define ATTRIBUTE_Code 1
 #define ATTRIBUTE_StackMapTable 2
@@ -1410,4 +1414,18 @@ struct ModuleMainClass_attribute {
   uint16_t main_class_index;
 };
 
+struct class_file;
+
+struct attribute_info* find_attribute(struct class_file* class,
+                                      struct attribute_info* attributes,
+                                      uint16_t count, const char* name);
+int parse_code_attribute(struct class_file* class,
+                         const struct attribute_info* attr,
+                         struct Code_attribute* code);
+void free_code_attribute(struct Code_attribute* code);
+int parse_stack_map_table(const struct attribute_info* attr,
+                          struct StackMapTable_attribute* table);
+void free_stack_map_table(struct StackMapTable_attribute* table);
+uint16_t stack_map_frame_offset_delta(const union stack_map_frame* frame);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,72 @@
+#ifndef SHIP_JVM_BOOTSTRAP_H
+#define SHIP_JVM_BOOTSTRAP_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "classfile.h"
+#include "interpreter.h"
+
+/*
+ * invokedynamic call sites and dynamic constants.
+ *
+ * Both name a bootstrap method in the class's BootstrapMethods
+ * attribute, which runs once: for each invokedynamic instruction, and
+ * for each Dynamic constant pool entry. The result is kept, later
+ * executions use it without looking at the bootstrap method again. A
+ * failed bootstrap fails every later execution the same way.
+ *
+ * There is no java.lang.invoke here, so the bootstrap method is a
+ * static method (REF_invokeStatic) called with only the static
+ * arguments, which must be numeric or dynamic constants, and without
+ * the lookup, name and type. A dynamic constant is the value the
+ * bootstrap method returns, converted by the constant's type. A call
+ * site is bound as by a ConstantCallSite over
+ * lookup.findStatic(bootstrap class, name, type): to the static method
+ * with the site's name and type found from the bootstrap method's
+ * class, which the bootstrap method may still reject by throwing.
+ *
+ * Linking numbers the invokedynamic instructions of each method. The
+ * interpreter copy of the code gets the number in the two zero bytes
+ * after the instruction's operand, so a site is found without a
+ * lookup.
+ */
+
+#define CALL_SITE_UNLINKED 0
+#define CALL_SITE_LINKED 1
+#define CALL_SITE_FAILED 2
+
+struct call_site {
+  struct class_file* class;   /* CALL_SITE_LINKED: the target */
+  struct method_info* method;
+  _Atomic(uint8_t) state;     /* CALL_SITE_* */
+};
+
+/* cp_cache_entry.resolved of a Dynamic entry whose bootstrap failed */
+#define DYNAMIC_CONSTANT_FAILED 2
+
+/**
+ * Numbers the invokedynamic instructions of the code in *copy, which
+ * is made from the code if NULL. Leaves the number of sites in *count,
+ * the copy is untouched when there are none. ENOMEM without memory
+ */
+int bootstrap_number_sites(const struct Code_attribute* code, uint8_t** copy,
+                           uint16_t* count);
+
+/**
+ * Links a call site of `class` for the InvokeDynamic entry at index,
+ * running the bootstrap method unless the site is already linked or
+ * failed. INTERP_EXCEPTION with a pending exception on failure
+ */
+int bootstrap_link_site(struct interp_thread* thread, struct class_file* class,
+                        struct call_site* site, uint16_t index);
+
+/**
+ * Value of the Dynamic entry at index, resolved once. INTERP_EXCEPTION
+ * with a pending exception on failure
+ */
+int bootstrap_resolve_constant(struct interp_thread* thread,
+                               struct class_file* class, uint16_t index,
+                               union java_value* value);
+
+#endif
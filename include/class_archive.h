@@ -0,0 +1,67 @@
+#ifndef SHIP_JVM_CLASS_ARCHIVE_H
+#define SHIP_JVM_CLASS_ARCHIVE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "classfile.h"
+
+/*
+ * Class data sharing archive: parsed, verified and linked classes
+ * (layouts and oop maps included) dumped into one file that is mapped
+ * read-only at startup.
+ *
+ * The file is a single class image (class_image.h) written for the
+ * requested base address. When the mapping lands there nothing is
+ * touched and every process mapping the archive shares its pages.
+ * Otherwise the archive is mapped privately, relocated once and then
+ * made read-only again. The class table uses offsets, so lookups
+ * never need fixing.
+ *
+ * Each entry keeps the hash of the class file it was dumped from. A
+ * lookup given the hash of the file on disk returns ESTALE when the
+ * class changed since the dump, the caller then parses the file.
+ */
+
+#define CLASS_ARCHIVE_MAGIC 0x4143564au /* "JVCA" */
+#define CLASS_ARCHIVE_BASE ((uintptr_t)0x800000000)
+
+/**
+ * Header at offset 0 of the archive
+ */
+struct class_archive_header {
+  uint32_t magic;
+  uint32_t abi;       /* class_image_abi() of the writer */
+  uint64_t base;      /* requested mapping address */
+  uint64_t size;      /* bytes mapped, equal to the file size */
+  uint64_t table;     /* offset of the class table */
+  uint32_t class_count;
+  uint32_t reserved;
+};
+
+/**
+ * Class table entry, the table is sorted by name_hash
+ */
+struct class_archive_entry {
+  uint64_t name_hash;   /* hash64 of the binary name, e.g. java/lang/Object */
+  uint64_t class;       /* offset of the class_file */
+  uint64_t source_hash; /* hash64 of the class file it was loaded from */
+};
+
+struct class_archive {
+  uint8_t* base;
+  size_t size;
+  const struct class_archive_header* header;
+  const struct class_archive_entry* entries;
+  int relocated; /* not mapped at the requested base */
+};
+
+int class_archive_link(struct class_file* classes, size_t count);
+int class_archive_dump(const char* path, struct class_file* classes,
+                       size_t count, const uint64_t* source_hashes);
+int class_archive_map(struct class_archive* archive, const char* path);
+void class_archive_unmap(struct class_archive* archive);
+int class_archive_find(const struct class_archive* archive, const char* name,
+                       uint64_t source_hash, struct class_file* class);
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef SHIP_JVM_CLASS_CACHE_H
+#define SHIP_JVM_CLASS_CACHE_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "classfile.h"
+
+/*
+ * On-disk cache of parsed and verified classes. An entry is named
+ * after the hash of the class file bytes and holds a class image
+ * (class_image.h) of a class that passed verification, so loading
+ * the same bytes again, from any path or jar, skips both the parser
+ * and the verifier. Entries are written to a temporary file and
+ * renamed, several processes may share one directory. Threads may
+ * share one cache, every load verifies with a verifier of its own.
+ */
+
+#define CLASS_CACHE_MAGIC 0x4343564au /* "JVCC" */
+#define CLASS_CACHE_SEED 0x5348495050524f4aull
+#define CLASS_CACHE_VERIFIED 1
+
+/**
+ * Header of a cache entry, the class image follows it
+ */
+struct class_cache_header {
+  uint32_t magic;
+  uint32_t abi;       /* class_image_abi() of the writer */
+  uint64_t hash;      /* hash64 of the class file, seed 0 */
+  uint64_t check;     /* hash64 of the class file, CLASS_CACHE_SEED */
+  uint64_t class_size;
+  uint64_t image_base; /* address the image pointers are written for */
+  uint64_t image_size;
+  uint64_t image_check; /* hash64 of the image, CLASS_CACHE_SEED */
+  uint32_t flags;
+  uint32_t reserved;
+};
+
+struct class_cache_stats {
+  _Atomic(uint64_t) lookups;
+  _Atomic(uint64_t) hits;
+  _Atomic(uint64_t) misses;
+  _Atomic(uint64_t) stores;
+  _Atomic(uint64_t) rejected; /* entries that failed validation */
+};
+
+struct class_cache {
+  char* directory;
+  struct class_cache_stats stats;
+};
+
+int class_cache_init(struct class_cache* cache, const char* directory);
+void class_cache_destroy(struct class_cache* cache);
+int class_cache_load(struct class_cache* cache, const uint8_t* bytes,
+                     size_t size, struct class_file* class);
+int class_cache_load_file(struct class_cache* cache, const char* path,
+                          struct class_file* class);
+/* class_cache_load_file() of a file open for reading, `path` names it */
+int class_cache_load_stream(struct class_cache* cache, FILE* file,
+                            const char* path, struct class_file* class);
+void class_cache_print_stats(const struct class_cache* cache);
+
+#endif
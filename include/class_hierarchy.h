@@ -0,0 +1,130 @@
+#ifndef SHIP_JVM_CLASS_HIERARCHY_H
+#define SHIP_JVM_CLASS_HIERARCHY_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "classfile.h"
+#include "interpreter.h"
+
+/*
+ * Class hierarchy analysis. Linking a class records it as a subtype
+ * of its superclass and of each of its direct superinterfaces, so
+ * the loaded part of the hierarchy can be walked downwards. The
+ * optimizing compiler asks whether a method has overriders and
+ * whether an interface has a single implementor, and turns virtual
+ * calls into direct ones when the answer allows it.
+ *
+ * Every answer the compiler relies on becomes an assumption in the
+ * dependencies of the compiled method. Linking a class that breaks
+ * one invalidates the method before the class can be instantiated:
+ * its entry is withdrawn and call sites still bound to the code leave
+ * it at once through cha_reenter(). Compiled code only gets references
+ * from its arguments, so an activation that passed the entry check
+ * never sees an instance of a class linked after it.
+ */
+
+#define CHA_NO_OVERRIDER 0       /* no loaded subclass overrides method */
+#define CHA_UNIQUE_IMPLEMENTOR 1 /* implementor is the only one of class */
+
+struct cha_assumption {
+  uint8_t kind;               /* CHA_* */
+  struct class_file* class;   /* holder of the method, or the interface */
+  struct method_info* method; /* CHA_NO_OVERRIDER */
+  struct class_file* implementor; /* CHA_UNIQUE_IMPLEMENTOR */
+};
+
+/* Assumptions one compiled method was built on */
+struct cha_dependencies {
+  struct cha_dependencies* next; /* registered with the hierarchy */
+  atomic_int invalid;            /* tested by the code at its entry */
+  struct class_file* class;
+  struct method_info* method;
+  struct osr_entry* osr; /* NULL for the method's normal entry */
+  compiled_entry code;
+  struct cha_assumption* assumptions; /* size = count */
+  uint32_t count;
+  uint32_t capacity;
+};
+
+struct class_hierarchy {
+  pthread_mutex_t lock; /* subtype lists and dependencies */
+  struct cha_dependencies* dependencies;
+  /* a superinterface could not be resolved, implementors may be missing */
+  int incomplete;
+  uint64_t invalidations;
+};
+
+struct class_hierarchy* class_hierarchy_new(void);
+void class_hierarchy_free(struct class_hierarchy* h);
+
+/**
+ * Records a class being linked, its runtime->super,
+ * runtime->interfaces and supertypes (subtype_link()) must be set. Invalidates the dependencies the
+ * class breaks, so it must run before the class is published
+ */
+int class_hierarchy_add(struct class_hierarchy* h, struct class_file* class,
+                        struct class_runtime* runtime);
+/* Forgets a class whose runtime is being freed */
+void class_hierarchy_remove(struct class_hierarchy* h, struct class_file* class,
+                            struct class_runtime* runtime);
+
+/* Whether a loaded subclass of `class` declares `method` again */
+int class_hierarchy_has_overriders(struct class_hierarchy* h,
+                                   struct class_file* class,
+                                   const struct method_info* method);
+/**
+ * The only loaded class that can be instantiated and implements
+ * `interface`, NULL if there is none or several
+ */
+struct class_file* class_hierarchy_unique_implementor(
+    struct class_hierarchy* h, struct class_file* interface);
+
+/**
+ * Method every receiver of an invokevirtual or invokeinterface of
+ * `resolved`, declared by *holder, runs given the classes loaded so
+ * far. NULL if that may vary or there is no code, otherwise *holder
+ * becomes the target's class and the assumptions the answer relies
+ * on are added to deps. ENOMEM is left in *err
+ */
+struct method_info* class_hierarchy_unique_target(
+    struct class_hierarchy* h, struct cha_dependencies* deps,
+    struct class_file** holder, struct method_info* resolved, int* err);
+
+/**
+ * Method an instance of exactly `class` runs for `resolved`, declared
+ * by *holder. It needs no assumption. NULL if there is no code,
+ * otherwise *holder becomes the target's class
+ */
+struct method_info* class_hierarchy_exact_target(struct class_file* class,
+                                                 struct class_file** holder,
+                                                 struct method_info* resolved);
+
+struct cha_dependencies* cha_dependencies_new(struct class_file* class,
+                                              struct method_info* method);
+void cha_dependencies_free(struct cha_dependencies* deps);
+
+/**
+ * Registers the dependencies of code about to be published. EAGAIN if
+ * a class linked since the compiler asked broke one of them
+ */
+int class_hierarchy_register(struct class_hierarchy* h,
+                             struct cha_dependencies* deps);
+void class_hierarchy_unregister(struct class_hierarchy* h,
+                                struct cha_dependencies* deps);
+
+/**
+ * Takes the code of invalidated dependencies out of its method, the
+ * method then runs interpreted until it is compiled again
+ */
+void cha_withdraw(struct cha_dependencies* deps);
+
+/**
+ * Called by invalidated code at its entry, with the arguments it got.
+ * Runs the method's current code or the interpreter instead
+ */
+int64_t cha_reenter(struct interp_thread* thread, union java_value* args,
+                    struct cha_dependencies* deps);
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef SHIP_JVM_CLASS_IMAGE_H
+#define SHIP_JVM_CLASS_IMAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "classfile.h"
+
+/*
+ * A class image is a parsed class_file flattened into one block:
+ * the class_file comes first, followed by every array it points to.
+ * Pointers are written as if the block were placed at `base`, so an
+ * image loaded at base needs no fixups and anywhere else needs one
+ * pass of class_image_relocate. Images are what the class cache and
+ * the shared archive store instead of raw class files.
+ */
+
+#define CLASS_IMAGE_ALIGNMENT 8
+
+/* Keep the layout and the oop maps, see class_image_put_class */
+#define CLASS_IMAGE_LINKED 1
+
+/**
+ * Growing buffer an image is written into. Offsets are relative to
+ * its start, pointers are stored as base + offset
+ */
+struct class_image_writer {
+  uint8_t* data;
+  size_t size;
+  size_t capacity;
+  uintptr_t base;
+  int error; /* ENOMEM once an allocation failed */
+};
+
+size_t class_image_put(struct class_image_writer* w, const void* bytes,
+                       size_t n);
+void class_image_set_pointer(struct class_image_writer* w, size_t field,
+                             size_t target);
+size_t class_image_get_pointer(const struct class_image_writer* w,
+                               size_t field);
+size_t class_image_put_class(struct class_image_writer* w,
+                             const struct class_file* class, int flags);
+
+int class_image_write(const struct class_file* class, uintptr_t base,
+                      uint8_t** image, size_t* size);
+int class_image_relocate_class(uint8_t* image, size_t size,
+                               uintptr_t from_base, size_t offset);
+int class_image_relocate(uint8_t* image, size_t size, uintptr_t from_base);
+int class_image_open(uint8_t* image, size_t size, uintptr_t from_base,
+                     int owned, struct class_file* class);
+uint32_t class_image_abi(void);
+
+#endif
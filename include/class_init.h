@@ -0,0 +1,59 @@
+#ifndef SHIP_JVM_CLASS_INIT_H
+#define SHIP_JVM_CLASS_INIT_H
+
+#include <stdint.h>
+
+#include "classfile.h"
+#include "interpreter.h"
+
+/*
+ * Eager initialization of the classes a program starts with. Run in
+ * order on one thread it is what touching them one after another
+ * does. With more threads the classes are split by what they can
+ * trigger (JVMS 5.5): a class depends on its superclass and
+ * interfaces and on the classes its <clinit> and methods create
+ * instances of (new) or use the static fields and methods of, and on
+ * what those classes trigger in turn. Classes it only names, as a
+ * field type or an instanceof, are left out. Classes depending on
+ * each other form one component, initialized by one thread, and a
+ * component starts once the components it depends on are done, so
+ * independent components run on the pool in parallel.
+ *
+ * interp_init_class() keeps its JVMS semantics in both modes: a
+ * class touched through a path the graph doesn't show, reflection or
+ * a method handle, is initialized lazily by whichever thread gets
+ * there first, the others wait for it. Since cycles stay on one
+ * thread, no two threads end up waiting for each other's classes.
+ */
+
+struct class_init_stats {
+  uint32_t classes;    /* asked for */
+  uint32_t failed;     /* threw from <clinit> or couldn't link */
+  uint32_t reached;    /* classes in the dependency graph */
+  uint32_t components; /* of the graph */
+  uint32_t largest;    /* classes in the largest component */
+  uint32_t threads;    /* that initialized classes */
+};
+
+/**
+ * Links and initializes `classes`, on the calling thread alone when
+ * `threads` is at most 1, otherwise on it and threads - 1 more, each
+ * with an interp_thread of its own. The classes a class can trigger
+ * are looked up with the interpreter's resolve_class to build the
+ * graph, but only `classes` are initialized. Call it outside Java
+ * code, as interp_invoke().
+ *
+ * A helper thread that can't start leaves its share to the others,
+ * the calling thread takes part in any case and alone it initializes
+ * the components in dependency order. stats->threads counts the
+ * threads that started.
+ *
+ * Every class is tried even when some fail: INTERP_EXCEPTION with
+ * ExceptionInInitializerError pending if any did, ENOMEM if the graph
+ * couldn't be built
+ */
+int class_init_all(struct interp_thread* thread, struct class_file** classes,
+                   uint32_t count, uint32_t threads,
+                   struct class_init_stats* stats);
+
+#endif
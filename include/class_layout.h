@@ -0,0 +1,112 @@
+#ifndef SHIP_JVM_CLASS_LAYOUT_H
+#define SHIP_JVM_CLASS_LAYOUT_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "classfile.h"
+
+/* newarray atype codes (JVMS 6.5 newarray) */
+#define T_BOOLEAN 4
+#define T_CHAR 5
+#define T_FLOAT 6
+#define T_DOUBLE 7
+#define T_BYTE 8
+#define T_SHORT 9
+#define T_INT 10
+#define T_LONG 11
+/* Internal code for arrays of references (anewarray) */
+#define T_OBJECT 12
+
+/**
+ * Header shared by every object on the Java heap
+ */
+struct object_header {
+  /**
+   * Lock word, GC age and forwarding bits
+   */
+  uintptr_t mark;
+
+  /**
+   * Layout of the object (instance or array)
+   */
+  const struct class_layout* layout;
+};
+
+/**
+ * Header of an array object, elements follow it
+ */
+struct array_header {
+  struct object_header header;
+  uint32_t length;
+  uint32_t padding; /* keeps 8-byte elements aligned */
+};
+
+/**
+ * Computed memory layout of instances of one class
+ * or of one kind of array
+ */
+struct class_layout {
+  /**
+   * Class this layout belongs to (NULL for arrays)
+   */
+  struct class_file* klass;
+
+  /**
+   * Layout of the superclass (NULL for java/lang/Object and arrays)
+   */
+  const struct class_layout* super;
+
+  /**
+   * Size of an instance including the header, multiple of 8.
+   * 0 for arrays, whose size depends on the length
+   */
+  uint32_t instance_size;
+
+  /**
+   * T_* code of the element type for arrays, 0 for instances
+   */
+  uint8_t array_type;
+
+  /**
+   * Size of one array element in bytes, 0 for instances
+   */
+  uint8_t element_size;
+
+  /**
+   * Number of reference fields including inherited ones
+   */
+  uint16_t ref_count;
+
+  /**
+   * Byte offsets of reference fields from the object start
+   */
+  uint32_t* ref_offsets; /* size = ref_count */
+
+  /**
+   * Number of fields declared by klass
+   */
+  uint16_t fields_count;
+
+  /**
+   * Byte offset of each declared field in the same order as
+   * class_file.fields, UINT32_MAX for static fields
+   */
+  uint32_t* field_offsets; /* size = fields_count */
+};
+
+int class_layout_compute(struct class_file* class,
+                         const struct class_layout* super,
+                         struct class_layout* layout);
+void class_layout_free(struct class_layout* layout);
+const struct class_layout* class_layout_for_array(uint8_t array_type);
+uint8_t field_descriptor_size(uint8_t first_char);
+
+static inline size_t class_layout_array_size(const struct class_layout* layout,
+                                             uint32_t length) {
+  size_t size = sizeof(struct array_header) +
+                (size_t)length * (size_t)layout->element_size;
+  return (size + 7) & ~(size_t)7;
+}
+
+#endif
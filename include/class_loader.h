@@ -0,0 +1,120 @@
+#ifndef SHIP_JVM_CLASS_LOADER_H
+#define SHIP_JVM_CLASS_LOADER_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "class_cache.h"
+#include "classfile.h"
+
+/*
+ * The system class loader: finds name.class in the directories of a
+ * class path, parses and verifies it and loads its superclass and
+ * superinterfaces before the class becomes visible, so a loaded
+ * class always has its supertypes loaded too.
+ *
+ * Loaded classes are kept in the system dictionary, an open
+ * addressing table of entries keyed by binary name. Lookups read it
+ * without any lock: a writer publishes entries and grown tables with
+ * release stores, and tables that were replaced stay mapped until the
+ * loader is destroyed. Only inserting takes the dictionary lock.
+ *
+ * The entry of a class is inserted as a placeholder when its loading
+ * starts. The thread that inserted it loads the class with no lock
+ * held and other threads asking for the same class wait on that
+ * entry alone, so loads of different classes run in parallel and a
+ * class is never loaded twice. A thread that would wait on a class
+ * its own load depends on, directly or through other loading
+ * threads, gets ClassCircularityError (ELOOP) instead. A failed load
+ * stays failed.
+ *
+ * With a class cache set, class files whose bytes were parsed and
+ * verified before, by this loader or another process sharing the
+ * cache directory, are loaded from their cached image instead.
+ */
+
+#define CLASS_LOADER_MAX_PATH 4096
+
+enum class_entry_state {
+  CLASS_ENTRY_LOADING,
+  CLASS_ENTRY_LOADED,
+  CLASS_ENTRY_FAILED,
+};
+
+/* A class of the dictionary, never freed before the loader */
+struct class_entry {
+  uint64_t hash;
+  char* name; /* binary name, java/lang/Object */
+  uint16_t length;
+  _Atomic(uint32_t) state; /* enum class_entry_state, a futex */
+  struct class_file* class; /* once loaded */
+  int error;                /* once failed */
+  const void* owner;        /* loading thread */
+  /* entry the loading thread waits for or loads on the way */
+  _Atomic(struct class_entry*) blocked_on;
+  _Atomic(uint32_t) waiters;
+  struct class_entry* next_loaded; /* loaded before this one */
+};
+
+struct class_table {
+  uint32_t mask; /* capacity - 1, a power of two */
+  struct class_table* retired; /* replaced tables, freed at the end */
+  _Atomic(struct class_entry*) slots[];
+};
+
+struct class_loader_stats {
+  uint64_t loaded;
+  uint64_t failed;
+  uint64_t waits;   /* lookups that waited for another thread's load */
+  uint64_t grows;   /* times the dictionary table was replaced */
+  uint64_t entries;
+};
+
+struct class_loader {
+  char** path; /* class path directories */
+  uint32_t path_count;
+  struct class_cache* cache; /* NULL: every class is parsed and verified */
+  _Atomic(struct class_table*) table;
+  pthread_mutex_t lock; /* inserting, fields below */
+  uint32_t count;
+  struct class_entry* last_loaded; /* subclasses come before supers */
+  struct class_loader_stats stats;
+};
+
+/**
+ * Loader over a class path of directories separated by ':'.
+ * ENOMEM
+ */
+int class_loader_init(struct class_loader* loader, const char* class_path);
+/**
+ * Frees the loaded classes, their runtimes first: call it before the
+ * interpreter and the heap are destroyed
+ */
+void class_loader_destroy(struct class_loader* loader);
+
+/**
+ * Loads the class with this binary name or waits for the thread
+ * loading it. ENOENT when no class path directory has it, EINVAL for
+ * a malformed class or one declaring another name, ELOOP for a
+ * circular hierarchy, or the error its superclass or an interface
+ * failed with
+ */
+int class_loader_load(struct class_loader* loader, const uint8_t* name,
+                      uint16_t length, struct class_file** class);
+
+/* The class if it is loaded already, without locking or waiting */
+struct class_file* class_loader_find(struct class_loader* loader,
+                                     const uint8_t* name, uint16_t length);
+
+/**
+ * interp_class_resolver over a struct class_loader, for the
+ * interpreter's resolve_class
+ */
+struct class_file* class_loader_resolve(const uint8_t* name, uint16_t length,
+                                        void* loader);
+
+void class_loader_get_stats(struct class_loader* loader,
+                            struct class_loader_stats* stats);
+
+#endif
@@ -6,6 +6,10 @@
 #include "constant_pool.h"
 #include "attribute_info.h"
 
+struct class_layout;
+struct class_runtime;
+struct Code_attribute;
+struct oop_map;
 
 struct field_info {
   uint16_t access_flags;
@@ -21,6 +25,9 @@ struct method_info {
   uint16_t descriptor_index;
   uint16_t attributes_count;
   struct attribute_info* attributes;  // size = attributes_count
+
+  struct Code_attribute* code;  // decoded Code attribute, NULL if none
+  struct oop_map* oop_map;      // reference slots at safepoints
 };
 
 struct class_file {
@@ -40,8 +47,25 @@ struct class_file {
   struct method_info* methods;  // size = methods_count
   uint16_t attributes_count;
   struct attribute_info* attributes;  // size = attributes_count
+
+  struct class_layout* layout;  // computed when the class is linked
+  struct class_runtime* runtime;  // interpreter state, see interpreter.h
+
+  void* image;          // class image holding the parsed data, or NULL
+  size_t image_size;
+  uint8_t image_owned;  // image is freed together with the class
+  uint8_t verify_deferred;  // class checks left to linking, see verifier.h
 };
 
 void init_class_file(struct class_file* class);
+void free_class_file(struct class_file* class);
 int get_constant(struct class_file* class, uint16_t index, struct cp_info** cp_info);
+
+/* Whether `pointer` is part of the class image and must not be freed */
+static inline int class_in_image(const struct class_file* class,
+                                 const void* pointer) {
+  const uint8_t* image = (const uint8_t*)class->image;
+  return image != NULL && (const uint8_t*)pointer >= image &&
+         (const uint8_t*)pointer < image + class->image_size;
+}
 #endif
\ No newline at end of file
@@ -9,11 +9,19 @@
 #include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "attribute_info.h"
 #include "classfile.h"
 #include "classfile_stream.h"
 #include "constant_pool.h"
 
-int parse_class_file();
+int is_string_match(const char* str, size_t len, const char* expected);
+int parse_attribute(Loader* loader, struct class_file* class,
+                    struct attribute_info* attr);
+int parse_attributes(Loader* loader, struct class_file* class, uint16_t count,
+                     struct attribute_info** attributes);
+int parse_class(Loader* loader, struct class_file* class);
+int parse_class_file(const char* path, struct class_file* class);
+void print_class_file(struct class_file* class);
 
-#endif
\ No newline at end of file
+#endif
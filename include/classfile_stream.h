@@ -3,11 +3,19 @@
 #include <stdint.h>
 #include <stdio.h>
 
+/*
+ * Reads big-endian class file data either from `file`
+ * or, when file is NULL, from `buffer`
+ */
 typedef struct {
   FILE* file;
   int error;
+  const uint8_t* buffer;
+  size_t size;
+  size_t position;
 } Loader;
 
+void loader_read_bytes(Loader* loader, uint8_t* buf, size_t n);
 uint8_t loader_u1(Loader* loader);
 uint16_t loader_u2(Loader* loader);
 uint32_t loader_u4(Loader* loader);
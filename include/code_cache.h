@@ -0,0 +1,35 @@
+#ifndef SHIP_JVM_CODE_CACHE_H
+#define SHIP_JVM_CODE_CACHE_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Executable memory of the JIT compilers. One mapping is reserved up
+ * front, code is bump allocated from it and is never freed before
+ * the cache itself, so entry points stay valid while any thread may
+ * still be running them.
+ */
+
+#define CODE_CACHE_DEFAULT_SIZE ((size_t)32 << 20)
+#define CODE_CACHE_ALIGNMENT 16
+
+struct code_cache {
+  uint8_t* base;
+  size_t size;
+  size_t used;
+  pthread_mutex_t lock;
+};
+
+int code_cache_init(struct code_cache* cache, size_t size);
+void code_cache_destroy(struct code_cache* cache);
+
+/**
+ * Copies `size` bytes of position independent code into the cache,
+ * NULL when the cache is full
+ */
+void* code_cache_install(struct code_cache* cache, const uint8_t* code,
+                         size_t size);
+
+#endif
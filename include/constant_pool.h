@@ -143,6 +143,8 @@ struct cp_info {
   };
 };
 
+struct class_file;
+
 int read_utf8_info(Loader* loader, struct UTF8_info* utf8);
 int read_primitive_info(Loader* loader, struct abstract_primitive* info);
 int read_big_primitive_info(Loader* loader,
@@ -156,5 +158,6 @@ int read_method_type_info(Loader* loader, struct method_type_info* info);
 int read_dynamic_info(Loader* loader, struct absract_dynamic_info* info);
 int read_module_info(Loader* loader, struct module_info* info);
 int read_package_info(Loader* loader, struct package_info* info);
+struct UTF8_info* validate_constant(struct class_file* class, uint16_t index);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,145 @@
+#ifndef SHIP_JVM_DEOPT_H
+#define SHIP_JVM_DEOPT_H
+
+#include <stdint.h>
+
+#include "classfile.h"
+#include "interpreter.h"
+
+/*
+ * Deoptimization. Optimized code records debug info at every point
+ * where it may give up: the interpreter frames live there, the
+ * method's own and those of the callees inlined into it, with the
+ * location of each of their locals and operand stack slots. A failed
+ * check jumps to a stub that saves all registers and calls
+ * deopt_resume(), which rebuilds the frames on the thread's slot
+ * stack and runs them to the end in the interpreter, innermost first.
+ * The compiled frame then returns what the outermost one returned.
+ *
+ * Allocations the compiler replaced by their fields have no object
+ * the frames could refer to. A point lists them with the location of
+ * each field, deopt_resume() allocates and fills them before the
+ * frames run, and DEOPT_OBJECT values stand for them.
+ *
+ * The table also lists the safepoint polls of the code with the
+ * locations of the references live at each, which the collector
+ * visits while the thread is parked at the poll.
+ */
+
+#define DEOPT_MAX_FRAMES 8
+
+#define DEOPT_CONST 0
+#define DEOPT_REG 1
+#define DEOPT_STACK 2
+#define DEOPT_OBJECT 3 /* value = index in the point's objects */
+
+struct deopt_value {
+  uint8_t kind;  /* DEOPT_* */
+  uint8_t reg;   /* enum x86_reg of DEOPT_REG */
+  char type;     /* 'I' or 'A' */
+  int32_t value; /* constant, or rbp displacement of DEOPT_STACK */
+};
+
+struct deopt_frame {
+  struct class_file* class;
+  struct method_info* method;
+  /* next instruction, the inlined call for all but the innermost */
+  uint16_t bci;
+  uint16_t local_count;
+  uint16_t stack_count; /* callers still hold the call's arguments */
+  uint32_t values; /* locals then stack slots in deopt_table.values */
+};
+
+/* Object of a replaced allocation, only int fields */
+struct deopt_object {
+  const struct class_layout* layout;
+  uint32_t fields; /* first in deopt_table.fields */
+  uint16_t field_count;
+};
+
+struct deopt_field {
+  int32_t offset;
+  struct deopt_value value;
+};
+
+struct deopt_point {
+  uint32_t frames; /* first in deopt_table.frames, innermost first */
+  uint16_t frame_count;
+  uint16_t object_count;
+  uint32_t objects; /* first in deopt_table.objects */
+};
+
+struct deopt_poll {
+  uint32_t offset; /* of the poll instruction in the code */
+  uint32_t values; /* first in deopt_table.values, all references */
+  uint16_t value_count;
+};
+
+struct deopt_table {
+  struct deopt_point* points; /* size = point_count */
+  uint32_t point_count;
+  uint32_t point_capacity;
+  struct deopt_frame* frames; /* size = frame_count */
+  uint32_t frame_count;
+  uint32_t frame_capacity;
+  struct deopt_value* values; /* size = value_count */
+  uint32_t value_count;
+  uint32_t value_capacity;
+  struct deopt_object* objects; /* size = object_count */
+  uint32_t object_count;
+  uint32_t object_capacity;
+  struct deopt_field* fields; /* size = field_count */
+  uint32_t field_count;
+  uint32_t field_capacity;
+  struct deopt_poll* polls; /* size = poll_count, by offset */
+  uint32_t poll_count;
+  uint32_t poll_capacity;
+};
+
+struct deopt_table* deopt_table_new(void);
+void deopt_table_free(struct deopt_table* table);
+
+/* Starts the next point, -1 without memory */
+int32_t deopt_add_point(struct deopt_table* table);
+
+/**
+ * Adds the next outer frame of the last point and returns its
+ * local_count + stack_count values to fill, NULL without memory
+ */
+struct deopt_value* deopt_add_frame(struct deopt_table* table,
+                                    struct class_file* class,
+                                    struct method_info* method, uint16_t bci,
+                                    uint16_t local_count,
+                                    uint16_t stack_count);
+
+/**
+ * Adds an object to allocate for the last point and returns its
+ * field_count fields to fill, NULL without memory
+ */
+struct deopt_field* deopt_add_object(struct deopt_table* table,
+                                     const struct class_layout* layout,
+                                     uint16_t field_count);
+
+/**
+ * Adds the poll at `offset`, after those added so far, with
+ * value_count locations to fill. Returns its index, -1 without memory
+ */
+int32_t deopt_add_poll(struct deopt_table* table, uint32_t offset,
+                       uint16_t value_count);
+
+/* Poll at `offset` in the code, NULL if there is none */
+const struct deopt_poll* deopt_find_poll(const struct deopt_table* table,
+                                         uint32_t offset);
+
+/**
+ * Called by compiled code at a failed check. regs holds the 16
+ * general purpose registers by number, fp is the compiled frame's
+ * rbp. Returns the result of the outermost frame, an exception may
+ * be pending instead, OutOfMemoryError if the objects of the point
+ * can't be allocated
+ */
+int64_t deopt_resume(struct interp_thread* thread,
+                     const struct deopt_table* table, uint32_t point,
+                     const uint64_t* regs, const uint8_t* fp);
+
+#endif
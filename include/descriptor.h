@@ -0,0 +1,38 @@
+#ifndef SHIP_JVM_DESCRIPTOR_H
+#define SHIP_JVM_DESCRIPTOR_H
+
+#include <stdint.h>
+
+#include "constant_pool.h"
+
+/* A method has at most 255 parameter slots, JVMS 4.3.3 */
+#define DESCRIPTOR_MAX_ARGS 255
+
+/**
+ * Parsed method descriptor. Object and array types are both
+ * reported as 'L', other types keep their descriptor letter
+ */
+struct method_descriptor {
+  uint8_t arg_count;
+  uint16_t arg_slots; /* long and double take two slots */
+  char args[DESCRIPTOR_MAX_ARGS]; /* size = arg_count */
+  char ret; /* 'V' for void */
+};
+
+const uint8_t* skip_field_descriptor(const uint8_t* p, const uint8_t* end,
+                                     char* kind);
+int parse_method_descriptor(const struct UTF8_info* descriptor,
+                            struct method_descriptor* desc);
+int parse_field_descriptor(const struct UTF8_info* descriptor, char* kind);
+struct name_and_type_info* constant_member_name_and_type(
+    struct class_file* class, uint16_t index);
+struct UTF8_info* constant_member_descriptor(struct class_file* class,
+                                             uint16_t index);
+struct UTF8_info* constant_class_name(struct class_file* class,
+                                      uint16_t index);
+
+static inline int descriptor_slots(char kind) {
+  return kind == 'J' || kind == 'D' ? 2 : kind == 'V' ? 0 : 1;
+}
+
+#endif
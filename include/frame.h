@@ -0,0 +1,35 @@
+#ifndef SHIP_JVM_FRAME_H
+#define SHIP_JVM_FRAME_H
+
+#include <stdint.h>
+
+#include "class_layout.h"
+#include "classfile.h"
+
+/**
+ * One local variable or operand stack slot. long and double
+ * take two slots, the value is kept in the first one
+ */
+union java_value {
+  int32_t i;
+  int64_t j;
+  float f;
+  double d;
+  struct object_header* ref;
+};
+
+/**
+ * Interpreter frame as seen by the runtime and the collector
+ */
+struct java_frame {
+  struct java_frame* caller;
+  struct class_file* class;
+  struct method_info* method;
+  uint16_t bci;              /* current instruction */
+  uint16_t stack_depth;      /* operand stack slots in use */
+  union java_value* locals;  /* size = max_locals */
+  union java_value* stack;   /* size = max_stack */
+  struct object_header* lock; /* held by a synchronized method, or NULL */
+};
+
+#endif
@@ -0,0 +1,147 @@
+#ifndef SHIP_JVM_GC_H
+#define SHIP_JVM_GC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "heap.h"
+
+/*
+ * Generational heap. One contiguous reservation is split into
+ *   | eden | survivor 0 | survivor 1 | old |
+ * Eden is a TLAB heap, survivors and old are bump spaces filled
+ * only by the collector. A card table covers the whole reservation
+ * and remembers old->young stores between scavenges.
+ */
+
+#define CARD_SHIFT 9
+#define CARD_SIZE ((size_t)1 << CARD_SHIFT)
+#define CARD_CLEAN 0xff
+#define CARD_DIRTY 0x00
+
+#define GC_DEFAULT_TENURING_THRESHOLD 6
+
+typedef void (*gc_slot_visitor)(struct object_header** slot, void* ctx);
+
+/**
+ * Reports every root slot of the embedder (stack frames, handles)
+ * to `visit`. Installed with gc_set_root_scanner
+ */
+typedef void (*gc_root_scanner)(gc_slot_visitor visit, void* visit_ctx,
+                                void* ctx);
+
+struct gc_heap;
+
+/**
+ * Collects the old generation when a scavenge can't guarantee
+ * promotion. Installed by the old generation collector
+ */
+typedef int (*gc_full_collector)(struct gc_heap* gh, void* ctx);
+
+/**
+ * Space filled by bump allocation under the GC lock
+ */
+struct gc_space {
+  uint8_t* base;
+  uint8_t* top;
+  uint8_t* end;
+};
+
+struct gc_stats {
+  uint64_t scavenges;
+  uint64_t promotion_failures;
+  uint64_t survived_bytes;  /* copied into survivor spaces */
+  uint64_t promoted_bytes;  /* copied into old generation */
+  uint64_t dirty_cards;     /* scanned as old->young roots */
+
+  uint64_t* pause_ns; /* size = pause_count */
+  size_t pause_count;
+  size_t pause_capacity;
+};
+
+struct gc_heap {
+  uint8_t* reserved;
+  size_t reserved_size;
+
+  struct heap eden;
+  struct gc_space survivor[2];
+  int from; /* index of the survivor space holding live objects */
+  struct gc_space old;
+
+  /*
+   * One byte per CARD_SIZE bytes of the reservation.
+   * card_base is biased so that card_base[addr >> CARD_SHIFT]
+   * is the card of addr, which makes the barrier one store.
+   */
+  uint8_t* cards;
+  uint8_t* card_base;
+  /* For every old card: start of the object covering its first byte */
+  uint8_t** card_first_object;
+
+  uint8_t tenuring_threshold;
+
+  struct object_header*** roots; /* registered root slots */
+  size_t roots_count;
+  size_t roots_capacity;
+  gc_root_scanner scan_roots;
+  void* scan_roots_ctx;
+
+  gc_full_collector full_collect;
+  void* full_collect_ctx;
+
+  struct gc_stats stats;
+};
+
+int gc_heap_init(struct gc_heap* gh, size_t young_size, size_t old_size);
+void gc_heap_destroy(struct gc_heap* gh);
+
+int gc_add_root(struct gc_heap* gh, struct object_header** slot);
+void gc_remove_root(struct gc_heap* gh, struct object_header** slot);
+void gc_set_root_scanner(struct gc_heap* gh, gc_root_scanner scan, void* ctx);
+void gc_set_full_collector(struct gc_heap* gh, gc_full_collector collect,
+                           void* ctx);
+void gc_visit_roots(struct gc_heap* gh, gc_slot_visitor visit, void* ctx);
+void gc_record_old_object(struct gc_heap* gh, uint8_t* obj, size_t size);
+
+int gc_scavenge(struct gc_heap* gh);
+uint64_t gc_pause_percentile(const struct gc_heap* gh, double percentile);
+
+void object_visit_refs(struct object_header* obj, gc_slot_visitor visit,
+                       void* ctx);
+
+static inline int gc_is_young(const struct gc_heap* gh, const void* addr) {
+  return (const uint8_t*)addr >= gh->eden.base &&
+         (const uint8_t*)addr < gh->old.base;
+}
+
+static inline int gc_is_old(const struct gc_heap* gh, const void* addr) {
+  return (const uint8_t*)addr >= gh->old.base &&
+         (const uint8_t*)addr < gh->old.end;
+}
+
+/* Post-write barrier: dirty the card of the updated slot */
+static inline void gc_write_barrier(struct gc_heap* gh, void* slot) {
+  gh->card_base[(uintptr_t)slot >> CARD_SHIFT] = CARD_DIRTY;
+}
+
+/* Reference store for putfield */
+static inline void gc_store_field(struct gc_heap* gh, struct object_header* obj,
+                                  uint32_t offset,
+                                  struct object_header* value) {
+  struct object_header** slot =
+      (struct object_header**)((uint8_t*)obj + offset);
+  *slot = value;
+  gc_write_barrier(gh, slot);
+}
+
+/* Reference store for aastore, index is already range checked */
+static inline void gc_store_element(struct gc_heap* gh,
+                                    struct array_header* array,
+                                    uint32_t index,
+                                    struct object_header* value) {
+  struct object_header** slot = (struct object_header**)(array + 1) + index;
+  *slot = value;
+  gc_write_barrier(gh, slot);
+}
+
+#endif
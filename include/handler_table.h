@@ -0,0 +1,62 @@
+#ifndef SHIP_JVM_HANDLER_TABLE_H
+#define SHIP_JVM_HANDLER_TABLE_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "classfile.h"
+
+/*
+ * Exception handler lookup for the interpreter.
+ *
+ * Linking splits the code of each method with an exception table at
+ * every start_pc and end_pc into ranges and gives each range the
+ * handlers covering it, in table order. Finding the handlers for a
+ * bci is then a binary search over the range starts, and a throw in
+ * code no handler covers costs nothing more.
+ *
+ * A catch type becomes a class pointer the first time a throw reaches
+ * its handler and stays one; resolving it when linking would load
+ * classes the method may never catch. The unwinder then only walks
+ * the superclass layouts of the exception. A catch type that can't be
+ * loaded is matched by name, as are exceptions the VM threw without
+ * an object.
+ */
+
+#define HANDLER_UNRESOLVED 0
+#define HANDLER_RESOLVED 1 /* catch_class is set */
+#define HANDLER_UNKNOWN 2  /* the catch type can't be loaded */
+
+struct exception_handler {
+  uint16_t handler_pc;
+  uint16_t catch_type; /* 0 catches everything */
+  /* NULL for an invalid catch type, which catches nothing */
+  struct UTF8_info* catch_name;
+  struct class_file* catch_class;
+  _Atomic(uint8_t) state; /* HANDLER_* */
+};
+
+struct handler_table {
+  struct exception_handler* handlers; /* in table order */
+  uint16_t* starts;     /* first bci of each range, ascending */
+  uint32_t* first;      /* range i has candidates[first[i]..first[i + 1]) */
+  uint16_t* candidates; /* handler indexes, in table order per range */
+  uint32_t range_count;
+};
+
+/**
+ * Handler table of the method's code, NULL on failure. The code must
+ * have an exception table
+ */
+struct handler_table* handler_table_build(struct class_file* class,
+                                          const struct Code_attribute* code);
+void handler_table_free(struct handler_table* table);
+
+/**
+ * Indexes of the handlers covering bci, in the order they must be
+ * tried. Their number is left in *count
+ */
+const uint16_t* handler_table_candidates(const struct handler_table* table,
+                                         uint32_t bci, uint32_t* count);
+
+#endif
@@ -0,0 +1,10 @@
+#ifndef SHIP_JVM_HASH_H
+#define SHIP_JVM_HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* XXH64 of `size` bytes, compatible with the reference xxHash */
+uint64_t hash64(const void* data, size_t size, uint64_t seed);
+
+#endif
@@ -0,0 +1,165 @@
+#ifndef SHIP_JVM_HEAP_H
+#define SHIP_JVM_HEAP_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "class_layout.h"
+
+/*
+ * Mark word layout:
+ *   bits 0-1  lock state: 0b01 unlocked, 0b00 thin locked, 0b10
+ *             inflated, 0b11 while a GC has forwarded the object
+ *   bits 3-6  number of scavenges survived (age)
+ *   bits 8-15 thin locked: recursions beyond the first lock
+ *   bits 16-  thin locked: owner thread id
+ *   bits 8-   inflated: monitor index (monitor.h)
+ * A forwarded mark holds the new address in place of the other bits.
+ */
+#define MARK_LOCK_MASK 0x3
+#define MARK_UNLOCKED 0x1
+#define MARK_THIN_LOCKED 0x0
+#define MARK_INFLATED 0x2
+#define MARK_FORWARDED 0x3
+#define MARK_AGE_SHIFT 3
+#define MARK_AGE_MASK ((uintptr_t)0xf << MARK_AGE_SHIFT)
+#define MARK_MAX_AGE 15
+#define MARK_COUNT_SHIFT 8
+#define MARK_COUNT_MASK ((uintptr_t)0xff << MARK_COUNT_SHIFT)
+#define MARK_OWNER_SHIFT 16
+#define MARK_MONITOR_SHIFT 8
+
+#define HEAP_ALIGNMENT 8
+#define HEAP_DEFAULT_TLAB_SIZE (256 * 1024)
+
+/*
+ * Space kept free at the end of every TLAB so that the unused tail
+ * can always be turned into a filler array when the TLAB is retired.
+ * This keeps the heap walkable object by object.
+ */
+#define HEAP_FILLER_RESERVE sizeof(struct array_header)
+
+struct heap;
+
+/**
+ * Called on the slow path when the shared region is exhausted.
+ * Must free space (or grow the heap) and return 0, non-zero means OOM
+ */
+typedef int (*heap_collect_fn)(struct heap* heap, size_t requested, void* ctx);
+
+/**
+ * Thread-local allocation buffer: a chunk of the shared region
+ * owned by one mutator thread and allocated by pointer bump
+ */
+struct tlab {
+  uint8_t* start;
+  uint8_t* top;
+  uint8_t* end; /* usable end, HEAP_FILLER_RESERVE below the real end */
+
+  struct heap* heap;
+  struct tlab* next; /* list of attached threads */
+
+  uint64_t refills;
+  uint64_t allocated_bytes; /* bytes in retired TLABs */
+};
+
+/**
+ * Contiguous region shared by all mutator threads.
+ * TLABs are carved from it with one atomic add
+ */
+struct heap {
+  uint8_t* base;
+  uint8_t* end;
+  _Atomic(uintptr_t) top;
+  int owns_memory; /* base was allocated by heap_init */
+
+  size_t tlab_size;
+
+  heap_collect_fn collect;
+  void* collect_ctx;
+
+  pthread_mutex_t lock; /* guards tlabs list and collections */
+  struct tlab* tlabs;
+
+  _Atomic(uint64_t) tlab_refills;
+  _Atomic(uint64_t) slow_allocations;
+  _Atomic(uint64_t) collections;
+};
+
+extern _Thread_local struct tlab heap_current_tlab;
+
+int heap_init(struct heap* heap, size_t capacity, size_t tlab_size);
+int heap_init_region(struct heap* heap, uint8_t* base, size_t capacity,
+                     size_t tlab_size);
+void heap_destroy(struct heap* heap);
+void heap_set_collector(struct heap* heap, heap_collect_fn collect, void* ctx);
+
+int heap_attach_thread(struct heap* heap);
+void heap_detach_thread(struct heap* heap);
+void heap_retire_tlabs(struct heap* heap);
+void heap_reset(struct heap* heap);
+size_t heap_used(struct heap* heap);
+
+void* heap_alloc_slow(struct heap* heap, size_t size);
+
+/* Fast path: bump the pointer of the current thread's TLAB */
+static inline void* heap_alloc(struct heap* heap, size_t size) {
+  struct tlab* tlab = &heap_current_tlab;
+
+  if (tlab->heap == heap && (size_t)(tlab->end - tlab->top) >= size) {
+    void* obj = tlab->top;
+    tlab->top += size;
+    return obj;
+  }
+  return heap_alloc_slow(heap, size);
+}
+
+/* Allocation for `new`: memory comes zeroed from the TLAB */
+static inline struct object_header* heap_new_instance(
+    struct heap* heap, const struct class_layout* layout) {
+  struct object_header* obj = heap_alloc(heap, layout->instance_size);
+
+  if (obj != NULL) {
+    obj->mark = MARK_UNLOCKED;
+    obj->layout = layout;
+  }
+  return obj;
+}
+
+/* Allocation for `newarray`/`anewarray` */
+static inline struct array_header* heap_new_array(
+    struct heap* heap, const struct class_layout* layout, int32_t length) {
+  struct array_header* array;
+
+  if (length < 0) {
+    return NULL;
+  }
+  array = heap_alloc(heap, class_layout_array_size(layout, (uint32_t)length));
+  if (array != NULL) {
+    array->header.mark = MARK_UNLOCKED;
+    array->header.layout = layout;
+    array->length = (uint32_t)length;
+  }
+  return array;
+}
+
+static inline int object_is_forwarded(const struct object_header* obj) {
+  return (obj->mark & MARK_LOCK_MASK) == MARK_FORWARDED;
+}
+
+static inline struct object_header* object_forwardee(
+    const struct object_header* obj) {
+  return (struct object_header*)(obj->mark & ~(uintptr_t)MARK_LOCK_MASK);
+}
+
+static inline size_t object_size(const struct object_header* obj) {
+  if (obj->layout->array_type != 0) {
+    return class_layout_array_size(obj->layout,
+                                   ((const struct array_header*)obj)->length);
+  }
+  return obj->layout->instance_size;
+}
+
+#endif
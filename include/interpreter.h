@@ -0,0 +1,332 @@
+#ifndef SHIP_JVM_INTERPRETER_H
+#define SHIP_JVM_INTERPRETER_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "classfile.h"
+#include "frame.h"
+#include "gc.h"
+#include "safepoint.h"
+#include "verifier.h"
+
+/*
+ * Bytecode interpreter. Every Java call is one call of interpret(),
+ * its locals and operand stack are carved from the slot stack of the
+ * thread and its java_frame is linked into thread->top so that the
+ * collector can find references through the oop maps.
+ *
+ * Threads are registered for safepoints and count as running Java
+ * code inside interp_invoke(). Frames poll at backward branches and
+ * returns, stopped there they are described by their oop map entry.
+ *
+ * Native methods registered in interp->natives are bound when their
+ * class links, their stub is their compiled entry. Methods with an
+ * intrinsic get it as their entry instead, natives or not.
+ *
+ * Per class state that changes at run time (resolved constant pool
+ * entries, static fields, invocation counters, compiled code) lives
+ * in class_runtime next to the class, never in the parsed class
+ * itself, which may be a read-only archive mapping.
+ */
+
+/* interpret() result: a Java exception is pending in the thread */
+#define INTERP_EXCEPTION 1000
+
+#define INTERP_DEFAULT_STACK_SLOTS (256 * 1024)
+#define INTERP_MAX_DEPTH 2048
+#define INTERP_DEFAULT_HOT_INVOCATIONS 1000
+#define INTERP_DEFAULT_HOT_BACKEDGES 10000
+#define INTERP_DEFAULT_OSR_BACKEDGES 20000
+
+struct interp_thread;
+
+/**
+ * Finds a class by binary name (java/lang/Object), NULL if unknown
+ */
+typedef struct class_file* (*interp_class_resolver)(const uint8_t* name,
+                                                    uint16_t length,
+                                                    void* ctx);
+
+/**
+ * Called once a method crosses an invocation or backedge threshold,
+ * by the interpreter and by compiled code that keeps counting
+ */
+typedef void (*interp_hot_method)(struct interp_thread* thread,
+                                  struct class_file* class,
+                                  struct method_info* method, void* ctx);
+
+/**
+ * Called once a method crosses the OSR backedge threshold while its
+ * loop at `bci` keeps running in the interpreter
+ */
+typedef void (*interp_hot_loop)(struct interp_thread* thread,
+                                struct class_file* class,
+                                struct method_info* method, uint32_t bci,
+                                void* ctx);
+
+struct deopt_table;
+
+/**
+ * Finds the compiled code holding pc: returns its debug info and
+ * leaves its start in *code, NULL if pc is in no such code
+ */
+typedef const struct deopt_table* (*interp_code_map)(const void* pc,
+                                                     const uint8_t** code,
+                                                     void* ctx);
+
+/**
+ * Entry of compiled code. Arguments come as they lie on the caller's
+ * operand stack, ints and references are returned in the low bits
+ */
+typedef int64_t (*compiled_entry)(struct interp_thread* thread,
+                                  union java_value* args);
+
+/**
+ * On-stack replacement entry at a loop header. Its code takes the
+ * interpreter frame's locals followed by its operand stack and runs
+ * the rest of the method
+ */
+struct osr_entry {
+  struct osr_entry* next;
+  _Atomic(compiled_entry) code; /* NULL once withdrawn */
+  uint32_t bci;
+};
+
+#define METHOD_NOT_COMPILABLE 0x1  /* rejected by the baseline compiler */
+#define METHOD_NOT_OPTIMIZABLE 0x2 /* rejected by the optimizing compiler */
+#define METHOD_OPTIMIZED 0x4       /* entry is optimized code */
+#define METHOD_QUEUED 0x8          /* waiting for a compiler thread */
+#define METHOD_OSR_QUEUED 0x10     /* an OSR entry is waiting for one */
+#define METHOD_INTRINSIC 0x20      /* entry is C code, never inlined */
+
+struct method_runtime {
+  _Atomic(uint32_t) invocations;
+  _Atomic(uint32_t) backedges;
+  _Atomic(compiled_entry) entry; /* NULL while interpreted */
+  _Atomic(struct osr_entry*) osr; /* newest first */
+  atomic_int flags;              /* METHOD_* */
+  uint16_t arg_slots;            /* including the receiver */
+  char ret;                      /* descriptor kind of the result */
+  /* bytecode with superinstructions, NULL to run method->code as is */
+  uint8_t* code;
+  /* NULL without an exception table */
+  struct handler_table* handlers;
+  /* built by the first interp_line_number() */
+  _Atomic(struct line_table*) lines;
+  struct call_site* sites; /* one per invokedynamic instruction */
+};
+
+/**
+ * Resolved constant pool entry: the class for Class entries, the
+ * holder and the member for Fieldref and Methodref entries
+ */
+struct cp_cache_entry {
+  struct class_file* class;
+  struct method_info* method;
+  uint32_t offset; /* instance field offset or static field index */
+  char kind;       /* descriptor kind of a field or a Dynamic constant */
+  union java_value value; /* Dynamic constant */
+  _Atomic(uint8_t) resolved;
+};
+
+enum class_init_state {
+  CLASS_UNINITIALIZED,
+  CLASS_INITIALIZING,
+  CLASS_INITIALIZED,
+  CLASS_INIT_ERROR,
+};
+
+struct class_hierarchy;
+struct monitor_table;
+struct native_table;
+
+/* Superclass depths a class can look up directly, see subtype.h */
+#define PRIMARY_SUPERS 8
+
+struct class_runtime {
+  struct class_file* super; /* NULL for java/lang/Object */
+  /* direct superinterfaces, NULL where unknown; size = interfaces_count */
+  struct class_file** interfaces;
+  struct method_runtime* methods;  /* size = methods_count */
+  struct cp_cache_entry* cp_cache; /* size = constant_pool_count */
+  union java_value* statics;       /* size = fields_count */
+  struct gc_heap* heap; /* static references are its roots */
+  /*
+   * enum class_init_state, changed under the interpreter lock.
+   * init_thread is the id of the thread running <clinit> while the
+   * class is being initialized
+   */
+  _Atomic(int) init_state;
+  uint64_t init_thread;
+  /*
+   * Locked by static synchronized methods in place of the Class
+   * object, outside the heap
+   */
+  struct object_header lock;
+
+  /*
+   * Linked direct subtypes, kept by class_hierarchy.c under its lock:
+   * the subclasses, or the implementors and subinterfaces
+   */
+  struct class_file** subtypes; /* size = subtype_count */
+  uint32_t subtype_count;
+  uint32_t subtype_capacity;
+  struct class_hierarchy* hierarchy; /* NULL: not recorded */
+
+  /*
+   * Supertypes for subtype checks, set by subtype.c when linking:
+   * primary[d] is the superclass at depth d, java/lang/Object being at
+   * 0, up to the class itself and NULL past it. secondary holds the
+   * superinterfaces and the superclasses too deep for primary
+   */
+  uint32_t depth;
+  struct class_file* primary[PRIMARY_SUPERS];
+  struct class_file** secondary; /* size = secondary_count */
+  uint32_t secondary_count;
+  _Atomic(struct class_file*) secondary_hit; /* last one checked for */
+};
+
+/**
+ * State shared by all interpreter threads
+ */
+struct interpreter {
+  struct gc_heap* heap; /* NULL: allocation throws OutOfMemoryError */
+
+  interp_class_resolver resolve_class;
+  void* resolve_ctx;
+
+  interp_hot_method hot_method;
+  interp_hot_loop hot_loop; /* gets hot_ctx too */
+  void* hot_ctx;
+  uint32_t hot_invocations;
+  uint32_t hot_backedges;
+  uint32_t osr_backedges;
+
+  interp_code_map code_map; /* NULL: no code records references */
+  void* code_ctx;
+
+  int superinstructions; /* fuse sequences in classes linked from now on */
+  uint64_t fused; /* superinstructions in the linked classes, under lock */
+  uint64_t intrinsics; /* methods of the linked classes, under lock */
+
+  struct class_hierarchy* hierarchy; /* records every linked class */
+  struct monitor_table* monitors;    /* inflated object locks */
+  struct native_table* natives;      /* bound when their class links */
+  _Atomic(uint64_t) thread_ids;      /* last one handed out */
+
+  pthread_mutex_t lock; /* linking and class initialization */
+  pthread_cond_t initialized; /* a class left CLASS_INITIALIZING */
+  struct verifier verifier; /* link-time checks, under lock */
+};
+
+struct interp_stats {
+  uint64_t invocations;
+  uint64_t compiled_calls;
+  uint64_t osr_entries; /* interpreted frames moved into compiled code */
+  uint64_t deoptimizations; /* compiled frames moved back */
+  uint64_t exceptions;
+  uint64_t lock_contentions; /* locks found held by another thread */
+  uint64_t lock_inflations;  /* monitors this thread put into objects */
+};
+
+/* Interpreted frame of a backtrace, its line is looked up on demand */
+struct backtrace_frame {
+  struct class_file* class;
+  struct method_info* method;
+  uint16_t bci;
+};
+
+struct interp_thread {
+  struct interpreter* interp;
+  uint64_t id; /* owner of the locks the thread holds, never 0 */
+  struct java_frame* top; /* innermost interpreted frame */
+  uint32_t depth;
+
+  union java_value* slots; /* locals and operand stacks of all frames */
+  size_t slots_used;
+  size_t slots_capacity;
+
+  /*
+   * Pending exception: exception_class is not NULL while one is
+   * pending. It names the exception the VM threw, the object is then
+   * NULL, or is java/lang/Throwable for objects thrown by athrow
+   */
+  struct object_header* exception;
+  const char* exception_class;
+  /*
+   * Interpreted frames when the last exception was thrown, innermost
+   * first. Frames that didn't fit in memory are left out
+   */
+  struct backtrace_frame* backtrace;
+  uint32_t backtrace_depth;
+  uint32_t backtrace_capacity;
+
+  struct interp_stats stats;
+  struct safepoint_thread safepoint;
+};
+
+int interpreter_init(struct interpreter* interp, struct gc_heap* heap);
+void interpreter_destroy(struct interpreter* interp);
+int interp_thread_init(struct interp_thread* thread,
+                       struct interpreter* interp, size_t stack_slots);
+void interp_thread_destroy(struct interp_thread* thread);
+
+int interp_link_class(struct interpreter* interp, struct class_file* class);
+/**
+ * Initializes a linked class as JVMS 5.5 does: its superclass first,
+ * then <clinit>, once. A thread asking for a class another thread is
+ * initializing waits for it, the thread initializing it goes on
+ */
+int interp_init_class(struct interp_thread* thread, struct class_file* class);
+void class_runtime_free(struct class_file* class);
+
+/**
+ * Resolves a Fieldref or Methodref entry of `class` once, NULL with
+ * a pending exception when the member can't be found
+ */
+struct cp_cache_entry* interp_resolve_member(struct interp_thread* thread,
+                                             struct class_file* class,
+                                             uint16_t index, int is_field);
+struct method_info* class_find_method(struct class_file* class,
+                                      const char* name,
+                                      const char* descriptor);
+int interpret(struct interp_thread* thread, struct class_file* class,
+              struct method_info* method, const union java_value* args,
+              union java_value* result);
+/**
+ * Runs a frame rebuilt by deoptimization. Its max_locals + max_stack
+ * slots must be the last ones reserved on the thread's slot stack,
+ * with `depth` operand stack slots in use. It goes on at `bci`, or
+ * looks for a handler there if an exception is pending. The slots
+ * are released on return. A synchronized frame already holds `lock`,
+ * which it releases when it returns
+ */
+int interp_resume(struct interp_thread* thread, struct class_file* class,
+                  struct method_info* method, uint32_t bci, uint16_t depth,
+                  struct object_header* lock, union java_value* result);
+int interp_invoke(struct interp_thread* thread, struct class_file* class,
+                  struct method_info* method, const union java_value* args,
+                  union java_value* result);
+/* Makes class_name pending and records the backtrace */
+void interp_throw(struct interp_thread* thread, const char* class_name);
+void interp_notify_hot(struct interp_thread* thread, struct class_file* class,
+                       struct method_info* method);
+void interp_clear_exception(struct interp_thread* thread);
+
+/**
+ * Source line of bci in the method, -1 if unknown or without memory
+ * for the method's line table, which is built the first time. The
+ * class must be linked
+ */
+int32_t interp_line_number(struct class_file* class, struct method_info* method,
+                           uint32_t bci);
+
+static inline struct method_runtime* method_runtime_of(
+    struct class_file* class, const struct method_info* method) {
+  return &class->runtime->methods[method - class->methods];
+}
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef SHIP_JVM_INTRINSICS_H
+#define SHIP_JVM_INTRINSICS_H
+
+#include "classfile.h"
+#include "interpreter.h"
+
+/*
+ * Library methods replaced by C code. The registry is a table of
+ * (class, name, descriptor) triples: a method matching one when its
+ * class links gets the C function as its compiled entry, which the
+ * interpreter and compiled code call in place of its bytecode or
+ * native, and the compilers neither compile nor inline it.
+ *
+ *   System.arraycopy, Arrays.fill and Arrays.equals of primitive
+ *   arrays, String.equals, String.hashCode, Math.abs, min, max,
+ *   sqrt, floor and ceil
+ *
+ * Fills and string hashes use AVX2, or SSE4.2 where AVX2 is missing,
+ * picked once from the processor, with scalar code as the fallback;
+ * copies and compares go to memmove and memcmp, which libc already
+ * vectorizes.
+ * An intrinsic doesn't poll, no collection runs in its middle.
+ *
+ * The string intrinsics work on the java/lang/String class that
+ * linked last: a char[] value (JDK 8) or a byte[] value with a coder
+ * (JDK 9 and later), and an int hash cache when there is one. A
+ * String without a value field gets no intrinsics.
+ */
+
+/**
+ * Entry replacing a method of a class being linked, NULL if the
+ * method has no intrinsic. Called by the interpreter
+ */
+compiled_entry intrinsic_bind(struct class_file* class,
+                              struct method_info* method);
+
+/**
+ * Makes the fills and hashes use "avx2", "sse4.2" or "scalar" code, for
+ * measurements. ENOTSUP when the processor lacks the instructions
+ */
+int intrinsic_use_isa(const char* isa);
+/* Instruction set the fills and hashes use */
+const char* intrinsic_isa(void);
+
+#endif
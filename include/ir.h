@@ -0,0 +1,283 @@
+#ifndef SHIP_JVM_IR_H
+#define SHIP_JVM_IR_H
+
+#include <stdint.h>
+
+#include "class_hierarchy.h"
+#include "classfile.h"
+#include "deopt.h"
+#include "template_jit.h"
+#include "x86_64.h"
+
+/*
+ * SSA intermediate representation of the optimizing compiler.
+ *
+ * A function is a graph of basic blocks holding instructions. Every
+ * instruction defines at most one value, named by its index in
+ * ir_function.instrs, and reads its operands from the shared
+ * ir_function.operands array. Phis come first in a block, the
+ * terminator (IR_IF, IR_GOTO, IR_RETURN) comes last. The operand i
+ * of a phi flows in from predecessor i.
+ *
+ * Instructions are never deleted while the passes run. A replaced
+ * instruction forwards to its replacement, and readers go through
+ * ir_resolve(). Checks produce the checked value so instructions
+ * that rely on a check depend on it through the data flow and can't
+ * be moved above it.
+ *
+ * A failed check deoptimizes: it carries the interpreter state before
+ * its instruction, whose values stay live up to the check, and the
+ * interpreter runs the instruction again and throws.
+ *
+ * Allocations never reach the code: escape analysis replaces those
+ * that stay in the function by their field values, which the states
+ * carry so deoptimization can allocate the objects again.
+ */
+
+#define IR_NONE UINT32_MAX
+
+enum ir_op {
+  IR_NOP, /* removed */
+  IR_CONST,
+  IR_PARAM, /* imm = argument slot */
+  IR_PHI,
+  IR_ADD,
+  IR_SUB,
+  IR_MUL,
+  IR_DIV, /* the divisor comes from IR_ZERO_CHECK */
+  IR_REM,
+  IR_AND,
+  IR_OR,
+  IR_XOR,
+  IR_SHL,
+  IR_SHR,
+  IR_USHR,
+  IR_NEG,
+  IR_I2B,
+  IR_I2C,
+  IR_I2S,
+  IR_NULL_CHECK,   /* args[0] or NullPointerException */
+  IR_ZERO_CHECK,   /* args[0] or ArithmeticException */
+  IR_BOUNDS_CHECK, /* index args[0] below length args[1] or throws */
+  IR_ARRAY_LENGTH,
+  IR_ARRAY_LOAD,  /* array, index; imm = T_* element type */
+  IR_ARRAY_STORE, /* array, index, value; imm = T_* element type */
+  IR_FIELD_LOAD,  /* object; imm = offset of an int field */
+  IR_FIELD_STORE, /* object, value; imm = offset of an int field */
+  IR_NEW,         /* imm = index in ir_function.objects */
+  IR_CALL,        /* arguments; imm = call site */
+  IR_IF,          /* a cond b: succs[0] if true, succs[1] otherwise */
+  IR_GOTO,
+  IR_RETURN, /* optional value */
+};
+
+/* Same order as ifeq..ifle and if_icmpeq..if_icmple */
+enum ir_cond {
+  IR_EQ,
+  IR_NE,
+  IR_LT,
+  IR_GE,
+  IR_GT,
+  IR_LE,
+};
+
+struct ir_instr {
+  uint8_t op;   /* enum ir_op */
+  uint8_t cond; /* enum ir_cond of IR_IF */
+  char type;    /* 'I' int, 'A' reference or 'V' no value */
+  uint32_t block;
+  int32_t imm;
+  uint32_t args; /* first operand in ir_function.operands */
+  uint16_t arg_count;
+  uint32_t forward; /* replacement, IR_NONE while live */
+  uint32_t state; /* ir_state of a check, IR_NONE otherwise */
+};
+
+/*
+ * Interpreter frame at a bytecode instruction, chained to the state
+ * of the call it is inlined at
+ */
+struct ir_state {
+  uint32_t caller; /* IR_NONE for the compiled method itself */
+  struct class_file* class;
+  struct method_info* method;
+  uint16_t bci;
+  uint16_t local_count;
+  uint16_t stack_count;
+  /*
+   * Scalar replaced objects the frames of the chain refer to, each as
+   * its IR_NEW followed by its field values, after the stack slots
+   */
+  uint16_t object_values;
+  uint32_t values; /* locals then stack slots in ir_function.operands */
+};
+
+/* Allocation of an instance, scalar replaced if it doesn't escape */
+struct ir_object {
+  uint32_t instr; /* IR_NEW */
+  struct class_file* class;
+  int32_t* offsets; /* int fields, the others stay zero; size = field_count */
+  uint16_t field_count;
+};
+
+struct ir_block {
+  uint32_t* instrs; /* size = instr_count */
+  uint32_t instr_count;
+  uint32_t instr_capacity;
+  uint32_t* preds; /* size = pred_count */
+  uint32_t pred_count;
+  uint32_t pred_capacity;
+  uint32_t succs[2];
+  uint8_t succ_count;
+
+  /* Filled by ir_compute_dominators */
+  uint32_t idom;
+  uint32_t order; /* position in reverse postorder, IR_NONE if dead */
+  uint32_t loop_header; /* innermost loop, IR_NONE outside loops */
+  uint16_t loop_depth;
+
+  /* SSA construction */
+  uint32_t* defs; /* current value of each variable, size = def_count */
+  uint32_t def_count;
+  uint32_t* incomplete; /* variable, phi pairs waiting for sealing */
+  uint32_t incomplete_count; /* pairs */
+  uint32_t incomplete_capacity;
+  uint32_t expected_preds;
+  uint8_t sealed;
+  struct method_info* method; /* bytecode origin, NULL for synthetic */
+  uint16_t bci;
+  uint32_t state; /* at the start of a loop header, IR_NONE otherwise */
+};
+
+struct ir_stats {
+  uint32_t inlined;
+  uint32_t folded;    /* constant folded or simplified */
+  uint32_t gvn;       /* replaced by an equal dominating value */
+  uint32_t hoisted;   /* moved out of loops */
+  uint32_t checks;    /* bounds and null checks removed */
+  uint32_t devirtualized; /* virtual calls with a single target */
+  uint32_t scalar_replaced; /* allocations that don't escape */
+  uint32_t locks_elided;    /* synchronized callees of such objects */
+  uint32_t spills;
+};
+
+struct ir_function {
+  struct class_file* class;
+  struct method_info* method;
+
+  struct ir_instr* instrs; /* size = instr_count */
+  uint32_t instr_count;
+  uint32_t instr_capacity;
+  uint32_t* operands;
+  uint32_t operand_count;
+  uint32_t operand_capacity;
+  struct ir_block* blocks; /* size = block_count */
+  uint32_t block_count;
+  uint32_t block_capacity;
+  uint32_t entry;
+
+  uint32_t* order; /* reachable blocks in reverse postorder */
+  uint32_t order_count;
+
+  uint32_t var_count; /* SSA construction variables */
+
+  struct ir_state* states; /* size = state_count */
+  uint32_t state_count;
+  uint32_t state_capacity;
+
+  struct ir_object* objects; /* size = object_count */
+  uint32_t object_count;
+  uint32_t object_capacity;
+
+  /*
+   * IR_NONE, or the loop header an OSR entry starts at. The entry then
+   * takes the interpreter's locals followed by its operand stack
+   */
+  uint32_t osr_bci;
+
+  /* Calls left after inlining, their sites live in the code */
+  struct jit_call_site* sites;
+  uint32_t site_count;
+  uint32_t site_capacity;
+  uint16_t max_call_args;
+
+  /* Debug info of the deoptimization points, lives with the code */
+  struct deopt_table* deopt;
+
+  /* NULL: virtual calls are not compiled */
+  struct class_hierarchy* hierarchy;
+  /* Answers of the hierarchy the code relies on, lives with the code */
+  struct cha_dependencies* dependencies;
+
+  struct ir_stats stats;
+  int error;
+};
+
+void ir_init(struct ir_function* func, struct class_file* class,
+             struct method_info* method);
+void ir_destroy(struct ir_function* func);
+
+uint32_t ir_new_block(struct ir_function* func);
+uint32_t ir_emit(struct ir_function* func, uint32_t block, uint8_t op,
+                 char type, int32_t imm, const uint32_t* args,
+                 uint16_t arg_count);
+uint32_t ir_new_phi(struct ir_function* func, uint32_t block, char type);
+void ir_set_phi_operands(struct ir_function* func, uint32_t phi,
+                         const uint32_t* values);
+void ir_add_edge(struct ir_function* func, uint32_t from, uint32_t to);
+void ir_remove_from_block(struct ir_function* func, uint32_t id);
+void ir_append(struct ir_function* func, uint32_t block, uint32_t id);
+void ir_replace(struct ir_function* func, uint32_t id, uint32_t by);
+uint32_t ir_resolve(const struct ir_function* func, uint32_t id);
+uint32_t ir_new_state(struct ir_function* func, uint32_t caller,
+                      struct class_file* class, struct method_info* method,
+                      uint16_t bci, const uint32_t* values,
+                      uint16_t local_count, uint16_t stack_count,
+                      uint16_t object_values);
+/* Number of values of a state, the objects' included */
+uint32_t ir_state_size(const struct ir_state* state);
+uint32_t ir_arg(const struct ir_function* func, const struct ir_instr* instr,
+                uint16_t index);
+int ir_is_const(const struct ir_function* func, uint32_t id, int32_t* value);
+
+int ir_compute_dominators(struct ir_function* func);
+int ir_dominates(const struct ir_function* func, uint32_t a, uint32_t b);
+
+/* Static callees up to this size are inlined, like HotSpot's MaxInlineSize */
+#define IR_INLINE_MAX_CODE 35
+#define IR_INLINE_MAX_DEPTH 4
+
+/**
+ * Translates a method of the int subset with int arrays, int fields
+ * and allocations into SSA, inlining small callees. Virtual calls
+ * must have a single target by class hierarchy analysis or by the
+ * exact class of an allocation. ENOTSUP for other methods. An OSR
+ * function starts at osr_bci and holds only the code reachable from
+ * there, its params are typed by the oop map of that bci
+ */
+int ir_build(struct ir_function* func);
+
+/* Passes, they keep dominators up to date */
+void ir_fold_and_gvn(struct ir_function* func);
+void ir_hoist_invariants(struct ir_function* func);
+void ir_eliminate_range_checks(struct ir_function* func);
+void ir_remove_dead(struct ir_function* func);
+
+/**
+ * Escape analysis. Replaces each allocation that is only read and
+ * written by field accesses with the SSA values of its fields and
+ * adds the objects to the states of the checks that may need them.
+ * Compiled code can't allocate, an escaping allocation leaves ENOTSUP
+ * in func->error
+ */
+void ir_scalar_replace(struct ir_function* func);
+
+/**
+ * Generates x86-64 code with linear-scan register allocation. The
+ * code follows the compiled_entry convention and refers to the
+ * deoptimization table it leaves in func->deopt and to
+ * func->dependencies, which it checks on entry
+ */
+int ir_generate(struct ir_function* func, struct x86_asm* a);
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef SHIP_JVM_LINE_TABLE_H
+#define SHIP_JVM_LINE_TABLE_H
+
+#include <stdint.h>
+
+#include "classfile.h"
+
+/*
+ * Compact line number index of a method.
+ *
+ * The LineNumberTable attributes of the code stay raw in the class
+ * file until a line is first asked for, which only happens when a
+ * stack trace element is materialized. The method then gets its
+ * entries sorted by start_pc in a blob of varints: the distance to
+ * the previous start_pc and the zigzag encoded change of the line,
+ * mostly one byte each. Every LINE_TABLE_STRIDE-th entry is also kept
+ * whole in a skip index, a lookup binary searches the index and
+ * decodes at most LINE_TABLE_STRIDE - 1 entries after it.
+ */
+
+#define LINE_TABLE_STRIDE 16
+
+struct line_skip {
+  uint16_t start_pc;
+  uint16_t line;
+  uint32_t offset; /* in the blob, of the entry after this one */
+};
+
+struct line_table {
+  uint32_t count; /* entries */
+  uint32_t skip_count;
+  struct line_skip* skips; /* size = skip_count */
+  uint8_t* blob;           /* count - skip_count entries */
+};
+
+/**
+ * Line table of the code, one without entries when the code has no
+ * LineNumberTable. NULL without memory
+ */
+struct line_table* line_table_build(struct class_file* class,
+                                    const struct Code_attribute* code);
+void line_table_free(struct line_table* table);
+
+/* Source line of the instruction at bci, -1 if unknown */
+int32_t line_table_lookup(const struct line_table* table, uint32_t bci);
+
+#endif
@@ -0,0 +1,104 @@
+#ifndef SHIP_JVM_MARK_COMPACT_H
+#define SHIP_JVM_MARK_COMPACT_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "gc.h"
+
+/*
+ * Parallel mark-compact collector of the old generation.
+ * Young objects are treated as roots and are not moved.
+ *
+ *   mark     workers trace from the roots with work-stealing deques
+ *   summary  live bytes per region give each region its destination
+ *   forward  every region gets a table old address -> new address
+ *   adjust   references in roots, young and old objects are updated
+ *   compact  regions slide down once their destination is free
+ */
+
+#define MC_REGION_SHIFT 16
+#define MC_REGION_SIZE ((size_t)1 << MC_REGION_SHIFT)
+#define MC_DEQUE_CAPACITY (1 << 14)
+
+struct mc_forward {
+  uint8_t* from;
+  uint8_t* to;
+};
+
+struct mc_region {
+  _Atomic(size_t) live_bytes;
+  uint8_t* dest;    /* where the first live object of the region goes */
+  uint8_t* src_end; /* end of the last live object starting here */
+
+  struct mc_forward* forward; /* sorted by from, size = forward_count */
+  size_t forward_count;
+  size_t forward_capacity;
+
+  atomic_int compacted;
+};
+
+/**
+ * Chase-Lev work-stealing deque of grey objects
+ */
+struct mc_deque {
+  _Atomic(int64_t) top;
+  _Atomic(int64_t) bottom;
+  _Atomic(struct object_header*)* items; /* size = MC_DEQUE_CAPACITY */
+};
+
+/**
+ * Per worker statistics of the last collection
+ */
+struct mc_worker_stats {
+  uint64_t marked_objects;
+  uint64_t marked_bytes;
+  uint64_t steals;
+  uint64_t steal_attempts;
+  uint64_t overflows;
+  uint64_t idle_ns;
+  uint64_t regions_compacted;
+};
+
+struct mark_compact {
+  struct gc_heap* gh;
+  unsigned workers;
+
+  struct mc_region* regions; /* size = region_count */
+  size_t region_count;
+  _Atomic(uint64_t)* bitmap; /* one bit per 8 bytes of the old generation */
+  size_t bitmap_words;
+
+  struct mc_deque* deques; /* size = workers */
+  struct mc_worker_stats* stats; /* size = workers */
+
+  /* Grey objects that did not fit into a full deque */
+  pthread_mutex_t overflow_lock;
+  struct object_header** overflow;
+  size_t overflow_count;
+  size_t overflow_capacity;
+  atomic_size_t overflow_size;
+
+  /* Per collection state */
+  atomic_uint barrier_waiting;
+  atomic_uint barrier_generation;
+  atomic_uint idle_workers;
+  atomic_size_t next_task;
+  uint8_t* new_top;
+  atomic_int failed;
+
+  uint64_t collections;
+  uint64_t last_pause_ns;
+  uint64_t total_pause_ns;
+  uint64_t live_bytes;
+};
+
+int mark_compact_init(struct mark_compact* mc, struct gc_heap* gh,
+                      unsigned workers);
+void mark_compact_destroy(struct mark_compact* mc);
+int mark_compact_collect(struct mark_compact* mc);
+void mark_compact_print_stats(const struct mark_compact* mc);
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef SHIP_JVM_MONITOR_H
+#define SHIP_JVM_MONITOR_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "heap.h"
+#include "interpreter.h"
+
+/*
+ * Object locks for synchronized methods and monitorenter/monitorexit.
+ *
+ * A lock lives in the mark word of the object while no other thread
+ * wants it: locking an unlocked object is one CAS writing the owner
+ * thread's id, locking it again in the owner bumps a recursion count
+ * in the same word. A thread finding the object locked by another one
+ * inflates the lock: it makes a monitor that the owner holds with its
+ * count, and swaps it into the mark word. From then on the object is
+ * locked through the monitor. A monitor spins for a while before it
+ * sleeps on a futex, for as long as spinning recently paid off, and
+ * is never deflated.
+ *
+ * Monitors are kept in chunks that never move, the mark word names a
+ * monitor by its index.
+ */
+
+#define MONITOR_CHUNK_SIZE 1024
+#define MONITOR_MAX_CHUNKS 4096
+
+#define MONITOR_MIN_SPIN 16
+#define MONITOR_MAX_SPIN 4096
+
+struct monitor {
+  /* 0 free, 1 held, 2 held and maybe someone sleeps on it */
+  _Atomic(uint32_t) futex;
+  _Atomic(uint32_t) spin; /* attempts before sleeping */
+  _Atomic(uint64_t) owner; /* thread id, 0 when free */
+  uint32_t recursions;    /* beyond the first enter, owner only */
+  uint32_t next_free;     /* index + 1 in the free list, 0 at the end */
+};
+
+struct monitor_table {
+  pthread_mutex_t lock; /* allocation */
+  _Atomic(struct monitor*) chunks[MONITOR_MAX_CHUNKS];
+  uint32_t count;     /* monitors handed out from the chunks */
+  uint32_t free_list; /* index + 1 of a monitor lost in a race, or 0 */
+};
+
+struct monitor_table* monitor_table_new(void);
+void monitor_table_free(struct monitor_table* table);
+
+/**
+ * Locks obj for the thread, waiting for other owners. ENOMEM when a
+ * monitor is needed and can't be made
+ */
+int monitor_enter(struct interp_thread* thread, struct object_header* obj);
+
+/**
+ * Unlocks obj once. EPERM when the thread doesn't hold it, the lock
+ * is then untouched
+ */
+int monitor_exit(struct interp_thread* thread, struct object_header* obj);
+
+#endif
@@ -0,0 +1,98 @@
+#ifndef SHIP_JVM_NATIVE_H
+#define SHIP_JVM_NATIVE_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "code_cache.h"
+#include "descriptor.h"
+#include "interpreter.h"
+
+/*
+ * Native methods. The embedder registers a C function for an
+ * ACC_NATIVE method before its class is linked, linking binds the
+ * method to a stub that becomes its compiled entry: the interpreter
+ * and compiled code call it like compiled Java code, without any
+ * per call marshalling.
+ *
+ * A stub is generated once per descriptor and kind of native and
+ * moves the arguments from the caller's operand stack slots straight
+ * into the System V registers, then onto the stack where those run
+ * out. Each method gets a few instructions in front of the shared
+ * stub loading its function.
+ *
+ * A normal native is called as
+ *   ret f(struct interp_thread* thread, class_or_receiver, args...)
+ * with the struct class_file* of a static method or a handle of the
+ * receiver. Reference arguments are passed as handles, pointers to
+ * the caller's argument slots which the collector updates: *handle
+ * is the object, NULL for null. A reference result is returned as a
+ * handle too, NULL for null. The thread is blocked for safepoints
+ * during the call, the native must not touch objects except through
+ * handles. It throws with interp_throw().
+ *
+ * A critical native (NATIVE_CRITICAL) is a static method taking and
+ * returning only primitives, called as ret f(args...) with no state
+ * transition: the stub usually just loads the registers and jumps.
+ * It must be short, safepoints wait for it, and can't throw.
+ */
+
+#define NATIVE_CRITICAL 0x1
+
+#define NATIVE_CODE_SIZE ((size_t)256 << 10)
+
+struct native_method {
+  struct native_method* next;
+  char* class_name; /* binary name, java/lang/Object */
+  char* name;
+  char* descriptor;
+  void* function;
+  uint32_t flags; /* NATIVE_* */
+};
+
+/* Shared by the methods with the same key */
+struct native_stub {
+  struct native_stub* next;
+  char* key; /* kind of native and descriptor */
+  void* code;
+};
+
+struct native_stats {
+  uint64_t bound;    /* methods given an entry */
+  uint64_t critical; /* of those, critical natives */
+  uint64_t stubs;    /* shared stubs generated */
+  uint64_t code_bytes;
+};
+
+struct native_table {
+  pthread_mutex_t lock;
+  struct native_method* methods;
+  struct native_stub* stubs;
+  struct code_cache code; /* mapped by the first binding */
+  struct native_stats stats;
+};
+
+struct native_table* native_table_new(void);
+void native_table_free(struct native_table* table);
+
+/**
+ * Registers the function of a native method, EINVAL for a malformed
+ * descriptor or a critical native with reference arguments or result
+ */
+int native_register(struct native_table* table, const char* class_name,
+                    const char* name, const char* descriptor,
+                    void* function, uint32_t flags);
+
+/**
+ * Entry of a native method of a class being linked, NULL without a
+ * registered function or when the method can't be bound. Called by
+ * the interpreter
+ */
+compiled_entry native_bind(struct native_table* table,
+                           struct class_file* class,
+                           struct method_info* method,
+                           const struct method_descriptor* desc);
+
+void native_get_stats(struct native_table* table, struct native_stats* stats);
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef SHIP_JVM_OOP_MAP_H
+#define SHIP_JVM_OOP_MAP_H
+
+#include <stdint.h>
+
+#include "classfile.h"
+#include "frame.h"
+#include "gc.h"
+
+/*
+ * Oop maps tell the collector which slots of a frame hold references.
+ *
+ * They are built from the StackMapTable: its frames give the exact
+ * types at branch targets and exception handlers, the straight-line
+ * code between two frames is followed tracking only whether a slot
+ * holds a reference. An entry is kept for every safepoint, that is
+ * the method entry, every stack map frame, every instruction that
+ * calls into the runtime or allocates, every backward branch and
+ * every return. An entry describes the frame before its instruction runs.
+ */
+
+struct oop_map_entry {
+  uint16_t bci;
+  uint16_t stack_depth; /* operand stack slots in use */
+};
+
+struct oop_map {
+  uint16_t max_locals;
+  uint16_t max_stack;
+  uint16_t words; /* bitmap words per entry */
+  uint32_t count;
+  struct oop_map_entry* entries; /* sorted by bci, size = count */
+  /*
+   * count * words bitmaps. Bit i < max_locals is local i,
+   * bit max_locals + j is operand stack slot j from the bottom
+   */
+  uint32_t* bits;
+};
+
+int oop_map_build(struct class_file* class, struct method_info* method);
+int class_build_oop_maps(struct class_file* class);
+void oop_map_free(struct oop_map* map);
+
+int32_t oop_map_find(const struct oop_map* map, uint16_t bci);
+int oop_map_visit_frame(const struct oop_map* map, struct java_frame* frame,
+                        gc_slot_visitor visit, void* ctx);
+void oop_map_scan_frames(gc_slot_visitor visit, void* visit_ctx, void* ctx);
+
+/**
+ * gc_root_scanner over every interpreter thread, during a safepoint:
+ * their interpreted frames, pending exceptions and the references of
+ * the compiled code they are parked in. ctx is unused
+ */
+void oop_map_scan_threads(gc_slot_visitor visit, void* visit_ctx, void* ctx);
+
+static inline int oop_map_is_ref(const struct oop_map* map, uint32_t index,
+                                 uint32_t slot) {
+  const uint32_t* bits = map->bits + (size_t)index * map->words;
+  return (int)((bits[slot >> 5] >> (slot & 31)) & 1);
+}
+
+#endif
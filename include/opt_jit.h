@@ -0,0 +1,85 @@
+#ifndef SHIP_JVM_OPT_JIT_H
+#define SHIP_JVM_OPT_JIT_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "classfile.h"
+#include "code_cache.h"
+#include "interpreter.h"
+#include "ir.h"
+#include "template_jit.h"
+
+/*
+ * Optimizing compiler. A hot method is translated into SSA with its
+ * small callees inlined, optimized (constant folding, global
+ * value numbering, loop-invariant code motion, range check
+ * elimination, dead code elimination) and compiled with linear-scan
+ * register allocation.
+ *
+ * It covers the int subset of the template compiler plus references,
+ * int, byte, char and short arrays, int fields and the virtual calls
+ * class hierarchy analysis binds to a single target; the code is
+ * invalidated when a class linked later breaks that. Compiled code
+ * can't allocate: objects created with `new` must not escape the
+ * method, their fields become values and synchronized callees inlined
+ * on them take no lock. Compiled code polls for safepoints at
+ * backward branches and returns, which record the references live
+ * there; calls record none, so methods that keep references across a
+ * call that wasn't inlined are rejected. Checks the optimizer can't prove redundant stay in the
+ * code and deoptimize when they fail: the interpreter rebuilds the
+ * frames of the method and of its inlined callees, and the objects
+ * they refer to, at the failing instruction and throws from there.
+ *
+ * Loops that keep running in the interpreter get an OSR entry at
+ * their header, the interpreter jumps into it at the next backedge.
+ *
+ * The compiler is the interpreter's code map, which finds the polls of
+ * the code a parked thread stopped in.
+ */
+
+struct opt_jit_stats {
+  uint64_t compiled;
+  uint64_t rejected;
+  uint64_t osr_compiled;
+  uint64_t osr_rejected;
+  uint64_t code_bytes;
+  uint64_t compile_ns;
+  struct ir_stats ir; /* summed over compiled methods */
+};
+
+struct opt_jit {
+  struct interpreter* interp;
+  struct code_cache cache;
+  pthread_mutex_t lock;
+  struct jit_method* methods; /* compiled so far, newest first */
+  struct opt_jit_stats stats;
+};
+
+/**
+ * Installs the compiler as the hot method and hot loop hook of the
+ * interpreter.
+ * Classes must not run compiled code after opt_jit_destroy
+ */
+int opt_jit_init(struct opt_jit* jit, struct interpreter* interp,
+                 size_t code_size);
+void opt_jit_destroy(struct opt_jit* jit);
+
+/**
+ * Compiles the method of a linked class and publishes its entry in
+ * place of any baseline code. ENOTSUP marks the method as not
+ * optimizable
+ */
+int opt_jit_compile(struct opt_jit* jit, struct class_file* class,
+                    struct method_info* method);
+
+/**
+ * Compiles an OSR entry of the method at the loop header `bci` and
+ * adds it to the method's entries. Rejection leaves the method's
+ * normal entry alone
+ */
+int opt_jit_compile_osr(struct opt_jit* jit, struct class_file* class,
+                        struct method_info* method, uint32_t bci);
+void opt_jit_print_stats(const struct opt_jit* jit);
+
+#endif
@@ -0,0 +1,117 @@
+#ifndef SHIP_JVM_SAFEPOINT_H
+#define SHIP_JVM_SAFEPOINT_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+/*
+ * Safepoints: stopping every thread that runs Java code at a point
+ * where its frames are described, for the collector and anything else
+ * that must see the threads still.
+ *
+ * Java code polls at backward branches and at returns, in the
+ * interpreter and in compiled code, by reading one byte of a global
+ * polling page, which costs a load and no branch. Starting an
+ * operation makes the page unreadable: the next poll of each thread
+ * faults, and the SIGSEGV handler parks the thread until the
+ * operation ends, then returns so the poll reads again. The parked
+ * thread's registers are in the signal context meanwhile, where the
+ * collector can find and update references compiled code keeps.
+ *
+ * A registered thread is running while it is inside Java code and not
+ * blocked, the operation waits only for those: a thread blocked on a
+ * lock or outside Java is already safe, and parks when it comes back
+ * into Java during the operation. Threads must not wait on a lock
+ * whose owner may wait for a safepoint unless they are blocked.
+ *
+ * The page lies in the low 2 GiB so compiled code polls with one
+ * test instruction on its absolute address.
+ */
+
+#define SAFEPOINT_SAFE 0    /* outside Java code or blocked */
+#define SAFEPOINT_RUNNING 1 /* must reach a poll */
+/*
+ * Stopped at a poll, the state also holds the number of operations
+ * ended before: a thread still leaving the last one isn't stopped
+ * for the next
+ */
+#define SAFEPOINT_PARKED 2
+#define SAFEPOINT_PARKED_IN(epoch) ((uint32_t)(epoch) << 2 | SAFEPOINT_PARKED)
+
+#define SAFEPOINT_MAX_OPERATIONS 16
+
+/* Read by every poll, unreadable while an operation runs */
+extern const volatile uint8_t* safepoint_polling_page;
+
+#define SAFEPOINT_POLL() ((void)*safepoint_polling_page)
+
+struct safepoint_thread {
+  _Atomic(uint32_t) state; /* SAFEPOINT_* or PARKED_IN, a futex */
+  uint32_t depth;   /* nested safepoint_enter() */
+  uint32_t blocked; /* nested safepoint_block() */
+  void* owner;      /* the embedder's thread */
+  void* context;    /* ucontext_t of the poll while parked */
+  struct safepoint_thread* next;
+};
+
+/* Time to safepoint of one kind of operation */
+struct safepoint_stats {
+  const char* operation;
+  uint64_t count;
+  uint64_t ttsp_ns; /* summed */
+  uint64_t max_ttsp_ns;
+  uint64_t total_ns; /* from the request to the end */
+};
+
+/**
+ * Maps the polling page and installs the SIGSEGV handler, once per
+ * process. ENOMEM when the page can't be mapped low
+ */
+int safepoint_init(void);
+
+/* The page address compiled code polls, below 2 GiB */
+uint32_t safepoint_poll_address(void);
+
+/**
+ * Registers a thread, safe until it enters Java code. The thread
+ * structure must stay in place until safepoint_detach()
+ */
+void safepoint_attach(struct safepoint_thread* thread, void* owner);
+void safepoint_detach(struct safepoint_thread* thread);
+
+/**
+ * Marks the calling thread as running Java code, parking first while
+ * an operation runs. Nests, the outermost safepoint_leave() makes the
+ * thread safe again
+ */
+void safepoint_enter(struct safepoint_thread* thread);
+void safepoint_leave(struct safepoint_thread* thread);
+
+/**
+ * Brackets a wait of the calling thread, which counts as safe in
+ * between. Nothing for a thread outside Java code
+ */
+void safepoint_block(void);
+void safepoint_unblock(void);
+
+/**
+ * Stops every running thread at its next poll. `operation` names the
+ * kind of operation in the statistics and must be a string literal.
+ * Operations don't nest and run one at a time
+ */
+void safepoint_begin(const char* operation);
+void safepoint_end(void);
+
+/**
+ * Calls visit for every registered thread. Only between
+ * safepoint_begin() and safepoint_end()
+ */
+void safepoint_for_each_thread(void (*visit)(struct safepoint_thread* thread,
+                                             void* ctx),
+                               void* ctx);
+
+/* Copies the statistics of up to max kinds of operations, returns how many */
+uint32_t safepoint_get_stats(struct safepoint_stats* stats, uint32_t max);
+void safepoint_print_stats(void);
+
+#endif
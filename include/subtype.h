@@ -0,0 +1,34 @@
+#ifndef SHIP_JVM_SUBTYPE_H
+#define SHIP_JVM_SUBTYPE_H
+
+#include "classfile.h"
+#include "interpreter.h"
+
+/*
+ * Subtype checks for checkcast, instanceof and exception handlers.
+ * Linking gives each class a display of its superclasses by depth,
+ * so whether it extends a class less than PRIMARY_SUPERS deep is one
+ * load and compare. Interfaces and deeper classes are looked up in
+ * the flattened list of secondary supertypes, which remembers its
+ * last hit: a site checking against the same interface again and
+ * again finds it without the scan.
+ */
+
+/**
+ * Fills the supertypes of a class being linked from its
+ * runtime->super and runtime->interfaces, which are linked already.
+ * ENOMEM
+ */
+int subtype_link(struct class_file* class, struct class_runtime* runtime);
+/* Frees what subtype_link() allocated */
+void subtype_free(struct class_runtime* runtime);
+
+/**
+ * Whether instances of `class` are instances of the linked class
+ * `of`. A superinterface that wasn't found can't be `of`, nor can the
+ * interfaces it extends be known
+ */
+int subtype_of(struct class_file* class, struct class_runtime* runtime,
+               struct class_file* of);
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef SHIP_JVM_SUPERINSTRUCTIONS_H
+#define SHIP_JVM_SUPERINSTRUCTIONS_H
+
+#include <stdint.h>
+
+#include "classfile.h"
+
+/*
+ * Superinstructions: one interpreter dispatch for a whole sequence of
+ * instructions that javac emits over and over.
+ *
+ * Linking gives each method a copy of its bytecode for the interpreter
+ * in which the first opcode of every sequence found is replaced by the
+ * superinstruction's opcode. Nothing else moves: the operands and the
+ * instructions after the first stay as they are, so branch offsets,
+ * exception ranges, stack map frames and every bci the runtime knows
+ * stay valid, and a branch into the middle of a sequence runs the
+ * original instructions from there. A superinstruction reads its
+ * pieces from the original bytecode and moves bci to the last of them
+ * before anything that may throw or branch.
+ *
+ * The sequences are the ones javac emits most in int code: an int
+ * local and an operand combined, compared or stored, a field read
+ * from a local object and the increment closing a counted loop.
+ */
+
+#define OP_LOAD_PUSH_IOP_STORE 0xcb /* iload, int push, int op, istore */
+#define OP_LOAD_PUSH_IOP 0xcc       /* iload, int push, int op */
+#define OP_LOAD_PUSH_IF 0xcd        /* iload, int push, if_icmp<cond> */
+#define OP_PUSH_IOP 0xce            /* int push, int op */
+#define OP_IOP_STORE 0xcf           /* int op, istore */
+#define OP_ALOAD_GETFIELD 0xd0      /* aload, getfield */
+#define OP_IINC_GOTO 0xd1           /* iinc, goto */
+
+/*
+ * An int push is iload, iconst, bipush or sipush, an int op one of
+ * iadd, isub, imul, iand, ior, ixor, ishl, ishr and iushr, which can't
+ * throw
+ */
+
+/**
+ * Interpreter copy of the code with superinstructions, NULL when no
+ * sequence was found or without memory, the bytecode then runs as is.
+ * The number of superinstructions is added to *count
+ */
+uint8_t* superinstructions_rewrite(const struct Code_attribute* code,
+                                   uint32_t* count);
+
+#endif
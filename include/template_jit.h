@@ -0,0 +1,121 @@
+#ifndef SHIP_JVM_TEMPLATE_JIT_H
+#define SHIP_JVM_TEMPLATE_JIT_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "class_hierarchy.h"
+#include "classfile.h"
+#include "code_cache.h"
+#include "deopt.h"
+#include "interpreter.h"
+
+/*
+ * Baseline compiler. Each bytecode of a hot method is expanded into a
+ * fixed x86-64 template in one pass over its Code attribute. Locals
+ * and operand stack slots live in the native frame at fixed offsets,
+ * the top of the stack is cached in eax between templates and spilled
+ * before branches and calls.
+ *
+ * Only methods in the int subset are compiled: int locals and
+ * arguments, int arithmetic, branches, invokestatic of int methods
+ * and no exception handlers. Others stay in the interpreter.
+ *
+ * Compiled code keeps rbx = thread. Exceptions are left pending in
+ * the thread and the code returns at once; callers check
+ * exception_class after every call. Backward branches and returns
+ * poll for safepoints, the frame holds no references to report there.
+ *
+ * Under a tiering policy the code keeps counting invocations and
+ * backedges in method_runtime so hot methods move on to the
+ * optimizing compiler.
+ */
+
+struct jit_call_site;
+
+typedef int64_t (*jit_call_target)(struct interp_thread* thread,
+                                   union java_value* args,
+                                   struct jit_call_site* site);
+
+/**
+ * Call site in compiled code, the code calls through `target`. It
+ * starts at a stub that resolves the callee and runs it, and is
+ * patched to the compiled entry of the callee once there is one
+ */
+struct jit_call_site {
+  _Atomic(jit_call_target) target;
+  struct class_file* class; /* caller */
+  uint16_t index;           /* Methodref constant of the call */
+  /* devirtualized callee and its class, NULL to resolve index */
+  struct method_info* method;
+  struct class_file* holder;
+};
+
+/* Points a new site of `class` at the resolving stub */
+void jit_call_site_init(struct jit_call_site* site, struct class_file* class,
+                        uint16_t index);
+
+struct jit_method {
+  struct jit_method* next;
+  struct class_file* class;
+  struct method_info* method;
+  void* code;
+  size_t code_size;
+  struct jit_call_site* sites; /* size = site_count */
+  uint32_t site_count;
+  struct osr_entry* osr; /* NULL unless the code is an OSR entry */
+  struct deopt_table* deopt; /* debug info of optimized code */
+  struct cha_dependencies* dependencies; /* NULL if it assumes nothing */
+};
+
+/**
+ * Points the call sites of `methods` that call `from` at `to`, after
+ * a method got recompiled. The caller keeps the list from changing
+ */
+void jit_retarget_sites(struct jit_method* methods, compiled_entry from,
+                        compiled_entry to);
+
+struct template_jit_stats {
+  uint64_t compiled;
+  uint64_t rejected; /* outside the int subset */
+  uint64_t code_bytes;
+  uint64_t compile_ns;
+};
+
+struct template_jit {
+  struct interpreter* interp;
+  struct code_cache cache;
+  pthread_mutex_t lock;
+  struct jit_method* methods; /* compiled so far, newest first */
+  struct template_jit_stats stats;
+
+  /*
+   * Code compiled from now on counts its invocations and backedges
+   * and calls interp_notify_hot when a counter reaches these, 0 keeps
+   * it from counting
+   */
+  uint32_t hot_invocations;
+  uint32_t hot_backedges;
+};
+
+/**
+ * Installs the compiler as the hot method hook of the interpreter.
+ * Classes must not run compiled code after template_jit_destroy
+ */
+int template_jit_init(struct template_jit* jit, struct interpreter* interp,
+                      size_t code_size);
+void template_jit_destroy(struct template_jit* jit);
+
+/**
+ * Compiles the method of a linked class and publishes its entry.
+ * ENOTSUP marks the method as not compilable
+ */
+int template_jit_compile(struct template_jit* jit, struct class_file* class,
+                         struct method_info* method);
+/* jit_retarget_sites() over the compiled methods */
+void template_jit_retarget(struct template_jit* jit, compiled_entry from,
+                           compiled_entry to);
+void template_jit_print_stats(const struct template_jit* jit);
+
+#endif
@@ -0,0 +1,116 @@
+#ifndef SHIP_JVM_TIERING_H
+#define SHIP_JVM_TIERING_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "classfile.h"
+#include "interpreter.h"
+#include "opt_jit.h"
+#include "template_jit.h"
+
+/*
+ * Tiered compilation policy. Methods start in the interpreter, move to
+ * the baseline compiler once their invocation or backedge counter
+ * reaches the baseline threshold and to the optimizing compiler once
+ * the counters kept by the baseline code reach the optimizing one.
+ * Methods the baseline compiler rejects go straight to the optimizing
+ * compiler. Loops still running in the interpreter once the method
+ * reaches the OSR threshold get an optimized OSR entry.
+ *
+ * Mutators only queue requests. The queue is a max-heap on hotness
+ * (invocations + backedges when queued) served by background compiler
+ * threads, compiled code is published through method_runtime.entry.
+ */
+
+#define TIER_DEFAULT_BASELINE_INVOCATIONS 200
+#define TIER_DEFAULT_BASELINE_BACKEDGES 2000
+#define TIER_DEFAULT_OPT_INVOCATIONS 5000
+#define TIER_DEFAULT_OPT_BACKEDGES 50000
+#define TIER_DEFAULT_OSR_BACKEDGES 10000
+#define TIER_DEFAULT_COMPILER_THREADS 2
+#define TIER_DEFAULT_QUEUE_CAPACITY 1024
+
+enum tier {
+  TIER_INTERPRETED,
+  TIER_BASELINE,
+  TIER_OPTIMIZED,
+  TIER_COUNT,
+};
+
+/* Zero fields take the defaults */
+struct tier_config {
+  uint32_t baseline_invocations;
+  uint32_t baseline_backedges;
+  uint32_t opt_invocations;
+  uint32_t opt_backedges;
+  uint32_t osr_backedges; /* in the interpreter */
+  uint32_t compiler_threads;
+  uint32_t queue_capacity;
+};
+
+struct tier_request {
+  struct class_file* class;
+  struct method_info* method;
+  uint64_t hotness;
+  int tier;        /* enum tier to compile for */
+  int32_t osr_bci; /* loop header of an OSR entry, -1 for the method */
+};
+
+struct tier_stats {
+  uint64_t queued;
+  uint64_t dropped; /* the queue was full */
+  uint64_t compiled[TIER_COUNT];
+  uint64_t failed[TIER_COUNT]; /* rejected or out of memory */
+  uint64_t compile_ns[TIER_COUNT];
+  uint64_t max_compile_ns[TIER_COUNT];
+  uint64_t transitions[TIER_COUNT][TIER_COUNT]; /* [from][to] */
+  uint64_t osr_compiled;
+  uint64_t osr_failed;
+  uint64_t osr_compile_ns;
+  uint32_t queue_length;
+  uint32_t max_queue_length;
+};
+
+struct tier_policy {
+  struct interpreter* interp;
+  struct template_jit* baseline; /* NULL: no baseline tier */
+  struct opt_jit* opt;           /* NULL: no optimizing tier */
+  struct tier_config config;
+
+  pthread_mutex_t lock;
+  pthread_cond_t wake; /* a request was queued or the policy stops */
+  pthread_cond_t idle; /* the queue is empty and no compile runs */
+  struct tier_request* queue; /* max-heap, size = config.queue_capacity */
+  uint32_t queue_length;
+  uint32_t active; /* requests being compiled */
+  int stopping;
+
+  pthread_t* threads; /* size = thread_count */
+  uint32_t thread_count;
+  struct tier_stats stats;
+};
+
+/**
+ * Installs the policy as the hot method hook of the interpreter in
+ * place of the compilers' own hooks and starts the compiler threads.
+ * config may be NULL
+ */
+int tier_policy_init(struct tier_policy* policy, struct interpreter* interp,
+                     struct template_jit* baseline, struct opt_jit* opt,
+                     const struct tier_config* config);
+
+/**
+ * Stops the compiler threads, requests still queued are dropped.
+ * Must run before the compilers are destroyed
+ */
+void tier_policy_destroy(struct tier_policy* policy);
+
+/* Waits until the queue is empty and no compile is running */
+void tier_policy_drain(struct tier_policy* policy);
+
+/* Consistent snapshot of the metrics */
+void tier_policy_stats(struct tier_policy* policy, struct tier_stats* stats);
+void tier_policy_print_stats(struct tier_policy* policy);
+
+#endif
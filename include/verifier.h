@@ -0,0 +1,127 @@
+#ifndef SHIP_JVM_VERIFIER_H
+#define SHIP_JVM_VERIFIER_H
+
+#include <stdint.h>
+
+#include "classfile.h"
+#include "descriptor.h"
+
+/*
+ * Type-checking verifier, JVMS 4.10.1. The StackMapTable gives the
+ * frame at every branch target so every method is checked in one
+ * linear pass over its instructions.
+ *
+ * Verification types are 32-bit integers: the ITEM_* tag in the low
+ * byte, then 16 bits of payload and the array dimensions in the high
+ * byte. Uninitialized keeps the offset of its `new` instruction. An
+ * Object type keeps the id of its element class name, interned per
+ * class in verifier.names, or of the primitive element of an array,
+ * so [[I and [Ljava/lang/String; are told apart by every array
+ * instruction. long and double take two slots, the second one is
+ * Top.
+ *
+ * Whether one class extends another needs the classes. Without a
+ * resolver verify_class() assumes it does and sets the class's
+ * verify_deferred; linking runs verify_class_links() on such a class
+ * with the interpreter's resolver, which walks the superclasses.
+ * Interfaces are treated as java/lang/Object, as JVMS does.
+ */
+
+typedef uint32_t vtype;
+
+#define VTYPE_TAG(type) ((uint8_t)((type) & 0xff))
+#define VTYPE_PAYLOAD(type) ((uint16_t)((type) >> 8))
+#define VTYPE_DIMS(type) ((uint8_t)((type) >> 24))
+#define VTYPE(tag, payload) ((vtype)(tag) | ((vtype)(payload) << 8))
+#define VTYPE_OBJECT(name, dims) \
+  (VTYPE(ITEM_Object, name) | ((vtype)(dims) << 24))
+
+/**
+ * Finds a class by binary name for the link-time checks, NULL if
+ * unknown. Same contract as interp_class_resolver
+ */
+typedef struct class_file* (*verifier_class_resolver)(const uint8_t* name,
+                                                      uint16_t length,
+                                                      void* ctx);
+
+/* A class name the verification types refer to by id */
+struct verifier_name {
+  const uint8_t* bytes; /* in the verified class or a literal */
+  uint16_t length;
+};
+
+/**
+ * Decoded stack map frame, its slots are kept in
+ * verifier.frame_types at index * (max_locals + max_stack)
+ */
+struct verifier_frame {
+  uint16_t bci;
+  uint16_t locals_size; /* slots covered by the frame's locals */
+  uint16_t stack_depth;
+};
+
+struct verifier_stats {
+  uint64_t classes;
+  uint64_t methods;
+  uint64_t instructions;
+  uint64_t frames;
+  uint64_t code_bytes;
+  uint64_t deferred; /* class assignments left to link time */
+};
+
+/**
+ * Buffers reused by every verified method, they only grow
+ * when a method has more frames or slots than any before
+ */
+struct verifier {
+  struct class_file* class;
+  struct method_info* method;
+  struct Code_attribute* code;
+  struct method_descriptor desc;
+  vtype return_type; /* Top for void */
+  vtype this_type;
+  vtype super_type; /* Top for java/lang/Object */
+  int is_init;  /* method is <init> */
+  uint32_t bci; /* instruction being checked */
+
+  struct verifier_frame* frames; /* size = frame_count */
+  vtype* frame_types;
+  uint32_t frame_count;
+  size_t frames_capacity;
+  size_t frame_types_capacity;
+
+  vtype* locals; /* size = max_locals */
+  vtype* stack;  /* size = max_stack */
+  uint16_t locals_size;
+  uint16_t depth;
+  size_t state_capacity;
+
+  /* names of the class being verified, ids index them */
+  const struct class_file* names_class;
+  struct verifier_name* names;
+  uint32_t name_count;
+  size_t names_capacity;
+  uint32_t* name_slots; /* open addressing over the names, id + 1 */
+  uint32_t name_slots_mask;
+
+  verifier_class_resolver resolve; /* set for the link-time checks */
+  void* resolve_ctx;
+  uint32_t deferred; /* assignments assumed for the current class */
+
+  struct verifier_stats stats;
+};
+
+void verifier_init(struct verifier* verifier);
+void verifier_destroy(struct verifier* verifier);
+int verify_method(struct verifier* verifier, struct class_file* class,
+                  struct method_info* method);
+int verify_class(struct verifier* verifier, struct class_file* class);
+/**
+ * Checks again a class whose verify_deferred is set, with `resolve`
+ * to look up the classes. EINVAL when a class doesn't extend the one
+ * it is used as; classes `resolve` doesn't know are taken on trust
+ */
+int verify_class_links(struct verifier* verifier, struct class_file* class,
+                       verifier_class_resolver resolve, void* ctx);
+
+#endif
@@ -0,0 +1,153 @@
+#ifndef SHIP_JVM_X86_64_H
+#define SHIP_JVM_X86_64_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Minimal x86-64 assembler for the JIT compilers. Instructions are
+ * appended to a growable buffer, memory operands are always
+ * [base + disp32]. A failed allocation sets `error` and the buffer
+ * stops growing, so emitters don't check results one by one.
+ */
+
+enum x86_reg {
+  X86_RAX,
+  X86_RCX,
+  X86_RDX,
+  X86_RBX,
+  X86_RSP,
+  X86_RBP,
+  X86_RSI,
+  X86_RDI,
+  X86_R8,
+  X86_R9,
+  X86_R10,
+  X86_R11,
+  X86_R12,
+  X86_R13,
+  X86_R14,
+  X86_R15,
+};
+
+/* Condition codes of jcc and setcc */
+enum x86_cond {
+  X86_CC_O = 0x0,
+  X86_CC_B = 0x2,
+  X86_CC_AE = 0x3,
+  X86_CC_E = 0x4,
+  X86_CC_NE = 0x5,
+  X86_CC_BE = 0x6,
+  X86_CC_A = 0x7,
+  X86_CC_L = 0xc,
+  X86_CC_GE = 0xd,
+  X86_CC_LE = 0xe,
+  X86_CC_G = 0xf,
+};
+
+/* Two operand integer instructions, the value is the /digit of 0x81 */
+enum x86_alu {
+  X86_ADD = 0,
+  X86_OR = 1,
+  X86_AND = 4,
+  X86_SUB = 5,
+  X86_XOR = 6,
+  X86_CMP = 7,
+};
+
+/* Shifts by cl, the value is the /digit of 0xd3 */
+enum x86_shift {
+  X86_SHL = 4,
+  X86_SHR = 5,
+  X86_SAR = 7,
+};
+
+struct x86_asm {
+  uint8_t* code; /* size = size */
+  size_t size;
+  size_t capacity;
+  int error;
+};
+
+void x86_init(struct x86_asm* a);
+void x86_destroy(struct x86_asm* a);
+void x86_emit_u8(struct x86_asm* a, uint8_t value);
+void x86_emit_u32(struct x86_asm* a, uint32_t value);
+void x86_emit_u64(struct x86_asm* a, uint64_t value);
+
+void x86_push(struct x86_asm* a, enum x86_reg reg);
+void x86_push_m(struct x86_asm* a, enum x86_reg base, int32_t disp);
+void x86_pop(struct x86_asm* a, enum x86_reg reg);
+void x86_ret(struct x86_asm* a);
+
+/* wide != 0 selects the 64-bit form */
+void x86_mov_rr(struct x86_asm* a, int wide, enum x86_reg dst,
+                enum x86_reg src);
+void x86_mov_rm(struct x86_asm* a, int wide, enum x86_reg dst,
+                enum x86_reg base, int32_t disp);
+void x86_mov_mr(struct x86_asm* a, int wide, enum x86_reg base,
+                int32_t disp, enum x86_reg src);
+void x86_mov_ri(struct x86_asm* a, enum x86_reg dst, int32_t imm);
+void x86_mov_ri64(struct x86_asm* a, enum x86_reg dst, uint64_t imm);
+void x86_mov_mi(struct x86_asm* a, enum x86_reg base, int32_t disp,
+                int32_t imm);
+void x86_lea(struct x86_asm* a, enum x86_reg dst, enum x86_reg base,
+             int32_t disp);
+
+void x86_alu_rr(struct x86_asm* a, int wide, enum x86_alu op,
+                enum x86_reg dst, enum x86_reg src);
+void x86_alu_ri(struct x86_asm* a, int wide, enum x86_alu op,
+                enum x86_reg dst, int32_t imm);
+void x86_alu_rm(struct x86_asm* a, int wide, enum x86_alu op,
+                enum x86_reg dst, enum x86_reg base, int32_t disp);
+void x86_alu_mi(struct x86_asm* a, int wide, enum x86_alu op,
+                enum x86_reg base, int32_t disp, int32_t imm);
+void x86_test_rr(struct x86_asm* a, int wide, enum x86_reg dst,
+                 enum x86_reg src);
+/* test [address], reg32 on an absolute address below 2 GiB */
+void x86_test_abs(struct x86_asm* a, uint32_t address, enum x86_reg reg);
+void x86_imul_rr(struct x86_asm* a, int wide, enum x86_reg dst,
+                 enum x86_reg src);
+void x86_neg(struct x86_asm* a, int wide, enum x86_reg reg);
+void x86_shift_cl(struct x86_asm* a, int wide, enum x86_shift op,
+                  enum x86_reg reg);
+void x86_cdq(struct x86_asm* a);
+void x86_idiv(struct x86_asm* a, int wide, enum x86_reg divisor);
+void x86_movsx8(struct x86_asm* a, enum x86_reg dst, enum x86_reg src);
+void x86_movsx16(struct x86_asm* a, enum x86_reg dst, enum x86_reg src);
+void x86_movzx8(struct x86_asm* a, enum x86_reg dst, enum x86_reg src);
+void x86_movzx16(struct x86_asm* a, enum x86_reg dst, enum x86_reg src);
+
+/* wide != 0 moves a double, otherwise a float: movsd/movss xmm, [base + disp] */
+void x86_load_xmm(struct x86_asm* a, int wide, int xmm, enum x86_reg base,
+                  int32_t disp);
+/* Raw bits of the low float or double of xmm: movd/movq dst, xmm */
+void x86_mov_rx(struct x86_asm* a, int wide, enum x86_reg dst, int xmm);
+
+/*
+ * Array element access [base + index * size + disp] of a 1, 2, 4
+ * or 8 byte element. The index register holds a zero-extended int,
+ * narrow loads sign-extend unless `sign` is 0
+ */
+void x86_load_indexed(struct x86_asm* a, int size, int sign,
+                      enum x86_reg dst, enum x86_reg base,
+                      enum x86_reg index, int32_t disp);
+void x86_store_indexed(struct x86_asm* a, int size, enum x86_reg base,
+                       enum x86_reg index, int32_t disp, enum x86_reg src);
+
+void x86_call_r(struct x86_asm* a, enum x86_reg target);
+void x86_call_m(struct x86_asm* a, enum x86_reg base, int32_t disp);
+void x86_jmp_r(struct x86_asm* a, enum x86_reg target);
+
+#define X86_NO_TARGET ((size_t)-1)
+
+/*
+ * Jumps with a 32-bit displacement. A forward jump passes
+ * X86_NO_TARGET and later gives the returned displacement offset
+ * to x86_patch_jump
+ */
+size_t x86_jmp(struct x86_asm* a, size_t target);
+size_t x86_jcc(struct x86_asm* a, enum x86_cond cond, size_t target);
+void x86_patch_jump(struct x86_asm* a, size_t at, size_t target);
+
+#endif
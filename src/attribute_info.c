@@ -1 +1,264 @@
-#include "attribute_info.h"
\ No newline at end of file
+#include "attribute_info.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "classfile_parser.h"
+
+struct attribute_info* find_attribute(struct class_file* class,
+                                      struct attribute_info* attributes,
+                                      uint16_t count, const char* name) {
+  uint16_t i;
+
+  for (i = 0; i < count; i++) {
+    struct UTF8_info* UTF8 =
+        validate_constant(class, attributes[i].attribute_name_index);
+    if (UTF8 != NULL &&
+        is_string_match((const char*)UTF8->bytes, UTF8->lenght, name)) {
+      return &attributes[i];
+    }
+  }
+  return NULL;
+}
+
+/*
+ * Decodes a Code attribute. The bytecode is not copied,
+ * code->code points into attr->info
+ */
+int parse_code_attribute(struct class_file* class,
+                         const struct attribute_info* attr,
+                         struct Code_attribute* code) {
+  Loader loader = {.buffer = attr->info, .size = attr->attribute_length};
+  uint16_t i;
+  int err;
+
+  code->attribute_name_index = attr->attribute_name_index;
+  code->attribute_length = attr->attribute_length;
+  code->max_stack = loader_u2(&loader);
+  code->max_locals = loader_u2(&loader);
+  code->code_length = loader_u4(&loader);
+  code->exception_table = NULL;
+  code->attributes = NULL;
+  code->attributes_count = 0;
+
+  if (loader.error || code->code_length == 0 || code->code_length > 65535 ||
+      code->code_length > loader.size - loader.position) {
+    printf("ERROR: bad code length %u\n", code->code_length);
+    return ENOEXEC;
+  }
+  code->code = attr->info + loader.position;
+  loader.position += code->code_length;
+
+  code->exception_table_length = loader_u2(&loader);
+  if (code->exception_table_length != 0) {
+    code->exception_table = malloc(code->exception_table_length *
+                                   sizeof(*code->exception_table));
+    if (code->exception_table == NULL) {
+      printf("ERROR: can't allocate memory for exception table\n");
+      return ENOMEM;
+    }
+  }
+  for (i = 0; i < code->exception_table_length; i++) {
+    code->exception_table[i].start_pc = loader_u2(&loader);
+    code->exception_table[i].end_pc = loader_u2(&loader);
+    code->exception_table[i].handler_pc = loader_u2(&loader);
+    code->exception_table[i].catch_type = loader_u2(&loader);
+  }
+
+  code->attributes_count = loader_u2(&loader);
+  if (loader.error) {
+    printf("ERROR: unexpected end of Code attribute\n");
+    free_code_attribute(code);
+    return ENOEXEC;
+  }
+
+  err = parse_attributes(&loader, class, code->attributes_count,
+                         &code->attributes);
+  if (err == 0 && loader.position != loader.size) {
+    printf("ERROR: Code attribute has %zu extra bytes\n",
+           loader.size - loader.position);
+    err = ENOEXEC;
+  }
+  if (err != 0) {
+    free_code_attribute(code);
+  }
+  return err;
+}
+
+void free_code_attribute(struct Code_attribute* code) {
+  uint16_t i;
+
+  free(code->exception_table);
+  code->exception_table = NULL;
+  if (code->attributes != NULL) {
+    for (i = 0; i < code->attributes_count; i++) {
+      free(code->attributes[i].info);
+    }
+    free(code->attributes);
+  }
+  code->attributes = NULL;
+  code->attributes_count = 0;
+}
+
+static int read_verification_type(Loader* loader,
+                                   union verification_type_info* type) {
+  type->Top_variable_info.tag = loader_u1(loader);
+
+  switch (type->Top_variable_info.tag) {
+    case ITEM_Object:
+      type->Object_variable_info.cpool_index = loader_u2(loader);
+      break;
+    case ITEM_Uninitialized:
+      type->Uninitialized_variable_info.offset = loader_u2(loader);
+      break;
+    default:
+      if (type->Top_variable_info.tag > ITEM_Uninitialized) {
+        printf("ERROR: bad verification type %hhu\n",
+               type->Top_variable_info.tag);
+        return EINVAL;
+      }
+  }
+  return loader->error ? ENOEXEC : 0;
+}
+
+static int read_verification_types(Loader* loader, uint16_t count,
+                                   union verification_type_info** types) {
+  uint16_t i;
+  int err;
+
+  *types = NULL;
+  if (count == 0) {
+    return 0;
+  }
+  *types = malloc(count * sizeof(union verification_type_info));
+  if (*types == NULL) {
+    printf("ERROR: can't allocate memory for stack map frame\n");
+    return ENOMEM;
+  }
+  for (i = 0; i < count; i++) {
+    err = read_verification_type(loader, &(*types)[i]);
+    if (err != 0) {
+      return err;
+    }
+  }
+  return 0;
+}
+
+static int read_stack_map_frame(Loader* loader, union stack_map_frame* frame) {
+  uint8_t type = loader_u1(loader);
+  int err;
+
+  frame->same_frame.frame_type = type;
+
+  if (type <= SAME_FRAME_MAX) {
+    return 0;
+  }
+  if (type <= SAME_LOCALS_1_STACK_ITEM_MAX) {
+    return read_verification_type(
+        loader, &frame->same_locals_1_stack_item_frame.stack[0]);
+  }
+  if (type < SAME_LOCALS_1_STACK_ITEM_EXTENDED) {
+    printf("ERROR: reserved stack map frame type %hhu\n", type);
+    return EINVAL;
+  }
+
+  /* every other frame type has an explicit offset_delta */
+  frame->chop_frame.offset_delta = loader_u2(loader);
+
+  if (type == SAME_LOCALS_1_STACK_ITEM_EXTENDED) {
+    return read_verification_type(
+        loader, &frame->same_locals_1_stack_item_frame_extended.stack[0]);
+  }
+  if (type <= SAME_FRAME_EXTENDED) {
+    return 0;
+  }
+  if (type <= APPEND_FRAME_MAX) {
+    return read_verification_types(loader, type - SAME_FRAME_EXTENDED,
+                                   &frame->append_frame.locals);
+  }
+
+  frame->full_frame.number_of_locals = loader_u2(loader);
+  frame->full_frame.stack = NULL;
+  err = read_verification_types(loader, frame->full_frame.number_of_locals,
+                                &frame->full_frame.locals);
+  if (err != 0) {
+    return err;
+  }
+  frame->full_frame.number_of_stack_items = loader_u2(loader);
+  return read_verification_types(loader,
+                                 frame->full_frame.number_of_stack_items,
+                                 &frame->full_frame.stack);
+}
+
+int parse_stack_map_table(const struct attribute_info* attr,
+                          struct StackMapTable_attribute* table) {
+  Loader loader = {.buffer = attr->info, .size = attr->attribute_length};
+  uint16_t i;
+  int err = 0;
+
+  table->attribute_name_index = attr->attribute_name_index;
+  table->attribute_length = attr->attribute_length;
+  table->number_of_entries = loader_u2(&loader);
+  table->entries = NULL;
+  if (loader.error) {
+    printf("ERROR: empty StackMapTable\n");
+    return ENOEXEC;
+  }
+  if (table->number_of_entries == 0) {
+    return 0;
+  }
+
+  table->entries =
+      calloc(table->number_of_entries, sizeof(union stack_map_frame));
+  if (table->entries == NULL) {
+    printf("ERROR: can't allocate memory for StackMapTable\n");
+    return ENOMEM;
+  }
+
+  for (i = 0; i < table->number_of_entries && err == 0; i++) {
+    err = read_stack_map_frame(&loader, &table->entries[i]);
+  }
+  if (err == 0 && (loader.error || loader.position != loader.size)) {
+    printf("ERROR: StackMapTable length mismatch\n");
+    err = ENOEXEC;
+  }
+  if (err != 0) {
+    free_stack_map_table(table);
+  }
+  return err;
+}
+
+void free_stack_map_table(struct StackMapTable_attribute* table) {
+  uint16_t i;
+
+  if (table->entries == NULL) {
+    return;
+  }
+  for (i = 0; i < table->number_of_entries; i++) {
+    union stack_map_frame* frame = &table->entries[i];
+    uint8_t type = frame->same_frame.frame_type;
+
+    if (type >= APPEND_FRAME_MIN && type <= APPEND_FRAME_MAX) {
+      free(frame->append_frame.locals);
+    } else if (type == FULL_FRAME) {
+      free(frame->full_frame.locals);
+      free(frame->full_frame.stack);
+    }
+  }
+  free(table->entries);
+  table->entries = NULL;
+  table->number_of_entries = 0;
+}
+
+uint16_t stack_map_frame_offset_delta(const union stack_map_frame* frame) {
+  uint8_t type = frame->same_frame.frame_type;
+
+  if (type <= SAME_FRAME_MAX) {
+    return type;
+  }
+  if (type <= SAME_LOCALS_1_STACK_ITEM_MAX) {
+    return (uint16_t)(type - SAME_LOCALS_1_STACK_ITEM_MIN);
+  }
+  return frame->chop_frame.offset_delta;
+}
@@ -0,0 +1,367 @@
+#include "bootstrap.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "attribute_info.h"
+#include "classfile_stream.h"
+#include "descriptor.h"
+#include "gc.h"
+#include "opcodes.h"
+
+/* Dynamic constants may refer to others, a cycle ends here */
+#define MAX_BOOTSTRAP_DEPTH 32
+
+#define REF_INVOKE_STATIC 6
+
+/* Entry of the BootstrapMethods attribute, arguments still raw */
+struct bootstrap_method {
+  uint16_t method_ref;
+  uint16_t argument_count;
+  const uint8_t* arguments; /* u2 constant pool indexes */
+};
+
+static int resolve_constant(struct interp_thread* thread,
+                            struct class_file* class, uint16_t index,
+                            union java_value* value, int depth);
+
+int bootstrap_number_sites(const struct Code_attribute* code, uint8_t** copy,
+                           uint16_t* count) {
+  uint32_t bci;
+
+  *count = 0;
+  for (bci = 0; bci < code->code_length;) {
+    uint32_t length = opcode_length(code->code, code->code_length, bci);
+
+    if (length == 0) {
+      /* malformed, the verifier rejects it anyway */
+      break;
+    }
+    if (code->code[bci] == OP_INVOKEDYNAMIC && length == 5) {
+      if (*copy == NULL) {
+        *copy = malloc(code->code_length);
+        if (*copy == NULL) {
+          printf("ERROR: can't allocate memory for call sites\n");
+          return ENOMEM;
+        }
+        memcpy(*copy, code->code, code->code_length);
+      }
+      (*copy)[bci + 3] = (uint8_t)(*count >> 8);
+      (*copy)[bci + 4] = (uint8_t)*count;
+      (*count)++;
+    }
+    bci += length;
+  }
+  return 0;
+}
+
+static int find_bootstrap_method(struct class_file* class, uint16_t index,
+                                 struct bootstrap_method* bootstrap) {
+  struct attribute_info* attr = find_attribute(
+      class, class->attributes, class->attributes_count, "BootstrapMethods");
+  Loader loader;
+  uint16_t count;
+  uint16_t i;
+
+  if (attr == NULL) {
+    return EINVAL;
+  }
+  loader = (Loader){.buffer = attr->info, .size = attr->attribute_length};
+  count = loader_u2(&loader);
+  for (i = 0; !loader.error && i < count; i++) {
+    bootstrap->method_ref = loader_u2(&loader);
+    bootstrap->argument_count = loader_u2(&loader);
+    bootstrap->arguments = attr->info + loader.position;
+    if (loader.error ||
+        loader.size - loader.position < 2u * bootstrap->argument_count) {
+      return EINVAL;
+    }
+    if (i == index) {
+      return 0;
+    }
+    loader.position += 2u * bootstrap->argument_count;
+  }
+  return EINVAL;
+}
+
+/* Kind of the value of the Dynamic entry at index */
+static int dynamic_kind(struct class_file* class, uint16_t index, char* kind) {
+  struct UTF8_info* descriptor = constant_member_descriptor(class, index);
+  return descriptor != NULL ? parse_field_descriptor(descriptor, kind) : EINVAL;
+}
+
+static int is_int_kind(char kind) {
+  return kind == 'I' || kind == 'Z' || kind == 'B' || kind == 'C' ||
+         kind == 'S';
+}
+
+/* Whether a value of kind `from` can be passed as `to` */
+static int compatible(char from, char to) {
+  return from == to || (is_int_kind(from) && is_int_kind(to));
+}
+
+static int32_t narrow(char kind, int32_t value) {
+  switch (kind) {
+    case 'Z':
+      return value & 1;
+    case 'B':
+      return (int8_t)value;
+    case 'C':
+      return (uint16_t)value;
+    case 'S':
+      return (int16_t)value;
+    default:
+      return value;
+  }
+}
+
+/*
+ * Calls the bootstrap method of the entry at index with its static
+ * arguments. The result must be of kind `expected`, or is ignored for
+ * 0, and *holder becomes the bootstrap method's class. EINVAL for a
+ * linkage the bootstrap method can't do, INTERP_EXCEPTION when it
+ * threw, other errors come from the interpreter
+ */
+static int run_bootstrap(struct interp_thread* thread,
+                         struct class_file* class, uint16_t index,
+                         char expected, union java_value* result,
+                         struct class_file** holder, int depth) {
+  union java_value args[DESCRIPTOR_MAX_ARGS];
+  struct bootstrap_method bootstrap;
+  struct method_descriptor desc;
+  struct cp_cache_entry* entry;
+  struct cp_info* cp_info;
+  uint16_t slots = 0;
+  uint16_t i;
+  int err;
+
+  if (get_constant(class, index, &cp_info) != 0 ||
+      (cp_info->tag != DYNAMIC && cp_info->tag != INVOKE_METHOD) ||
+      find_bootstrap_method(class, cp_info->dynamic_info.info
+                                       .bootstrap_method_attr_index,
+                            &bootstrap) != 0 ||
+      get_constant(class, bootstrap.method_ref, &cp_info) != 0 ||
+      cp_info->tag != METHOD_HANDLE ||
+      cp_info->method_handle_info.reference_kind != REF_INVOKE_STATIC) {
+    return EINVAL;
+  }
+  entry = interp_resolve_member(
+      thread, class, cp_info->method_handle_info.reference_index, 0);
+  if (entry == NULL) {
+    return INTERP_EXCEPTION;
+  }
+  if (!(entry->method->access_flags & ACC_STATIC) ||
+      parse_method_descriptor(
+          validate_constant(entry->class, entry->method->descriptor_index),
+          &desc) != 0 ||
+      desc.arg_count != bootstrap.argument_count ||
+      (expected != 0 && !compatible(desc.ret, expected))) {
+    return EINVAL;
+  }
+
+  for (i = 0; i < bootstrap.argument_count; i++) {
+    uint16_t arg = (uint16_t)(bootstrap.arguments[2 * i] << 8 |
+                              bootstrap.arguments[2 * i + 1]);
+    char kind;
+
+    if (get_constant(class, arg, &cp_info) != 0) {
+      return EINVAL;
+    }
+    switch (cp_info->tag) {
+      case INTEGER:
+        kind = 'I';
+        args[slots].i = (int32_t)cp_info->integer_info.info.bytes;
+        break;
+      case FLOAT:
+        kind = 'F';
+        memcpy(&args[slots].f, &cp_info->float_info.info.bytes,
+               sizeof(float));
+        break;
+      case LONG:
+      case DOUBLE:
+        kind = cp_info->tag == LONG ? 'J' : 'D';
+        args[slots].j =
+            (int64_t)((uint64_t)cp_info->long_info.info.high_bytes << 32 |
+                      cp_info->long_info.info.low_bytes);
+        break;
+      case DYNAMIC:
+        if (dynamic_kind(class, arg, &kind) != 0) {
+          return EINVAL;
+        }
+        err = resolve_constant(thread, class, arg, &args[slots], depth + 1);
+        if (err != 0) {
+          return err;
+        }
+        break;
+      default:
+        /* strings, classes, method handles and types have no objects */
+        return EINVAL;
+    }
+    if (!compatible(kind, desc.args[i])) {
+      return EINVAL;
+    }
+    if (is_int_kind(kind)) {
+      args[slots].i = narrow(desc.args[i], args[slots].i);
+    }
+    slots = (uint16_t)(slots + descriptor_slots(kind));
+  }
+
+  *holder = entry->class;
+  err = interp_invoke(thread, entry->class, entry->method, args, result);
+  if (err == 0 && is_int_kind(expected)) {
+    result->i = narrow(expected, result->i);
+  }
+  return err;
+}
+
+/* Static method `name` with `descriptor` of the class or a superclass */
+static struct method_info* find_static(struct class_file** holder,
+                                       const struct UTF8_info* name,
+                                       const struct UTF8_info* descriptor) {
+  struct class_file* class;
+
+  for (class = *holder; class != NULL; class = class->runtime->super) {
+    uint16_t i;
+
+    for (i = 0; i < class->methods_count; i++) {
+      struct method_info* method = &class->methods[i];
+      struct UTF8_info* method_name =
+          validate_constant(class, method->name_index);
+      struct UTF8_info* method_descriptor =
+          validate_constant(class, method->descriptor_index);
+
+      if ((method->access_flags & ACC_STATIC) && method_name != NULL &&
+          method_descriptor != NULL &&
+          method_name->lenght == name->lenght &&
+          method_descriptor->lenght == descriptor->lenght &&
+          memcmp(method_name->bytes, name->bytes, name->lenght) == 0 &&
+          memcmp(method_descriptor->bytes, descriptor->bytes,
+                 descriptor->lenght) == 0) {
+        *holder = class;
+        return method;
+      }
+    }
+  }
+  return NULL;
+}
+
+/*
+ * A failed bootstrap fails with BootstrapMethodError, errors other
+ * than a Java exception stop the interpreter
+ */
+static int bootstrap_failed(struct interp_thread* thread, int err) {
+  if (err != EINVAL && err != INTERP_EXCEPTION) {
+    return err;
+  }
+  interp_throw(thread, "java/lang/BootstrapMethodError");
+  return INTERP_EXCEPTION;
+}
+
+int bootstrap_link_site(struct interp_thread* thread, struct class_file* class,
+                        struct call_site* site, uint16_t index) {
+  struct class_file* holder = NULL;
+  struct method_info* method = NULL;
+  union java_value ignored;
+  uint8_t state = atomic_load_explicit(&site->state, memory_order_acquire);
+  int err;
+
+  if (state == CALL_SITE_UNLINKED) {
+    err = run_bootstrap(thread, class, index, 0, &ignored, &holder, 0);
+    if (err != 0 && err != INTERP_EXCEPTION && err != EINVAL) {
+      return err;
+    }
+    if (err == 0) {
+      struct name_and_type_info* name_and_type =
+          constant_member_name_and_type(class, index);
+      struct UTF8_info* name =
+          name_and_type != NULL
+              ? validate_constant(class, name_and_type->name_index)
+              : NULL;
+      struct UTF8_info* descriptor =
+          name_and_type != NULL
+              ? validate_constant(class, name_and_type->descripror_index)
+              : NULL;
+      method = name != NULL && descriptor != NULL
+                   ? find_static(&holder, name, descriptor)
+                   : NULL;
+    }
+    /* threads racing to link the site agree on the first result */
+    pthread_mutex_lock(&thread->interp->lock);
+    if (atomic_load_explicit(&site->state, memory_order_relaxed) ==
+        CALL_SITE_UNLINKED) {
+      site->class = holder;
+      site->method = method;
+      atomic_store_explicit(&site->state,
+                            method != NULL ? CALL_SITE_LINKED
+                                           : CALL_SITE_FAILED,
+                            memory_order_release);
+    }
+    state = atomic_load_explicit(&site->state, memory_order_relaxed);
+    pthread_mutex_unlock(&thread->interp->lock);
+  }
+  if (state == CALL_SITE_FAILED) {
+    return bootstrap_failed(thread, EINVAL);
+  }
+  /* a bootstrap that lost the race may have thrown */
+  interp_clear_exception(thread);
+  return 0;
+}
+
+static int resolve_constant(struct interp_thread* thread,
+                            struct class_file* class, uint16_t index,
+                            union java_value* value, int depth) {
+  struct class_runtime* runtime = class->runtime;
+  struct cp_cache_entry* entry = &runtime->cp_cache[index];
+  struct class_file* holder;
+  union java_value result = {0};
+  uint8_t resolved =
+      atomic_load_explicit(&entry->resolved, memory_order_acquire);
+  char kind;
+  int err;
+
+  if (resolved == 0) {
+    if (depth >= MAX_BOOTSTRAP_DEPTH) {
+      interp_throw(thread, "java/lang/StackOverflowError");
+      return INTERP_EXCEPTION;
+    }
+    if (dynamic_kind(class, index, &kind) != 0) {
+      return bootstrap_failed(thread, EINVAL);
+    }
+    err = run_bootstrap(thread, class, index, kind, &result, &holder, depth);
+    if (err != 0 && err != INTERP_EXCEPTION && err != EINVAL) {
+      return err;
+    }
+    pthread_mutex_lock(&thread->interp->lock);
+    if (atomic_load_explicit(&entry->resolved, memory_order_relaxed) == 0) {
+      entry->kind = kind;
+      entry->value = result;
+      /* a reference lives as long as the class */
+      if (err == 0 && kind == 'L' && runtime->heap != NULL &&
+          gc_add_root(runtime->heap, &entry->value.ref) != 0) {
+        pthread_mutex_unlock(&thread->interp->lock);
+        interp_throw(thread, "java/lang/OutOfMemoryError");
+        return INTERP_EXCEPTION;
+      }
+      atomic_store_explicit(&entry->resolved,
+                            err == 0 ? 1 : DYNAMIC_CONSTANT_FAILED,
+                            memory_order_release);
+    }
+    resolved = atomic_load_explicit(&entry->resolved, memory_order_relaxed);
+    pthread_mutex_unlock(&thread->interp->lock);
+  }
+  if (resolved == DYNAMIC_CONSTANT_FAILED) {
+    return bootstrap_failed(thread, EINVAL);
+  }
+  /* a bootstrap that lost the race may have thrown */
+  interp_clear_exception(thread);
+  *value = entry->value;
+  return 0;
+}
+
+int bootstrap_resolve_constant(struct interp_thread* thread,
+                               struct class_file* class, uint16_t index,
+                               union java_value* value) {
+  return resolve_constant(thread, class, index, value, 0);
+}
@@ -0,0 +1,378 @@
+#define _GNU_SOURCE
+
+#include "class_archive.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "class_image.h"
+#include "class_layout.h"
+#include "classfile_parser.h"
+#include "descriptor.h"
+#include "hash.h"
+#include "oop_map.h"
+
+#define CLASS_ARCHIVE_PAGE 4096
+
+/* Fails instead of replacing mappings at the requested base */
+#ifdef MAP_FIXED_NOREPLACE
+#define CLASS_ARCHIVE_MAP_FIXED MAP_FIXED_NOREPLACE
+#else
+#define CLASS_ARCHIVE_MAP_FIXED 0
+#endif
+
+static struct UTF8_info* class_name(struct class_file* class) {
+  return constant_class_name(class, class->this_class);
+}
+
+static int find_by_name(struct class_file* classes, size_t count,
+                        const struct UTF8_info* name) {
+  size_t i;
+
+  for (i = 0; name != NULL && i < count; i++) {
+    struct UTF8_info* other = class_name(&classes[i]);
+    if (other != NULL && other->lenght == name->lenght &&
+        memcmp(other->bytes, name->bytes, name->lenght) == 0) {
+      return (int)i;
+    }
+  }
+  return -1;
+}
+
+/*
+ * Builds oop maps and instance layouts for classes about to be dumped.
+ * A layout needs the layout of the superclass, so it is computed only
+ * when the superclass is java/lang/Object or one of `classes`
+ */
+int class_archive_link(struct class_file* classes, size_t count) {
+  size_t i;
+  int progress = 1;
+  int err;
+
+  for (i = 0; i < count; i++) {
+    err = class_build_oop_maps(&classes[i]);
+    if (err != 0) {
+      return err;
+    }
+  }
+
+  while (progress) {
+    progress = 0;
+    for (i = 0; i < count; i++) {
+      struct class_file* class = &classes[i];
+      const struct class_layout* super = NULL;
+      struct UTF8_info* super_name;
+      struct class_layout* layout;
+
+      if (class->layout != NULL || class->super_class == 0) {
+        continue;
+      }
+      super_name = constant_class_name(class, class->super_class);
+      if (super_name == NULL) {
+        return EINVAL;
+      }
+      if (!is_string_match((const char*)super_name->bytes, super_name->lenght,
+                           "java/lang/Object")) {
+        int super_index = find_by_name(classes, count, super_name);
+        if (super_index < 0 || classes[super_index].layout == NULL) {
+          continue;
+        }
+        super = classes[super_index].layout;
+      }
+
+      layout = malloc(sizeof(struct class_layout));
+      if (layout == NULL) {
+        printf("ERROR: can't allocate memory for class layout\n");
+        return ENOMEM;
+      }
+      err = class_layout_compute(class, super, layout);
+      if (err != 0) {
+        free(layout);
+        return err;
+      }
+      class->layout = layout;
+      progress = 1;
+    }
+  }
+  return 0;
+}
+
+static int compare_entries(const void* a, const void* b) {
+  uint64_t x = ((const struct class_archive_entry*)a)->name_hash;
+  uint64_t y = ((const struct class_archive_entry*)b)->name_hash;
+  return x < y ? -1 : x > y;
+}
+
+/* Points the superclass layouts inside the image at their copies */
+static void link_layouts(struct class_image_writer* w,
+                         struct class_file* classes, size_t count,
+                         const size_t* offsets) {
+  size_t i, j;
+
+  for (i = 0; i < count; i++) {
+    size_t layout =
+        class_image_get_pointer(w, offsets[i] + offsetof(struct class_file,
+                                                         layout));
+    if (layout == 0 || classes[i].layout->super == NULL) {
+      continue;
+    }
+    for (j = 0; j < count; j++) {
+      if (classes[j].layout == classes[i].layout->super) {
+        class_image_set_pointer(
+            w, layout + offsetof(struct class_layout, super),
+            class_image_get_pointer(
+                w, offsets[j] + offsetof(struct class_file, layout)));
+      }
+    }
+  }
+}
+
+static int write_file(const char* path, const uint8_t* data, size_t size) {
+  char temp[4096 + 32];
+  FILE* file;
+  int fd;
+  int ok;
+
+  /* unique per dump, threads and processes may dump the same archive */
+  snprintf(temp, sizeof(temp), "%s.XXXXXX", path);
+  fd = mkstemp(temp);
+  if (fd < 0) {
+    printf("ERROR: can't create file %s\n", temp);
+    return errno;
+  }
+  file = fchmod(fd, 0644) == 0 ? fdopen(fd, "wb") : NULL;
+  if (file == NULL) {
+    close(fd);
+    remove(temp);
+    printf("ERROR: can't create file %s\n", temp);
+    return EIO;
+  }
+  ok = fwrite(data, 1, size, file) == size;
+  ok = fclose(file) == 0 && ok;
+  if (!ok || rename(temp, path) != 0) {
+    remove(temp);
+    printf("ERROR: can't write class archive %s\n", path);
+    return EIO;
+  }
+  return 0;
+}
+
+/*
+ * Writes linked classes into an archive. Every method with code must
+ * have its oop map and every class must have its layout, see
+ * class_archive_link; source_hashes may be NULL
+ */
+int class_archive_dump(const char* path, struct class_file* classes,
+                       size_t count, const uint64_t* source_hashes) {
+  struct class_image_writer w = {.base = CLASS_ARCHIVE_BASE};
+  struct class_archive_header header = {
+      .magic = CLASS_ARCHIVE_MAGIC,
+      .abi = class_image_abi(),
+      .base = CLASS_ARCHIVE_BASE,
+      .class_count = (uint32_t)count,
+  };
+  struct class_archive_entry* entries;
+  size_t* offsets;
+  size_t end;
+  size_t i;
+  uint16_t m;
+  int err;
+
+  for (i = 0; i < count; i++) {
+    struct UTF8_info* name = class_name(&classes[i]);
+    if (name == NULL || classes[i].layout == NULL) {
+      printf("ERROR: class %zu is not linked, can't archive it\n", i);
+      return EINVAL;
+    }
+    for (m = 0; m < classes[i].methods_count; m++) {
+      if (classes[i].methods[m].code != NULL &&
+          classes[i].methods[m].oop_map == NULL) {
+        printf("ERROR: %.*s has no oop maps, can't archive it\n",
+               name->lenght, (const char*)name->bytes);
+        return EINVAL;
+      }
+    }
+  }
+
+  entries = calloc(count + 1, sizeof(struct class_archive_entry));
+  offsets = calloc(count + 1, sizeof(size_t));
+  if (entries == NULL || offsets == NULL) {
+    free(entries);
+    free(offsets);
+    printf("ERROR: can't allocate memory for class archive\n");
+    return ENOMEM;
+  }
+
+  class_image_put(&w, &header, sizeof(header));
+  for (i = 0; i < count; i++) {
+    struct UTF8_info* name = class_name(&classes[i]);
+
+    offsets[i] = class_image_put_class(&w, &classes[i], CLASS_IMAGE_LINKED);
+    entries[i].name_hash = hash64(name->bytes, name->lenght, 0);
+    entries[i].class = offsets[i];
+    entries[i].source_hash = source_hashes != NULL ? source_hashes[i] : 0;
+  }
+  link_layouts(&w, classes, count, offsets);
+  qsort(entries, count, sizeof(struct class_archive_entry), compare_entries);
+  header.table =
+      class_image_put(&w, entries, count * sizeof(struct class_archive_entry));
+  /* mappings are page granular, pad the archive to a whole page */
+  class_image_put(&w, NULL, sizeof(uint64_t));
+  end = (w.size + CLASS_ARCHIVE_PAGE - 1) & ~(size_t)(CLASS_ARCHIVE_PAGE - 1);
+  if (end > w.size) {
+    class_image_put(&w, NULL, end - w.size);
+  }
+  header.size = w.size;
+  free(entries);
+  free(offsets);
+
+  if (w.error) {
+    free(w.data);
+    printf("ERROR: can't allocate memory for class archive\n");
+    return ENOMEM;
+  }
+  memcpy(w.data, &header, sizeof(header));
+  err = write_file(path, w.data, w.size);
+  free(w.data);
+  return err;
+}
+
+/*
+ * Maps an archive, at its requested base when the address is free.
+ * Returns ENOENT if there is no archive and EINVAL if it was written
+ * by an incompatible VM
+ */
+int class_archive_map(struct class_archive* archive, const char* path) {
+  struct class_archive_header header;
+  struct stat st;
+  uint8_t* base;
+  uint32_t i;
+  int fd;
+
+  memset(archive, 0, sizeof(*archive));
+  fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return ENOENT;
+  }
+  if (fstat(fd, &st) != 0 ||
+      pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+      header.magic != CLASS_ARCHIVE_MAGIC ||
+      header.abi != class_image_abi() || header.size != (uint64_t)st.st_size ||
+      header.table > header.size ||
+      header.table % _Alignof(struct class_archive_entry) != 0 ||
+      (header.size - header.table) / sizeof(struct class_archive_entry) <
+          header.class_count) {
+    close(fd);
+    printf("ERROR: %s is not a compatible class archive\n", path);
+    return EINVAL;
+  }
+
+  base = mmap((void*)(uintptr_t)header.base, (size_t)header.size, PROT_READ,
+              MAP_PRIVATE | CLASS_ARCHIVE_MAP_FIXED, fd, 0);
+  if (base != MAP_FAILED && base != (uint8_t*)(uintptr_t)header.base) {
+    munmap(base, (size_t)header.size);
+    base = MAP_FAILED;
+  }
+  if (base == MAP_FAILED) {
+    /* the requested range is taken, relocate a private copy */
+    base = mmap(NULL, (size_t)header.size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE, fd, 0);
+    archive->relocated = 1;
+  }
+  close(fd);
+  if (base == MAP_FAILED) {
+    printf("ERROR: can't map class archive %s\n", path);
+    return ENOMEM;
+  }
+
+  archive->base = base;
+  archive->size = (size_t)header.size;
+  archive->header = (const struct class_archive_header*)base;
+  archive->entries =
+      (const struct class_archive_entry*)(base + header.table);
+
+  /* lookups dereference the offsets directly, check them on both paths */
+  for (i = 0; i < header.class_count; i++) {
+    uint64_t offset = archive->entries[i].class;
+
+    if (offset < sizeof(header) || offset > archive->size ||
+        archive->size - offset < sizeof(struct class_file) ||
+        offset % _Alignof(struct class_file) != 0) {
+      printf("ERROR: %s is not a compatible class archive\n", path);
+      class_archive_unmap(archive);
+      return EINVAL;
+    }
+  }
+  if (archive->relocated) {
+    for (i = 0; i < header.class_count; i++) {
+      if (class_image_relocate_class(base, archive->size, header.base,
+                                     (size_t)archive->entries[i].class) != 0) {
+        class_archive_unmap(archive);
+        return EINVAL;
+      }
+    }
+    mprotect(base, archive->size, PROT_READ);
+  }
+  return 0;
+}
+
+void class_archive_unmap(struct class_archive* archive) {
+  if (archive->base != NULL) {
+    munmap(archive->base, archive->size);
+  }
+  memset(archive, 0, sizeof(*archive));
+}
+
+/*
+ * Makes `class` refer to the archived class with the given binary
+ * name. The class shares the archive pages and must be freed before
+ * the archive is unmapped. A nonzero source_hash is the hash64 of the
+ * current class file, ESTALE is returned if the class was archived
+ * from different bytes. Returns ENOENT if the class is not archived
+ */
+int class_archive_find(const struct class_archive* archive, const char* name,
+                       uint64_t source_hash, struct class_file* class) {
+  uint64_t name_hash = hash64(name, strlen(name), 0);
+  size_t low = 0;
+  size_t high;
+
+  if (archive->base == NULL) {
+    return ENOENT;
+  }
+  high = archive->header->class_count;
+  while (low < high) {
+    size_t middle = low + (high - low) / 2;
+    if (archive->entries[middle].name_hash < name_hash) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  for (; low < archive->header->class_count &&
+         archive->entries[low].name_hash == name_hash;
+       low++) {
+    struct class_file* archived =
+        (struct class_file*)(archive->base + archive->entries[low].class);
+    struct UTF8_info* found = class_name(archived);
+
+    if (found != NULL &&
+        is_string_match((const char*)found->bytes, found->lenght, name)) {
+      if (source_hash != 0 && archive->entries[low].source_hash != 0 &&
+          archive->entries[low].source_hash != source_hash) {
+        return ESTALE;
+      }
+      *class = *archived;
+      class->image = archive->base;
+      class->image_size = archive->size;
+      class->image_owned = 0;
+      return 0;
+    }
+  }
+  return ENOENT;
+}
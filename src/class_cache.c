@@ -0,0 +1,242 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "class_cache.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "class_image.h"
+#include "classfile_parser.h"
+#include "hash.h"
+#include "verifier.h"
+
+#define CLASS_CACHE_PATH_MAX 4096
+
+int class_cache_init(struct class_cache* cache, const char* directory) {
+  memset(cache, 0, sizeof(*cache));
+  if (mkdir(directory, 0755) != 0 && errno != EEXIST) {
+    printf("ERROR: can't create class cache directory %s\n", directory);
+    return errno;
+  }
+  cache->directory = strdup(directory);
+  if (cache->directory == NULL) {
+    printf("ERROR: can't allocate memory for class cache\n");
+    return ENOMEM;
+  }
+  return 0;
+}
+
+void class_cache_destroy(struct class_cache* cache) {
+  free(cache->directory);
+  cache->directory = NULL;
+}
+
+static void count(_Atomic(uint64_t)* counter) {
+  atomic_fetch_add_explicit(counter, 1, memory_order_relaxed);
+}
+
+static void entry_path(const struct class_cache* cache, uint64_t hash,
+                       const char* suffix, char* path) {
+  snprintf(path, CLASS_CACHE_PATH_MAX, "%s/%016llx%s", cache->directory,
+           (unsigned long long)hash, suffix);
+}
+
+/* Returns 0 and the class if a valid entry exists, ENOENT otherwise */
+static int lookup(struct class_cache* cache,
+                  const struct class_cache_header* expected,
+                  struct class_file* class) {
+  char path[CLASS_CACHE_PATH_MAX];
+  struct class_cache_header header;
+  uint8_t* image;
+  FILE* file;
+
+  entry_path(cache, expected->hash, ".jvcc", path);
+  file = fopen(path, "rb");
+  if (file == NULL) {
+    return ENOENT;
+  }
+  if (fread(&header, sizeof(header), 1, file) != 1 ||
+      header.magic != expected->magic || header.abi != expected->abi ||
+      header.hash != expected->hash || header.check != expected->check ||
+      header.class_size != expected->class_size ||
+      !(header.flags & CLASS_CACHE_VERIFIED) ||
+      header.image_size < sizeof(struct class_file) ||
+      header.image_size > (uint64_t)SIZE_MAX) {
+    fclose(file);
+    count(&cache->stats.rejected);
+    return ENOENT;
+  }
+
+  image = malloc((size_t)header.image_size);
+  if (image == NULL ||
+      fread(image, 1, (size_t)header.image_size, file) != header.image_size) {
+    free(image);
+    fclose(file);
+    count(&cache->stats.rejected);
+    return ENOENT;
+  }
+  fclose(file);
+
+  /* the header hashes cover the class file, this covers what we read */
+  if (hash64(image, (size_t)header.image_size, CLASS_CACHE_SEED) !=
+      header.image_check) {
+    free(image);
+    count(&cache->stats.rejected);
+    return ENOENT;
+  }
+  if (class_image_open(image, (size_t)header.image_size,
+                       (uintptr_t)header.image_base, 1, class) != 0) {
+    free(image);
+    count(&cache->stats.rejected);
+    return ENOENT;
+  }
+  return 0;
+}
+
+/* Stores a verified class, failures only cost a future miss */
+static void store(struct class_cache* cache,
+                  const struct class_cache_header* expected,
+                  const struct class_file* class) {
+  char path[CLASS_CACHE_PATH_MAX];
+  char temp[CLASS_CACHE_PATH_MAX + 32];
+  struct class_cache_header header = *expected;
+  uint8_t* image;
+  size_t size;
+  FILE* file;
+  int fd;
+  int ok;
+
+  if (class_image_write(class, 0, &image, &size) != 0) {
+    return;
+  }
+  header.image_base = 0;
+  header.image_size = size;
+  header.image_check = hash64(image, size, CLASS_CACHE_SEED);
+  header.flags = CLASS_CACHE_VERIFIED;
+
+  entry_path(cache, expected->hash, ".jvcc", path);
+  /* unique per store, threads and processes may store the same class */
+  snprintf(temp, sizeof(temp), "%s.XXXXXX", path);
+  fd = mkstemp(temp);
+  if (fd < 0) {
+    free(image);
+    return;
+  }
+  file = fchmod(fd, 0644) == 0 ? fdopen(fd, "wb") : NULL;
+  if (file == NULL) {
+    close(fd);
+    remove(temp);
+    free(image);
+    return;
+  }
+  ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+       fwrite(image, 1, size, file) == size;
+  ok = fclose(file) == 0 && ok;
+  free(image);
+  if (ok && rename(temp, path) == 0) {
+    count(&cache->stats.stores);
+  } else {
+    remove(temp);
+  }
+}
+
+/*
+ * Loads a class from its class file bytes, from the cache when the
+ * same bytes were verified before, otherwise by parsing and verifying
+ * them and storing the result
+ */
+int class_cache_load(struct class_cache* cache, const uint8_t* bytes,
+                     size_t size, struct class_file* class) {
+  struct class_cache_header expected = {
+      .magic = CLASS_CACHE_MAGIC,
+      .abi = class_image_abi(),
+      .hash = hash64(bytes, size, 0),
+      .check = hash64(bytes, size, CLASS_CACHE_SEED),
+      .class_size = size,
+  };
+  Loader loader = {.buffer = bytes, .size = size};
+  struct verifier verifier;
+  int err;
+
+  count(&cache->stats.lookups);
+  if (lookup(cache, &expected, class) == 0) {
+    count(&cache->stats.hits);
+    return 0;
+  }
+  count(&cache->stats.misses);
+
+  init_class_file(class);
+  err = parse_class(&loader, class);
+  if (err == 0) {
+    verifier_init(&verifier);
+    err = verify_class(&verifier, class);
+    verifier_destroy(&verifier);
+  }
+  if (err != 0) {
+    free_class_file(class);
+    return err;
+  }
+  store(cache, &expected, class);
+  return 0;
+}
+
+/* Reads the whole file first, the hash covers what the parser reads */
+int class_cache_load_stream(struct class_cache* cache, FILE* file,
+                            const char* path, struct class_file* class) {
+  uint8_t* bytes;
+  long size;
+  int err;
+
+  if (fseek(file, 0, SEEK_END) != 0 || (size = ftell(file)) < 0 ||
+      fseek(file, 0, SEEK_SET) != 0) {
+    printf("ERROR: can't read file %s\n", path);
+    return EIO;
+  }
+  bytes = malloc(size > 0 ? (size_t)size : 1);
+  if (bytes == NULL) {
+    printf("ERROR: can't allocate memory for %s\n", path);
+    return ENOMEM;
+  }
+  if (fread(bytes, 1, (size_t)size, file) != (size_t)size) {
+    free(bytes);
+    printf("ERROR: can't read file %s\n", path);
+    return EIO;
+  }
+
+  err = class_cache_load(cache, bytes, (size_t)size, class);
+  free(bytes);
+  return err;
+}
+
+int class_cache_load_file(struct class_cache* cache, const char* path,
+                          struct class_file* class) {
+  FILE* file = fopen(path, "rb");
+  int err;
+
+  if (file == NULL) {
+    printf("ERROR: can't open file %s\n", path);
+    return ENOENT;
+  }
+  err = class_cache_load_stream(cache, file, path, class);
+  fclose(file);
+  return err;
+}
+
+void class_cache_print_stats(const struct class_cache* cache) {
+  const struct class_cache_stats* stats = &cache->stats;
+  uint64_t lookups = atomic_load(&stats->lookups);
+  uint64_t hits = atomic_load(&stats->hits);
+
+  printf("class cache %s: lookups=%llu hits=%llu misses=%llu stores=%llu "
+         "rejected=%llu hit rate=%.1f%%\n",
+         cache->directory, (unsigned long long)lookups,
+         (unsigned long long)hits,
+         (unsigned long long)atomic_load(&stats->misses),
+         (unsigned long long)atomic_load(&stats->stores),
+         (unsigned long long)atomic_load(&stats->rejected),
+         lookups != 0 ? 100.0 * (double)hits / (double)lookups : 0.0);
+}
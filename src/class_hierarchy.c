@@ -0,0 +1,459 @@
+#include "class_hierarchy.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "constant_pool.h"
+#include "subtype.h"
+
+static int same_utf8(const struct UTF8_info* a, const struct UTF8_info* b) {
+  return a != NULL && b != NULL && a->lenght == b->lenght &&
+         memcmp(a->bytes, b->bytes, a->lenght) == 0;
+}
+
+static int is_interface(const struct class_file* class) {
+  return (class->access_flags & ACC_INTERFACE) != 0;
+}
+
+static int is_instantiable(const struct class_file* class) {
+  return !(class->access_flags & (ACC_INTERFACE | ACC_ABSTRACT));
+}
+
+/* Method of `class` with the name and descriptor of `method` of `holder` */
+static struct method_info* declared(struct class_file* class,
+                                    struct class_file* holder,
+                                    const struct method_info* method) {
+  struct UTF8_info* name = validate_constant(holder, method->name_index);
+  struct UTF8_info* descriptor =
+      validate_constant(holder, method->descriptor_index);
+  uint16_t i;
+
+  for (i = 0; i < class->methods_count; i++) {
+    struct method_info* candidate = &class->methods[i];
+    if (same_utf8(validate_constant(class, candidate->name_index), name) &&
+        same_utf8(validate_constant(class, candidate->descriptor_index),
+                  descriptor)) {
+      return candidate;
+    }
+  }
+  return NULL;
+}
+
+/* Method that instances of *class run, found like the interpreter does */
+static struct method_info* inherited(struct class_file** class,
+                                     struct class_file* holder,
+                                     const struct method_info* method) {
+  struct class_file* c;
+
+  for (c = *class; c != NULL && c->runtime != NULL; c = c->runtime->super) {
+    struct method_info* found = declared(c, holder, method);
+    if (found != NULL) {
+      *class = c;
+      return found;
+    }
+  }
+  return NULL;
+}
+
+/*
+ * Whether a subclass of `class` declares the method. The class being
+ * linked is listed before its runtime is published, it has no
+ * subtypes yet
+ */
+static int overridden(struct class_file* class, struct class_file* holder,
+                      const struct method_info* method) {
+  struct class_runtime* runtime = class->runtime;
+  uint32_t i;
+
+  for (i = 0; runtime != NULL && i < runtime->subtype_count; i++) {
+    struct class_file* sub = runtime->subtypes[i];
+    /* interfaces only list java/lang/Object as their superclass */
+    if (!is_interface(sub) &&
+        (declared(sub, holder, method) != NULL ||
+         overridden(sub, holder, method))) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* Instantiable classes below `class` into *found, 0 once there are two */
+static int collect(struct class_file* class, struct class_file** found) {
+  struct class_runtime* runtime = class->runtime;
+  uint32_t i;
+
+  if (is_instantiable(class)) {
+    if (*found != NULL && *found != class) {
+      return 0;
+    }
+    *found = class;
+  }
+  for (i = 0; runtime != NULL && i < runtime->subtype_count; i++) {
+    if (!collect(runtime->subtypes[i], found)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static struct class_file* unique_implementor(struct class_hierarchy* h,
+                                             struct class_file* interface) {
+  struct class_file* found = NULL;
+
+  if (h->incomplete || !is_interface(interface) ||
+      !collect(interface, &found)) {
+    return NULL;
+  }
+  return found;
+}
+
+static int holds(struct class_hierarchy* h, const struct cha_assumption* a) {
+  if (a->kind == CHA_NO_OVERRIDER) {
+    return !overridden(a->class, a->class, a->method);
+  }
+  return unique_implementor(h, a->class) == a->implementor;
+}
+
+/* Whether linking `class` makes the assumption wrong */
+static int breaks(const struct cha_assumption* a, struct class_file* class,
+                  struct class_runtime* runtime) {
+  if (a->kind == CHA_NO_OVERRIDER) {
+    return declared(class, a->class, a->method) != NULL &&
+           subtype_of(class, runtime, a->class);
+  }
+  return is_instantiable(class) && class != a->implementor &&
+         subtype_of(class, runtime, a->class);
+}
+
+static void invalidate(struct class_hierarchy* h, struct class_file* class,
+                       struct class_runtime* runtime) {
+  struct cha_dependencies** link = &h->dependencies;
+
+  while (*link != NULL) {
+    struct cha_dependencies* deps = *link;
+    uint32_t i = 0;
+
+    while (i < deps->count && !breaks(&deps->assumptions[i], class, runtime)) {
+      i++;
+    }
+    if (i == deps->count) {
+      link = &deps->next;
+      continue;
+    }
+    *link = deps->next;
+    deps->next = NULL;
+    cha_withdraw(deps);
+    h->invalidations++;
+  }
+}
+
+static int reserve_subtype(struct class_file* class) {
+  struct class_runtime* runtime = class->runtime;
+  struct class_file** subtypes;
+  uint32_t capacity;
+
+  if (runtime->subtype_count < runtime->subtype_capacity) {
+    return 0;
+  }
+  capacity = runtime->subtype_capacity != 0 ? runtime->subtype_capacity * 2 : 4;
+  subtypes = realloc(runtime->subtypes, capacity * sizeof(struct class_file*));
+  if (subtypes == NULL) {
+    printf("ERROR: can't allocate memory for class hierarchy\n");
+    return ENOMEM;
+  }
+  runtime->subtypes = subtypes;
+  runtime->subtype_capacity = capacity;
+  return 0;
+}
+
+static void remove_subtype(struct class_file* class, struct class_file* sub) {
+  struct class_runtime* runtime = class->runtime;
+  uint32_t i;
+
+  for (i = 0; runtime != NULL && i < runtime->subtype_count; i++) {
+    if (runtime->subtypes[i] == sub) {
+      runtime->subtypes[i] = runtime->subtypes[--runtime->subtype_count];
+      return;
+    }
+  }
+}
+
+struct class_hierarchy* class_hierarchy_new(void) {
+  struct class_hierarchy* h = calloc(1, sizeof(struct class_hierarchy));
+
+  if (h == NULL) {
+    printf("ERROR: can't allocate memory for class hierarchy\n");
+    return NULL;
+  }
+  if (pthread_mutex_init(&h->lock, NULL) != 0) {
+    free(h);
+    return NULL;
+  }
+  return h;
+}
+
+void class_hierarchy_free(struct class_hierarchy* h) {
+  if (h != NULL) {
+    pthread_mutex_destroy(&h->lock);
+    free(h);
+  }
+}
+
+int class_hierarchy_add(struct class_hierarchy* h, struct class_file* class,
+                        struct class_runtime* runtime) {
+  uint16_t i;
+  int err = 0;
+
+  pthread_mutex_lock(&h->lock);
+  /* room first, so the class is listed everywhere or nowhere */
+  if (runtime->super != NULL) {
+    err = reserve_subtype(runtime->super);
+  }
+  for (i = 0; err == 0 && runtime->interfaces != NULL &&
+              i < class->interfaces_count;
+       i++) {
+    if (runtime->interfaces[i] != NULL) {
+      err = reserve_subtype(runtime->interfaces[i]);
+    }
+  }
+  if (err != 0) {
+    pthread_mutex_unlock(&h->lock);
+    return err;
+  }
+
+  if (runtime->super != NULL) {
+    struct class_runtime* super = runtime->super->runtime;
+    super->subtypes[super->subtype_count++] = class;
+  }
+  for (i = 0; i < class->interfaces_count; i++) {
+    struct class_file* interface =
+        runtime->interfaces != NULL ? runtime->interfaces[i] : NULL;
+    if (interface == NULL) {
+      h->incomplete = 1;
+      continue;
+    }
+    interface->runtime->subtypes[interface->runtime->subtype_count++] = class;
+  }
+  runtime->hierarchy = h;
+  invalidate(h, class, runtime);
+  pthread_mutex_unlock(&h->lock);
+  return 0;
+}
+
+void class_hierarchy_remove(struct class_hierarchy* h, struct class_file* class,
+                            struct class_runtime* runtime) {
+  uint16_t i;
+
+  pthread_mutex_lock(&h->lock);
+  if (runtime->super != NULL) {
+    remove_subtype(runtime->super, class);
+  }
+  for (i = 0; runtime->interfaces != NULL && i < class->interfaces_count;
+       i++) {
+    if (runtime->interfaces[i] != NULL) {
+      remove_subtype(runtime->interfaces[i], class);
+    }
+  }
+  runtime->hierarchy = NULL;
+  pthread_mutex_unlock(&h->lock);
+}
+
+int class_hierarchy_has_overriders(struct class_hierarchy* h,
+                                   struct class_file* class,
+                                   const struct method_info* method) {
+  int found;
+
+  pthread_mutex_lock(&h->lock);
+  found = overridden(class, class, method);
+  pthread_mutex_unlock(&h->lock);
+  return found;
+}
+
+struct class_file* class_hierarchy_unique_implementor(
+    struct class_hierarchy* h, struct class_file* interface) {
+  struct class_file* found;
+
+  pthread_mutex_lock(&h->lock);
+  found = unique_implementor(h, interface);
+  pthread_mutex_unlock(&h->lock);
+  return found;
+}
+
+static int add_assumption(struct cha_dependencies* deps,
+                          const struct cha_assumption* a) {
+  uint32_t i;
+
+  for (i = 0; i < deps->count; i++) {
+    const struct cha_assumption* known = &deps->assumptions[i];
+    if (known->kind == a->kind && known->class == a->class &&
+        known->method == a->method && known->implementor == a->implementor) {
+      return 0;
+    }
+  }
+  if (deps->count == deps->capacity) {
+    uint32_t capacity = deps->capacity != 0 ? deps->capacity * 2 : 4;
+    struct cha_assumption* assumptions = realloc(
+        deps->assumptions, capacity * sizeof(struct cha_assumption));
+    if (assumptions == NULL) {
+      printf("ERROR: can't allocate memory for dependencies\n");
+      return ENOMEM;
+    }
+    deps->assumptions = assumptions;
+    deps->capacity = capacity;
+  }
+  deps->assumptions[deps->count++] = *a;
+  return 0;
+}
+
+struct method_info* class_hierarchy_unique_target(
+    struct class_hierarchy* h, struct cha_dependencies* deps,
+    struct class_file** holder, struct method_info* resolved, int* err) {
+  struct class_file* class = *holder;
+  struct method_info* target = NULL;
+  struct cha_assumption a;
+
+  memset(&a, 0, sizeof(a));
+  *err = 0;
+  pthread_mutex_lock(&h->lock);
+  if (is_interface(class)) {
+    struct class_file* implementor = unique_implementor(h, class);
+    a.kind = CHA_UNIQUE_IMPLEMENTOR;
+    a.class = class;
+    a.implementor = implementor;
+    class = implementor;
+    target = implementor != NULL ? inherited(&class, *holder, resolved)
+                                 : NULL;
+  } else if ((resolved->access_flags & (ACC_PRIVATE | ACC_FINAL)) ||
+             (class->access_flags & ACC_FINAL)) {
+    /* the interpreter never selects another method either */
+    target = resolved;
+  } else if (!overridden(class, class, resolved)) {
+    a.kind = CHA_NO_OVERRIDER;
+    a.class = class;
+    a.method = resolved;
+    target = resolved;
+  }
+  if (target != NULL &&
+      (target->code == NULL || (target->access_flags & ACC_STATIC))) {
+    target = NULL;
+  }
+  if (target != NULL && a.class != NULL) {
+    *err = add_assumption(deps, &a);
+    if (*err != 0) {
+      target = NULL;
+    }
+  }
+  pthread_mutex_unlock(&h->lock);
+  if (target != NULL) {
+    *holder = class;
+  }
+  return target;
+}
+
+struct method_info* class_hierarchy_exact_target(struct class_file* class,
+                                                 struct class_file** holder,
+                                                 struct method_info* resolved) {
+  struct method_info* target = resolved;
+
+  /* private and final methods are not selected, like in the interpreter */
+  if (!(resolved->access_flags & (ACC_PRIVATE | ACC_FINAL))) {
+    target = inherited(&class, *holder, resolved);
+  } else {
+    class = *holder;
+  }
+  if (target == NULL || target->code == NULL ||
+      (target->access_flags & ACC_STATIC)) {
+    return NULL;
+  }
+  *holder = class;
+  return target;
+}
+
+struct cha_dependencies* cha_dependencies_new(struct class_file* class,
+                                              struct method_info* method) {
+  struct cha_dependencies* deps = calloc(1, sizeof(struct cha_dependencies));
+
+  if (deps == NULL) {
+    printf("ERROR: can't allocate memory for dependencies\n");
+    return NULL;
+  }
+  atomic_init(&deps->invalid, 0);
+  deps->class = class;
+  deps->method = method;
+  return deps;
+}
+
+void cha_dependencies_free(struct cha_dependencies* deps) {
+  if (deps != NULL) {
+    free(deps->assumptions);
+    free(deps);
+  }
+}
+
+int class_hierarchy_register(struct class_hierarchy* h,
+                             struct cha_dependencies* deps) {
+  uint32_t i;
+
+  pthread_mutex_lock(&h->lock);
+  for (i = 0; i < deps->count; i++) {
+    if (!holds(h, &deps->assumptions[i])) {
+      pthread_mutex_unlock(&h->lock);
+      return EAGAIN;
+    }
+  }
+  deps->next = h->dependencies;
+  h->dependencies = deps;
+  pthread_mutex_unlock(&h->lock);
+  return 0;
+}
+
+void class_hierarchy_unregister(struct class_hierarchy* h,
+                                struct cha_dependencies* deps) {
+  struct cha_dependencies** link;
+
+  pthread_mutex_lock(&h->lock);
+  /* invalidated dependencies are already gone */
+  for (link = &h->dependencies; *link != NULL; link = &(*link)->next) {
+    if (*link == deps) {
+      *link = deps->next;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&h->lock);
+}
+
+void cha_withdraw(struct cha_dependencies* deps) {
+  struct method_runtime* mr = method_runtime_of(deps->class, deps->method);
+  compiled_entry code = deps->code;
+
+  atomic_store(&deps->invalid, 1);
+  if (deps->osr != NULL) {
+    atomic_compare_exchange_strong(&deps->osr->code, &code, NULL);
+  } else if (atomic_compare_exchange_strong(&mr->entry, &code, NULL)) {
+    atomic_fetch_and_explicit(&mr->flags, ~METHOD_OPTIMIZED,
+                              memory_order_relaxed);
+    atomic_store_explicit(&mr->invocations, 0, memory_order_relaxed);
+  }
+  /* counting from zero again asks for a new compile */
+  atomic_store_explicit(&mr->backedges, 0, memory_order_relaxed);
+}
+
+int64_t cha_reenter(struct interp_thread* thread, union java_value* args,
+                    struct cha_dependencies* deps) {
+  struct method_runtime* mr = method_runtime_of(deps->class, deps->method);
+  compiled_entry entry = atomic_load_explicit(&mr->entry, memory_order_acquire);
+  union java_value result;
+  int err;
+
+  if (entry != NULL && entry != deps->code) {
+    return entry(thread, args);
+  }
+  result.j = 0;
+  err = interpret(thread, deps->class, deps->method, args, &result);
+  if (err != 0 && err != INTERP_EXCEPTION) {
+    interp_throw(thread, "java/lang/InternalError");
+  }
+  return err == 0 ? result.j : 0;
+}
@@ -0,0 +1,423 @@
+#include "class_image.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "attribute_info.h"
+#include "class_layout.h"
+#include "hash.h"
+#include "oop_map.h"
+
+#define CLASS_IMAGE_VERSION 3
+
+/* Appends `n` aligned bytes and returns their offset, 0 if n is 0 */
+size_t class_image_put(struct class_image_writer* w, const void* bytes,
+                       size_t n) {
+  size_t offset = (w->size + CLASS_IMAGE_ALIGNMENT - 1) &
+                  ~(size_t)(CLASS_IMAGE_ALIGNMENT - 1);
+
+  if (n == 0 || w->error) {
+    return 0;
+  }
+  if (offset + n > w->capacity) {
+    size_t capacity = w->capacity == 0 ? 4096 : w->capacity;
+    uint8_t* data;
+
+    while (capacity < offset + n) {
+      capacity *= 2;
+    }
+    data = realloc(w->data, capacity);
+    if (data == NULL) {
+      w->error = ENOMEM;
+      return 0;
+    }
+    w->data = data;
+    w->capacity = capacity;
+  }
+  memset(w->data + w->size, 0, offset - w->size);
+  if (bytes != NULL) {
+    memcpy(w->data + offset, bytes, n);
+  } else {
+    memset(w->data + offset, 0, n);
+  }
+  w->size = offset + n;
+  return offset;
+}
+
+/* Points the pointer field at `field` to `target`, 0 means NULL */
+void class_image_set_pointer(struct class_image_writer* w, size_t field,
+                             size_t target) {
+  uintptr_t value = target != 0 ? w->base + target : 0;
+
+  if (!w->error) {
+    memcpy(w->data + field, &value, sizeof(value));
+  }
+}
+
+/* Offset of the target of the pointer field at `field`, 0 for NULL */
+size_t class_image_get_pointer(const struct class_image_writer* w,
+                               size_t field) {
+  uintptr_t value;
+
+  if (w->error) {
+    return 0;
+  }
+  memcpy(&value, w->data + field, sizeof(value));
+  return value != 0 ? (size_t)(value - w->base) : 0;
+}
+
+static void write_attributes(struct class_image_writer* w, size_t field,
+                             const struct attribute_info* attributes,
+                             uint16_t count) {
+  size_t array =
+      class_image_put(w, attributes, count * sizeof(struct attribute_info));
+  uint16_t i;
+
+  class_image_set_pointer(w, field, array);
+  for (i = 0; i < count; i++) {
+    size_t info = class_image_put(w, attributes[i].info,
+                                  attributes[i].attribute_length);
+    class_image_set_pointer(w,
+                            array + i * sizeof(struct attribute_info) +
+                                offsetof(struct attribute_info, info),
+                            info);
+  }
+}
+
+static void write_code(struct class_image_writer* w, size_t field,
+                       const struct method_info* method,
+                       size_t method_attributes) {
+  const struct Code_attribute* code = method->code;
+  size_t copy = class_image_put(w, code, sizeof(struct Code_attribute));
+  size_t table;
+  uint16_t i;
+
+  class_image_set_pointer(w, field, copy);
+  if (copy == 0) {
+    return;
+  }
+
+  /* the bytecode stays inside the raw Code attribute */
+  class_image_set_pointer(w, copy + offsetof(struct Code_attribute, code), 0);
+  for (i = 0; i < method->attributes_count; i++) {
+    const struct attribute_info* attr = &method->attributes[i];
+    if (code->code >= attr->info &&
+        code->code < attr->info + attr->attribute_length) {
+      size_t info = class_image_get_pointer(
+          w, method_attributes + i * sizeof(struct attribute_info) +
+                 offsetof(struct attribute_info, info));
+      class_image_set_pointer(w, copy + offsetof(struct Code_attribute, code),
+                              info + (size_t)(code->code - attr->info));
+    }
+  }
+
+  table = class_image_put(
+      w, code->exception_table,
+      code->exception_table_length * sizeof(*code->exception_table));
+  class_image_set_pointer(
+      w, copy + offsetof(struct Code_attribute, exception_table), table);
+  write_attributes(w, copy + offsetof(struct Code_attribute, attributes),
+                   code->attributes, code->attributes_count);
+}
+
+static void write_oop_map(struct class_image_writer* w, size_t field,
+                          const struct oop_map* map) {
+  size_t copy = class_image_put(w, map, sizeof(struct oop_map));
+
+  class_image_set_pointer(w, field, copy);
+  if (copy == 0) {
+    return;
+  }
+  class_image_set_pointer(
+      w, copy + offsetof(struct oop_map, entries),
+      class_image_put(w, map->entries,
+                      map->count * sizeof(struct oop_map_entry)));
+  class_image_set_pointer(
+      w, copy + offsetof(struct oop_map, bits),
+      class_image_put(w, map->bits,
+                      (size_t)map->count * map->words * sizeof(uint32_t)));
+}
+
+/* The superclass layout is left NULL, see class_image_put_class */
+static void write_layout(struct class_image_writer* w, size_t class_offset,
+                         const struct class_layout* layout) {
+  size_t field = class_offset + offsetof(struct class_file, layout);
+  size_t copy = class_image_put(w, layout, sizeof(struct class_layout));
+
+  class_image_set_pointer(w, field, copy);
+  if (copy == 0) {
+    return;
+  }
+  class_image_set_pointer(w, copy + offsetof(struct class_layout, klass),
+                          class_offset);
+  class_image_set_pointer(w, copy + offsetof(struct class_layout, super), 0);
+  class_image_set_pointer(
+      w, copy + offsetof(struct class_layout, ref_offsets),
+      class_image_put(w, layout->ref_offsets,
+                      layout->ref_count * sizeof(uint32_t)));
+  class_image_set_pointer(
+      w, copy + offsetof(struct class_layout, field_offsets),
+      class_image_put(w, layout->field_offsets,
+                      layout->fields_count * sizeof(uint32_t)));
+}
+
+/*
+ * Appends the class to the image and returns the offset of its
+ * class_file. Linking results (layout, oop maps) are only kept with
+ * CLASS_IMAGE_LINKED; the layout of the superclass is then left NULL
+ * for the caller to point at the superclass image
+ */
+size_t class_image_put_class(struct class_image_writer* w,
+                             const struct class_file* class, int flags) {
+  size_t offset = class_image_put(w, class, sizeof(struct class_file));
+  size_t pool;
+  size_t array;
+  uint16_t i;
+
+  class_image_set_pointer(w, offset + offsetof(struct class_file, layout), 0);
+  class_image_set_pointer(w, offset + offsetof(struct class_file, runtime), 0);
+  class_image_set_pointer(w, offset + offsetof(struct class_file, image), 0);
+
+  pool = class_image_put(w, class->constant_pool,
+                         class->constant_pool_count * sizeof(struct cp_info));
+  class_image_set_pointer(w, offset + offsetof(struct class_file, constant_pool),
+                          pool);
+  for (i = 0; i + 1 < class->constant_pool_count; i++) {
+    const struct cp_info* cp_info = &class->constant_pool[i];
+    if (cp_info->tag == UTF8) {
+      class_image_set_pointer(
+          w,
+          pool + i * sizeof(struct cp_info) +
+              offsetof(struct cp_info, utf8_info.bytes),
+          class_image_put(w, cp_info->utf8_info.bytes,
+                          cp_info->utf8_info.lenght));
+    }
+  }
+
+  class_image_set_pointer(
+      w, offset + offsetof(struct class_file, interfaces),
+      class_image_put(w, class->interfaces,
+                      class->interfaces_count * sizeof(uint16_t)));
+
+  array = class_image_put(w, class->fields,
+                          class->fields_count * sizeof(struct field_info));
+  class_image_set_pointer(w, offset + offsetof(struct class_file, fields),
+                          array);
+  for (i = 0; i < class->fields_count; i++) {
+    write_attributes(w,
+                     array + i * sizeof(struct field_info) +
+                         offsetof(struct field_info, attributes),
+                     class->fields[i].attributes,
+                     class->fields[i].attributes_count);
+  }
+
+  array = class_image_put(w, class->methods,
+                          class->methods_count * sizeof(struct method_info));
+  class_image_set_pointer(w, offset + offsetof(struct class_file, methods),
+                          array);
+  for (i = 0; i < class->methods_count; i++) {
+    const struct method_info* method = &class->methods[i];
+    size_t copy = array + i * sizeof(struct method_info);
+
+    write_attributes(w, copy + offsetof(struct method_info, attributes),
+                     method->attributes, method->attributes_count);
+    class_image_set_pointer(w, copy + offsetof(struct method_info, code), 0);
+    class_image_set_pointer(w, copy + offsetof(struct method_info, oop_map), 0);
+    if (method->code != NULL) {
+      write_code(w, copy + offsetof(struct method_info, code), method,
+                 class_image_get_pointer(
+                     w, copy + offsetof(struct method_info, attributes)));
+    }
+    if (flags & CLASS_IMAGE_LINKED) {
+      write_oop_map(w, copy + offsetof(struct method_info, oop_map),
+                    method->oop_map);
+    }
+  }
+
+  write_attributes(w, offset + offsetof(struct class_file, attributes),
+                   class->attributes, class->attributes_count);
+  if (flags & CLASS_IMAGE_LINKED) {
+    write_layout(w, offset, class->layout);
+  }
+  return offset;
+}
+
+/* Flattens the parsed parts of `class` into a new malloc'd image */
+int class_image_write(const struct class_file* class, uintptr_t base,
+                      uint8_t** image, size_t* size) {
+  struct class_image_writer w = {.base = base};
+
+  class_image_put_class(&w, class, 0);
+  if (w.error) {
+    printf("ERROR: can't allocate memory for class image\n");
+    free(w.data);
+    return w.error;
+  }
+  *image = w.data;
+  *size = w.size;
+  return 0;
+}
+
+struct relocator {
+  uint8_t* image;
+  size_t size;
+  uintptr_t from;
+  int error;
+};
+
+/* Moves one pointer into the image, checking it stays inside */
+static void* fix(struct relocator* r, const void* pointer, size_t bytes) {
+  uintptr_t offset = (uintptr_t)pointer - r->from;
+
+  if (pointer == NULL || r->error) {
+    return NULL;
+  }
+  if (offset > r->size || bytes > r->size - offset) {
+    r->error = 1;
+    return NULL;
+  }
+  return r->image + offset;
+}
+
+static struct attribute_info* fix_attributes(struct relocator* r,
+                                             struct attribute_info* pointer,
+                                             uint16_t count) {
+  struct attribute_info* attributes =
+      fix(r, pointer, count * sizeof(struct attribute_info));
+  uint16_t i;
+
+  for (i = 0; attributes != NULL && i < count; i++) {
+    attributes[i].info =
+        fix(r, attributes[i].info, attributes[i].attribute_length);
+  }
+  return attributes;
+}
+
+static void fix_method(struct relocator* r, struct method_info* method) {
+  struct Code_attribute* code;
+  struct oop_map* map;
+
+  method->attributes =
+      fix_attributes(r, method->attributes, method->attributes_count);
+  code = method->code = fix(r, method->code, sizeof(struct Code_attribute));
+  if (code != NULL) {
+    code->code = fix(r, code->code, code->code_length);
+    code->exception_table =
+        fix(r, code->exception_table,
+            code->exception_table_length * sizeof(*code->exception_table));
+    code->attributes =
+        fix_attributes(r, code->attributes, code->attributes_count);
+  }
+  map = method->oop_map = fix(r, method->oop_map, sizeof(struct oop_map));
+  if (map != NULL) {
+    map->entries =
+        fix(r, map->entries, map->count * sizeof(struct oop_map_entry));
+    map->bits = fix(r, map->bits,
+                    (size_t)map->count * map->words * sizeof(uint32_t));
+  }
+}
+
+/*
+ * Rewrites every pointer of the class at `offset` of an image
+ * written for `from_base`
+ */
+int class_image_relocate_class(uint8_t* image, size_t size,
+                               uintptr_t from_base, size_t offset) {
+  struct relocator r = {.image = image, .size = size, .from = from_base};
+  struct class_file* class = (struct class_file*)(image + offset);
+  struct class_layout* layout;
+  uint16_t i;
+
+  if (offset > size || size - offset < sizeof(struct class_file)) {
+    return EINVAL;
+  }
+  if (from_base == (uintptr_t)image) {
+    return 0;
+  }
+
+  class->constant_pool =
+      fix(&r, class->constant_pool,
+          class->constant_pool_count * sizeof(struct cp_info));
+  for (i = 0; class->constant_pool != NULL &&
+              i + 1 < class->constant_pool_count;
+       i++) {
+    struct cp_info* cp_info = &class->constant_pool[i];
+    if (cp_info->tag == UTF8) {
+      cp_info->utf8_info.bytes =
+          fix(&r, cp_info->utf8_info.bytes, cp_info->utf8_info.lenght);
+    }
+  }
+  class->interfaces =
+      fix(&r, class->interfaces, class->interfaces_count * sizeof(uint16_t));
+
+  class->fields =
+      fix(&r, class->fields, class->fields_count * sizeof(struct field_info));
+  for (i = 0; class->fields != NULL && i < class->fields_count; i++) {
+    class->fields[i].attributes =
+        fix_attributes(&r, class->fields[i].attributes,
+                       class->fields[i].attributes_count);
+  }
+
+  class->methods = fix(&r, class->methods,
+                       class->methods_count * sizeof(struct method_info));
+  for (i = 0; class->methods != NULL && i < class->methods_count; i++) {
+    fix_method(&r, &class->methods[i]);
+  }
+
+  class->attributes =
+      fix_attributes(&r, class->attributes, class->attributes_count);
+
+  layout = class->layout =
+      fix(&r, class->layout, sizeof(struct class_layout));
+  if (layout != NULL) {
+    layout->klass = fix(&r, layout->klass, sizeof(struct class_file));
+    layout->super = fix(&r, layout->super, sizeof(struct class_layout));
+    layout->ref_offsets =
+        fix(&r, layout->ref_offsets, layout->ref_count * sizeof(uint32_t));
+    layout->field_offsets = fix(&r, layout->field_offsets,
+                                layout->fields_count * sizeof(uint32_t));
+  }
+
+  if (r.error) {
+    printf("ERROR: class image is corrupted\n");
+    return EINVAL;
+  }
+  return 0;
+}
+
+int class_image_relocate(uint8_t* image, size_t size, uintptr_t from_base) {
+  return class_image_relocate_class(image, size, from_base, 0);
+}
+
+/*
+ * Relocates the image if needed and makes `class` refer to it.
+ * An owned image is freed together with the class
+ */
+int class_image_open(uint8_t* image, size_t size, uintptr_t from_base,
+                     int owned, struct class_file* class) {
+  int err = class_image_relocate(image, size, from_base);
+
+  if (err != 0) {
+    return err;
+  }
+  *class = *(struct class_file*)image;
+  class->image = image;
+  class->image_size = size;
+  class->image_owned = (uint8_t)owned;
+  return 0;
+}
+
+/* Changes whenever the layout of the structures in an image changes */
+uint32_t class_image_abi(void) {
+  const uint64_t sizes[] = {
+      CLASS_IMAGE_VERSION,           sizeof(void*),
+      sizeof(struct class_file),     sizeof(struct cp_info),
+      sizeof(struct field_info),     sizeof(struct method_info),
+      sizeof(struct attribute_info), sizeof(struct Code_attribute),
+      sizeof(struct class_layout),   sizeof(struct oop_map),
+  };
+
+  return (uint32_t)hash64(sizes, sizeof(sizes), 0);
+}
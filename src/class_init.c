@@ -0,0 +1,593 @@
+#include "class_init.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "descriptor.h"
+#include "opcodes.h"
+
+#define UNVISITED UINT32_MAX
+
+struct init_node {
+  struct class_file* class;
+  uint32_t* deps; /* nodes whose initialization it can trigger */
+  uint32_t dep_count;
+  uint32_t dep_capacity;
+  uint32_t next_dep; /* the DFS resumes there */
+  uint32_t index; /* Tarjan's DFS numbering */
+  uint32_t low;
+  uint32_t component;
+  uint8_t on_stack;
+  uint8_t requested;
+};
+
+/* Strongly connected nodes, initialized by one thread */
+struct init_component {
+  uint32_t first; /* in graph->order */
+  uint32_t count;
+  uint32_t pending; /* components it waits for, under the pool lock */
+  uint32_t* dependents; /* into graph->dependents */
+  uint32_t dependent_count;
+};
+
+struct init_graph {
+  struct interpreter* interp;
+  struct init_node* nodes;
+  uint32_t count;
+  uint32_t capacity;
+  uint32_t* map; /* open addressing over class pointers, node + 1 */
+  uint32_t map_mask;
+
+  uint32_t* stack; /* Tarjan's */
+  uint32_t stack_size;
+  uint32_t* calls; /* the DFS path */
+  uint32_t next_index;
+  uint32_t* order; /* nodes by component */
+  uint32_t ordered;
+  struct init_component* components;
+  uint32_t component_count;
+  uint32_t* dependents;
+};
+
+struct init_pool {
+  struct init_graph* graph;
+  pthread_mutex_t lock; /* everything below, pending counts */
+  pthread_cond_t changed;
+  uint32_t* ready; /* components with nothing pending */
+  uint32_t head;
+  uint32_t tail;
+  uint32_t remaining; /* components not done */
+  uint32_t failed;
+};
+
+struct init_worker {
+  pthread_t pthread;
+  struct init_pool* pool;
+  int started;
+};
+
+static uint32_t hash_pointer(const void* pointer) {
+  uint64_t x = (uint64_t)(uintptr_t)pointer;
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  return (uint32_t)x;
+}
+
+static int grow_map(struct init_graph* graph) {
+  uint32_t capacity = graph->map != NULL ? (graph->map_mask + 1) * 2 : 64;
+  uint32_t* map = calloc(capacity, sizeof(uint32_t));
+  uint32_t i;
+
+  if (map == NULL) {
+    return ENOMEM;
+  }
+  for (i = 0; i < graph->count; i++) {
+    uint32_t slot = hash_pointer(graph->nodes[i].class) & (capacity - 1);
+    while (map[slot] != 0) {
+      slot = (slot + 1) & (capacity - 1);
+    }
+    map[slot] = i + 1;
+  }
+  free(graph->map);
+  graph->map = map;
+  graph->map_mask = capacity - 1;
+  return 0;
+}
+
+/* The node of `class`, added if it is new. ENOMEM */
+static int node_of(struct init_graph* graph, struct class_file* class,
+                   uint32_t* node) {
+  uint32_t slot;
+  int err;
+
+  if (graph->map == NULL || (graph->count + 1) * 2 > graph->map_mask + 1) {
+    err = grow_map(graph);
+    if (err != 0) {
+      return err;
+    }
+  }
+  slot = hash_pointer(class) & graph->map_mask;
+  while (graph->map[slot] != 0) {
+    if (graph->nodes[graph->map[slot] - 1].class == class) {
+      *node = graph->map[slot] - 1;
+      return 0;
+    }
+    slot = (slot + 1) & graph->map_mask;
+  }
+
+  if (graph->count == graph->capacity) {
+    uint32_t capacity = graph->capacity != 0 ? graph->capacity * 2 : 64;
+    struct init_node* nodes =
+        realloc(graph->nodes, capacity * sizeof(struct init_node));
+    if (nodes == NULL) {
+      return ENOMEM;
+    }
+    graph->nodes = nodes;
+    graph->capacity = capacity;
+  }
+  memset(&graph->nodes[graph->count], 0, sizeof(struct init_node));
+  graph->nodes[graph->count].class = class;
+  graph->nodes[graph->count].index = UNVISITED;
+  graph->map[slot] = graph->count + 1;
+  *node = graph->count++;
+  return 0;
+}
+
+static int add_dep(struct init_node* node, uint32_t dep) {
+  if (node->dep_count == node->dep_capacity) {
+    uint32_t capacity = node->dep_capacity != 0 ? node->dep_capacity * 2 : 8;
+    uint32_t* deps = realloc(node->deps, capacity * sizeof(uint32_t));
+    if (deps == NULL) {
+      return ENOMEM;
+    }
+    node->deps = deps;
+    node->dep_capacity = capacity;
+  }
+  node->deps[node->dep_count++] = dep;
+  return 0;
+}
+
+/* Edge from node `v` to the class constant `index` names, once per index */
+static int add_class_dep(struct init_graph* graph, uint32_t v, uint16_t index,
+                         uint8_t* seen) {
+  struct class_file* class = graph->nodes[v].class;
+  struct interpreter* interp = graph->interp;
+  struct UTF8_info* name;
+  struct class_file* named;
+  uint32_t w;
+  int err;
+
+  if (index == 0 || index >= class->constant_pool_count || seen[index]) {
+    return 0;
+  }
+  seen[index] = 1;
+  name = constant_class_name(class, index);
+  /* creating an array doesn't initialize its element class */
+  if (name == NULL || name->lenght == 0 || name->bytes[0] == '[') {
+    return 0;
+  }
+  named = interp->resolve_class(name->bytes, name->lenght, interp->resolve_ctx);
+  if (named == NULL || named == class) {
+    return 0;
+  }
+  err = node_of(graph, named, &w);
+  if (err == 0 && w != v) {
+    err = add_dep(&graph->nodes[v], w);
+  }
+  return err;
+}
+
+/* The class constant a new, getstatic, putstatic or invokestatic names */
+static uint16_t trigger_class(struct class_file* class, const uint8_t* code) {
+  uint16_t index = (uint16_t)((code[1] << 8) | code[2]);
+  struct cp_info* cp_info;
+
+  if (code[0] == OP_NEW) {
+    return index;
+  }
+  if (get_constant(class, index, &cp_info) != 0) {
+    return 0;
+  }
+  switch (cp_info->tag) {
+    case FIELD_REF:
+      return code[0] == OP_GETSTATIC || code[0] == OP_PUTSTATIC
+                 ? cp_info->fieldref_info.info.class_index
+                 : 0;
+    case METHOD_REF:
+      return code[0] == OP_INVOKESTATIC
+                 ? cp_info->methodref_info.info.class_index
+                 : 0;
+    case INTERF_METHOD_REF:
+      return code[0] == OP_INVOKESTATIC
+                 ? cp_info->interface_meth_ref_info.info.class_index
+                 : 0;
+    default:
+      return 0;
+  }
+}
+
+/*
+ * Edges to the classes whose initialization node `v` can trigger,
+ * JVMS 5.5: its superclass and interfaces, and the classes its code
+ * creates instances of or uses the static members of
+ */
+static int add_deps(struct init_graph* graph, uint32_t v) {
+  struct class_file* class = graph->nodes[v].class;
+  uint8_t* seen;
+  uint16_t i;
+  int err = 0;
+
+  if (graph->interp->resolve_class == NULL) {
+    return 0;
+  }
+  seen = calloc(class->constant_pool_count + 1u, 1);
+  if (seen == NULL) {
+    return ENOMEM;
+  }
+  err = add_class_dep(graph, v, class->super_class, seen);
+  for (i = 0; err == 0 && i < class->interfaces_count; i++) {
+    err = add_class_dep(graph, v, class->interfaces[i], seen);
+  }
+  for (i = 0; err == 0 && i < class->methods_count; i++) {
+    const struct Code_attribute* code = class->methods[i].code;
+    uint32_t bci, length;
+
+    for (bci = 0; err == 0 && code != NULL && bci < code->code_length;
+         bci += length) {
+      uint8_t opcode = code->code[bci];
+
+      length = opcode_length(code->code, code->code_length, bci);
+      if (length == 0) {
+        break;
+      }
+      if (opcode == OP_NEW || opcode == OP_GETSTATIC ||
+          opcode == OP_PUTSTATIC || opcode == OP_INVOKESTATIC) {
+        err = add_class_dep(graph, v, trigger_class(class, code->code + bci),
+                            seen);
+      }
+    }
+  }
+  free(seen);
+  return err;
+}
+
+/* Tarjan's DFS entry to node `v` */
+static void visit(struct init_graph* graph, uint32_t v) {
+  struct init_node* node = &graph->nodes[v];
+
+  node->index = node->low = graph->next_index++;
+  graph->stack[graph->stack_size++] = v;
+  node->on_stack = 1;
+}
+
+/*
+ * Tarjan's algorithm from `root` with an explicit call stack, a chain
+ * of classes can be deeper than the thread's stack
+ */
+static void strong_connect(struct init_graph* graph, uint32_t root) {
+  uint32_t depth = 0;
+
+  visit(graph, root);
+  graph->calls[depth++] = root;
+  while (depth > 0) {
+    uint32_t v = graph->calls[depth - 1];
+    struct init_node* node = &graph->nodes[v];
+
+    if (node->next_dep < node->dep_count) {
+      uint32_t w = node->deps[node->next_dep++];
+      struct init_node* dep = &graph->nodes[w];
+
+      if (dep->index == UNVISITED) {
+        visit(graph, w);
+        graph->calls[depth++] = w;
+      } else if (dep->on_stack && dep->index < node->low) {
+        node->low = dep->index;
+      }
+      continue;
+    }
+
+    /* a component comes out after every component it reaches */
+    if (node->low == node->index) {
+      struct init_component* component =
+          &graph->components[graph->component_count];
+      uint32_t w;
+
+      component->first = graph->ordered;
+      do {
+        w = graph->stack[--graph->stack_size];
+        graph->nodes[w].on_stack = 0;
+        graph->nodes[w].component = graph->component_count;
+        graph->order[graph->ordered++] = w;
+      } while (w != v);
+      component->count = graph->ordered - component->first;
+      graph->component_count++;
+    }
+    depth--;
+    if (depth > 0) {
+      struct init_node* caller = &graph->nodes[graph->calls[depth - 1]];
+      if (node->low < caller->low) {
+        caller->low = node->low;
+      }
+    }
+  }
+}
+
+/* Links components to the ones waiting for them, twice: count, fill */
+static int link_components(struct init_graph* graph) {
+  uint32_t* seen = calloc(graph->component_count, sizeof(uint32_t));
+  uint32_t total = 0;
+  uint32_t pass, c, i, j;
+
+  if (seen == NULL) {
+    return ENOMEM;
+  }
+  for (pass = 0; pass < 2; pass++) {
+    if (pass == 1) {
+      graph->dependents = malloc((total != 0 ? total : 1) * sizeof(uint32_t));
+      if (graph->dependents == NULL) {
+        free(seen);
+        return ENOMEM;
+      }
+      total = 0;
+      for (c = 0; c < graph->component_count; c++) {
+        graph->components[c].dependents = graph->dependents + total;
+        total += graph->components[c].dependent_count;
+        graph->components[c].dependent_count = 0;
+      }
+      memset(seen, 0, graph->component_count * sizeof(uint32_t));
+    }
+    for (c = 0; c < graph->component_count; c++) {
+      struct init_component* component = &graph->components[c];
+      for (i = 0; i < component->count; i++) {
+        struct init_node* node =
+            &graph->nodes[graph->order[component->first + i]];
+        for (j = 0; j < node->dep_count; j++) {
+          uint32_t d = graph->nodes[node->deps[j]].component;
+          struct init_component* dep = &graph->components[d];
+
+          if (d == c || seen[d] == c + 1) {
+            continue;
+          }
+          seen[d] = c + 1;
+          if (pass == 0) {
+            dep->dependent_count++;
+            total++;
+          } else {
+            dep->dependents[dep->dependent_count++] = c;
+            component->pending++;
+          }
+        }
+      }
+    }
+  }
+  free(seen);
+  return 0;
+}
+
+static int build_graph(struct init_graph* graph, struct class_file** classes,
+                       uint32_t count) {
+  uint32_t i, v;
+  int err;
+
+  for (i = 0; i < count; i++) {
+    err = node_of(graph, classes[i], &v);
+    if (err != 0) {
+      return err;
+    }
+    graph->nodes[v].requested = 1;
+  }
+  /* the nodes added on the way get their edges too */
+  for (v = 0; v < graph->count; v++) {
+    err = add_deps(graph, v);
+    if (err != 0) {
+      return err;
+    }
+  }
+
+  graph->stack = malloc(graph->count * sizeof(uint32_t));
+  graph->calls = malloc(graph->count * sizeof(uint32_t));
+  graph->order = malloc(graph->count * sizeof(uint32_t));
+  graph->components = calloc(graph->count, sizeof(struct init_component));
+  if (graph->stack == NULL || graph->calls == NULL || graph->order == NULL ||
+      graph->components == NULL) {
+    return ENOMEM;
+  }
+  for (v = 0; v < graph->count; v++) {
+    if (graph->nodes[v].index == UNVISITED) {
+      strong_connect(graph, v);
+    }
+  }
+  return link_components(graph);
+}
+
+static void free_graph(struct init_graph* graph) {
+  uint32_t i;
+
+  for (i = 0; i < graph->count; i++) {
+    free(graph->nodes[i].deps);
+  }
+  free(graph->nodes);
+  free(graph->map);
+  free(graph->stack);
+  free(graph->calls);
+  free(graph->order);
+  free(graph->components);
+  free(graph->dependents);
+}
+
+/* 1 when the class failed, its exception is dropped */
+static int init_one(struct interp_thread* thread, struct class_file* class) {
+  int err = interp_link_class(thread->interp, class);
+
+  if (err == 0) {
+    safepoint_enter(&thread->safepoint);
+    err = interp_init_class(thread, class);
+    safepoint_leave(&thread->safepoint);
+  }
+  if (err != 0) {
+    interp_clear_exception(thread);
+    return 1;
+  }
+  return 0;
+}
+
+/* Takes ready components until none are left */
+static void run_pool(struct init_pool* pool, struct interp_thread* thread) {
+  struct init_graph* graph = pool->graph;
+
+  for (;;) {
+    struct init_component* component;
+    uint32_t failed = 0;
+    uint32_t c, i;
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->head == pool->tail && pool->remaining != 0) {
+      pthread_cond_wait(&pool->changed, &pool->lock);
+    }
+    if (pool->head == pool->tail) {
+      pthread_mutex_unlock(&pool->lock);
+      return;
+    }
+    c = pool->ready[pool->head++];
+    pthread_mutex_unlock(&pool->lock);
+
+    component = &graph->components[c];
+    for (i = 0; i < component->count; i++) {
+      struct init_node* node =
+          &graph->nodes[graph->order[component->first + i]];
+      if (node->requested) {
+        failed += init_one(thread, node->class);
+      }
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->failed += failed;
+    for (i = 0; i < component->dependent_count; i++) {
+      uint32_t d = component->dependents[i];
+      if (--graph->components[d].pending == 0) {
+        pool->ready[pool->tail++] = d;
+      }
+    }
+    pool->remaining--;
+    pthread_cond_broadcast(&pool->changed);
+    pthread_mutex_unlock(&pool->lock);
+  }
+}
+
+static void* run_worker(void* arg) {
+  struct init_worker* worker = arg;
+  struct interp_thread thread;
+
+  if (interp_thread_init(&thread, worker->pool->graph->interp, 0) != 0) {
+    interp_thread_destroy(&thread);
+    return NULL;
+  }
+  run_pool(worker->pool, &thread);
+  interp_thread_destroy(&thread);
+  return NULL;
+}
+
+static int init_parallel(struct interp_thread* thread,
+                         struct class_file** classes, uint32_t count,
+                         uint32_t threads, struct class_init_stats* stats) {
+  struct init_graph graph;
+  struct init_pool pool;
+  struct init_worker* workers;
+  uint32_t c, i;
+  int err;
+
+  memset(&graph, 0, sizeof(graph));
+  graph.interp = thread->interp;
+  err = build_graph(&graph, classes, count);
+  if (err != 0) {
+    printf("ERROR: can't allocate memory for the class graph\n");
+    free_graph(&graph);
+    return err;
+  }
+
+  memset(&pool, 0, sizeof(pool));
+  pool.graph = &graph;
+  pool.remaining = graph.component_count;
+  pool.ready = malloc((graph.component_count + 1) * sizeof(uint32_t));
+  workers = calloc(threads - 1, sizeof(struct init_worker));
+  if (pool.ready == NULL || workers == NULL) {
+    printf("ERROR: can't allocate memory for the class graph\n");
+    free(pool.ready);
+    free(workers);
+    free_graph(&graph);
+    return ENOMEM;
+  }
+  for (c = 0; c < graph.component_count; c++) {
+    if (graph.components[c].pending == 0) {
+      pool.ready[pool.tail++] = c;
+    }
+    if (graph.components[c].count > stats->largest) {
+      stats->largest = graph.components[c].count;
+    }
+  }
+  stats->reached = graph.count;
+  stats->components = graph.component_count;
+  pthread_mutex_init(&pool.lock, NULL);
+  pthread_cond_init(&pool.changed, NULL);
+
+  /*
+   * the calling thread works too, so a helper that doesn't start only
+   * makes it take longer and is not an error
+   */
+  stats->threads = 1;
+  for (i = 0; i < threads - 1; i++) {
+    workers[i].pool = &pool;
+    workers[i].started =
+        pthread_create(&workers[i].pthread, NULL, run_worker, &workers[i]) ==
+        0;
+    stats->threads += workers[i].started;
+  }
+  run_pool(&pool, thread);
+  for (i = 0; i < threads - 1; i++) {
+    if (workers[i].started) {
+      pthread_join(workers[i].pthread, NULL);
+    }
+  }
+  stats->failed = pool.failed;
+
+  pthread_cond_destroy(&pool.changed);
+  pthread_mutex_destroy(&pool.lock);
+  free(pool.ready);
+  free(workers);
+  free_graph(&graph);
+  return 0;
+}
+
+int class_init_all(struct interp_thread* thread, struct class_file** classes,
+                   uint32_t count, uint32_t threads,
+                   struct class_init_stats* stats) {
+  struct class_init_stats unused;
+  uint32_t i;
+  int err;
+
+  if (stats == NULL) {
+    stats = &unused;
+  }
+  memset(stats, 0, sizeof(*stats));
+  stats->classes = count;
+  if (threads <= 1) {
+    stats->threads = 1;
+    for (i = 0; i < count; i++) {
+      stats->failed += init_one(thread, classes[i]);
+    }
+  } else {
+    err = init_parallel(thread, classes, count, threads, stats);
+    if (err != 0) {
+      return err;
+    }
+  }
+  if (stats->failed != 0) {
+    interp_throw(thread, "java/lang/ExceptionInInitializerError");
+    return INTERP_EXCEPTION;
+  }
+  return 0;
+}
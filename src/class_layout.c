@@ -0,0 +1,167 @@
+#include "class_layout.h"
+
+#include <errno.h>
+#include <stdio.h>
+
+#include "constant_pool.h"
+
+#define LAYOUT_GROUPS 5
+
+static const struct class_layout array_layouts[] = {
+    {.array_type = T_BOOLEAN, .element_size = 1},
+    {.array_type = T_CHAR, .element_size = 2},
+    {.array_type = T_FLOAT, .element_size = 4},
+    {.array_type = T_DOUBLE, .element_size = 8},
+    {.array_type = T_BYTE, .element_size = 1},
+    {.array_type = T_SHORT, .element_size = 2},
+    {.array_type = T_INT, .element_size = 4},
+    {.array_type = T_LONG, .element_size = 8},
+    {.array_type = T_OBJECT, .element_size = sizeof(void*)},
+};
+
+uint8_t field_descriptor_size(uint8_t first_char) {
+  switch (first_char) {
+    case 'B':
+    case 'Z':
+      return 1;
+    case 'C':
+    case 'S':
+      return 2;
+    case 'I':
+    case 'F':
+      return 4;
+    case 'J':
+    case 'D':
+      return 8;
+    case 'L':
+    case '[':
+      return sizeof(void*);
+    default:
+      return 0;
+  }
+}
+
+const struct class_layout* class_layout_for_array(uint8_t array_type) {
+  if (array_type < T_BOOLEAN || array_type > T_OBJECT) {
+    return NULL;
+  }
+  return &array_layouts[array_type - T_BOOLEAN];
+}
+
+/* Group index of a field: references first, then by decreasing size */
+static int field_group(uint8_t first_char) {
+  switch (field_descriptor_size(first_char)) {
+    case 8:
+      return (first_char == 'L' || first_char == '[') ? 0 : 1;
+    case 4:
+      return 2;
+    case 2:
+      return 3;
+    case 1:
+      return 4;
+    default:
+      return -1;
+  }
+}
+
+int class_layout_compute(struct class_file* class,
+                         const struct class_layout* super,
+                         struct class_layout* layout) {
+  static const uint32_t group_size[LAYOUT_GROUPS] = {sizeof(void*), 8, 4, 2,
+                                                     1};
+  uint32_t group_offset[LAYOUT_GROUPS];
+  uint32_t group_count[LAYOUT_GROUPS] = {0};
+  uint32_t offset;
+  uint16_t i;
+  uint16_t ref_index;
+  int group;
+
+  layout->klass = class;
+  layout->super = super;
+  layout->array_type = 0;
+  layout->element_size = 0;
+  layout->fields_count = class->fields_count;
+  layout->field_offsets = NULL;
+  layout->ref_offsets = NULL;
+
+  if (class->fields_count != 0) {
+    layout->field_offsets = malloc(sizeof(uint32_t) * class->fields_count);
+    if (layout->field_offsets == NULL) {
+      printf("ERROR: can't allocate memory for field offsets");
+      return ENOMEM;
+    }
+  }
+
+  for (i = 0; i < class->fields_count; i++) {
+    struct UTF8_info* descriptor;
+
+    layout->field_offsets[i] = UINT32_MAX;
+    if (class->fields[i].access_flags & ACC_STATIC) {
+      continue;
+    }
+    descriptor = validate_constant(class, class->fields[i].descriptor_index);
+    if (descriptor == NULL || descriptor->lenght == 0 ||
+        (group = field_group(descriptor->bytes[0])) < 0) {
+      printf("ERROR: bad descriptor of field %hu\n", i);
+      class_layout_free(layout);
+      return EINVAL;
+    }
+    group_count[group]++;
+  }
+
+  /*
+   * Fields of the class are appended after the superclass fields.
+   * Groups go in order of decreasing alignment so no padding
+   * is needed between them.
+   */
+  offset = super != NULL ? super->instance_size : sizeof(struct object_header);
+  for (group = 0; group < LAYOUT_GROUPS; group++) {
+    group_offset[group] = offset;
+    offset += group_count[group] * group_size[group];
+  }
+  layout->instance_size = (offset + 7) & ~(uint32_t)7;
+
+  layout->ref_count = (uint16_t)((super != NULL ? super->ref_count : 0) +
+                                 group_count[0]);
+  if (layout->ref_count != 0) {
+    layout->ref_offsets = malloc(sizeof(uint32_t) * layout->ref_count);
+    if (layout->ref_offsets == NULL) {
+      printf("ERROR: can't allocate memory for reference map");
+      class_layout_free(layout);
+      return ENOMEM;
+    }
+  }
+
+  ref_index = 0;
+  if (super != NULL) {
+    for (; ref_index < super->ref_count; ref_index++) {
+      layout->ref_offsets[ref_index] = super->ref_offsets[ref_index];
+    }
+  }
+
+  for (i = 0; i < class->fields_count; i++) {
+    struct UTF8_info* descriptor;
+
+    if (class->fields[i].access_flags & ACC_STATIC) {
+      continue;
+    }
+    descriptor = validate_constant(class, class->fields[i].descriptor_index);
+    group = field_group(descriptor->bytes[0]);
+    layout->field_offsets[i] = group_offset[group];
+    group_offset[group] += group_size[group];
+    if (group == 0) {
+      layout->ref_offsets[ref_index++] = layout->field_offsets[i];
+    }
+  }
+
+  return 0;
+}
+
+void class_layout_free(struct class_layout* layout) {
+  free(layout->field_offsets);
+  free(layout->ref_offsets);
+  layout->field_offsets = NULL;
+  layout->ref_offsets = NULL;
+  layout->ref_count = 0;
+  layout->fields_count = 0;
+}
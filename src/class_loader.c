@@ -0,0 +1,444 @@
+#define _GNU_SOURCE
+
+#include "class_loader.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "classfile_parser.h"
+#include "descriptor.h"
+#include "hash.h"
+#include "interpreter.h"
+#include "verifier.h"
+
+#define INITIAL_CAPACITY 256
+/* longest chain of loading threads looked at for a circularity */
+#define MAX_BLOCKED_CHAIN 4096
+
+/* Identifies the thread as an owner, never dereferenced */
+static _Thread_local char thread_tag;
+/* Innermost class the thread is loading */
+static _Thread_local struct class_entry* loading;
+
+static void futex_wait(_Atomic(uint32_t)* word, uint32_t value) {
+  syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+}
+
+static void futex_wake(_Atomic(uint32_t)* word, int count) {
+  syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+static struct class_table* table_new(uint32_t capacity) {
+  struct class_table* table =
+      calloc(1, sizeof(struct class_table) +
+                    capacity * sizeof(_Atomic(struct class_entry*)));
+
+  if (table == NULL) {
+    printf("ERROR: can't allocate memory for the system dictionary\n");
+    return NULL;
+  }
+  table->mask = capacity - 1;
+  return table;
+}
+
+static void free_entry(struct class_entry* entry) {
+  if (entry->class != NULL) {
+    free_class_file(entry->class);
+    free(entry->class);
+  }
+  free(entry->name);
+  free(entry);
+}
+
+int class_loader_init(struct class_loader* loader, const char* class_path) {
+  const char* start = class_path;
+
+  memset(loader, 0, sizeof(*loader));
+  pthread_mutex_init(&loader->lock, NULL);
+  loader->path = calloc(strlen(class_path) / 2 + 1, sizeof(char*));
+  if (loader->path == NULL) {
+    class_loader_destroy(loader);
+    printf("ERROR: can't allocate memory for the class path\n");
+    return ENOMEM;
+  }
+  while (*start != '\0') {
+    size_t length = strcspn(start, ":");
+
+    if (length != 0) {
+      loader->path[loader->path_count] = strndup(start, length);
+      if (loader->path[loader->path_count++] == NULL) {
+        class_loader_destroy(loader);
+        printf("ERROR: can't allocate memory for the class path\n");
+        return ENOMEM;
+      }
+    }
+    start += length + (start[length] == ':');
+  }
+  atomic_init(&loader->table, table_new(INITIAL_CAPACITY));
+  if (atomic_load(&loader->table) == NULL) {
+    class_loader_destroy(loader);
+    return ENOMEM;
+  }
+  return 0;
+}
+
+void class_loader_destroy(struct class_loader* loader) {
+  struct class_table* table = atomic_load(&loader->table);
+  struct class_entry* entry;
+  uint32_t i;
+
+  /* a runtime is unhooked from those of its supertypes */
+  for (entry = loader->last_loaded; entry != NULL;
+       entry = entry->next_loaded) {
+    class_runtime_free(entry->class);
+  }
+  for (i = 0; table != NULL && i <= table->mask; i++) {
+    entry = atomic_load_explicit(&table->slots[i], memory_order_relaxed);
+    if (entry != NULL) {
+      free_entry(entry);
+    }
+  }
+  while (table != NULL) {
+    struct class_table* retired = table->retired;
+    free(table);
+    table = retired;
+  }
+  for (i = 0; i < loader->path_count; i++) {
+    free(loader->path[i]);
+  }
+  free(loader->path);
+  pthread_mutex_destroy(&loader->lock);
+  memset(loader, 0, sizeof(*loader));
+}
+
+static struct class_entry* lookup(struct class_table* table, uint64_t hash,
+                                  const uint8_t* name, uint16_t length) {
+  uint32_t i = (uint32_t)hash & table->mask;
+
+  for (;;) {
+    struct class_entry* entry =
+        atomic_load_explicit(&table->slots[i], memory_order_acquire);
+
+    if (entry == NULL) {
+      return NULL;
+    }
+    if (entry->hash == hash && entry->length == length &&
+        memcmp(entry->name, name, length) == 0) {
+      return entry;
+    }
+    i = (i + 1) & table->mask;
+  }
+}
+
+static void insert(struct class_table* table, struct class_entry* entry) {
+  uint32_t i = (uint32_t)entry->hash & table->mask;
+
+  while (atomic_load_explicit(&table->slots[i], memory_order_relaxed) !=
+         NULL) {
+    i = (i + 1) & table->mask;
+  }
+  atomic_store_explicit(&table->slots[i], entry, memory_order_release);
+}
+
+/*
+ * Under the lock. Readers still in the old table either find what
+ * they look for or go for the lock
+ */
+static int grow(struct class_loader* loader) {
+  struct class_table* old =
+      atomic_load_explicit(&loader->table, memory_order_relaxed);
+  struct class_table* table = table_new((old->mask + 1) * 2);
+  uint32_t i;
+
+  if (table == NULL) {
+    return ENOMEM;
+  }
+  for (i = 0; i <= old->mask; i++) {
+    struct class_entry* entry =
+        atomic_load_explicit(&old->slots[i], memory_order_relaxed);
+    if (entry != NULL) {
+      insert(table, entry);
+    }
+  }
+  table->retired = old;
+  atomic_store_explicit(&loader->table, table, memory_order_release);
+  loader->stats.grows++;
+  return 0;
+}
+
+/* Entry of the name, a new one is this thread's placeholder */
+static struct class_entry* find_or_insert(struct class_loader* loader,
+                                          uint64_t hash, const uint8_t* name,
+                                          uint16_t length, int* inserted) {
+  struct class_entry* entry;
+
+  pthread_mutex_lock(&loader->lock);
+  entry = lookup(atomic_load_explicit(&loader->table, memory_order_relaxed),
+                 hash, name, length);
+  if (entry == NULL) {
+    struct class_table* table =
+        atomic_load_explicit(&loader->table, memory_order_relaxed);
+
+    /* at most three quarters full */
+    if ((loader->count + 1) * 4 > (table->mask + 1) * 3 &&
+        grow(loader) != 0) {
+      pthread_mutex_unlock(&loader->lock);
+      return NULL;
+    }
+    entry = calloc(1, sizeof(struct class_entry));
+    if (entry != NULL && (entry->name = malloc(length + 1u)) == NULL) {
+      free(entry);
+      entry = NULL;
+    }
+    if (entry == NULL) {
+      pthread_mutex_unlock(&loader->lock);
+      printf("ERROR: can't allocate memory for the system dictionary\n");
+      return NULL;
+    }
+    memcpy(entry->name, name, length);
+    entry->name[length] = '\0';
+    entry->length = length;
+    entry->hash = hash;
+    entry->owner = &thread_tag;
+    atomic_init(&entry->state, CLASS_ENTRY_LOADING);
+    insert(atomic_load_explicit(&loader->table, memory_order_relaxed), entry);
+    loader->count++;
+    loader->stats.entries++;
+    *inserted = 1;
+  }
+  pthread_mutex_unlock(&loader->lock);
+  return entry;
+}
+
+/*
+ * Whether waiting for the entry would wait, through the threads
+ * loading the classes each one is blocked on, for this thread
+ */
+static int circular(struct class_entry* entry) {
+  uint32_t steps;
+
+  for (steps = 0; entry != NULL && steps < MAX_BLOCKED_CHAIN; steps++) {
+    if (atomic_load(&entry->state) != CLASS_ENTRY_LOADING) {
+      return 0;
+    }
+    if (entry->owner == &thread_tag) {
+      return 1;
+    }
+    entry = atomic_load(&entry->blocked_on);
+  }
+  return 0;
+}
+
+static int wait_loaded(struct class_loader* loader, struct class_entry* entry) {
+  uint32_t state;
+
+  if (atomic_load_explicit(&entry->state, memory_order_acquire) ==
+      CLASS_ENTRY_LOADING) {
+    if (circular(entry)) {
+      printf("ERROR: ClassCircularityError: %s\n", entry->name);
+      return ELOOP;
+    }
+    pthread_mutex_lock(&loader->lock);
+    loader->stats.waits++;
+    pthread_mutex_unlock(&loader->lock);
+    /* the loader wakes us if it sees waiters after publishing */
+    atomic_fetch_add(&entry->waiters, 1);
+    while ((state = atomic_load(&entry->state)) == CLASS_ENTRY_LOADING) {
+      futex_wait(&entry->state, CLASS_ENTRY_LOADING);
+    }
+    atomic_fetch_sub(&entry->waiters, 1);
+  }
+  state = atomic_load_explicit(&entry->state, memory_order_acquire);
+  return state == CLASS_ENTRY_LOADED ? 0 : entry->error;
+}
+
+/* Frees the class when it fails either */
+static int parse_and_verify(Loader* reader, struct class_file* class) {
+  struct verifier verifier;
+  int err;
+
+  init_class_file(class);
+  err = parse_class(reader, class);
+  if (err == 0) {
+    verifier_init(&verifier);
+    err = verify_class(&verifier, class);
+    verifier_destroy(&verifier);
+  }
+  if (err != 0) {
+    free_class_file(class);
+  }
+  return err;
+}
+
+/*
+ * Parses and verifies name.class from the first directory having it,
+ * or takes it from the cache
+ */
+static int read_class(struct class_loader* loader,
+                      const struct class_entry* entry,
+                      struct class_file* class) {
+  char path[CLASS_LOADER_MAX_PATH];
+  struct UTF8_info* name;
+  uint32_t i;
+  int err;
+
+  for (i = 0; i < loader->path_count; i++) {
+    Loader reader = {0};
+
+    snprintf(path, sizeof(path), "%s/%s.class", loader->path[i], entry->name);
+    reader.file = fopen(path, "rb");
+    if (reader.file == NULL) {
+      continue;
+    }
+    err = loader->cache != NULL
+              ? class_cache_load_stream(loader->cache, reader.file, path,
+                                        class)
+              : parse_and_verify(&reader, class);
+    fclose(reader.file);
+    if (err != 0) {
+      return err;
+    }
+    name = constant_class_name(class, class->this_class);
+    if (name == NULL || name->lenght != entry->length ||
+        memcmp(name->bytes, entry->name, entry->length) != 0) {
+      printf("ERROR: NoClassDefFoundError: %s holds another class\n", path);
+      free_class_file(class);
+      return EINVAL;
+    }
+    return 0;
+  }
+  return ENOENT;
+}
+
+static int load_supertype(struct class_loader* loader, struct class_file* class,
+                          uint16_t index) {
+  struct UTF8_info* name = constant_class_name(class, index);
+  struct class_file* super;
+  int err;
+
+  if (name == NULL) {
+    return EINVAL;
+  }
+  err = class_loader_load(loader, name->bytes, name->lenght, &super);
+  /* the interpreter runs without a java/lang/Object */
+  return err == ENOENT && name->lenght == 16 &&
+                 memcmp(name->bytes, "java/lang/Object", 16) == 0
+             ? 0
+             : err;
+}
+
+/* Loads the class of this thread's placeholder, then publishes it */
+static int load(struct class_loader* loader, struct class_entry* entry) {
+  struct class_entry* outer = loading;
+  struct class_file* class = malloc(sizeof(struct class_file));
+  uint16_t i;
+  int err = class != NULL ? read_class(loader, entry, class) : ENOMEM;
+
+  if (err == 0) {
+    loading = entry;
+    if (class->super_class != 0) {
+      err = load_supertype(loader, class, class->super_class);
+    }
+    for (i = 0; err == 0 && i < class->interfaces_count; i++) {
+      err = load_supertype(loader, class, class->interfaces[i]);
+    }
+    loading = outer;
+    if (err != 0) {
+      free_class_file(class);
+    }
+  }
+
+  pthread_mutex_lock(&loader->lock);
+  if (err == 0) {
+    entry->class = class;
+    entry->next_loaded = loader->last_loaded;
+    loader->last_loaded = entry;
+    loader->stats.loaded++;
+  } else {
+    free(class);
+    entry->error = err;
+    loader->stats.failed++;
+  }
+  pthread_mutex_unlock(&loader->lock);
+  atomic_store(&entry->state,
+               err == 0 ? CLASS_ENTRY_LOADED : CLASS_ENTRY_FAILED);
+  if (atomic_load(&entry->waiters) != 0) {
+    futex_wake(&entry->state, INT_MAX);
+  }
+  return err;
+}
+
+int class_loader_load(struct class_loader* loader, const uint8_t* name,
+                      uint16_t length, struct class_file** class) {
+  uint64_t hash = hash64(name, length, 0);
+  struct class_entry* entry = lookup(
+      atomic_load_explicit(&loader->table, memory_order_acquire), hash, name,
+      length);
+  struct class_entry* outer = loading;
+  int inserted = 0;
+  int err;
+
+  *class = NULL;
+  if (entry != NULL && atomic_load_explicit(&entry->state,
+                                            memory_order_acquire) ==
+                           CLASS_ENTRY_LOADED) {
+    *class = entry->class;
+    return 0;
+  }
+  if (entry == NULL) {
+    entry = find_or_insert(loader, hash, name, length, &inserted);
+    if (entry == NULL) {
+      return ENOMEM;
+    }
+  }
+  if (outer != NULL) {
+    atomic_store(&outer->blocked_on, entry);
+  }
+  err = inserted ? load(loader, entry) : wait_loaded(loader, entry);
+  if (outer != NULL) {
+    atomic_store(&outer->blocked_on, NULL);
+  }
+  if (err == 0) {
+    *class = entry->class;
+  }
+  return err;
+}
+
+struct class_file* class_loader_find(struct class_loader* loader,
+                                     const uint8_t* name, uint16_t length) {
+  struct class_entry* entry =
+      lookup(atomic_load_explicit(&loader->table, memory_order_acquire),
+             hash64(name, length, 0), name, length);
+
+  if (entry == NULL || atomic_load_explicit(&entry->state,
+                                            memory_order_acquire) !=
+                           CLASS_ENTRY_LOADED) {
+    return NULL;
+  }
+  return entry->class;
+}
+
+struct class_file* class_loader_resolve(const uint8_t* name, uint16_t length,
+                                        void* loader) {
+  struct class_file* class;
+
+  /* array classes aren't loaded from files */
+  if (length == 0 || name[0] == '[') {
+    return NULL;
+  }
+  class_loader_load(loader, name, length, &class);
+  return class;
+}
+
+void class_loader_get_stats(struct class_loader* loader,
+                            struct class_loader_stats* stats) {
+  pthread_mutex_lock(&loader->lock);
+  *stats = loader->stats;
+  pthread_mutex_unlock(&loader->lock);
+}
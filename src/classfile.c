@@ -1,4 +1,9 @@
 #include "classfile.h"
+
+#include "class_layout.h"
+#include "interpreter.h"
+#include "oop_map.h"
+
 void init_class_file(struct class_file* class) {
   class->magic = 0;
   class->minor_version = 0;
@@ -16,12 +21,101 @@ void init_class_file(struct class_file* class) {
   class->methods = 0;
   class->attributes_count = 0;
   class->attributes = 0;
+  class->layout = 0;
+  class->runtime = 0;
+  class->image = 0;
+  class->image_size = 0;
+  class->image_owned = 0;
+  class->verify_deferred = 0;
+}
+
+static void free_attributes(struct attribute_info* attributes,
+                            uint16_t count) {
+  uint16_t i;
+
+  if (attributes == NULL) {
+    return;
+  }
+  for (i = 0; i < count; i++) {
+    free(attributes[i].info);
+  }
+  free(attributes);
+}
+
+static void free_linked(struct class_file* class) {
+  uint16_t i;
+
+  class_runtime_free(class);
+  for (i = 0; class->methods != NULL && i < class->methods_count; i++) {
+    if (!class_in_image(class, class->methods[i].oop_map)) {
+      oop_map_free(class->methods[i].oop_map);
+      class->methods[i].oop_map = NULL;
+    }
+  }
+  if (class->layout != NULL && !class_in_image(class, class->layout)) {
+    /* a copy of an archived layout shares its offset arrays */
+    if (!class_in_image(class, class->layout->field_offsets) &&
+        !class_in_image(class, class->layout->ref_offsets)) {
+      class_layout_free(class->layout);
+    }
+    free(class->layout);
+  }
+  class->layout = NULL;
+}
+
+/* Frees everything the parser and the linker allocated for the class */
+void free_class_file(struct class_file* class) {
+  uint16_t i;
+
+  free_linked(class);
+  if (class->image != NULL) {
+    /* parsed data lives in one block, see class_image.h */
+    if (class->image_owned) {
+      free(class->image);
+    }
+    init_class_file(class);
+    return;
+  }
+
+  if (class->constant_pool != NULL) {
+    for (i = 0; i + 1 < class->constant_pool_count; i++) {
+      if (class->constant_pool[i].tag == UTF8) {
+        free(class->constant_pool[i].utf8_info.bytes);
+      }
+    }
+    free(class->constant_pool);
+  }
+  free(class->interfaces);
+
+  if (class->fields != NULL) {
+    for (i = 0; i < class->fields_count; i++) {
+      free_attributes(class->fields[i].attributes,
+                      class->fields[i].attributes_count);
+    }
+    free(class->fields);
+  }
+
+  if (class->methods != NULL) {
+    for (i = 0; i < class->methods_count; i++) {
+      struct method_info* method = &class->methods[i];
+
+      if (method->code != NULL) {
+        free_code_attribute(method->code);
+        free(method->code);
+      }
+      free_attributes(method->attributes, method->attributes_count);
+    }
+    free(class->methods);
+  }
+
+  free_attributes(class->attributes, class->attributes_count);
+  init_class_file(class);
 }
 
 
  int get_constant(struct class_file* class, uint16_t index, struct cp_info** cp_info){
 
-  if (index == 0 || index > class->constant_pool_count){
+  if (index == 0 || index >= class->constant_pool_count){
     printf("Can't take constant by that adress");
     return EINVAL;
   }
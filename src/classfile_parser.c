@@ -7,258 +7,117 @@ int is_string_match(const char* str, size_t len, const char* expected) {
   return memcmp(str, expected, len) == 0;
 }
 
-int parse_attributes(Loader* loader, struct class_file* class, struct attribute_info *attr){
-  int iter;
-  int err = 0;
-  
-  if(attr==NULL){
-    printf("ERROR: Attributes array is null");
+/*
+ * Reads one attribute keeping its body as raw bytes, the known
+ * attributes are decoded on demand by attribute_info.c
+ */
+int parse_attribute(Loader* loader, struct class_file* class,
+                    struct attribute_info* attr) {
+  if (attr == NULL) {
+    printf("ERROR: Attributes array is null\n");
     return EINVAL;
   }
 
   attr->attribute_name_index = loader_u2(loader);
   attr->attribute_length = loader_u4(loader);
-  struct UTF8_info* UTF8 = validate_constant(class, attr->attribute_name_index);
-
-  if(UTF8 == NULL){
-    printf("ERROR while reading attr name");
-    err = 1;
+  attr->info = NULL;
+  if (loader->error) {
+    printf("ERROR: unexpected end of attribute\n");
+    return ENOEXEC;
   }
-  attr->info = malloc((size_t)(attr->attribute_length) * sizeof(struct attribute_info));
 
-  if (attr->info){
-    printf("ERROR after malloc for attr");
-    err = 1;
+  if (validate_constant(class, attr->attribute_name_index) == NULL) {
+    printf("ERROR while reading attr name\n");
+    return EINVAL;
   }
 
-  
-
-  for(iter = 0; iter < class->attributes_count; iter++){
-    if(is_string_match(UTF8->bytes, UTF8->lenght, "Code")){
-      #ifdef DEBUG
-      assert((size_t)(attr->attribute_length) * sizeof(struct attribute_info)
-       == sizeof(struct code_attribute))
-      #endif
-      struct code_attribute* code = (struct code_attribute*)attr->info;
-
-    }
-    else if(is_string_match(UTF8->bytes, UTF8->lenght, "ConstantValue")){
-      #ifdef DEBUG
-      assert((size_t)(attr->attribute_length) * sizeof(struct attribute_info)
-       == sizeof(struct code_attribute))
-      #endif
-
-    }
-    else if(is_string_match(UTF8->bytes, UTF8->lenght, "StackMapTable")){
-      #ifdef DEBUG
-      assert((size_t)(attr->attribute_length) * sizeof(struct attribute_info)
-       == sizeof(struct code_attribute))
-      #endif
-      
-    }
-    else if(is_string_match(UTF8->bytes, UTF8->lenght, "BootstrapMethods")){
-      #ifdef DEBUG
-      assert((size_t)(attr->attribute_length) * sizeof(struct attribute_info)
-       == sizeof(struct code_attribute))
-      #endif
-
-    }
-    else if(is_string_match(UTF8->bytes, UTF8->lenght, "NestHost")){
-      #ifdef DEBUG
-      assert((size_t)(attr->attribute_length) * sizeof(struct attribute_info)
-       == sizeof(struct code_attribute))
-      #endif
-
-    }
-    else if(is_string_match(UTF8->bytes, UTF8->lenght, "NestMembers")){
-      #ifdef DEBUG
-      assert((size_t)(attr->attribute_length) * sizeof(struct attribute_info)
-       == sizeof(struct code_attribute))
-      #endif
-
-    }
-    else if(is_string_match(UTF8->bytes, UTF8->lenght, "PermittedSubclasses")){
-      #ifdef DEBUG
-      assert((size_t)(attr->attribute_length) * sizeof(struct attribute_info)
-       == sizeof(struct code_attribute))
-      #endif
-
-    }
-    else if(is_string_match(UTF8->bytes, UTF8->lenght, "Exceptions")){
-      #ifdef DEBUG
-      assert((size_t)(attr->attribute_length) * sizeof(struct attribute_info)
-       == sizeof(struct code_attribute))
-      #endif
-
-    }
-    else if(is_string_match(UTF8->bytes, UTF8->lenght, "InnerClasses")){
-      #ifdef DEBUG
-      assert((size_t)(attr->attribute_length) * sizeof(struct attribute_info)
-       == sizeof(struct code_attribute))
-      #endif
-
-    }
-    else if(is_string_match(UTF8->bytes, UTF8->lenght, "EnclosingMethod")){
-      #ifdef DEBUG
-      assert((size_t)(attr->attribute_length) * sizeof(struct attribute_info)
-       == sizeof(struct code_attribute))
-      #endif
-
-    }
-    else if(is_string_match(UTF8->bytes, UTF8->lenght, "Synthetic")){
-      #ifdef DEBUG
-      assert((size_t)(attr->attribute_length) * sizeof(struct attribute_info)
-       == sizeof(struct code_attribute))
-      #endif
-
-    }
-    else if(is_string_match(UTF8->bytes, UTF8->lenght, "Signature")){
-      #ifdef DEBUG
-      assert((size_t)(attr->attribute_length) * sizeof(struct attribute_info)
-       == sizeof(struct code_attribute))
-      #endif
-
-    }
-    else if(is_string_match(UTF8->bytes, UTF8->lenght, "Record")){
-      #ifdef DEBUG
-      assert((size_t)(attr->attribute_length) * sizeof(struct attribute_info)
-       == sizeof(struct code_attribute))
-      #endif
-
-    }
-    else if(is_string_match(UTF8->bytes, UTF8->lenght, "SourceFile")){
-      #ifdef DEBUG
-      assert((size_t)(attr->attribute_length) * sizeof(struct attribute_info)
-       == sizeof(struct code_attribute))
-      #endif
-
-    }
-    else if(is_string_match(UTF8->bytes, UTF8->lenght, "LineNumberTable")){
-      #ifdef DEBUG
-      assert((size_t)(attr->attribute_length) * sizeof(struct attribute_info)
-       == sizeof(struct code_attribute))
-      #endif
-
-    }
-    else if(is_string_match(UTF8->bytes, UTF8->lenght, "LocalVariableTable")){
-      #ifdef DEBUG
-      assert((size_t)(attr->attribute_length) * sizeof(struct attribute_info)
-       == sizeof(struct code_attribute))
-      #endif
-
-    }
-    else if(is_string_match(UTF8->bytes, UTF8->lenght, "SourceDebugExtension")){
-      #ifdef DEBUG
-      assert((size_t)(attr->attribute_length) * sizeof(struct attribute_info)
-       == sizeof(struct code_attribute))
-      #endif
-
-    }
-    else if(is_string_match(UTF8->bytes, UTF8->lenght, "Deprecated")){
-      #ifdef DEBUG
-      assert((size_t)(attr->attribute_length) * sizeof(struct attribute_info)
-       == sizeof(struct code_attribute))
-      #endif
-
-    }
-    else if(is_string_match(UTF8->bytes, UTF8->lenght, "RuntimeVisibleAnnotations")){
-      #ifdef DEBUG
-      assert((size_t)(attr->attribute_length) * sizeof(struct attribute_info)
-       == sizeof(struct code_attribute))
-      #endif
-
-    }
-    else if(is_string_match(UTF8->bytes, UTF8->lenght, "RuntimeInvisibleAnnotations")){
-      #ifdef DEBUG
-      assert((size_t)(attr->attribute_length) * sizeof(struct attribute_info)
-       == sizeof(struct code_attribute))
-      #endif
-
-    }
-    else if(is_string_match(UTF8->bytes, UTF8->lenght, "RuntimeVisibleParameterAnnotations")){
-      #ifdef DEBUG
-      assert((size_t)(attr->attribute_length) * sizeof(struct attribute_info)
-       == sizeof(struct code_attribute))
-      #endif
-
-    }
-    else if(is_string_match(UTF8->bytes, UTF8->lenght, "RuntimeInvisibleParameterAnnotations")){
-      #ifdef DEBUG
-      assert((size_t)(attr->attribute_length) * sizeof(struct attribute_info)
-       == sizeof(struct code_attribute))
-      #endif
-
-    }
-    else if(is_string_match(UTF8->bytes, UTF8->lenght, "RuntimeVisibleTypeAnnotations")){
-      #ifdef DEBUG
-      assert((size_t)(attr->attribute_length) * sizeof(struct attribute_info)
-       == sizeof(struct code_attribute))
-      #endif
-
-    }
-    else if(is_string_match(UTF8->bytes, UTF8->lenght, "RuntimeInvisibleTypeAnnotations")){
-      #ifdef DEBUG
-      assert((size_t)(attr->attribute_length) * sizeof(struct attribute_info)
-       == sizeof(struct code_attribute))
-      #endif
-
-    }
-    else if(is_string_match(UTF8->bytes, UTF8->lenght, "AnnotationDefault")){
-      #ifdef DEBUG
-      assert((size_t)(attr->attribute_length) * sizeof(struct attribute_info)
-       == sizeof(struct code_attribute))
-      #endif
+  if (attr->attribute_length == 0) {
+    return 0;
+  }
+  attr->info = malloc((size_t)attr->attribute_length);
+  if (attr->info == NULL) {
+    printf("ERROR: can't allocate %u bytes for attribute\n",
+           attr->attribute_length);
+    return ENOMEM;
+  }
 
-    }
-    else if(is_string_match(UTF8->bytes, UTF8->lenght, "MethodParameters")){
-      #ifdef DEBUG
-      assert((size_t)(attr->attribute_length) * sizeof(struct attribute_info)
-       == sizeof(struct code_attribute))
-      #endif
+  loader_read_bytes(loader, attr->info, attr->attribute_length);
+  if (loader->error) {
+    printf("ERROR: unexpected end of attribute\n");
+    return ENOEXEC;
+  }
+  return 0;
+}
 
-    }
-    else if(is_string_match(UTF8->bytes, UTF8->lenght, "Module")){
-      #ifdef DEBUG
-      assert((size_t)(attr->attribute_length) * sizeof(struct attribute_info)
-       == sizeof(struct code_attribute))
-      #endif
+int parse_attributes(Loader* loader, struct class_file* class, uint16_t count,
+                     struct attribute_info** attributes) {
+  uint16_t i;
+  int err;
 
-    }
-    else if(is_string_match(UTF8->bytes, UTF8->lenght, "ModulePackages")){
-      #ifdef DEBUG
-      assert((size_t)(attr->attribute_length) * sizeof(struct attribute_info)
-       == sizeof(struct code_attribute))
-      #endif
+  *attributes = NULL;
+  if (count == 0) {
+    return 0;
+  }
 
-    }
-    else if(is_string_match(UTF8->bytes, UTF8->lenght, "ModuleMainClass")){
-      #ifdef DEBUG
-      assert((size_t)(attr->attribute_length) * sizeof(struct attribute_info)
-       == sizeof(struct code_attribute))
-      #endif
+  *attributes = calloc(count, sizeof(struct attribute_info));
+  if (*attributes == NULL) {
+    printf("ERROR: can't allocate memory for attributes\n");
+    return ENOMEM;
+  }
 
-    }
-    else {
-      print("ERROR!!!");
+  for (i = 0; i < count; i++) {
+    err = parse_attribute(loader, class, &(*attributes)[i]);
+    if (err != 0) {
+      return err;
     }
   }
-
   return 0;
 }
 
-int parse_class_fields(Loader* loader, struct field_info* fields) {
+int parse_class_fields(Loader* loader, struct class_file* class,
+                       struct field_info* fields) {
   fields->access_flags = loader_u2(loader);
   fields->name_index = loader_u2(loader);
   fields->descriptor_index = loader_u2(loader);
   fields->attributes_count = loader_u2(loader);
-  fields->access_flags = loader_u2(loader);
-  fields->attributes = malloc(sizeof(struct attribute_info) *
-                        (size_t)(fields->attributes_count));
-  if(fields->attributes == NULL){
-    printf("ERROR: can't allocate memory for fields attributes");
+  return parse_attributes(loader, class, fields->attributes_count,
+                          &fields->attributes);
+}
+
+int parse_class_methods(Loader* loader, struct class_file* class,
+                        struct method_info* method) {
+  struct attribute_info* code;
+  int err;
+
+  method->access_flags = loader_u2(loader);
+  method->name_index = loader_u2(loader);
+  method->descriptor_index = loader_u2(loader);
+  method->attributes_count = loader_u2(loader);
+  method->code = NULL;
+  method->oop_map = NULL;
+
+  err = parse_attributes(loader, class, method->attributes_count,
+                         &method->attributes);
+  if (err != 0) {
+    return err;
+  }
+
+  code = find_attribute(class, method->attributes, method->attributes_count,
+                        "Code");
+  if (code == NULL) {
+    return 0;
+  }
+
+  method->code = malloc(sizeof(struct Code_attribute));
+  if (method->code == NULL) {
+    printf("ERROR: can't allocate memory for method code\n");
     return ENOMEM;
   }
-  int err = parse_attributes(loader, fields->attributes_count, fields->attributes);
+  err = parse_code_attribute(class, code, method->code);
+  if (err != 0) {
+    free(method->code);
+    method->code = NULL;
+  }
   return err;
 }
 
@@ -278,182 +137,234 @@ int parse_const_pool(struct class_file* class, Loader* loader) {
     return EINVAL;
   }
 
-  class->constant_pool = malloc(pool_count * sizeof(struct cp_info));
+  class->constant_pool = calloc(pool_count, sizeof(struct cp_info));
 
   if (class->constant_pool == NULL) {
     perror("can not allocate memory for constant pool\n");
     return ENOMEM;
   }
 
-  printf("CONSTANT POOL:\n");
-
   for (i = 0; i < pool_count - 1; i++) {
     tag = loader_u1(loader);
     class->constant_pool[i].tag = tag;
-    printf("I: %hu, tag is - %hhu, type - ", i, tag);
 
     switch (tag) {
       case UTF8:
-        printf("UTF8, ");
-        read_utf8_info(loader, &(class->constant_pool[i].utf8_info));
-        printf("data - %.*s\n", class->constant_pool[i].utf8_info.lenght,
-               class->constant_pool[i].utf8_info.bytes);
+        error = read_utf8_info(loader, &(class->constant_pool[i].utf8_info));
         break;
       case INTEGER:
-        printf("INTEGER\n");
         read_primitive_info(loader,
                             &(class->constant_pool[i].integer_info.info));
         break;
       case FLOAT:
-        printf("FLOAT\n");
         read_primitive_info(loader, &(class->constant_pool[i].float_info.info));
         break;
       case LONG:
-        printf("LONG\n");
         read_big_primitive_info(loader,
                                 &(class->constant_pool[i].long_info.info));
+        /* 8-byte constants take two entries, the second one is unusable */
+        i++;
         break;
       case DOUBLE:
-        printf("DOUBLE\n");
         read_big_primitive_info(loader,
                                 &(class->constant_pool[i].double_info.info));
+        i++;
         break;
       case CLASS:
-        printf("CLASS\n");
         read_class_info(loader, &(class->constant_pool[i].class_info));
         break;
       case STRING:
-        printf("STRING\n");
         read_string_info(loader, &(class->constant_pool[i].string_info));
         break;
       case FIELD_REF:
-        printf("FIELD_RED\n");
         read_ref_type_info(loader,
                            &(class->constant_pool[i].fieldref_info.info));
         break;
       case METHOD_REF:
-        printf("METHOD_REF\n");
         read_ref_type_info(loader,
                            &(class->constant_pool[i].methodref_info.info));
         break;
       case INTERF_METHOD_REF:
-        printf("INTEGER_METHOD\n");
         read_ref_type_info(
             loader, &(class->constant_pool[i].interface_meth_ref_info.info));
         break;
       case NAME_AND_TYPE:
-        printf("NAME_AND_TYPE\n");
         read_name_and_type_info(loader,
                                 &(class->constant_pool[i].name_and_type_info));
         break;
       case METHOD_HANDLE:
-        printf("METHOD_HANDLE\n");
         read_method_handle_info(loader,
                                 &(class->constant_pool[i].method_handle_info));
         break;
       case METHOD_TYPE:
-        printf("METHOD_TYPE\n");
         read_method_type_info(loader,
                               &(class->constant_pool[i].method_type_info));
         break;
       case DYNAMIC:
-        printf("DYNAMIC\n");
         read_dynamic_info(loader, &(class->constant_pool[i].dynamic_info.info));
         break;
       case INVOKE_METHOD:
-        printf("INVOKE_METHOD\n");
         read_dynamic_info(loader,
                           &(class->constant_pool[i].invoke_dynamic_info.info));
         break;
       case MODULE:
-        printf("MODULE\n");
         read_module_info(loader, &(class->constant_pool[i].module_info));
         break;
       case PACKAGE:
-        printf("PACKAGE\n");
         read_package_info(loader, &(class->constant_pool[i].package_info));
         break;
       default:
-        printf("unknown\n, ERROR: unsupported tag: %hhu on iteration: %hu\n",
-               tag, i);
+        printf("ERROR: unsupported tag: %hhu on iteration: %hu\n", tag, i);
         error = EINVAL;
-        goto exit;
+    }
+
+    if (error != 0) {
+      return error;
+    }
+    if (loader->error) {
+      printf("ERROR: unexpected end of constant pool\n");
+      return ENOEXEC;
     }
   }
 
-exit:
-  free(class->constant_pool);
-  return error;
+  return 0;
 }
 
-int parse_class_file() {
-  int err = 0;
-  FILE* file = fopen("tests/Add.class", "rb");
-  Loader loader = {.file = file, .error = 0};
-  struct class_file class;
+/* Parses the class file read by `loader`, class must be initialized */
+int parse_class(Loader* loader, struct class_file* class) {
   uint16_t iterator;
+  int err;
 
-  if (!file) {
-    perror("Failed to open file\n");
-    err = EINVAL;
-    goto exit;
-  }
-
-  init_class_file(&class);
-  class.magic = loader_u4(&loader);
-  class.major_version = loader_u2(&loader);
-  class.minor_version = loader_u2(&loader);
-  class.constant_pool_count = loader_u2(&loader);
-  printf("Constant_pool_count is %hu\n", class.constant_pool_count);
+  class->magic = loader_u4(loader);
+  class->minor_version = loader_u2(loader);
+  class->major_version = loader_u2(loader);
+  class->constant_pool_count = loader_u2(loader);
 
-  if (loader.error) {
-    perror("Error reading file\n");
-    err = ENOEXEC;
-    goto exit;
+  if (loader->error || class->magic != 0xCAFEBABE) {
+    printf("ERROR: not a class file\n");
+    return ENOEXEC;
   }
 
-  err = parse_const_pool(&class, &loader);
-
+  err = parse_const_pool(class, loader);
   if (err != 0) {
     printf("Error after parse const pool is - %d\n", err);
+    return err;
   }
 
-  class.access_flags = loader_u2(&loader);
-  class.this_class = loader_u2(&loader);
-  class.super_class = loader_u2(&loader);
-  class.interfaces_count = loader_u2(&loader);
-  class.interfaces = malloc(class.interfaces_count * sizeof(uint16_t));
+  class->access_flags = loader_u2(loader);
+  class->this_class = loader_u2(loader);
+  class->super_class = loader_u2(loader);
+  class->interfaces_count = loader_u2(loader);
 
-  if (class.interfaces == NULL) {
-    printf("ERROR: can not malloc data for interfaces");
+  if (class->interfaces_count != 0) {
+    class->interfaces = malloc(class->interfaces_count * sizeof(uint16_t));
+    if (class->interfaces == NULL) {
+      printf("ERROR: can not malloc data for interfaces\n");
+      return ENOMEM;
+    }
+  }
+  for (iterator = 0; iterator < class->interfaces_count; ++iterator) {
+    class->interfaces[iterator] = loader_u2(loader);
   }
 
-  for (iterator = 0; iterator < class.interfaces_count; ++iterator) {
-    class.interfaces[iterator] = loader_u2(&loader);
+  class->fields_count = loader_u2(loader);
+  if (class->fields_count != 0) {
+    class->fields = calloc(class->fields_count, sizeof(struct field_info));
+    if (class->fields == NULL) {
+      printf("ERROR: can not malloc data for fields\n");
+      return ENOMEM;
+    }
+  }
+  for (iterator = 0; iterator < class->fields_count; ++iterator) {
+    err = parse_class_fields(loader, class, &class->fields[iterator]);
+    if (err != 0) {
+      return err;
+    }
   }
 
-  class.fields_count = loader_u2(&loader);
+  class->methods_count = loader_u2(loader);
+  if (class->methods_count != 0) {
+    class->methods = calloc(class->methods_count, sizeof(struct method_info));
+    if (class->methods == NULL) {
+      printf("ERROR: can not malloc data for methods\n");
+      return ENOMEM;
+    }
+  }
+  for (iterator = 0; iterator < class->methods_count; ++iterator) {
+    err = parse_class_methods(loader, class, &class->methods[iterator]);
+    if (err != 0) {
+      return err;
+    }
+  }
 
-  class.fields = malloc(sizeof(struct field_info) * class.fields_count);
+  class->attributes_count = loader_u2(loader);
+  err = parse_attributes(loader, class, class->attributes_count,
+                         &class->attributes);
+  if (err != 0) {
+    return err;
+  }
 
-  if (class.fields == NULL) {
-    printf("ERROR: can not malloc data for interfaces");
+  if (loader->error) {
+    printf("ERROR: unexpected end of class file\n");
+    return ENOEXEC;
   }
+  return 0;
+}
 
-  // for (iterator = 0; iterator < class.fields_count; ++iterator) {
-  //   class.fields[iterator];
-  // }
+int parse_class_file(const char* path, struct class_file* class) {
+  int err = 0;
+  FILE* file = fopen(path, "rb");
+  Loader loader = {.file = file, .error = 0};
 
-  if (loader.error) {
-    perror("Error reading file\n");
-    err = ENOEXEC;
-    goto exit;
-  } else {
-    printf("Magic: 0x%X, Version: %hu.%hu\n", class.magic, class.major_version,
-           class.minor_version);
+  init_class_file(class);
+  if (!file) {
+    perror("Failed to open file\n");
+    return EINVAL;
   }
 
-exit:
+  err = parse_class(&loader, class);
   fclose(file);
+
+  if (err != 0) {
+    free_class_file(class);
+  }
   return err;
-}
\ No newline at end of file
+}
+
+void print_class_file(struct class_file* class) {
+  uint16_t i;
+  struct UTF8_info* name;
+
+  printf("Magic: 0x%X, Version: %hu.%hu\n", class->magic,
+         class->major_version, class->minor_version);
+  printf("Constant_pool_count is %hu\n", class->constant_pool_count);
+  printf("CONSTANT POOL:\n");
+
+  for (i = 0; i < class->constant_pool_count - 1; i++) {
+    struct cp_info* cp_info = &class->constant_pool[i];
+
+    if (cp_info->tag == 0) {
+      continue;
+    }
+    printf("I: %hu, tag is - %hhu", i + 1, cp_info->tag);
+    if (cp_info->tag == UTF8) {
+      printf(", data - %.*s", cp_info->utf8_info.lenght,
+             cp_info->utf8_info.bytes);
+    }
+    printf("\n");
+  }
+
+  for (i = 0; i < class->methods_count; i++) {
+    struct method_info* method = &class->methods[i];
+
+    name = validate_constant(class, method->name_index);
+    printf("METHOD %.*s: flags 0x%04hx", name ? name->lenght : 0,
+           name ? (const char*)name->bytes : "", method->access_flags);
+    if (method->code != NULL) {
+      printf(", max_stack %hu, max_locals %hu, code_length %u",
+             method->code->max_stack, method->code->max_locals,
+             method->code->code_length);
+    }
+    printf("\n");
+  }
+}
@@ -1,8 +1,20 @@
 #include "classfile_stream.h"
 
+#include <string.h>
+
 void loader_read_bytes(Loader* loader, uint8_t* buf, size_t n) {
   if (loader->error != 0) return;
 
+  if (loader->file == NULL) {
+    if (loader->size - loader->position < n) {
+      loader->error = 1;
+      return;
+    }
+    memcpy(buf, loader->buffer + loader->position, n);
+    loader->position += n;
+    return;
+  }
+
   size_t read = fread(buf, 1, n, loader->file);
   if (read != n) {
     loader->error = 1;
@@ -10,19 +22,19 @@ void loader_read_bytes(Loader* loader, uint8_t* buf, size_t n) {
 }
 
 uint8_t loader_u1(Loader* loader) {
-  uint8_t buf[1];
+  uint8_t buf[1] = {0};
   loader_read_bytes(loader, buf, 1);
   return buf[0];
 }
 
 uint16_t loader_u2(Loader* loader) {
-  uint8_t buf[2];
+  uint8_t buf[2] = {0};
   loader_read_bytes(loader, buf, 2);
   return (uint16_t)((buf[0] << 8) | buf[1]);
 }
 
 uint32_t loader_u4(Loader* loader) {
-  uint8_t buf[4];
+  uint8_t buf[4] = {0};
   loader_read_bytes(loader, buf, 4);
   return (uint32_t)(
     ((uint32_t)buf[0] << 24) |
@@ -32,7 +44,7 @@ uint32_t loader_u4(Loader* loader) {
 }
 
 uint64_t loader_u8(Loader* loader) {
-  uint8_t buf[8];
+  uint8_t buf[8] = {0};
   loader_read_bytes(loader, buf, 8);
   return (uint64_t)((uint64_t)buf[0] << 56) | ((uint64_t)buf[1] << 48) |
          ((uint64_t)buf[2] << 40) | ((uint64_t)buf[3] << 32) |
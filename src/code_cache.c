@@ -0,0 +1,51 @@
+#define _GNU_SOURCE
+
+#include "code_cache.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+int code_cache_init(struct code_cache* cache, size_t size) {
+  memset(cache, 0, sizeof(*cache));
+  if (size == 0) {
+    size = CODE_CACHE_DEFAULT_SIZE;
+  }
+  /* call sites are patched through data cells, the code itself is not */
+  cache->base = mmap(NULL, size, PROT_READ | PROT_WRITE | PROT_EXEC,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (cache->base == MAP_FAILED) {
+    printf("ERROR: can't map %zu bytes of executable memory\n", size);
+    cache->base = NULL;
+    return ENOMEM;
+  }
+  cache->size = size;
+  return pthread_mutex_init(&cache->lock, NULL);
+}
+
+void code_cache_destroy(struct code_cache* cache) {
+  if (cache->base != NULL) {
+    munmap(cache->base, cache->size);
+    pthread_mutex_destroy(&cache->lock);
+  }
+  memset(cache, 0, sizeof(*cache));
+}
+
+void* code_cache_install(struct code_cache* cache, const uint8_t* code,
+                         size_t size) {
+  uint8_t* to = NULL;
+
+  pthread_mutex_lock(&cache->lock);
+  if (size <= cache->size - cache->used) {
+    to = cache->base + cache->used;
+    memcpy(to, code, size);
+    cache->used += (size + CODE_CACHE_ALIGNMENT - 1) &
+                   ~(size_t)(CODE_CACHE_ALIGNMENT - 1);
+    if (cache->used > cache->size) {
+      cache->used = cache->size;
+    }
+  }
+  pthread_mutex_unlock(&cache->lock);
+  return to;
+}
@@ -80,15 +80,15 @@ int read_package_info(Loader* loader, struct package_info* info) {
 }
 
 struct UTF8_info* validate_constant(struct class_file* class, uint16_t index){
-  struct cp_info** cp_info = NULL;
-  int err = get_constant(class, index, cp_info);
+  struct cp_info* cp_info = NULL;
+  int err = get_constant(class, index, &cp_info);
   if (err != 0 || cp_info == NULL){
     printf("ERROR: %d", err);
     return NULL;
   }
-  if((*cp_info)->tag != UTF8){
+  if(cp_info->tag != UTF8){
     printf("ERROR: parse const fail");
     return NULL;
   }
-  return &((*cp_info)->utf8_info);
+  return &(cp_info->utf8_info);
 }
\ No newline at end of file
@@ -0,0 +1,407 @@
+#include "deopt.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "class_layout.h"
+#include "gc.h"
+#include "heap.h"
+#include "monitor.h"
+#include "opcodes.h"
+
+/* Makes room for `needed` elements, 0 without memory */
+static int reserve(void** data, uint32_t* capacity, uint32_t needed,
+                   size_t size) {
+  uint32_t new_capacity;
+  void* grown;
+
+  if (needed <= *capacity) {
+    return 1;
+  }
+  new_capacity = *capacity != 0 ? *capacity : 16;
+  while (new_capacity < needed) {
+    new_capacity *= 2;
+  }
+  grown = realloc(*data, (size_t)new_capacity * size);
+  if (grown == NULL) {
+    return 0;
+  }
+  *data = grown;
+  *capacity = new_capacity;
+  return 1;
+}
+
+struct deopt_table* deopt_table_new(void) {
+  return calloc(1, sizeof(struct deopt_table));
+}
+
+void deopt_table_free(struct deopt_table* table) {
+  if (table != NULL) {
+    free(table->points);
+    free(table->frames);
+    free(table->values);
+    free(table->objects);
+    free(table->fields);
+    free(table->polls);
+    free(table);
+  }
+}
+
+int32_t deopt_add_point(struct deopt_table* table) {
+  struct deopt_point* point;
+
+  if (!reserve((void**)&table->points, &table->point_capacity,
+               table->point_count + 1, sizeof(struct deopt_point))) {
+    return -1;
+  }
+  point = &table->points[table->point_count];
+  point->frames = table->frame_count;
+  point->frame_count = 0;
+  point->objects = table->object_count;
+  point->object_count = 0;
+  return (int32_t)table->point_count++;
+}
+
+struct deopt_value* deopt_add_frame(struct deopt_table* table,
+                                    struct class_file* class,
+                                    struct method_info* method, uint16_t bci,
+                                    uint16_t local_count,
+                                    uint16_t stack_count) {
+  uint32_t count = (uint32_t)local_count + stack_count;
+  struct deopt_frame* frame;
+
+  if (!reserve((void**)&table->frames, &table->frame_capacity,
+               table->frame_count + 1, sizeof(struct deopt_frame)) ||
+      !reserve((void**)&table->values, &table->value_capacity,
+               table->value_count + count, sizeof(struct deopt_value))) {
+    return NULL;
+  }
+  frame = &table->frames[table->frame_count++];
+  frame->class = class;
+  frame->method = method;
+  frame->bci = bci;
+  frame->local_count = local_count;
+  frame->stack_count = stack_count;
+  frame->values = table->value_count;
+  table->points[table->point_count - 1].frame_count++;
+  table->value_count += count;
+  return table->values + frame->values;
+}
+
+struct deopt_field* deopt_add_object(struct deopt_table* table,
+                                     const struct class_layout* layout,
+                                     uint16_t field_count) {
+  struct deopt_object* object;
+
+  if (!reserve((void**)&table->objects, &table->object_capacity,
+               table->object_count + 1, sizeof(struct deopt_object)) ||
+      !reserve((void**)&table->fields, &table->field_capacity,
+               table->field_count + field_count, sizeof(struct deopt_field))) {
+    return NULL;
+  }
+  object = &table->objects[table->object_count++];
+  object->layout = layout;
+  object->fields = table->field_count;
+  object->field_count = field_count;
+  table->points[table->point_count - 1].object_count++;
+  table->field_count += field_count;
+  return table->fields + object->fields;
+}
+
+int32_t deopt_add_poll(struct deopt_table* table, uint32_t offset,
+                       uint16_t value_count) {
+  struct deopt_poll* poll;
+
+  if (!reserve((void**)&table->polls, &table->poll_capacity,
+               table->poll_count + 1, sizeof(struct deopt_poll)) ||
+      !reserve((void**)&table->values, &table->value_capacity,
+               table->value_count + value_count,
+               sizeof(struct deopt_value))) {
+    return -1;
+  }
+  poll = &table->polls[table->poll_count];
+  poll->offset = offset;
+  poll->values = table->value_count;
+  poll->value_count = value_count;
+  table->value_count += value_count;
+  return (int32_t)table->poll_count++;
+}
+
+const struct deopt_poll* deopt_find_poll(const struct deopt_table* table,
+                                         uint32_t offset) {
+  uint32_t low = 0;
+  uint32_t high = table->poll_count;
+
+  while (low < high) {
+    uint32_t mid = (low + high) / 2;
+    if (table->polls[mid].offset < offset) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  if (low < table->poll_count && table->polls[low].offset == offset) {
+    return &table->polls[low];
+  }
+  return NULL;
+}
+
+static void read_value(const struct deopt_value* value, const uint64_t* regs,
+                       const uint8_t* fp, union java_value* slot) {
+  uint64_t bits = 0;
+
+  if (value->kind == DEOPT_OBJECT) {
+    /* filled in once the objects exist */
+    bits = 0;
+  } else if (value->kind == DEOPT_CONST) {
+    bits = (uint64_t)(int64_t)value->value;
+  } else if (value->kind == DEOPT_REG) {
+    bits = regs[value->reg];
+  } else {
+    /* ints are spilled as 32 bits, little endian */
+    memcpy(&bits, fp + value->value, value->type == 'A' ? 8 : 4);
+  }
+  if (value->type == 'A') {
+    slot->ref = (struct object_header*)(uintptr_t)bits;
+  } else {
+    slot->i = (int32_t)(uint32_t)bits;
+  }
+}
+
+/*
+ * Allocates the objects of a point and stores them into the frames
+ * that refer to them. The references already in the frames are roots
+ * while the heap may collect. OutOfMemoryError is pending on failure
+ */
+static int rematerialize(struct interp_thread* thread,
+                         const struct deopt_table* table,
+                         const struct deopt_point* p,
+                         union java_value* const* frame_slots,
+                         const uint64_t* regs, const uint8_t* fp) {
+  const struct deopt_object* objects = table->objects + p->objects;
+  const struct deopt_frame* frames = table->frames + p->frames;
+  struct gc_heap* heap = thread->interp->heap;
+  struct object_header** made;
+  size_t rooted = 0;
+  size_t roots = p->object_count;
+  union java_value** slots;
+  uint32_t i;
+  uint32_t k;
+  int err = heap == NULL ? ENOMEM : 0;
+
+  for (i = 0; i < p->frame_count; i++) {
+    roots += (size_t)frames[i].local_count + frames[i].stack_count;
+  }
+  made = calloc(p->object_count, sizeof(struct object_header*));
+  slots = malloc(roots * sizeof(union java_value*));
+  if (made == NULL || slots == NULL) {
+    err = ENOMEM;
+  }
+
+  /* the slot of every reference a frame holds */
+  for (i = 0; err == 0 && i < p->frame_count; i++) {
+    const struct deopt_frame* f = &frames[i];
+    uint16_t max_locals = f->method->code->max_locals;
+    for (k = 0; k < (uint32_t)f->local_count + f->stack_count; k++) {
+      const struct deopt_value* value = &table->values[f->values + k];
+      union java_value* slot =
+          frame_slots[i] + (k < f->local_count ? k : max_locals + k -
+                                                         f->local_count);
+      if (value->type == 'A' && value->kind != DEOPT_OBJECT) {
+        slots[rooted++] = slot;
+      }
+    }
+  }
+  for (k = 0; err == 0 && k < rooted; k++) {
+    err = gc_add_root(heap, &slots[k]->ref);
+  }
+  for (i = 0; err == 0 && i < p->object_count; i++) {
+    err = gc_add_root(heap, &made[i]);
+    if (err != 0) {
+      break;
+    }
+    made[i] = heap_new_instance(&heap->eden, objects[i].layout);
+    if (made[i] == NULL) {
+      err = ENOMEM;
+    }
+  }
+  if (heap != NULL && made != NULL && slots != NULL) {
+    for (k = 0; k < rooted; k++) {
+      gc_remove_root(heap, &slots[k]->ref);
+    }
+    for (k = 0; k < p->object_count; k++) {
+      gc_remove_root(heap, &made[k]);
+    }
+  }
+
+  /* fields are ints, the objects need no barrier */
+  for (i = 0; err == 0 && i < p->object_count; i++) {
+    const struct deopt_field* fields = table->fields + objects[i].fields;
+    for (k = 0; k < objects[i].field_count; k++) {
+      union java_value field;
+      read_value(&fields[k].value, regs, fp, &field);
+      memcpy((uint8_t*)made[i] + fields[k].offset, &field.i, sizeof(int32_t));
+    }
+  }
+  for (i = 0; err == 0 && i < p->frame_count; i++) {
+    const struct deopt_frame* f = &frames[i];
+    uint16_t max_locals = f->method->code->max_locals;
+    for (k = 0; k < (uint32_t)f->local_count + f->stack_count; k++) {
+      const struct deopt_value* value = &table->values[f->values + k];
+      if (value->kind == DEOPT_OBJECT) {
+        frame_slots[i][k < f->local_count ? k : max_locals + k -
+                                                    f->local_count]
+            .ref = made[value->value];
+      }
+    }
+  }
+  free(made);
+  free(slots);
+  if (err != 0) {
+    interp_throw(thread, "java/lang/OutOfMemoryError");
+  }
+  return err;
+}
+
+/*
+ * Takes the locks of the synchronized frames, which the compiled code
+ * elided, outermost first as the interpreter would have. The receiver
+ * is still in local 0, inlining kept it there. OutOfMemoryError is
+ * pending on failure, with none of them held
+ */
+static int relock(struct interp_thread* thread,
+                  const struct deopt_frame* frames, uint32_t count,
+                  union java_value* const* frame_slots,
+                  struct object_header** locks) {
+  uint32_t i;
+
+  for (i = count; i-- > 0;) {
+    const struct deopt_frame* f = &frames[i];
+
+    locks[i] = NULL;
+    if (!(f->method->access_flags & ACC_SYNCHRONIZED)) {
+      continue;
+    }
+    locks[i] = (f->method->access_flags & ACC_STATIC)
+                   ? &f->class->runtime->lock
+                   : frame_slots[i][0].ref;
+    if (monitor_enter(thread, locks[i]) != 0) {
+      for (i++; i < count; i++) {
+        if (locks[i] != NULL) {
+          monitor_exit(thread, locks[i]);
+        }
+      }
+      interp_throw(thread, "java/lang/OutOfMemoryError");
+      return ENOMEM;
+    }
+  }
+  return 0;
+}
+
+int64_t deopt_resume(struct interp_thread* thread,
+                     const struct deopt_table* table, uint32_t point,
+                     const uint64_t* regs, const uint8_t* fp) {
+  const struct deopt_point* p = &table->points[point];
+  const struct deopt_frame* frames = table->frames + p->frames;
+  struct java_frame callers[DEOPT_MAX_FRAMES];
+  union java_value* frame_slots[DEOPT_MAX_FRAMES];
+  struct object_header* locks[DEOPT_MAX_FRAMES];
+  struct java_frame* top = thread->top;
+  size_t base = thread->slots_used;
+  union java_value value;
+  uint32_t i;
+  int err;
+
+  thread->stats.deoptimizations++;
+  /* outermost first, every frame is on top of the slots when it runs */
+  for (i = p->frame_count; i-- > 0;) {
+    const struct deopt_frame* f = &frames[i];
+    const struct Code_attribute* code = f->method->code;
+    size_t count = (size_t)code->max_locals + code->max_stack;
+    union java_value* slots = thread->slots + thread->slots_used;
+    uint32_t k;
+
+    if (thread->slots_capacity - thread->slots_used < count) {
+      thread->top = top;
+      thread->slots_used = base;
+      interp_throw(thread, "java/lang/StackOverflowError");
+      return 0;
+    }
+    memset(slots, 0, count * sizeof(union java_value));
+    frame_slots[i] = slots;
+    for (k = 0; k < f->local_count; k++) {
+      read_value(&table->values[f->values + k], regs, fp, &slots[k]);
+    }
+    for (k = 0; k < f->stack_count; k++) {
+      read_value(&table->values[f->values + f->local_count + k], regs, fp,
+                 &slots[code->max_locals + k]);
+    }
+    thread->slots_used += count;
+    if (i > 0) {
+      /* the collector sees the callers while their callees run */
+      callers[i].caller = thread->top;
+      callers[i].class = f->class;
+      callers[i].method = f->method;
+      callers[i].bci = f->bci;
+      callers[i].stack_depth = f->stack_count;
+      callers[i].locals = slots;
+      callers[i].stack = slots + code->max_locals;
+      callers[i].lock = NULL;
+      thread->top = &callers[i];
+    }
+  }
+
+  if ((p->object_count > 0 &&
+       rematerialize(thread, table, p, frame_slots, regs, fp) != 0) ||
+      relock(thread, frames, p->frame_count, frame_slots, locks) != 0) {
+    thread->top = top;
+    thread->slots_used = base;
+    return 0;
+  }
+  /* the callers' locks move with the objects while the callees run */
+  for (i = 1; i < p->frame_count; i++) {
+    callers[i].lock = locks[i];
+  }
+
+  value.j = 0;
+  err = interp_resume(thread, frames[0].class, frames[0].method, frames[0].bci,
+                      frames[0].stack_count, locks[0], &value);
+  for (i = 1; i < p->frame_count && (err == 0 || err == INTERP_EXCEPTION);
+       i++) {
+    const struct deopt_frame* f = &frames[i];
+    const struct method_runtime* callee =
+        method_runtime_of(frames[i - 1].class, frames[i - 1].method);
+    union java_value* stack = callers[i].stack;
+    uint16_t depth = f->stack_count;
+    uint32_t bci = f->bci;
+
+    thread->top = callers[i].caller;
+    if (err == 0) {
+      /* the call returns like in the interpreter */
+      depth = (uint16_t)(depth - callee->arg_slots);
+      if (callee->ret == 'J' || callee->ret == 'D') {
+        stack[depth] = value;
+        depth += 2;
+      } else if (callee->ret != 'V') {
+        stack[depth++] = value;
+      }
+      bci += opcode_table[f->method->code->code[bci]].length;
+    }
+    value.j = 0;
+    err = interp_resume(thread, f->class, f->method, bci, depth,
+                        callers[i].lock, &value);
+  }
+  if (err != 0 && err != INTERP_EXCEPTION) {
+    /* the callers that don't run anymore leave their locks */
+    for (; i < p->frame_count; i++) {
+      if (callers[i].lock != NULL) {
+        monitor_exit(thread, callers[i].lock);
+      }
+    }
+    thread->top = top;
+    thread->slots_used = base;
+    interp_throw(thread, "java/lang/InternalError");
+  }
+  return err == 0 ? value.j : 0;
+}
@@ -0,0 +1,168 @@
+#include "descriptor.h"
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+
+/*
+ * Skips one field type starting at p. Stores its kind and returns
+ * the position after it, NULL if the type is malformed
+ */
+const uint8_t* skip_field_descriptor(const uint8_t* p, const uint8_t* end,
+                                     char* kind) {
+  int array = 0;
+
+  while (p < end && *p == '[') {
+    array = 1;
+    p++;
+  }
+  if (p >= end) {
+    return NULL;
+  }
+
+  switch (*p) {
+    case 'B':
+    case 'C':
+    case 'D':
+    case 'F':
+    case 'I':
+    case 'J':
+    case 'S':
+    case 'Z':
+      *kind = array ? 'L' : (char)*p;
+      return p + 1;
+    case 'L':
+      while (p < end && *p != ';') {
+        p++;
+      }
+      if (p >= end) {
+        return NULL;
+      }
+      *kind = 'L';
+      return p + 1;
+    default:
+      return NULL;
+  }
+}
+
+int parse_method_descriptor(const struct UTF8_info* descriptor,
+                            struct method_descriptor* desc) {
+  const uint8_t* p = descriptor->bytes;
+  const uint8_t* end = p + descriptor->lenght;
+  char kind;
+
+  desc->arg_count = 0;
+  desc->arg_slots = 0;
+
+  if (p >= end || *p != '(') {
+    goto malformed;
+  }
+  p++;
+
+  while (p < end && *p != ')') {
+    p = skip_field_descriptor(p, end, &kind);
+    if (p == NULL || desc->arg_count == DESCRIPTOR_MAX_ARGS) {
+      goto malformed;
+    }
+    desc->args[desc->arg_count++] = kind;
+    desc->arg_slots += (uint16_t)descriptor_slots(kind);
+  }
+  if (p >= end || desc->arg_slots > DESCRIPTOR_MAX_ARGS) {
+    goto malformed;
+  }
+  p++;
+
+  if (p < end && *p == 'V') {
+    desc->ret = 'V';
+    p++;
+  } else {
+    p = skip_field_descriptor(p, end, &desc->ret);
+  }
+  if (p != end) {
+    goto malformed;
+  }
+  return 0;
+
+malformed:
+  printf("ERROR: malformed method descriptor %.*s\n", descriptor->lenght,
+         descriptor->bytes);
+  return EINVAL;
+}
+
+int parse_field_descriptor(const struct UTF8_info* descriptor, char* kind) {
+  const uint8_t* end = descriptor->bytes + descriptor->lenght;
+
+  if (skip_field_descriptor(descriptor->bytes, end, kind) != end) {
+    printf("ERROR: malformed field descriptor %.*s\n", descriptor->lenght,
+           descriptor->bytes);
+    return EINVAL;
+  }
+  return 0;
+}
+
+/*
+ * NameAndType of the field, method or dynamic constant referenced
+ * by the constant pool entry `index`, NULL if there is none
+ */
+struct name_and_type_info* constant_member_name_and_type(
+    struct class_file* class, uint16_t index) {
+  struct cp_info* cp_info;
+  struct cp_info* name_and_type;
+  uint16_t name_and_type_index;
+
+  if (get_constant(class, index, &cp_info) != 0) {
+    return NULL;
+  }
+
+  switch (cp_info->tag) {
+    case FIELD_REF:
+      name_and_type_index = cp_info->fieldref_info.info.name_and_type_index;
+      break;
+    case METHOD_REF:
+      name_and_type_index = cp_info->methodref_info.info.name_and_type_index;
+      break;
+    case INTERF_METHOD_REF:
+      name_and_type_index =
+          cp_info->interface_meth_ref_info.info.name_and_type_index;
+      break;
+    case DYNAMIC:
+      name_and_type_index = cp_info->dynamic_info.info.name_and_type_index;
+      break;
+    case INVOKE_METHOD:
+      name_and_type_index =
+          cp_info->invoke_dynamic_info.info.name_and_type_index;
+      break;
+    default:
+      printf("ERROR: constant %hu is not a member reference\n", index);
+      return NULL;
+  }
+
+  if (get_constant(class, name_and_type_index, &name_and_type) != 0 ||
+      name_and_type->tag != NAME_AND_TYPE) {
+    printf("ERROR: bad NameAndType constant %hu\n", name_and_type_index);
+    return NULL;
+  }
+  return &name_and_type->name_and_type_info;
+}
+
+struct UTF8_info* constant_member_descriptor(struct class_file* class,
+                                             uint16_t index) {
+  struct name_and_type_info* name_and_type =
+      constant_member_name_and_type(class, index);
+
+  if (name_and_type == NULL) {
+    return NULL;
+  }
+  return validate_constant(class, name_and_type->descripror_index);
+}
+
+/* Name of the class referenced by a CONSTANT_Class entry */
+struct UTF8_info* constant_class_name(struct class_file* class,
+                                      uint16_t index) {
+  struct cp_info* cp_info;
+
+  if (get_constant(class, index, &cp_info) != 0 || cp_info->tag != CLASS) {
+    return NULL;
+  }
+  return validate_constant(class, cp_info->class_info.name_index);
+}
@@ -0,0 +1,432 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "gc.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+struct scavenge_state {
+  struct gc_heap* gh;
+  struct gc_space* to;
+};
+
+/* Slot filter used while scanning one dirty card */
+struct card_scan_state {
+  struct scavenge_state* scavenge;
+  uint8_t* start;
+  uint8_t* end;
+};
+
+static size_t align_card(size_t size) {
+  return (size + CARD_SIZE - 1) & ~(CARD_SIZE - 1);
+}
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static int gc_collect_hook(struct heap* heap, size_t requested, void* ctx);
+static int scavenge(struct gc_heap* gh);
+
+int gc_heap_init(struct gc_heap* gh, size_t young_size, size_t old_size) {
+  size_t eden_size;
+  size_t survivor_size;
+  size_t tlab_size;
+  size_t card_count;
+  uint8_t* next;
+  int err;
+
+  memset(gh, 0, sizeof(*gh));
+
+  survivor_size = align_card(young_size / 10);
+  eden_size = align_card(young_size - 2 * survivor_size);
+  old_size = align_card(old_size);
+  if (survivor_size == 0 || eden_size == 0 || old_size == 0) {
+    printf("ERROR: generations are too small\n");
+    return EINVAL;
+  }
+
+  gh->reserved_size = eden_size + 2 * survivor_size + old_size;
+  gh->reserved = aligned_alloc(4096, (gh->reserved_size + 4095) & ~4095UL);
+  if (gh->reserved == NULL) {
+    printf("ERROR: can't reserve %zu bytes for heap\n", gh->reserved_size);
+    return ENOMEM;
+  }
+
+  card_count = gh->reserved_size >> CARD_SHIFT;
+  gh->cards = malloc(card_count);
+  gh->card_first_object = calloc(old_size >> CARD_SHIFT, sizeof(uint8_t*));
+  if (gh->cards == NULL || gh->card_first_object == NULL) {
+    printf("ERROR: can't allocate card table\n");
+    gc_heap_destroy(gh);
+    return ENOMEM;
+  }
+  memset(gh->cards, CARD_CLEAN, card_count);
+  gh->card_base =
+      (uint8_t*)((uintptr_t)gh->cards - ((uintptr_t)gh->reserved >> CARD_SHIFT));
+
+  tlab_size = eden_size / 16 < HEAP_DEFAULT_TLAB_SIZE ? eden_size / 16
+                                                       : HEAP_DEFAULT_TLAB_SIZE;
+  err = heap_init_region(&gh->eden, gh->reserved, eden_size, tlab_size);
+  if (err != 0) {
+    gc_heap_destroy(gh);
+    return err;
+  }
+  heap_set_collector(&gh->eden, gc_collect_hook, gh);
+
+  next = gh->reserved + eden_size;
+  for (int i = 0; i < 2; i++) {
+    gh->survivor[i].base = gh->survivor[i].top = next;
+    gh->survivor[i].end = next + survivor_size;
+    next += survivor_size;
+  }
+  gh->old.base = gh->old.top = next;
+  gh->old.end = next + old_size;
+
+  gh->from = 0;
+  gh->tenuring_threshold = GC_DEFAULT_TENURING_THRESHOLD;
+  return 0;
+}
+
+void gc_heap_destroy(struct gc_heap* gh) {
+  if (gh->eden.base != NULL) {
+    heap_destroy(&gh->eden);
+  }
+  free(gh->reserved);
+  free(gh->cards);
+  free(gh->card_first_object);
+  free(gh->roots);
+  free(gh->stats.pause_ns);
+  memset(gh, 0, sizeof(*gh));
+}
+
+int gc_add_root(struct gc_heap* gh, struct object_header** slot) {
+  if (gh->roots_count == gh->roots_capacity) {
+    size_t capacity = gh->roots_capacity ? gh->roots_capacity * 2 : 16;
+    struct object_header*** roots =
+        realloc(gh->roots, capacity * sizeof(*roots));
+    if (roots == NULL) {
+      printf("ERROR: can't grow root set\n");
+      return ENOMEM;
+    }
+    gh->roots = roots;
+    gh->roots_capacity = capacity;
+  }
+  gh->roots[gh->roots_count++] = slot;
+  return 0;
+}
+
+void gc_remove_root(struct gc_heap* gh, struct object_header** slot) {
+  size_t i;
+
+  for (i = 0; i < gh->roots_count; i++) {
+    if (gh->roots[i] == slot) {
+      gh->roots[i] = gh->roots[--gh->roots_count];
+      return;
+    }
+  }
+}
+
+void gc_set_root_scanner(struct gc_heap* gh, gc_root_scanner scan,
+                         void* ctx) {
+  gh->scan_roots = scan;
+  gh->scan_roots_ctx = ctx;
+}
+
+void gc_set_full_collector(struct gc_heap* gh, gc_full_collector collect,
+                           void* ctx) {
+  gh->full_collect = collect;
+  gh->full_collect_ctx = ctx;
+}
+
+void gc_visit_roots(struct gc_heap* gh, gc_slot_visitor visit, void* ctx) {
+  size_t i;
+
+  for (i = 0; i < gh->roots_count; i++) {
+    visit(gh->roots[i], ctx);
+  }
+  if (gh->scan_roots != NULL) {
+    gh->scan_roots(visit, ctx, gh->scan_roots_ctx);
+  }
+}
+
+void object_visit_refs(struct object_header* obj, gc_slot_visitor visit,
+                       void* ctx) {
+  const struct class_layout* layout = obj->layout;
+  uint32_t i;
+
+  if (layout->array_type == T_OBJECT) {
+    struct array_header* array = (struct array_header*)obj;
+    struct object_header** elements = (struct object_header**)(array + 1);
+    for (i = 0; i < array->length; i++) {
+      visit(&elements[i], ctx);
+    }
+    return;
+  }
+
+  for (i = 0; i < layout->ref_count; i++) {
+    visit((struct object_header**)((uint8_t*)obj + layout->ref_offsets[i]),
+          ctx);
+  }
+}
+
+/* The object covers the first byte of every card starting inside it */
+void gc_record_old_object(struct gc_heap* gh, uint8_t* obj, size_t size) {
+  size_t card = ((size_t)(obj - gh->old.base) + CARD_SIZE - 1) >> CARD_SHIFT;
+  size_t last = ((size_t)(obj + size - gh->old.base) - 1) >> CARD_SHIFT;
+
+  for (; card <= last; card++) {
+    gh->card_first_object[card] = obj;
+  }
+}
+
+/* Promotion: bump allocation in the old generation */
+static uint8_t* old_alloc(struct gc_heap* gh, size_t size) {
+  uint8_t* obj = gh->old.top;
+
+  if ((size_t)(gh->old.end - obj) < size) {
+    return NULL;
+  }
+  gh->old.top += size;
+  gc_record_old_object(gh, obj, size);
+  return obj;
+}
+
+static uint8_t* space_alloc(struct gc_space* space, size_t size) {
+  uint8_t* obj = space->top;
+
+  if ((size_t)(space->end - obj) < size) {
+    return NULL;
+  }
+  space->top += size;
+  return obj;
+}
+
+static struct object_header* evacuate(struct scavenge_state* sc,
+                                      struct object_header* obj) {
+  struct gc_heap* gh = sc->gh;
+  struct object_header* copy;
+  uintptr_t age;
+  size_t size;
+
+  if (object_is_forwarded(obj)) {
+    return object_forwardee(obj);
+  }
+
+  size = object_size(obj);
+  age = (obj->mark & MARK_AGE_MASK) >> MARK_AGE_SHIFT;
+  copy = NULL;
+
+  if (age + 1 < gh->tenuring_threshold) {
+    copy = (struct object_header*)space_alloc(sc->to, size);
+  }
+  if (copy != NULL) {
+    age++;
+    gh->stats.survived_bytes += size;
+  } else {
+    /* The promotion guarantee checked up front makes this succeed */
+    copy = (struct object_header*)old_alloc(gh, size);
+    gh->stats.promoted_bytes += size;
+  }
+
+  memcpy(copy, obj, size);
+  copy->mark = (obj->mark & ~MARK_AGE_MASK) | (age << MARK_AGE_SHIFT);
+  obj->mark = (uintptr_t)copy | MARK_FORWARDED;
+  return copy;
+}
+
+static void scavenge_slot(struct object_header** slot, void* ctx) {
+  struct scavenge_state* sc = ctx;
+  struct gc_heap* gh = sc->gh;
+  struct object_header* obj = *slot;
+
+  if (obj == NULL || !gc_is_young(gh, obj) ||
+      ((uint8_t*)obj >= sc->to->base && (uint8_t*)obj < sc->to->end)) {
+    return;
+  }
+
+  *slot = evacuate(sc, obj);
+
+  /* A promoted object or dirty card still pointing to a survivor */
+  if (gc_is_old(gh, slot) && gc_is_young(gh, *slot)) {
+    gc_write_barrier(gh, slot);
+  }
+}
+
+static void card_slot(struct object_header** slot, void* ctx) {
+  struct card_scan_state* card = ctx;
+
+  if ((uint8_t*)slot >= card->start && (uint8_t*)slot < card->end) {
+    scavenge_slot(slot, card->scavenge);
+  }
+}
+
+/* Only the elements of a large array that lie on the card are scanned */
+static void scan_array_slice(struct scavenge_state* sc,
+                             struct array_header* array, uint8_t* start,
+                             uint8_t* end) {
+  struct object_header** elements = (struct object_header**)(array + 1);
+  struct object_header** first = (struct object_header**)start;
+  struct object_header** last = elements + array->length;
+
+  if (first < elements) {
+    first = elements;
+  }
+  if ((uint8_t*)last > end) {
+    last = (struct object_header**)end;
+  }
+  for (; first < last; first++) {
+    scavenge_slot(first, sc);
+  }
+}
+
+/* Old->young pointers: scan objects on dirty cards of the old generation */
+static void scan_dirty_cards(struct scavenge_state* sc, uint8_t* old_top) {
+  struct gc_heap* gh = sc->gh;
+  uint8_t* cards = &gh->card_base[(uintptr_t)gh->old.base >> CARD_SHIFT];
+  size_t count = align_card((size_t)(old_top - gh->old.base)) >> CARD_SHIFT;
+  struct card_scan_state state = {.scavenge = sc};
+  size_t card;
+
+  for (card = 0; card < count; card++) {
+    uint8_t* obj;
+
+    if (cards[card] != CARD_DIRTY) {
+      continue;
+    }
+    cards[card] = CARD_CLEAN;
+    gh->stats.dirty_cards++;
+
+    state.start = gh->old.base + (card << CARD_SHIFT);
+    state.end = state.start + CARD_SIZE < old_top ? state.start + CARD_SIZE
+                                                  : old_top;
+    for (obj = gh->card_first_object[card]; obj < state.end;
+         obj += object_size((struct object_header*)obj)) {
+      struct object_header* header = (struct object_header*)obj;
+
+      if (header->layout->array_type == T_OBJECT) {
+        scan_array_slice(sc, (struct array_header*)obj, state.start,
+                         state.end);
+      } else {
+        object_visit_refs(header, card_slot, &state);
+      }
+    }
+  }
+}
+
+static void scan_objects(struct scavenge_state* sc, uint8_t** scan,
+                         uint8_t* const* top) {
+  while (*scan < *top) {
+    struct object_header* obj = (struct object_header*)*scan;
+    object_visit_refs(obj, scavenge_slot, sc);
+    *scan += object_size(obj);
+  }
+}
+
+/* Cheney-style copying collection of eden and the from-survivor space */
+static int scavenge(struct gc_heap* gh) {
+  struct scavenge_state sc = {.gh = gh, .to = &gh->survivor[1 - gh->from]};
+  struct gc_space* from = &gh->survivor[gh->from];
+  uint64_t start = now_ns();
+  size_t young_used = heap_used(&gh->eden) + (size_t)(from->top - from->base);
+  uint8_t* old_top = gh->old.top;
+  uint8_t* to_scan = sc.to->base;
+  uint8_t* old_scan = old_top;
+
+  /* Promotion guarantee: everything in young may have to be promoted */
+  if ((size_t)(gh->old.end - gh->old.top) < young_used) {
+    gh->stats.promotion_failures++;
+    return ENOMEM;
+  }
+
+  sc.to->top = sc.to->base;
+
+  gc_visit_roots(gh, scavenge_slot, &sc);
+  scan_dirty_cards(&sc, old_top);
+
+  /* Copied objects are the grey set, scanned in address order */
+  while (to_scan < sc.to->top || old_scan < gh->old.top) {
+    scan_objects(&sc, &to_scan, &sc.to->top);
+    scan_objects(&sc, &old_scan, &gh->old.top);
+  }
+
+  heap_reset(&gh->eden);
+  from->top = from->base;
+  gh->from = 1 - gh->from;
+  gh->stats.scavenges++;
+
+  if (gh->stats.pause_count == gh->stats.pause_capacity) {
+    size_t capacity =
+        gh->stats.pause_capacity ? gh->stats.pause_capacity * 2 : 64;
+    uint64_t* pauses =
+        realloc(gh->stats.pause_ns, capacity * sizeof(uint64_t));
+    if (pauses == NULL) {
+      return 0;
+    }
+    gh->stats.pause_ns = pauses;
+    gh->stats.pause_capacity = capacity;
+  }
+  gh->stats.pause_ns[gh->stats.pause_count++] = now_ns() - start;
+  return 0;
+}
+
+/* Scavenge, falling back to a full collection of the old generation */
+static int collect(struct gc_heap* gh) {
+  int err = scavenge(gh);
+
+  if (err == ENOMEM && gh->full_collect != NULL) {
+    err = gh->full_collect(gh, gh->full_collect_ctx);
+    if (err == 0) {
+      err = scavenge(gh);
+    }
+  }
+  if (err == ENOMEM) {
+    printf("ERROR: old generation can't guarantee promotion\n");
+  }
+  return err;
+}
+
+static int gc_collect_hook(struct heap* heap, size_t requested, void* ctx) {
+  (void)heap;
+  (void)requested;
+  return collect((struct gc_heap*)ctx);
+}
+
+/* Mutators must be stopped, safepoint_begin() stops those in Java code */
+int gc_scavenge(struct gc_heap* gh) {
+  heap_retire_tlabs(&gh->eden);
+  return collect(gh);
+}
+
+static int compare_u64(const void* a, const void* b) {
+  uint64_t x = *(const uint64_t*)a;
+  uint64_t y = *(const uint64_t*)b;
+  return (x > y) - (x < y);
+}
+
+uint64_t gc_pause_percentile(const struct gc_heap* gh, double percentile) {
+  size_t count = gh->stats.pause_count;
+  uint64_t* sorted;
+  uint64_t result;
+  size_t index;
+
+  if (count == 0) {
+    return 0;
+  }
+  sorted = malloc(count * sizeof(uint64_t));
+  if (sorted == NULL) {
+    return 0;
+  }
+  memcpy(sorted, gh->stats.pause_ns, count * sizeof(uint64_t));
+  qsort(sorted, count, sizeof(uint64_t), compare_u64);
+
+  index = (size_t)(percentile / 100.0 * (double)(count - 1) + 0.5);
+  result = sorted[index < count ? index : count - 1];
+  free(sorted);
+  return result;
+}
@@ -0,0 +1,119 @@
+#include "handler_table.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "attribute_info.h"
+#include "descriptor.h"
+
+static int compare_bci(const void* a, const void* b) {
+  return (int)*(const uint16_t*)a - (int)*(const uint16_t*)b;
+}
+
+static int covers(const struct Code_attribute* code, uint16_t handler,
+                  uint16_t bci) {
+  return bci >= code->exception_table[handler].start_pc &&
+         bci < code->exception_table[handler].end_pc;
+}
+
+struct handler_table* handler_table_build(struct class_file* class,
+                                          const struct Code_attribute* code) {
+  uint16_t length = code->exception_table_length;
+  struct handler_table* table = calloc(1, sizeof(struct handler_table));
+  uint32_t count = 0;
+  uint32_t i;
+
+  if (table == NULL) {
+    printf("ERROR: can't allocate memory for handler table\n");
+    return NULL;
+  }
+  table->handlers = calloc(length + 1u, sizeof(struct exception_handler));
+  table->starts = malloc((2u * length + 1u) * sizeof(uint16_t));
+  table->first = malloc((2u * length + 2u) * sizeof(uint32_t));
+  if (table->handlers == NULL || table->starts == NULL ||
+      table->first == NULL) {
+    handler_table_free(table);
+    printf("ERROR: can't allocate memory for handler table\n");
+    return NULL;
+  }
+
+  for (i = 0; i < length; i++) {
+    struct exception_handler* handler = &table->handlers[i];
+
+    handler->handler_pc = code->exception_table[i].handler_pc;
+    handler->catch_type = code->exception_table[i].catch_type;
+    if (handler->catch_type != 0) {
+      handler->catch_name = constant_class_name(class, handler->catch_type);
+    }
+    table->starts[2 * i] = code->exception_table[i].start_pc;
+    table->starts[2 * i + 1] = code->exception_table[i].end_pc;
+  }
+
+  /* every start_pc and end_pc begins a range */
+  qsort(table->starts, 2u * length, sizeof(uint16_t), compare_bci);
+  for (i = 0; i < 2u * length; i++) {
+    if (table->range_count == 0 ||
+        table->starts[table->range_count - 1] != table->starts[i]) {
+      table->starts[table->range_count++] = table->starts[i];
+    }
+  }
+
+  for (i = 0; i < table->range_count; i++) {
+    uint16_t h;
+
+    table->first[i] = count;
+    for (h = 0; h < length; h++) {
+      count += (uint32_t)covers(code, h, table->starts[i]);
+    }
+  }
+  table->first[table->range_count] = count;
+  table->candidates = malloc((count + 1u) * sizeof(uint16_t));
+  if (table->candidates == NULL) {
+    handler_table_free(table);
+    printf("ERROR: can't allocate memory for handler table\n");
+    return NULL;
+  }
+  for (i = 0, count = 0; i < table->range_count; i++) {
+    uint16_t h;
+
+    for (h = 0; h < length; h++) {
+      if (covers(code, h, table->starts[i])) {
+        table->candidates[count++] = h;
+      }
+    }
+  }
+  return table;
+}
+
+void handler_table_free(struct handler_table* table) {
+  if (table == NULL) {
+    return;
+  }
+  free(table->handlers);
+  free(table->starts);
+  free(table->first);
+  free(table->candidates);
+  free(table);
+}
+
+const uint16_t* handler_table_candidates(const struct handler_table* table,
+                                         uint32_t bci, uint32_t* count) {
+  uint32_t low = 0;
+  uint32_t high = table->range_count;
+
+  /* last range starting at or before bci */
+  while (low < high) {
+    uint32_t mid = low + (high - low) / 2;
+    if (table->starts[mid] <= bci) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  if (low == 0) {
+    *count = 0;
+    return NULL;
+  }
+  *count = table->first[low] - table->first[low - 1];
+  return table->candidates + table->first[low - 1];
+}
@@ -0,0 +1,284 @@
+#include "heap.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "safepoint.h"
+
+_Thread_local struct tlab heap_current_tlab;
+
+static size_t align_size(size_t size) {
+  return (size + HEAP_ALIGNMENT - 1) & ~(size_t)(HEAP_ALIGNMENT - 1);
+}
+
+int heap_init(struct heap* heap, size_t capacity, size_t tlab_size) {
+  uint8_t* base;
+  int err;
+
+  capacity = (capacity + 4095) & ~(size_t)4095;
+  if (capacity == 0) {
+    printf("ERROR: heap capacity is 0\n");
+    return EINVAL;
+  }
+
+  base = aligned_alloc(4096, capacity);
+  if (base == NULL) {
+    printf("ERROR: can't allocate %zu bytes for heap\n", capacity);
+    return ENOMEM;
+  }
+
+  err = heap_init_region(heap, base, capacity, tlab_size);
+  if (err != 0) {
+    free(base);
+    return err;
+  }
+  heap->owns_memory = 1;
+  return 0;
+}
+
+/* Sets up a heap over memory owned by the caller, e.g. one generation */
+int heap_init_region(struct heap* heap, uint8_t* base, size_t capacity,
+                     size_t tlab_size) {
+  if (tlab_size == 0) {
+    tlab_size = HEAP_DEFAULT_TLAB_SIZE;
+  }
+  tlab_size = align_size(tlab_size);
+
+  if (tlab_size <= HEAP_FILLER_RESERVE || tlab_size > capacity) {
+    printf("ERROR: bad heap size %zu with TLAB size %zu\n", capacity,
+           tlab_size);
+    return EINVAL;
+  }
+
+  heap->base = base;
+  heap->end = heap->base + capacity;
+  atomic_init(&heap->top, (uintptr_t)heap->base);
+  heap->owns_memory = 0;
+  heap->tlab_size = tlab_size;
+  heap->collect = NULL;
+  heap->collect_ctx = NULL;
+  heap->tlabs = NULL;
+  atomic_init(&heap->tlab_refills, 0);
+  atomic_init(&heap->slow_allocations, 0);
+  atomic_init(&heap->collections, 0);
+
+  if (pthread_mutex_init(&heap->lock, NULL) != 0) {
+    return ENOMEM;
+  }
+  return 0;
+}
+
+void heap_destroy(struct heap* heap) {
+  struct tlab* tlab;
+
+  pthread_mutex_lock(&heap->lock);
+  for (tlab = heap->tlabs; tlab != NULL; tlab = tlab->next) {
+    tlab->heap = NULL;
+    tlab->start = tlab->top = tlab->end = NULL;
+  }
+  heap->tlabs = NULL;
+  pthread_mutex_unlock(&heap->lock);
+
+  pthread_mutex_destroy(&heap->lock);
+  if (heap->owns_memory) {
+    free(heap->base);
+  }
+  heap->base = heap->end = NULL;
+}
+
+void heap_set_collector(struct heap* heap, heap_collect_fn collect,
+                        void* ctx) {
+  heap->collect = collect;
+  heap->collect_ctx = ctx;
+}
+
+/* Claims `size` bytes of the shared region, NULL when it is exhausted */
+static uint8_t* heap_claim(struct heap* heap, size_t size) {
+  uintptr_t top = atomic_load_explicit(&heap->top, memory_order_relaxed);
+
+  do {
+    if ((uintptr_t)heap->end - top < size) {
+      return NULL;
+    }
+  } while (!atomic_compare_exchange_weak_explicit(
+      &heap->top, &top, top + size, memory_order_relaxed,
+      memory_order_relaxed));
+
+  return (uint8_t*)top;
+}
+
+/* Turns [start, start + size) into an int[] nobody references */
+static void heap_fill(uint8_t* start, size_t size) {
+  struct array_header* filler = (struct array_header*)start;
+
+  filler->header.mark = MARK_UNLOCKED;
+  filler->header.layout = class_layout_for_array(T_INT);
+  filler->length = (uint32_t)((size - sizeof(struct array_header)) / 4);
+}
+
+static void tlab_retire(struct tlab* tlab) {
+  if (tlab->start == NULL) {
+    return;
+  }
+  heap_fill(tlab->top, (size_t)(tlab->end - tlab->top) + HEAP_FILLER_RESERVE);
+  tlab->allocated_bytes += (uint64_t)(tlab->top - tlab->start);
+  tlab->start = tlab->top = tlab->end = NULL;
+}
+
+static int tlab_refill(struct heap* heap, struct tlab* tlab) {
+  uint8_t* chunk;
+
+  tlab_retire(tlab);
+  chunk = heap_claim(heap, heap->tlab_size);
+  if (chunk == NULL) {
+    return ENOMEM;
+  }
+
+  /* Zeroing the whole buffer once keeps the fast path free of memset */
+  memset(chunk, 0, heap->tlab_size);
+  tlab->start = tlab->top = chunk;
+  tlab->end = chunk + heap->tlab_size - HEAP_FILLER_RESERVE;
+  tlab->refills++;
+  atomic_fetch_add_explicit(&heap->tlab_refills, 1, memory_order_relaxed);
+  return 0;
+}
+
+int heap_attach_thread(struct heap* heap) {
+  struct tlab* tlab = &heap_current_tlab;
+
+  if (tlab->heap == heap) {
+    return 0;
+  }
+  if (tlab->heap != NULL) {
+    printf("ERROR: thread is already attached to another heap\n");
+    return EINVAL;
+  }
+
+  memset(tlab, 0, sizeof(*tlab));
+  tlab->heap = heap;
+  safepoint_block();
+  pthread_mutex_lock(&heap->lock);
+  tlab->next = heap->tlabs;
+  heap->tlabs = tlab;
+  pthread_mutex_unlock(&heap->lock);
+  safepoint_unblock();
+  return 0;
+}
+
+void heap_detach_thread(struct heap* heap) {
+  struct tlab* tlab = &heap_current_tlab;
+  struct tlab** link;
+
+  if (tlab->heap != heap) {
+    return;
+  }
+
+  safepoint_block();
+  pthread_mutex_lock(&heap->lock);
+  tlab_retire(tlab);
+  for (link = &heap->tlabs; *link != NULL; link = &(*link)->next) {
+    if (*link == tlab) {
+      *link = tlab->next;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&heap->lock);
+  safepoint_unblock();
+  tlab->heap = NULL;
+  tlab->next = NULL;
+}
+
+static void heap_retire_tlabs_locked(struct heap* heap) {
+  struct tlab* tlab;
+
+  for (tlab = heap->tlabs; tlab != NULL; tlab = tlab->next) {
+    tlab_retire(tlab);
+  }
+}
+
+/*
+ * Mutators must be stopped: the TLABs of all attached threads
+ * are retired so the heap can be walked or evacuated.
+ */
+void heap_retire_tlabs(struct heap* heap) {
+  pthread_mutex_lock(&heap->lock);
+  heap_retire_tlabs_locked(heap);
+  pthread_mutex_unlock(&heap->lock);
+}
+
+void heap_reset(struct heap* heap) {
+  atomic_store_explicit(&heap->top, (uintptr_t)heap->base,
+                        memory_order_relaxed);
+}
+
+size_t heap_used(struct heap* heap) {
+  return (size_t)(atomic_load_explicit(&heap->top, memory_order_relaxed) -
+                  (uintptr_t)heap->base);
+}
+
+/*
+ * Runs the collector once for all threads that failed to allocate:
+ * a thread that waited on the lock while another one collected
+ * simply retries its allocation. The collection is a safepoint
+ * operation, the other threads are stopped at polls.
+ */
+static int heap_collect(struct heap* heap, size_t requested,
+                        uint64_t seen_collections) {
+  int err = 0;
+
+  if (heap->collect == NULL) {
+    return ENOMEM;
+  }
+
+  /* the collecting thread waits for us to stop, we wait for the lock */
+  safepoint_block();
+  pthread_mutex_lock(&heap->lock);
+  if (atomic_load(&heap->collections) == seen_collections) {
+    safepoint_begin("collection");
+    heap_retire_tlabs_locked(heap);
+    err = heap->collect(heap, requested, heap->collect_ctx);
+    atomic_fetch_add(&heap->collections, 1);
+    safepoint_end();
+  }
+  pthread_mutex_unlock(&heap->lock);
+  safepoint_unblock();
+  return err;
+}
+
+void* heap_alloc_slow(struct heap* heap, size_t size) {
+  struct tlab* tlab = &heap_current_tlab;
+  int attempt;
+
+  if (tlab->heap != heap && heap_attach_thread(heap) != 0) {
+    return NULL;
+  }
+  size = align_size(size);
+
+  for (attempt = 0; attempt < 2; attempt++) {
+    uint64_t seen_collections = atomic_load(&heap->collections);
+
+    if (size > heap->tlab_size / 2) {
+      /* Large objects bypass the TLAB so it is not wasted */
+      uint8_t* obj = heap_claim(heap, size);
+      if (obj != NULL) {
+        memset(obj, 0, size);
+        atomic_fetch_add_explicit(&heap->slow_allocations, 1,
+                                  memory_order_relaxed);
+        return obj;
+      }
+    } else if (tlab_refill(heap, tlab) == 0) {
+      void* obj = tlab->top;
+      tlab->top += size;
+      return obj;
+    }
+
+    if (heap_collect(heap, size, seen_collections) != 0) {
+      break;
+    }
+  }
+
+  printf("ERROR: java heap is out of memory, requested %zu bytes\n", size);
+  return NULL;
+}
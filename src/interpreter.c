@@ -0,0 +1,2411 @@
+#include "interpreter.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bootstrap.h"
+#include "class_hierarchy.h"
+#include "class_layout.h"
+#include "classfile_parser.h"
+#include "descriptor.h"
+#include "handler_table.h"
+#include "heap.h"
+#include "intrinsics.h"
+#include "line_table.h"
+#include "monitor.h"
+#include "native.h"
+#include "oop_map.h"
+#include "opcodes.h"
+#include "subtype.h"
+#include "superinstructions.h"
+
+/* Superclasses of the exceptions the VM throws by itself */
+static const char* const vm_exception_supers[][2] = {
+    {"java/lang/ArithmeticException", "java/lang/RuntimeException"},
+    {"java/lang/ArrayIndexOutOfBoundsException",
+     "java/lang/IndexOutOfBoundsException"},
+    {"java/lang/IndexOutOfBoundsException", "java/lang/RuntimeException"},
+    {"java/lang/NegativeArraySizeException", "java/lang/RuntimeException"},
+    {"java/lang/NullPointerException", "java/lang/RuntimeException"},
+    {"java/lang/ClassCastException", "java/lang/RuntimeException"},
+    {"java/lang/IllegalMonitorStateException", "java/lang/RuntimeException"},
+    {"java/lang/RuntimeException", "java/lang/Exception"},
+    {"java/lang/Exception", "java/lang/Throwable"},
+    {"java/lang/OutOfMemoryError", "java/lang/VirtualMachineError"},
+    {"java/lang/StackOverflowError", "java/lang/VirtualMachineError"},
+    {"java/lang/InternalError", "java/lang/VirtualMachineError"},
+    {"java/lang/VirtualMachineError", "java/lang/Error"},
+    {"java/lang/NoClassDefFoundError", "java/lang/LinkageError"},
+    {"java/lang/NoSuchFieldError", "java/lang/LinkageError"},
+    {"java/lang/NoSuchMethodError", "java/lang/LinkageError"},
+    {"java/lang/AbstractMethodError",
+     "java/lang/IncompatibleClassChangeError"},
+    {"java/lang/IncompatibleClassChangeError", "java/lang/LinkageError"},
+    {"java/lang/ExceptionInInitializerError", "java/lang/LinkageError"},
+    {"java/lang/BootstrapMethodError", "java/lang/LinkageError"},
+    {"java/lang/LinkageError", "java/lang/Error"},
+    {"java/lang/Error", "java/lang/Throwable"},
+};
+
+int interpreter_init(struct interpreter* interp, struct gc_heap* heap) {
+  int err;
+
+  memset(interp, 0, sizeof(*interp));
+  err = safepoint_init();
+  if (err != 0) {
+    return err;
+  }
+  interp->heap = heap;
+  interp->hot_invocations = INTERP_DEFAULT_HOT_INVOCATIONS;
+  interp->hot_backedges = INTERP_DEFAULT_HOT_BACKEDGES;
+  interp->osr_backedges = INTERP_DEFAULT_OSR_BACKEDGES;
+  interp->superinstructions = 1;
+  verifier_init(&interp->verifier);
+  interp->hierarchy = class_hierarchy_new();
+  interp->monitors = monitor_table_new();
+  interp->natives = native_table_new();
+  if (interp->hierarchy == NULL || interp->monitors == NULL ||
+      interp->natives == NULL) {
+    class_hierarchy_free(interp->hierarchy);
+    monitor_table_free(interp->monitors);
+    native_table_free(interp->natives);
+    return ENOMEM;
+  }
+  err = pthread_mutex_init(&interp->lock, NULL);
+  if (err == 0) {
+    err = pthread_cond_init(&interp->initialized, NULL);
+    if (err != 0) {
+      pthread_mutex_destroy(&interp->lock);
+    }
+  }
+  if (err != 0) {
+    class_hierarchy_free(interp->hierarchy);
+    monitor_table_free(interp->monitors);
+    native_table_free(interp->natives);
+  }
+  return err;
+}
+
+void interpreter_destroy(struct interpreter* interp) {
+  pthread_cond_destroy(&interp->initialized);
+  pthread_mutex_destroy(&interp->lock);
+  class_hierarchy_free(interp->hierarchy);
+  monitor_table_free(interp->monitors);
+  native_table_free(interp->natives);
+  verifier_destroy(&interp->verifier);
+}
+
+int interp_thread_init(struct interp_thread* thread,
+                       struct interpreter* interp, size_t stack_slots) {
+  memset(thread, 0, sizeof(*thread));
+  thread->interp = interp;
+  thread->id = atomic_fetch_add(&interp->thread_ids, 1) + 1;
+  thread->slots_capacity =
+      stack_slots != 0 ? stack_slots : INTERP_DEFAULT_STACK_SLOTS;
+  thread->slots = malloc(thread->slots_capacity * sizeof(union java_value));
+  if (thread->slots == NULL) {
+    printf("ERROR: can't allocate memory for interpreter stack\n");
+    return ENOMEM;
+  }
+  safepoint_attach(&thread->safepoint, thread);
+  return 0;
+}
+
+void interp_thread_destroy(struct interp_thread* thread) {
+  if (thread->slots != NULL) {
+    safepoint_detach(&thread->safepoint);
+  }
+  free(thread->slots);
+  free(thread->backtrace);
+  thread->slots = NULL;
+  thread->backtrace = NULL;
+}
+
+/* Only (method, bci) pairs, lines are looked up when someone asks */
+static void record_backtrace(struct interp_thread* thread) {
+  struct java_frame* frame;
+
+  thread->backtrace_depth = 0;
+  for (frame = thread->top; frame != NULL; frame = frame->caller) {
+    struct backtrace_frame* entry;
+
+    if (thread->backtrace_depth == thread->backtrace_capacity) {
+      uint32_t capacity = thread->backtrace_capacity != 0
+                              ? thread->backtrace_capacity * 2
+                              : 64;
+      struct backtrace_frame* grown = realloc(
+          thread->backtrace, capacity * sizeof(struct backtrace_frame));
+      if (grown == NULL) {
+        return;
+      }
+      thread->backtrace = grown;
+      thread->backtrace_capacity = capacity;
+    }
+    entry = &thread->backtrace[thread->backtrace_depth++];
+    entry->class = frame->class;
+    entry->method = frame->method;
+    entry->bci = frame->bci;
+  }
+}
+
+void interp_throw(struct interp_thread* thread, const char* class_name) {
+  thread->exception = NULL;
+  thread->exception_class = class_name;
+  thread->stats.exceptions++;
+  record_backtrace(thread);
+}
+
+void interp_clear_exception(struct interp_thread* thread) {
+  thread->exception = NULL;
+  thread->exception_class = NULL;
+}
+
+static int utf8_is(const struct UTF8_info* utf8, const char* str) {
+  return utf8 != NULL &&
+         is_string_match((const char*)utf8->bytes, utf8->lenght, str);
+}
+
+static int utf8_equals(const struct UTF8_info* a, const struct UTF8_info* b) {
+  return a != NULL && b != NULL && a->lenght == b->lenght &&
+         memcmp(a->bytes, b->bytes, a->lenght) == 0;
+}
+
+static struct UTF8_info* class_name_of(struct class_file* class) {
+  return constant_class_name(class, class->this_class);
+}
+
+/* Finds a class by name as seen from `from`, links it, NULL if unknown */
+static struct class_file* lookup_class(struct interpreter* interp,
+                                       struct class_file* from,
+                                       const struct UTF8_info* name) {
+  struct class_file* class = NULL;
+
+  if (utf8_equals(class_name_of(from), name)) {
+    class = from;
+  } else if (interp->resolve_class != NULL) {
+    class = interp->resolve_class(name->bytes, name->lenght,
+                                  interp->resolve_ctx);
+  }
+  if (class != NULL && interp_link_class(interp, class) != 0) {
+    return NULL;
+  }
+  return class;
+}
+
+static void free_runtime(struct class_file* class,
+                         struct class_runtime* runtime) {
+  uint16_t i;
+
+  for (i = 0; runtime->heap != NULL && runtime->statics != NULL &&
+              i < class->fields_count;
+       i++) {
+    gc_remove_root(runtime->heap, &runtime->statics[i].ref);
+  }
+  /* references of Dynamic constants are roots as well */
+  for (i = 1; runtime->heap != NULL && runtime->cp_cache != NULL &&
+              i < class->constant_pool_count;
+       i++) {
+    struct cp_info* cp_info;
+    if (runtime->cp_cache[i].resolved == 1 &&
+        runtime->cp_cache[i].kind == 'L' &&
+        get_constant(class, i, &cp_info) == 0 && cp_info->tag == DYNAMIC) {
+      gc_remove_root(runtime->heap, &runtime->cp_cache[i].value.ref);
+    }
+  }
+  if (runtime->hierarchy != NULL) {
+    class_hierarchy_remove(runtime->hierarchy, class, runtime);
+  }
+  for (i = 0; runtime->methods != NULL && i < class->methods_count; i++) {
+    free(runtime->methods[i].code);
+    handler_table_free(runtime->methods[i].handlers);
+    line_table_free(runtime->methods[i].lines);
+    free(runtime->methods[i].sites);
+  }
+  subtype_free(runtime);
+  free(runtime->interfaces);
+  free(runtime->subtypes);
+  free(runtime->methods);
+  free(runtime->cp_cache);
+  free(runtime->statics);
+  free(runtime);
+}
+
+static int link_runtime(struct interpreter* interp, struct class_file* class);
+
+/* lookup_class() for link_runtime(), which already holds the lock */
+static struct class_file* lookup_locked(struct interpreter* interp,
+                                        struct class_file* from,
+                                        const struct UTF8_info* name) {
+  struct class_file* class = NULL;
+
+  /* a class can't be its own supertype */
+  if (interp->resolve_class != NULL &&
+      !utf8_equals(class_name_of(from), name)) {
+    class = interp->resolve_class(name->bytes, name->lenght,
+                                  interp->resolve_ctx);
+  }
+  if (class != NULL && class->runtime == NULL &&
+      link_runtime(interp, class) != 0) {
+    return NULL;
+  }
+  return class;
+}
+
+static int link_runtime(struct interpreter* interp, struct class_file* class) {
+  struct class_runtime* runtime;
+  struct class_file* super = NULL;
+  const struct class_layout* super_layout = NULL;
+  struct method_descriptor desc;
+  compiled_entry entry;
+  uint16_t i;
+  int err;
+
+  if (class->super_class != 0) {
+    struct UTF8_info* name = constant_class_name(class, class->super_class);
+    if (name == NULL) {
+      return EINVAL;
+    }
+    super = lookup_locked(interp, class, name);
+    if (super == NULL && !utf8_is(name, "java/lang/Object")) {
+      printf("ERROR: superclass %.*s not found\n", name->lenght,
+             (const char*)name->bytes);
+      return ENOENT;
+    }
+    super_layout = super != NULL ? super->layout : NULL;
+  }
+  /* the class hierarchy the verifier assumed, now that it can be seen */
+  if (class->verify_deferred && interp->resolve_class != NULL) {
+    err = verify_class_links(&interp->verifier, class, interp->resolve_class,
+                             interp->resolve_ctx);
+    if (err != 0) {
+      return err;
+    }
+  }
+
+  if (class->layout == NULL) {
+    struct class_layout* layout = malloc(sizeof(struct class_layout));
+    if (layout == NULL) {
+      printf("ERROR: can't allocate memory for class layout\n");
+      return ENOMEM;
+    }
+    err = class_layout_compute(class, super_layout, layout);
+    if (err != 0) {
+      free(layout);
+      return err;
+    }
+    class->layout = layout;
+  } else if (class->layout->klass != class) {
+    /* an archived layout points to the archived class, not to this one */
+    struct class_layout* layout = malloc(sizeof(struct class_layout));
+    if (layout == NULL) {
+      printf("ERROR: can't allocate memory for class layout\n");
+      return ENOMEM;
+    }
+    *layout = *class->layout;
+    layout->klass = class;
+    layout->super = super_layout;
+    class->layout = layout;
+  }
+
+  err = class_build_oop_maps(class);
+  if (err != 0) {
+    return err;
+  }
+
+  runtime = calloc(1, sizeof(struct class_runtime));
+  if (runtime == NULL) {
+    printf("ERROR: can't allocate memory for class runtime\n");
+    return ENOMEM;
+  }
+  runtime->super = super;
+  runtime->heap = interp->heap;
+  runtime->lock.mark = MARK_UNLOCKED;
+  runtime->lock.layout = class->layout;
+  runtime->methods = calloc(class->methods_count + 1u,
+                            sizeof(struct method_runtime));
+  runtime->cp_cache = calloc(class->constant_pool_count + 1u,
+                             sizeof(struct cp_cache_entry));
+  runtime->statics = calloc(class->fields_count + 1u,
+                            sizeof(union java_value));
+  runtime->interfaces = calloc(class->interfaces_count + 1u,
+                               sizeof(struct class_file*));
+  if (runtime->methods == NULL || runtime->cp_cache == NULL ||
+      runtime->statics == NULL || runtime->interfaces == NULL) {
+    free_runtime(class, runtime);
+    printf("ERROR: can't allocate memory for class runtime\n");
+    return ENOMEM;
+  }
+
+  for (i = 0; i < class->methods_count; i++) {
+    struct method_info* method = &class->methods[i];
+    struct method_runtime* mr = &runtime->methods[i];
+
+    if (parse_method_descriptor(
+            validate_constant(class, method->descriptor_index), &desc) != 0) {
+      free_runtime(class, runtime);
+      return EINVAL;
+    }
+    mr->arg_slots = (uint16_t)(desc.arg_slots +
+                               !(method->access_flags & ACC_STATIC));
+    mr->ret = desc.ret;
+    entry = intrinsic_bind(class, method);
+    if (entry != NULL) {
+      atomic_store_explicit(&mr->flags,
+                            METHOD_NOT_COMPILABLE | METHOD_NOT_OPTIMIZABLE |
+                                METHOD_INTRINSIC,
+                            memory_order_relaxed);
+      atomic_store_explicit(&mr->entry, entry, memory_order_relaxed);
+      interp->intrinsics++;
+    } else if (method->access_flags & ACC_NATIVE) {
+      /* the stub is the method's only code, compilers leave it alone */
+      atomic_store_explicit(&mr->flags,
+                            METHOD_NOT_COMPILABLE | METHOD_NOT_OPTIMIZABLE,
+                            memory_order_relaxed);
+      atomic_store_explicit(&mr->entry,
+                            native_bind(interp->natives, class, method, &desc),
+                            memory_order_relaxed);
+    }
+    if (interp->superinstructions && method->code != NULL) {
+      uint32_t fused = 0;
+      mr->code = superinstructions_rewrite(method->code, &fused);
+      interp->fused += fused;
+    }
+    if (method->code != NULL) {
+      uint16_t sites;
+      err = bootstrap_number_sites(method->code, &mr->code, &sites);
+      if (err == 0 && sites != 0) {
+        mr->sites = calloc(sites, sizeof(struct call_site));
+        err = mr->sites != NULL ? 0 : ENOMEM;
+      }
+      if (err != 0) {
+        free_runtime(class, runtime);
+        return err;
+      }
+    }
+    if (method->code != NULL && method->code->exception_table_length != 0) {
+      mr->handlers = handler_table_build(class, method->code);
+      if (mr->handlers == NULL) {
+        free_runtime(class, runtime);
+        return ENOMEM;
+      }
+    }
+  }
+
+  /* static references are roots until the class is freed */
+  for (i = 0; interp->heap != NULL && i < class->fields_count; i++) {
+    struct UTF8_info* descriptor =
+        validate_constant(class, class->fields[i].descriptor_index);
+    if ((class->fields[i].access_flags & ACC_STATIC) && descriptor != NULL &&
+        descriptor->lenght != 0 &&
+        (descriptor->bytes[0] == 'L' || descriptor->bytes[0] == '[') &&
+        gc_add_root(interp->heap, &runtime->statics[i].ref) != 0) {
+      free_runtime(class, runtime);
+      return ENOMEM;
+    }
+  }
+
+  /* an unknown superinterface leaves the hierarchy incomplete */
+  for (i = 0; i < class->interfaces_count; i++) {
+    struct UTF8_info* name = constant_class_name(class, class->interfaces[i]);
+    runtime->interfaces[i] =
+        name != NULL ? lookup_locked(interp, class, name) : NULL;
+  }
+  err = subtype_link(class, runtime);
+  if (err != 0) {
+    free_runtime(class, runtime);
+    return err;
+  }
+  /* dependencies on the hierarchy break before instances can exist */
+  if (interp->hierarchy != NULL) {
+    err = class_hierarchy_add(interp->hierarchy, class, runtime);
+    if (err != 0) {
+      free_runtime(class, runtime);
+      return err;
+    }
+  }
+
+  /* readers check class->runtime without the lock */
+  atomic_thread_fence(memory_order_release);
+  class->runtime = runtime;
+  return 0;
+}
+
+/*
+ * Prepares the class for execution: resolves its superclass and
+ * superinterfaces, computes its layout and oop maps, allocates its
+ * runtime state and records it in the class hierarchy
+ */
+int interp_link_class(struct interpreter* interp, struct class_file* class) {
+  int err = 0;
+
+  if (class->runtime != NULL) {
+    return 0;
+  }
+  pthread_mutex_lock(&interp->lock);
+  if (class->runtime == NULL) {
+    err = link_runtime(interp, class);
+  }
+  pthread_mutex_unlock(&interp->lock);
+  return err;
+}
+
+void class_runtime_free(struct class_file* class) {
+  if (class->runtime != NULL) {
+    free_runtime(class, class->runtime);
+    class->runtime = NULL;
+  }
+}
+
+struct method_info* class_find_method(struct class_file* class,
+                                      const char* name,
+                                      const char* descriptor) {
+  uint16_t i;
+
+  for (i = 0; i < class->methods_count; i++) {
+    struct method_info* method = &class->methods[i];
+    if (utf8_is(validate_constant(class, method->name_index), name) &&
+        utf8_is(validate_constant(class, method->descriptor_index),
+                descriptor)) {
+      return method;
+    }
+  }
+  return NULL;
+}
+
+int32_t interp_line_number(struct class_file* class, struct method_info* method,
+                           uint32_t bci) {
+  struct method_runtime* mr = method_runtime_of(class, method);
+  struct line_table* lines =
+      atomic_load_explicit(&mr->lines, memory_order_acquire);
+
+  if (method->code == NULL) {
+    return -1;
+  }
+  if (lines == NULL) {
+    struct line_table* expected = NULL;
+
+    lines = line_table_build(class, method->code);
+    if (lines == NULL) {
+      return -1;
+    }
+    /* another thread may have built it first */
+    if (!atomic_compare_exchange_strong_explicit(
+            &mr->lines, &expected, lines, memory_order_acq_rel,
+            memory_order_acquire)) {
+      line_table_free(lines);
+      lines = expected;
+    }
+  }
+  return line_table_lookup(lines, bci);
+}
+
+/* Method declared by `class` or its superclasses */
+static struct method_info* find_method(struct class_file** holder,
+                                       const struct UTF8_info* name,
+                                       const struct UTF8_info* descriptor) {
+  struct class_file* class = *holder;
+
+  for (; class != NULL; class = class->runtime->super) {
+    uint16_t i;
+    for (i = 0; i < class->methods_count; i++) {
+      struct method_info* method = &class->methods[i];
+      if (utf8_equals(validate_constant(class, method->name_index), name) &&
+          utf8_equals(validate_constant(class, method->descriptor_index),
+                      descriptor)) {
+        *holder = class;
+        return method;
+      }
+    }
+  }
+  return NULL;
+}
+
+/* Field declared by `class` or its superclasses, -1 if not found */
+static int32_t find_field(struct class_file** holder,
+                          const struct UTF8_info* name,
+                          const struct UTF8_info* descriptor) {
+  struct class_file* class = *holder;
+
+  for (; class != NULL; class = class->runtime->super) {
+    uint16_t i;
+    for (i = 0; i < class->fields_count; i++) {
+      struct field_info* field = &class->fields[i];
+      if (utf8_equals(validate_constant(class, field->name_index), name) &&
+          utf8_equals(validate_constant(class, field->descriptor_index),
+                      descriptor)) {
+        *holder = class;
+        return i;
+      }
+    }
+  }
+  return -1;
+}
+
+/* Resolved Class constant, NULL if the class can't be found or linked */
+static struct cp_cache_entry* find_class_entry(struct interpreter* interp,
+                                               struct class_file* class,
+                                               uint16_t index) {
+  struct cp_cache_entry* entry = &class->runtime->cp_cache[index];
+  struct UTF8_info* name;
+
+  if (atomic_load_explicit(&entry->resolved, memory_order_acquire)) {
+    return entry;
+  }
+  name = constant_class_name(class, index);
+  if (name == NULL ||
+      (entry->class = lookup_class(interp, class, name)) == NULL) {
+    return NULL;
+  }
+  atomic_store_explicit(&entry->resolved, 1, memory_order_release);
+  return entry;
+}
+
+static struct cp_cache_entry* resolve_class_entry(struct interp_thread* thread,
+                                                  struct class_file* class,
+                                                  uint16_t index) {
+  struct cp_cache_entry* entry =
+      find_class_entry(thread->interp, class, index);
+
+  if (entry == NULL) {
+    interp_throw(thread, "java/lang/NoClassDefFoundError");
+  }
+  return entry;
+}
+
+struct cp_cache_entry* interp_resolve_member(struct interp_thread* thread,
+                                             struct class_file* class,
+                                             uint16_t index, int is_field) {
+  struct cp_cache_entry* entry = &class->runtime->cp_cache[index];
+  struct name_and_type_info* name_and_type;
+  struct UTF8_info* name;
+  struct UTF8_info* descriptor;
+  struct class_file* holder;
+  struct cp_info* cp_info;
+
+  if (atomic_load_explicit(&entry->resolved, memory_order_acquire)) {
+    return entry;
+  }
+  name_and_type = constant_member_name_and_type(class, index);
+  if (name_and_type == NULL || get_constant(class, index, &cp_info) != 0) {
+    interp_throw(thread, "java/lang/NoClassDefFoundError");
+    return NULL;
+  }
+  name = validate_constant(class, name_and_type->name_index);
+  descriptor = validate_constant(class, name_and_type->descripror_index);
+  holder = lookup_class(
+      thread->interp, class,
+      constant_class_name(class, cp_info->methodref_info.info.class_index));
+  if (holder == NULL || name == NULL || descriptor == NULL) {
+    interp_throw(thread, "java/lang/NoClassDefFoundError");
+    return NULL;
+  }
+
+  if (is_field) {
+    int32_t field = find_field(&holder, name, descriptor);
+    if (field < 0) {
+      interp_throw(thread, "java/lang/NoSuchFieldError");
+      return NULL;
+    }
+    entry->kind = (char)descriptor->bytes[0];
+    entry->offset =
+        (holder->fields[field].access_flags & ACC_STATIC)
+            ? (uint32_t)field
+            : holder->layout->field_offsets[field];
+  } else {
+    entry->method = find_method(&holder, name, descriptor);
+    if (entry->method == NULL) {
+      interp_throw(thread, "java/lang/NoSuchMethodError");
+      return NULL;
+    }
+  }
+  entry->class = holder;
+  atomic_store_explicit(&entry->resolved, 1, memory_order_release);
+  return entry;
+}
+
+/* Whether instances of `class` are instances of the class named `name` */
+static int is_subclass_of(struct interpreter* interp, struct class_file* class,
+                          const struct UTF8_info* name) {
+  for (; class != NULL; class = class->runtime->super) {
+    uint16_t i;
+
+    if (utf8_equals(class_name_of(class), name)) {
+      return 1;
+    }
+    for (i = 0; i < class->interfaces_count; i++) {
+      struct UTF8_info* interface_name =
+          constant_class_name(class, class->interfaces[i]);
+      struct class_file* interface;
+
+      if (utf8_equals(interface_name, name)) {
+        return 1;
+      }
+      interface = interface_name != NULL
+                      ? lookup_class(interp, class, interface_name)
+                      : NULL;
+      if (interface != NULL && is_subclass_of(interp, interface, name)) {
+        return 1;
+      }
+    }
+  }
+  return utf8_is(name, "java/lang/Object");
+}
+
+/*
+ * checkcast and instanceof, obj is not null. `of` is the class named
+ * `name` when it could be linked, names are compared otherwise
+ */
+static int is_instance_of(struct interpreter* interp,
+                          const struct object_header* obj,
+                          const struct UTF8_info* name,
+                          struct class_file* of) {
+  const struct class_layout* layout = obj->layout;
+
+  if (of != NULL && layout->array_type == 0) {
+    return subtype_of(layout->klass, layout->klass->runtime, of);
+  }
+  if (layout->array_type != 0) {
+    static const char array_names[] = "ZCFDBSIJ";
+    if (utf8_is(name, "java/lang/Object")) {
+      return 1;
+    }
+    if (name->lenght < 2 || name->bytes[0] != '[') {
+      return 0;
+    }
+    if (layout->array_type == T_OBJECT) {
+      return name->bytes[1] == 'L' || name->bytes[1] == '[';
+    }
+    return name->lenght == 2 &&
+           name->bytes[1] == array_names[layout->array_type - T_BOOLEAN];
+  }
+  return is_subclass_of(interp, layout->klass, name);
+}
+
+static int vm_exception_is(const char* thrown, const struct UTF8_info* name) {
+  while (thrown != NULL) {
+    size_t i;
+
+    if (utf8_is(name, thrown)) {
+      return 1;
+    }
+    for (i = 0; i < sizeof(vm_exception_supers) / sizeof(*vm_exception_supers);
+         i++) {
+      if (strcmp(vm_exception_supers[i][0], thrown) == 0) {
+        break;
+      }
+    }
+    thrown = i < sizeof(vm_exception_supers) / sizeof(*vm_exception_supers)
+                 ? vm_exception_supers[i][1]
+                 : NULL;
+  }
+  return 0;
+}
+
+/* Whether the handler catches the pending exception */
+static int catches(struct interp_thread* thread, struct class_file* class,
+                   struct exception_handler* handler) {
+  uint8_t state;
+
+  if (handler->catch_type == 0) {
+    return 1;
+  }
+  if (handler->catch_name == NULL) {
+    return 0;
+  }
+  if (thread->exception == NULL) {
+    return vm_exception_is(thread->exception_class, handler->catch_name);
+  }
+  state = atomic_load_explicit(&handler->state, memory_order_acquire);
+  if (state == HANDLER_UNRESOLVED) {
+    handler->catch_class =
+        lookup_class(thread->interp, class, handler->catch_name);
+    state = handler->catch_class != NULL ? HANDLER_RESOLVED : HANDLER_UNKNOWN;
+    atomic_store_explicit(&handler->state, state, memory_order_release);
+  }
+  /* catch types are classes, never interfaces */
+  if (state == HANDLER_RESOLVED) {
+    struct class_file* thrown = thread->exception->layout->klass;
+    return thrown != NULL &&
+           subtype_of(thrown, thrown->runtime, handler->catch_class);
+  }
+  return is_instance_of(thread->interp, thread->exception,
+                        handler->catch_name, NULL);
+}
+
+/*
+ * Handler for the pending exception at bci, -1 if there is none.
+ * Tries the handlers covering bci in table order
+ */
+static int32_t find_handler(struct interp_thread* thread,
+                            struct class_file* class,
+                            const struct method_runtime* mr, uint32_t bci) {
+  const uint16_t* candidates;
+  uint32_t count;
+  uint32_t i;
+
+  if (mr->handlers == NULL) {
+    return -1;
+  }
+  candidates = handler_table_candidates(mr->handlers, bci, &count);
+  for (i = 0; i < count; i++) {
+    struct exception_handler* handler =
+        &mr->handlers->handlers[candidates[i]];
+    if (catches(thread, class, handler)) {
+      return handler->handler_pc;
+    }
+  }
+  return -1;
+}
+
+/*
+ * Gives an exception thrown by the VM an object when its class can
+ * be loaded, otherwise the handler receives null
+ */
+static void materialize_exception(struct interp_thread* thread,
+                                  struct class_file* from) {
+  struct UTF8_info name;
+  struct class_file* class;
+
+  if (thread->exception != NULL || thread->interp->resolve_class == NULL ||
+      thread->interp->heap == NULL) {
+    return;
+  }
+  name.lenght = (uint16_t)strlen(thread->exception_class);
+  name.bytes = (uint8_t*)thread->exception_class;
+  class = lookup_class(thread->interp, from, &name);
+  if (class != NULL) {
+    thread->exception =
+        heap_new_instance(&thread->interp->heap->eden, class->layout);
+  }
+}
+
+/* Leaves CLASS_INITIALIZING and wakes the threads waiting for it */
+static void finish_init(struct interpreter* interp,
+                        struct class_runtime* runtime, int state) {
+  pthread_mutex_lock(&interp->lock);
+  runtime->init_thread = 0;
+  atomic_store_explicit(&runtime->init_state, state, memory_order_release);
+  pthread_cond_broadcast(&interp->initialized);
+  pthread_mutex_unlock(&interp->lock);
+}
+
+int interp_init_class(struct interp_thread* thread, struct class_file* class) {
+  struct interpreter* interp = thread->interp;
+  struct class_runtime* runtime = class->runtime;
+  struct method_info* clinit;
+  int state;
+  int err;
+
+  if (atomic_load_explicit(&runtime->init_state, memory_order_acquire) ==
+      CLASS_INITIALIZED) {
+    return 0;
+  }
+  pthread_mutex_lock(&interp->lock);
+  while ((state = runtime->init_state) == CLASS_INITIALIZING &&
+         runtime->init_thread != thread->id) {
+    /* the initializing thread may need a safepoint, don't hold it up */
+    safepoint_block();
+    pthread_cond_wait(&interp->initialized, &interp->lock);
+    pthread_mutex_unlock(&interp->lock);
+    safepoint_unblock();
+    pthread_mutex_lock(&interp->lock);
+  }
+  if (state == CLASS_UNINITIALIZED) {
+    runtime->init_state = CLASS_INITIALIZING;
+    runtime->init_thread = thread->id;
+  }
+  pthread_mutex_unlock(&interp->lock);
+  if (state == CLASS_INITIALIZED || state == CLASS_INITIALIZING) {
+    return 0;
+  }
+  if (state == CLASS_INIT_ERROR) {
+    interp_throw(thread, "java/lang/NoClassDefFoundError");
+    return INTERP_EXCEPTION;
+  }
+
+  if (runtime->super != NULL) {
+    err = interp_init_class(thread, runtime->super);
+    if (err != 0) {
+      finish_init(interp, runtime, CLASS_INIT_ERROR);
+      return err;
+    }
+  }
+  clinit = class_find_method(class, "<clinit>", "()V");
+  err = clinit != NULL ? interpret(thread, class, clinit, NULL, NULL) : 0;
+  if (err == INTERP_EXCEPTION) {
+    interp_throw(thread, "java/lang/ExceptionInInitializerError");
+  }
+  finish_init(interp, runtime,
+              err == 0 ? CLASS_INITIALIZED : CLASS_INIT_ERROR);
+  return err;
+}
+
+/* Links and initializes the class, then calls the method */
+int interp_invoke(struct interp_thread* thread, struct class_file* class,
+                  struct method_info* method, const union java_value* args,
+                  union java_value* result) {
+  int err;
+
+  safepoint_enter(&thread->safepoint);
+  err = interp_link_class(thread->interp, class);
+  if (err == 0) {
+    err = interp_init_class(thread, class);
+  }
+  if (err == 0) {
+    err = interpret(thread, class, method, args, result);
+  }
+  safepoint_leave(&thread->safepoint);
+  return err;
+}
+
+static int32_t java_f2i(float f) {
+  if (f != f) {
+    return 0;
+  }
+  if (f >= 2147483647.0f) {
+    return INT32_MAX;
+  }
+  if (f <= -2147483648.0f) {
+    return INT32_MIN;
+  }
+  return (int32_t)f;
+}
+
+static int64_t java_f2l(float f) {
+  if (f != f) {
+    return 0;
+  }
+  if (f >= 9223372036854775807.0f) {
+    return INT64_MAX;
+  }
+  if (f <= -9223372036854775808.0f) {
+    return INT64_MIN;
+  }
+  return (int64_t)f;
+}
+
+static int32_t java_d2i(double d) {
+  if (d != d) {
+    return 0;
+  }
+  if (d >= 2147483647.0) {
+    return INT32_MAX;
+  }
+  if (d <= -2147483648.0) {
+    return INT32_MIN;
+  }
+  return (int32_t)d;
+}
+
+static int64_t java_d2l(double d) {
+  if (d != d) {
+    return 0;
+  }
+  if (d >= 9223372036854775807.0) {
+    return INT64_MAX;
+  }
+  if (d <= -9223372036854775808.0) {
+    return INT64_MIN;
+  }
+  return (int64_t)d;
+}
+
+static int32_t compare_floats(double a, double b, int32_t nan_result) {
+  if (a > b) {
+    return 1;
+  }
+  if (a < b) {
+    return -1;
+  }
+  return a == b ? 0 : nan_result;
+}
+
+static uint16_t read_u2(const uint8_t* p) {
+  return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static int32_t read_s4(const uint8_t* p) {
+  return (int32_t)(((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+                   ((uint32_t)p[2] << 8) | p[3]);
+}
+
+/* Local of an xload or xstore at p, short_form is its xload_0 or xstore_0 */
+static uint8_t local_index(const uint8_t* p, uint8_t short_form) {
+  return opcode_table[p[0]].length == 2 ? p[1] : (uint8_t)(p[0] - short_form);
+}
+
+/* Value of the int push at p: iload, iconst, bipush or sipush */
+static int32_t int_push(const uint8_t* p, const union java_value* locals) {
+  switch (p[0]) {
+    case OP_ILOAD:
+    case OP_ILOAD_0:
+    case OP_ILOAD_1:
+    case OP_ILOAD_2:
+    case OP_ILOAD_3:
+      return locals[local_index(p, OP_ILOAD_0)].i;
+    case OP_BIPUSH:
+      return (int8_t)p[1];
+    case OP_SIPUSH:
+      return (int16_t)read_u2(p + 1);
+    default:
+      return p[0] - OP_ICONST_0;
+  }
+}
+
+/* The int ops of superinstructions, none of them throws */
+static int32_t int_op(uint8_t opcode, int32_t a, int32_t b) {
+  switch (opcode) {
+    case OP_IADD:
+      return (int32_t)((uint32_t)a + (uint32_t)b);
+    case OP_ISUB:
+      return (int32_t)((uint32_t)a - (uint32_t)b);
+    case OP_IMUL:
+      return (int32_t)((uint32_t)a * (uint32_t)b);
+    case OP_IAND:
+      return a & b;
+    case OP_IOR:
+      return a | b;
+    case OP_IXOR:
+      return a ^ b;
+    case OP_ISHL:
+      return (int32_t)((uint32_t)a << (b & 31));
+    case OP_ISHR:
+      return a >> (b & 31);
+    default:
+      return (int32_t)((uint32_t)a >> (b & 31));
+  }
+}
+
+static int int_compare(uint8_t opcode, int32_t a, int32_t b) {
+  switch (opcode) {
+    case OP_IF_ICMPEQ:
+      return a == b;
+    case OP_IF_ICMPNE:
+      return a != b;
+    case OP_IF_ICMPLT:
+      return a < b;
+    case OP_IF_ICMPGE:
+      return a >= b;
+    case OP_IF_ICMPGT:
+      return a > b;
+    default:
+      return a <= b;
+  }
+}
+
+static struct object_header* new_instance(struct interp_thread* thread,
+                                          const struct class_layout* layout) {
+  struct object_header* obj =
+      thread->interp->heap != NULL
+          ? heap_new_instance(&thread->interp->heap->eden, layout)
+          : NULL;
+
+  if (obj == NULL) {
+    interp_throw(thread, "java/lang/OutOfMemoryError");
+  }
+  return obj;
+}
+
+static struct array_header* new_array(struct interp_thread* thread,
+                                      uint8_t array_type, int32_t length) {
+  struct array_header* array;
+
+  if (length < 0) {
+    interp_throw(thread, "java/lang/NegativeArraySizeException");
+    return NULL;
+  }
+  array = thread->interp->heap != NULL
+              ? heap_new_array(&thread->interp->heap->eden,
+                               class_layout_for_array(array_type), length)
+              : NULL;
+  if (array == NULL) {
+    interp_throw(thread, "java/lang/OutOfMemoryError");
+  }
+  return array;
+}
+
+static void store_ref(struct interp_thread* thread, void* slot,
+                      struct object_header* value) {
+  *(struct object_header**)slot = value;
+  if (thread->interp->heap != NULL) {
+    gc_write_barrier(thread->interp->heap, slot);
+  }
+}
+
+static void load_field(union java_value* to, const uint8_t* from, char kind) {
+  switch (kind) {
+    case 'B':
+      to->i = *(const int8_t*)from;
+      break;
+    case 'Z':
+      to->i = *from;
+      break;
+    case 'C':
+      to->i = *(const uint16_t*)from;
+      break;
+    case 'S':
+      to->i = *(const int16_t*)from;
+      break;
+    case 'I':
+      to->i = *(const int32_t*)from;
+      break;
+    case 'F':
+      to->f = *(const float*)from;
+      break;
+    case 'J':
+      to->j = *(const int64_t*)from;
+      break;
+    case 'D':
+      to->d = *(const double*)from;
+      break;
+    default:
+      to->ref = *(struct object_header* const*)from;
+      break;
+  }
+}
+
+static void store_field(struct interp_thread* thread, uint8_t* to,
+                        const union java_value* from, char kind) {
+  switch (kind) {
+    case 'B':
+    case 'Z':
+      *(int8_t*)to = (int8_t)from->i;
+      break;
+    case 'C':
+    case 'S':
+      *(int16_t*)to = (int16_t)from->i;
+      break;
+    case 'I':
+      *(int32_t*)to = from->i;
+      break;
+    case 'F':
+      *(float*)to = from->f;
+      break;
+    case 'J':
+      *(int64_t*)to = from->j;
+      break;
+    case 'D':
+      *(double*)to = from->d;
+      break;
+    default:
+      store_ref(thread, to, from->ref);
+      break;
+  }
+}
+
+/* Method that a virtual call on `receiver` runs */
+static struct method_info* select_method(struct class_file** holder,
+                                         struct method_info* resolved,
+                                         struct object_header* receiver) {
+  struct class_file* class = receiver->layout->klass;
+  struct class_file* resolved_class = *holder;
+
+  if ((resolved->access_flags & (ACC_PRIVATE | ACC_FINAL)) ||
+      receiver->layout->array_type != 0 || class == resolved_class) {
+    return resolved;
+  }
+  *holder = class;
+  return find_method(
+      holder, validate_constant(resolved_class, resolved->name_index),
+      validate_constant(resolved_class, resolved->descriptor_index));
+}
+
+void interp_notify_hot(struct interp_thread* thread, struct class_file* class,
+                       struct method_info* method) {
+  struct interpreter* interp = thread->interp;
+
+  if (interp->hot_method != NULL) {
+    interp->hot_method(thread, class, method, interp->hot_ctx);
+  }
+}
+
+#define PUSH_I(v) ((sp++)->i = (v))
+#define PUSH_F(v) ((sp++)->f = (v))
+#define PUSH_A(v) ((sp++)->ref = (v))
+#define PUSH_J(v) (sp->j = (v), sp += 2)
+#define PUSH_D(v) (sp->d = (v), sp += 2)
+#define POP_I() ((--sp)->i)
+#define POP_F() ((--sp)->f)
+#define POP_A() ((--sp)->ref)
+#define POP_J() ((sp -= 2)->j)
+#define POP_D() ((sp -= 2)->d)
+
+/* Publishes bci and stack depth for the collector and the unwinder */
+#define SYNC() (frame.bci = (uint16_t)bci, \
+                frame.stack_depth = (uint16_t)(sp - stack))
+
+#define THROW(name)          \
+  do {                       \
+    SYNC();                  \
+    interp_throw(thread, name); \
+    goto exception;          \
+  } while (0)
+
+#define NULL_CHECK(ref)                              \
+  do {                                               \
+    if ((ref) == NULL) {                             \
+      THROW("java/lang/NullPointerException");       \
+    }                                                \
+  } while (0)
+
+/* Array element access: pops index and array, checks both */
+#define ARRAY_ACCESS(array, index)                               \
+  do {                                                                 \
+    index = POP_I();                                                   \
+    array = (struct array_header*)POP_A();                             \
+    NULL_CHECK(array);                                                 \
+    if ((uint32_t)index >= array->length) {                            \
+      THROW("java/lang/ArrayIndexOutOfBoundsException");               \
+    }                                                                  \
+  } while (0)
+
+#define ELEMENTS(type, array) ((type*)((array) + 1))
+
+#define BRANCH(condition)                                 \
+  do {                                                    \
+    if (condition) {                                      \
+      next = bci + (int16_t)read_u2(code + bci + 1);      \
+      if (next <= bci) {                                  \
+        goto backedge;                                    \
+      }                                                   \
+    }                                                     \
+  } while (0)
+
+/*
+ * Runs the frame of `method` whose slots are the last ones reserved on
+ * the thread's slot stack from `start` with `depth` operand stack
+ * slots in use, or first looks for a handler of the pending exception
+ * at `start` if `throwing`. The slots are released on return
+ */
+static int execute(struct interp_thread* thread, struct class_file* class,
+                   struct method_info* method, uint32_t start, uint16_t depth,
+                   int throwing, struct object_header* held,
+                   union java_value* result) {
+  struct method_runtime* mr = method_runtime_of(class, method);
+  const struct Code_attribute* attr = method->code;
+  size_t frame_slots = (size_t)attr->max_locals + attr->max_stack;
+  union java_value* locals = thread->slots + thread->slots_used - frame_slots;
+  union java_value* stack = locals + attr->max_locals;
+  /* dispatch on superinstructions, their pieces are read from bytecode */
+  const uint8_t* code = mr->code != NULL ? mr->code : attr->code;
+  const uint8_t* bytecode = attr->code;
+  struct java_frame frame;
+  union java_value* sp = stack + depth;
+  uint32_t bci = start;
+  uint32_t next;
+  int err = 0;
+
+  thread->depth++;
+  frame.caller = thread->top;
+  frame.class = class;
+  frame.method = method;
+  frame.bci = (uint16_t)start;
+  frame.stack_depth = depth;
+  frame.locals = locals;
+  frame.stack = stack;
+  frame.lock = held;
+  thread->top = &frame;
+  if (held == NULL && (method->access_flags & ACC_SYNCHRONIZED)) {
+    struct object_header* lock = (method->access_flags & ACC_STATIC)
+                                     ? &class->runtime->lock
+                                     : locals[0].ref;
+
+    if (monitor_enter(thread, lock) != 0) {
+      interp_throw(thread, "java/lang/OutOfMemoryError");
+      err = INTERP_EXCEPTION;
+      goto out;
+    }
+    frame.lock = lock;
+  }
+  if (throwing) {
+    goto exception;
+  }
+
+  for (;;) {
+    uint8_t opcode = code[bci];
+    next = bci + (uint32_t)opcode_table[opcode].length;
+
+    switch (opcode) {
+      case OP_NOP:
+        break;
+      case OP_ACONST_NULL:
+        PUSH_A(NULL);
+        break;
+      case OP_ICONST_M1:
+      case OP_ICONST_0:
+      case OP_ICONST_1:
+      case OP_ICONST_2:
+      case OP_ICONST_3:
+      case OP_ICONST_4:
+      case OP_ICONST_5:
+        PUSH_I(opcode - OP_ICONST_0);
+        break;
+      case OP_LCONST_0:
+      case OP_LCONST_1:
+        PUSH_J(opcode - OP_LCONST_0);
+        break;
+      case OP_FCONST_0:
+      case OP_FCONST_1:
+      case OP_FCONST_2:
+        PUSH_F((float)(opcode - OP_FCONST_0));
+        break;
+      case OP_DCONST_0:
+      case OP_DCONST_1:
+        PUSH_D((double)(opcode - OP_DCONST_0));
+        break;
+      case OP_BIPUSH:
+        PUSH_I((int8_t)code[bci + 1]);
+        break;
+      case OP_SIPUSH:
+        PUSH_I((int16_t)read_u2(code + bci + 1));
+        break;
+      case OP_LDC:
+      case OP_LDC_W:
+      case OP_LDC2_W: {
+        uint16_t index =
+            opcode == OP_LDC ? code[bci + 1] : read_u2(code + bci + 1);
+        struct cp_info* cp_info;
+
+        if (get_constant(class, index, &cp_info) != 0) {
+          err = EINVAL;
+          goto out;
+        }
+        switch (cp_info->tag) {
+          case INTEGER:
+            PUSH_I((int32_t)cp_info->integer_info.info.bytes);
+            break;
+          case FLOAT: {
+            float f;
+            memcpy(&f, &cp_info->float_info.info.bytes, sizeof(f));
+            PUSH_F(f);
+            break;
+          }
+          case LONG:
+          case DOUBLE: {
+            uint64_t bits =
+                ((uint64_t)cp_info->long_info.info.high_bytes << 32) |
+                cp_info->long_info.info.low_bytes;
+            memcpy(&sp->j, &bits, sizeof(bits));
+            sp += 2;
+            break;
+          }
+          case DYNAMIC: {
+            union java_value value;
+
+            SYNC();
+            err = bootstrap_resolve_constant(thread, class, index, &value);
+            if (err == INTERP_EXCEPTION) {
+              goto exception;
+            }
+            if (err != 0) {
+              goto out;
+            }
+            *sp = value;
+            sp += opcode == OP_LDC2_W ? 2 : 1;
+            break;
+          }
+          default:
+            printf("ERROR: ldc of constant tag %d is not supported\n",
+                   cp_info->tag);
+            err = ENOTSUP;
+            goto out;
+        }
+        break;
+      }
+
+      case OP_ILOAD:
+      case OP_FLOAD:
+      case OP_ALOAD:
+        *sp++ = locals[code[bci + 1]];
+        break;
+      case OP_LLOAD:
+      case OP_DLOAD:
+        *sp = locals[code[bci + 1]];
+        sp += 2;
+        break;
+      case OP_ILOAD_0:
+      case OP_ILOAD_1:
+      case OP_ILOAD_2:
+      case OP_ILOAD_3:
+        *sp++ = locals[opcode - OP_ILOAD_0];
+        break;
+      case OP_LLOAD_0:
+      case OP_LLOAD_1:
+      case OP_LLOAD_2:
+      case OP_LLOAD_3:
+        *sp = locals[opcode - OP_LLOAD_0];
+        sp += 2;
+        break;
+      case OP_FLOAD_0:
+      case OP_FLOAD_1:
+      case OP_FLOAD_2:
+      case OP_FLOAD_3:
+        *sp++ = locals[opcode - OP_FLOAD_0];
+        break;
+      case OP_DLOAD_0:
+      case OP_DLOAD_1:
+      case OP_DLOAD_2:
+      case OP_DLOAD_3:
+        *sp = locals[opcode - OP_DLOAD_0];
+        sp += 2;
+        break;
+      case OP_ALOAD_0:
+      case OP_ALOAD_1:
+      case OP_ALOAD_2:
+      case OP_ALOAD_3:
+        *sp++ = locals[opcode - OP_ALOAD_0];
+        break;
+
+      case OP_ISTORE:
+      case OP_FSTORE:
+      case OP_ASTORE:
+        locals[code[bci + 1]] = *--sp;
+        break;
+      case OP_LSTORE:
+      case OP_DSTORE:
+        sp -= 2;
+        locals[code[bci + 1]] = *sp;
+        break;
+      case OP_ISTORE_0:
+      case OP_ISTORE_1:
+      case OP_ISTORE_2:
+      case OP_ISTORE_3:
+        locals[opcode - OP_ISTORE_0] = *--sp;
+        break;
+      case OP_LSTORE_0:
+      case OP_LSTORE_1:
+      case OP_LSTORE_2:
+      case OP_LSTORE_3:
+        sp -= 2;
+        locals[opcode - OP_LSTORE_0] = *sp;
+        break;
+      case OP_FSTORE_0:
+      case OP_FSTORE_1:
+      case OP_FSTORE_2:
+      case OP_FSTORE_3:
+        locals[opcode - OP_FSTORE_0] = *--sp;
+        break;
+      case OP_DSTORE_0:
+      case OP_DSTORE_1:
+      case OP_DSTORE_2:
+      case OP_DSTORE_3:
+        sp -= 2;
+        locals[opcode - OP_DSTORE_0] = *sp;
+        break;
+      case OP_ASTORE_0:
+      case OP_ASTORE_1:
+      case OP_ASTORE_2:
+      case OP_ASTORE_3:
+        locals[opcode - OP_ASTORE_0] = *--sp;
+        break;
+
+      case OP_IALOAD:
+      case OP_FALOAD:
+      case OP_BALOAD:
+      case OP_CALOAD:
+      case OP_SALOAD:
+      case OP_LALOAD:
+      case OP_DALOAD:
+      case OP_AALOAD: {
+        struct array_header* array;
+        int32_t index;
+
+        ARRAY_ACCESS(array, index);
+        switch (opcode) {
+          case OP_IALOAD:
+            PUSH_I(ELEMENTS(int32_t, array)[index]);
+            break;
+          case OP_FALOAD:
+            PUSH_F(ELEMENTS(float, array)[index]);
+            break;
+          case OP_BALOAD:
+            PUSH_I(ELEMENTS(int8_t, array)[index]);
+            break;
+          case OP_CALOAD:
+            PUSH_I(ELEMENTS(uint16_t, array)[index]);
+            break;
+          case OP_SALOAD:
+            PUSH_I(ELEMENTS(int16_t, array)[index]);
+            break;
+          case OP_LALOAD:
+            PUSH_J(ELEMENTS(int64_t, array)[index]);
+            break;
+          case OP_DALOAD:
+            PUSH_D(ELEMENTS(double, array)[index]);
+            break;
+          default:
+            PUSH_A(ELEMENTS(struct object_header*, array)[index]);
+            break;
+        }
+        break;
+      }
+      case OP_IASTORE:
+      case OP_FASTORE:
+      case OP_BASTORE:
+      case OP_CASTORE:
+      case OP_SASTORE:
+      case OP_AASTORE: {
+        union java_value value = *--sp;
+        struct array_header* array;
+        int32_t index;
+
+        ARRAY_ACCESS(array, index);
+        switch (opcode) {
+          case OP_IASTORE:
+            ELEMENTS(int32_t, array)[index] = value.i;
+            break;
+          case OP_FASTORE:
+            ELEMENTS(float, array)[index] = value.f;
+            break;
+          case OP_BASTORE:
+            ELEMENTS(int8_t, array)[index] = (int8_t)value.i;
+            break;
+          case OP_CASTORE:
+          case OP_SASTORE:
+            ELEMENTS(int16_t, array)[index] = (int16_t)value.i;
+            break;
+          default:
+            /* element types of reference arrays are not tracked */
+            store_ref(thread, &ELEMENTS(struct object_header*, array)[index],
+                      value.ref);
+            break;
+        }
+        break;
+      }
+      case OP_LASTORE:
+      case OP_DASTORE: {
+        union java_value value;
+        struct array_header* array;
+        int32_t index;
+
+        sp -= 2;
+        value = *sp;
+        ARRAY_ACCESS(array, index);
+        ELEMENTS(int64_t, array)[index] = value.j;
+        break;
+      }
+
+      case OP_POP:
+        sp--;
+        break;
+      case OP_POP2:
+        sp -= 2;
+        break;
+      case OP_DUP:
+        sp[0] = sp[-1];
+        sp++;
+        break;
+      case OP_DUP_X1:
+        sp[0] = sp[-1];
+        sp[-1] = sp[-2];
+        sp[-2] = sp[0];
+        sp++;
+        break;
+      case OP_DUP_X2:
+        sp[0] = sp[-1];
+        sp[-1] = sp[-2];
+        sp[-2] = sp[-3];
+        sp[-3] = sp[0];
+        sp++;
+        break;
+      case OP_DUP2:
+        sp[0] = sp[-2];
+        sp[1] = sp[-1];
+        sp += 2;
+        break;
+      case OP_DUP2_X1:
+        sp[1] = sp[-1];
+        sp[0] = sp[-2];
+        sp[-1] = sp[-3];
+        sp[-2] = sp[1];
+        sp[-3] = sp[0];
+        sp += 2;
+        break;
+      case OP_DUP2_X2:
+        sp[1] = sp[-1];
+        sp[0] = sp[-2];
+        sp[-1] = sp[-3];
+        sp[-2] = sp[-4];
+        sp[-3] = sp[1];
+        sp[-4] = sp[0];
+        sp += 2;
+        break;
+      case OP_SWAP: {
+        union java_value top = sp[-1];
+        sp[-1] = sp[-2];
+        sp[-2] = top;
+        break;
+      }
+
+      case OP_IADD: {
+        int32_t b = POP_I();
+        sp[-1].i = (int32_t)((uint32_t)sp[-1].i + (uint32_t)b);
+        break;
+      }
+      case OP_ISUB: {
+        int32_t b = POP_I();
+        sp[-1].i = (int32_t)((uint32_t)sp[-1].i - (uint32_t)b);
+        break;
+      }
+      case OP_IMUL: {
+        int32_t b = POP_I();
+        sp[-1].i = (int32_t)((uint32_t)sp[-1].i * (uint32_t)b);
+        break;
+      }
+      case OP_IDIV:
+      case OP_IREM: {
+        int32_t b = POP_I();
+        int32_t a = POP_I();
+        if (b == 0) {
+          SYNC();
+          THROW("java/lang/ArithmeticException");
+        }
+        if (b == -1) {
+          PUSH_I(opcode == OP_IDIV ? (int32_t)(0u - (uint32_t)a) : 0);
+        } else {
+          PUSH_I(opcode == OP_IDIV ? a / b : a % b);
+        }
+        break;
+      }
+      case OP_INEG:
+        sp[-1].i = (int32_t)(0u - (uint32_t)sp[-1].i);
+        break;
+      case OP_ISHL: {
+        int32_t b = POP_I();
+        sp[-1].i = (int32_t)((uint32_t)sp[-1].i << (b & 31));
+        break;
+      }
+      case OP_ISHR: {
+        int32_t b = POP_I();
+        sp[-1].i >>= (b & 31);
+        break;
+      }
+      case OP_IUSHR: {
+        int32_t b = POP_I();
+        sp[-1].i = (int32_t)((uint32_t)sp[-1].i >> (b & 31));
+        break;
+      }
+      case OP_IAND: {
+        int32_t b = POP_I();
+        sp[-1].i &= b;
+        break;
+      }
+      case OP_IOR: {
+        int32_t b = POP_I();
+        sp[-1].i |= b;
+        break;
+      }
+      case OP_IXOR: {
+        int32_t b = POP_I();
+        sp[-1].i ^= b;
+        break;
+      }
+
+      case OP_LADD: {
+        int64_t b = POP_J();
+        sp[-2].j = (int64_t)((uint64_t)sp[-2].j + (uint64_t)b);
+        break;
+      }
+      case OP_LSUB: {
+        int64_t b = POP_J();
+        sp[-2].j = (int64_t)((uint64_t)sp[-2].j - (uint64_t)b);
+        break;
+      }
+      case OP_LMUL: {
+        int64_t b = POP_J();
+        sp[-2].j = (int64_t)((uint64_t)sp[-2].j * (uint64_t)b);
+        break;
+      }
+      case OP_LDIV:
+      case OP_LREM: {
+        int64_t b = POP_J();
+        int64_t a = POP_J();
+        if (b == 0) {
+          SYNC();
+          THROW("java/lang/ArithmeticException");
+        }
+        if (b == -1) {
+          PUSH_J(opcode == OP_LDIV ? (int64_t)(0u - (uint64_t)a) : 0);
+        } else {
+          PUSH_J(opcode == OP_LDIV ? a / b : a % b);
+        }
+        break;
+      }
+      case OP_LNEG:
+        sp[-2].j = (int64_t)(0u - (uint64_t)sp[-2].j);
+        break;
+      case OP_LSHL: {
+        int32_t b = POP_I();
+        sp[-2].j = (int64_t)((uint64_t)sp[-2].j << (b & 63));
+        break;
+      }
+      case OP_LSHR: {
+        int32_t b = POP_I();
+        sp[-2].j >>= (b & 63);
+        break;
+      }
+      case OP_LUSHR: {
+        int32_t b = POP_I();
+        sp[-2].j = (int64_t)((uint64_t)sp[-2].j >> (b & 63));
+        break;
+      }
+      case OP_LAND: {
+        int64_t b = POP_J();
+        sp[-2].j &= b;
+        break;
+      }
+      case OP_LOR: {
+        int64_t b = POP_J();
+        sp[-2].j |= b;
+        break;
+      }
+      case OP_LXOR: {
+        int64_t b = POP_J();
+        sp[-2].j ^= b;
+        break;
+      }
+
+      case OP_FADD: {
+        float b = POP_F();
+        sp[-1].f += b;
+        break;
+      }
+      case OP_FSUB: {
+        float b = POP_F();
+        sp[-1].f -= b;
+        break;
+      }
+      case OP_FMUL: {
+        float b = POP_F();
+        sp[-1].f *= b;
+        break;
+      }
+      case OP_FDIV: {
+        float b = POP_F();
+        sp[-1].f /= b;
+        break;
+      }
+      case OP_FREM: {
+        float b = POP_F();
+        sp[-1].f = fmodf(sp[-1].f, b);
+        break;
+      }
+      case OP_FNEG:
+        sp[-1].f = -sp[-1].f;
+        break;
+      case OP_DADD: {
+        double b = POP_D();
+        sp[-2].d += b;
+        break;
+      }
+      case OP_DSUB: {
+        double b = POP_D();
+        sp[-2].d -= b;
+        break;
+      }
+      case OP_DMUL: {
+        double b = POP_D();
+        sp[-2].d *= b;
+        break;
+      }
+      case OP_DDIV: {
+        double b = POP_D();
+        sp[-2].d /= b;
+        break;
+      }
+      case OP_DREM: {
+        double b = POP_D();
+        sp[-2].d = fmod(sp[-2].d, b);
+        break;
+      }
+      case OP_DNEG:
+        sp[-2].d = -sp[-2].d;
+        break;
+
+      case OP_IINC:
+        locals[code[bci + 1]].i = (int32_t)((uint32_t)locals[code[bci + 1]].i +
+                                            (uint32_t)(int8_t)code[bci + 2]);
+        break;
+
+      case OP_I2L: {
+        int32_t a = POP_I();
+        PUSH_J(a);
+        break;
+      }
+      case OP_I2F:
+        sp[-1].f = (float)sp[-1].i;
+        break;
+      case OP_I2D: {
+        int32_t a = POP_I();
+        PUSH_D(a);
+        break;
+      }
+      case OP_L2I: {
+        int64_t a = POP_J();
+        PUSH_I((int32_t)a);
+        break;
+      }
+      case OP_L2F: {
+        int64_t a = POP_J();
+        PUSH_F((float)a);
+        break;
+      }
+      case OP_L2D:
+        sp[-2].d = (double)sp[-2].j;
+        break;
+      case OP_F2I:
+        sp[-1].i = java_f2i(sp[-1].f);
+        break;
+      case OP_F2L: {
+        float a = POP_F();
+        PUSH_J(java_f2l(a));
+        break;
+      }
+      case OP_F2D: {
+        float a = POP_F();
+        PUSH_D(a);
+        break;
+      }
+      case OP_D2I: {
+        double a = POP_D();
+        PUSH_I(java_d2i(a));
+        break;
+      }
+      case OP_D2L:
+        sp[-2].j = java_d2l(sp[-2].d);
+        break;
+      case OP_D2F: {
+        double a = POP_D();
+        PUSH_F((float)a);
+        break;
+      }
+      case OP_I2B:
+        sp[-1].i = (int8_t)sp[-1].i;
+        break;
+      case OP_I2C:
+        sp[-1].i = (uint16_t)sp[-1].i;
+        break;
+      case OP_I2S:
+        sp[-1].i = (int16_t)sp[-1].i;
+        break;
+
+      case OP_LCMP: {
+        int64_t b = POP_J();
+        int64_t a = POP_J();
+        PUSH_I(a > b ? 1 : a < b ? -1 : 0);
+        break;
+      }
+      case OP_FCMPL:
+      case OP_FCMPG: {
+        float b = POP_F();
+        float a = POP_F();
+        PUSH_I(compare_floats(a, b, opcode == OP_FCMPG ? 1 : -1));
+        break;
+      }
+      case OP_DCMPL:
+      case OP_DCMPG: {
+        double b = POP_D();
+        double a = POP_D();
+        PUSH_I(compare_floats(a, b, opcode == OP_DCMPG ? 1 : -1));
+        break;
+      }
+
+      case OP_IFEQ:
+        BRANCH(POP_I() == 0);
+        break;
+      case OP_IFNE:
+        BRANCH(POP_I() != 0);
+        break;
+      case OP_IFLT:
+        BRANCH(POP_I() < 0);
+        break;
+      case OP_IFGE:
+        BRANCH(POP_I() >= 0);
+        break;
+      case OP_IFGT:
+        BRANCH(POP_I() > 0);
+        break;
+      case OP_IFLE:
+        BRANCH(POP_I() <= 0);
+        break;
+      case OP_IF_ICMPEQ:
+        sp -= 2;
+        BRANCH(sp[0].i == sp[1].i);
+        break;
+      case OP_IF_ICMPNE:
+        sp -= 2;
+        BRANCH(sp[0].i != sp[1].i);
+        break;
+      case OP_IF_ICMPLT:
+        sp -= 2;
+        BRANCH(sp[0].i < sp[1].i);
+        break;
+      case OP_IF_ICMPGE:
+        sp -= 2;
+        BRANCH(sp[0].i >= sp[1].i);
+        break;
+      case OP_IF_ICMPGT:
+        sp -= 2;
+        BRANCH(sp[0].i > sp[1].i);
+        break;
+      case OP_IF_ICMPLE:
+        sp -= 2;
+        BRANCH(sp[0].i <= sp[1].i);
+        break;
+      case OP_IF_ACMPEQ:
+        sp -= 2;
+        BRANCH(sp[0].ref == sp[1].ref);
+        break;
+      case OP_IF_ACMPNE:
+        sp -= 2;
+        BRANCH(sp[0].ref != sp[1].ref);
+        break;
+      case OP_IFNULL:
+        BRANCH(POP_A() == NULL);
+        break;
+      case OP_IFNONNULL:
+        BRANCH(POP_A() != NULL);
+        break;
+      case OP_GOTO:
+        BRANCH(1);
+        break;
+      case OP_GOTO_W:
+        next = bci + (uint32_t)read_s4(code + bci + 1);
+        if (next <= bci) {
+          goto backedge;
+        }
+        break;
+
+      case OP_TABLESWITCH:
+      case OP_LOOKUPSWITCH: {
+        const uint8_t* p = code + ((bci + 4) & ~3u);
+        int32_t key = POP_I();
+        int32_t offset = read_s4(p);
+
+        if (opcode == OP_TABLESWITCH) {
+          int32_t low = read_s4(p + 4);
+          int32_t high = read_s4(p + 8);
+          if (key >= low && key <= high) {
+            offset = read_s4(p + 12 + 4 * (size_t)((int64_t)key - low));
+          }
+        } else {
+          int32_t count = read_s4(p + 4);
+          int32_t lo = 0;
+          int32_t hi = count - 1;
+          while (lo <= hi) {
+            int32_t middle = lo + (hi - lo) / 2;
+            int32_t match = read_s4(p + 8 + 8 * (size_t)middle);
+            if (match == key) {
+              offset = read_s4(p + 12 + 8 * (size_t)middle);
+              break;
+            }
+            if (match < key) {
+              lo = middle + 1;
+            } else {
+              hi = middle - 1;
+            }
+          }
+        }
+        next = bci + (uint32_t)offset;
+        if (next <= bci) {
+          goto backedge;
+        }
+        break;
+      }
+
+      case OP_IRETURN:
+      case OP_FRETURN:
+      case OP_ARETURN:
+        SYNC();
+        SAFEPOINT_POLL();
+        if (result != NULL) {
+          *result = sp[-1];
+        }
+        goto out;
+      case OP_LRETURN:
+      case OP_DRETURN:
+        SYNC();
+        SAFEPOINT_POLL();
+        if (result != NULL) {
+          *result = sp[-2];
+        }
+        goto out;
+      case OP_RETURN:
+        SYNC();
+        SAFEPOINT_POLL();
+        goto out;
+
+      case OP_GETSTATIC:
+      case OP_PUTSTATIC:
+      case OP_GETFIELD:
+      case OP_PUTFIELD:
+      field_access: {
+        struct cp_cache_entry* entry;
+        int is_static = opcode == OP_GETSTATIC || opcode == OP_PUTSTATIC;
+        int wide;
+
+        SYNC();
+        entry =
+            interp_resolve_member(thread, class, read_u2(code + bci + 1), 1);
+        if (entry == NULL) {
+          goto exception;
+        }
+        wide = entry->kind == 'J' || entry->kind == 'D';
+        if (is_static) {
+          union java_value* slot = &entry->class->runtime->statics[entry->offset];
+          if (interp_init_class(thread, entry->class) != 0) {
+            goto exception;
+          }
+          if (opcode == OP_GETSTATIC) {
+            *sp = *slot;
+            sp += 1 + wide;
+          } else {
+            sp -= 1 + wide;
+            /* statics are roots, not heap slots, so no card to dirty */
+            *slot = *sp;
+          }
+        } else if (opcode == OP_GETFIELD) {
+          struct object_header* obj = POP_A();
+          NULL_CHECK(obj);
+          load_field(sp, (const uint8_t*)obj + entry->offset, entry->kind);
+          sp += 1 + wide;
+        } else {
+          union java_value value;
+          struct object_header* obj;
+
+          sp -= 1 + wide;
+          value = *sp;
+          obj = POP_A();
+          NULL_CHECK(obj);
+          store_field(thread, (uint8_t*)obj + entry->offset, &value,
+                      entry->kind);
+        }
+        break;
+      }
+
+      case OP_INVOKEVIRTUAL:
+      case OP_INVOKESPECIAL:
+      case OP_INVOKESTATIC:
+      case OP_INVOKEINTERFACE:
+      case OP_INVOKEDYNAMIC: {
+        struct class_file* holder;
+        struct method_info* callee;
+        struct method_runtime* callee_runtime;
+        union java_value value;
+
+        SYNC();
+        if (opcode == OP_INVOKEDYNAMIC) {
+          /* the interpreter copy has the site's index after the operand */
+          struct call_site* site = &mr->sites[read_u2(code + bci + 3)];
+
+          if (atomic_load_explicit(&site->state, memory_order_acquire) !=
+              CALL_SITE_LINKED) {
+            err = bootstrap_link_site(thread, class, site,
+                                      read_u2(code + bci + 1));
+            if (err == INTERP_EXCEPTION) {
+              goto exception;
+            }
+            if (err != 0) {
+              goto out;
+            }
+          }
+          holder = site->class;
+          callee = site->method;
+        } else {
+          struct cp_cache_entry* entry =
+              interp_resolve_member(thread, class, read_u2(code + bci + 1), 0);
+          if (entry == NULL) {
+            goto exception;
+          }
+          holder = entry->class;
+          callee = entry->method;
+        }
+        callee_runtime = method_runtime_of(holder, callee);
+        sp -= callee_runtime->arg_slots;
+
+        if (opcode == OP_INVOKESTATIC || opcode == OP_INVOKEDYNAMIC) {
+          if (interp_init_class(thread, holder) != 0) {
+            goto exception;
+          }
+        } else {
+          NULL_CHECK(sp[0].ref);
+          if (opcode != OP_INVOKESPECIAL) {
+            callee = select_method(&holder, callee, sp[0].ref);
+            if (callee == NULL) {
+              THROW("java/lang/AbstractMethodError");
+            }
+          }
+        }
+
+        /* arguments stay below sp, the callee copies them */
+        frame.stack_depth = (uint16_t)(sp - stack + callee_runtime->arg_slots);
+        err = interpret(thread, holder, callee, sp, &value);
+        if (err == INTERP_EXCEPTION) {
+          goto exception;
+        }
+        if (err != 0) {
+          goto out;
+        }
+        switch (callee_runtime->ret) {
+          case 'V':
+            break;
+          case 'J':
+          case 'D':
+            *sp = value;
+            sp += 2;
+            break;
+          default:
+            *sp++ = value;
+            break;
+        }
+        break;
+      }
+
+      case OP_NEW: {
+        struct cp_cache_entry* entry;
+        struct object_header* obj;
+
+        SYNC();
+        entry = resolve_class_entry(thread, class, read_u2(code + bci + 1));
+        if (entry == NULL || interp_init_class(thread, entry->class) != 0) {
+          goto exception;
+        }
+        obj = new_instance(thread, entry->class->layout);
+        if (obj == NULL) {
+          goto exception;
+        }
+        PUSH_A(obj);
+        break;
+      }
+      case OP_NEWARRAY:
+      case OP_ANEWARRAY: {
+        struct array_header* array;
+
+        SYNC();
+        if (opcode == OP_ANEWARRAY &&
+            resolve_class_entry(thread, class, read_u2(code + bci + 1)) ==
+                NULL) {
+          goto exception;
+        }
+        array = new_array(thread,
+                          opcode == OP_NEWARRAY ? code[bci + 1] : T_OBJECT,
+                          sp[-1].i);
+        if (array == NULL) {
+          goto exception;
+        }
+        sp[-1].ref = &array->header;
+        break;
+      }
+      case OP_ARRAYLENGTH: {
+        struct array_header* array = (struct array_header*)POP_A();
+        NULL_CHECK(array);
+        PUSH_I((int32_t)array->length);
+        break;
+      }
+
+      case OP_ATHROW: {
+        struct object_header* obj = POP_A();
+
+        SYNC();
+        NULL_CHECK(obj);
+        interp_throw(thread, "java/lang/Throwable");
+        thread->exception = obj;
+        goto exception;
+      }
+
+      case OP_MONITORENTER:
+      case OP_MONITOREXIT: {
+        struct object_header* obj = POP_A();
+
+        SYNC();
+        NULL_CHECK(obj);
+        if (opcode == OP_MONITORENTER) {
+          if (monitor_enter(thread, obj) != 0) {
+            THROW("java/lang/OutOfMemoryError");
+          }
+        } else if (monitor_exit(thread, obj) != 0) {
+          THROW("java/lang/IllegalMonitorStateException");
+        }
+        break;
+      }
+
+      case OP_CHECKCAST:
+      case OP_INSTANCEOF: {
+        struct object_header* obj = sp[-1].ref;
+        struct cp_cache_entry* entry;
+        struct UTF8_info* name;
+        int matches;
+
+        if (obj == NULL) {
+          if (opcode == OP_INSTANCEOF) {
+            sp[-1].i = 0;
+          }
+          break;
+        }
+        SYNC();
+        name = constant_class_name(class, read_u2(code + bci + 1));
+        if (name == NULL) {
+          err = EINVAL;
+          goto out;
+        }
+        entry = name->lenght != 0 && name->bytes[0] != '['
+                    ? find_class_entry(thread->interp, class,
+                                       read_u2(code + bci + 1))
+                    : NULL;
+        matches = is_instance_of(thread->interp, obj, name,
+                                 entry != NULL ? entry->class : NULL);
+        if (opcode == OP_INSTANCEOF) {
+          sp[-1].i = matches;
+        } else if (!matches) {
+          THROW("java/lang/ClassCastException");
+        }
+        break;
+      }
+
+      case OP_WIDE: {
+        uint8_t widened = code[bci + 1];
+        uint16_t index = read_u2(code + bci + 2);
+
+        next = bci + (widened == OP_IINC ? 6 : 4);
+        switch (widened) {
+          case OP_ILOAD:
+          case OP_FLOAD:
+          case OP_ALOAD:
+            *sp++ = locals[index];
+            break;
+          case OP_LLOAD:
+          case OP_DLOAD:
+            *sp = locals[index];
+            sp += 2;
+            break;
+          case OP_ISTORE:
+          case OP_FSTORE:
+          case OP_ASTORE:
+            locals[index] = *--sp;
+            break;
+          case OP_LSTORE:
+          case OP_DSTORE:
+            sp -= 2;
+            locals[index] = *sp;
+            break;
+          case OP_IINC:
+            locals[index].i =
+                (int32_t)((uint32_t)locals[index].i +
+                          (uint32_t)(int16_t)read_u2(code + bci + 4));
+            break;
+          default:
+            err = EINVAL;
+            goto out;
+        }
+        break;
+      }
+
+      case OP_LOAD_PUSH_IOP_STORE:
+      case OP_LOAD_PUSH_IOP: {
+        const uint8_t* p = bytecode + bci;
+        uint32_t push = (uint32_t)opcode_table[p[0]].length;
+        uint32_t op = push + (uint32_t)opcode_table[p[push]].length;
+        int32_t value = int_op(p[op], int_push(p, locals),
+                               int_push(p + push, locals));
+
+        next = bci + op + 1;
+        if (opcode == OP_LOAD_PUSH_IOP) {
+          PUSH_I(value);
+        } else {
+          locals[local_index(bytecode + next, OP_ISTORE_0)].i = value;
+          next += (uint32_t)opcode_table[bytecode[next]].length;
+        }
+        break;
+      }
+      case OP_LOAD_PUSH_IF: {
+        const uint8_t* p = bytecode + bci;
+        uint32_t push = (uint32_t)opcode_table[p[0]].length;
+        int32_t a = int_push(p, locals);
+        int32_t b = int_push(p + push, locals);
+
+        bci += push + (uint32_t)opcode_table[p[push]].length;
+        next = bci + 3;
+        BRANCH(int_compare(bytecode[bci], a, b));
+        break;
+      }
+      case OP_PUSH_IOP: {
+        const uint8_t* p = bytecode + bci;
+        uint32_t op = (uint32_t)opcode_table[p[0]].length;
+
+        sp[-1].i = int_op(p[op], sp[-1].i, int_push(p, locals));
+        next = bci + op + 1;
+        break;
+      }
+      case OP_IOP_STORE: {
+        int32_t b = POP_I();
+        int32_t a = POP_I();
+
+        locals[local_index(bytecode + bci + 1, OP_ISTORE_0)].i =
+            int_op(bytecode[bci], a, b);
+        next = bci + 1 + (uint32_t)opcode_table[bytecode[bci + 1]].length;
+        break;
+      }
+      case OP_ALOAD_GETFIELD:
+        *sp++ = locals[local_index(bytecode + bci, OP_ALOAD_0)];
+        bci += (uint32_t)opcode_table[bytecode[bci]].length;
+        opcode = OP_GETFIELD;
+        next = bci + 3;
+        goto field_access;
+      case OP_IINC_GOTO:
+        locals[code[bci + 1]].i = (int32_t)((uint32_t)locals[code[bci + 1]].i +
+                                            (uint32_t)(int8_t)code[bci + 2]);
+        bci += 3;
+        BRANCH(1);
+        break;
+
+      default:
+        printf("ERROR: unsupported opcode %s at %u\n",
+               opcode_table[opcode].name ? opcode_table[opcode].name : "?",
+               bci);
+        err = ENOTSUP;
+        goto out;
+    }
+    bci = next;
+    continue;
+
+  backedge: {
+    struct interpreter* interp = thread->interp;
+    uint32_t count =
+        atomic_fetch_add_explicit(&mr->backedges, 1, memory_order_relaxed) + 1;
+    struct osr_entry* osr;
+    compiled_entry code;
+
+    /* the frame stops at the branch, which has an oop map entry */
+    SYNC();
+    SAFEPOINT_POLL();
+    bci = next;
+    if (count == interp->hot_backedges) {
+      interp_notify_hot(thread, class, method);
+    }
+    if (count == interp->osr_backedges && interp->hot_loop != NULL) {
+      SYNC();
+      interp->hot_loop(thread, class, method, bci, interp->hot_ctx);
+    }
+    osr = atomic_load_explicit(&mr->osr, memory_order_acquire);
+    code = NULL;
+    for (; osr != NULL && code == NULL; osr = osr->next) {
+      code = osr->bci == bci ? atomic_load_explicit(&osr->code,
+                                                    memory_order_acquire)
+                             : NULL;
+    }
+    if (code != NULL) {
+      /* locals and operand stack are contiguous, the code takes both */
+      int64_t value;
+
+      SYNC();
+      thread->stats.osr_entries++;
+      value = code(thread, locals);
+      if (thread->exception_class != NULL) {
+        err = INTERP_EXCEPTION;
+      } else if (result != NULL) {
+        result->j = value;
+      }
+      goto out;
+    }
+    continue;
+  }
+
+  exception: {
+    int32_t handler = find_handler(thread, class, mr, bci);
+
+    if (handler < 0) {
+      err = INTERP_EXCEPTION;
+      goto out;
+    }
+    /* a callee that threw left its result in err */
+    err = 0;
+    bci = (uint32_t)handler;
+    sp = stack;
+    SYNC();
+    materialize_exception(thread, class);
+    PUSH_A(thread->exception);
+    interp_clear_exception(thread);
+    continue;
+  }
+  }
+
+out:
+  if (frame.lock != NULL && monitor_exit(thread, frame.lock) != 0 &&
+      err == 0) {
+    interp_throw(thread, "java/lang/IllegalMonitorStateException");
+    err = INTERP_EXCEPTION;
+  }
+  thread->top = frame.caller;
+  thread->slots_used -= frame_slots;
+  thread->depth--;
+  return err;
+}
+
+/*
+ * Runs one method in a new frame. args holds arg_slots values laid
+ * out as on the operand stack, result may be NULL for void methods.
+ * The class must be linked and initialized
+ */
+int interpret(struct interp_thread* thread, struct class_file* class,
+              struct method_info* method, const union java_value* args,
+              union java_value* result) {
+  struct method_runtime* mr = method_runtime_of(class, method);
+  const struct Code_attribute* attr = method->code;
+  compiled_entry entry;
+  size_t frame_slots;
+
+  thread->stats.invocations++;
+  /* compiled code counts its own invocations if it counts at all */
+  entry = atomic_load_explicit(&mr->entry, memory_order_acquire);
+  if (entry == NULL &&
+      atomic_fetch_add_explicit(&mr->invocations, 1, memory_order_relaxed) +
+              1 ==
+          thread->interp->hot_invocations) {
+    interp_notify_hot(thread, class, method);
+    entry = atomic_load_explicit(&mr->entry, memory_order_acquire);
+  }
+  if (entry != NULL) {
+    int64_t value;
+
+    thread->stats.compiled_calls++;
+    value = entry(thread, (union java_value*)args);
+    if (thread->exception_class != NULL) {
+      return INTERP_EXCEPTION;
+    }
+    if (result != NULL) {
+      result->j = value;
+    }
+    return 0;
+  }
+
+  if (attr == NULL) {
+    /* abstract, or native without a registered function */
+    interp_throw(thread, method->access_flags & ACC_ABSTRACT
+                             ? "java/lang/AbstractMethodError"
+                             : "java/lang/UnsatisfiedLinkError");
+    return INTERP_EXCEPTION;
+  }
+
+  frame_slots = (size_t)attr->max_locals + attr->max_stack;
+  if (thread->depth >= INTERP_MAX_DEPTH ||
+      thread->slots_capacity - thread->slots_used < frame_slots) {
+    interp_throw(thread, "java/lang/StackOverflowError");
+    return INTERP_EXCEPTION;
+  }
+  if (mr->arg_slots != 0) {
+    memcpy(thread->slots + thread->slots_used, args,
+           mr->arg_slots * sizeof(union java_value));
+  }
+  thread->slots_used += frame_slots;
+  return execute(thread, class, method, 0, 0, 0, NULL, result);
+}
+
+int interp_resume(struct interp_thread* thread, struct class_file* class,
+                  struct method_info* method, uint32_t bci, uint16_t depth,
+                  struct object_header* lock, union java_value* result) {
+  return execute(thread, class, method, bci, depth,
+                 thread->exception_class != NULL, lock, result);
+}
@@ -0,0 +1,676 @@
+#include "intrinsics.h"
+
+#include <errno.h>
+#include <immintrin.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+
+#include "attribute_info.h"
+#include "class_layout.h"
+#include "constant_pool.h"
+#include "descriptor.h"
+#include "gc.h"
+
+/* Loops over array elements, one set per instruction set */
+struct simd_ops {
+  const char* isa;
+  /* pattern holds the element repeated over 8 bytes */
+  void (*fill)(uint8_t* to, uint64_t pattern, size_t size);
+  uint32_t (*hash8)(const uint8_t* chars, uint32_t count);
+  uint32_t (*hash16)(const uint16_t* chars, uint32_t count);
+};
+
+/* Fields of java/lang/String, UINT32_MAX when missing */
+struct string_fields {
+  uint32_t value;
+  uint32_t coder;
+  uint32_t hash;
+  char kind; /* 'C' for char[] values, 'B' for byte[] ones */
+};
+
+static pthread_once_t select_once = PTHREAD_ONCE_INIT;
+static _Atomic(const struct simd_ops*) ops;
+/* written while String links, before its methods get their entries */
+static struct string_fields string_fields;
+
+static uint8_t* elements(struct array_header* array) {
+  return (uint8_t*)(array + 1);
+}
+
+static struct array_header* array_of(struct object_header* obj) {
+  return (struct array_header*)obj;
+}
+
+/* h = 31 * h + c over the chars, as String.hashCode does */
+static uint32_t hash8_scalar(const uint8_t* chars, uint32_t count) {
+  uint32_t h = 0;
+  uint32_t i;
+
+  for (i = 0; i < count; i++) {
+    h = 31 * h + chars[i];
+  }
+  return h;
+}
+
+static uint32_t hash16_scalar(const uint16_t* chars, uint32_t count) {
+  uint32_t h = 0;
+  uint32_t i;
+
+  for (i = 0; i < count; i++) {
+    h = 31 * h + chars[i];
+  }
+  return h;
+}
+
+static void fill_tail(uint8_t* to, uint64_t pattern, size_t from,
+                      size_t size) {
+  size_t i;
+
+  for (i = from; i < size; i++) {
+    to[i] = (uint8_t)(pattern >> (8 * (i & 7)));
+  }
+}
+
+static void fill_scalar(uint8_t* to, uint64_t pattern, size_t size) {
+  size_t i;
+
+  for (i = 0; i + 8 <= size; i += 8) {
+    memcpy(to + i, &pattern, 8);
+  }
+  fill_tail(to, pattern, i, size);
+}
+
+/*
+ * The vector hashes keep one partial hash per lane: each block of
+ * lanes multiplies them by 31^lanes and adds its chars, the lanes
+ * are then combined with the powers of 31 they still lack
+ */
+static const uint32_t powers_of_31[8] = {
+    31u * 31 * 31 * 31 * 31 * 31 * 31, 31u * 31 * 31 * 31 * 31 * 31,
+    31u * 31 * 31 * 31 * 31,           31u * 31 * 31 * 31,
+    31u * 31 * 31,                     31u * 31,
+    31u,                               1u,
+};
+
+__attribute__((target("avx2"))) static uint32_t combine8(__m256i acc) {
+  uint32_t lanes[8];
+  uint32_t h = 0;
+  uint32_t i;
+
+  _mm256_storeu_si256((__m256i*)lanes, acc);
+  for (i = 0; i < 8; i++) {
+    h += lanes[i] * powers_of_31[i];
+  }
+  return h;
+}
+
+/*
+ * Four accumulators take 32 chars a step so the multiplies of one
+ * don't wait for the other, each lane then lacks 31^24, 31^16, 31^8
+ * or nothing on top of its combine8() power
+ */
+#define POW31_8 (31u * 31 * 31 * 31 * 31 * 31 * 31 * 31)
+
+__attribute__((target("avx2"))) static uint32_t combine32(__m256i acc[4]) {
+  uint32_t h = 0;
+  int j;
+
+  for (j = 0; j < 4; j++) {
+    h = h * POW31_8 + combine8(acc[j]);
+  }
+  return h;
+}
+
+__attribute__((target("avx2"))) static uint32_t hash8_avx2(
+    const uint8_t* chars, uint32_t count) {
+  const __m256i step = _mm256_set1_epi32(
+      (int)(POW31_8 * POW31_8 * POW31_8 * POW31_8));
+  __m256i acc[4] = {_mm256_setzero_si256(), _mm256_setzero_si256(),
+                    _mm256_setzero_si256(), _mm256_setzero_si256()};
+  uint32_t h;
+  uint32_t i;
+  int j;
+
+  for (i = 0; i + 32 <= count; i += 32) {
+    for (j = 0; j < 4; j++) {
+      __m128i bytes = _mm_loadl_epi64((const __m128i*)(chars + i + 8 * j));
+      acc[j] = _mm256_add_epi32(_mm256_mullo_epi32(acc[j], step),
+                                _mm256_cvtepu8_epi32(bytes));
+    }
+  }
+  h = combine32(acc);
+  for (; i + 8 <= count; i += 8) {
+    __m128i bytes = _mm_loadl_epi64((const __m128i*)(chars + i));
+    h = h * POW31_8 + combine8(_mm256_cvtepu8_epi32(bytes));
+  }
+  for (; i < count; i++) {
+    h = 31 * h + chars[i];
+  }
+  return h;
+}
+
+__attribute__((target("avx2"))) static uint32_t hash16_avx2(
+    const uint16_t* chars, uint32_t count) {
+  const __m256i step = _mm256_set1_epi32(
+      (int)(POW31_8 * POW31_8 * POW31_8 * POW31_8));
+  __m256i acc[4] = {_mm256_setzero_si256(), _mm256_setzero_si256(),
+                    _mm256_setzero_si256(), _mm256_setzero_si256()};
+  uint32_t h;
+  uint32_t i;
+  int j;
+
+  for (i = 0; i + 32 <= count; i += 32) {
+    for (j = 0; j < 4; j++) {
+      __m128i units = _mm_loadu_si128((const __m128i*)(chars + i + 8 * j));
+      acc[j] = _mm256_add_epi32(_mm256_mullo_epi32(acc[j], step),
+                                _mm256_cvtepu16_epi32(units));
+    }
+  }
+  h = combine32(acc);
+  for (; i + 8 <= count; i += 8) {
+    __m128i units = _mm_loadu_si128((const __m128i*)(chars + i));
+    h = h * POW31_8 + combine8(_mm256_cvtepu16_epi32(units));
+  }
+  for (; i < count; i++) {
+    h = 31 * h + chars[i];
+  }
+  return h;
+}
+
+__attribute__((target("avx2"))) static void fill_avx2(uint8_t* to,
+                                                     uint64_t pattern,
+                                                     size_t size) {
+  __m256i v = _mm256_set1_epi64x((long long)pattern);
+  size_t i;
+
+  for (i = 0; i + 32 <= size; i += 32) {
+    _mm256_storeu_si256((__m256i*)(to + i), v);
+  }
+  fill_tail(to, pattern, i, size);
+}
+
+__attribute__((target("sse4.2"))) static uint32_t combine4(__m128i acc) {
+  uint32_t lanes[4];
+  uint32_t h = 0;
+  uint32_t i;
+
+  _mm_storeu_si128((__m128i*)lanes, acc);
+  for (i = 0; i < 4; i++) {
+    h += lanes[i] * powers_of_31[4 + i];
+  }
+  return h;
+}
+
+__attribute__((target("sse4.2"))) static uint32_t hash8_sse(
+    const uint8_t* chars, uint32_t count) {
+  const __m128i step = _mm_set1_epi32((int)(31u * 31 * 31 * 31));
+  __m128i acc = _mm_setzero_si128();
+  uint32_t h;
+  uint32_t i;
+
+  for (i = 0; i + 4 <= count; i += 4) {
+    int32_t bytes;
+    memcpy(&bytes, chars + i, 4);
+    acc = _mm_add_epi32(_mm_mullo_epi32(acc, step),
+                        _mm_cvtepu8_epi32(_mm_cvtsi32_si128(bytes)));
+  }
+  h = combine4(acc);
+  for (; i < count; i++) {
+    h = 31 * h + chars[i];
+  }
+  return h;
+}
+
+__attribute__((target("sse4.2"))) static uint32_t hash16_sse(
+    const uint16_t* chars, uint32_t count) {
+  const __m128i step = _mm_set1_epi32((int)(31u * 31 * 31 * 31));
+  __m128i acc = _mm_setzero_si128();
+  uint32_t h;
+  uint32_t i;
+
+  for (i = 0; i + 4 <= count; i += 4) {
+    __m128i units = _mm_loadl_epi64((const __m128i*)(chars + i));
+    acc = _mm_add_epi32(_mm_mullo_epi32(acc, step),
+                        _mm_cvtepu16_epi32(units));
+  }
+  h = combine4(acc);
+  for (; i < count; i++) {
+    h = 31 * h + chars[i];
+  }
+  return h;
+}
+
+__attribute__((target("sse4.2"))) static void fill_sse(uint8_t* to,
+                                                      uint64_t pattern,
+                                                      size_t size) {
+  __m128i v = _mm_set1_epi64x((long long)pattern);
+  size_t i;
+
+  for (i = 0; i + 16 <= size; i += 16) {
+    _mm_storeu_si128((__m128i*)(to + i), v);
+  }
+  fill_tail(to, pattern, i, size);
+}
+
+static const struct simd_ops avx2_ops = {
+    "avx2", fill_avx2, hash8_avx2, hash16_avx2,
+};
+static const struct simd_ops sse_ops = {
+    "sse4.2", fill_sse, hash8_sse, hash16_sse,
+};
+static const struct simd_ops scalar_ops = {
+    "scalar", fill_scalar, hash8_scalar, hash16_scalar,
+};
+
+static void select_ops(void) {
+  const struct simd_ops* best = &scalar_ops;
+
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    best = &avx2_ops;
+  } else if (__builtin_cpu_supports("sse4.2")) {
+    best = &sse_ops;
+  }
+  atomic_store(&ops, best);
+}
+
+int intrinsic_use_isa(const char* isa) {
+  const struct simd_ops* chosen;
+
+  pthread_once(&select_once, select_ops);
+  if (strcmp(isa, "avx2") == 0 && __builtin_cpu_supports("avx2")) {
+    chosen = &avx2_ops;
+  } else if (strcmp(isa, "sse4.2") == 0 && __builtin_cpu_supports("sse4.2")) {
+    chosen = &sse_ops;
+  } else if (strcmp(isa, "scalar") == 0) {
+    chosen = &scalar_ops;
+  } else {
+    return ENOTSUP;
+  }
+  atomic_store(&ops, chosen);
+  return 0;
+}
+
+const char* intrinsic_isa(void) {
+  pthread_once(&select_once, select_ops);
+  return atomic_load(&ops)->isa;
+}
+
+static const struct simd_ops* simd(void) {
+  return atomic_load_explicit(&ops, memory_order_relaxed);
+}
+
+/* Result bits as compiled code returns them */
+static int64_t double_result(double value) {
+  union java_value v;
+
+  v.d = value;
+  return v.j;
+}
+
+static void dirty_cards(struct interp_thread* thread, uint8_t* from,
+                        size_t size) {
+  struct gc_heap* gh = thread->interp->heap;
+  uintptr_t first;
+  uintptr_t last;
+
+  if (gh == NULL || size == 0) {
+    return;
+  }
+  first = (uintptr_t)from >> CARD_SHIFT;
+  last = ((uintptr_t)from + size - 1) >> CARD_SHIFT;
+  memset(&gh->card_base[first], CARD_DIRTY, last - first + 1);
+}
+
+/* Element repeated over 8 bytes */
+static uint64_t repeat(uint64_t value, uint32_t size) {
+  switch (size) {
+    case 1:
+      return (value & 0xff) * 0x0101010101010101ull;
+    case 2:
+      return (value & 0xffff) * 0x0001000100010001ull;
+    case 4:
+      return (value & 0xffffffff) * 0x0000000100000001ull;
+    default:
+      return value;
+  }
+}
+
+/* System.arraycopy(Object src, int srcPos, Object dest, int destPos, int length) */
+static int64_t array_copy(struct interp_thread* thread,
+                          union java_value* args) {
+  struct array_header* src = array_of(args[0].ref);
+  struct array_header* dest = array_of(args[2].ref);
+  int32_t src_pos = args[1].i;
+  int32_t dest_pos = args[3].i;
+  int32_t length = args[4].i;
+  const struct class_layout* layout;
+  size_t size;
+
+  if (src == NULL || dest == NULL) {
+    interp_throw(thread, "java/lang/NullPointerException");
+    return 0;
+  }
+  layout = src->header.layout;
+  if (layout->array_type == 0 ||
+      dest->header.layout->array_type != layout->array_type) {
+    interp_throw(thread, "java/lang/ArrayStoreException");
+    return 0;
+  }
+  if (src_pos < 0 || dest_pos < 0 || length < 0 ||
+      (uint32_t)src_pos + (uint32_t)length > src->length ||
+      (uint32_t)dest_pos + (uint32_t)length > dest->length) {
+    interp_throw(thread, "java/lang/ArrayIndexOutOfBoundsException");
+    return 0;
+  }
+  size = layout->element_size;
+  /* libc picks its own vector code and handles the overlap */
+  memmove(elements(dest) + (size_t)dest_pos * size,
+          elements(src) + (size_t)src_pos * size, (size_t)length * size);
+  if (layout->array_type == T_OBJECT) {
+    dirty_cards(thread, elements(dest) + (size_t)dest_pos * size,
+                (size_t)length * size);
+  }
+  return 0;
+}
+
+/* Arrays.fill(T[] a, T value) of every element type */
+static int64_t array_fill(struct interp_thread* thread,
+                          union java_value* args) {
+  struct array_header* array = array_of(args[0].ref);
+  uint32_t size;
+
+  if (array == NULL) {
+    interp_throw(thread, "java/lang/NullPointerException");
+    return 0;
+  }
+  size = array->header.layout->element_size;
+  simd()->fill(elements(array), repeat((uint64_t)args[1].j, size),
+               (size_t)array->length * size);
+  if (array->header.layout->array_type == T_OBJECT) {
+    dirty_cards(thread, elements(array), (size_t)array->length * size);
+  }
+  return 0;
+}
+
+/*
+ * Arrays.equals(T[] a, T[] b) of integral element types. The libc
+ * memcmp already compares with the widest vectors
+ */
+static int64_t array_equals(struct interp_thread* thread,
+                            union java_value* args) {
+  struct array_header* a = array_of(args[0].ref);
+  struct array_header* b = array_of(args[1].ref);
+
+  (void)thread;
+  if (a == b) {
+    return 1;
+  }
+  if (a == NULL || b == NULL || a->length != b->length) {
+    return 0;
+  }
+  return memcmp(elements(a), elements(b),
+                (size_t)a->length * a->header.layout->element_size) == 0;
+}
+
+static struct array_header* string_value(struct object_header* string) {
+  return *(struct array_header**)((uint8_t*)string + string_fields.value);
+}
+
+static int string_utf16(struct object_header* string) {
+  return string_fields.kind == 'C' ||
+         (string_fields.coder != UINT32_MAX &&
+          *((uint8_t*)string + string_fields.coder) != 0);
+}
+
+static int64_t string_equals(struct interp_thread* thread,
+                             union java_value* args) {
+  struct object_header* self = args[0].ref;
+  struct object_header* other = args[1].ref;
+  struct array_header* a;
+  struct array_header* b;
+
+  (void)thread;
+  if (self == other) {
+    return 1;
+  }
+  /* String is final, anything else has another layout */
+  if (other == NULL || other->layout != self->layout ||
+      string_utf16(self) != string_utf16(other)) {
+    return 0;
+  }
+  a = string_value(self);
+  b = string_value(other);
+  if (a == b) {
+    return 1;
+  }
+  if (a == NULL || b == NULL || a->length != b->length) {
+    return 0;
+  }
+  return memcmp(elements(a), elements(b),
+                (size_t)a->length * a->header.layout->element_size) == 0;
+}
+
+static int64_t string_hash(struct interp_thread* thread,
+                           union java_value* args) {
+  struct object_header* self = args[0].ref;
+  int32_t* cached = string_fields.hash != UINT32_MAX
+                        ? (int32_t*)((uint8_t*)self + string_fields.hash)
+                        : NULL;
+  struct array_header* value;
+  uint32_t h;
+
+  (void)thread;
+  if (cached != NULL && *cached != 0) {
+    return *cached;
+  }
+  value = string_value(self);
+  if (value == NULL) {
+    return 0;
+  }
+  if (!string_utf16(self)) {
+    h = simd()->hash8(elements(value), value->length);
+  } else {
+    /* a UTF-16 byte[] holds two bytes per char in native order */
+    h = simd()->hash16(
+        (const uint16_t*)elements(value),
+        string_fields.kind == 'C' ? value->length : value->length / 2);
+  }
+  if (cached != NULL) {
+    *cached = (int32_t)h;
+  }
+  return (int32_t)h;
+}
+
+static int64_t math_abs_int(struct interp_thread* thread,
+                            union java_value* args) {
+  (void)thread;
+  return (int32_t)(args[0].i < 0 ? 0u - (uint32_t)args[0].i
+                                 : (uint32_t)args[0].i);
+}
+
+static int64_t math_abs_long(struct interp_thread* thread,
+                             union java_value* args) {
+  (void)thread;
+  return (int64_t)(args[0].j < 0 ? 0u - (uint64_t)args[0].j
+                                 : (uint64_t)args[0].j);
+}
+
+/* abs of a float or double clears the sign bit, NaNs included */
+static int64_t math_abs_float(struct interp_thread* thread,
+                              union java_value* args) {
+  (void)thread;
+  return (int64_t)((uint32_t)args[0].i & 0x7fffffffu);
+}
+
+static int64_t math_abs_double(struct interp_thread* thread,
+                               union java_value* args) {
+  (void)thread;
+  return args[0].j & INT64_MAX;
+}
+
+static int64_t math_min_int(struct interp_thread* thread,
+                            union java_value* args) {
+  (void)thread;
+  return args[0].i < args[1].i ? args[0].i : args[1].i;
+}
+
+static int64_t math_max_int(struct interp_thread* thread,
+                            union java_value* args) {
+  (void)thread;
+  return args[0].i > args[1].i ? args[0].i : args[1].i;
+}
+
+/* a long takes two argument slots */
+static int64_t math_min_long(struct interp_thread* thread,
+                             union java_value* args) {
+  (void)thread;
+  return args[0].j < args[2].j ? args[0].j : args[2].j;
+}
+
+static int64_t math_max_long(struct interp_thread* thread,
+                             union java_value* args) {
+  (void)thread;
+  return args[0].j > args[2].j ? args[0].j : args[2].j;
+}
+
+static int64_t math_sqrt(struct interp_thread* thread,
+                         union java_value* args) {
+  (void)thread;
+  return double_result(sqrt(args[0].d));
+}
+
+static int64_t math_floor(struct interp_thread* thread,
+                          union java_value* args) {
+  (void)thread;
+  return double_result(floor(args[0].d));
+}
+
+static int64_t math_ceil(struct interp_thread* thread,
+                         union java_value* args) {
+  (void)thread;
+  return double_result(ceil(args[0].d));
+}
+
+struct intrinsic {
+  const char* class_name;
+  const char* name;
+  const char* descriptor;
+  compiled_entry entry;
+};
+
+static const struct intrinsic intrinsics[] = {
+    {"java/lang/System", "arraycopy",
+     "(Ljava/lang/Object;ILjava/lang/Object;II)V", array_copy},
+
+    {"java/util/Arrays", "fill", "([ZZ)V", array_fill},
+    {"java/util/Arrays", "fill", "([BB)V", array_fill},
+    {"java/util/Arrays", "fill", "([CC)V", array_fill},
+    {"java/util/Arrays", "fill", "([SS)V", array_fill},
+    {"java/util/Arrays", "fill", "([II)V", array_fill},
+    {"java/util/Arrays", "fill", "([JJ)V", array_fill},
+    {"java/util/Arrays", "fill", "([FF)V", array_fill},
+    {"java/util/Arrays", "fill", "([DD)V", array_fill},
+    {"java/util/Arrays", "fill", "([Ljava/lang/Object;Ljava/lang/Object;)V",
+     array_fill},
+
+    /* float and double arrays compare NaNs by value, they stay Java */
+    {"java/util/Arrays", "equals", "([Z[Z)Z", array_equals},
+    {"java/util/Arrays", "equals", "([B[B)Z", array_equals},
+    {"java/util/Arrays", "equals", "([C[C)Z", array_equals},
+    {"java/util/Arrays", "equals", "([S[S)Z", array_equals},
+    {"java/util/Arrays", "equals", "([I[I)Z", array_equals},
+    {"java/util/Arrays", "equals", "([J[J)Z", array_equals},
+
+    {"java/lang/String", "equals", "(Ljava/lang/Object;)Z", string_equals},
+    {"java/lang/String", "hashCode", "()I", string_hash},
+
+    {"java/lang/Math", "abs", "(I)I", math_abs_int},
+    {"java/lang/Math", "abs", "(J)J", math_abs_long},
+    {"java/lang/Math", "abs", "(F)F", math_abs_float},
+    {"java/lang/Math", "abs", "(D)D", math_abs_double},
+    {"java/lang/Math", "min", "(II)I", math_min_int},
+    {"java/lang/Math", "max", "(II)I", math_max_int},
+    {"java/lang/Math", "min", "(JJ)J", math_min_long},
+    {"java/lang/Math", "max", "(JJ)J", math_max_long},
+    {"java/lang/Math", "sqrt", "(D)D", math_sqrt},
+    {"java/lang/Math", "floor", "(D)D", math_floor},
+    {"java/lang/Math", "ceil", "(D)D", math_ceil},
+};
+
+static int utf8_is_str(const struct UTF8_info* utf8, const char* str) {
+  size_t length = strlen(str);
+  return utf8 != NULL && utf8->lenght == length &&
+         memcmp(utf8->bytes, str, length) == 0;
+}
+
+/* Finds the fields the string intrinsics read, 0 without a value */
+static int find_string_fields(struct class_file* class) {
+  struct string_fields fields = {UINT32_MAX, UINT32_MAX, UINT32_MAX, 0};
+  uint16_t i;
+
+  if (class->layout == NULL) {
+    return 0;
+  }
+  for (i = 0; i < class->fields_count && i < class->layout->fields_count;
+       i++) {
+    struct UTF8_info* name = validate_constant(class, class->fields[i].name_index);
+    struct UTF8_info* descriptor =
+        validate_constant(class, class->fields[i].descriptor_index);
+    uint32_t offset = class->layout->field_offsets[i];
+
+    if (class->fields[i].access_flags & ACC_STATIC) {
+      continue;
+    }
+    if (utf8_is_str(name, "value") && (utf8_is_str(descriptor, "[C") ||
+                                       utf8_is_str(descriptor, "[B"))) {
+      fields.value = offset;
+      fields.kind = (char)descriptor->bytes[1];
+    } else if (utf8_is_str(name, "coder") && utf8_is_str(descriptor, "B")) {
+      fields.coder = offset;
+    } else if (utf8_is_str(name, "hash") && utf8_is_str(descriptor, "I")) {
+      fields.hash = offset;
+    }
+  }
+  if (fields.value == UINT32_MAX) {
+    return 0;
+  }
+  string_fields = fields;
+  return 1;
+}
+
+compiled_entry intrinsic_bind(struct class_file* class,
+                              struct method_info* method) {
+  struct UTF8_info* class_name = constant_class_name(class, class->this_class);
+  struct UTF8_info* name = validate_constant(class, method->name_index);
+  struct UTF8_info* descriptor =
+      validate_constant(class, method->descriptor_index);
+  size_t i;
+
+  if (class_name == NULL || name == NULL || descriptor == NULL) {
+    return NULL;
+  }
+  for (i = 0; i < sizeof(intrinsics) / sizeof(*intrinsics); i++) {
+    const struct intrinsic* in = &intrinsics[i];
+
+    if (!utf8_is_str(class_name, in->class_name) ||
+        !utf8_is_str(name, in->name) ||
+        !utf8_is_str(descriptor, in->descriptor)) {
+      continue;
+    }
+    /* the descriptor settles whether the method is static */
+    if ((strcmp(in->class_name, "java/lang/String") == 0) ==
+        ((method->access_flags & ACC_STATIC) != 0)) {
+      return NULL;
+    }
+    if (strcmp(in->class_name, "java/lang/String") == 0 &&
+        !find_string_fields(class)) {
+      return NULL;
+    }
+    pthread_once(&select_once, select_ops);
+    return in->entry;
+  }
+  return NULL;
+}
@@ -0,0 +1,434 @@
+#include "ir.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Makes room for `needed` elements, sets func->error on failure */
+static int reserve(struct ir_function* func, void** data, uint32_t* capacity,
+                   uint32_t needed, size_t size) {
+  uint32_t new_capacity;
+  void* grown;
+
+  if (needed <= *capacity) {
+    return 0;
+  }
+  new_capacity = *capacity != 0 ? *capacity : 16;
+  while (new_capacity < needed) {
+    new_capacity *= 2;
+  }
+  grown = realloc(*data, (size_t)new_capacity * size);
+  if (grown == NULL) {
+    func->error = ENOMEM;
+    return ENOMEM;
+  }
+  *data = grown;
+  *capacity = new_capacity;
+  return 0;
+}
+
+void ir_init(struct ir_function* func, struct class_file* class,
+             struct method_info* method) {
+  memset(func, 0, sizeof(*func));
+  func->class = class;
+  func->method = method;
+  func->entry = IR_NONE;
+  func->osr_bci = IR_NONE;
+}
+
+void ir_destroy(struct ir_function* func) {
+  uint32_t i;
+
+  for (i = 0; i < func->block_count; i++) {
+    free(func->blocks[i].instrs);
+    free(func->blocks[i].preds);
+    free(func->blocks[i].defs);
+    free(func->blocks[i].incomplete);
+  }
+  free(func->blocks);
+  free(func->instrs);
+  free(func->operands);
+  free(func->order);
+  free(func->states);
+  for (i = 0; i < func->object_count; i++) {
+    free(func->objects[i].offsets);
+  }
+  free(func->objects);
+  free(func->sites);
+  deopt_table_free(func->deopt);
+  cha_dependencies_free(func->dependencies);
+  memset(func, 0, sizeof(*func));
+}
+
+uint32_t ir_new_block(struct ir_function* func) {
+  struct ir_block* block;
+
+  if (reserve(func, (void**)&func->blocks, &func->block_capacity,
+              func->block_count + 1, sizeof(struct ir_block)) != 0) {
+    return IR_NONE;
+  }
+  block = &func->blocks[func->block_count];
+  memset(block, 0, sizeof(*block));
+  block->idom = IR_NONE;
+  block->order = IR_NONE;
+  block->loop_header = IR_NONE;
+  block->state = IR_NONE;
+  return func->block_count++;
+}
+
+static int is_terminator(uint8_t op) {
+  return op == IR_IF || op == IR_GOTO || op == IR_RETURN;
+}
+
+/* Inserts `id` at `position` of the block's instruction list */
+static void insert_at(struct ir_function* func, uint32_t block, uint32_t at,
+                      uint32_t id) {
+  struct ir_block* b = &func->blocks[block];
+
+  if (reserve(func, (void**)&b->instrs, &b->instr_capacity,
+              b->instr_count + 1, sizeof(uint32_t)) != 0) {
+    return;
+  }
+  memmove(b->instrs + at + 1, b->instrs + at,
+          (b->instr_count - at) * sizeof(uint32_t));
+  b->instrs[at] = id;
+  b->instr_count++;
+  func->instrs[id].block = block;
+}
+
+void ir_append(struct ir_function* func, uint32_t block, uint32_t id) {
+  struct ir_block* b = &func->blocks[block];
+  uint32_t at = b->instr_count;
+
+  if (at > 0 && is_terminator(func->instrs[b->instrs[at - 1]].op) &&
+      !is_terminator(func->instrs[id].op)) {
+    at--;
+  }
+  insert_at(func, block, at, id);
+}
+
+uint32_t ir_emit(struct ir_function* func, uint32_t block, uint8_t op,
+                 char type, int32_t imm, const uint32_t* args,
+                 uint16_t arg_count) {
+  struct ir_instr* instr;
+  uint32_t id;
+
+  if (func->error != 0 ||
+      reserve(func, (void**)&func->instrs, &func->instr_capacity,
+              func->instr_count + 1, sizeof(struct ir_instr)) != 0 ||
+      reserve(func, (void**)&func->operands, &func->operand_capacity,
+              func->operand_count + arg_count, sizeof(uint32_t)) != 0) {
+    return IR_NONE;
+  }
+  id = func->instr_count++;
+  instr = &func->instrs[id];
+  memset(instr, 0, sizeof(*instr));
+  instr->op = op;
+  instr->type = type;
+  instr->block = block;
+  instr->imm = imm;
+  instr->args = func->operand_count;
+  instr->arg_count = arg_count;
+  instr->forward = IR_NONE;
+  instr->state = IR_NONE;
+  if (arg_count > 0) {
+    memcpy(func->operands + func->operand_count, args,
+           arg_count * sizeof(uint32_t));
+    func->operand_count += arg_count;
+  }
+  if (block != IR_NONE) {
+    ir_append(func, block, id);
+  }
+  return id;
+}
+
+uint32_t ir_new_phi(struct ir_function* func, uint32_t block, char type) {
+  struct ir_block* b = &func->blocks[block];
+  uint32_t id = ir_emit(func, IR_NONE, IR_PHI, type, 0, NULL, 0);
+  uint32_t at = 0;
+
+  if (id == IR_NONE) {
+    return IR_NONE;
+  }
+  while (at < b->instr_count && func->instrs[b->instrs[at]].op == IR_PHI) {
+    at++;
+  }
+  insert_at(func, block, at, id);
+  return id;
+}
+
+void ir_set_phi_operands(struct ir_function* func, uint32_t phi,
+                         const uint32_t* values) {
+  struct ir_instr* instr = &func->instrs[phi];
+  uint32_t count = func->blocks[instr->block].pred_count;
+
+  if (reserve(func, (void**)&func->operands, &func->operand_capacity,
+              func->operand_count + count, sizeof(uint32_t)) != 0) {
+    return;
+  }
+  instr->args = func->operand_count;
+  instr->arg_count = (uint16_t)count;
+  memcpy(func->operands + func->operand_count, values,
+         count * sizeof(uint32_t));
+  func->operand_count += count;
+}
+
+void ir_add_edge(struct ir_function* func, uint32_t from, uint32_t to) {
+  struct ir_block* source = &func->blocks[from];
+  struct ir_block* target = &func->blocks[to];
+
+  if (reserve(func, (void**)&target->preds, &target->pred_capacity,
+              target->pred_count + 1, sizeof(uint32_t)) != 0) {
+    return;
+  }
+  target->preds[target->pred_count++] = from;
+  source->succs[source->succ_count++] = to;
+}
+
+void ir_remove_from_block(struct ir_function* func, uint32_t id) {
+  struct ir_block* b = &func->blocks[func->instrs[id].block];
+  uint32_t i;
+
+  for (i = 0; i < b->instr_count; i++) {
+    if (b->instrs[i] == id) {
+      memmove(b->instrs + i, b->instrs + i + 1,
+              (b->instr_count - i - 1) * sizeof(uint32_t));
+      b->instr_count--;
+      return;
+    }
+  }
+}
+
+void ir_replace(struct ir_function* func, uint32_t id, uint32_t by) {
+  by = ir_resolve(func, by);
+  if (by != id) {
+    func->instrs[id].forward = by;
+  }
+}
+
+uint32_t ir_resolve(const struct ir_function* func, uint32_t id) {
+  while (id != IR_NONE && func->instrs[id].forward != IR_NONE) {
+    id = func->instrs[id].forward;
+  }
+  return id;
+}
+
+uint32_t ir_arg(const struct ir_function* func, const struct ir_instr* instr,
+                uint16_t index) {
+  return ir_resolve(func, func->operands[instr->args + index]);
+}
+
+uint32_t ir_new_state(struct ir_function* func, uint32_t caller,
+                      struct class_file* class, struct method_info* method,
+                      uint16_t bci, const uint32_t* values,
+                      uint16_t local_count, uint16_t stack_count,
+                      uint16_t object_values) {
+  uint32_t count = (uint32_t)local_count + stack_count + object_values;
+  struct ir_state* state;
+
+  if (func->error != 0 ||
+      reserve(func, (void**)&func->states, &func->state_capacity,
+              func->state_count + 1, sizeof(struct ir_state)) != 0 ||
+      reserve(func, (void**)&func->operands, &func->operand_capacity,
+              func->operand_count + count, sizeof(uint32_t)) != 0) {
+    return IR_NONE;
+  }
+  state = &func->states[func->state_count];
+  state->caller = caller;
+  state->class = class;
+  state->method = method;
+  state->bci = bci;
+  state->local_count = local_count;
+  state->stack_count = stack_count;
+  state->object_values = object_values;
+  state->values = func->operand_count;
+  if (count > 0) {
+    memcpy(func->operands + func->operand_count, values,
+           count * sizeof(uint32_t));
+    func->operand_count += count;
+  }
+  return func->state_count++;
+}
+
+uint32_t ir_state_size(const struct ir_state* state) {
+  return (uint32_t)state->local_count + state->stack_count +
+         state->object_values;
+}
+
+int ir_is_const(const struct ir_function* func, uint32_t id, int32_t* value) {
+  const struct ir_instr* instr = &func->instrs[ir_resolve(func, id)];
+
+  if (instr->op != IR_CONST) {
+    return 0;
+  }
+  if (value != NULL) {
+    *value = instr->imm;
+  }
+  return 1;
+}
+
+static void postorder(struct ir_function* func, uint32_t* post,
+                      uint32_t* count, uint32_t* stack, uint8_t* next) {
+  uint32_t depth = 0;
+
+  stack[depth++] = func->entry;
+  next[func->entry] = 1;
+  while (depth > 0) {
+    uint32_t top = stack[depth - 1];
+    struct ir_block* b = &func->blocks[top];
+    uint8_t k = (uint8_t)(next[top] - 1);
+
+    if (k < b->succ_count) {
+      uint32_t succ = b->succs[k];
+      next[top]++;
+      if (next[succ] == 0) {
+        next[succ] = 1;
+        stack[depth++] = succ;
+      }
+    } else {
+      post[(*count)++] = top;
+      depth--;
+    }
+  }
+}
+
+static uint32_t intersect(const struct ir_function* func, uint32_t a,
+                          uint32_t b) {
+  while (a != b) {
+    while (func->blocks[a].order > func->blocks[b].order) {
+      a = func->blocks[a].idom;
+    }
+    while (func->blocks[b].order > func->blocks[a].order) {
+      b = func->blocks[b].idom;
+    }
+  }
+  return a;
+}
+
+/* Marks the body of the natural loop of the backedge latch -> header */
+static void mark_loop(struct ir_function* func, uint32_t header,
+                      uint32_t latch, uint32_t* stack) {
+  uint32_t depth = 0;
+
+  if (func->blocks[latch].loop_header != header && latch != header) {
+    func->blocks[latch].loop_header = header;
+    func->blocks[latch].loop_depth++;
+    stack[depth++] = latch;
+  }
+  while (depth > 0) {
+    struct ir_block* b = &func->blocks[stack[--depth]];
+    uint32_t i;
+    for (i = 0; i < b->pred_count; i++) {
+      uint32_t pred = b->preds[i];
+      if (pred != header && func->blocks[pred].order != IR_NONE &&
+          func->blocks[pred].loop_header != header) {
+        func->blocks[pred].loop_header = header;
+        func->blocks[pred].loop_depth++;
+        stack[depth++] = pred;
+      }
+    }
+  }
+}
+
+/*
+ * Reverse postorder, dominators (Cooper, Harvey and Kennedy) and
+ * natural loops. Outer headers come first in reverse postorder, so
+ * inner loops overwrite loop_header of their blocks
+ */
+int ir_compute_dominators(struct ir_function* func) {
+  uint32_t n = func->block_count;
+  uint32_t* post = malloc((n + 1) * sizeof(uint32_t));
+  uint32_t* stack = malloc((n + 1) * sizeof(uint32_t));
+  uint8_t* next = calloc(n + 1, 1);
+  uint32_t count = 0;
+  uint32_t i;
+  int changed = 1;
+
+  if (post == NULL || stack == NULL || next == NULL) {
+    free(post);
+    free(stack);
+    free(next);
+    func->error = ENOMEM;
+    return ENOMEM;
+  }
+  for (i = 0; i < n; i++) {
+    func->blocks[i].order = IR_NONE;
+    func->blocks[i].idom = IR_NONE;
+    func->blocks[i].loop_header = IR_NONE;
+    func->blocks[i].loop_depth = 0;
+  }
+  postorder(func, post, &count, stack, next);
+  free(next);
+
+  free(func->order);
+  func->order = malloc((count + 1) * sizeof(uint32_t));
+  if (func->order == NULL) {
+    free(post);
+    free(stack);
+    func->order_count = 0;
+    func->error = ENOMEM;
+    return ENOMEM;
+  }
+  func->order_count = count;
+  for (i = 0; i < count; i++) {
+    func->order[i] = post[count - 1 - i];
+    func->blocks[func->order[i]].order = i;
+  }
+  free(post);
+
+  func->blocks[func->entry].idom = func->entry;
+  while (changed) {
+    changed = 0;
+    for (i = 1; i < count; i++) {
+      struct ir_block* b = &func->blocks[func->order[i]];
+      uint32_t idom = IR_NONE;
+      uint32_t k;
+      for (k = 0; k < b->pred_count; k++) {
+        uint32_t pred = b->preds[k];
+        if (func->blocks[pred].idom == IR_NONE) {
+          continue;
+        }
+        idom = idom == IR_NONE ? pred : intersect(func, pred, idom);
+      }
+      if (idom != b->idom) {
+        b->idom = idom;
+        changed = 1;
+      }
+    }
+  }
+
+  for (i = 0; i < count; i++) {
+    uint32_t header = func->order[i];
+    struct ir_block* b = &func->blocks[header];
+    uint32_t k;
+    int is_header = 0;
+    for (k = 0; k < b->pred_count; k++) {
+      if (ir_dominates(func, header, b->preds[k])) {
+        if (!is_header) {
+          is_header = 1;
+          b->loop_header = header;
+          b->loop_depth++;
+        }
+        mark_loop(func, header, b->preds[k], stack);
+      }
+    }
+  }
+  free(stack);
+  return 0;
+}
+
+int ir_dominates(const struct ir_function* func, uint32_t a, uint32_t b) {
+  if (func->blocks[b].order == IR_NONE) {
+    return 0;
+  }
+  for (;;) {
+    if (a == b) {
+      return 1;
+    }
+    if (b == func->entry) {
+      return 0;
+    }
+    b = func->blocks[b].idom;
+  }
+}
@@ -0,0 +1,1523 @@
+#include "ir.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "class_layout.h"
+#include "descriptor.h"
+#include "interpreter.h"
+#include "oop_map.h"
+#include "opcodes.h"
+
+/*
+ * Bytecode to SSA in one pass over each inlined method, following
+ * Braun et al., "Simple and Efficient Construction of Static Single
+ * Assignment Form". Locals and operand stack slots of every frame are
+ * variables. Blocks are sealed once all their predecessors are known,
+ * reads in unsealed blocks (loop headers) create incomplete phis.
+ */
+
+#define IR_START 0x1 /* an instruction starts here */
+#define IR_BLOCK 0x2 /* a basic block starts here */
+
+/* Bytecode method being translated, the root or an inlined callee */
+struct ir_frame {
+  struct ir_frame* caller;
+  struct class_file* class;
+  struct method_info* method;
+  const struct Code_attribute* code;
+  uint16_t inline_depth;
+
+  /* local i is variable var_base + i, stack slot j follows the locals */
+  uint32_t var_base;
+  uint32_t result_var;
+  uint32_t exit; /* continuation of an inlined call, IR_NONE for the root */
+  uint32_t call_state; /* state at the inlined call, IR_NONE for the root */
+
+  int32_t* depth; /* stack depth before each instruction, -1 if unseen */
+  uint8_t* flags; /* IR_START, IR_BLOCK */
+  uint32_t* preds; /* incoming edges of each block start */
+  uint32_t* blocks; /* IR block of each block start */
+  uint32_t* worklist;
+  uint32_t* stack; /* operand stack values while translating */
+  uint32_t returns; /* reachable return instructions */
+};
+
+struct ir_builder {
+  struct ir_function* func;
+  struct ir_frame* top; /* innermost frame being translated */
+  uint32_t current; /* block being filled, IR_NONE after a jump */
+
+  /* instruction being translated and its stack depth before it runs */
+  uint32_t bci;
+  int32_t sp;
+  uint32_t state; /* made by its first check, IR_NONE until then */
+};
+
+static uint16_t read_u2(const uint8_t* p) {
+  return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static int is_int_kind(char kind) {
+  return kind == 'I' || kind == 'Z' || kind == 'B' || kind == 'C' ||
+         kind == 'S';
+}
+
+/* Int and reference arguments with an int or void result */
+static int supported_descriptor(struct UTF8_info* descriptor,
+                                struct method_descriptor* desc) {
+  uint8_t i;
+
+  if (descriptor == NULL || parse_method_descriptor(descriptor, desc) != 0 ||
+      (!is_int_kind(desc->ret) && desc->ret != 'V')) {
+    return 0;
+  }
+  for (i = 0; i < desc->arg_count; i++) {
+    if (!is_int_kind(desc->args[i]) && desc->args[i] != 'L') {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/* -1 when the instruction is outside the subset of the compiler */
+static int stack_effect(const struct ir_frame* f, uint32_t bci, int32_t* pops,
+                        int32_t* pushes) {
+  const uint8_t* code = f->code->code;
+  uint8_t opcode = code[bci];
+  struct method_descriptor desc;
+
+  *pops = 0;
+  *pushes = 0;
+  switch (opcode) {
+    case OP_NOP:
+    case OP_IINC:
+    case OP_GOTO:
+    case OP_RETURN:
+      return 0;
+    case OP_ACONST_NULL:
+    case OP_ICONST_M1:
+    case OP_ICONST_0:
+    case OP_ICONST_1:
+    case OP_ICONST_2:
+    case OP_ICONST_3:
+    case OP_ICONST_4:
+    case OP_ICONST_5:
+    case OP_BIPUSH:
+    case OP_SIPUSH:
+    case OP_ILOAD:
+    case OP_ILOAD_0:
+    case OP_ILOAD_1:
+    case OP_ILOAD_2:
+    case OP_ILOAD_3:
+    case OP_ALOAD:
+    case OP_ALOAD_0:
+    case OP_ALOAD_1:
+    case OP_ALOAD_2:
+    case OP_ALOAD_3:
+    case OP_NEW:
+      *pushes = 1;
+      return 0;
+    case OP_LDC:
+    case OP_LDC_W: {
+      struct cp_info* cp_info;
+      uint16_t index = opcode == OP_LDC ? code[bci + 1]
+                                        : read_u2(code + bci + 1);
+      if (get_constant(f->class, index, &cp_info) != 0 ||
+          cp_info->tag != INTEGER) {
+        return -1;
+      }
+      *pushes = 1;
+      return 0;
+    }
+    case OP_ISTORE:
+    case OP_ISTORE_0:
+    case OP_ISTORE_1:
+    case OP_ISTORE_2:
+    case OP_ISTORE_3:
+    case OP_ASTORE:
+    case OP_ASTORE_0:
+    case OP_ASTORE_1:
+    case OP_ASTORE_2:
+    case OP_ASTORE_3:
+    case OP_POP:
+    case OP_IFEQ:
+    case OP_IFNE:
+    case OP_IFLT:
+    case OP_IFGE:
+    case OP_IFGT:
+    case OP_IFLE:
+    case OP_IFNULL:
+    case OP_IFNONNULL:
+    case OP_IRETURN:
+      *pops = 1;
+      return 0;
+    case OP_INEG:
+    case OP_I2B:
+    case OP_I2C:
+    case OP_I2S:
+    case OP_ARRAYLENGTH:
+      *pops = 1;
+      *pushes = 1;
+      return 0;
+    case OP_DUP:
+      *pops = 1;
+      *pushes = 2;
+      return 0;
+    case OP_IADD:
+    case OP_ISUB:
+    case OP_IMUL:
+    case OP_IDIV:
+    case OP_IREM:
+    case OP_ISHL:
+    case OP_ISHR:
+    case OP_IUSHR:
+    case OP_IAND:
+    case OP_IOR:
+    case OP_IXOR:
+    case OP_IALOAD:
+    case OP_BALOAD:
+    case OP_CALOAD:
+    case OP_SALOAD:
+      *pops = 2;
+      *pushes = 1;
+      return 0;
+    case OP_IF_ICMPEQ:
+    case OP_IF_ICMPNE:
+    case OP_IF_ICMPLT:
+    case OP_IF_ICMPGE:
+    case OP_IF_ICMPGT:
+    case OP_IF_ICMPLE:
+    case OP_IF_ACMPEQ:
+    case OP_IF_ACMPNE:
+      *pops = 2;
+      return 0;
+    case OP_IASTORE:
+    case OP_BASTORE:
+    case OP_CASTORE:
+    case OP_SASTORE:
+      *pops = 3;
+      return 0;
+    case OP_GETFIELD:
+    case OP_PUTFIELD: {
+      struct UTF8_info* descriptor =
+          constant_member_descriptor(f->class, read_u2(code + bci + 1));
+      if (descriptor == NULL || descriptor->lenght != 1 ||
+          descriptor->bytes[0] != 'I') {
+        return -1;
+      }
+      *pops = opcode == OP_GETFIELD ? 1 : 2;
+      *pushes = opcode == OP_GETFIELD;
+      return 0;
+    }
+    case OP_INVOKEVIRTUAL:
+    case OP_INVOKESPECIAL:
+    case OP_INVOKESTATIC:
+    case OP_INVOKEINTERFACE:
+      if (!supported_descriptor(
+              constant_member_descriptor(f->class, read_u2(code + bci + 1)),
+              &desc)) {
+        return -1;
+      }
+      *pops = desc.arg_slots + (opcode != OP_INVOKESTATIC);
+      *pushes = desc.ret != 'V';
+      return 0;
+    default:
+      return -1;
+  }
+}
+
+static int local_index(const uint8_t* code, uint32_t bci) {
+  uint8_t opcode = code[bci];
+
+  if (opcode >= OP_ILOAD_0 && opcode <= OP_ILOAD_3) {
+    return opcode - OP_ILOAD_0;
+  }
+  if (opcode >= OP_ALOAD_0 && opcode <= OP_ALOAD_3) {
+    return opcode - OP_ALOAD_0;
+  }
+  if (opcode >= OP_ISTORE_0 && opcode <= OP_ISTORE_3) {
+    return opcode - OP_ISTORE_0;
+  }
+  if (opcode >= OP_ASTORE_0 && opcode <= OP_ASTORE_3) {
+    return opcode - OP_ASTORE_0;
+  }
+  if (opcode == OP_ILOAD || opcode == OP_ISTORE || opcode == OP_ALOAD ||
+      opcode == OP_ASTORE || opcode == OP_IINC) {
+    return code[bci + 1];
+  }
+  return -1;
+}
+
+static int enqueue(struct ir_frame* f, uint32_t* count, uint32_t bci,
+                   int32_t depth) {
+  if (bci >= f->code->code_length || !(f->flags[bci] & IR_START)) {
+    return EINVAL;
+  }
+  if (f->depth[bci] < 0) {
+    f->depth[bci] = depth;
+    f->worklist[(*count)++] = bci;
+  } else if (f->depth[bci] != depth) {
+    return EINVAL;
+  }
+  return 0;
+}
+
+/* Successors of a reachable instruction, IR_NONE where there is none */
+static void successors(const struct ir_frame* f, uint32_t bci,
+                       uint32_t* target, uint32_t* next) {
+  const uint8_t* code = f->code->code;
+  uint8_t opcode = code[bci];
+
+  *target = opcode_table[opcode].flags & OPF_BRANCH
+                ? bci + (uint32_t)opcode_branch_offset(code, bci)
+                : IR_NONE;
+  *next = opcode_table[opcode].flags & OPF_NO_FALLTHROUGH
+              ? IR_NONE
+              : bci + opcode_table[opcode].length;
+}
+
+/*
+ * Stack depths, block starts and predecessor counts of a method,
+ * ENOTSUP outside the subset
+ */
+static int analyze(struct ir_frame* f) {
+  const uint8_t* code = f->code->code;
+  uint32_t length = f->code->code_length;
+  uint32_t count = 0;
+  uint32_t bci;
+  int err;
+
+  for (bci = 0; bci < length;) {
+    uint32_t size = opcode_length(code, length, bci);
+    if (size == 0) {
+      return EINVAL;
+    }
+    f->flags[bci] |= IR_START;
+    f->depth[bci] = -1;
+    bci += size;
+  }
+
+  err = enqueue(f, &count, 0, 0);
+  while (err == 0 && count > 0) {
+    uint32_t target;
+    uint32_t next;
+    int32_t pops;
+    int32_t pushes;
+    int32_t depth;
+
+    bci = f->worklist[--count];
+    if (stack_effect(f, bci, &pops, &pushes) != 0) {
+      return ENOTSUP;
+    }
+    if (local_index(code, bci) >= f->code->max_locals) {
+      return EINVAL;
+    }
+    depth = f->depth[bci] - pops;
+    if (depth < 0 || depth + pushes > f->code->max_stack) {
+      return EINVAL;
+    }
+    depth += pushes;
+
+    successors(f, bci, &target, &next);
+    if (target != IR_NONE) {
+      err = enqueue(f, &count, target, depth);
+    }
+    if (err == 0 && next != IR_NONE) {
+      err = enqueue(f, &count, next, depth);
+    }
+  }
+  return err;
+}
+
+/*
+ * Block starts, predecessor counts and returns of the reachable code,
+ * `start` begins a block
+ */
+static void count_edges(struct ir_frame* f, uint32_t start) {
+  const uint8_t* code = f->code->code;
+  uint32_t length = f->code->code_length;
+  uint32_t bci;
+
+  memset(f->preds, 0, (length + 1u) * sizeof(uint32_t));
+  f->returns = 0;
+  /* blocks start at branch targets and after branches */
+  f->flags[start] |= IR_BLOCK;
+  for (bci = 0; bci < length; bci += opcode_length(code, length, bci)) {
+    uint32_t target;
+    uint32_t next;
+
+    if (f->depth[bci] < 0) {
+      continue;
+    }
+    successors(f, bci, &target, &next);
+    if (target != IR_NONE) {
+      f->flags[target] |= IR_BLOCK;
+      if (next != IR_NONE) {
+        f->flags[next] |= IR_BLOCK;
+      }
+    }
+    if (code[bci] == OP_IRETURN || code[bci] == OP_RETURN) {
+      f->returns++;
+    }
+  }
+  for (bci = 0; bci < length; bci += opcode_length(code, length, bci)) {
+    uint32_t target;
+    uint32_t next;
+
+    if (f->depth[bci] < 0) {
+      continue;
+    }
+    successors(f, bci, &target, &next);
+    if (target != IR_NONE) {
+      f->preds[target]++;
+    }
+    if (next != IR_NONE && (f->flags[next] & IR_BLOCK)) {
+      f->preds[next]++;
+    }
+  }
+}
+
+/*
+ * Forgets the code an OSR entry at `start` can't reach, it may be
+ * reachable from bci 0 only
+ */
+static int restrict_to(struct ir_frame* f, uint32_t start) {
+  uint32_t length = f->code->code_length;
+  uint8_t* reached = calloc(length + 1u, 1);
+  uint32_t count = 0;
+  uint32_t bci;
+
+  if (reached == NULL) {
+    return ENOMEM;
+  }
+  reached[start] = 1;
+  f->worklist[count++] = start;
+  while (count > 0) {
+    uint32_t target;
+    uint32_t next;
+
+    successors(f, f->worklist[--count], &target, &next);
+    if (target != IR_NONE && !reached[target]) {
+      reached[target] = 1;
+      f->worklist[count++] = target;
+    }
+    if (next != IR_NONE && !reached[next]) {
+      reached[next] = 1;
+      f->worklist[count++] = next;
+    }
+  }
+  for (bci = 0; bci < length; bci++) {
+    if (!reached[bci]) {
+      f->depth[bci] = -1;
+    }
+  }
+  free(reached);
+  count_edges(f, start);
+  return 0;
+}
+
+static void free_frame(struct ir_frame* f) {
+  free(f->depth);
+  free(f->flags);
+  free(f->preds);
+  free(f->blocks);
+  free(f->worklist);
+  free(f->stack);
+}
+
+static int init_frame(struct ir_builder* b, struct ir_frame* f,
+                      struct ir_frame* caller, struct class_file* class,
+                      struct method_info* method) {
+  uint32_t length = method->code->code_length;
+  int err;
+
+  memset(f, 0, sizeof(*f));
+  f->caller = caller;
+  f->class = class;
+  f->method = method;
+  f->code = method->code;
+  f->inline_depth = caller != NULL ? (uint16_t)(caller->inline_depth + 1) : 0;
+  f->exit = IR_NONE;
+  f->call_state = IR_NONE;
+  f->depth = malloc((length + 1u) * sizeof(int32_t));
+  f->flags = calloc(length + 1u, 1);
+  f->preds = calloc(length + 1u, sizeof(uint32_t));
+  f->blocks = calloc(length + 1u, sizeof(uint32_t));
+  f->worklist = malloc((length + 1u) * sizeof(uint32_t));
+  f->stack = calloc(f->code->max_stack + 1u, sizeof(uint32_t));
+  if (f->depth == NULL || f->flags == NULL || f->preds == NULL ||
+      f->blocks == NULL || f->worklist == NULL || f->stack == NULL) {
+    free_frame(f);
+    b->func->error = ENOMEM;
+    return ENOMEM;
+  }
+  err = analyze(f);
+  if (err != 0) {
+    free_frame(f);
+    return err == EINVAL ? ENOTSUP : err;
+  }
+  count_edges(f, 0);
+  f->var_base = b->func->var_count;
+  f->result_var = f->var_base + f->code->max_locals + f->code->max_stack;
+  b->func->var_count = f->result_var + 1;
+  return 0;
+}
+
+static uint32_t constant(struct ir_builder* b, char type, int32_t value) {
+  return ir_emit(b->func, b->func->entry, IR_CONST, type, value, NULL, 0);
+}
+
+static uint32_t emit(struct ir_builder* b, uint8_t op, char type, int32_t imm,
+                     const uint32_t* args, uint16_t arg_count) {
+  return ir_emit(b->func, b->current, op, type, imm, args, arg_count);
+}
+
+static uint32_t emit1(struct ir_builder* b, uint8_t op, char type,
+                      uint32_t arg) {
+  return emit(b, op, type, 0, &arg, 1);
+}
+
+static uint32_t emit2(struct ir_builder* b, uint8_t op, char type,
+                      uint32_t first, uint32_t second) {
+  uint32_t args[2] = {first, second};
+  return emit(b, op, type, 0, args, 2);
+}
+
+/* --- SSA construction --- */
+
+static uint32_t read_var(struct ir_builder* b, uint32_t block, uint32_t var);
+
+static void write_var(struct ir_builder* b, uint32_t block, uint32_t var,
+                      uint32_t value) {
+  struct ir_function* func = b->func;
+  struct ir_block* blk = &func->blocks[block];
+
+  if (var >= blk->def_count) {
+    uint32_t count = func->var_count;
+    uint32_t* defs = realloc(blk->defs, count * sizeof(uint32_t));
+    if (defs == NULL) {
+      func->error = ENOMEM;
+      return;
+    }
+    while (blk->def_count < count) {
+      defs[blk->def_count++] = IR_NONE;
+    }
+    blk->defs = defs;
+  }
+  blk->defs[var] = value;
+}
+
+/* Type of a phi from the oop map at its block, '?' if unknown */
+static char phi_type(struct ir_builder* b, uint32_t block, uint32_t var) {
+  struct ir_block* blk = &b->func->blocks[block];
+  struct ir_frame* f = b->top;
+  const struct oop_map* map;
+  uint32_t slot;
+  int32_t index;
+
+  while (f != NULL && f->method != blk->method) {
+    f = f->caller;
+  }
+  if (f == NULL || var < f->var_base || var >= f->result_var) {
+    return '?';
+  }
+  map = f->method->oop_map;
+  index = map != NULL ? oop_map_find(map, blk->bci) : -1;
+  if (index < 0) {
+    return '?';
+  }
+  slot = var - f->var_base;
+  return oop_map_is_ref(map, (uint32_t)index, slot) ? 'A' : 'I';
+}
+
+static uint32_t try_remove_trivial_phi(struct ir_builder* b, uint32_t phi) {
+  struct ir_function* func = b->func;
+  struct ir_instr* instr = &func->instrs[phi];
+  uint32_t same = IR_NONE;
+  uint16_t i;
+
+  for (i = 0; i < instr->arg_count; i++) {
+    uint32_t value = ir_arg(func, instr, i);
+    if (value == same || value == phi) {
+      continue;
+    }
+    if (same != IR_NONE) {
+      return phi;
+    }
+    same = value;
+  }
+  if (same == IR_NONE) {
+    /* unreachable or undefined, verified code never reads it */
+    same = constant(b, instr->type == 'A' ? 'A' : 'I', 0);
+  }
+  ir_remove_from_block(func, phi);
+  ir_replace(func, phi, same);
+  return same;
+}
+
+static uint32_t add_phi_operands(struct ir_builder* b, uint32_t var,
+                                 uint32_t phi) {
+  struct ir_function* func = b->func;
+  uint32_t block = func->instrs[phi].block;
+  uint32_t count = func->blocks[block].pred_count;
+  uint32_t* values = calloc(count + 1, sizeof(uint32_t));
+  uint32_t i;
+
+  if (values == NULL) {
+    func->error = ENOMEM;
+    return phi;
+  }
+  for (i = 0; i < count; i++) {
+    values[i] = read_var(b, func->blocks[block].preds[i], var);
+  }
+  ir_set_phi_operands(func, phi, values);
+  if (func->instrs[phi].type == '?') {
+    for (i = 0; i < count; i++) {
+      char type = func->instrs[ir_resolve(func, values[i])].type;
+      if (type != '?') {
+        func->instrs[phi].type = type;
+        break;
+      }
+    }
+  }
+  free(values);
+  return try_remove_trivial_phi(b, phi);
+}
+
+static uint32_t read_var_recursive(struct ir_builder* b, uint32_t block,
+                                   uint32_t var) {
+  struct ir_function* func = b->func;
+  struct ir_block* blk = &func->blocks[block];
+  uint32_t value;
+
+  if (!blk->sealed) {
+    value = ir_new_phi(func, block, phi_type(b, block, var));
+    blk = &func->blocks[block];
+    if (value != IR_NONE &&
+        blk->incomplete_count * 2 + 2 > blk->incomplete_capacity) {
+      uint32_t capacity =
+          blk->incomplete_capacity != 0 ? blk->incomplete_capacity * 2 : 16;
+      uint32_t* grown = realloc(blk->incomplete, capacity * sizeof(uint32_t));
+      if (grown == NULL) {
+        func->error = ENOMEM;
+        return IR_NONE;
+      }
+      blk->incomplete = grown;
+      blk->incomplete_capacity = capacity;
+    }
+    if (value != IR_NONE) {
+      blk->incomplete[blk->incomplete_count * 2] = var;
+      blk->incomplete[blk->incomplete_count * 2 + 1] = value;
+      blk->incomplete_count++;
+    }
+  } else if (blk->pred_count == 1) {
+    value = read_var(b, blk->preds[0], var);
+  } else if (blk->pred_count == 0) {
+    value = constant(b, 'I', 0);
+  } else {
+    /* the phi breaks cycles while the operands are read */
+    value = ir_new_phi(func, block, phi_type(b, block, var));
+    if (value == IR_NONE) {
+      return IR_NONE;
+    }
+    write_var(b, block, var, value);
+    value = add_phi_operands(b, var, value);
+  }
+  write_var(b, block, var, value);
+  return value;
+}
+
+static uint32_t read_var(struct ir_builder* b, uint32_t block, uint32_t var) {
+  struct ir_block* blk = &b->func->blocks[block];
+
+  if (b->func->error != 0) {
+    return IR_NONE;
+  }
+  if (var < blk->def_count && blk->defs[var] != IR_NONE) {
+    return ir_resolve(b->func, blk->defs[var]);
+  }
+  return read_var_recursive(b, block, var);
+}
+
+static void seal_block(struct ir_builder* b, uint32_t block) {
+  struct ir_function* func = b->func;
+  uint32_t i;
+
+  for (i = 0; i < func->blocks[block].incomplete_count; i++) {
+    uint32_t var = func->blocks[block].incomplete[i * 2];
+    uint32_t phi = func->blocks[block].incomplete[i * 2 + 1];
+    add_phi_operands(b, var, phi);
+  }
+  func->blocks[block].incomplete_count = 0;
+  func->blocks[block].sealed = 1;
+}
+
+static void link_blocks(struct ir_builder* b, uint32_t from, uint32_t to) {
+  struct ir_function* func = b->func;
+
+  ir_add_edge(func, from, to);
+  if (func->error == 0 &&
+      func->blocks[to].pred_count == func->blocks[to].expected_preds) {
+    seal_block(b, to);
+  }
+}
+
+static uint32_t stack_var(const struct ir_frame* f, int32_t slot) {
+  return f->var_base + f->code->max_locals + (uint32_t)slot;
+}
+
+/* Hands the operand stack to the successors of the current block */
+static void save_stack(struct ir_builder* b, struct ir_frame* f, int32_t sp) {
+  int32_t i;
+
+  for (i = 0; i < sp; i++) {
+    write_var(b, b->current, stack_var(f, i), f->stack[i]);
+  }
+}
+
+static void jump_to(struct ir_builder* b, uint32_t target) {
+  uint32_t from = b->current;
+
+  emit(b, IR_GOTO, 'V', 0, NULL, 0);
+  b->current = IR_NONE;
+  link_blocks(b, from, target);
+}
+
+/* Interpreter state of frame `f` at `bci` with `sp` stack slots */
+static uint32_t frame_state(struct ir_builder* b, struct ir_frame* f,
+                            uint32_t bci, int32_t sp) {
+  uint16_t locals = f->code->max_locals;
+  uint32_t* values = malloc(((size_t)locals + (uint32_t)sp + 1) *
+                            sizeof(uint32_t));
+  uint32_t state;
+  uint32_t i;
+
+  if (values == NULL) {
+    b->func->error = ENOMEM;
+    return IR_NONE;
+  }
+  for (i = 0; i < locals; i++) {
+    values[i] = read_var(b, b->current, f->var_base + i);
+  }
+  memcpy(values + locals, f->stack, (uint32_t)sp * sizeof(uint32_t));
+  state = ir_new_state(b->func, f->call_state, f->class, f->method,
+                       (uint16_t)bci, values, locals, (uint16_t)sp, 0);
+  free(values);
+  return state;
+}
+
+/* A check deoptimizing to the state before the current instruction */
+static uint32_t emit_check(struct ir_builder* b, uint8_t op, char type,
+                           const uint32_t* args, uint16_t arg_count) {
+  uint32_t check;
+
+  if (b->state == IR_NONE) {
+    b->state = frame_state(b, b->top, b->bci, b->sp);
+  }
+  check = emit(b, op, type, 0, args, arg_count);
+  if (check != IR_NONE) {
+    b->func->instrs[check].state = b->state;
+  }
+  return check;
+}
+
+/* --- translation --- */
+
+static int parse_frame(struct ir_builder* b, struct ir_frame* f,
+                       uint32_t start, const uint32_t* args,
+                       uint32_t arg_count);
+
+static struct jit_call_site* new_site(struct ir_function* func,
+                                      struct class_file* class,
+                                      uint16_t index) {
+  if (func->site_count == func->site_capacity) {
+    uint32_t capacity = func->site_capacity != 0 ? func->site_capacity * 2 : 4;
+    struct jit_call_site* sites =
+        realloc(func->sites, capacity * sizeof(struct jit_call_site));
+    if (sites == NULL) {
+      func->error = ENOMEM;
+      return NULL;
+    }
+    func->sites = sites;
+    func->site_capacity = capacity;
+  }
+  jit_call_site_init(&func->sites[func->site_count], class, index);
+  return &func->sites[func->site_count++];
+}
+
+/*
+ * Resolved entry of a Fieldref or Methodref constant, NULL if the
+ * interpreter hasn't resolved it yet. Nothing is resolved here, the
+ * interpreter has usually run the code by the time a method is hot
+ */
+static struct cp_cache_entry* resolved_entry(const struct ir_frame* f,
+                                             uint16_t index) {
+  struct cp_cache_entry* entry = &f->class->runtime->cp_cache[index];
+  return atomic_load_explicit(&entry->resolved, memory_order_acquire)
+             ? entry
+             : NULL;
+}
+
+/* IR_NEW behind a value, through its null checks. IR_NONE if none */
+static uint32_t allocation_of(const struct ir_function* func,
+                              uint32_t value) {
+  value = ir_resolve(func, value);
+  while (func->instrs[value].op == IR_NULL_CHECK) {
+    value = ir_arg(func, &func->instrs[value], 0);
+  }
+  return func->instrs[value].op == IR_NEW ? value : IR_NONE;
+}
+
+/*
+ * Whether the code stores into local 0. Deoptimizing a synchronized
+ * frame locks the receiver it finds there
+ */
+static int writes_receiver(const struct Code_attribute* code) {
+  uint32_t size;
+  uint32_t bci;
+
+  for (bci = 0; bci < code->code_length; bci += size) {
+    uint8_t opcode = code->code[bci];
+
+    size = opcode_length(code->code, code->code_length, bci);
+    if (size == 0) {
+      return 1;
+    }
+    if (local_index(code->code, bci) == 0 &&
+        !(opcode >= OP_ILOAD_0 && opcode <= OP_ILOAD_3) &&
+        !(opcode >= OP_ALOAD_0 && opcode <= OP_ALOAD_3) &&
+        opcode != OP_ILOAD && opcode != OP_ALOAD) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/*
+ * Inlines a callee in place of the call. Returns 1 when inlined, 0 to
+ * keep the call. The receiver of an instance callee is checked. A
+ * synchronized callee is only inlined on an allocation of the method,
+ * which no other thread can lock if it doesn't escape, and must keep
+ * the receiver in local 0
+ */
+static int try_inline(struct ir_builder* b, struct ir_frame* f, uint32_t bci,
+                      struct class_file* holder, struct method_info* callee,
+                      int32_t* sp, int32_t pops, int pushes) {
+  int locked = (callee->access_flags & ACC_SYNCHRONIZED) != 0;
+  struct ir_frame* caller;
+  struct ir_frame frame;
+  uint32_t exit;
+  int err;
+
+  if (f->inline_depth >= IR_INLINE_MAX_DEPTH || callee->code == NULL ||
+      callee->code->code_length > IR_INLINE_MAX_CODE ||
+      callee->code->exception_table_length != 0 ||
+      (callee->access_flags & ACC_NATIVE) || holder->runtime == NULL ||
+      /* the intrinsic beats the bytecode */
+      (atomic_load_explicit(&method_runtime_of(holder, callee)->flags,
+                            memory_order_relaxed) &
+       METHOD_INTRINSIC) ||
+      (locked && ((callee->access_flags & ACC_STATIC) ||
+                  allocation_of(b->func, f->stack[*sp - pops]) == IR_NONE ||
+                  writes_receiver(callee->code))) ||
+      ((callee->access_flags & ACC_STATIC) &&
+       holder->runtime->init_state != CLASS_INITIALIZED)) {
+    return 0;
+  }
+  for (caller = f; caller != NULL; caller = caller->caller) {
+    if (caller->method == callee) {
+      return 0;
+    }
+  }
+
+  err = init_frame(b, &frame, f, holder, callee);
+  if (err != 0 || frame.returns == 0) {
+    if (err == 0) {
+      free_frame(&frame);
+    }
+    return err == ENOMEM ? -ENOMEM : 0;
+  }
+  exit = ir_new_block(b->func);
+  if (exit == IR_NONE) {
+    free_frame(&frame);
+    return -ENOMEM;
+  }
+  b->func->blocks[exit].expected_preds = frame.returns;
+  frame.exit = exit;
+  /* the caller waits in the call with the arguments still pushed */
+  frame.call_state = frame_state(b, f, bci, *sp);
+  err = parse_frame(b, &frame, 0, f->stack + *sp - pops, (uint32_t)pops);
+  if (err == 0 && !b->func->blocks[exit].sealed) {
+    err = ENOTSUP;
+  }
+  if (err == 0) {
+    b->current = exit;
+    *sp -= pops;
+    if (pushes) {
+      f->stack[(*sp)++] = read_var(b, exit, frame.result_var);
+    }
+    b->func->stats.inlined++;
+    b->func->stats.locks_elided += locked;
+  }
+  free_frame(&frame);
+  return err == 0 ? 1 : -err;
+}
+
+/*
+ * The method an invokevirtual, invokeinterface or invokespecial runs.
+ * The class of an allocation is exact, any other virtual call is
+ * bound to the only target the loaded classes allow, which the code
+ * then depends on. ENOTSUP if there may be several
+ */
+static int devirtualize(struct ir_builder* b, struct ir_frame* f,
+                        uint8_t opcode, uint16_t index, uint32_t receiver,
+                        struct class_file** holder,
+                        struct method_info** callee) {
+  struct ir_function* func = b->func;
+  struct cp_cache_entry* entry = resolved_entry(f, index);
+  int err;
+
+  if (entry == NULL) {
+    return ENOTSUP;
+  }
+  *holder = entry->class;
+  *callee = entry->method;
+  if (opcode == OP_INVOKESPECIAL) {
+    return 0;
+  }
+  if (allocation_of(func, receiver) != IR_NONE) {
+    struct ir_object* object =
+        &func->objects[func->instrs[allocation_of(func, receiver)].imm];
+    *callee = class_hierarchy_exact_target(object->class, holder, *callee);
+    return *callee != NULL ? 0 : ENOTSUP;
+  }
+  if (func->hierarchy == NULL) {
+    return ENOTSUP;
+  }
+  if (func->dependencies == NULL) {
+    func->dependencies = cha_dependencies_new(func->class, func->method);
+    if (func->dependencies == NULL) {
+      return ENOMEM;
+    }
+  }
+  *callee = class_hierarchy_unique_target(func->hierarchy, func->dependencies,
+                                          holder, *callee, &err);
+  if (*callee == NULL) {
+    return err != 0 ? err : ENOTSUP;
+  }
+  func->stats.devirtualized++;
+  return 0;
+}
+
+static int emit_invoke(struct ir_builder* b, struct ir_frame* f, uint32_t bci,
+                       int32_t* sp) {
+  uint8_t opcode = f->code->code[bci];
+  uint16_t index = read_u2(f->code->code + bci + 1);
+  struct class_file* holder = NULL;
+  struct method_info* callee = NULL;
+  struct jit_call_site* site;
+  int32_t pops;
+  int32_t pushes;
+  uint32_t call;
+  int inlined = 0;
+
+  stack_effect(f, bci, &pops, &pushes);
+  if (opcode != OP_INVOKESTATIC) {
+    uint32_t* receiver = &f->stack[*sp - pops];
+    int err = devirtualize(b, f, opcode, index, *receiver, &holder, &callee);
+    if (err != 0) {
+      return err;
+    }
+    *receiver = emit_check(b, IR_NULL_CHECK, 'A', receiver, 1);
+  } else if (resolved_entry(f, index) != NULL) {
+    holder = resolved_entry(f, index)->class;
+    callee = resolved_entry(f, index)->method;
+  }
+  if (callee != NULL) {
+    inlined = try_inline(b, f, bci, holder, callee, sp, pops, pushes);
+  }
+  if (inlined != 0) {
+    return inlined < 0 ? -inlined : 0;
+  }
+
+  site = new_site(b->func, f->class, index);
+  if (site == NULL) {
+    return ENOMEM;
+  }
+  if (opcode != OP_INVOKESTATIC) {
+    site->method = callee;
+    site->holder = holder;
+  }
+  call = emit(b, IR_CALL, pushes ? 'I' : 'V',
+              (int32_t)(b->func->site_count - 1), f->stack + *sp - pops,
+              (uint16_t)pops);
+  if (pops > b->func->max_call_args) {
+    b->func->max_call_args = (uint16_t)pops;
+  }
+  *sp -= pops;
+  if (pushes) {
+    f->stack[(*sp)++] = call;
+  }
+  return 0;
+}
+
+static void emit_branch(struct ir_builder* b, struct ir_frame* f,
+                        uint32_t bci, int32_t sp, enum ir_cond cond,
+                        uint32_t left, uint32_t right) {
+  uint32_t target = bci + (uint32_t)opcode_branch_offset(f->code->code, bci);
+  uint32_t from = b->current;
+  uint32_t branch;
+
+  save_stack(b, f, sp);
+  branch = emit2(b, IR_IF, 'V', left, right);
+  if (branch != IR_NONE) {
+    b->func->instrs[branch].cond = (uint8_t)cond;
+  }
+  b->current = IR_NONE;
+  link_blocks(b, from, f->blocks[target]);
+  link_blocks(b, from, f->blocks[bci + opcode_table[OP_IFEQ].length]);
+}
+
+static void emit_return(struct ir_builder* b, struct ir_frame* f,
+                        uint32_t value) {
+  if (f->exit == IR_NONE) {
+    emit(b, IR_RETURN, 'V', 0, &value, value != IR_NONE);
+    b->current = IR_NONE;
+    return;
+  }
+  if (value != IR_NONE) {
+    write_var(b, b->current, f->result_var, value);
+  }
+  jump_to(b, f->exit);
+}
+
+static uint32_t array_access(struct ir_builder* b, uint32_t array,
+                             uint32_t* index) {
+  uint32_t checked = emit_check(b, IR_NULL_CHECK, 'A', &array, 1);
+  uint32_t args[2];
+
+  args[0] = *index;
+  args[1] = emit1(b, IR_ARRAY_LENGTH, 'I', checked);
+  *index = emit_check(b, IR_BOUNDS_CHECK, 'I', args, 2);
+  return checked;
+}
+
+/* Int fields of the class and of its superclasses */
+static int int_fields(const struct class_layout* layout, int32_t* offsets) {
+  int count = 0;
+
+  for (; layout != NULL; layout = layout->super) {
+    struct class_file* class = layout->klass;
+    uint16_t i;
+    for (i = 0; i < class->fields_count && i < layout->fields_count; i++) {
+      struct UTF8_info* descriptor =
+          validate_constant(class, class->fields[i].descriptor_index);
+      if (!(class->fields[i].access_flags & ACC_STATIC) &&
+          descriptor != NULL && descriptor->lenght == 1 &&
+          descriptor->bytes[0] == 'I') {
+        if (offsets != NULL) {
+          offsets[count] = (int32_t)layout->field_offsets[i];
+        }
+        count++;
+      }
+    }
+  }
+  return count;
+}
+
+/*
+ * new of an initialized class. The allocation is kept only if escape
+ * analysis replaces it, calls on it go to the methods of its class
+ */
+static int new_object(struct ir_builder* b, struct ir_frame* f, uint32_t bci,
+                      int32_t* sp) {
+  struct ir_function* func = b->func;
+  struct cp_cache_entry* entry =
+      resolved_entry(f, read_u2(f->code->code + bci + 1));
+  struct class_file* class = entry != NULL ? entry->class : NULL;
+  struct ir_object* object;
+  int count;
+
+  if (class == NULL || class->runtime == NULL || class->layout == NULL ||
+      class->runtime->init_state != CLASS_INITIALIZED ||
+      (class->access_flags & (ACC_INTERFACE | ACC_ABSTRACT))) {
+    return ENOTSUP;
+  }
+  if (func->object_count == func->object_capacity) {
+    uint32_t capacity =
+        func->object_capacity != 0 ? func->object_capacity * 2 : 4;
+    struct ir_object* objects =
+        realloc(func->objects, capacity * sizeof(struct ir_object));
+    if (objects == NULL) {
+      return ENOMEM;
+    }
+    func->objects = objects;
+    func->object_capacity = capacity;
+  }
+  count = int_fields(class->layout, NULL);
+  object = &func->objects[func->object_count];
+  object->class = class;
+  object->field_count = (uint16_t)count;
+  object->offsets = malloc(((size_t)count + 1) * sizeof(int32_t));
+  if (object->offsets == NULL) {
+    return ENOMEM;
+  }
+  int_fields(class->layout, object->offsets);
+  object->instr = emit(b, IR_NEW, 'A', (int32_t)func->object_count, NULL, 0);
+  func->object_count++;
+  f->stack[(*sp)++] = object->instr;
+  return 0;
+}
+
+/* getfield and putfield of a resolved int field */
+static int field_access(struct ir_builder* b, struct ir_frame* f,
+                        uint32_t bci, int32_t* sp) {
+  struct cp_cache_entry* entry =
+      resolved_entry(f, read_u2(f->code->code + bci + 1));
+  uint32_t* stack = f->stack;
+  uint32_t args[2];
+
+  if (entry == NULL || entry->kind != 'I') {
+    return ENOTSUP;
+  }
+  if (f->code->code[bci] == OP_GETFIELD) {
+    args[0] = emit_check(b, IR_NULL_CHECK, 'A', &stack[*sp - 1], 1);
+    stack[*sp - 1] = emit(b, IR_FIELD_LOAD, 'I', (int32_t)entry->offset,
+                          args, 1);
+    return 0;
+  }
+  args[1] = stack[--(*sp)];
+  args[0] = emit_check(b, IR_NULL_CHECK, 'A', &stack[--(*sp)], 1);
+  emit(b, IR_FIELD_STORE, 'V', (int32_t)entry->offset, args, 2);
+  return 0;
+}
+
+static uint8_t element_type(uint8_t opcode) {
+  switch (opcode) {
+    case OP_BALOAD:
+    case OP_BASTORE:
+      return T_BYTE;
+    case OP_CALOAD:
+    case OP_CASTORE:
+      return T_CHAR;
+    case OP_SALOAD:
+    case OP_SASTORE:
+      return T_SHORT;
+    default:
+      return T_INT;
+  }
+}
+
+static int parse_instruction(struct ir_builder* b, struct ir_frame* f,
+                             uint32_t bci, int32_t* sp) {
+  const uint8_t* code = f->code->code;
+  uint8_t opcode = code[bci];
+  uint32_t* stack = f->stack;
+  uint32_t left;
+  uint32_t right;
+
+  switch (opcode) {
+    case OP_NOP:
+      break;
+    case OP_ACONST_NULL:
+      stack[(*sp)++] = constant(b, 'A', 0);
+      break;
+    case OP_ICONST_M1:
+    case OP_ICONST_0:
+    case OP_ICONST_1:
+    case OP_ICONST_2:
+    case OP_ICONST_3:
+    case OP_ICONST_4:
+    case OP_ICONST_5:
+      stack[(*sp)++] = constant(b, 'I', opcode - OP_ICONST_0);
+      break;
+    case OP_BIPUSH:
+      stack[(*sp)++] = constant(b, 'I', (int8_t)code[bci + 1]);
+      break;
+    case OP_SIPUSH:
+      stack[(*sp)++] = constant(b, 'I', (int16_t)read_u2(code + bci + 1));
+      break;
+    case OP_LDC:
+    case OP_LDC_W: {
+      struct cp_info* cp_info = NULL;
+      /* checked to be an Integer by analyze() */
+      get_constant(f->class,
+                   opcode == OP_LDC ? code[bci + 1] : read_u2(code + bci + 1),
+                   &cp_info);
+      stack[(*sp)++] =
+          constant(b, 'I', (int32_t)cp_info->integer_info.info.bytes);
+      break;
+    }
+
+    case OP_ILOAD:
+    case OP_ILOAD_0:
+    case OP_ILOAD_1:
+    case OP_ILOAD_2:
+    case OP_ILOAD_3:
+    case OP_ALOAD:
+    case OP_ALOAD_0:
+    case OP_ALOAD_1:
+    case OP_ALOAD_2:
+    case OP_ALOAD_3:
+      stack[(*sp)++] = read_var(
+          b, b->current, f->var_base + (uint32_t)local_index(code, bci));
+      break;
+    case OP_ISTORE:
+    case OP_ISTORE_0:
+    case OP_ISTORE_1:
+    case OP_ISTORE_2:
+    case OP_ISTORE_3:
+    case OP_ASTORE:
+    case OP_ASTORE_0:
+    case OP_ASTORE_1:
+    case OP_ASTORE_2:
+    case OP_ASTORE_3:
+      write_var(b, b->current, f->var_base + (uint32_t)local_index(code, bci),
+                stack[--(*sp)]);
+      break;
+    case OP_IINC: {
+      uint32_t var = f->var_base + code[bci + 1];
+      write_var(b, b->current, var,
+                emit2(b, IR_ADD, 'I', read_var(b, b->current, var),
+                      constant(b, 'I', (int8_t)code[bci + 2])));
+      break;
+    }
+
+    case OP_POP:
+      (*sp)--;
+      break;
+    case OP_DUP:
+      stack[*sp] = stack[*sp - 1];
+      (*sp)++;
+      break;
+
+    case OP_IADD:
+    case OP_ISUB:
+    case OP_IMUL:
+    case OP_IDIV:
+    case OP_IREM:
+    case OP_IAND:
+    case OP_IOR:
+    case OP_IXOR:
+    case OP_ISHL:
+    case OP_ISHR:
+    case OP_IUSHR: {
+      uint8_t op = opcode == OP_IADD   ? IR_ADD
+                   : opcode == OP_ISUB ? IR_SUB
+                   : opcode == OP_IMUL ? IR_MUL
+                   : opcode == OP_IDIV ? IR_DIV
+                   : opcode == OP_IREM ? IR_REM
+                   : opcode == OP_IAND ? IR_AND
+                   : opcode == OP_IOR  ? IR_OR
+                   : opcode == OP_IXOR ? IR_XOR
+                   : opcode == OP_ISHL ? IR_SHL
+                   : opcode == OP_ISHR ? IR_SHR
+                                       : IR_USHR;
+      right = stack[--(*sp)];
+      left = stack[--(*sp)];
+      if (op == IR_DIV || op == IR_REM) {
+        right = emit_check(b, IR_ZERO_CHECK, 'I', &right, 1);
+      }
+      stack[(*sp)++] = emit2(b, op, 'I', left, right);
+      break;
+    }
+    case OP_INEG:
+    case OP_I2B:
+    case OP_I2C:
+    case OP_I2S:
+      stack[*sp - 1] = emit1(b,
+                             opcode == OP_INEG  ? IR_NEG
+                             : opcode == OP_I2B ? IR_I2B
+                             : opcode == OP_I2C ? IR_I2C
+                                                : IR_I2S,
+                             'I', stack[*sp - 1]);
+      break;
+
+    case OP_ARRAYLENGTH:
+      stack[*sp - 1] =
+          emit1(b, IR_ARRAY_LENGTH, 'I',
+                emit_check(b, IR_NULL_CHECK, 'A', &stack[*sp - 1], 1));
+      break;
+    case OP_IALOAD:
+    case OP_BALOAD:
+    case OP_CALOAD:
+    case OP_SALOAD: {
+      uint32_t args[2];
+      args[1] = stack[--(*sp)];
+      args[0] = array_access(b, stack[--(*sp)], &args[1]);
+      stack[(*sp)++] = emit(b, IR_ARRAY_LOAD, 'I', element_type(opcode), args,
+                            2);
+      break;
+    }
+    case OP_IASTORE:
+    case OP_BASTORE:
+    case OP_CASTORE:
+    case OP_SASTORE: {
+      uint32_t args[3];
+      args[2] = stack[--(*sp)];
+      args[1] = stack[--(*sp)];
+      args[0] = array_access(b, stack[--(*sp)], &args[1]);
+      emit(b, IR_ARRAY_STORE, 'V', element_type(opcode), args, 3);
+      break;
+    }
+
+    case OP_IFEQ:
+    case OP_IFNE:
+    case OP_IFLT:
+    case OP_IFGE:
+    case OP_IFGT:
+    case OP_IFLE:
+      left = stack[--(*sp)];
+      emit_branch(b, f, bci, *sp, (enum ir_cond)(opcode - OP_IFEQ), left,
+                  constant(b, 'I', 0));
+      break;
+    case OP_IFNULL:
+    case OP_IFNONNULL:
+      left = stack[--(*sp)];
+      emit_branch(b, f, bci, *sp, opcode == OP_IFNULL ? IR_EQ : IR_NE, left,
+                  constant(b, 'A', 0));
+      break;
+    case OP_IF_ICMPEQ:
+    case OP_IF_ICMPNE:
+    case OP_IF_ICMPLT:
+    case OP_IF_ICMPGE:
+    case OP_IF_ICMPGT:
+    case OP_IF_ICMPLE:
+    case OP_IF_ACMPEQ:
+    case OP_IF_ACMPNE:
+      right = stack[--(*sp)];
+      left = stack[--(*sp)];
+      emit_branch(b, f, bci, *sp,
+                  opcode >= OP_IF_ACMPEQ
+                      ? (enum ir_cond)(opcode - OP_IF_ACMPEQ)
+                      : (enum ir_cond)(opcode - OP_IF_ICMPEQ),
+                  left, right);
+      break;
+    case OP_GOTO:
+      save_stack(b, f, *sp);
+      jump_to(b, f->blocks[bci + (uint32_t)opcode_branch_offset(code, bci)]);
+      break;
+
+    case OP_IRETURN:
+      emit_return(b, f, stack[--(*sp)]);
+      break;
+    case OP_RETURN:
+      emit_return(b, f, IR_NONE);
+      break;
+
+    case OP_GETFIELD:
+    case OP_PUTFIELD:
+      return field_access(b, f, bci, sp);
+    case OP_NEW:
+      return new_object(b, f, bci, sp);
+
+    case OP_INVOKEVIRTUAL:
+    case OP_INVOKESPECIAL:
+    case OP_INVOKESTATIC:
+    case OP_INVOKEINTERFACE:
+      return emit_invoke(b, f, bci, sp);
+  }
+  return 0;
+}
+
+/*
+ * Translates the frame entered at `start` with the first arg_count
+ * variables (locals, then stack slots) set to args
+ */
+static int parse_frame(struct ir_builder* b, struct ir_frame* f,
+                       uint32_t start, const uint32_t* args,
+                       uint32_t arg_count) {
+  struct ir_function* func = b->func;
+  const uint8_t* code = f->code->code;
+  uint32_t length = f->code->code_length;
+  int32_t sp = 0;
+  uint32_t bci;
+  uint32_t i;
+  int err = 0;
+
+  for (bci = 0; bci < length; bci += opcode_length(code, length, bci)) {
+    uint32_t block;
+    if (!(f->flags[bci] & IR_BLOCK) || f->depth[bci] < 0) {
+      continue;
+    }
+    block = ir_new_block(func);
+    if (block == IR_NONE) {
+      return ENOMEM;
+    }
+    f->blocks[bci] = block;
+    func->blocks[block].method = f->method;
+    func->blocks[block].bci = (uint16_t)bci;
+    func->blocks[block].expected_preds = f->preds[bci];
+  }
+  /* the method is entered from the caller's block */
+  func->blocks[f->blocks[start]].expected_preds++;
+
+  for (i = 0; i < arg_count; i++) {
+    write_var(b, b->current, f->var_base + i, args[i]);
+  }
+  jump_to(b, f->blocks[start]);
+
+  b->top = f;
+  for (bci = 0; bci < length && err == 0 && func->error == 0;
+       bci += opcode_length(code, length, bci)) {
+    if (f->depth[bci] < 0) {
+      continue;
+    }
+    if (f->flags[bci] & IR_BLOCK) {
+      int32_t j;
+      if (b->current != IR_NONE) {
+        save_stack(b, f, sp);
+        jump_to(b, f->blocks[bci]);
+      }
+      b->current = f->blocks[bci];
+      sp = f->depth[bci];
+      for (j = 0; j < sp; j++) {
+        f->stack[j] = read_var(b, b->current, stack_var(f, j));
+      }
+      /* checks hoisted out of a loop deoptimize to its entry */
+      if (!func->blocks[b->current].sealed) {
+        func->blocks[b->current].state = frame_state(b, f, bci, sp);
+      }
+    }
+    b->bci = bci;
+    b->sp = sp;
+    b->state = IR_NONE;
+    err = parse_instruction(b, f, bci, &sp);
+  }
+  b->top = f->caller;
+  return err != 0 ? err : func->error;
+}
+
+/* Phis whose type the oop maps didn't give take it from their operands */
+static void infer_phi_types(struct ir_function* func) {
+  int changed = 1;
+  uint32_t i;
+
+  while (changed) {
+    changed = 0;
+    for (i = 0; i < func->instr_count; i++) {
+      struct ir_instr* instr = &func->instrs[i];
+      uint16_t k;
+      if (instr->op != IR_PHI || instr->type != '?' ||
+          instr->forward != IR_NONE) {
+        continue;
+      }
+      for (k = 0; k < instr->arg_count; k++) {
+        char type = func->instrs[ir_arg(func, instr, k)].type;
+        if (type != '?') {
+          instr->type = type;
+          changed = 1;
+          break;
+        }
+      }
+    }
+  }
+  for (i = 0; i < func->instr_count; i++) {
+    if (func->instrs[i].type == '?') {
+      func->instrs[i].type = 'I';
+    }
+  }
+}
+
+/*
+ * Params of an OSR entry: the locals and stack slots of the
+ * interpreter frame at the loop header, typed by its oop map
+ */
+static uint32_t osr_params(struct ir_builder* b, struct ir_frame* f,
+                           uint32_t* params) {
+  const struct oop_map* map = f->method->oop_map;
+  uint32_t count = f->code->max_locals + (uint32_t)f->depth[b->func->osr_bci];
+  int32_t index = oop_map_find(map, (uint16_t)b->func->osr_bci);
+  uint32_t slot;
+
+  for (slot = 0; slot < count; slot++) {
+    params[slot] = emit(b, IR_PARAM,
+                        oop_map_is_ref(map, (uint32_t)index, slot) ? 'A' : 'I',
+                        (int32_t)slot, NULL, 0);
+  }
+  return count;
+}
+
+int ir_build(struct ir_function* func) {
+  struct method_info* method = func->method;
+  struct method_descriptor desc;
+  struct ir_builder b;
+  struct ir_frame root;
+  uint32_t* params;
+  uint32_t param_count;
+  uint32_t start = 0;
+  uint16_t slot;
+  uint32_t i;
+  int err;
+
+  if (method->code == NULL || method->code->exception_table_length != 0 ||
+      (method->access_flags & ACC_SYNCHRONIZED) ||
+      !supported_descriptor(validate_constant(func->class,
+                                              method->descriptor_index),
+                            &desc)) {
+    return ENOTSUP;
+  }
+
+  memset(&b, 0, sizeof(b));
+  b.func = func;
+  err = init_frame(&b, &root, NULL, func->class, method);
+  if (err != 0) {
+    return err;
+  }
+  if (func->osr_bci != IR_NONE) {
+    start = func->osr_bci;
+    /* loop headers have a stack map frame, thus an oop map entry */
+    if (start >= method->code->code_length || root.depth[start] < 0 ||
+        method->oop_map == NULL ||
+        oop_map_find(method->oop_map, (uint16_t)start) < 0) {
+      free_frame(&root);
+      return ENOTSUP;
+    }
+    err = restrict_to(&root, start);
+    if (err != 0) {
+      free_frame(&root);
+      return err;
+    }
+  }
+  func->entry = ir_new_block(func);
+  params = malloc((desc.arg_slots + 1u + method->code->max_locals +
+                   method->code->max_stack + 1u) *
+                  sizeof(uint32_t));
+  if (func->entry == IR_NONE || params == NULL) {
+    free(params);
+    free_frame(&root);
+    return ENOMEM;
+  }
+  func->blocks[func->entry].sealed = 1;
+  b.current = func->entry;
+  if (func->osr_bci != IR_NONE) {
+    param_count = osr_params(&b, &root, params);
+  } else {
+    slot = 0;
+    if (!(method->access_flags & ACC_STATIC)) {
+      params[slot] = emit(&b, IR_PARAM, 'A', (int32_t)slot, NULL, 0);
+      slot++;
+    }
+    for (i = 0; i < desc.arg_count; i++, slot++) {
+      params[slot] = emit(&b, IR_PARAM, desc.args[i] == 'L' ? 'A' : 'I',
+                          (int32_t)slot, NULL, 0);
+    }
+    param_count = slot;
+  }
+
+  err = parse_frame(&b, &root, start, params, param_count);
+  free(params);
+  for (i = 0; err == 0 && i < func->block_count; i++) {
+    if (!func->blocks[i].sealed) {
+      err = ENOTSUP;
+    }
+  }
+  free_frame(&root);
+  if (err == 0) {
+    infer_phi_types(func);
+  }
+  return err != 0 ? err : func->error;
+}
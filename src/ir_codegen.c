@@ -0,0 +1,1316 @@
+#include "ir.h"
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "class_layout.h"
+#include "interpreter.h"
+#include "safepoint.h"
+
+/*
+ * Code generation. Critical edges are split so phi moves always sit
+ * in a block with one successor, then values get one live interval
+ * each from a liveness pass over the blocks in reverse postorder
+ * (Wimmer's single pass with loop extension), and linear scan
+ * (Poletto and Sarkar) hands out registers. A spilled interval lives
+ * in its stack slot for its whole life.
+ *
+ * Registers: r15 = thread, rax, rcx and rdx are scratch, rsi, rdi and
+ * r8-r11 are allocated to intervals that don't cross a call, rbx and
+ * r12-r14 to any interval. Constants are never allocated, they are
+ * rematerialized at each use.
+ *
+ * The values of a check's state are used by the check, so they are in
+ * their location when it fails. Each check jumps to its own stub that
+ * names its deoptimization point, the stubs share the code that saves
+ * the registers and calls deopt_resume().
+ *
+ * Code built on class hierarchy assumptions tests its dependencies at
+ * the entry and hands the call to cha_reenter() once they are broken.
+ *
+ * Backward branches and returns poll for safepoints. Each poll
+ * records where the references that are live across it are: values
+ * whose interval covers the poll and whose definition dominates it,
+ * so their location can't hold anything else there.
+ */
+
+#define LOC_NONE 0
+#define LOC_REG 1
+#define LOC_STACK 2
+
+/* Labels after the block ids, the deoptimization stubs follow them */
+#define LABEL_RETURN 0
+#define LABEL_EXIT 1
+#define LABEL_OVERFLOW 2
+#define LABEL_DEOPT 3
+#define LABEL_REENTER 4
+#define LABEL_COUNT 5
+
+/* push rbp and the five saved registers */
+#define SAVED_BYTES 40
+
+#if IR_INLINE_MAX_DEPTH >= DEOPT_MAX_FRAMES
+#error "deoptimization must rebuild every inlined frame"
+#endif
+
+struct location {
+  uint8_t kind;
+  uint8_t reg; /* enum x86_reg */
+  int32_t disp; /* rbp displacement of a stack slot */
+};
+
+struct codegen_fixup {
+  size_t at;
+  uint32_t target; /* block id, block_count + LABEL_* or a stub after them */
+};
+
+struct codegen {
+  struct ir_function* func;
+  struct x86_asm* a;
+
+  uint32_t* start; /* position of each value's definition */
+  uint32_t* end;   /* last position it is live at */
+  struct location* loc;
+  uint32_t* block_from;
+  uint32_t* block_to;
+  uint32_t* calls; /* positions of calls, increasing */
+  uint32_t call_count;
+  uint32_t spill_slots;
+
+  size_t* native; /* code offset of each block */
+  size_t labels[LABEL_COUNT];
+  size_t* stubs; /* code offset of the stub of each deoptimization point */
+  struct codegen_fixup* fixups;
+  size_t fixup_count;
+  size_t fixup_capacity;
+};
+
+static const enum x86_reg caller_saved[] = {X86_RSI, X86_RDI, X86_R8,
+                                            X86_R9,  X86_R10, X86_R11};
+static const enum x86_reg callee_saved[] = {X86_RBX, X86_R12, X86_R13,
+                                            X86_R14};
+
+/* --- CFG preparation --- */
+
+static int has_phis(const struct ir_function* func, uint32_t block) {
+  const struct ir_block* b = &func->blocks[block];
+  return b->instr_count > 0 && func->instrs[b->instrs[0]].op == IR_PHI;
+}
+
+/* Drops replaced instructions and makes every operand direct */
+static void compact(struct ir_function* func) {
+  uint32_t i;
+
+  for (i = 0; i < func->block_count; i++) {
+    struct ir_block* b = &func->blocks[i];
+    uint32_t kept = 0;
+    uint32_t k;
+    for (k = 0; k < b->instr_count; k++) {
+      struct ir_instr* instr = &func->instrs[b->instrs[k]];
+      uint16_t j;
+      if (instr->op == IR_NOP || instr->forward != IR_NONE) {
+        continue;
+      }
+      for (j = 0; j < instr->arg_count; j++) {
+        func->operands[instr->args + j] = ir_arg(func, instr, j);
+      }
+      b->instrs[kept++] = b->instrs[k];
+    }
+    b->instr_count = kept;
+  }
+  for (i = 0; i < func->state_count; i++) {
+    const struct ir_state* state = &func->states[i];
+    uint32_t k;
+    for (k = 0; k < ir_state_size(state); k++) {
+      func->operands[state->values + k] =
+          ir_resolve(func, func->operands[state->values + k]);
+    }
+  }
+}
+
+/* Puts an empty block on every edge from a branch to a merge with phis */
+static int split_critical_edges(struct ir_function* func) {
+  uint32_t count = func->block_count;
+  uint32_t i;
+
+  for (i = 0; i < count; i++) {
+    uint8_t k;
+    if (func->blocks[i].order == IR_NONE || func->blocks[i].succ_count < 2) {
+      continue;
+    }
+    for (k = 0; k < func->blocks[i].succ_count; k++) {
+      uint32_t succ = func->blocks[i].succs[k];
+      uint32_t split;
+      uint32_t p;
+      if (func->blocks[succ].pred_count < 2 || !has_phis(func, succ)) {
+        continue;
+      }
+      split = ir_new_block(func);
+      if (split == IR_NONE) {
+        return ENOMEM;
+      }
+      ir_emit(func, split, IR_GOTO, 'V', 0, NULL, 0);
+      func->blocks[split].succs[0] = succ;
+      func->blocks[split].succ_count = 1;
+      func->blocks[split].preds = malloc(sizeof(uint32_t));
+      if (func->blocks[split].preds == NULL) {
+        return ENOMEM;
+      }
+      func->blocks[split].preds[0] = i;
+      func->blocks[split].pred_count = 1;
+      func->blocks[split].pred_capacity = 1;
+      func->blocks[i].succs[k] = split;
+      /* the first edge from i not split yet, the phi operand stays put */
+      for (p = 0; p < func->blocks[succ].pred_count; p++) {
+        if (func->blocks[succ].preds[p] == i) {
+          func->blocks[succ].preds[p] = split;
+          break;
+        }
+      }
+    }
+  }
+  return func->error;
+}
+
+/* --- liveness and intervals --- */
+
+static int allocated(const struct ir_function* func, uint32_t id) {
+  const struct ir_instr* instr = &func->instrs[id];
+  /* replaced allocations only live on in states */
+  return instr->type != 'V' && instr->op != IR_CONST && instr->op != IR_NEW;
+}
+
+static uint32_t pred_index(const struct ir_function* func, uint32_t block,
+                           uint32_t pred) {
+  const struct ir_block* b = &func->blocks[block];
+  uint32_t i;
+
+  for (i = 0; i < b->pred_count; i++) {
+    if (b->preds[i] == pred) {
+      return i;
+    }
+  }
+  return 0;
+}
+
+/* Last position inside the loop of each header, 0 elsewhere */
+static int loop_ends(struct codegen* g, uint32_t* loop_end) {
+  struct ir_function* func = g->func;
+  uint8_t* body = malloc(func->block_count + 1);
+  uint32_t* stack = malloc((func->block_count + 1) * sizeof(uint32_t));
+  uint32_t i;
+
+  if (body == NULL || stack == NULL) {
+    free(body);
+    free(stack);
+    return ENOMEM;
+  }
+  for (i = 0; i < func->order_count; i++) {
+    uint32_t header = func->order[i];
+    const struct ir_block* h = &func->blocks[header];
+    uint32_t depth = 0;
+    uint32_t k;
+
+    loop_end[header] = 0;
+    if (h->loop_header != header) {
+      continue;
+    }
+    memset(body, 0, func->block_count);
+    body[header] = 1;
+    loop_end[header] = g->block_to[header];
+    for (k = 0; k < h->pred_count; k++) {
+      if (ir_dominates(func, header, h->preds[k]) && !body[h->preds[k]]) {
+        body[h->preds[k]] = 1;
+        stack[depth++] = h->preds[k];
+      }
+    }
+    while (depth > 0) {
+      uint32_t block = stack[--depth];
+      const struct ir_block* b = &func->blocks[block];
+      if (g->block_to[block] > loop_end[header]) {
+        loop_end[header] = g->block_to[block];
+      }
+      for (k = 0; k < b->pred_count; k++) {
+        if (!body[b->preds[k]] && func->blocks[b->preds[k]].order != IR_NONE) {
+          body[b->preds[k]] = 1;
+          stack[depth++] = b->preds[k];
+        }
+      }
+    }
+  }
+  free(body);
+  free(stack);
+  return 0;
+}
+
+static void extend_to(struct codegen* g, uint32_t id, uint32_t position) {
+  if (position > g->end[id]) {
+    g->end[id] = position;
+  }
+}
+
+static int build_intervals(struct codegen* g) {
+  struct ir_function* func = g->func;
+  uint32_t words = (func->instr_count + 63) / 64;
+  uint64_t* live_in = calloc((size_t)func->block_count * words + 1,
+                             sizeof(uint64_t));
+  uint64_t* live = calloc(words + 1, sizeof(uint64_t));
+  uint32_t* loop_end = calloc(func->block_count + 1, sizeof(uint32_t));
+  uint32_t position = 0;
+  uint32_t i;
+  int err = 0;
+
+  if (live_in == NULL || live == NULL || loop_end == NULL) {
+    err = ENOMEM;
+    goto out;
+  }
+
+  /* positions: even numbers, phis at the block start */
+  for (i = 0; i < func->order_count; i++) {
+    const struct ir_block* b = &func->blocks[func->order[i]];
+    uint32_t k;
+    g->block_from[func->order[i]] = position;
+    position += 2;
+    for (k = 0; k < b->instr_count; k++) {
+      uint32_t id = b->instrs[k];
+      if (func->instrs[id].op == IR_PHI) {
+        g->start[id] = g->block_from[func->order[i]];
+      } else {
+        g->start[id] = position;
+        position += 2;
+      }
+      g->end[id] = g->start[id];
+      if (func->instrs[id].op == IR_CALL) {
+        g->calls[g->call_count++] = g->start[id];
+      }
+    }
+    g->block_to[func->order[i]] = position;
+    position += 2;
+  }
+  err = loop_ends(g, loop_end);
+  if (err != 0) {
+    goto out;
+  }
+
+  for (i = func->order_count; i-- > 0;) {
+    uint32_t block = func->order[i];
+    const struct ir_block* b = &func->blocks[block];
+    uint32_t k;
+    uint32_t w;
+    uint8_t s;
+
+    memset(live, 0, words * sizeof(uint64_t));
+    for (s = 0; s < b->succ_count; s++) {
+      uint32_t succ = b->succs[s];
+      const struct ir_block* sb = &func->blocks[succ];
+      uint32_t index = pred_index(func, succ, block);
+      for (w = 0; w < words; w++) {
+        live[w] |= live_in[(size_t)succ * words + w];
+      }
+      for (k = 0; k < sb->instr_count; k++) {
+        const struct ir_instr* phi = &func->instrs[sb->instrs[k]];
+        uint32_t value;
+        if (phi->op != IR_PHI) {
+          break;
+        }
+        value = func->operands[phi->args + index];
+        if (allocated(func, value)) {
+          live[value / 64] |= 1ULL << (value % 64);
+        }
+      }
+    }
+    for (w = 0; w < words; w++) {
+      uint64_t bits = live[w];
+      while (bits != 0) {
+        extend_to(g, w * 64 + (uint32_t)__builtin_ctzll(bits),
+                  g->block_to[block]);
+        bits &= bits - 1;
+      }
+    }
+    for (k = b->instr_count; k-- > 0;) {
+      uint32_t id = b->instrs[k];
+      const struct ir_instr* instr = &func->instrs[id];
+      uint32_t state;
+      uint16_t j;
+      if (instr->op == IR_PHI) {
+        live[id / 64] &= ~(1ULL << (id % 64));
+        continue;
+      }
+      live[id / 64] &= ~(1ULL << (id % 64));
+      for (j = 0; j < instr->arg_count; j++) {
+        uint32_t value = func->operands[instr->args + j];
+        if (allocated(func, value)) {
+          live[value / 64] |= 1ULL << (value % 64);
+          extend_to(g, value, g->start[id]);
+        }
+      }
+      for (state = instr->state; state != IR_NONE;
+           state = func->states[state].caller) {
+        const struct ir_state* s = &func->states[state];
+        uint32_t n;
+        for (n = 0; n < ir_state_size(s); n++) {
+          uint32_t value = func->operands[s->values + n];
+          if (allocated(func, value)) {
+            live[value / 64] |= 1ULL << (value % 64);
+            extend_to(g, value, g->start[id]);
+          }
+        }
+      }
+    }
+    if (loop_end[block] != 0) {
+      /* values live into the loop stay live through all of it */
+      for (w = 0; w < words; w++) {
+        uint64_t bits = live[w];
+        while (bits != 0) {
+          extend_to(g, w * 64 + (uint32_t)__builtin_ctzll(bits),
+                    loop_end[block]);
+          bits &= bits - 1;
+        }
+      }
+    }
+    memcpy(live_in + (size_t)block * words, live, words * sizeof(uint64_t));
+  }
+
+out:
+  free(live_in);
+  free(live);
+  free(loop_end);
+  return err;
+}
+
+/* --- linear scan --- */
+
+static int crosses_call(const struct codegen* g, uint32_t id) {
+  uint32_t low = 0;
+  uint32_t high = g->call_count;
+
+  /* first call after the definition */
+  while (low < high) {
+    uint32_t mid = (low + high) / 2;
+    if (g->calls[mid] <= g->start[id]) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return low < g->call_count && g->calls[low] < g->end[id];
+}
+
+static const uint32_t* sort_start;
+
+static int by_start(const void* a, const void* b) {
+  uint32_t x = *(const uint32_t*)a;
+  uint32_t y = *(const uint32_t*)b;
+
+  if (sort_start[x] != sort_start[y]) {
+    return sort_start[x] < sort_start[y] ? -1 : 1;
+  }
+  return x < y ? -1 : x > y;
+}
+
+static int callee_saved_reg(enum x86_reg reg) {
+  return reg == X86_RBX || (reg >= X86_R12 && reg <= X86_R14);
+}
+
+static void spill(struct codegen* g, uint32_t id) {
+  g->loc[id].kind = LOC_STACK;
+  g->loc[id].disp = -SAVED_BYTES - 8 - 8 * (int32_t)g->spill_slots++;
+  g->func->stats.spills++;
+}
+
+static int allocate(struct codegen* g) {
+  struct ir_function* func = g->func;
+  uint32_t* intervals = malloc((func->instr_count + 1) * sizeof(uint32_t));
+  uint32_t* active = malloc((func->instr_count + 1) * sizeof(uint32_t));
+  uint8_t used[16] = {0};
+  uint32_t count = 0;
+  uint32_t active_count = 0;
+  uint32_t i;
+
+  if (intervals == NULL || active == NULL) {
+    free(intervals);
+    free(active);
+    return ENOMEM;
+  }
+  for (i = 0; i < func->order_count; i++) {
+    const struct ir_block* b = &func->blocks[func->order[i]];
+    uint32_t k;
+    for (k = 0; k < b->instr_count; k++) {
+      if (allocated(func, b->instrs[k])) {
+        intervals[count++] = b->instrs[k];
+      }
+    }
+  }
+  sort_start = g->start;
+  qsort(intervals, count, sizeof(uint32_t), by_start);
+
+  for (i = 0; i < count; i++) {
+    uint32_t id = intervals[i];
+    int needs_saved = crosses_call(g, id);
+    int reg = -1;
+    uint32_t k;
+
+    /*
+     * Operands end where their user starts and stay taken, so the
+     * result never shares a register with an operand
+     */
+    for (k = 0; k < active_count;) {
+      if (g->end[active[k]] < g->start[id]) {
+        used[g->loc[active[k]].reg] = 0;
+        active[k] = active[--active_count];
+      } else {
+        k++;
+      }
+    }
+
+    if (!needs_saved) {
+      for (k = 0; k < sizeof(caller_saved) / sizeof(*caller_saved); k++) {
+        if (!used[caller_saved[k]]) {
+          reg = caller_saved[k];
+          break;
+        }
+      }
+    }
+    for (k = 0; reg < 0 && k < sizeof(callee_saved) / sizeof(*callee_saved);
+         k++) {
+      if (!used[callee_saved[k]]) {
+        reg = callee_saved[k];
+      }
+    }
+
+    if (reg < 0) {
+      /* spill whichever usable interval ends last */
+      uint32_t victim = UINT32_MAX;
+      for (k = 0; k < active_count; k++) {
+        uint32_t other = active[k];
+        if ((!needs_saved || callee_saved_reg(g->loc[other].reg)) &&
+            (victim == UINT32_MAX || g->end[other] > g->end[active[victim]])) {
+          victim = k;
+        }
+      }
+      if (victim != UINT32_MAX && g->end[active[victim]] > g->end[id]) {
+        reg = g->loc[active[victim]].reg;
+        spill(g, active[victim]);
+        active[victim] = active[--active_count];
+      } else {
+        spill(g, id);
+        continue;
+      }
+    }
+    used[reg] = 1;
+    g->loc[id].kind = LOC_REG;
+    g->loc[id].reg = (uint8_t)reg;
+    active[active_count++] = id;
+  }
+  free(intervals);
+  free(active);
+  return 0;
+}
+
+/* --- emission --- */
+
+static void add_fixup(struct codegen* g, size_t at, uint32_t target) {
+  if (g->fixup_count == g->fixup_capacity) {
+    size_t capacity = g->fixup_capacity != 0 ? g->fixup_capacity * 2 : 64;
+    struct codegen_fixup* fixups =
+        realloc(g->fixups, capacity * sizeof(struct codegen_fixup));
+    if (fixups == NULL) {
+      g->a->error = 1;
+      return;
+    }
+    g->fixups = fixups;
+    g->fixup_capacity = capacity;
+  }
+  g->fixups[g->fixup_count].at = at;
+  g->fixups[g->fixup_count].target = target;
+  g->fixup_count++;
+}
+
+static void jump(struct codegen* g, uint32_t target) {
+  add_fixup(g, x86_jmp(g->a, X86_NO_TARGET), target);
+}
+
+static void jump_if(struct codegen* g, enum x86_cond cond, uint32_t target) {
+  add_fixup(g, x86_jcc(g->a, cond, X86_NO_TARGET), target);
+}
+
+static uint32_t label(const struct codegen* g, uint32_t id) {
+  return g->func->block_count + id;
+}
+
+static int is_wide(const struct codegen* g, uint32_t id) {
+  return g->func->instrs[id].type == 'A';
+}
+
+/* A register holding the value, `scratch` unless it lives in one */
+static enum x86_reg use(struct codegen* g, uint32_t id, enum x86_reg scratch) {
+  const struct ir_instr* instr = &g->func->instrs[id];
+
+  if (instr->op == IR_CONST) {
+    x86_mov_ri(g->a, scratch, instr->imm);
+    return scratch;
+  }
+  if (g->loc[id].kind == LOC_REG) {
+    return (enum x86_reg)g->loc[id].reg;
+  }
+  x86_mov_rm(g->a, is_wide(g, id), scratch, X86_RBP, g->loc[id].disp);
+  return scratch;
+}
+
+static void load(struct codegen* g, uint32_t id, enum x86_reg reg) {
+  enum x86_reg from = use(g, id, reg);
+  if (from != reg) {
+    x86_mov_rr(g->a, is_wide(g, id), reg, from);
+  }
+}
+
+/* Register to compute a value in, rax for spilled values */
+static enum x86_reg result_reg(const struct codegen* g, uint32_t id) {
+  return g->loc[id].kind == LOC_REG ? (enum x86_reg)g->loc[id].reg : X86_RAX;
+}
+
+static void define(struct codegen* g, uint32_t id, enum x86_reg reg) {
+  if (g->loc[id].kind == LOC_REG) {
+    if (g->loc[id].reg != reg) {
+      x86_mov_rr(g->a, is_wide(g, id), (enum x86_reg)g->loc[id].reg, reg);
+    }
+  } else if (g->loc[id].kind == LOC_STACK) {
+    x86_mov_mr(g->a, is_wide(g, id), X86_RBP, g->loc[id].disp, reg);
+  }
+}
+
+/* Second operand of a two-operand instruction on `dst` */
+static void alu_operand(struct codegen* g, int wide, enum x86_alu op,
+                        enum x86_reg dst, uint32_t id) {
+  const struct ir_instr* instr = &g->func->instrs[id];
+
+  if (instr->op == IR_CONST) {
+    x86_alu_ri(g->a, wide, op, dst, instr->imm);
+  } else if (g->loc[id].kind == LOC_REG) {
+    x86_alu_rr(g->a, wide, op, dst, (enum x86_reg)g->loc[id].reg);
+  } else {
+    x86_alu_rm(g->a, wide, op, dst, X86_RBP, g->loc[id].disp);
+  }
+}
+
+static uint32_t arg(const struct codegen* g, const struct ir_instr* instr,
+                    uint16_t index) {
+  return g->func->operands[instr->args + index];
+}
+
+static void emit_division(struct codegen* g, uint32_t id, int remainder) {
+  const struct ir_instr* instr = &g->func->instrs[id];
+  size_t divide;
+  size_t done;
+
+  load(g, arg(g, instr, 1), X86_RCX);
+  load(g, arg(g, instr, 0), X86_RAX);
+  /* MIN_VALUE / -1 overflows in idiv, Java wraps it */
+  x86_alu_ri(g->a, 0, X86_CMP, X86_RCX, -1);
+  divide = x86_jcc(g->a, X86_CC_NE, X86_NO_TARGET);
+  if (remainder) {
+    x86_mov_ri(g->a, X86_RAX, 0);
+  } else {
+    x86_neg(g->a, 0, X86_RAX);
+  }
+  done = x86_jmp(g->a, X86_NO_TARGET);
+  x86_patch_jump(g->a, divide, g->a->size);
+  x86_cdq(g->a);
+  x86_idiv(g->a, 0, X86_RCX);
+  if (remainder) {
+    x86_mov_rr(g->a, 0, X86_RAX, X86_RDX);
+  }
+  x86_patch_jump(g->a, done, g->a->size);
+  define(g, id, X86_RAX);
+}
+
+static int element_size(int32_t type, int* sign) {
+  *sign = type != T_CHAR;
+  return type == T_INT ? 4 : type == T_BYTE ? 1 : 2;
+}
+
+static void emit_call(struct codegen* g, uint32_t id) {
+  const struct ir_instr* instr = &g->func->instrs[id];
+  struct jit_call_site* site = &g->func->sites[instr->imm];
+  uint16_t i;
+
+  /* arguments go to the outgoing area at the bottom of the frame */
+  for (i = 0; i < instr->arg_count; i++) {
+    x86_mov_mr(g->a, 1, X86_RSP, 8 * i, use(g, arg(g, instr, i), X86_RAX));
+  }
+  x86_mov_rr(g->a, 1, X86_RDI, X86_R15);
+  x86_mov_rr(g->a, 1, X86_RSI, X86_RSP);
+  x86_mov_ri64(g->a, X86_RDX, (uint64_t)(uintptr_t)site);
+  x86_call_m(g->a, X86_RDX, (int32_t)offsetof(struct jit_call_site, target));
+  x86_alu_mi(g->a, 1, X86_CMP, X86_R15,
+             (int32_t)offsetof(struct interp_thread, exception_class), 0);
+  jump_if(g, X86_CC_NE, label(g, LABEL_EXIT));
+  if (instr->type != 'V') {
+    define(g, id, X86_RAX);
+  }
+}
+
+static int same_location(const struct location* a, const struct location* b) {
+  return a->kind == b->kind &&
+         (a->kind == LOC_REG ? a->reg == b->reg : a->disp == b->disp);
+}
+
+struct phi_move {
+  struct location dst;
+  struct location src; /* LOC_NONE for a constant */
+  int32_t value;
+  int wide;
+};
+
+static void emit_move(struct codegen* g, const struct phi_move* m) {
+  enum x86_reg src;
+
+  if (m->src.kind == LOC_NONE) {
+    src = m->dst.kind == LOC_REG ? (enum x86_reg)m->dst.reg : X86_RCX;
+    x86_mov_ri(g->a, src, m->value);
+  } else if (m->src.kind == LOC_REG) {
+    src = (enum x86_reg)m->src.reg;
+  } else {
+    src = m->dst.kind == LOC_REG ? (enum x86_reg)m->dst.reg : X86_RCX;
+    x86_mov_rm(g->a, m->wide, src, X86_RBP, m->src.disp);
+  }
+  if (m->dst.kind == LOC_REG) {
+    if (src != m->dst.reg) {
+      x86_mov_rr(g->a, m->wide, (enum x86_reg)m->dst.reg, src);
+    }
+  } else {
+    x86_mov_mr(g->a, m->wide, X86_RBP, m->dst.disp, src);
+  }
+}
+
+/*
+ * Copies the phi operands of the edge into the phis of `succ` at
+ * once: moves run when no other move still reads their destination,
+ * a cycle is broken by parking one destination in rax
+ */
+static int emit_phi_moves(struct codegen* g, uint32_t block, uint32_t succ) {
+  struct ir_function* func = g->func;
+  const struct ir_block* s = &func->blocks[succ];
+  uint32_t index = pred_index(func, succ, block);
+  struct phi_move* moves = malloc((s->instr_count + 1) * sizeof(*moves));
+  uint32_t count = 0;
+  uint32_t k;
+
+  if (moves == NULL) {
+    return ENOMEM;
+  }
+  for (k = 0; k < s->instr_count; k++) {
+    uint32_t phi = s->instrs[k];
+    const struct ir_instr* instr = &func->instrs[phi];
+    uint32_t value;
+    struct phi_move* m = &moves[count];
+    if (instr->op != IR_PHI) {
+      break;
+    }
+    value = func->operands[instr->args + index];
+    if (g->loc[phi].kind == LOC_NONE) {
+      continue;
+    }
+    m->dst = g->loc[phi];
+    m->wide = instr->type == 'A';
+    if (func->instrs[value].op == IR_CONST) {
+      m->src.kind = LOC_NONE;
+      m->value = func->instrs[value].imm;
+    } else {
+      m->src = g->loc[value];
+      if (same_location(&m->src, &m->dst)) {
+        continue;
+      }
+    }
+    count++;
+  }
+
+  while (count > 0) {
+    int progress = 0;
+    uint32_t i;
+    for (i = 0; i < count; i++) {
+      uint32_t j;
+      int blocked = 0;
+      for (j = 0; j < count && !blocked; j++) {
+        blocked = j != i && moves[j].src.kind != LOC_NONE &&
+                  same_location(&moves[j].src, &moves[i].dst);
+      }
+      if (!blocked) {
+        emit_move(g, &moves[i]);
+        moves[i] = moves[--count];
+        progress = 1;
+        break;
+      }
+    }
+    if (!progress) {
+      struct location parked = {LOC_REG, X86_RAX, 0};
+      struct phi_move save = {parked, moves[0].dst, 0, 1};
+      emit_move(g, &save);
+      for (i = 0; i < count; i++) {
+        if (moves[i].src.kind != LOC_NONE &&
+            same_location(&moves[i].src, &moves[0].dst)) {
+          moves[i].src = parked;
+        }
+      }
+    }
+  }
+  free(moves);
+  return 0;
+}
+
+static enum x86_cond condition(uint8_t cond) {
+  static const enum x86_cond conditions[] = {
+      X86_CC_E, X86_CC_NE, X86_CC_L, X86_CC_GE, X86_CC_G, X86_CC_LE,
+  };
+  return conditions[cond];
+}
+
+static uint8_t negate(uint8_t cond) {
+  static const uint8_t negated[] = {IR_NE, IR_EQ, IR_GE, IR_LT, IR_LE, IR_GT};
+  return negated[cond];
+}
+
+/* a cond b as b cond' a */
+static uint8_t mirror(uint8_t cond) {
+  static const uint8_t mirrored[] = {IR_EQ, IR_NE, IR_GT, IR_LE, IR_LT, IR_GE};
+  return mirrored[cond];
+}
+
+static void emit_branch(struct codegen* g, uint32_t block, uint32_t id,
+                        uint32_t next) {
+  const struct ir_instr* instr = &g->func->instrs[id];
+  const struct ir_block* b = &g->func->blocks[block];
+  uint32_t left = arg(g, instr, 0);
+  uint32_t right = arg(g, instr, 1);
+  uint8_t cond = instr->cond;
+  int wide = is_wide(g, left) || is_wide(g, right);
+
+  if (g->func->instrs[left].op == IR_CONST &&
+      g->func->instrs[right].op != IR_CONST) {
+    uint32_t t = left;
+    left = right;
+    right = t;
+    cond = mirror(cond);
+  }
+  alu_operand(g, wide, X86_CMP, use(g, left, X86_RAX), right);
+  if (b->succs[0] == next) {
+    jump_if(g, condition(negate(cond)), b->succs[1]);
+  } else {
+    jump_if(g, condition(cond), b->succs[0]);
+    if (b->succs[1] != next) {
+      jump(g, b->succs[1]);
+    }
+  }
+}
+
+static struct deopt_value deopt_value_of(const struct codegen* g,
+                                         uint32_t id) {
+  const struct ir_instr* instr = &g->func->instrs[id];
+  struct deopt_value value;
+
+  value.kind = DEOPT_CONST;
+  value.reg = 0;
+  value.type = instr->type == 'A' ? 'A' : 'I';
+  value.value = instr->op == IR_CONST ? instr->imm : 0;
+  if (instr->op != IR_CONST && g->loc[id].kind == LOC_REG) {
+    value.kind = DEOPT_REG;
+    value.reg = g->loc[id].reg;
+  } else if (instr->op != IR_CONST && g->loc[id].kind == LOC_STACK) {
+    value.kind = DEOPT_STACK;
+    value.value = g->loc[id].disp;
+  }
+  return value;
+}
+
+/*
+ * Objects to allocate from the object section of the innermost state,
+ * which follows its frame values: each allocation and its fields
+ */
+static int deopt_objects(struct codegen* g, const struct ir_state* s) {
+  struct ir_function* func = g->func;
+  uint32_t n = (uint32_t)s->local_count + s->stack_count;
+  uint32_t end = ir_state_size(s);
+
+  while (n < end) {
+    const struct ir_object* object =
+        &func->objects[func->instrs[func->operands[s->values + n]].imm];
+    struct deopt_field* fields = deopt_add_object(
+        func->deopt, object->class->layout, object->field_count);
+    uint16_t f;
+    if (fields == NULL) {
+      return ENOMEM;
+    }
+    for (f = 0; f < object->field_count; f++) {
+      fields[f].offset = object->offsets[f];
+      fields[f].value =
+          deopt_value_of(g, func->operands[s->values + n + 1 + f]);
+    }
+    n += 1u + object->field_count;
+  }
+  return 0;
+}
+
+/* Index of an allocation among the objects of the innermost state */
+static int32_t deopt_object_index(const struct ir_function* func,
+                                  const struct ir_state* s, uint32_t id) {
+  uint32_t n = (uint32_t)s->local_count + s->stack_count;
+  int32_t index = 0;
+
+  while (func->operands[s->values + n] != id) {
+    n += 1u + func->objects[func->instrs[func->operands[s->values + n]].imm]
+                  .field_count;
+    index++;
+  }
+  return index;
+}
+
+/* Records where the state of a check lives, returns its stub's target */
+static uint32_t deopt_point(struct codegen* g, uint32_t id) {
+  struct ir_function* func = g->func;
+  const struct ir_state* innermost = &func->states[func->instrs[id].state];
+  uint32_t state;
+  int32_t point;
+
+  if (func->deopt == NULL) {
+    func->deopt = deopt_table_new();
+  }
+  point = func->deopt != NULL ? deopt_add_point(func->deopt) : -1;
+  if (point < 0 || deopt_objects(g, innermost) != 0) {
+    g->a->error = 1;
+    return label(g, LABEL_DEOPT);
+  }
+  for (state = func->instrs[id].state; state != IR_NONE;
+       state = func->states[state].caller) {
+    const struct ir_state* s = &func->states[state];
+    struct deopt_value* values =
+        deopt_add_frame(func->deopt, s->class, s->method, s->bci,
+                        s->local_count, s->stack_count);
+    uint32_t k;
+    if (values == NULL) {
+      g->a->error = 1;
+      break;
+    }
+    for (k = 0; k < (uint32_t)s->local_count + s->stack_count; k++) {
+      uint32_t value = func->operands[s->values + k];
+      if (func->instrs[value].op == IR_NEW) {
+        values[k].kind = DEOPT_OBJECT;
+        values[k].reg = 0;
+        values[k].type = 'A';
+        values[k].value = deopt_object_index(func, innermost, value);
+      } else {
+        values[k] = deopt_value_of(g, value);
+      }
+    }
+  }
+  return func->block_count + LABEL_COUNT + (uint32_t)point;
+}
+
+static int live_reference(const struct codegen* g, uint32_t id,
+                          uint32_t block, uint32_t position) {
+  const struct ir_instr* instr = &g->func->instrs[id];
+
+  return instr->type == 'A' && allocated(g->func, id) &&
+         g->loc[id].kind != LOC_NONE && g->start[id] < position &&
+         g->end[id] >= position && ir_dominates(g->func, instr->block, block);
+}
+
+/* Safepoint poll in front of instruction id of the block */
+static int emit_poll(struct codegen* g, uint32_t block, uint32_t id) {
+  struct ir_function* func = g->func;
+  uint32_t position = g->start[id];
+  struct deopt_value* values;
+  int32_t poll = -1;
+  uint32_t count = 0;
+  uint32_t v;
+
+  for (v = 0; v < func->instr_count; v++) {
+    count += (uint32_t)live_reference(g, v, block, position);
+  }
+  if (func->deopt == NULL) {
+    func->deopt = deopt_table_new();
+  }
+  if (func->deopt != NULL && count <= UINT16_MAX) {
+    poll = deopt_add_poll(func->deopt, (uint32_t)g->a->size,
+                          (uint16_t)count);
+  }
+  if (poll < 0) {
+    return ENOMEM;
+  }
+  values = func->deopt->values + func->deopt->polls[poll].values;
+  for (v = 0; v < func->instr_count; v++) {
+    if (live_reference(g, v, block, position)) {
+      *values++ = deopt_value_of(g, v);
+    }
+  }
+  x86_test_abs(g->a, safepoint_poll_address(), X86_RAX);
+  return 0;
+}
+
+static int is_backedge(const struct ir_function* func, uint32_t block,
+                       uint32_t succ) {
+  return ir_dominates(func, succ, block);
+}
+
+static int emit_instr(struct codegen* g, uint32_t block, uint32_t id,
+                      uint32_t next) {
+  const struct ir_instr* instr = &g->func->instrs[id];
+  enum x86_reg dst = result_reg(g, id);
+  struct x86_asm* a = g->a;
+
+  switch (instr->op) {
+    case IR_CONST:
+    case IR_PHI:
+      break;
+    case IR_PARAM:
+      /* rax holds the argument pointer through the entry block */
+      if (dst == X86_RAX) {
+        dst = X86_RCX;
+      }
+      x86_mov_rm(a, is_wide(g, id), dst, X86_RAX, 8 * instr->imm);
+      define(g, id, dst);
+      break;
+    case IR_ADD:
+    case IR_SUB:
+    case IR_AND:
+    case IR_OR:
+    case IR_XOR: {
+      enum x86_alu op = instr->op == IR_ADD   ? X86_ADD
+                        : instr->op == IR_SUB ? X86_SUB
+                        : instr->op == IR_AND ? X86_AND
+                        : instr->op == IR_OR  ? X86_OR
+                                              : X86_XOR;
+      load(g, arg(g, instr, 0), dst);
+      alu_operand(g, 0, op, dst, arg(g, instr, 1));
+      define(g, id, dst);
+      break;
+    }
+    case IR_MUL:
+      load(g, arg(g, instr, 0), dst);
+      x86_imul_rr(a, 0, dst, use(g, arg(g, instr, 1), X86_RCX));
+      define(g, id, dst);
+      break;
+    case IR_DIV:
+    case IR_REM:
+      emit_division(g, id, instr->op == IR_REM);
+      break;
+    case IR_SHL:
+    case IR_SHR:
+    case IR_USHR:
+      /* x86 masks 32-bit shift counts to 5 bits like Java */
+      load(g, arg(g, instr, 1), X86_RCX);
+      load(g, arg(g, instr, 0), dst);
+      x86_shift_cl(a, 0,
+                   instr->op == IR_SHL   ? X86_SHL
+                   : instr->op == IR_SHR ? X86_SAR
+                                         : X86_SHR,
+                   dst);
+      define(g, id, dst);
+      break;
+    case IR_NEG:
+      load(g, arg(g, instr, 0), dst);
+      x86_neg(a, 0, dst);
+      define(g, id, dst);
+      break;
+    case IR_I2B:
+      x86_movsx8(a, dst, use(g, arg(g, instr, 0), X86_RAX));
+      define(g, id, dst);
+      break;
+    case IR_I2C:
+      x86_movzx16(a, dst, use(g, arg(g, instr, 0), X86_RAX));
+      define(g, id, dst);
+      break;
+    case IR_I2S:
+      x86_movsx16(a, dst, use(g, arg(g, instr, 0), X86_RAX));
+      define(g, id, dst);
+      break;
+
+    case IR_NULL_CHECK:
+      load(g, arg(g, instr, 0), dst);
+      x86_test_rr(a, 1, dst, dst);
+      jump_if(g, X86_CC_E, deopt_point(g, id));
+      define(g, id, dst);
+      break;
+    case IR_ZERO_CHECK:
+      load(g, arg(g, instr, 0), dst);
+      x86_test_rr(a, 0, dst, dst);
+      jump_if(g, X86_CC_E, deopt_point(g, id));
+      define(g, id, dst);
+      break;
+    case IR_BOUNDS_CHECK:
+      /* unsigned compare also rejects negative indexes */
+      load(g, arg(g, instr, 0), dst);
+      alu_operand(g, 0, X86_CMP, dst, arg(g, instr, 1));
+      jump_if(g, X86_CC_AE, deopt_point(g, id));
+      define(g, id, dst);
+      break;
+    case IR_ARRAY_LENGTH:
+      x86_mov_rm(a, 0, dst, use(g, arg(g, instr, 0), X86_RCX),
+                 (int32_t)offsetof(struct array_header, length));
+      define(g, id, dst);
+      break;
+    case IR_ARRAY_LOAD: {
+      int sign;
+      int size = element_size(instr->imm, &sign);
+      enum x86_reg array = use(g, arg(g, instr, 0), X86_RCX);
+      x86_load_indexed(a, size, sign, dst, array,
+                       use(g, arg(g, instr, 1), X86_RDX),
+                       (int32_t)sizeof(struct array_header));
+      define(g, id, dst);
+      break;
+    }
+    case IR_ARRAY_STORE: {
+      int sign;
+      int size = element_size(instr->imm, &sign);
+      enum x86_reg array = use(g, arg(g, instr, 0), X86_RCX);
+      enum x86_reg index = use(g, arg(g, instr, 1), X86_RDX);
+      x86_store_indexed(a, size, array, index,
+                        (int32_t)sizeof(struct array_header),
+                        use(g, arg(g, instr, 2), X86_RAX));
+      break;
+    }
+    case IR_FIELD_LOAD:
+      x86_mov_rm(a, 0, dst, use(g, arg(g, instr, 0), X86_RCX), instr->imm);
+      define(g, id, dst);
+      break;
+    case IR_FIELD_STORE: {
+      enum x86_reg object = use(g, arg(g, instr, 0), X86_RCX);
+      x86_mov_mr(a, 0, object, instr->imm, use(g, arg(g, instr, 1), X86_RAX));
+      break;
+    }
+    case IR_CALL:
+      emit_call(g, id);
+      break;
+
+    case IR_IF: {
+      const struct ir_block* b = &g->func->blocks[block];
+      if (is_backedge(g->func, block, b->succs[0]) ||
+          is_backedge(g->func, block, b->succs[1])) {
+        int err = emit_poll(g, block, id);
+        if (err != 0) {
+          return err;
+        }
+      }
+      emit_branch(g, block, id, next);
+      break;
+    }
+    case IR_GOTO: {
+      uint32_t succ = g->func->blocks[block].succs[0];
+      int err = is_backedge(g->func, block, succ) ? emit_poll(g, block, id)
+                                                  : 0;
+      if (err == 0) {
+        err = emit_phi_moves(g, block, succ);
+      }
+      if (err != 0) {
+        return err;
+      }
+      if (succ != next) {
+        jump(g, succ);
+      }
+      break;
+    }
+    case IR_RETURN: {
+      int err = emit_poll(g, block, id);
+      if (err != 0) {
+        return err;
+      }
+      if (instr->arg_count > 0) {
+        load(g, arg(g, instr, 0), X86_RAX);
+      } else {
+        x86_mov_ri(a, X86_RAX, 0);
+      }
+      jump(g, label(g, LABEL_RETURN));
+      break;
+    }
+  }
+  return 0;
+}
+
+static void emit_throw(struct codegen* g, const char* class_name) {
+  x86_mov_rr(g->a, 1, X86_RDI, X86_R15);
+  x86_mov_ri64(g->a, X86_RSI, (uint64_t)(uintptr_t)class_name);
+  x86_mov_ri64(g->a, X86_RAX, (uint64_t)(uintptr_t)interp_throw);
+  x86_call_r(g->a, X86_RAX);
+  jump(g, label(g, LABEL_EXIT));
+}
+
+/*
+ * Shared tail of the stubs, edx holds the point. The registers are
+ * pushed so that they lie in memory by number, rsp stays aligned
+ */
+static void emit_deopt(struct codegen* g) {
+  struct x86_asm* a = g->a;
+  int reg;
+
+  for (reg = X86_R15; reg >= X86_RAX; reg--) {
+    x86_push(a, (enum x86_reg)reg);
+  }
+  x86_mov_rr(a, 1, X86_RDI, X86_R15);
+  x86_mov_ri64(a, X86_RSI, (uint64_t)(uintptr_t)g->func->deopt);
+  x86_mov_rr(a, 1, X86_RCX, X86_RSP);
+  x86_mov_rr(a, 1, X86_R8, X86_RBP);
+  x86_mov_ri64(a, X86_RAX, (uint64_t)(uintptr_t)deopt_resume);
+  x86_call_r(a, X86_RAX);
+  jump(g, label(g, LABEL_RETURN));
+}
+
+/* OSR code is withdrawn before the interpreter can enter it again */
+static int guarded(const struct ir_function* func) {
+  return func->dependencies != NULL && func->dependencies->count > 0 &&
+         func->osr_bci == IR_NONE;
+}
+
+/*
+ *   push rbp; mov rbp, rsp; push rbx, r12, r13, r14, r15; sub rsp, frame
+ *   | saved | spill slots ... | outgoing arguments |  <- rsp
+ * frame keeps rsp 16-byte aligned for calls
+ */
+static int emit_function(struct codegen* g) {
+  struct ir_function* func = g->func;
+  struct x86_asm* a = g->a;
+  int32_t depth_disp = (int32_t)offsetof(struct interp_thread, depth);
+  int32_t frame = 8 * (int32_t)(g->spill_slots + func->max_call_args);
+  uint32_t points;
+  uint32_t p;
+  uint32_t i;
+  size_t k;
+
+  if (frame % 16 == 0) {
+    frame += 8;
+  }
+  x86_push(a, X86_RBP);
+  x86_mov_rr(a, 1, X86_RBP, X86_RSP);
+  x86_push(a, X86_RBX);
+  x86_push(a, X86_R12);
+  x86_push(a, X86_R13);
+  x86_push(a, X86_R14);
+  x86_push(a, X86_R15);
+  x86_alu_ri(a, 1, X86_SUB, X86_RSP, frame);
+  x86_mov_rr(a, 1, X86_R15, X86_RDI);
+  x86_alu_mi(a, 0, X86_ADD, X86_R15, depth_disp, 1);
+  x86_alu_mi(a, 0, X86_CMP, X86_R15, depth_disp, INTERP_MAX_DEPTH);
+  jump_if(g, X86_CC_A, label(g, LABEL_OVERFLOW));
+  x86_mov_rr(a, 1, X86_RAX, X86_RSI);
+  if (guarded(func)) {
+    x86_mov_ri64(a, X86_RCX, (uint64_t)(uintptr_t)&func->dependencies->invalid);
+    x86_alu_mi(a, 0, X86_CMP, X86_RCX, 0, 0);
+    jump_if(g, X86_CC_NE, label(g, LABEL_REENTER));
+  }
+
+  for (i = 0; i < func->order_count; i++) {
+    uint32_t block = func->order[i];
+    uint32_t next = i + 1 < func->order_count ? func->order[i + 1] : IR_NONE;
+    const struct ir_block* b = &func->blocks[block];
+    uint32_t j;
+
+    g->native[block] = a->size;
+    for (j = 0; j < b->instr_count; j++) {
+      int err = emit_instr(g, block, b->instrs[j], next);
+      if (err != 0) {
+        return err;
+      }
+    }
+  }
+
+  points = func->deopt != NULL ? func->deopt->point_count : 0;
+  g->stubs = malloc((points + 1) * sizeof(size_t));
+  if (g->stubs == NULL) {
+    return ENOMEM;
+  }
+  for (p = 0; p < points; p++) {
+    g->stubs[p] = a->size;
+    x86_mov_ri(a, X86_RDX, (int32_t)p);
+    jump(g, label(g, LABEL_DEOPT));
+  }
+  g->labels[LABEL_DEOPT] = a->size;
+  if (points > 0) {
+    emit_deopt(g);
+  }
+
+  g->labels[LABEL_REENTER] = a->size;
+  if (guarded(func)) {
+    x86_mov_rr(a, 1, X86_RDI, X86_R15);
+    x86_mov_rr(a, 1, X86_RSI, X86_RAX);
+    x86_mov_ri64(a, X86_RDX, (uint64_t)(uintptr_t)func->dependencies);
+    x86_mov_ri64(a, X86_RAX, (uint64_t)(uintptr_t)cha_reenter);
+    x86_call_r(a, X86_RAX);
+    jump(g, label(g, LABEL_RETURN));
+  }
+  g->labels[LABEL_OVERFLOW] = a->size;
+  emit_throw(g, "java/lang/StackOverflowError");
+  g->labels[LABEL_EXIT] = a->size;
+  x86_mov_ri(a, X86_RAX, 0);
+  g->labels[LABEL_RETURN] = a->size;
+  x86_alu_mi(a, 0, X86_SUB, X86_R15, depth_disp, 1);
+  x86_lea(a, X86_RSP, X86_RBP, -SAVED_BYTES);
+  x86_pop(a, X86_R15);
+  x86_pop(a, X86_R14);
+  x86_pop(a, X86_R13);
+  x86_pop(a, X86_R12);
+  x86_pop(a, X86_RBX);
+  x86_pop(a, X86_RBP);
+  x86_ret(a);
+
+  for (k = 0; k < g->fixup_count; k++) {
+    uint32_t target = g->fixups[k].target;
+    x86_patch_jump(a, g->fixups[k].at,
+                   target < func->block_count ? g->native[target]
+                   : target < func->block_count + LABEL_COUNT
+                       ? g->labels[target - func->block_count]
+                       : g->stubs[target - func->block_count - LABEL_COUNT]);
+  }
+  return a->error ? ENOMEM : 0;
+}
+
+int ir_generate(struct ir_function* func, struct x86_asm* a) {
+  struct codegen g;
+  int err;
+
+  if (func->error != 0) {
+    return func->error;
+  }
+  compact(func);
+  err = split_critical_edges(func);
+  if (err == 0) {
+    err = ir_compute_dominators(func);
+  }
+  if (err != 0) {
+    return err;
+  }
+
+  memset(&g, 0, sizeof(g));
+  g.func = func;
+  g.a = a;
+  g.start = calloc(func->instr_count + 1, sizeof(uint32_t));
+  g.end = calloc(func->instr_count + 1, sizeof(uint32_t));
+  g.loc = calloc(func->instr_count + 1, sizeof(struct location));
+  g.block_from = calloc(func->block_count + 1, sizeof(uint32_t));
+  g.block_to = calloc(func->block_count + 1, sizeof(uint32_t));
+  g.calls = calloc(func->instr_count + 1, sizeof(uint32_t));
+  g.native = calloc(func->block_count + 1, sizeof(size_t));
+  if (g.start == NULL || g.end == NULL || g.loc == NULL ||
+      g.block_from == NULL || g.block_to == NULL || g.calls == NULL ||
+      g.native == NULL) {
+    err = ENOMEM;
+  }
+  if (err == 0) {
+    err = build_intervals(&g);
+  }
+  if (err == 0) {
+    err = allocate(&g);
+  }
+  if (err == 0) {
+    err = emit_function(&g);
+  }
+  free(g.start);
+  free(g.end);
+  free(g.loc);
+  free(g.block_from);
+  free(g.block_to);
+  free(g.calls);
+  free(g.native);
+  free(g.stubs);
+  free(g.fixups);
+  return err;
+}
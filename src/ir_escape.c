@@ -0,0 +1,458 @@
+#include "ir.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Escape analysis and scalar replacement. An allocation escapes when
+ * any instruction other than a field access or a null check uses it:
+ * a call, a return, a phi, a comparison or a store into another
+ * object. Each field of an allocation that doesn't escape becomes an
+ * SSA variable defined by the stores, built over the finished CFG
+ * like the builder builds locals: a load reads the last store in its
+ * block or the value flowing into the block, merges get phis.
+ *
+ * The interpreter still needs the objects when a check fails. The
+ * state of every check gets the objects its frames refer to, with
+ * the field values at the check, and the deoptimization allocates
+ * them again.
+ */
+
+struct field_ssa {
+  struct ir_function* func;
+  uint32_t* first; /* of each object's fields in the rows below */
+  uint32_t* values; /* two rows of block_count per field */
+  uint32_t zero;
+
+  /* field being read */
+  uint32_t object; /* IR_NEW */
+  int32_t offset;
+  uint32_t* in;  /* value at the start of each block, IR_NONE if unknown */
+  uint32_t* out; /* value at the end of each block, IR_NONE if unknown */
+};
+
+static int32_t field_index(const struct ir_object* object, int32_t offset) {
+  uint16_t i;
+
+  for (i = 0; i < object->field_count; i++) {
+    if (object->offsets[i] == offset) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/*
+ * Phis no instruction reads, directly or through other phis, become
+ * zero. They are locals like a loop variable's object
+ * from the previous iteration that the code overwrites before reading
+ * again; the interpreter runs the same code and won't read them
+ * either, but the states still name them and they would keep the
+ * allocation from being replaced
+ */
+static void drop_unread_phis(struct ir_function* func) {
+  uint8_t* read = calloc(func->instr_count + 1, 1);
+  uint32_t* work = malloc((func->instr_count + 1) * sizeof(uint32_t));
+  uint32_t count = 0;
+  uint32_t zero[2] = {IR_NONE, IR_NONE}; /* int, reference */
+  uint32_t i;
+
+  if (read == NULL || work == NULL) {
+    free(read);
+    free(work);
+    func->error = ENOMEM;
+    return;
+  }
+  for (i = 0; i < func->order_count; i++) {
+    const struct ir_block* b = &func->blocks[func->order[i]];
+    uint32_t k;
+    for (k = 0; k < b->instr_count; k++) {
+      const struct ir_instr* instr = &func->instrs[b->instrs[k]];
+      uint16_t j;
+      if (instr->op == IR_PHI) {
+        continue;
+      }
+      for (j = 0; j < instr->arg_count; j++) {
+        uint32_t arg = ir_arg(func, instr, j);
+        if (func->instrs[arg].op == IR_PHI && !read[arg]) {
+          read[arg] = 1;
+          work[count++] = arg;
+        }
+      }
+    }
+  }
+  while (count > 0) {
+    const struct ir_instr* phi = &func->instrs[work[--count]];
+    uint16_t j;
+    for (j = 0; j < phi->arg_count; j++) {
+      uint32_t arg = ir_arg(func, phi, j);
+      if (func->instrs[arg].op == IR_PHI && !read[arg]) {
+        read[arg] = 1;
+        work[count++] = arg;
+      }
+    }
+  }
+  for (i = 0; i < func->order_count; i++) {
+    const struct ir_block* b = &func->blocks[func->order[i]];
+    uint32_t k = 0;
+    while (k < b->instr_count) {
+      uint32_t id = b->instrs[k];
+      int reference;
+      if (func->instrs[id].op != IR_PHI || read[id]) {
+        k++;
+        continue;
+      }
+      reference = func->instrs[id].type == 'A';
+      if (zero[reference] == IR_NONE) {
+        zero[reference] = ir_emit(func, func->entry, IR_CONST,
+                                  reference ? 'A' : 'I', 0, NULL, 0);
+        if (zero[reference] == IR_NONE) {
+          break;
+        }
+      }
+      ir_remove_from_block(func, id);
+      ir_replace(func, id, zero[reference]);
+    }
+  }
+  free(read);
+  free(work);
+}
+
+/* Whether an allocation is used by more than field accesses and null checks */
+static int escapes(const struct ir_function* func) {
+  uint32_t i;
+
+  for (i = 0; i < func->order_count; i++) {
+    const struct ir_block* b = &func->blocks[func->order[i]];
+    uint32_t k;
+    for (k = 0; k < b->instr_count; k++) {
+      const struct ir_instr* instr = &func->instrs[b->instrs[k]];
+      uint16_t j;
+      for (j = 0; j < instr->arg_count; j++) {
+        const struct ir_instr* arg = &func->instrs[ir_arg(func, instr, j)];
+        if (arg->op != IR_NEW) {
+          continue;
+        }
+        if (instr->op == IR_NULL_CHECK) {
+          continue;
+        }
+        if ((instr->op != IR_FIELD_LOAD && instr->op != IR_FIELD_STORE) ||
+            j != 0 ||
+            field_index(&func->objects[arg->imm], instr->imm) < 0) {
+          return 1;
+        }
+      }
+    }
+  }
+  return 0;
+}
+
+static void select_field(struct field_ssa* s, uint32_t object, uint16_t field) {
+  uint32_t blocks = s->func->block_count;
+  uint32_t row = s->first[object] + field;
+
+  s->object = s->func->objects[object].instr;
+  s->offset = s->func->objects[object].offsets[field];
+  s->in = s->values + (size_t)row * 2 * blocks;
+  s->out = s->in + blocks;
+}
+
+static uint32_t value_in(struct field_ssa* s, uint32_t block);
+
+/* Field value before the instruction at `position` of the block */
+static uint32_t value_before(struct field_ssa* s, uint32_t block,
+                             uint32_t position) {
+  struct ir_function* func = s->func;
+  const struct ir_block* b = &func->blocks[block];
+
+  while (position-- > 0) {
+    uint32_t id = b->instrs[position];
+    const struct ir_instr* instr = &func->instrs[id];
+    if (id == s->object) {
+      return s->zero;
+    }
+    if (instr->op == IR_FIELD_STORE && instr->imm == s->offset &&
+        ir_arg(func, instr, 0) == s->object) {
+      return ir_arg(func, instr, 1);
+    }
+  }
+  return value_in(s, block);
+}
+
+static uint32_t value_out(struct field_ssa* s, uint32_t block) {
+  if (s->out[block] == IR_NONE) {
+    s->out[block] =
+        value_before(s, block, s->func->blocks[block].instr_count);
+  }
+  return ir_resolve(s->func, s->out[block]);
+}
+
+static uint32_t value_in(struct field_ssa* s, uint32_t block) {
+  struct ir_function* func = s->func;
+  uint32_t count = func->blocks[block].pred_count;
+  uint32_t* values;
+  uint32_t same = IR_NONE;
+  uint32_t phi;
+  uint32_t i;
+
+  if (s->in[block] != IR_NONE) {
+    return ir_resolve(func, s->in[block]);
+  }
+  /* the allocation dominates the reads, the entry and dead code don't count */
+  if (count == 0 || func->blocks[block].order == IR_NONE) {
+    s->in[block] = s->zero;
+    return s->zero;
+  }
+  if (count == 1) {
+    s->in[block] = value_out(s, func->blocks[block].preds[0]);
+    return s->in[block];
+  }
+  /* the phi breaks cycles while the operands are read */
+  phi = ir_new_phi(func, block, 'I');
+  values = malloc(count * sizeof(uint32_t));
+  if (phi == IR_NONE || values == NULL) {
+    free(values);
+    func->error = ENOMEM;
+    return s->zero;
+  }
+  s->in[block] = phi;
+  for (i = 0; i < count; i++) {
+    values[i] = value_out(s, func->blocks[block].preds[i]);
+    if (values[i] != phi && values[i] != same) {
+      same = same == IR_NONE ? values[i] : IR_NONE - 1;
+    }
+  }
+  ir_set_phi_operands(func, phi, values);
+  free(values);
+  if (same != IR_NONE && same != IR_NONE - 1) {
+    ir_remove_from_block(func, phi);
+    ir_replace(func, phi, same);
+    s->in[block] = same;
+  }
+  return ir_resolve(func, s->in[block]);
+}
+
+static uint32_t position_of(const struct ir_function* func, uint32_t id) {
+  const struct ir_block* b = &func->blocks[func->instrs[id].block];
+  uint32_t k = 0;
+
+  while (b->instrs[k] != id) {
+    k++;
+  }
+  return k;
+}
+
+/*
+ * Objects the frames of a state refer to, as IR_NEW ids in `found`.
+ * Returns how many
+ */
+static uint32_t referenced_objects(const struct ir_function* func,
+                                   uint32_t state, uint32_t* found) {
+  uint32_t count = 0;
+
+  for (; state != IR_NONE; state = func->states[state].caller) {
+    const struct ir_state* s = &func->states[state];
+    uint32_t n;
+    for (n = 0; n < (uint32_t)s->local_count + s->stack_count; n++) {
+      uint32_t value = ir_resolve(func, func->operands[s->values + n]);
+      uint32_t k = 0;
+      if (func->instrs[value].op != IR_NEW) {
+        continue;
+      }
+      while (k < count && found[k] != value) {
+        k++;
+      }
+      if (k == count) {
+        found[count++] = value;
+      }
+    }
+  }
+  return count;
+}
+
+/*
+ * Copy of a state with the objects its frames refer to, their fields
+ * read at `position` of the block. The state itself if there are none
+ */
+static uint32_t with_objects(struct field_ssa* s, uint32_t state,
+                             uint32_t block, uint32_t position) {
+  struct ir_function* func = s->func;
+  struct ir_state copy = func->states[state];
+  uint32_t* found = malloc((func->object_count + 1) * sizeof(uint32_t));
+  uint32_t* values = NULL;
+  uint32_t count;
+  uint32_t size;
+  uint32_t n;
+  uint32_t i;
+
+  if (found == NULL) {
+    func->error = ENOMEM;
+    return state;
+  }
+  count = referenced_objects(func, state, found);
+  size = (uint32_t)copy.local_count + copy.stack_count;
+  for (i = 0; i < count; i++) {
+    size += 1u + func->objects[func->instrs[found[i]].imm].field_count;
+  }
+  if (count > 0) {
+    values = malloc(size * sizeof(uint32_t));
+    if (values == NULL) {
+      free(found);
+      func->error = ENOMEM;
+      return state;
+    }
+  }
+  if (values != NULL) {
+    n = (uint32_t)copy.local_count + copy.stack_count;
+    memcpy(values, func->operands + copy.values, n * sizeof(uint32_t));
+    for (i = 0; i < count; i++) {
+      uint32_t index = (uint32_t)func->instrs[found[i]].imm;
+      uint16_t f;
+      values[n++] = found[i];
+      for (f = 0; f < func->objects[index].field_count; f++) {
+        select_field(s, index, f);
+        values[n++] = value_before(s, block, position);
+      }
+    }
+    state = ir_new_state(func, copy.caller, copy.class, copy.method, copy.bci,
+                         values, copy.local_count, copy.stack_count,
+                         (uint16_t)(size - copy.local_count -
+                                    copy.stack_count));
+  }
+  free(values);
+  free(found);
+  return state;
+}
+
+/* Replaces the loads of one field of an allocation */
+static void replace_loads(struct field_ssa* s) {
+  struct ir_function* func = s->func;
+  uint32_t i;
+
+  for (i = 0; i < func->order_count; i++) {
+    uint32_t block = func->order[i];
+    uint32_t k = 0;
+    while (k < func->blocks[block].instr_count) {
+      uint32_t id = func->blocks[block].instrs[k];
+      const struct ir_instr* instr = &func->instrs[id];
+      uint32_t value;
+      if (instr->op != IR_FIELD_LOAD || instr->imm != s->offset ||
+          ir_arg(func, instr, 0) != s->object) {
+        k++;
+        continue;
+      }
+      value = value_before(s, block, k);
+      /* phis may have been added in front of the load */
+      k = position_of(func, id);
+      ir_remove_from_block(func, id);
+      ir_replace(func, id, value);
+    }
+  }
+}
+
+/* Drops the stores and null checks of replaced objects, and the objects */
+static void remove_objects(struct ir_function* func) {
+  uint32_t i;
+
+  for (i = 0; i < func->order_count; i++) {
+    uint32_t block = func->order[i];
+    uint32_t k = 0;
+    while (k < func->blocks[block].instr_count) {
+      uint32_t id = func->blocks[block].instrs[k];
+      struct ir_instr* instr = &func->instrs[id];
+      if (instr->op == IR_NEW) {
+        /* states still name it, it has no code */
+        ir_remove_from_block(func, id);
+        func->stats.scalar_replaced++;
+      } else if (instr->arg_count > 0 &&
+                 func->instrs[ir_arg(func, instr, 0)].op == IR_NEW &&
+                 (instr->op == IR_FIELD_STORE ||
+                  instr->op == IR_NULL_CHECK)) {
+        uint32_t object = ir_arg(func, instr, 0);
+        ir_remove_from_block(func, id);
+        if (instr->op == IR_NULL_CHECK) {
+          ir_replace(func, id, object);
+        } else {
+          instr->op = IR_NOP;
+        }
+      } else {
+        k++;
+      }
+    }
+  }
+}
+
+void ir_scalar_replace(struct ir_function* func) {
+  struct field_ssa s;
+  uint32_t state_count;
+  uint32_t fields = 0;
+  uint32_t i;
+
+  if (func->error != 0 || func->object_count == 0) {
+    return;
+  }
+  drop_unread_phis(func);
+  if (func->error != 0) {
+    return;
+  }
+  if (escapes(func)) {
+    func->error = ENOTSUP;
+    return;
+  }
+  memset(&s, 0, sizeof(s));
+  s.func = func;
+  s.first = malloc(func->object_count * sizeof(uint32_t));
+  for (i = 0; s.first != NULL && i < func->object_count; i++) {
+    s.first[i] = fields;
+    fields += func->objects[i].field_count;
+  }
+  /* no block is added, phis only */
+  s.values = malloc(((size_t)fields * 2 * func->block_count + 1) *
+                    sizeof(uint32_t));
+  s.zero = ir_emit(func, func->entry, IR_CONST, 'I', 0, NULL, 0);
+  if (s.first == NULL || s.values == NULL || s.zero == IR_NONE) {
+    free(s.first);
+    free(s.values);
+    func->error = ENOMEM;
+    return;
+  }
+  memset(s.values, 0xff,
+         (size_t)fields * 2 * func->block_count * sizeof(uint32_t));
+
+  /* states first, they read the fields before loads are replaced */
+  state_count = func->state_count;
+  for (i = 0; i < func->order_count && func->error == 0; i++) {
+    uint32_t block = func->order[i];
+    uint32_t k;
+    if (func->blocks[block].state != IR_NONE &&
+        func->blocks[block].state < state_count) {
+      func->blocks[block].state =
+          with_objects(&s, func->blocks[block].state, block, 0);
+    }
+    for (k = 0; k < func->blocks[block].instr_count; k++) {
+      struct ir_instr* instr = &func->instrs[func->blocks[block].instrs[k]];
+      uint32_t state = instr->state;
+      if (state != IR_NONE && state < state_count) {
+        uint32_t id = func->blocks[block].instrs[k];
+        state = with_objects(&s, state, block, k);
+        /* phis may have been added in front of the check */
+        k = position_of(func, id);
+        func->instrs[id].state = state;
+      }
+    }
+  }
+
+  for (i = 0; i < func->object_count && func->error == 0; i++) {
+    uint16_t f;
+    for (f = 0; f < func->objects[i].field_count; f++) {
+      select_field(&s, i, f);
+      replace_loads(&s);
+    }
+  }
+  if (func->error == 0) {
+    remove_objects(func);
+  }
+  free(s.first);
+  free(s.values);
+}
@@ -0,0 +1,769 @@
+#include "ir.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Computes a value from its operands alone, may be shared */
+static int is_pure(uint8_t op) {
+  return op == IR_CONST || (op >= IR_ADD && op <= IR_I2S) ||
+         op == IR_ARRAY_LENGTH;
+}
+
+static int is_check(uint8_t op) {
+  return op == IR_NULL_CHECK || op == IR_ZERO_CHECK || op == IR_BOUNDS_CHECK;
+}
+
+static int is_commutative(uint8_t op) {
+  return op == IR_ADD || op == IR_MUL || op == IR_AND || op == IR_OR ||
+         op == IR_XOR;
+}
+
+static int live_instr(const struct ir_function* func, uint32_t id) {
+  const struct ir_instr* instr = &func->instrs[id];
+  return instr->op != IR_NOP && instr->forward == IR_NONE;
+}
+
+static void replace(struct ir_function* func, uint32_t id, uint32_t by) {
+  ir_remove_from_block(func, id);
+  ir_replace(func, id, by);
+}
+
+static uint32_t new_constant(struct ir_function* func, int32_t value) {
+  return ir_emit(func, func->entry, IR_CONST, 'I', value, NULL, 0);
+}
+
+/* Java int arithmetic on constants, 0 if the operation can trap */
+static int fold(uint8_t op, int32_t a, int32_t b, int32_t* result) {
+  uint32_t x = (uint32_t)a;
+  uint32_t y = (uint32_t)b;
+
+  switch (op) {
+    case IR_ADD:
+      *result = (int32_t)(x + y);
+      return 1;
+    case IR_SUB:
+      *result = (int32_t)(x - y);
+      return 1;
+    case IR_MUL:
+      *result = (int32_t)(x * y);
+      return 1;
+    case IR_DIV:
+    case IR_REM:
+      if (b == 0) {
+        return 0;
+      }
+      if (a == INT32_MIN && b == -1) {
+        *result = op == IR_DIV ? INT32_MIN : 0;
+      } else {
+        *result = op == IR_DIV ? a / b : a % b;
+      }
+      return 1;
+    case IR_AND:
+      *result = (int32_t)(x & y);
+      return 1;
+    case IR_OR:
+      *result = (int32_t)(x | y);
+      return 1;
+    case IR_XOR:
+      *result = (int32_t)(x ^ y);
+      return 1;
+    case IR_SHL:
+      *result = (int32_t)(x << (y & 31));
+      return 1;
+    case IR_SHR:
+      *result = a >> (y & 31);
+      return 1;
+    case IR_USHR:
+      *result = (int32_t)(x >> (y & 31));
+      return 1;
+    case IR_NEG:
+      *result = (int32_t)(0u - x);
+      return 1;
+    case IR_I2B:
+      *result = (int8_t)a;
+      return 1;
+    case IR_I2C:
+      *result = (uint16_t)a;
+      return 1;
+    case IR_I2S:
+      *result = (int16_t)a;
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+/*
+ * A value equal to the instruction, IR_NONE if there is none.
+ * Constants are created in the entry block
+ */
+static uint32_t simplify(struct ir_function* func, uint32_t id) {
+  struct ir_instr* instr = &func->instrs[id];
+  uint8_t op = instr->op;
+  uint32_t a;
+  uint32_t b;
+  int32_t x;
+  int32_t y;
+  int32_t result;
+  int a_const;
+  int b_const;
+
+  if (instr->arg_count == 0 || instr->type != 'I' ||
+      (!is_pure(op) && op != IR_ZERO_CHECK)) {
+    /* checked values and allocations are not null */
+    return op == IR_NULL_CHECK &&
+                   (func->instrs[ir_arg(func, instr, 0)].op == IR_NULL_CHECK ||
+                    func->instrs[ir_arg(func, instr, 0)].op == IR_NEW)
+               ? ir_arg(func, instr, 0)
+               : IR_NONE;
+  }
+  a = ir_arg(func, instr, 0);
+  a_const = ir_is_const(func, a, &x);
+  if (op == IR_ZERO_CHECK) {
+    return a_const && x != 0 ? a : IR_NONE;
+  }
+  if (instr->arg_count == 1) {
+    return a_const && fold(op, x, 0, &result) ? new_constant(func, result)
+                                              : IR_NONE;
+  }
+  if (op == IR_ARRAY_LENGTH) {
+    return IR_NONE;
+  }
+
+  b = ir_arg(func, instr, 1);
+  b_const = ir_is_const(func, b, &y);
+  if (a_const && b_const) {
+    return fold(op, x, y, &result) ? new_constant(func, result) : IR_NONE;
+  }
+  if (a == b) {
+    if (op == IR_AND || op == IR_OR) {
+      return a;
+    }
+    if (op == IR_SUB || op == IR_XOR) {
+      return new_constant(func, 0);
+    }
+  }
+  if (!b_const) {
+    return IR_NONE;
+  }
+  switch (op) {
+    case IR_ADD:
+    case IR_SUB:
+    case IR_OR:
+    case IR_XOR:
+      return y == 0 ? a : IR_NONE;
+    case IR_SHL:
+    case IR_SHR:
+    case IR_USHR:
+      return (y & 31) == 0 ? a : IR_NONE;
+    case IR_MUL:
+      return y == 1 ? a : y == 0 ? b : IR_NONE;
+    case IR_DIV:
+      return y == 1 ? a : IR_NONE;
+    case IR_AND:
+      return y == -1 ? a : y == 0 ? b : IR_NONE;
+    default:
+      return IR_NONE;
+  }
+}
+
+/* Constants go right, other operands in id order so a + b == b + a */
+static void canonicalize(struct ir_function* func, struct ir_instr* instr) {
+  uint32_t* args = func->operands + instr->args;
+  uint32_t a;
+  uint32_t b;
+  int swap;
+
+  if (!is_commutative(instr->op)) {
+    return;
+  }
+  a = ir_resolve(func, args[0]);
+  b = ir_resolve(func, args[1]);
+  if (ir_is_const(func, a, NULL) != ir_is_const(func, b, NULL)) {
+    swap = ir_is_const(func, a, NULL);
+  } else {
+    swap = a > b;
+  }
+  args[0] = swap ? b : a;
+  args[1] = swap ? a : b;
+}
+
+struct value_table {
+  uint32_t* slots; /* instruction ids, IR_NONE when empty */
+  uint32_t mask;
+};
+
+static uint64_t value_hash(const struct ir_function* func,
+                           const struct ir_instr* instr) {
+  uint64_t h = (uint64_t)instr->op * 0x9E3779B97F4A7C15ULL;
+  uint16_t i;
+
+  h ^= (uint64_t)(uint32_t)instr->imm + ((uint64_t)(uint8_t)instr->type << 32);
+  for (i = 0; i < instr->arg_count; i++) {
+    h = (h ^ ir_arg(func, instr, i)) * 0x100000001B3ULL;
+  }
+  return h ^ (h >> 29);
+}
+
+static int same_value(const struct ir_function* func,
+                      const struct ir_instr* a, const struct ir_instr* b) {
+  uint16_t i;
+
+  if (a->op != b->op || a->type != b->type || a->imm != b->imm ||
+      a->arg_count != b->arg_count) {
+    return 0;
+  }
+  for (i = 0; i < a->arg_count; i++) {
+    if (ir_arg(func, a, i) != ir_arg(func, b, i)) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/*
+ * Finds an equal instruction whose block dominates `id`, otherwise
+ * records `id`. Blocks are visited in reverse postorder, so every
+ * dominating instruction is already in the table
+ */
+static uint32_t value_number(struct ir_function* func,
+                             struct value_table* table, uint32_t id) {
+  const struct ir_instr* instr = &func->instrs[id];
+  uint32_t slot = (uint32_t)value_hash(func, instr) & table->mask;
+
+  while (table->slots[slot] != IR_NONE) {
+    uint32_t other = table->slots[slot];
+    if (other != id && live_instr(func, other) &&
+        same_value(func, &func->instrs[other], instr) &&
+        ir_dominates(func, func->instrs[other].block, instr->block)) {
+      return other;
+    }
+    slot = (slot + 1) & table->mask;
+  }
+  table->slots[slot] = id;
+  return IR_NONE;
+}
+
+/* Phis whose operands are all the same value or the phi itself */
+static int remove_trivial_phis(struct ir_function* func) {
+  int removed = 0;
+  uint32_t i;
+
+  for (i = 0; i < func->order_count; i++) {
+    struct ir_block* b = &func->blocks[func->order[i]];
+    uint32_t k = 0;
+    while (k < b->instr_count) {
+      uint32_t id = b->instrs[k];
+      struct ir_instr* instr = &func->instrs[id];
+      uint32_t same = IR_NONE;
+      uint16_t j;
+      if (instr->op != IR_PHI) {
+        break;
+      }
+      for (j = 0; j < instr->arg_count; j++) {
+        uint32_t value = ir_arg(func, instr, j);
+        if (value == id || value == same) {
+          continue;
+        }
+        same = same == IR_NONE ? value : IR_NONE - 1;
+      }
+      if (same != IR_NONE && same != IR_NONE - 1) {
+        replace(func, id, same);
+        removed = 1;
+      } else {
+        k++;
+      }
+    }
+  }
+  return removed;
+}
+
+static int fold_and_number(struct ir_function* func,
+                           struct value_table* table) {
+  int changed = 0;
+  uint32_t i;
+
+  memset(table->slots, 0xff, ((size_t)table->mask + 1) * sizeof(uint32_t));
+  for (i = 0; i < func->order_count; i++) {
+    uint32_t block = func->order[i];
+    uint32_t k = 0;
+
+    while (k < func->blocks[block].instr_count) {
+      uint32_t id = func->blocks[block].instrs[k];
+      struct ir_instr* instr = &func->instrs[id];
+      uint32_t by;
+
+      if (!is_pure(instr->op) && !is_check(instr->op)) {
+        k++;
+        continue;
+      }
+      canonicalize(func, instr);
+      by = simplify(func, id);
+      if (by != IR_NONE) {
+        func->stats.folded++;
+      } else {
+        by = value_number(func, table, id);
+        if (by != IR_NONE) {
+          if (is_check(func->instrs[id].op)) {
+            func->stats.checks++;
+          } else if (func->instrs[id].op != IR_CONST) {
+            func->stats.gvn++;
+          }
+        }
+      }
+      if (by != IR_NONE && by != id) {
+        replace(func, id, by);
+        changed = 1;
+      } else {
+        k++;
+      }
+    }
+  }
+  return changed;
+}
+
+void ir_fold_and_gvn(struct ir_function* func) {
+  struct value_table table;
+  uint32_t capacity = 64;
+  int round;
+
+  if (func->error != 0) {
+    return;
+  }
+  /* folding creates constants, leave room for them */
+  while (capacity < func->instr_count * 4) {
+    capacity *= 2;
+  }
+  table.slots = malloc(capacity * sizeof(uint32_t));
+  if (table.slots == NULL) {
+    func->error = ENOMEM;
+    return;
+  }
+  table.mask = capacity - 1;
+  for (round = 0; round < 4; round++) {
+    int changed = remove_trivial_phis(func);
+    if (func->instr_count * 2 > capacity) {
+      break;
+    }
+    changed |= fold_and_number(func, &table);
+    if (!changed) {
+      break;
+    }
+  }
+  free(table.slots);
+}
+
+/* Marks the natural loop of `header` in `body` */
+static void loop_body(const struct ir_function* func, uint32_t header,
+                      uint8_t* body, uint32_t* stack) {
+  const struct ir_block* h = &func->blocks[header];
+  uint32_t depth = 0;
+  uint32_t i;
+
+  memset(body, 0, func->block_count);
+  body[header] = 1;
+  for (i = 0; i < h->pred_count; i++) {
+    uint32_t latch = h->preds[i];
+    if (ir_dominates(func, header, latch) && !body[latch]) {
+      body[latch] = 1;
+      stack[depth++] = latch;
+    }
+  }
+  while (depth > 0) {
+    const struct ir_block* b = &func->blocks[stack[--depth]];
+    for (i = 0; i < b->pred_count; i++) {
+      uint32_t pred = b->preds[i];
+      if (!body[pred] && func->blocks[pred].order != IR_NONE) {
+        body[pred] = 1;
+        stack[depth++] = pred;
+      }
+    }
+  }
+}
+
+static int is_loop_header(const struct ir_function* func, uint32_t block) {
+  return func->blocks[block].loop_header == block;
+}
+
+/* The single block entering the loop, if it only leads to the header */
+static uint32_t preheader(const struct ir_function* func, uint32_t header,
+                          const uint8_t* body) {
+  const struct ir_block* h = &func->blocks[header];
+  uint32_t found = IR_NONE;
+  uint32_t i;
+
+  for (i = 0; i < h->pred_count; i++) {
+    if (body[h->preds[i]]) {
+      continue;
+    }
+    if (found != IR_NONE && found != h->preds[i]) {
+      return IR_NONE;
+    }
+    found = h->preds[i];
+  }
+  if (found == IR_NONE || func->blocks[found].succ_count != 1) {
+    return IR_NONE;
+  }
+  return found;
+}
+
+static int invariant(const struct ir_function* func,
+                     const struct ir_instr* instr, const uint8_t* body) {
+  uint16_t i;
+
+  for (i = 0; i < instr->arg_count; i++) {
+    if (body[func->instrs[ir_arg(func, instr, i)].block]) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/*
+ * State of a check hoisted to the preheader: the state at the start of
+ * the header with the values that enter it from the preheader. The
+ * interpreter runs the header again up to the failing instruction
+ */
+static uint32_t entry_state(struct ir_function* func, uint32_t header,
+                            uint32_t pre) {
+  const struct ir_block* h = &func->blocks[header];
+  struct ir_state entry;
+  uint32_t* values;
+  uint32_t count;
+  uint32_t index = 0;
+  uint32_t state;
+  uint32_t i;
+
+  if (h->state == IR_NONE) {
+    return IR_NONE;
+  }
+  while (h->preds[index] != pre) {
+    index++;
+  }
+  entry = func->states[h->state];
+  count = ir_state_size(&entry);
+  values = malloc((count + 1) * sizeof(uint32_t));
+  if (values == NULL) {
+    func->error = ENOMEM;
+    return IR_NONE;
+  }
+  for (i = 0; i < count; i++) {
+    uint32_t value = ir_resolve(func, func->operands[entry.values + i]);
+    const struct ir_instr* instr = &func->instrs[value];
+    if (instr->op == IR_PHI && instr->block == header) {
+      value = ir_arg(func, instr, (uint16_t)index);
+    }
+    values[i] = value;
+  }
+  state = ir_new_state(func, entry.caller, entry.class, entry.method,
+                       entry.bci, values, entry.local_count,
+                       entry.stack_count, entry.object_values);
+  free(values);
+  return state;
+}
+
+static void hoist_loop(struct ir_function* func, uint32_t header,
+                       const uint8_t* body, uint32_t* ids) {
+  uint32_t pre = preheader(func, header, body);
+  uint32_t state = IR_NONE;
+  uint32_t i;
+
+  if (pre == IR_NONE) {
+    return;
+  }
+  /* reverse postorder, operands are hoisted before their users */
+  for (i = func->blocks[header].order; i < func->order_count; i++) {
+    uint32_t block = func->order[i];
+    /*
+     * A check may only leave the header, and only ahead of anything
+     * with an effect: it then runs at the same point of the first
+     * iteration and would pass again in every later one
+     */
+    int checks = block == header;
+    uint32_t count = func->blocks[block].instr_count;
+    uint32_t k;
+
+    if (!body[block]) {
+      continue;
+    }
+    memcpy(ids, func->blocks[block].instrs, count * sizeof(uint32_t));
+    for (k = 0; k < count; k++) {
+      struct ir_instr* instr = &func->instrs[ids[k]];
+      int movable = instr->op != IR_CONST &&
+                    (is_pure(instr->op) || (checks && is_check(instr->op)));
+
+      if (movable && is_check(instr->op) && invariant(func, instr, body)) {
+        if (state == IR_NONE) {
+          state = entry_state(func, header, pre);
+        }
+        /* func->instrs stays put, only states and operands grew */
+        movable = state != IR_NONE;
+        if (movable) {
+          instr->state = state;
+        }
+      }
+      if (movable && invariant(func, instr, body)) {
+        ir_remove_from_block(func, ids[k]);
+        ir_append(func, pre, ids[k]);
+        func->stats.hoisted++;
+      } else if (!is_pure(instr->op) && instr->op != IR_PHI) {
+        checks = 0;
+      }
+    }
+  }
+}
+
+void ir_hoist_invariants(struct ir_function* func) {
+  uint8_t* body;
+  uint32_t* stack;
+  uint32_t i;
+
+  if (func->error != 0) {
+    return;
+  }
+  body = malloc(func->block_count + 1);
+  /* also holds the instructions of one block */
+  stack = malloc((func->block_count + func->instr_count + 1) *
+                 sizeof(uint32_t));
+  if (body == NULL || stack == NULL) {
+    free(body);
+    free(stack);
+    func->error = ENOMEM;
+    return;
+  }
+  /* inner loops first, their invariants may be invariant outside too */
+  for (i = func->order_count; i-- > 0;) {
+    uint32_t header = func->order[i];
+    if (is_loop_header(func, header)) {
+      loop_body(func, header, body, stack);
+      hoist_loop(func, header, body, stack);
+    }
+  }
+  free(body);
+  free(stack);
+}
+
+/* Does `value` < `limit` hold on the edge from `block` to succs[k]? */
+static int edge_implies_below(const struct ir_function* func, uint32_t block,
+                              int k, uint32_t value, uint32_t limit) {
+  const struct ir_block* b = &func->blocks[block];
+  const struct ir_instr* branch;
+  uint32_t left;
+  uint32_t right;
+
+  if (b->instr_count == 0) {
+    return 0;
+  }
+  branch = &func->instrs[b->instrs[b->instr_count - 1]];
+  if (branch->op != IR_IF) {
+    return 0;
+  }
+  left = ir_arg(func, branch, 0);
+  right = ir_arg(func, branch, 1);
+  switch (branch->cond) {
+    case IR_LT:
+      return left == value && right == limit && k == 0;
+    case IR_GE:
+      return left == value && right == limit && k == 1;
+    case IR_GT:
+      return left == limit && right == value && k == 0;
+    case IR_LE:
+      return left == limit && right == value && k == 1;
+    default:
+      return 0;
+  }
+}
+
+/*
+ * An induction variable i = phi(init >= 0, i + 1) of a loop whose
+ * header exits unless i < length: wherever the loop test's in-loop
+ * successor dominates, 0 <= i < length. The increment can't overflow
+ * because each one follows a passed test
+ */
+static int induction_in_bounds(const struct ir_function* func,
+                               uint32_t index, uint32_t length,
+                               uint32_t block, uint8_t* body,
+                               uint32_t* stack) {
+  const struct ir_instr* phi = &func->instrs[index];
+  uint32_t header = phi->block;
+  const struct ir_block* h = &func->blocks[header];
+  int32_t init;
+  uint16_t i;
+  int seen_init = 0;
+  int seen_step = 0;
+  int k;
+
+  if (phi->op != IR_PHI || !is_loop_header(func, header) ||
+      h->succ_count != 2) {
+    return 0;
+  }
+  loop_body(func, header, body, stack);
+  for (i = 0; i < phi->arg_count; i++) {
+    uint32_t value = ir_arg(func, phi, i);
+    const struct ir_instr* step = &func->instrs[value];
+    int32_t one;
+    if (!body[h->preds[i]]) {
+      if (!ir_is_const(func, value, &init) || init < 0) {
+        return 0;
+      }
+      seen_init = 1;
+    } else if (step->op == IR_ADD && ir_arg(func, step, 0) == index &&
+               ir_is_const(func, ir_arg(func, step, 1), &one) && one == 1) {
+      seen_step = 1;
+    } else {
+      return 0;
+    }
+  }
+  if (!seen_init || !seen_step) {
+    return 0;
+  }
+  for (k = 0; k < 2; k++) {
+    uint32_t inside = h->succs[k];
+    uint32_t outside = h->succs[1 - k];
+    if (body[inside] && !body[outside] &&
+        func->blocks[inside].pred_count == 1 &&
+        edge_implies_below(func, header, k, index, length) &&
+        ir_dominates(func, inside, block)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* A check of a larger constant index against the same length dominates */
+static int covered_by_larger_check(const struct ir_function* func,
+                                   uint32_t check, int32_t index,
+                                   uint32_t length) {
+  const struct ir_instr* instr = &func->instrs[check];
+  uint32_t i;
+
+  for (i = 0; i < func->instr_count; i++) {
+    const struct ir_instr* other = &func->instrs[i];
+    int32_t other_index;
+    if (i == check || other->op != IR_BOUNDS_CHECK || !live_instr(func, i) ||
+        ir_arg(func, other, 1) != length ||
+        !ir_is_const(func, ir_arg(func, other, 0), &other_index) ||
+        other_index < index) {
+      continue;
+    }
+    if (other->block != instr->block) {
+      if (ir_dominates(func, other->block, instr->block)) {
+        return 1;
+      }
+      continue;
+    }
+    /* same block: the other check has to come first */
+    {
+      const struct ir_block* b = &func->blocks[instr->block];
+      uint32_t k;
+      for (k = 0; k < b->instr_count && b->instrs[k] != check; k++) {
+        if (b->instrs[k] == i) {
+          return 1;
+        }
+      }
+    }
+  }
+  return 0;
+}
+
+void ir_eliminate_range_checks(struct ir_function* func) {
+  uint8_t* body;
+  uint32_t* stack;
+  uint32_t i;
+
+  if (func->error != 0) {
+    return;
+  }
+  body = malloc(func->block_count + 1);
+  stack = malloc((func->block_count + 1) * sizeof(uint32_t));
+  if (body == NULL || stack == NULL) {
+    free(body);
+    free(stack);
+    func->error = ENOMEM;
+    return;
+  }
+  for (i = 0; i < func->instr_count; i++) {
+    struct ir_instr* instr = &func->instrs[i];
+    uint32_t index;
+    uint32_t length;
+    int32_t constant;
+
+    if (instr->op != IR_BOUNDS_CHECK || !live_instr(func, i) ||
+        func->blocks[instr->block].order == IR_NONE) {
+      continue;
+    }
+    index = ir_arg(func, instr, 0);
+    length = ir_arg(func, instr, 1);
+    if (induction_in_bounds(func, index, length, instr->block, body, stack) ||
+        (ir_is_const(func, index, &constant) && constant >= 0 &&
+         covered_by_larger_check(func, i, constant, length))) {
+      replace(func, i, index);
+      func->stats.checks++;
+    }
+  }
+  free(body);
+  free(stack);
+}
+
+void ir_remove_dead(struct ir_function* func) {
+  uint32_t* uses;
+  int changed = 1;
+  uint32_t i;
+
+  if (func->error != 0) {
+    return;
+  }
+  uses = calloc(func->instr_count + 1, sizeof(uint32_t));
+  if (uses == NULL) {
+    func->error = ENOMEM;
+    return;
+  }
+  for (i = 0; i < func->order_count; i++) {
+    const struct ir_block* b = &func->blocks[func->order[i]];
+    uint32_t k;
+    for (k = 0; k < b->instr_count; k++) {
+      const struct ir_instr* instr = &func->instrs[b->instrs[k]];
+      uint32_t state;
+      uint16_t j;
+      for (j = 0; j < instr->arg_count; j++) {
+        uses[ir_arg(func, instr, j)]++;
+      }
+      /* the interpreter may still need what a check's state holds */
+      for (state = instr->state; state != IR_NONE;
+           state = func->states[state].caller) {
+        const struct ir_state* s = &func->states[state];
+        uint32_t n;
+        for (n = 0; n < ir_state_size(s); n++) {
+          uses[ir_resolve(func, func->operands[s->values + n])]++;
+        }
+      }
+    }
+  }
+  while (changed) {
+    changed = 0;
+    for (i = 0; i < func->order_count; i++) {
+      struct ir_block* b = &func->blocks[func->order[i]];
+      uint32_t k = 0;
+      while (k < b->instr_count) {
+        uint32_t id = b->instrs[k];
+        struct ir_instr* instr = &func->instrs[id];
+        uint16_t j;
+        if (uses[id] != 0 ||
+            (!is_pure(instr->op) && instr->op != IR_PHI &&
+             instr->op != IR_ARRAY_LOAD && instr->op != IR_FIELD_LOAD)) {
+          k++;
+          continue;
+        }
+        for (j = 0; j < instr->arg_count; j++) {
+          uses[ir_arg(func, instr, j)]--;
+        }
+        ir_remove_from_block(func, id);
+        instr->op = IR_NOP;
+        changed = 1;
+      }
+    }
+  }
+  free(uses);
+}
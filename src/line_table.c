@@ -0,0 +1,187 @@
+#include "line_table.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "attribute_info.h"
+#include "classfile_parser.h"
+#include "classfile_stream.h"
+
+struct line_entry {
+  uint16_t start_pc;
+  uint16_t line;
+};
+
+static int compare_entries(const void* a, const void* b) {
+  return (int)((const struct line_entry*)a)->start_pc -
+         (int)((const struct line_entry*)b)->start_pc;
+}
+
+static int is_line_number_table(struct class_file* class,
+                                const struct attribute_info* attr) {
+  struct UTF8_info* name = validate_constant(class, attr->attribute_name_index);
+  return name != NULL && is_string_match((const char*)name->bytes,
+                                         name->lenght, "LineNumberTable");
+}
+
+static uint8_t* put_varint(uint8_t* out, uint32_t value) {
+  while (value >= 0x80) {
+    *out++ = (uint8_t)(value | 0x80);
+    value >>= 7;
+  }
+  *out++ = (uint8_t)value;
+  return out;
+}
+
+static const uint8_t* get_varint(const uint8_t* in, uint32_t* value) {
+  uint32_t shift = 0;
+
+  *value = 0;
+  do {
+    *value |= (uint32_t)(*in & 0x7f) << shift;
+    shift += 7;
+  } while (*in++ & 0x80);
+  return in;
+}
+
+/* Entries of every LineNumberTable of the code, in class file order */
+static struct line_entry* read_entries(struct class_file* class,
+                                       const struct Code_attribute* code,
+                                       uint32_t* count) {
+  struct line_entry* entries;
+  uint32_t total = 0;
+  uint16_t i;
+
+  for (i = 0; i < code->attributes_count; i++) {
+    if (is_line_number_table(class, &code->attributes[i]) &&
+        code->attributes[i].attribute_length >= 2) {
+      total += (uint32_t)code->attributes[i].info[0] << 8 |
+               code->attributes[i].info[1];
+    }
+  }
+  entries = malloc((total + 1u) * sizeof(struct line_entry));
+  if (entries == NULL) {
+    return NULL;
+  }
+  *count = 0;
+  for (i = 0; i < code->attributes_count; i++) {
+    Loader loader = {.buffer = code->attributes[i].info,
+                     .size = code->attributes[i].attribute_length};
+    uint16_t length;
+
+    if (!is_line_number_table(class, &code->attributes[i])) {
+      continue;
+    }
+    length = loader_u2(&loader);
+    while (length-- > 0) {
+      struct line_entry entry;
+
+      entry.start_pc = loader_u2(&loader);
+      entry.line = loader_u2(&loader);
+      /* a truncated or out of range entry is dropped */
+      if (loader.error) {
+        break;
+      }
+      if (entry.start_pc < code->code_length) {
+        entries[(*count)++] = entry;
+      }
+    }
+  }
+  return entries;
+}
+
+struct line_table* line_table_build(struct class_file* class,
+                                    const struct Code_attribute* code) {
+  struct line_table* table;
+  struct line_entry* entries;
+  uint32_t count;
+  uint32_t skip_count;
+  uint8_t* out;
+  uint32_t i;
+
+  entries = read_entries(class, code, &count);
+  if (entries == NULL) {
+    printf("ERROR: can't allocate memory for line table\n");
+    return NULL;
+  }
+  qsort(entries, count, sizeof(struct line_entry), compare_entries);
+
+  /* a varint of 16 bits takes 3 bytes at most */
+  skip_count = (count + LINE_TABLE_STRIDE - 1) / LINE_TABLE_STRIDE;
+  table = malloc(sizeof(struct line_table) +
+                 skip_count * sizeof(struct line_skip) +
+                 (count - skip_count) * 6u);
+  if (table == NULL) {
+    free(entries);
+    printf("ERROR: can't allocate memory for line table\n");
+    return NULL;
+  }
+  table->count = count;
+  table->skip_count = skip_count;
+  table->skips = (struct line_skip*)(table + 1);
+  table->blob = (uint8_t*)(table->skips + skip_count);
+
+  out = table->blob;
+  for (i = 0; i < count; i++) {
+    if (i % LINE_TABLE_STRIDE == 0) {
+      struct line_skip* skip = &table->skips[i / LINE_TABLE_STRIDE];
+      skip->start_pc = entries[i].start_pc;
+      skip->line = entries[i].line;
+      skip->offset = (uint32_t)(out - table->blob);
+    } else {
+      int32_t delta = (int32_t)entries[i].line - entries[i - 1].line;
+      out = put_varint(out, (uint32_t)(entries[i].start_pc -
+                                       entries[i - 1].start_pc));
+      /* zigzag: the sign goes to the lowest bit */
+      out = put_varint(out, delta < 0 ? ~((uint32_t)delta << 1)
+                                      : (uint32_t)delta << 1);
+    }
+  }
+  free(entries);
+  return table;
+}
+
+void line_table_free(struct line_table* table) {
+  free(table);
+}
+
+int32_t line_table_lookup(const struct line_table* table, uint32_t bci) {
+  const struct line_skip* skip;
+  const uint8_t* in;
+  uint32_t low = 0;
+  uint32_t high = table->skip_count;
+  uint32_t start_pc;
+  uint32_t line;
+  uint32_t i;
+
+  /* last skip entry starting at or before bci */
+  while (low < high) {
+    uint32_t mid = low + (high - low) / 2;
+    if (table->skips[mid].start_pc <= bci) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  if (low == 0) {
+    return -1;
+  }
+  skip = &table->skips[low - 1];
+  start_pc = skip->start_pc;
+  line = skip->line;
+  in = table->blob + skip->offset;
+  for (i = (low - 1) * LINE_TABLE_STRIDE + 1;
+       i < table->count && i % LINE_TABLE_STRIDE != 0; i++) {
+    uint32_t pc_delta;
+    uint32_t line_delta;
+
+    in = get_varint(in, &pc_delta);
+    in = get_varint(in, &line_delta);
+    if (start_pc + pc_delta > bci) {
+      break;
+    }
+    start_pc += pc_delta;
+    line += (line_delta >> 1) ^ (0u - (line_delta & 1));
+  }
+  return (int32_t)(uint16_t)line;
+}
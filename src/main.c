@@ -1,9 +1,212 @@
+#include <errno.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
+#include "class_archive.h"
+#include "class_cache.h"
 #include "classfile_parser.h"
+#include "hash.h"
+#include "oop_map.h"
+#include "verifier.h"
 
-// Пример использования
-int main(int argc, char* argv[]) { 
-    printf("Argc: %d, pointer for argv: %p\n", argc, argv); // for analyzers
-    return parse_class_file(); 
+// Разбор и проверка класса без кэша
+static int load_class_file(const char* path, struct class_file* class) {
+    struct verifier verifier;
+    int err = parse_class_file(path, class);
+
+    if (err != 0) {
+        return err;
+    }
+    verifier_init(&verifier);
+    err = verify_class(&verifier, class);
+    verifier_destroy(&verifier);
+    if (err != 0) {
+        free_class_file(class);
+    }
+    return err;
+}
+
+// Хэш содержимого файла, как его считает кэш классов
+static uint64_t file_hash(const char* path) {
+    FILE* file = fopen(path, "rb");
+    uint8_t buffer[4096];
+    uint8_t* bytes = NULL;
+    size_t size = 0;
+    size_t n;
+    uint64_t hash;
+
+    if (file == NULL) {
+        return 0;
+    }
+    while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        uint8_t* grown = realloc(bytes, size + n);
+        if (grown == NULL) {
+            break;
+        }
+        bytes = grown;
+        memcpy(bytes + size, buffer, n);
+        size += n;
+    }
+    fclose(file);
+    hash = hash64(bytes, size, 0);
+    free(bytes);
+    return hash;
+}
+
+// Режим дампа: main --dump-archive=FILE A.class B.class ...
+static int dump_archive(const char* archive, char* paths[], int count) {
+    struct class_file* classes = calloc((size_t)count, sizeof(struct class_file));
+    uint64_t* hashes = calloc((size_t)count, sizeof(uint64_t));
+    int loaded = 0;
+    int err = classes != NULL && hashes != NULL ? 0 : ENOMEM;
+    int i;
+
+    for (; err == 0 && loaded < count; loaded++) {
+        err = load_class_file(paths[loaded], &classes[loaded]);
+        hashes[loaded] = file_hash(paths[loaded]);
+        if (err != 0) {
+            break;
+        }
+    }
+    if (err == 0) {
+        err = class_archive_link(classes, (size_t)count);
+    }
+    if (err == 0) {
+        err = class_archive_dump(archive, classes, (size_t)count, hashes);
+    }
+    if (err == 0) {
+        printf("dumped %d classes into %s\n", count, archive);
+    }
+    for (i = 0; i < loaded; i++) {
+        free_class_file(&classes[i]);
+    }
+    free(classes);
+    free(hashes);
+    return err;
+}
+
+static int ends_with(const char* str, const char* suffix) {
+    size_t length = strlen(str);
+    size_t suffix_length = strlen(suffix);
+    return length >= suffix_length &&
+           strcmp(str + length - suffix_length, suffix) == 0;
+}
+
+// Ищет в архиве класс из файла path, сверяя хэш файла с хэшем,
+// сохраненным при дампе. Имя класса берется из пути: a/b/C.class
+// ищется как a/b/C, затем b/C и C
+static int find_archived_file(const struct class_archive* archive,
+                              const char* path, struct class_file* class) {
+    uint64_t source_hash = file_hash(path);
+    const char* start = path;
+    char name[4096];
+    int err = ENOENT;
+
+    if (source_hash == 0) {
+        return ENOENT;
+    }
+    while (start != NULL && err == ENOENT) {
+        snprintf(name, sizeof(name), "%.*s", (int)(strlen(start) - 6), start);
+        err = class_archive_find(archive, name, source_hash, class);
+        start = strchr(start, '/');
+        if (start != NULL) {
+            start++;
+        }
+    }
+    return err;
+}
+
+// Загружает класс из архива, если он там есть и не менялся после дампа
+static int load_archived_file(struct class_archive* archive,
+                              const char* archive_path, const char* path,
+                              struct class_file* class) {
+    int err = class_archive_map(archive, archive_path);
+
+    if (err == 0) {
+        err = find_archived_file(archive, path, class);
+        if (err == ESTALE) {
+            printf("%s changed since class archive %s was dumped\n", path,
+                   archive_path);
+        }
+    }
+    if (err != 0) {
+        class_archive_unmap(archive);
+    }
+    return err;
+}
+
+// Пример использования:
+//   main [--class-cache=DIR] [file.class]
+//   main --archive=FILE [--class-cache=DIR] file.class
+//   main --archive=FILE java/lang/Name
+//   main --dump-archive=FILE A.class B.class ...
+int main(int argc, char* argv[]) {
+    struct class_file class;
+    struct class_cache cache;
+    struct class_archive archive = {0};
+    const char* cache_dir = NULL;
+    const char* archive_path = NULL;
+    const char* path = "tests/Add.class";
+    int err;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--class-cache=", 14) == 0) {
+            cache_dir = argv[i] + 14;
+        } else if (strncmp(argv[i], "--archive=", 10) == 0) {
+            archive_path = argv[i] + 10;
+        } else if (strncmp(argv[i], "--dump-archive=", 15) == 0) {
+            return dump_archive(argv[i] + 15, argv + i + 1, argc - i - 1);
+        } else {
+            path = argv[i];
+        }
+    }
+
+    if (archive_path != NULL && !ends_with(path, ".class")) {
+        // Классы из архива уже проверены и слинкованы
+        err = class_archive_map(&archive, archive_path);
+        if (err == 0) {
+            err = class_archive_find(&archive, path, 0, &class);
+            if (err != 0) {
+                printf("ERROR: %s is not in class archive %s\n", path,
+                       archive_path);
+            }
+        }
+        if (err != 0) {
+            class_archive_unmap(&archive);
+            return err;
+        }
+        printf("class archive %s: %s\n", archive_path,
+               archive.relocated ? "relocated" : "mapped at base");
+    } else if (archive_path != NULL &&
+               load_archived_file(&archive, archive_path, path, &class) == 0) {
+        // Файл не менялся после дампа, разбирать его не нужно
+        printf("class archive %s: %s\n", archive_path,
+               archive.relocated ? "relocated" : "mapped at base");
+    } else if (cache_dir != NULL) {
+        err = class_cache_init(&cache, cache_dir);
+        if (err != 0) {
+            return err;
+        }
+        err = class_cache_load_file(&cache, path, &class);
+        class_cache_print_stats(&cache);
+        class_cache_destroy(&cache);
+        if (err != 0) {
+            return err;
+        }
+    } else {
+        err = load_class_file(path, &class);
+        if (err != 0) {
+            return err;
+        }
+    }
+    err = class_build_oop_maps(&class);
+    if (err == 0) {
+        print_class_file(&class);
+    }
+    free_class_file(&class);
+    class_archive_unmap(&archive);
+    return err;
 }
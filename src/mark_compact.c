@@ -0,0 +1,686 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "mark_compact.h"
+
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+struct mc_worker {
+  struct mark_compact* mc;
+  unsigned id;
+  uint32_t random;
+  pthread_t thread;
+};
+
+/* Old and new address of the object whose slots are adjusted */
+struct mc_adjust_state {
+  struct mark_compact* mc;
+  uint8_t* from;
+  uint8_t* to;
+};
+
+struct mc_seed_state {
+  struct mc_worker* workers;
+  unsigned count;
+  unsigned next;
+};
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static int mc_full_collect(struct gc_heap* gh, void* ctx) {
+  (void)gh;
+  return mark_compact_collect((struct mark_compact*)ctx);
+}
+
+int mark_compact_init(struct mark_compact* mc, struct gc_heap* gh,
+                      unsigned workers) {
+  size_t old_size = (size_t)(gh->old.end - gh->old.base);
+  unsigned i;
+
+  memset(mc, 0, sizeof(*mc));
+  if (workers == 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    workers = cpus > 0 ? (unsigned)cpus : 1;
+  }
+
+  mc->gh = gh;
+  mc->workers = workers;
+  mc->region_count = (old_size + MC_REGION_SIZE - 1) >> MC_REGION_SHIFT;
+  mc->bitmap_words = ((old_size >> 3) + 63) / 64;
+
+  mc->regions = calloc(mc->region_count, sizeof(struct mc_region));
+  mc->bitmap = calloc(mc->bitmap_words, sizeof(uint64_t));
+  mc->deques = calloc(workers, sizeof(struct mc_deque));
+  mc->stats = calloc(workers, sizeof(struct mc_worker_stats));
+  if (mc->regions == NULL || mc->bitmap == NULL || mc->deques == NULL ||
+      mc->stats == NULL) {
+    printf("ERROR: can't allocate mark-compact tables\n");
+    mark_compact_destroy(mc);
+    return ENOMEM;
+  }
+
+  for (i = 0; i < workers; i++) {
+    mc->deques[i].items =
+        calloc(MC_DEQUE_CAPACITY, sizeof(_Atomic(struct object_header*)));
+    if (mc->deques[i].items == NULL) {
+      printf("ERROR: can't allocate marking deque\n");
+      mark_compact_destroy(mc);
+      return ENOMEM;
+    }
+  }
+
+  pthread_mutex_init(&mc->overflow_lock, NULL);
+  gc_set_full_collector(gh, mc_full_collect, mc);
+  return 0;
+}
+
+void mark_compact_destroy(struct mark_compact* mc) {
+  size_t i;
+
+  if (mc->gh != NULL && mc->gh->full_collect_ctx == mc) {
+    gc_set_full_collector(mc->gh, NULL, NULL);
+  }
+  if (mc->regions != NULL) {
+    for (i = 0; i < mc->region_count; i++) {
+      free(mc->regions[i].forward);
+    }
+  }
+  if (mc->deques != NULL) {
+    for (i = 0; i < mc->workers; i++) {
+      free(mc->deques[i].items);
+    }
+    pthread_mutex_destroy(&mc->overflow_lock);
+  }
+  free(mc->regions);
+  free(mc->bitmap);
+  free(mc->deques);
+  free(mc->stats);
+  free(mc->overflow);
+  memset(mc, 0, sizeof(*mc));
+}
+
+/* Chase-Lev deque: push and pop by the owner, steal by anyone */
+
+static int deque_push(struct mc_deque* deque, struct object_header* obj) {
+  int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+  int64_t top = atomic_load_explicit(&deque->top, memory_order_acquire);
+
+  if (bottom - top >= MC_DEQUE_CAPACITY) {
+    return 0;
+  }
+  atomic_store_explicit(&deque->items[bottom & (MC_DEQUE_CAPACITY - 1)], obj,
+                        memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+  return 1;
+}
+
+static struct object_header* deque_pop(struct mc_deque* deque) {
+  int64_t bottom =
+      atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+  int64_t top;
+  struct object_header* obj;
+
+  atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+  atomic_thread_fence(memory_order_seq_cst);
+  top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+
+  if (top > bottom) {
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+    return NULL;
+  }
+
+  obj = atomic_load_explicit(&deque->items[bottom & (MC_DEQUE_CAPACITY - 1)],
+                             memory_order_relaxed);
+  if (top == bottom) {
+    /* Last item: race with thieves for it */
+    if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+                                                 memory_order_seq_cst,
+                                                 memory_order_relaxed)) {
+      obj = NULL;
+    }
+    atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+  }
+  return obj;
+}
+
+static struct object_header* deque_steal(struct mc_deque* deque) {
+  int64_t top = atomic_load_explicit(&deque->top, memory_order_acquire);
+  int64_t bottom;
+  struct object_header* obj;
+
+  atomic_thread_fence(memory_order_seq_cst);
+  bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+  if (top >= bottom) {
+    return NULL;
+  }
+
+  obj = atomic_load_explicit(&deque->items[top & (MC_DEQUE_CAPACITY - 1)],
+                             memory_order_relaxed);
+  if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+                                               memory_order_seq_cst,
+                                               memory_order_relaxed)) {
+    return NULL;
+  }
+  return obj;
+}
+
+static int deque_is_empty(struct mc_deque* deque) {
+  return atomic_load_explicit(&deque->top, memory_order_relaxed) >=
+         atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+}
+
+static void overflow_push(struct mark_compact* mc, struct object_header* obj) {
+  pthread_mutex_lock(&mc->overflow_lock);
+  if (mc->overflow_count == mc->overflow_capacity) {
+    size_t capacity = mc->overflow_capacity ? mc->overflow_capacity * 2 : 1024;
+    struct object_header** overflow =
+        realloc(mc->overflow, capacity * sizeof(*overflow));
+    if (overflow == NULL) {
+      /* Losing a grey object would free live data, stop the VM instead */
+      printf("ERROR: can't grow marking overflow stack\n");
+      abort();
+    }
+    mc->overflow = overflow;
+    mc->overflow_capacity = capacity;
+  }
+  mc->overflow[mc->overflow_count++] = obj;
+  atomic_store(&mc->overflow_size, mc->overflow_count);
+  pthread_mutex_unlock(&mc->overflow_lock);
+}
+
+static struct object_header* overflow_pop(struct mark_compact* mc) {
+  struct object_header* obj = NULL;
+
+  if (atomic_load_explicit(&mc->overflow_size, memory_order_relaxed) == 0) {
+    return NULL;
+  }
+  pthread_mutex_lock(&mc->overflow_lock);
+  if (mc->overflow_count != 0) {
+    obj = mc->overflow[--mc->overflow_count];
+    atomic_store(&mc->overflow_size, mc->overflow_count);
+  }
+  pthread_mutex_unlock(&mc->overflow_lock);
+  return obj;
+}
+
+static struct mc_region* region_of(struct mark_compact* mc, const void* addr) {
+  return &mc->regions[(size_t)((const uint8_t*)addr - mc->gh->old.base) >>
+                      MC_REGION_SHIFT];
+}
+
+/* Sets the mark bit, returns 1 if this thread marked the object */
+static int mark_object(struct mark_compact* mc, const void* obj) {
+  size_t bit = (size_t)((const uint8_t*)obj - mc->gh->old.base) >> 3;
+  uint64_t mask = (uint64_t)1 << (bit & 63);
+  uint64_t old = atomic_fetch_or_explicit(&mc->bitmap[bit >> 6], mask,
+                                          memory_order_relaxed);
+  return (old & mask) == 0;
+}
+
+static void mark_slot(struct object_header** slot, void* ctx) {
+  struct mc_worker* worker = ctx;
+  struct mark_compact* mc = worker->mc;
+  struct mc_worker_stats* stats = &mc->stats[worker->id];
+  struct object_header* obj = *slot;
+  size_t size;
+
+  if (obj == NULL || !gc_is_old(mc->gh, obj) || !mark_object(mc, obj)) {
+    return;
+  }
+
+  size = object_size(obj);
+  atomic_fetch_add_explicit(&region_of(mc, obj)->live_bytes, size,
+                            memory_order_relaxed);
+  stats->marked_objects++;
+  stats->marked_bytes += size;
+
+  if (!deque_push(&mc->deques[worker->id], obj)) {
+    stats->overflows++;
+    overflow_push(mc, obj);
+  }
+}
+
+/* Roots are spread over the deques of all workers before they start */
+static void seed_slot(struct object_header** slot, void* ctx) {
+  struct mc_seed_state* seed = ctx;
+
+  mark_slot(slot, &seed->workers[seed->next]);
+  seed->next = (seed->next + 1) % seed->count;
+}
+
+static void visit_space_refs(uint8_t* start, uint8_t* end,
+                             gc_slot_visitor visit, void* ctx) {
+  while (start < end) {
+    struct object_header* obj = (struct object_header*)start;
+    object_visit_refs(obj, visit, ctx);
+    start += object_size(obj);
+  }
+}
+
+/* Young objects are all considered live, so their fields are roots too */
+static void visit_young_refs(struct gc_heap* gh, gc_slot_visitor visit,
+                             void* ctx) {
+  struct gc_space* from = &gh->survivor[gh->from];
+
+  visit_space_refs(gh->eden.base, gh->eden.base + heap_used(&gh->eden), visit,
+                   ctx);
+  visit_space_refs(from->base, from->top, visit, ctx);
+}
+
+static uint32_t next_random(uint32_t* state) {
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return *state = x;
+}
+
+static struct object_header* steal_grey(struct mc_worker* worker) {
+  struct mark_compact* mc = worker->mc;
+  struct mc_worker_stats* stats = &mc->stats[worker->id];
+  unsigned attempts;
+
+  for (attempts = 0; attempts < 2 * mc->workers; attempts++) {
+    unsigned victim = next_random(&worker->random) % mc->workers;
+    struct object_header* obj;
+
+    if (victim == worker->id) {
+      continue;
+    }
+    stats->steal_attempts++;
+    obj = deque_steal(&mc->deques[victim]);
+    if (obj != NULL) {
+      stats->steals++;
+      return obj;
+    }
+  }
+  return overflow_pop(mc);
+}
+
+static int work_available(struct mark_compact* mc) {
+  unsigned i;
+
+  if (atomic_load_explicit(&mc->overflow_size, memory_order_relaxed) != 0) {
+    return 1;
+  }
+  for (i = 0; i < mc->workers; i++) {
+    if (!deque_is_empty(&mc->deques[i])) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/*
+ * Marking is over when every worker is idle at the same time:
+ * an idle worker has an empty deque and pushes nothing.
+ */
+static int mark_terminate(struct mc_worker* worker) {
+  struct mark_compact* mc = worker->mc;
+  uint64_t start = now_ns();
+  int done = 0;
+
+  atomic_fetch_add(&mc->idle_workers, 1);
+  for (;;) {
+    if (atomic_load(&mc->idle_workers) == mc->workers) {
+      done = 1;
+      break;
+    }
+    if (work_available(mc)) {
+      atomic_fetch_sub(&mc->idle_workers, 1);
+      break;
+    }
+    sched_yield();
+  }
+  mc->stats[worker->id].idle_ns += now_ns() - start;
+  return done;
+}
+
+static void mark_phase(struct mc_worker* worker) {
+  struct mark_compact* mc = worker->mc;
+  struct object_header* obj;
+
+  for (;;) {
+    while ((obj = deque_pop(&mc->deques[worker->id])) != NULL ||
+           (obj = overflow_pop(mc)) != NULL) {
+      object_visit_refs(obj, mark_slot, worker);
+    }
+    obj = steal_grey(worker);
+    if (obj != NULL) {
+      object_visit_refs(obj, mark_slot, worker);
+      continue;
+    }
+    if (mark_terminate(worker)) {
+      return;
+    }
+  }
+}
+
+/* Serial: live bytes of the regions give their destinations */
+static void summary_phase(struct mark_compact* mc) {
+  uint8_t* dest = mc->gh->old.base;
+  size_t i;
+
+  for (i = 0; i < mc->region_count; i++) {
+    mc->regions[i].dest = dest;
+    dest += atomic_load_explicit(&mc->regions[i].live_bytes,
+                                 memory_order_relaxed);
+  }
+  mc->new_top = dest;
+  mc->live_bytes = (uint64_t)(dest - mc->gh->old.base);
+}
+
+static int add_forward(struct mc_region* region, uint8_t* from, uint8_t* to) {
+  if (region->forward_count == region->forward_capacity) {
+    size_t capacity =
+        region->forward_capacity ? region->forward_capacity * 2 : 64;
+    struct mc_forward* forward =
+        realloc(region->forward, capacity * sizeof(*forward));
+    if (forward == NULL) {
+      return ENOMEM;
+    }
+    region->forward = forward;
+    region->forward_capacity = capacity;
+  }
+  region->forward[region->forward_count].from = from;
+  region->forward[region->forward_count].to = to;
+  region->forward_count++;
+  return 0;
+}
+
+/* Builds the forwarding table of one region from its mark bits */
+static int forward_region(struct mark_compact* mc, size_t index) {
+  struct mc_region* region = &mc->regions[index];
+  uint8_t* base = mc->gh->old.base;
+  size_t first_word = (index << MC_REGION_SHIFT) >> 9;
+  size_t last_word = first_word + (MC_REGION_SIZE >> 9);
+  uint8_t* dest = region->dest;
+  size_t word;
+
+  region->forward_count = 0;
+  region->src_end = NULL;
+  if (last_word > mc->bitmap_words) {
+    last_word = mc->bitmap_words;
+  }
+
+  for (word = first_word; word < last_word; word++) {
+    uint64_t bits = atomic_load_explicit(&mc->bitmap[word],
+                                         memory_order_relaxed);
+    while (bits != 0) {
+      int bit = __builtin_ctzll(bits);
+      uint8_t* obj = base + ((word * 64 + (size_t)bit) << 3);
+      size_t size = object_size((struct object_header*)obj);
+
+      if (add_forward(region, obj, dest) != 0) {
+        return ENOMEM;
+      }
+      dest += size;
+      region->src_end = obj + size;
+      bits &= bits - 1;
+    }
+  }
+  return 0;
+}
+
+static uint8_t* forwardee(struct mark_compact* mc, uint8_t* obj) {
+  struct mc_region* region = region_of(mc, obj);
+  size_t low = 0;
+  size_t high = region->forward_count;
+
+  while (low < high) {
+    size_t middle = low + (high - low) / 2;
+    if (region->forward[middle].from < obj) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  if (low < region->forward_count && region->forward[low].from == obj) {
+    return region->forward[low].to;
+  }
+  return obj;
+}
+
+static void adjust_slot(struct object_header** slot, void* ctx) {
+  struct mark_compact* mc = ctx;
+  struct object_header* obj = *slot;
+
+  if (obj != NULL && gc_is_old(mc->gh, obj)) {
+    *slot = (struct object_header*)forwardee(mc, (uint8_t*)obj);
+  }
+}
+
+/* Slots of a moving old object: old->young stores re-dirty the new card */
+static void adjust_old_slot(struct object_header** slot, void* ctx) {
+  struct mc_adjust_state* state = ctx;
+  struct gc_heap* gh = state->mc->gh;
+  struct object_header* obj = *slot;
+
+  if (obj == NULL) {
+    return;
+  }
+  if (gc_is_old(gh, obj)) {
+    *slot = (struct object_header*)forwardee(state->mc, (uint8_t*)obj);
+  } else if (gc_is_young(gh, obj)) {
+    gc_write_barrier(gh, state->to + ((uint8_t*)slot - state->from));
+  }
+}
+
+static void adjust_region(struct mark_compact* mc, size_t index) {
+  struct mc_region* region = &mc->regions[index];
+  struct mc_adjust_state state = {.mc = mc};
+  size_t i;
+
+  for (i = 0; i < region->forward_count; i++) {
+    state.from = region->forward[i].from;
+    state.to = region->forward[i].to;
+    object_visit_refs((struct object_header*)state.from, adjust_old_slot,
+                      &state);
+  }
+}
+
+/*
+ * Objects slide down, so the destination of a region only overlaps
+ * sources of lower regions. Regions are claimed in increasing order
+ * and wait for the lower ones whose live objects are still in the way.
+ */
+static void compact_region(struct mark_compact* mc, size_t index) {
+  struct mc_region* region = &mc->regions[index];
+  size_t lower;
+  size_t i;
+
+  for (lower = index; lower-- > 0;) {
+    struct mc_region* other = &mc->regions[lower];
+    if (other->forward_count == 0) {
+      continue;
+    }
+    if (other->src_end <= region->dest) {
+      break;
+    }
+    while (!atomic_load_explicit(&other->compacted, memory_order_acquire)) {
+      sched_yield();
+    }
+  }
+
+  for (i = 0; i < region->forward_count; i++) {
+    uint8_t* from = region->forward[i].from;
+    uint8_t* to = region->forward[i].to;
+    size_t size = object_size((struct object_header*)from);
+
+    if (from != to) {
+      memmove(to, from, size);
+    }
+    gc_record_old_object(mc->gh, to, size);
+  }
+  atomic_store_explicit(&region->compacted, 1, memory_order_release);
+}
+
+/* Phase barrier; workers spin briefly since phases are short */
+static void barrier_wait(struct mark_compact* mc) {
+  unsigned generation = atomic_load(&mc->barrier_generation);
+
+  if (atomic_fetch_add(&mc->barrier_waiting, 1) + 1 == mc->workers) {
+    atomic_store(&mc->barrier_waiting, 0);
+    atomic_fetch_add(&mc->barrier_generation, 1);
+    return;
+  }
+  while (atomic_load(&mc->barrier_generation) == generation) {
+    sched_yield();
+  }
+}
+
+/* Runs `step` on worker 0 while the others wait */
+static void serial_step(struct mc_worker* worker,
+                        void (*step)(struct mark_compact* mc)) {
+  barrier_wait(worker->mc);
+  if (worker->id == 0) {
+    step(worker->mc);
+  }
+  barrier_wait(worker->mc);
+}
+
+static void start_next_phase(struct mark_compact* mc) {
+  atomic_store(&mc->next_task, 0);
+}
+
+static void summary_step(struct mark_compact* mc) {
+  summary_phase(mc);
+  start_next_phase(mc);
+}
+
+static void adjust_step(struct mark_compact* mc) {
+  struct gc_heap* gh = mc->gh;
+
+  if (!mc->failed) {
+    /* Old->young cards are rebuilt while adjusting */
+    memset(&gh->card_base[(uintptr_t)gh->old.base >> CARD_SHIFT], CARD_CLEAN,
+           (size_t)(gh->old.end - gh->old.base) >> CARD_SHIFT);
+  }
+  start_next_phase(mc);
+}
+
+static void* worker_main(void* arg) {
+  struct mc_worker* worker = arg;
+  struct mark_compact* mc = worker->mc;
+  size_t task;
+
+  mark_phase(worker);
+  serial_step(worker, summary_step);
+
+  while ((task = atomic_fetch_add(&mc->next_task, 1)) < mc->region_count) {
+    if (forward_region(mc, task) != 0) {
+      mc->failed = 1;
+    }
+  }
+  serial_step(worker, adjust_step);
+  if (mc->failed) {
+    return NULL;
+  }
+
+  /* One extra task handles the roots and the young generation */
+  while ((task = atomic_fetch_add(&mc->next_task, 1)) <= mc->region_count) {
+    if (task == mc->region_count) {
+      gc_visit_roots(mc->gh, adjust_slot, mc);
+      visit_young_refs(mc->gh, adjust_slot, mc);
+    } else {
+      adjust_region(mc, task);
+    }
+  }
+  serial_step(worker, start_next_phase);
+
+  while ((task = atomic_fetch_add(&mc->next_task, 1)) < mc->region_count) {
+    compact_region(mc, task);
+    mc->stats[worker->id].regions_compacted++;
+  }
+  return NULL;
+}
+
+/* Mutators must be stopped and TLABs retired */
+int mark_compact_collect(struct mark_compact* mc) {
+  struct gc_heap* gh = mc->gh;
+  struct mc_worker* workers;
+  struct mc_seed_state seed;
+  uint64_t start = now_ns();
+  unsigned i;
+  size_t r;
+
+  workers = calloc(mc->workers, sizeof(*workers));
+  if (workers == NULL) {
+    return ENOMEM;
+  }
+
+  memset(mc->stats, 0, mc->workers * sizeof(struct mc_worker_stats));
+  for (r = 0; r < mc->region_count; r++) {
+    atomic_store(&mc->regions[r].live_bytes, 0);
+    atomic_store(&mc->regions[r].compacted, 0);
+    mc->regions[r].forward_count = 0;
+  }
+  atomic_store(&mc->idle_workers, 0);
+  atomic_store(&mc->next_task, 0);
+  atomic_store(&mc->barrier_waiting, 0);
+  mc->failed = 0;
+
+  for (i = 0; i < mc->workers; i++) {
+    workers[i].mc = mc;
+    workers[i].id = i;
+    workers[i].random = 2463534242u + i * 7919u;
+  }
+
+  seed.workers = workers;
+  seed.count = mc->workers;
+  seed.next = 0;
+  gc_visit_roots(gh, seed_slot, &seed);
+  visit_young_refs(gh, seed_slot, &seed);
+
+  for (i = 1; i < mc->workers; i++) {
+    pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]);
+  }
+  worker_main(&workers[0]);
+  for (i = 1; i < mc->workers; i++) {
+    pthread_join(workers[i].thread, NULL);
+  }
+
+  memset((void*)mc->bitmap, 0, mc->bitmap_words * sizeof(uint64_t));
+  free(workers);
+
+  if (mc->failed) {
+    printf("ERROR: can't allocate forwarding tables\n");
+    return ENOMEM;
+  }
+
+  gh->old.top = mc->new_top;
+  mc->collections++;
+  mc->last_pause_ns = now_ns() - start;
+  mc->total_pause_ns += mc->last_pause_ns;
+  return 0;
+}
+
+void mark_compact_print_stats(const struct mark_compact* mc) {
+  unsigned i;
+
+  printf("full gc #%llu: pause %.3f ms, live %.1f MB, %u workers\n",
+         (unsigned long long)mc->collections, (double)mc->last_pause_ns / 1e6,
+         (double)mc->live_bytes / (1024.0 * 1024.0), mc->workers);
+  for (i = 0; i < mc->workers; i++) {
+    const struct mc_worker_stats* stats = &mc->stats[i];
+    printf("  worker %u: marked %llu objects / %.1f MB, steals %llu/%llu, "
+           "overflows %llu, idle %.3f ms, regions %llu\n",
+           i, (unsigned long long)stats->marked_objects,
+           (double)stats->marked_bytes / (1024.0 * 1024.0),
+           (unsigned long long)stats->steals,
+           (unsigned long long)stats->steal_attempts,
+           (unsigned long long)stats->overflows,
+           (double)stats->idle_ns / 1e6,
+           (unsigned long long)stats->regions_compacted);
+  }
+}
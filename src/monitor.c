@@ -0,0 +1,272 @@
+#define _GNU_SOURCE
+
+#include "monitor.h"
+
+#include <errno.h>
+#include <linux/futex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "safepoint.h"
+
+static _Atomic(uintptr_t)* mark_of(struct object_header* obj) {
+  return (_Atomic(uintptr_t)*)&obj->mark;
+}
+
+static void spin_pause(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#endif
+}
+
+static void futex_wait(_Atomic(uint32_t)* word, uint32_t value) {
+  syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+}
+
+static void futex_wake(_Atomic(uint32_t)* word) {
+  syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+struct monitor_table* monitor_table_new(void) {
+  struct monitor_table* table = calloc(1, sizeof(struct monitor_table));
+
+  if (table == NULL) {
+    printf("ERROR: can't allocate memory for monitor table\n");
+    return NULL;
+  }
+  if (pthread_mutex_init(&table->lock, NULL) != 0) {
+    free(table);
+    return NULL;
+  }
+  return table;
+}
+
+void monitor_table_free(struct monitor_table* table) {
+  uint32_t i;
+
+  if (table == NULL) {
+    return;
+  }
+  for (i = 0; i < MONITOR_MAX_CHUNKS; i++) {
+    free(atomic_load_explicit(&table->chunks[i], memory_order_relaxed));
+  }
+  pthread_mutex_destroy(&table->lock);
+  free(table);
+}
+
+static struct monitor* monitor_at(struct monitor_table* table,
+                                  uint32_t index) {
+  struct monitor* chunk = atomic_load_explicit(
+      &table->chunks[index / MONITOR_CHUNK_SIZE], memory_order_acquire);
+  return &chunk[index % MONITOR_CHUNK_SIZE];
+}
+
+/* Index of a monitor held by owner, UINT32_MAX without memory */
+static uint32_t monitor_new(struct monitor_table* table, uint64_t owner,
+                            uint32_t recursions) {
+  struct monitor* m;
+  uint32_t index = UINT32_MAX;
+
+  pthread_mutex_lock(&table->lock);
+  if (table->free_list != 0) {
+    index = table->free_list - 1;
+    table->free_list = monitor_at(table, index)->next_free;
+  } else if (table->count < MONITOR_CHUNK_SIZE * MONITOR_MAX_CHUNKS) {
+    uint32_t chunk = table->count / MONITOR_CHUNK_SIZE;
+
+    if (atomic_load_explicit(&table->chunks[chunk], memory_order_relaxed) ==
+        NULL) {
+      m = calloc(MONITOR_CHUNK_SIZE, sizeof(struct monitor));
+      atomic_store_explicit(&table->chunks[chunk], m, memory_order_release);
+    }
+    if (atomic_load_explicit(&table->chunks[chunk], memory_order_relaxed) !=
+        NULL) {
+      index = table->count++;
+    }
+  }
+  pthread_mutex_unlock(&table->lock);
+  if (index == UINT32_MAX) {
+    printf("ERROR: can't allocate memory for monitor\n");
+    return UINT32_MAX;
+  }
+
+  /* nobody sees it before the mark word names it */
+  m = monitor_at(table, index);
+  atomic_store_explicit(&m->futex, 1, memory_order_relaxed);
+  atomic_store_explicit(&m->spin, MONITOR_MIN_SPIN, memory_order_relaxed);
+  atomic_store_explicit(&m->owner, owner, memory_order_relaxed);
+  m->recursions = recursions;
+  m->next_free = 0;
+  return index;
+}
+
+/* Takes back a monitor that never got into a mark word */
+static void monitor_discard(struct monitor_table* table, uint32_t index) {
+  pthread_mutex_lock(&table->lock);
+  monitor_at(table, index)->next_free = table->free_list;
+  table->free_list = index + 1;
+  pthread_mutex_unlock(&table->lock);
+}
+
+/*
+ * Puts a monitor held like the thin lock in mark into the object.
+ * Returns 0 also when the mark changed meanwhile, the caller looks
+ * again
+ */
+static int inflate(struct interp_thread* thread, struct object_header* obj,
+                   uintptr_t mark, uint32_t recursions) {
+  struct monitor_table* table = thread->interp->monitors;
+  uint32_t index = monitor_new(table, mark >> MARK_OWNER_SHIFT, recursions);
+  uintptr_t inflated;
+
+  if (index == UINT32_MAX) {
+    return ENOMEM;
+  }
+  inflated = (mark & MARK_AGE_MASK) |
+             (uintptr_t)index << MARK_MONITOR_SHIFT | MARK_INFLATED;
+  if (atomic_compare_exchange_strong(mark_of(obj), &mark, inflated)) {
+    thread->stats.lock_inflations++;
+  } else {
+    monitor_discard(table, index);
+  }
+  return 0;
+}
+
+static void enter_monitor(struct interp_thread* thread, struct monitor* m) {
+  uint32_t expected = 0;
+  uint32_t spin;
+  uint32_t i;
+
+  if (atomic_load_explicit(&m->owner, memory_order_relaxed) == thread->id) {
+    m->recursions++;
+    return;
+  }
+  if (atomic_compare_exchange_strong(&m->futex, &expected, 1)) {
+    goto owned;
+  }
+
+  thread->stats.lock_contentions++;
+  /* spin as long as the last spins got the lock */
+  spin = atomic_load_explicit(&m->spin, memory_order_relaxed);
+  for (i = 0; i < spin; i++) {
+    spin_pause();
+    expected = 0;
+    if (atomic_load_explicit(&m->futex, memory_order_relaxed) == 0 &&
+        atomic_compare_exchange_strong(&m->futex, &expected, 1)) {
+      if (spin < MONITOR_MAX_SPIN) {
+        atomic_store_explicit(&m->spin, spin * 2, memory_order_relaxed);
+      }
+      goto owned;
+    }
+  }
+  if (spin > MONITOR_MIN_SPIN) {
+    atomic_store_explicit(&m->spin, spin / 2, memory_order_relaxed);
+  }
+  /* 2 tells the owner to wake someone when it leaves */
+  safepoint_block();
+  while (atomic_exchange(&m->futex, 2) != 0) {
+    futex_wait(&m->futex, 2);
+  }
+  safepoint_unblock();
+
+owned:
+  atomic_store_explicit(&m->owner, thread->id, memory_order_relaxed);
+  m->recursions = 0;
+}
+
+static int exit_monitor(struct interp_thread* thread, struct monitor* m) {
+  if (atomic_load_explicit(&m->owner, memory_order_relaxed) != thread->id) {
+    return EPERM;
+  }
+  if (m->recursions > 0) {
+    m->recursions--;
+    return 0;
+  }
+  atomic_store_explicit(&m->owner, 0, memory_order_relaxed);
+  if (atomic_fetch_sub(&m->futex, 1) != 1) {
+    atomic_store(&m->futex, 0);
+    futex_wake(&m->futex);
+  }
+  return 0;
+}
+
+int monitor_enter(struct interp_thread* thread, struct object_header* obj) {
+  uintptr_t self = (uintptr_t)thread->id << MARK_OWNER_SHIFT;
+
+  for (;;) {
+    uintptr_t mark = atomic_load(mark_of(obj));
+    int err;
+
+    switch (mark & MARK_LOCK_MASK) {
+      case MARK_UNLOCKED:
+        if (atomic_compare_exchange_strong(
+                mark_of(obj), &mark,
+                (mark & MARK_AGE_MASK) | self | MARK_THIN_LOCKED)) {
+          return 0;
+        }
+        break;
+      case MARK_THIN_LOCKED:
+        if ((mark & ~(uintptr_t)0 << MARK_OWNER_SHIFT) != self) {
+          /* the owner keeps the lock, as the owner of a monitor */
+          err = inflate(thread, obj, mark,
+                        (uint32_t)((mark & MARK_COUNT_MASK) >>
+                                   MARK_COUNT_SHIFT));
+        } else if ((mark & MARK_COUNT_MASK) != MARK_COUNT_MASK) {
+          if (atomic_compare_exchange_strong(
+                  mark_of(obj), &mark,
+                  mark + ((uintptr_t)1 << MARK_COUNT_SHIFT))) {
+            return 0;
+          }
+          err = 0;
+        } else {
+          /* the count is full, a monitor counts further */
+          err = inflate(thread, obj, mark,
+                        (uint32_t)(MARK_COUNT_MASK >> MARK_COUNT_SHIFT));
+        }
+        if (err != 0) {
+          return err;
+        }
+        break;
+      case MARK_INFLATED:
+        enter_monitor(thread, monitor_at(thread->interp->monitors,
+                                         (uint32_t)(mark >>
+                                                    MARK_MONITOR_SHIFT)));
+        return 0;
+      default:
+        printf("ERROR: lock of a forwarded object\n");
+        return EINVAL;
+    }
+  }
+}
+
+int monitor_exit(struct interp_thread* thread, struct object_header* obj) {
+  uintptr_t self = (uintptr_t)thread->id << MARK_OWNER_SHIFT;
+
+  for (;;) {
+    uintptr_t mark = atomic_load(mark_of(obj));
+    uintptr_t unlocked;
+
+    switch (mark & MARK_LOCK_MASK) {
+      case MARK_THIN_LOCKED:
+        if ((mark & ~(uintptr_t)0 << MARK_OWNER_SHIFT) != self) {
+          return EPERM;
+        }
+        unlocked = (mark & MARK_COUNT_MASK) != 0
+                       ? mark - ((uintptr_t)1 << MARK_COUNT_SHIFT)
+                       : (mark & MARK_AGE_MASK) | MARK_UNLOCKED;
+        /* fails when a contender inflated the lock */
+        if (atomic_compare_exchange_strong(mark_of(obj), &mark, unlocked)) {
+          return 0;
+        }
+        break;
+      case MARK_INFLATED:
+        return exit_monitor(thread, monitor_at(thread->interp->monitors,
+                                               (uint32_t)(mark >>
+                                                          MARK_MONITOR_SHIFT)));
+      default:
+        return EPERM;
+    }
+  }
+}
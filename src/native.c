@@ -0,0 +1,483 @@
+#define _GNU_SOURCE
+
+#include "native.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "attribute_info.h"
+#include "safepoint.h"
+#include "x86_64.h"
+
+#define INT_REGS 6
+#define XMM_REGS 8
+
+static const enum x86_reg int_regs[INT_REGS] = {
+    X86_RDI, X86_RSI, X86_RDX, X86_RCX, X86_R8, X86_R9,
+};
+
+/*
+ * Argument of the C call: 'T' the thread, 'K' the class, 'L' a
+ * handle, otherwise the descriptor kind of a primitive
+ */
+struct native_arg {
+  char kind;
+  int32_t disp; /* of its slot in the caller's arguments */
+  int reg;      /* x86_reg or xmm number, -1 on the stack */
+};
+
+struct stub_layout {
+  struct native_arg args[DESCRIPTOR_MAX_ARGS + 2];
+  uint32_t count;
+  uint32_t stacked;
+};
+
+struct native_table* native_table_new(void) {
+  struct native_table* table = calloc(1, sizeof(struct native_table));
+
+  if (table == NULL) {
+    printf("ERROR: can't allocate memory for native table\n");
+    return NULL;
+  }
+  if (pthread_mutex_init(&table->lock, NULL) != 0) {
+    free(table);
+    return NULL;
+  }
+  return table;
+}
+
+static void method_free(struct native_method* m) {
+  free(m->class_name);
+  free(m->name);
+  free(m->descriptor);
+  free(m);
+}
+
+void native_table_free(struct native_table* table) {
+  if (table == NULL) {
+    return;
+  }
+  while (table->methods != NULL) {
+    struct native_method* next = table->methods->next;
+    method_free(table->methods);
+    table->methods = next;
+  }
+  while (table->stubs != NULL) {
+    struct native_stub* next = table->stubs->next;
+    free(table->stubs->key);
+    free(table->stubs);
+    table->stubs = next;
+  }
+  code_cache_destroy(&table->code);
+  pthread_mutex_destroy(&table->lock);
+  free(table);
+}
+
+static int parse(const char* descriptor, struct method_descriptor* desc) {
+  struct UTF8_info utf8;
+
+  utf8.lenght = (uint16_t)strlen(descriptor);
+  utf8.bytes = (uint8_t*)descriptor;
+  return parse_method_descriptor(&utf8, desc);
+}
+
+static int is_primitive_only(const struct method_descriptor* desc) {
+  uint32_t i;
+
+  for (i = 0; i < desc->arg_count; i++) {
+    if (desc->args[i] == 'L') {
+      return 0;
+    }
+  }
+  return desc->ret != 'L';
+}
+
+int native_register(struct native_table* table, const char* class_name,
+                    const char* name, const char* descriptor,
+                    void* function, uint32_t flags) {
+  struct method_descriptor desc;
+  struct native_method* m;
+
+  if (strlen(descriptor) > UINT16_MAX || parse(descriptor, &desc) != 0) {
+    return EINVAL;
+  }
+  if ((flags & NATIVE_CRITICAL) && !is_primitive_only(&desc)) {
+    printf("ERROR: critical native %s.%s%s takes or returns references\n",
+           class_name, name, descriptor);
+    return EINVAL;
+  }
+  m = calloc(1, sizeof(struct native_method));
+  if (m != NULL) {
+    m->class_name = strdup(class_name);
+    m->name = strdup(name);
+    m->descriptor = strdup(descriptor);
+  }
+  if (m == NULL || m->class_name == NULL || m->name == NULL ||
+      m->descriptor == NULL) {
+    printf("ERROR: can't allocate memory for native method\n");
+    if (m != NULL) {
+      method_free(m);
+    }
+    return ENOMEM;
+  }
+  m->function = function;
+  m->flags = flags;
+
+  pthread_mutex_lock(&table->lock);
+  m->next = table->methods;
+  table->methods = m;
+  pthread_mutex_unlock(&table->lock);
+  return 0;
+}
+
+static int utf8_equals_str(const struct UTF8_info* utf8, const char* str) {
+  size_t length = strlen(str);
+  return utf8 != NULL && utf8->lenght == length &&
+         memcmp(utf8->bytes, str, length) == 0;
+}
+
+/* Under the table lock, the newest registration wins */
+static struct native_method* find_method(struct native_table* table,
+                                         struct class_file* class,
+                                         struct method_info* method) {
+  struct UTF8_info* class_name = constant_class_name(class, class->this_class);
+  struct UTF8_info* name = validate_constant(class, method->name_index);
+  struct UTF8_info* descriptor =
+      validate_constant(class, method->descriptor_index);
+  struct native_method* m;
+
+  for (m = table->methods; m != NULL; m = m->next) {
+    if (utf8_equals_str(class_name, m->class_name) &&
+        utf8_equals_str(name, m->name) &&
+        utf8_equals_str(descriptor, m->descriptor)) {
+      return m;
+    }
+  }
+  return NULL;
+}
+
+/* Assigns registers to the arguments in System V order */
+static void layout_args(struct stub_layout* layout, int critical,
+                        int is_static, const struct method_descriptor* desc) {
+  uint32_t ints = 0;
+  uint32_t xmms = 0;
+  int32_t slot = 0;
+  uint32_t i;
+
+  layout->count = 0;
+  layout->stacked = 0;
+  if (!critical) {
+    layout->args[layout->count++] = (struct native_arg){'T', 0, 0};
+    layout->args[layout->count++] =
+        (struct native_arg){is_static ? 'K' : 'L', 0, 0};
+    slot = !is_static;
+  }
+  for (i = 0; i < desc->arg_count; i++) {
+    char kind = desc->args[i];
+    layout->args[layout->count++] = (struct native_arg){
+        kind, slot * (int32_t)sizeof(union java_value), 0};
+    slot += descriptor_slots(kind);
+  }
+
+  for (i = 0; i < layout->count; i++) {
+    struct native_arg* arg = &layout->args[i];
+
+    if (arg->kind == 'F' || arg->kind == 'D') {
+      arg->reg = xmms < XMM_REGS ? (int)xmms++ : -1;
+    } else {
+      arg->reg = ints < INT_REGS ? (int)int_regs[ints++] : -1;
+    }
+    layout->stacked += arg->reg < 0;
+  }
+}
+
+static void load_arg(struct x86_asm* a, const struct native_arg* arg,
+                     enum x86_reg base) {
+  switch (arg->kind) {
+    case 'T':
+      x86_mov_rr(a, 1, (enum x86_reg)arg->reg, X86_RBX);
+      break;
+    case 'K':
+      x86_mov_rr(a, 1, (enum x86_reg)arg->reg, X86_R14);
+      break;
+    case 'L':
+      x86_lea(a, (enum x86_reg)arg->reg, base, arg->disp);
+      break;
+    case 'F':
+    case 'D':
+      x86_load_xmm(a, arg->kind == 'D', arg->reg, base, arg->disp);
+      break;
+    default:
+      x86_mov_rm(a, arg->kind == 'J', (enum x86_reg)arg->reg, base,
+                 arg->disp);
+      break;
+  }
+}
+
+/* Pushes the stack arguments, rsp is 16-byte aligned at the call */
+static void push_args(struct x86_asm* a, const struct stub_layout* layout,
+                      enum x86_reg base) {
+  uint32_t i;
+
+  if (layout->stacked % 2 != 0) {
+    x86_alu_ri(a, 1, X86_SUB, X86_RSP, 8);
+  }
+  for (i = layout->count; i-- > 0;) {
+    const struct native_arg* arg = &layout->args[i];
+
+    if (arg->reg >= 0) {
+      continue;
+    }
+    if (arg->kind == 'L') {
+      x86_lea(a, X86_RAX, base, arg->disp);
+      x86_push(a, X86_RAX);
+    } else {
+      /* the slot is 8 bytes, narrower values sit in its low bytes */
+      x86_push_m(a, base, arg->disp);
+    }
+  }
+}
+
+static void load_args(struct x86_asm* a, const struct stub_layout* layout,
+                      enum x86_reg base) {
+  uint32_t i;
+
+  for (i = 0; i < layout->count; i++) {
+    if (layout->args[i].reg >= 0) {
+      load_arg(a, &layout->args[i], base);
+    }
+  }
+}
+
+/* Puts the C result into rax as compiled code returns it */
+static int convert_result(struct x86_asm* a, char ret, int emit) {
+  switch (ret) {
+    case 'F':
+    case 'D':
+      if (emit) {
+        x86_mov_rx(a, ret == 'D', X86_RAX, 0);
+      }
+      return 1;
+    case 'Z':
+      if (emit) {
+        x86_movzx8(a, X86_RAX, X86_RAX);
+      }
+      return 1;
+    case 'B':
+      if (emit) {
+        x86_movsx8(a, X86_RAX, X86_RAX);
+      }
+      return 1;
+    case 'C':
+      if (emit) {
+        x86_movzx16(a, X86_RAX, X86_RAX);
+      }
+      return 1;
+    case 'S':
+      if (emit) {
+        x86_movsx16(a, X86_RAX, X86_RAX);
+      }
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+/*
+ * Entered with the thread in rdi, the arguments in rsi and the
+ * function in r10. Calls it directly, and when nothing is left to do
+ * after it, jumps to it
+ */
+static void emit_critical(struct x86_asm* a, const struct stub_layout* layout,
+                          char ret) {
+  x86_mov_rr(a, 1, X86_R11, X86_RSI);
+  if (layout->stacked == 0 && !convert_result(a, ret, 0)) {
+    load_args(a, layout, X86_R11);
+    x86_jmp_r(a, X86_R10);
+    return;
+  }
+  x86_push(a, X86_RBP);
+  x86_mov_rr(a, 1, X86_RBP, X86_RSP);
+  push_args(a, layout, X86_R11);
+  load_args(a, layout, X86_R11);
+  x86_call_r(a, X86_R10);
+  x86_mov_rr(a, 1, X86_RSP, X86_RBP);
+  x86_pop(a, X86_RBP);
+  convert_result(a, ret, 1);
+  x86_ret(a);
+}
+
+/*
+ * As emit_critical() with the class in r11. The thread is blocked
+ * for safepoints around the call and a handle result is read after
+ * it is running again, when the object can't move any more
+ */
+static void emit_normal(struct x86_asm* a, const struct stub_layout* layout,
+                        char ret) {
+  size_t null_result = X86_NO_TARGET;
+
+  x86_push(a, X86_RBP);
+  x86_mov_rr(a, 1, X86_RBP, X86_RSP);
+  x86_push(a, X86_RBX);
+  x86_push(a, X86_R12);
+  x86_push(a, X86_R13);
+  x86_push(a, X86_R14);
+  x86_mov_rr(a, 1, X86_RBX, X86_RDI);
+  x86_mov_rr(a, 1, X86_R12, X86_RSI);
+  x86_mov_rr(a, 1, X86_R13, X86_R10);
+  x86_mov_rr(a, 1, X86_R14, X86_R11);
+  x86_mov_ri64(a, X86_RAX, (uint64_t)(uintptr_t)safepoint_block);
+  x86_call_r(a, X86_RAX);
+
+  push_args(a, layout, X86_R12);
+  load_args(a, layout, X86_R12);
+  x86_call_r(a, X86_R13);
+  x86_lea(a, X86_RSP, X86_RBP, -32);
+  convert_result(a, ret, 1);
+
+  x86_mov_rr(a, 1, X86_R14, X86_RAX);
+  x86_mov_ri64(a, X86_RAX, (uint64_t)(uintptr_t)safepoint_unblock);
+  x86_call_r(a, X86_RAX);
+  x86_mov_rr(a, 1, X86_RAX, X86_R14);
+  if (ret == 'L') {
+    x86_test_rr(a, 1, X86_RAX, X86_RAX);
+    null_result = x86_jcc(a, X86_CC_E, X86_NO_TARGET);
+    x86_mov_rm(a, 1, X86_RAX, X86_RAX, 0);
+    x86_patch_jump(a, null_result, a->size);
+  }
+
+  x86_pop(a, X86_R14);
+  x86_pop(a, X86_R13);
+  x86_pop(a, X86_R12);
+  x86_pop(a, X86_RBX);
+  x86_pop(a, X86_RBP);
+  x86_ret(a);
+}
+
+static void* install(struct native_table* table, struct x86_asm* a) {
+  void* code;
+
+  if (a->error != 0) {
+    printf("ERROR: can't allocate memory for native stub\n");
+    return NULL;
+  }
+  code = code_cache_install(&table->code, a->code, a->size);
+  if (code == NULL) {
+    printf("ERROR: native code cache is full\n");
+    return NULL;
+  }
+  table->stats.code_bytes += a->size;
+  return code;
+}
+
+/* Under the table lock */
+static void* stub_for(struct native_table* table, int critical,
+                      int is_static, const struct method_descriptor* desc) {
+  char key[DESCRIPTOR_MAX_ARGS + 4];
+  struct stub_layout* layout;
+  struct native_stub* stub;
+  struct x86_asm a;
+  void* code;
+
+  key[0] = critical ? 'C' : 'N';
+  key[1] = is_static ? 'S' : 'I';
+  memcpy(key + 2, desc->args, desc->arg_count);
+  key[2 + desc->arg_count] = desc->ret;
+  key[3 + desc->arg_count] = '\0';
+  for (stub = table->stubs; stub != NULL; stub = stub->next) {
+    if (strcmp(stub->key, key) == 0) {
+      return stub->code;
+    }
+  }
+
+  layout = malloc(sizeof(struct stub_layout));
+  stub = calloc(1, sizeof(struct native_stub));
+  if (stub != NULL) {
+    stub->key = strdup(key);
+  }
+  if (layout == NULL || stub == NULL || stub->key == NULL) {
+    printf("ERROR: can't allocate memory for native stub\n");
+    free(layout);
+    if (stub != NULL) {
+      free(stub->key);
+    }
+    free(stub);
+    return NULL;
+  }
+  layout_args(layout, critical, is_static, desc);
+  x86_init(&a);
+  if (critical) {
+    emit_critical(&a, layout, desc->ret);
+  } else {
+    emit_normal(&a, layout, desc->ret);
+  }
+  code = install(table, &a);
+  x86_destroy(&a);
+  free(layout);
+  if (code == NULL) {
+    free(stub->key);
+    free(stub);
+    return NULL;
+  }
+  stub->code = code;
+  stub->next = table->stubs;
+  table->stubs = stub;
+  table->stats.stubs++;
+  return code;
+}
+
+compiled_entry native_bind(struct native_table* table,
+                           struct class_file* class,
+                           struct method_info* method,
+                           const struct method_descriptor* desc) {
+  int is_static = (method->access_flags & ACC_STATIC) != 0;
+  struct native_method* m;
+  struct x86_asm a;
+  void* stub;
+  void* entry = NULL;
+  int critical;
+
+  pthread_mutex_lock(&table->lock);
+  m = find_method(table, class, method);
+  if (m == NULL) {
+    pthread_mutex_unlock(&table->lock);
+    return NULL;
+  }
+  critical = (m->flags & NATIVE_CRITICAL) != 0;
+  if (method->access_flags & ACC_SYNCHRONIZED) {
+    printf("ERROR: synchronized native method %s.%s is not supported\n",
+           m->class_name, m->name);
+  } else if (critical && !is_static) {
+    printf("ERROR: critical native %s.%s must be static\n", m->class_name,
+           m->name);
+  } else if (table->code.base != NULL ||
+             code_cache_init(&table->code, NATIVE_CODE_SIZE) == 0) {
+    stub = stub_for(table, critical, is_static, desc);
+    if (stub != NULL) {
+      /* the method's own part: its function, its class, the stub */
+      x86_init(&a);
+      x86_mov_ri64(&a, X86_R10, (uint64_t)(uintptr_t)m->function);
+      if (!critical && is_static) {
+        x86_mov_ri64(&a, X86_R11, (uint64_t)(uintptr_t)class);
+      }
+      x86_mov_ri64(&a, X86_RAX, (uint64_t)(uintptr_t)stub);
+      x86_jmp_r(&a, X86_RAX);
+      entry = install(table, &a);
+      x86_destroy(&a);
+    }
+    if (entry != NULL) {
+      table->stats.bound++;
+      table->stats.critical += critical;
+    }
+  }
+  pthread_mutex_unlock(&table->lock);
+  return (compiled_entry)entry;
+}
+
+void native_get_stats(struct native_table* table, struct native_stats* stats) {
+  pthread_mutex_lock(&table->lock);
+  *stats = table->stats;
+  pthread_mutex_unlock(&table->lock);
+}
@@ -0,0 +1,746 @@
+#define _GNU_SOURCE
+
+#include "oop_map.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ucontext.h>
+
+#include "attribute_info.h"
+#include "deopt.h"
+#include "descriptor.h"
+#include "opcodes.h"
+
+/* Builder state, one reference flag per slot */
+struct oop_flow {
+  struct class_file* class;
+  struct Code_attribute* code;
+  struct oop_map* map;
+  uint32_t capacity;
+
+  uint8_t* locals; /* size = max_locals */
+  uint8_t* stack;  /* size = max_stack */
+  uint16_t depth;
+
+  /* Verification types of the locals of the last stack map frame */
+  uint8_t* frame_locals; /* size = max_locals */
+  uint16_t frame_local_count;
+};
+
+static int is_reference_type(uint8_t tag) {
+  return tag == ITEM_Object || tag == ITEM_Null ||
+         tag == ITEM_UninitializedThis || tag == ITEM_Uninitialized;
+}
+
+static int is_wide_type(uint8_t tag) {
+  return tag == ITEM_Long || tag == ITEM_Double;
+}
+
+static uint8_t descriptor_type(char kind) {
+  switch (kind) {
+    case 'L':
+      return ITEM_Object;
+    case 'J':
+      return ITEM_Long;
+    case 'D':
+      return ITEM_Double;
+    case 'F':
+      return ITEM_Float;
+    default:
+      return ITEM_Integer;
+  }
+}
+
+static int push(struct oop_flow* flow, int slots, uint8_t ref) {
+  if (flow->depth + slots > flow->code->max_stack) {
+    printf("ERROR: operand stack overflow\n");
+    return EINVAL;
+  }
+  while (slots-- > 0) {
+    flow->stack[flow->depth++] = ref;
+  }
+  return 0;
+}
+
+static int pop(struct oop_flow* flow, int slots) {
+  if (flow->depth < slots) {
+    printf("ERROR: operand stack underflow\n");
+    return EINVAL;
+  }
+  flow->depth -= (uint16_t)slots;
+  return 0;
+}
+
+static int push_kind(struct oop_flow* flow, uint8_t push_kind) {
+  switch (push_kind) {
+    case OPK_INT:
+      return push(flow, 1, 0);
+    case OPK_WIDE:
+      return push(flow, 2, 0);
+    case OPK_REF:
+      return push(flow, 1, 1);
+    default:
+      return 0;
+  }
+}
+
+static int push_descriptor(struct oop_flow* flow, char kind) {
+  return push(flow, descriptor_slots(kind), kind == 'L');
+}
+
+/* Pops `slots` and stores them into the locals starting at `index` */
+static int store(struct oop_flow* flow, uint16_t index, int slots) {
+  uint8_t ref;
+
+  if (index + slots > flow->code->max_locals || pop(flow, slots) != 0) {
+    printf("ERROR: bad store to local %hu\n", index);
+    return EINVAL;
+  }
+  ref = slots == 1 ? flow->stack[flow->depth] : 0;
+  flow->locals[index] = ref;
+  if (slots == 2) {
+    flow->locals[index + 1] = 0;
+  }
+  return 0;
+}
+
+/* Copies the top `count` slots `below` slots down, the dup family */
+static int dup(struct oop_flow* flow, uint16_t count, uint16_t below) {
+  uint8_t* base;
+
+  if (flow->depth < below || flow->depth + count > flow->code->max_stack) {
+    printf("ERROR: bad dup\n");
+    return EINVAL;
+  }
+  base = flow->stack + flow->depth - below;
+  memmove(base + count, base, below);
+  memcpy(base, base + below, count);
+  flow->depth += count;
+  return 0;
+}
+
+static int push_constant(struct oop_flow* flow, uint16_t index) {
+  struct cp_info* cp_info;
+  struct UTF8_info* descriptor;
+  char kind;
+
+  if (get_constant(flow->class, index, &cp_info) != 0) {
+    return EINVAL;
+  }
+  switch (cp_info->tag) {
+    case INTEGER:
+    case FLOAT:
+      return push(flow, 1, 0);
+    case STRING:
+    case CLASS:
+    case METHOD_TYPE:
+    case METHOD_HANDLE:
+      return push(flow, 1, 1);
+    case DYNAMIC:
+      descriptor = constant_member_descriptor(flow->class, index);
+      if (descriptor == NULL ||
+          parse_field_descriptor(descriptor, &kind) != 0) {
+        return EINVAL;
+      }
+      return push_descriptor(flow, kind);
+    default:
+      printf("ERROR: ldc of constant %hu with tag %hhu\n", index,
+             cp_info->tag);
+      return EINVAL;
+  }
+}
+
+static int field_access(struct oop_flow* flow, uint8_t opcode,
+                        uint16_t index) {
+  struct UTF8_info* descriptor =
+      constant_member_descriptor(flow->class, index);
+  char kind;
+
+  if (descriptor == NULL || parse_field_descriptor(descriptor, &kind) != 0) {
+    return EINVAL;
+  }
+  switch (opcode) {
+    case OP_GETSTATIC:
+      return push_descriptor(flow, kind);
+    case OP_PUTSTATIC:
+      return pop(flow, descriptor_slots(kind));
+    case OP_GETFIELD:
+      return pop(flow, 1) != 0 ? EINVAL : push_descriptor(flow, kind);
+    default:
+      return pop(flow, descriptor_slots(kind) + 1);
+  }
+}
+
+static int invoke(struct oop_flow* flow, uint8_t opcode, uint16_t index) {
+  struct UTF8_info* descriptor =
+      constant_member_descriptor(flow->class, index);
+  struct method_descriptor desc;
+  int receiver = opcode != OP_INVOKESTATIC && opcode != OP_INVOKEDYNAMIC;
+
+  if (descriptor == NULL || parse_method_descriptor(descriptor, &desc) != 0 ||
+      pop(flow, desc.arg_slots + receiver) != 0) {
+    return EINVAL;
+  }
+  return push_descriptor(flow, desc.ret);
+}
+
+static uint16_t read_u2(const uint8_t* p) {
+  return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+/* Applies the instruction at bci to the reference flags */
+static int flow_step(struct oop_flow* flow, uint32_t bci) {
+  const uint8_t* code = flow->code->code;
+  uint8_t opcode = code[bci];
+  const struct opcode_info* info = &opcode_table[opcode];
+  uint8_t inner;
+
+  if (info->pops != OPCODE_SPECIAL) {
+    if (pop(flow, info->pops) != 0) {
+      return EINVAL;
+    }
+    return push_kind(flow, info->push);
+  }
+
+  switch (opcode) {
+    case OP_LDC:
+      return push_constant(flow, code[bci + 1]);
+    case OP_LDC_W:
+      return push_constant(flow, read_u2(code + bci + 1));
+    case OP_ISTORE:
+    case OP_FSTORE:
+    case OP_ASTORE:
+      return store(flow, code[bci + 1], 1);
+    case OP_LSTORE:
+    case OP_DSTORE:
+      return store(flow, code[bci + 1], 2);
+    case OP_DUP:
+      return dup(flow, 1, 1);
+    case OP_DUP_X1:
+      return dup(flow, 1, 2);
+    case OP_DUP_X2:
+      return dup(flow, 1, 3);
+    case OP_DUP2:
+      return dup(flow, 2, 2);
+    case OP_DUP2_X1:
+      return dup(flow, 2, 3);
+    case OP_DUP2_X2:
+      return dup(flow, 2, 4);
+    case OP_SWAP:
+      if (dup(flow, 1, 2) != 0) {
+        return EINVAL;
+      }
+      return pop(flow, 1);
+    case OP_GETSTATIC:
+    case OP_PUTSTATIC:
+    case OP_GETFIELD:
+    case OP_PUTFIELD:
+      return field_access(flow, opcode, read_u2(code + bci + 1));
+    case OP_INVOKEVIRTUAL:
+    case OP_INVOKESPECIAL:
+    case OP_INVOKESTATIC:
+    case OP_INVOKEINTERFACE:
+    case OP_INVOKEDYNAMIC:
+      return invoke(flow, opcode, read_u2(code + bci + 1));
+    case OP_MULTIANEWARRAY:
+      if (code[bci + 3] == 0 || pop(flow, code[bci + 3]) != 0) {
+        return EINVAL;
+      }
+      return push(flow, 1, 1);
+    case OP_WIDE:
+      inner = code[bci + 1];
+      if (inner == OP_IINC) {
+        return 0;
+      }
+      if (inner >= OP_ILOAD && inner <= OP_ALOAD) {
+        return push_kind(flow, opcode_table[inner].push);
+      }
+      if (inner >= OP_ISTORE && inner <= OP_ASTORE) {
+        return store(flow, read_u2(code + bci + 2),
+                     inner == OP_LSTORE || inner == OP_DSTORE ? 2 : 1);
+      }
+      break;
+    default:
+      if (opcode >= OP_ISTORE_0 && opcode <= OP_ASTORE_3) {
+        uint8_t group = (uint8_t)((opcode - OP_ISTORE_0) / 4);
+        uint16_t index = (uint16_t)((opcode - OP_ISTORE_0) % 4);
+        /* istore, lstore, fstore, dstore, astore */
+        return store(flow, index, group == 1 || group == 3 ? 2 : 1);
+      }
+  }
+
+  printf("ERROR: unsupported instruction %s at bci %u\n",
+         info->name != NULL ? info->name : "?", bci);
+  return EINVAL;
+}
+
+/* Recomputes the local flags from the verification types of the frame */
+static int apply_frame_locals(struct oop_flow* flow) {
+  uint16_t slot = 0;
+  uint16_t i;
+
+  memset(flow->locals, 0, flow->code->max_locals);
+  for (i = 0; i < flow->frame_local_count; i++) {
+    uint8_t tag = flow->frame_locals[i];
+    int slots = is_wide_type(tag) ? 2 : 1;
+
+    if (slot + slots > flow->code->max_locals) {
+      printf("ERROR: stack map frame has more locals than max_locals\n");
+      return EINVAL;
+    }
+    flow->locals[slot] = (uint8_t)is_reference_type(tag);
+    slot += (uint16_t)slots;
+  }
+  return 0;
+}
+
+static int apply_frame_stack(struct oop_flow* flow,
+                             const union verification_type_info* stack,
+                             uint16_t count) {
+  uint16_t i;
+
+  flow->depth = 0;
+  for (i = 0; i < count; i++) {
+    uint8_t tag = stack[i].Top_variable_info.tag;
+    if (push(flow, is_wide_type(tag) ? 2 : 1,
+             (uint8_t)is_reference_type(tag)) != 0) {
+      return EINVAL;
+    }
+  }
+  return 0;
+}
+
+static int append_frame_locals(struct oop_flow* flow,
+                               const union verification_type_info* locals,
+                               uint16_t count) {
+  uint16_t i;
+
+  if (flow->frame_local_count + count > flow->code->max_locals) {
+    printf("ERROR: stack map frame has more locals than max_locals\n");
+    return EINVAL;
+  }
+  for (i = 0; i < count; i++) {
+    flow->frame_locals[flow->frame_local_count++] =
+        locals[i].Top_variable_info.tag;
+  }
+  return 0;
+}
+
+static int apply_frame(struct oop_flow* flow,
+                       const union stack_map_frame* frame) {
+  uint8_t type = frame->same_frame.frame_type;
+  uint16_t chop;
+
+  if (type <= SAME_FRAME_MAX || type == SAME_FRAME_EXTENDED) {
+    flow->depth = 0;
+  } else if (type <= SAME_LOCALS_1_STACK_ITEM_MAX) {
+    return apply_frame_stack(flow, frame->same_locals_1_stack_item_frame.stack,
+                             1);
+  } else if (type == SAME_LOCALS_1_STACK_ITEM_EXTENDED) {
+    return apply_frame_stack(
+        flow, frame->same_locals_1_stack_item_frame_extended.stack, 1);
+  } else if (type <= CHOP_FRAME_MAX) {
+    chop = (uint16_t)(SAME_FRAME_EXTENDED - type);
+    if (chop > flow->frame_local_count) {
+      printf("ERROR: chop frame removes missing locals\n");
+      return EINVAL;
+    }
+    flow->frame_local_count -= chop;
+    flow->depth = 0;
+  } else if (type <= APPEND_FRAME_MAX) {
+    if (append_frame_locals(flow, frame->append_frame.locals,
+                            (uint16_t)(type - SAME_FRAME_EXTENDED)) != 0) {
+      return EINVAL;
+    }
+    flow->depth = 0;
+  } else {
+    flow->frame_local_count = 0;
+    if (append_frame_locals(flow, frame->full_frame.locals,
+                            frame->full_frame.number_of_locals) != 0 ||
+        apply_frame_stack(flow, frame->full_frame.stack,
+                          frame->full_frame.number_of_stack_items) != 0) {
+      return EINVAL;
+    }
+  }
+  return apply_frame_locals(flow);
+}
+
+/* The implicit frame at method entry comes from the descriptor */
+static int entry_frame(struct oop_flow* flow, struct method_info* method) {
+  struct UTF8_info* descriptor =
+      validate_constant(flow->class, method->descriptor_index);
+  struct method_descriptor desc;
+  uint8_t types[DESCRIPTOR_MAX_ARGS + 1];
+  uint16_t count = 0;
+  uint16_t i;
+
+  if (descriptor == NULL || parse_method_descriptor(descriptor, &desc) != 0) {
+    return EINVAL;
+  }
+  if (!(method->access_flags & ACC_STATIC)) {
+    types[count++] = ITEM_Object;
+  }
+  for (i = 0; i < desc.arg_count; i++) {
+    types[count++] = descriptor_type(desc.args[i]);
+  }
+  if (count > flow->code->max_locals) {
+    printf("ERROR: arguments don't fit into max_locals\n");
+    return EINVAL;
+  }
+
+  memcpy(flow->frame_locals, types, count);
+  flow->frame_local_count = count;
+  flow->depth = 0;
+  return apply_frame_locals(flow);
+}
+
+static int record(struct oop_flow* flow, uint16_t bci) {
+  struct oop_map* map = flow->map;
+  struct oop_map_entry* entry;
+  uint32_t* bits;
+  uint16_t i;
+
+  if (map->count > 0 && map->entries[map->count - 1].bci == bci) {
+    return 0;
+  }
+
+  if (map->count == flow->capacity) {
+    uint32_t capacity = flow->capacity == 0 ? 8 : flow->capacity * 2;
+    struct oop_map_entry* entries =
+        realloc(map->entries, capacity * sizeof(struct oop_map_entry));
+    if (entries == NULL) {
+      return ENOMEM;
+    }
+    map->entries = entries;
+    bits = realloc(map->bits, (size_t)capacity * map->words * sizeof(uint32_t));
+    if (bits == NULL) {
+      return ENOMEM;
+    }
+    map->bits = bits;
+    flow->capacity = capacity;
+  }
+
+  entry = &map->entries[map->count];
+  entry->bci = bci;
+  entry->stack_depth = flow->depth;
+  bits = map->bits + (size_t)map->count * map->words;
+  memset(bits, 0, map->words * sizeof(uint32_t));
+  for (i = 0; i < map->max_locals; i++) {
+    bits[i >> 5] |= (uint32_t)flow->locals[i] << (i & 31);
+  }
+  for (i = 0; i < flow->depth; i++) {
+    uint32_t slot = (uint32_t)map->max_locals + i;
+    bits[slot >> 5] |= (uint32_t)flow->stack[i] << (slot & 31);
+  }
+  map->count++;
+  return 0;
+}
+
+static int is_safepoint(const uint8_t* code, uint32_t bci) {
+  const struct opcode_info* info = &opcode_table[code[bci]];
+
+  if (info->flags & (OPF_CALL | OPF_ALLOC)) {
+    return 1;
+  }
+  if (info->flags & OPF_BRANCH) {
+    return opcode_branch_offset(code, bci) <= 0;
+  }
+  /* returns poll with the result still on the operand stack */
+  return code[bci] == OP_TABLESWITCH || code[bci] == OP_LOOKUPSWITCH ||
+         (code[bci] >= OP_IRETURN && code[bci] <= OP_RETURN);
+}
+
+static int build(struct oop_flow* flow, struct method_info* method,
+                 struct StackMapTable_attribute* table) {
+  struct Code_attribute* code = flow->code;
+  uint32_t next_frame = 0;
+  uint32_t frame_bci = 0;
+  uint32_t bci;
+  uint32_t length;
+  int live = 1;
+  int err;
+
+  err = entry_frame(flow, method);
+  if (err != 0) {
+    return err;
+  }
+  if (table->number_of_entries > 0) {
+    frame_bci = stack_map_frame_offset_delta(&table->entries[0]);
+  }
+
+  for (bci = 0; bci < code->code_length; bci += length) {
+    length = opcode_length(code->code, code->code_length, bci);
+    if (length == 0) {
+      printf("ERROR: bad instruction at bci %u\n", bci);
+      return EINVAL;
+    }
+
+    if (next_frame < table->number_of_entries && frame_bci == bci) {
+      err = apply_frame(flow, &table->entries[next_frame]);
+      if (err != 0) {
+        return err;
+      }
+      live = 1;
+      if (++next_frame < table->number_of_entries) {
+        frame_bci +=
+            stack_map_frame_offset_delta(&table->entries[next_frame]) + 1u;
+      }
+      err = record(flow, (uint16_t)bci);
+    } else if (!live) {
+      printf("ERROR: no stack map frame at bci %u\n", bci);
+      return EINVAL;
+    } else if (bci == 0 || is_safepoint(code->code, bci)) {
+      err = record(flow, (uint16_t)bci);
+    }
+    if (err != 0) {
+      return err;
+    }
+
+    if (code->code[bci] == OP_JSR || code->code[bci] == OP_JSR_W ||
+        code->code[bci] == OP_RET ||
+        (code->code[bci] == OP_WIDE && code->code[bci + 1] == OP_RET)) {
+      printf("ERROR: jsr/ret are not supported\n");
+      return EINVAL;
+    }
+
+    err = flow_step(flow, bci);
+    if (err != 0) {
+      printf("ERROR: at bci %u\n", bci);
+      return err;
+    }
+    if (opcode_table[code->code[bci]].flags & OPF_NO_FALLTHROUGH) {
+      live = 0;
+    }
+  }
+
+  if (next_frame < table->number_of_entries) {
+    printf("ERROR: stack map frame at bci %u is not an instruction\n",
+           frame_bci);
+    return EINVAL;
+  }
+  return 0;
+}
+
+int oop_map_build(struct class_file* class, struct method_info* method) {
+  struct Code_attribute* code = method->code;
+  struct StackMapTable_attribute table = {0};
+  struct attribute_info* attr;
+  struct oop_flow flow = {0};
+  struct oop_map* map;
+  int err;
+
+  if (code == NULL || method->oop_map != NULL) {
+    return 0;
+  }
+
+  attr = find_attribute(class, code->attributes, code->attributes_count,
+                        "StackMapTable");
+  if (attr != NULL) {
+    err = parse_stack_map_table(attr, &table);
+    if (err != 0) {
+      return err;
+    }
+  }
+
+  map = calloc(1, sizeof(struct oop_map));
+  flow.locals = malloc((size_t)code->max_locals * 2 + code->max_stack + 1);
+  if (map == NULL || flow.locals == NULL) {
+    free(map);
+    free(flow.locals);
+    free_stack_map_table(&table);
+    return ENOMEM;
+  }
+  map->max_locals = code->max_locals;
+  map->max_stack = code->max_stack;
+  map->words = (uint16_t)((code->max_locals + code->max_stack + 31) / 32);
+  if (map->words == 0) {
+    map->words = 1;
+  }
+
+  flow.class = class;
+  flow.code = code;
+  flow.map = map;
+  flow.stack = flow.locals + code->max_locals;
+  flow.frame_locals = flow.stack + code->max_stack;
+
+  err = build(&flow, method, &table);
+  free(flow.locals);
+  free_stack_map_table(&table);
+
+  if (err != 0) {
+    oop_map_free(map);
+    return err;
+  }
+  method->oop_map = map;
+  return 0;
+}
+
+int class_build_oop_maps(struct class_file* class) {
+  uint16_t i;
+  int err;
+
+  for (i = 0; i < class->methods_count; i++) {
+    err = oop_map_build(class, &class->methods[i]);
+    if (err != 0) {
+      struct UTF8_info* name =
+          validate_constant(class, class->methods[i].name_index);
+      printf("ERROR: can't build oop map of %.*s\n", name ? name->lenght : 0,
+             name ? (const char*)name->bytes : "");
+      return err;
+    }
+  }
+  return 0;
+}
+
+void oop_map_free(struct oop_map* map) {
+  if (map == NULL) {
+    return;
+  }
+  free(map->entries);
+  free(map->bits);
+  free(map);
+}
+
+/* Index of the entry for bci, -1 if bci is not a safepoint */
+int32_t oop_map_find(const struct oop_map* map, uint16_t bci) {
+  uint32_t low = 0;
+  uint32_t high = map->count;
+
+  while (low < high) {
+    uint32_t mid = (low + high) / 2;
+    if (map->entries[mid].bci < bci) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  if (low < map->count && map->entries[low].bci == bci) {
+    return (int32_t)low;
+  }
+  return -1;
+}
+
+int oop_map_visit_frame(const struct oop_map* map, struct java_frame* frame,
+                        gc_slot_visitor visit, void* ctx) {
+  int32_t index = oop_map_find(map, frame->bci);
+  const uint32_t* bits;
+  uint32_t slots;
+  uint16_t w;
+
+  if (index < 0) {
+    return ENOENT;
+  }
+  bits = map->bits + (size_t)index * map->words;
+  slots = (uint32_t)map->max_locals + map->entries[index].stack_depth;
+
+  for (w = 0; w < map->words; w++) {
+    uint32_t word = bits[w];
+    while (word != 0) {
+      uint32_t slot = (uint32_t)w * 32 + (uint32_t)__builtin_ctz(word);
+      word &= word - 1;
+      if (slot >= slots) {
+        break;
+      }
+      if (slot < map->max_locals) {
+        visit(&frame->locals[slot].ref, ctx);
+      } else {
+        visit(&frame->stack[slot - map->max_locals].ref, ctx);
+      }
+    }
+  }
+  return 0;
+}
+
+/*
+ * gc_root_scanner over the frames of a stopped thread,
+ * ctx points to the innermost frame pointer
+ */
+void oop_map_scan_frames(gc_slot_visitor visit, void* visit_ctx, void* ctx) {
+  struct java_frame* frame = *(struct java_frame**)ctx;
+
+  for (; frame != NULL; frame = frame->caller) {
+    struct oop_map* map = frame->method->oop_map;
+
+    if (frame->lock != NULL) {
+      visit(&frame->lock, visit_ctx);
+    }
+    if (map == NULL) {
+      continue;
+    }
+    if (oop_map_visit_frame(map, frame, visit, visit_ctx) != 0) {
+      printf("ERROR: frame stopped at bci %hu, which is not a safepoint\n",
+             frame->bci);
+    }
+  }
+}
+
+/* gregs index of each enum x86_reg */
+static const int context_regs[] = {
+    REG_RAX, REG_RCX, REG_RDX, REG_RBX, REG_RSP, REG_RBP,
+    REG_RSI, REG_RDI, REG_R8,  REG_R9,  REG_R10, REG_R11,
+    REG_R12, REG_R13, REG_R14, REG_R15,
+};
+
+struct thread_scan {
+  gc_slot_visitor visit;
+  void* visit_ctx;
+};
+
+/*
+ * References optimized code keeps at the poll the thread is parked
+ * at, in the registers of the signal context, which the thread gets
+ * back, and in its frame
+ */
+static void scan_compiled(struct interp_thread* thread, ucontext_t* context,
+                          const struct thread_scan* scan) {
+  greg_t* regs = context->uc_mcontext.gregs;
+  const uint8_t* pc = (const uint8_t*)regs[REG_RIP];
+  const struct deopt_table* table;
+  const struct deopt_poll* poll;
+  const uint8_t* code;
+  uint16_t i;
+
+  if (thread->interp->code_map == NULL) {
+    return;
+  }
+  table = thread->interp->code_map(pc, &code, thread->interp->code_ctx);
+  if (table == NULL) {
+    return;
+  }
+  poll = deopt_find_poll(table, (uint32_t)(pc - code));
+  if (poll == NULL) {
+    printf("ERROR: compiled code stopped outside a safepoint poll\n");
+    return;
+  }
+  for (i = 0; i < poll->value_count; i++) {
+    const struct deopt_value* value = &table->values[poll->values + i];
+    struct object_header** slot =
+        value->kind == DEOPT_REG
+            ? (struct object_header**)&regs[context_regs[value->reg]]
+            : (struct object_header**)((uint8_t*)regs[REG_RBP] +
+                                       value->value);
+    scan->visit(slot, scan->visit_ctx);
+  }
+}
+
+static void scan_thread(struct safepoint_thread* safepoint, void* ctx) {
+  const struct thread_scan* scan = ctx;
+  struct interp_thread* thread = safepoint->owner;
+
+  oop_map_scan_frames(scan->visit, scan->visit_ctx, &thread->top);
+  if (thread->exception != NULL) {
+    scan->visit(&thread->exception, scan->visit_ctx);
+  }
+  if (safepoint->context != NULL) {
+    scan_compiled(thread, safepoint->context, scan);
+  }
+}
+
+void oop_map_scan_threads(gc_slot_visitor visit, void* visit_ctx, void* ctx) {
+  struct thread_scan scan = {visit, visit_ctx};
+
+  (void)ctx;
+  safepoint_for_each_thread(scan_thread, &scan);
+}
@@ -0,0 +1,265 @@
+#include "opcodes.h"
+
+#include <stddef.h>
+
+const struct opcode_info opcode_table[256] = {
+    [OP_NOP] = {"nop", 1, 0, OPK_NONE, 0},
+    [OP_ACONST_NULL] = {"aconst_null", 1, 0, OPK_REF, 0},
+    [OP_ICONST_M1] = {"iconst_m1", 1, 0, OPK_INT, 0},
+    [OP_ICONST_0] = {"iconst_0", 1, 0, OPK_INT, 0},
+    [OP_ICONST_1] = {"iconst_1", 1, 0, OPK_INT, 0},
+    [OP_ICONST_2] = {"iconst_2", 1, 0, OPK_INT, 0},
+    [OP_ICONST_3] = {"iconst_3", 1, 0, OPK_INT, 0},
+    [OP_ICONST_4] = {"iconst_4", 1, 0, OPK_INT, 0},
+    [OP_ICONST_5] = {"iconst_5", 1, 0, OPK_INT, 0},
+    [OP_LCONST_0] = {"lconst_0", 1, 0, OPK_WIDE, 0},
+    [OP_LCONST_1] = {"lconst_1", 1, 0, OPK_WIDE, 0},
+    [OP_FCONST_0] = {"fconst_0", 1, 0, OPK_INT, 0},
+    [OP_FCONST_1] = {"fconst_1", 1, 0, OPK_INT, 0},
+    [OP_FCONST_2] = {"fconst_2", 1, 0, OPK_INT, 0},
+    [OP_DCONST_0] = {"dconst_0", 1, 0, OPK_WIDE, 0},
+    [OP_DCONST_1] = {"dconst_1", 1, 0, OPK_WIDE, 0},
+    [OP_BIPUSH] = {"bipush", 2, 0, OPK_INT, 0},
+    [OP_SIPUSH] = {"sipush", 3, 0, OPK_INT, 0},
+    [OP_LDC] = {"ldc", 2, OPCODE_SPECIAL, OPK_NONE, OPF_CALL},
+    [OP_LDC_W] = {"ldc_w", 3, OPCODE_SPECIAL, OPK_NONE, OPF_CALL},
+    [OP_LDC2_W] = {"ldc2_w", 3, 0, OPK_WIDE, 0},
+    [OP_ILOAD] = {"iload", 2, 0, OPK_INT, 0},
+    [OP_LLOAD] = {"lload", 2, 0, OPK_WIDE, 0},
+    [OP_FLOAD] = {"fload", 2, 0, OPK_INT, 0},
+    [OP_DLOAD] = {"dload", 2, 0, OPK_WIDE, 0},
+    [OP_ALOAD] = {"aload", 2, 0, OPK_REF, 0},
+    [OP_ILOAD_0] = {"iload_0", 1, 0, OPK_INT, 0},
+    [OP_ILOAD_1] = {"iload_1", 1, 0, OPK_INT, 0},
+    [OP_ILOAD_2] = {"iload_2", 1, 0, OPK_INT, 0},
+    [OP_ILOAD_3] = {"iload_3", 1, 0, OPK_INT, 0},
+    [OP_LLOAD_0] = {"lload_0", 1, 0, OPK_WIDE, 0},
+    [OP_LLOAD_1] = {"lload_1", 1, 0, OPK_WIDE, 0},
+    [OP_LLOAD_2] = {"lload_2", 1, 0, OPK_WIDE, 0},
+    [OP_LLOAD_3] = {"lload_3", 1, 0, OPK_WIDE, 0},
+    [OP_FLOAD_0] = {"fload_0", 1, 0, OPK_INT, 0},
+    [OP_FLOAD_1] = {"fload_1", 1, 0, OPK_INT, 0},
+    [OP_FLOAD_2] = {"fload_2", 1, 0, OPK_INT, 0},
+    [OP_FLOAD_3] = {"fload_3", 1, 0, OPK_INT, 0},
+    [OP_DLOAD_0] = {"dload_0", 1, 0, OPK_WIDE, 0},
+    [OP_DLOAD_1] = {"dload_1", 1, 0, OPK_WIDE, 0},
+    [OP_DLOAD_2] = {"dload_2", 1, 0, OPK_WIDE, 0},
+    [OP_DLOAD_3] = {"dload_3", 1, 0, OPK_WIDE, 0},
+    [OP_ALOAD_0] = {"aload_0", 1, 0, OPK_REF, 0},
+    [OP_ALOAD_1] = {"aload_1", 1, 0, OPK_REF, 0},
+    [OP_ALOAD_2] = {"aload_2", 1, 0, OPK_REF, 0},
+    [OP_ALOAD_3] = {"aload_3", 1, 0, OPK_REF, 0},
+    [OP_IALOAD] = {"iaload", 1, 2, OPK_INT, 0},
+    [OP_LALOAD] = {"laload", 1, 2, OPK_WIDE, 0},
+    [OP_FALOAD] = {"faload", 1, 2, OPK_INT, 0},
+    [OP_DALOAD] = {"daload", 1, 2, OPK_WIDE, 0},
+    [OP_AALOAD] = {"aaload", 1, 2, OPK_REF, 0},
+    [OP_BALOAD] = {"baload", 1, 2, OPK_INT, 0},
+    [OP_CALOAD] = {"caload", 1, 2, OPK_INT, 0},
+    [OP_SALOAD] = {"saload", 1, 2, OPK_INT, 0},
+    [OP_ISTORE] = {"istore", 2, OPCODE_SPECIAL, OPK_NONE, 0},
+    [OP_LSTORE] = {"lstore", 2, OPCODE_SPECIAL, OPK_NONE, 0},
+    [OP_FSTORE] = {"fstore", 2, OPCODE_SPECIAL, OPK_NONE, 0},
+    [OP_DSTORE] = {"dstore", 2, OPCODE_SPECIAL, OPK_NONE, 0},
+    [OP_ASTORE] = {"astore", 2, OPCODE_SPECIAL, OPK_NONE, 0},
+    [OP_ISTORE_0] = {"istore_0", 1, OPCODE_SPECIAL, OPK_NONE, 0},
+    [OP_ISTORE_1] = {"istore_1", 1, OPCODE_SPECIAL, OPK_NONE, 0},
+    [OP_ISTORE_2] = {"istore_2", 1, OPCODE_SPECIAL, OPK_NONE, 0},
+    [OP_ISTORE_3] = {"istore_3", 1, OPCODE_SPECIAL, OPK_NONE, 0},
+    [OP_LSTORE_0] = {"lstore_0", 1, OPCODE_SPECIAL, OPK_NONE, 0},
+    [OP_LSTORE_1] = {"lstore_1", 1, OPCODE_SPECIAL, OPK_NONE, 0},
+    [OP_LSTORE_2] = {"lstore_2", 1, OPCODE_SPECIAL, OPK_NONE, 0},
+    [OP_LSTORE_3] = {"lstore_3", 1, OPCODE_SPECIAL, OPK_NONE, 0},
+    [OP_FSTORE_0] = {"fstore_0", 1, OPCODE_SPECIAL, OPK_NONE, 0},
+    [OP_FSTORE_1] = {"fstore_1", 1, OPCODE_SPECIAL, OPK_NONE, 0},
+    [OP_FSTORE_2] = {"fstore_2", 1, OPCODE_SPECIAL, OPK_NONE, 0},
+    [OP_FSTORE_3] = {"fstore_3", 1, OPCODE_SPECIAL, OPK_NONE, 0},
+    [OP_DSTORE_0] = {"dstore_0", 1, OPCODE_SPECIAL, OPK_NONE, 0},
+    [OP_DSTORE_1] = {"dstore_1", 1, OPCODE_SPECIAL, OPK_NONE, 0},
+    [OP_DSTORE_2] = {"dstore_2", 1, OPCODE_SPECIAL, OPK_NONE, 0},
+    [OP_DSTORE_3] = {"dstore_3", 1, OPCODE_SPECIAL, OPK_NONE, 0},
+    [OP_ASTORE_0] = {"astore_0", 1, OPCODE_SPECIAL, OPK_NONE, 0},
+    [OP_ASTORE_1] = {"astore_1", 1, OPCODE_SPECIAL, OPK_NONE, 0},
+    [OP_ASTORE_2] = {"astore_2", 1, OPCODE_SPECIAL, OPK_NONE, 0},
+    [OP_ASTORE_3] = {"astore_3", 1, OPCODE_SPECIAL, OPK_NONE, 0},
+    [OP_IASTORE] = {"iastore", 1, 3, OPK_NONE, 0},
+    [OP_LASTORE] = {"lastore", 1, 4, OPK_NONE, 0},
+    [OP_FASTORE] = {"fastore", 1, 3, OPK_NONE, 0},
+    [OP_DASTORE] = {"dastore", 1, 4, OPK_NONE, 0},
+    [OP_AASTORE] = {"aastore", 1, 3, OPK_NONE, 0},
+    [OP_BASTORE] = {"bastore", 1, 3, OPK_NONE, 0},
+    [OP_CASTORE] = {"castore", 1, 3, OPK_NONE, 0},
+    [OP_SASTORE] = {"sastore", 1, 3, OPK_NONE, 0},
+    [OP_POP] = {"pop", 1, 1, OPK_NONE, 0},
+    [OP_POP2] = {"pop2", 1, 2, OPK_NONE, 0},
+    [OP_DUP] = {"dup", 1, OPCODE_SPECIAL, OPK_NONE, 0},
+    [OP_DUP_X1] = {"dup_x1", 1, OPCODE_SPECIAL, OPK_NONE, 0},
+    [OP_DUP_X2] = {"dup_x2", 1, OPCODE_SPECIAL, OPK_NONE, 0},
+    [OP_DUP2] = {"dup2", 1, OPCODE_SPECIAL, OPK_NONE, 0},
+    [OP_DUP2_X1] = {"dup2_x1", 1, OPCODE_SPECIAL, OPK_NONE, 0},
+    [OP_DUP2_X2] = {"dup2_x2", 1, OPCODE_SPECIAL, OPK_NONE, 0},
+    [OP_SWAP] = {"swap", 1, OPCODE_SPECIAL, OPK_NONE, 0},
+    [OP_IADD] = {"iadd", 1, 2, OPK_INT, 0},
+    [OP_LADD] = {"ladd", 1, 4, OPK_WIDE, 0},
+    [OP_FADD] = {"fadd", 1, 2, OPK_INT, 0},
+    [OP_DADD] = {"dadd", 1, 4, OPK_WIDE, 0},
+    [OP_ISUB] = {"isub", 1, 2, OPK_INT, 0},
+    [OP_LSUB] = {"lsub", 1, 4, OPK_WIDE, 0},
+    [OP_FSUB] = {"fsub", 1, 2, OPK_INT, 0},
+    [OP_DSUB] = {"dsub", 1, 4, OPK_WIDE, 0},
+    [OP_IMUL] = {"imul", 1, 2, OPK_INT, 0},
+    [OP_LMUL] = {"lmul", 1, 4, OPK_WIDE, 0},
+    [OP_FMUL] = {"fmul", 1, 2, OPK_INT, 0},
+    [OP_DMUL] = {"dmul", 1, 4, OPK_WIDE, 0},
+    [OP_IDIV] = {"idiv", 1, 2, OPK_INT, 0},
+    [OP_LDIV] = {"ldiv", 1, 4, OPK_WIDE, 0},
+    [OP_FDIV] = {"fdiv", 1, 2, OPK_INT, 0},
+    [OP_DDIV] = {"ddiv", 1, 4, OPK_WIDE, 0},
+    [OP_IREM] = {"irem", 1, 2, OPK_INT, 0},
+    [OP_LREM] = {"lrem", 1, 4, OPK_WIDE, 0},
+    [OP_FREM] = {"frem", 1, 2, OPK_INT, 0},
+    [OP_DREM] = {"drem", 1, 4, OPK_WIDE, 0},
+    [OP_INEG] = {"ineg", 1, 1, OPK_INT, 0},
+    [OP_LNEG] = {"lneg", 1, 2, OPK_WIDE, 0},
+    [OP_FNEG] = {"fneg", 1, 1, OPK_INT, 0},
+    [OP_DNEG] = {"dneg", 1, 2, OPK_WIDE, 0},
+    [OP_ISHL] = {"ishl", 1, 2, OPK_INT, 0},
+    [OP_LSHL] = {"lshl", 1, 3, OPK_WIDE, 0},
+    [OP_ISHR] = {"ishr", 1, 2, OPK_INT, 0},
+    [OP_LSHR] = {"lshr", 1, 3, OPK_WIDE, 0},
+    [OP_IUSHR] = {"iushr", 1, 2, OPK_INT, 0},
+    [OP_LUSHR] = {"lushr", 1, 3, OPK_WIDE, 0},
+    [OP_IAND] = {"iand", 1, 2, OPK_INT, 0},
+    [OP_LAND] = {"land", 1, 4, OPK_WIDE, 0},
+    [OP_IOR] = {"ior", 1, 2, OPK_INT, 0},
+    [OP_LOR] = {"lor", 1, 4, OPK_WIDE, 0},
+    [OP_IXOR] = {"ixor", 1, 2, OPK_INT, 0},
+    [OP_LXOR] = {"lxor", 1, 4, OPK_WIDE, 0},
+    [OP_IINC] = {"iinc", 3, 0, OPK_NONE, 0},
+    [OP_I2L] = {"i2l", 1, 1, OPK_WIDE, 0},
+    [OP_I2F] = {"i2f", 1, 1, OPK_INT, 0},
+    [OP_I2D] = {"i2d", 1, 1, OPK_WIDE, 0},
+    [OP_L2I] = {"l2i", 1, 2, OPK_INT, 0},
+    [OP_L2F] = {"l2f", 1, 2, OPK_INT, 0},
+    [OP_L2D] = {"l2d", 1, 2, OPK_WIDE, 0},
+    [OP_F2I] = {"f2i", 1, 1, OPK_INT, 0},
+    [OP_F2L] = {"f2l", 1, 1, OPK_WIDE, 0},
+    [OP_F2D] = {"f2d", 1, 1, OPK_WIDE, 0},
+    [OP_D2I] = {"d2i", 1, 2, OPK_INT, 0},
+    [OP_D2L] = {"d2l", 1, 2, OPK_WIDE, 0},
+    [OP_D2F] = {"d2f", 1, 2, OPK_INT, 0},
+    [OP_I2B] = {"i2b", 1, 1, OPK_INT, 0},
+    [OP_I2C] = {"i2c", 1, 1, OPK_INT, 0},
+    [OP_I2S] = {"i2s", 1, 1, OPK_INT, 0},
+    [OP_LCMP] = {"lcmp", 1, 4, OPK_INT, 0},
+    [OP_FCMPL] = {"fcmpl", 1, 2, OPK_INT, 0},
+    [OP_FCMPG] = {"fcmpg", 1, 2, OPK_INT, 0},
+    [OP_DCMPL] = {"dcmpl", 1, 4, OPK_INT, 0},
+    [OP_DCMPG] = {"dcmpg", 1, 4, OPK_INT, 0},
+    [OP_IFEQ] = {"ifeq", 3, 1, OPK_NONE, OPF_BRANCH},
+    [OP_IFNE] = {"ifne", 3, 1, OPK_NONE, OPF_BRANCH},
+    [OP_IFLT] = {"iflt", 3, 1, OPK_NONE, OPF_BRANCH},
+    [OP_IFGE] = {"ifge", 3, 1, OPK_NONE, OPF_BRANCH},
+    [OP_IFGT] = {"ifgt", 3, 1, OPK_NONE, OPF_BRANCH},
+    [OP_IFLE] = {"ifle", 3, 1, OPK_NONE, OPF_BRANCH},
+    [OP_IF_ICMPEQ] = {"if_icmpeq", 3, 2, OPK_NONE, OPF_BRANCH},
+    [OP_IF_ICMPNE] = {"if_icmpne", 3, 2, OPK_NONE, OPF_BRANCH},
+    [OP_IF_ICMPLT] = {"if_icmplt", 3, 2, OPK_NONE, OPF_BRANCH},
+    [OP_IF_ICMPGE] = {"if_icmpge", 3, 2, OPK_NONE, OPF_BRANCH},
+    [OP_IF_ICMPGT] = {"if_icmpgt", 3, 2, OPK_NONE, OPF_BRANCH},
+    [OP_IF_ICMPLE] = {"if_icmple", 3, 2, OPK_NONE, OPF_BRANCH},
+    [OP_IF_ACMPEQ] = {"if_acmpeq", 3, 2, OPK_NONE, OPF_BRANCH},
+    [OP_IF_ACMPNE] = {"if_acmpne", 3, 2, OPK_NONE, OPF_BRANCH},
+    [OP_GOTO] = {"goto", 3, 0, OPK_NONE, OPF_BRANCH|OPF_NO_FALLTHROUGH},
+    [OP_JSR] = {"jsr", 3, 0, OPK_INT, OPF_BRANCH},
+    [OP_RET] = {"ret", 2, 0, OPK_NONE, OPF_NO_FALLTHROUGH},
+    [OP_TABLESWITCH] = {"tableswitch", 0, 1, OPK_NONE, OPF_NO_FALLTHROUGH},
+    [OP_LOOKUPSWITCH] = {"lookupswitch", 0, 1, OPK_NONE, OPF_NO_FALLTHROUGH},
+    [OP_IRETURN] = {"ireturn", 1, 1, OPK_NONE, OPF_NO_FALLTHROUGH},
+    [OP_LRETURN] = {"lreturn", 1, 2, OPK_NONE, OPF_NO_FALLTHROUGH},
+    [OP_FRETURN] = {"freturn", 1, 1, OPK_NONE, OPF_NO_FALLTHROUGH},
+    [OP_DRETURN] = {"dreturn", 1, 2, OPK_NONE, OPF_NO_FALLTHROUGH},
+    [OP_ARETURN] = {"areturn", 1, 1, OPK_NONE, OPF_NO_FALLTHROUGH},
+    [OP_RETURN] = {"return", 1, 0, OPK_NONE, OPF_NO_FALLTHROUGH},
+    [OP_GETSTATIC] = {"getstatic", 3, OPCODE_SPECIAL, OPK_NONE, OPF_CALL},
+    [OP_PUTSTATIC] = {"putstatic", 3, OPCODE_SPECIAL, OPK_NONE, OPF_CALL},
+    [OP_GETFIELD] = {"getfield", 3, OPCODE_SPECIAL, OPK_NONE, OPF_CALL},
+    [OP_PUTFIELD] = {"putfield", 3, OPCODE_SPECIAL, OPK_NONE, OPF_CALL},
+    [OP_INVOKEVIRTUAL] = {"invokevirtual", 3, OPCODE_SPECIAL, OPK_NONE, OPF_CALL},
+    [OP_INVOKESPECIAL] = {"invokespecial", 3, OPCODE_SPECIAL, OPK_NONE, OPF_CALL},
+    [OP_INVOKESTATIC] = {"invokestatic", 3, OPCODE_SPECIAL, OPK_NONE, OPF_CALL},
+    [OP_INVOKEINTERFACE] = {"invokeinterface", 5, OPCODE_SPECIAL, OPK_NONE, OPF_CALL},
+    [OP_INVOKEDYNAMIC] = {"invokedynamic", 5, OPCODE_SPECIAL, OPK_NONE, OPF_CALL},
+    [OP_NEW] = {"new", 3, 0, OPK_REF, OPF_ALLOC},
+    [OP_NEWARRAY] = {"newarray", 2, 1, OPK_REF, OPF_ALLOC},
+    [OP_ANEWARRAY] = {"anewarray", 3, 1, OPK_REF, OPF_ALLOC},
+    [OP_ARRAYLENGTH] = {"arraylength", 1, 1, OPK_INT, 0},
+    [OP_ATHROW] = {"athrow", 1, 1, OPK_NONE, OPF_NO_FALLTHROUGH|OPF_CALL},
+    [OP_CHECKCAST] = {"checkcast", 3, 1, OPK_REF, OPF_CALL},
+    [OP_INSTANCEOF] = {"instanceof", 3, 1, OPK_INT, OPF_CALL},
+    [OP_MONITORENTER] = {"monitorenter", 1, 1, OPK_NONE, OPF_CALL},
+    [OP_MONITOREXIT] = {"monitorexit", 1, 1, OPK_NONE, 0},
+    [OP_WIDE] = {"wide", 0, OPCODE_SPECIAL, OPK_NONE, 0},
+    [OP_MULTIANEWARRAY] = {"multianewarray", 4, OPCODE_SPECIAL, OPK_NONE, OPF_ALLOC},
+    [OP_IFNULL] = {"ifnull", 3, 1, OPK_NONE, OPF_BRANCH},
+    [OP_IFNONNULL] = {"ifnonnull", 3, 1, OPK_NONE, OPF_BRANCH},
+    [OP_GOTO_W] = {"goto_w", 5, 0, OPK_NONE, OPF_BRANCH|OPF_NO_FALLTHROUGH},
+    [OP_JSR_W] = {"jsr_w", 5, 0, OPK_INT, OPF_BRANCH},
+};
+
+static int32_t read_s4(const uint8_t* p) {
+  return (int32_t)(((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+                   ((uint32_t)p[2] << 8) | (uint32_t)p[3]);
+}
+
+/* Length of the instruction at bci, 0 if it is malformed or truncated */
+uint32_t opcode_length(const uint8_t* code, uint32_t code_length,
+                       uint32_t bci) {
+  uint8_t opcode = code[bci];
+  uint32_t length = (uint32_t)opcode_table[opcode].length;
+  uint32_t operands;
+
+  if (opcode_table[opcode].name == NULL) {
+    return 0;
+  }
+
+  if (opcode == OP_TABLESWITCH || opcode == OP_LOOKUPSWITCH) {
+    /* operands are 4-byte aligned relative to the start of the code */
+    operands = (bci + 4) & ~(uint32_t)3;
+    if (operands + 12 > code_length) {
+      return 0;
+    }
+    if (opcode == OP_TABLESWITCH) {
+      int32_t low = read_s4(code + operands + 4);
+      int32_t high = read_s4(code + operands + 8);
+      if (high < low || (int64_t)high - low >= (int64_t)code_length) {
+        return 0;
+      }
+      length = operands - bci + 12 + 4 * (uint32_t)(high - low + 1);
+    } else {
+      int32_t pairs = read_s4(code + operands + 4);
+      if (pairs < 0 || (uint32_t)pairs > code_length / 8) {
+        return 0;
+      }
+      length = operands - bci + 8 + 8 * (uint32_t)pairs;
+    }
+  } else if (opcode == OP_WIDE) {
+    if (bci + 1 >= code_length) {
+      return 0;
+    }
+    length = code[bci + 1] == OP_IINC ? 6 : 4;
+  }
+
+  if (length > code_length - bci) {
+    return 0;
+  }
+  return length;
+}
+
+/* Offset of a OPF_BRANCH instruction relative to its bci */
+int32_t opcode_branch_offset(const uint8_t* code, uint32_t bci) {
+  if (code[bci] == OP_GOTO_W || code[bci] == OP_JSR_W) {
+    return read_s4(code + bci + 1);
+  }
+  return (int16_t)(((uint16_t)code[bci + 1] << 8) | code[bci + 2]);
+}
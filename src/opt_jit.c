@@ -0,0 +1,362 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "opt_jit.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "x86_64.h"
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/*
+ * Only polls record references, a collection during a call would
+ * miss those held in registers and spill slots
+ */
+static int gc_safe(const struct ir_function* func) {
+  int calls = 0;
+  int references = 0;
+  uint32_t i;
+
+  for (i = 0; i < func->order_count; i++) {
+    const struct ir_block* b = &func->blocks[func->order[i]];
+    uint32_t k;
+    for (k = 0; k < b->instr_count; k++) {
+      const struct ir_instr* instr = &func->instrs[b->instrs[k]];
+      calls |= instr->op == IR_CALL;
+      references |= instr->type == 'A' && instr->op != IR_CONST;
+    }
+  }
+  return !(calls && references);
+}
+
+static void add_stats(struct ir_stats* total, const struct ir_stats* stats) {
+  total->inlined += stats->inlined;
+  total->folded += stats->folded;
+  total->gvn += stats->gvn;
+  total->hoisted += stats->hoisted;
+  total->checks += stats->checks;
+  total->spills += stats->spills;
+  total->devirtualized += stats->devirtualized;
+  total->scalar_replaced += stats->scalar_replaced;
+  total->locks_elided += stats->locks_elided;
+}
+
+/*
+ * Sites of our code still bound to invalidated code of the method
+ * move on to its new code
+ */
+static void retarget_invalidated(struct opt_jit* jit,
+                                 const struct jit_method* compiled) {
+  struct jit_method* old;
+
+  for (old = compiled->next; old != NULL; old = old->next) {
+    if (old->method == compiled->method && old->osr == NULL &&
+        old->dependencies != NULL &&
+        atomic_load_explicit(&old->dependencies->invalid,
+                             memory_order_relaxed)) {
+      jit_retarget_sites(jit->methods, (compiled_entry)old->code,
+                         (compiled_entry)compiled->code);
+    }
+  }
+}
+
+/* Normal entry for osr_bci = IR_NONE, else an OSR entry at osr_bci */
+static int compile_method(struct opt_jit* jit, struct class_file* class,
+                          struct method_info* method, uint32_t osr_bci) {
+  struct method_runtime* mr = method_runtime_of(class, method);
+  struct osr_entry* osr = NULL;
+  compiled_entry previous = atomic_load_explicit(&mr->entry,
+                                                 memory_order_relaxed);
+  struct cha_dependencies* deps = NULL;
+  struct jit_method* compiled;
+  struct ir_function func;
+  struct x86_asm a;
+  void* code = NULL;
+  int err;
+
+  ir_init(&func, class, method);
+  func.osr_bci = osr_bci;
+  func.hierarchy = jit->interp->hierarchy;
+  x86_init(&a);
+  err = ir_build(&func);
+  if (err == 0) {
+    err = ir_compute_dominators(&func);
+  }
+  if (err == 0) {
+    ir_fold_and_gvn(&func);
+    ir_scalar_replace(&func);
+    ir_hoist_invariants(&func);
+    ir_eliminate_range_checks(&func);
+    ir_fold_and_gvn(&func);
+    ir_remove_dead(&func);
+    err = func.error;
+  }
+  if (err == 0 && !gc_safe(&func)) {
+    err = ENOTSUP;
+  }
+  if (err == 0) {
+    err = ir_generate(&func, &a);
+  }
+  compiled = err == 0 ? calloc(1, sizeof(struct jit_method)) : NULL;
+  if (err == 0 && osr_bci != IR_NONE) {
+    osr = calloc(1, sizeof(struct osr_entry));
+  }
+  if (err == 0 &&
+      (compiled == NULL || (osr_bci != IR_NONE && osr == NULL))) {
+    printf("ERROR: can't allocate memory for compiled method\n");
+    err = ENOMEM;
+  }
+  if (err == 0) {
+    code = code_cache_install(&jit->cache, a.code, a.size);
+    if (code == NULL) {
+      printf("ERROR: code cache is full\n");
+      err = ENOMEM;
+    }
+  }
+  if (err == 0 && func.dependencies != NULL &&
+      func.dependencies->count > 0) {
+    /* a class linked since the build may have broken the code already */
+    deps = func.dependencies;
+    func.dependencies = NULL;
+    deps->osr = osr;
+    deps->code = (compiled_entry)code;
+    err = class_hierarchy_register(jit->interp->hierarchy, deps);
+    if (err != 0) {
+      cha_dependencies_free(deps);
+    }
+  }
+  if (err != 0) {
+    free(osr);
+    free(compiled);
+    x86_destroy(&a);
+    ir_destroy(&func);
+    return err;
+  }
+
+  compiled->class = class;
+  compiled->method = method;
+  compiled->code = code;
+  compiled->code_size = a.size;
+  /* the code points into the sites and the debug info, they move along */
+  compiled->sites = func.sites;
+  compiled->site_count = func.site_count;
+  func.sites = NULL;
+  compiled->deopt = func.deopt;
+  func.deopt = NULL;
+  compiled->dependencies = deps;
+  compiled->next = jit->methods;
+  jit->methods = compiled;
+  jit->stats.code_bytes += a.size;
+  add_stats(&jit->stats.ir, &func.stats);
+  x86_destroy(&a);
+  ir_destroy(&func);
+
+  if (osr != NULL) {
+    atomic_init(&osr->code, (compiled_entry)code);
+    osr->bci = osr_bci;
+    osr->next = atomic_load_explicit(&mr->osr, memory_order_relaxed);
+    compiled->osr = osr;
+    /* entries are only added under the lock */
+    atomic_store_explicit(&mr->osr, osr, memory_order_release);
+  } else {
+    atomic_fetch_or_explicit(&mr->flags, METHOD_OPTIMIZED,
+                             memory_order_relaxed);
+    atomic_store_explicit(&mr->entry, (compiled_entry)code,
+                          memory_order_release);
+    /* optimized callers that bound the baseline code move on */
+    if (previous != NULL) {
+      jit_retarget_sites(jit->methods, previous, (compiled_entry)code);
+    }
+    retarget_invalidated(jit, compiled);
+  }
+  /* invalidated between registering and publishing, nobody withdrew it */
+  if (deps != NULL && atomic_load(&deps->invalid)) {
+    cha_withdraw(deps);
+  }
+  return 0;
+}
+
+int opt_jit_compile(struct opt_jit* jit, struct class_file* class,
+                    struct method_info* method) {
+  struct method_runtime* mr = method_runtime_of(class, method);
+  uint64_t start = now_ns();
+  int err = 0;
+
+  pthread_mutex_lock(&jit->lock);
+  if (!(atomic_load_explicit(&mr->flags, memory_order_relaxed) &
+        (METHOD_OPTIMIZED | METHOD_NOT_OPTIMIZABLE))) {
+    err = compile_method(jit, class, method, IR_NONE);
+    if (err == EAGAIN) {
+      err = compile_method(jit, class, method, IR_NONE);
+    }
+    if (err == 0) {
+      jit->stats.compiled++;
+    } else if (err == ENOTSUP) {
+      atomic_fetch_or_explicit(&mr->flags, METHOD_NOT_OPTIMIZABLE,
+                               memory_order_relaxed);
+      jit->stats.rejected++;
+    }
+    jit->stats.compile_ns += now_ns() - start;
+  }
+  pthread_mutex_unlock(&jit->lock);
+  return err;
+}
+
+int opt_jit_compile_osr(struct opt_jit* jit, struct class_file* class,
+                        struct method_info* method, uint32_t bci) {
+  struct method_runtime* mr = method_runtime_of(class, method);
+  uint64_t start = now_ns();
+  struct osr_entry* osr;
+  int err = 0;
+
+  pthread_mutex_lock(&jit->lock);
+  osr = atomic_load_explicit(&mr->osr, memory_order_relaxed);
+  /* withdrawn entries stay in the list */
+  while (osr != NULL &&
+         (osr->bci != bci ||
+          atomic_load_explicit(&osr->code, memory_order_relaxed) == NULL)) {
+    osr = osr->next;
+  }
+  if (osr == NULL && !(atomic_load_explicit(&mr->flags, memory_order_relaxed) &
+                       METHOD_NOT_OPTIMIZABLE)) {
+    err = compile_method(jit, class, method, bci);
+    if (err == 0) {
+      jit->stats.osr_compiled++;
+    } else if (err == ENOTSUP) {
+      jit->stats.osr_rejected++;
+    }
+    jit->stats.compile_ns += now_ns() - start;
+  }
+  pthread_mutex_unlock(&jit->lock);
+  return err;
+}
+
+/* Called during a safepoint, compile threads may still install code */
+static const struct deopt_table* find_code(const void* pc, const uint8_t** code,
+                                           void* ctx) {
+  struct opt_jit* jit = ctx;
+  const struct deopt_table* table = NULL;
+  struct jit_method* compiled;
+
+  pthread_mutex_lock(&jit->lock);
+  for (compiled = jit->methods; compiled != NULL && table == NULL;
+       compiled = compiled->next) {
+    const uint8_t* start = compiled->code;
+    if ((const uint8_t*)pc >= start &&
+        (const uint8_t*)pc < start + compiled->code_size) {
+      *code = start;
+      table = compiled->deopt;
+    }
+  }
+  pthread_mutex_unlock(&jit->lock);
+  return table;
+}
+
+static void compile_hot(struct interp_thread* thread, struct class_file* class,
+                        struct method_info* method, void* ctx) {
+  (void)thread;
+  opt_jit_compile(ctx, class, method);
+}
+
+static void compile_hot_loop(struct interp_thread* thread,
+                             struct class_file* class,
+                             struct method_info* method, uint32_t bci,
+                             void* ctx) {
+  (void)thread;
+  opt_jit_compile_osr(ctx, class, method, bci);
+}
+
+int opt_jit_init(struct opt_jit* jit, struct interpreter* interp,
+                 size_t code_size) {
+  int err;
+
+  memset(jit, 0, sizeof(*jit));
+  jit->interp = interp;
+  err = code_cache_init(&jit->cache, code_size);
+  if (err != 0) {
+    return err;
+  }
+  err = pthread_mutex_init(&jit->lock, NULL);
+  if (err != 0) {
+    code_cache_destroy(&jit->cache);
+    return err;
+  }
+  interp->hot_method = compile_hot;
+  interp->hot_loop = compile_hot_loop;
+  interp->hot_ctx = jit;
+  interp->code_map = find_code;
+  interp->code_ctx = jit;
+  return 0;
+}
+
+void opt_jit_destroy(struct opt_jit* jit) {
+  struct jit_method* compiled = jit->methods;
+
+  while (compiled != NULL) {
+    struct jit_method* next = compiled->next;
+    /* the class may outlive the compiler, send it back to interpreter */
+    if (compiled->class->runtime != NULL) {
+      struct method_runtime* mr =
+          method_runtime_of(compiled->class, compiled->method);
+      /* every OSR entry of the method is one of ours */
+      if (compiled->osr != NULL) {
+        atomic_store_explicit(&mr->osr, NULL, memory_order_release);
+      } else {
+        atomic_fetch_and_explicit(&mr->flags, ~METHOD_OPTIMIZED,
+                                  memory_order_relaxed);
+        atomic_store_explicit(&mr->entry, NULL, memory_order_release);
+      }
+    }
+    if (compiled->dependencies != NULL) {
+      class_hierarchy_unregister(jit->interp->hierarchy,
+                                 compiled->dependencies);
+      cha_dependencies_free(compiled->dependencies);
+    }
+    free(compiled->osr);
+    free(compiled->sites);
+    deopt_table_free(compiled->deopt);
+    free(compiled);
+    compiled = next;
+  }
+  if (jit->interp->hot_ctx == jit) {
+    jit->interp->hot_method = NULL;
+    jit->interp->hot_loop = NULL;
+    jit->interp->hot_ctx = NULL;
+  }
+  if (jit->interp->code_ctx == jit) {
+    jit->interp->code_map = NULL;
+    jit->interp->code_ctx = NULL;
+  }
+  pthread_mutex_destroy(&jit->lock);
+  code_cache_destroy(&jit->cache);
+  memset(jit, 0, sizeof(*jit));
+}
+
+void opt_jit_print_stats(const struct opt_jit* jit) {
+  const struct opt_jit_stats* stats = &jit->stats;
+
+  printf("opt jit: compiled=%llu rejected=%llu osr=%llu osr rejected=%llu "
+         "code=%llu bytes compile time=%.3f ms\n",
+         (unsigned long long)stats->compiled,
+         (unsigned long long)stats->rejected,
+         (unsigned long long)stats->osr_compiled,
+         (unsigned long long)stats->osr_rejected,
+         (unsigned long long)stats->code_bytes,
+         (double)stats->compile_ns / 1e6);
+  printf("  inlined=%u folded=%u gvn=%u hoisted=%u checks removed=%u "
+         "spills=%u devirtualized=%u invalidated=%llu\n",
+         stats->ir.inlined, stats->ir.folded, stats->ir.gvn,
+         stats->ir.hoisted, stats->ir.checks, stats->ir.spills,
+         stats->ir.devirtualized,
+         (unsigned long long)jit->interp->hierarchy->invalidations);
+  printf("  scalar replaced=%u locks elided=%u\n", stats->ir.scalar_replaced,
+         stats->ir.locks_elided);
+}
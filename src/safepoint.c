@@ -0,0 +1,335 @@
+#define _GNU_SOURCE
+
+#include "safepoint.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Polls before safepoint_init() read this, it is never protected */
+static const uint8_t unarmed_byte;
+
+const volatile uint8_t* safepoint_polling_page = &unarmed_byte;
+
+static uint8_t* page;
+static size_t page_size;
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+static int init_error;
+static struct sigaction previous_action;
+
+/* Held for the whole of an operation */
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct safepoint_thread* threads;
+
+static _Atomic(uint32_t) armed;
+static _Atomic(uint32_t) epoch; /* operations ended, a futex */
+
+static _Thread_local struct safepoint_thread* self;
+
+/* Under registry_lock */
+static struct safepoint_stats stats[SAFEPOINT_MAX_OPERATIONS];
+static uint32_t stats_count;
+static const char* operation;
+static uint64_t requested_ns;
+static uint64_t reached_ns;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void futex_wait(_Atomic(uint32_t)* word, uint32_t value) {
+  syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+}
+
+static void futex_wake(_Atomic(uint32_t)* word, int count) {
+  syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+/* Waits until the operation running when `seen` was read has ended */
+static void wait_for_end(uint32_t seen) {
+  while (atomic_load(&epoch) == seen) {
+    futex_wait(&epoch, seen);
+  }
+}
+
+/* A fault that isn't a poll goes to whoever handled SIGSEGV before */
+static void forward_fault(int sig, siginfo_t* info, void* context) {
+  if (previous_action.sa_flags & SA_SIGINFO) {
+    previous_action.sa_sigaction(sig, info, context);
+  } else if (previous_action.sa_handler != SIG_DFL &&
+             previous_action.sa_handler != SIG_IGN) {
+    previous_action.sa_handler(sig);
+  } else {
+    /* the faulting instruction runs again and kills the process */
+    struct sigaction action;
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = SIG_DFL;
+    sigaction(sig, &action, NULL);
+  }
+}
+
+static void handle_fault(int sig, siginfo_t* info, void* context) {
+  struct safepoint_thread* thread = self;
+  const uint8_t* address = info->si_addr;
+  int saved_errno = errno;
+  uint32_t seen;
+
+  if (page == NULL || address < page || address >= page + page_size) {
+    forward_fault(sig, info, context);
+    return;
+  }
+  seen = atomic_load(&epoch);
+  if (atomic_load(&armed)) {
+    if (thread != NULL) {
+      thread->context = context;
+      atomic_store(&thread->state, SAFEPOINT_PARKED_IN(seen));
+      futex_wake(&thread->state, 1);
+    }
+    wait_for_end(seen);
+    if (thread != NULL) {
+      thread->context = NULL;
+      atomic_store(&thread->state, SAFEPOINT_RUNNING);
+      /* the next operation may have found us parked in this one */
+      futex_wake(&thread->state, 1);
+    }
+  }
+  /* returning reads the page again */
+  errno = saved_errno;
+}
+
+static void init(void) {
+  struct sigaction action;
+  long size = sysconf(_SC_PAGESIZE);
+  void* mapping;
+
+  page_size = size > 0 ? (size_t)size : 4096;
+  mapping = mmap(NULL, page_size, PROT_READ,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+  if (mapping == MAP_FAILED ||
+      (uintptr_t)mapping + page_size > (uintptr_t)INT32_MAX) {
+    printf("ERROR: can't map the safepoint polling page\n");
+    if (mapping != MAP_FAILED) {
+      munmap(mapping, page_size);
+    }
+    init_error = ENOMEM;
+    return;
+  }
+
+  memset(&action, 0, sizeof(action));
+  action.sa_sigaction = handle_fault;
+  action.sa_flags = SA_SIGINFO | SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  if (sigaction(SIGSEGV, &action, &previous_action) != 0) {
+    printf("ERROR: can't install the safepoint signal handler\n");
+    munmap(mapping, page_size);
+    init_error = EINVAL;
+    return;
+  }
+  page = mapping;
+  safepoint_polling_page = page;
+}
+
+int safepoint_init(void) {
+  pthread_once(&init_once, init);
+  return init_error;
+}
+
+uint32_t safepoint_poll_address(void) {
+  return (uint32_t)(uintptr_t)page;
+}
+
+void safepoint_attach(struct safepoint_thread* thread, void* owner) {
+  memset(thread, 0, sizeof(*thread));
+  atomic_init(&thread->state, SAFEPOINT_SAFE);
+  thread->owner = owner;
+  pthread_mutex_lock(&registry_lock);
+  thread->next = threads;
+  threads = thread;
+  pthread_mutex_unlock(&registry_lock);
+}
+
+void safepoint_detach(struct safepoint_thread* thread) {
+  struct safepoint_thread** link;
+
+  pthread_mutex_lock(&registry_lock);
+  for (link = &threads; *link != NULL; link = &(*link)->next) {
+    if (*link == thread) {
+      *link = thread->next;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&registry_lock);
+  thread->next = NULL;
+}
+
+/*
+ * The thread publishes that it runs before it looks at armed, the
+ * operation arms before it looks at the threads: one of them sees
+ * the other
+ */
+static void become_running(struct safepoint_thread* thread) {
+  for (;;) {
+    uint32_t seen = atomic_load(&epoch);
+
+    atomic_store(&thread->state, SAFEPOINT_RUNNING);
+    if (!atomic_load(&armed)) {
+      return;
+    }
+    atomic_store(&thread->state, SAFEPOINT_SAFE);
+    futex_wake(&thread->state, 1);
+    wait_for_end(seen);
+  }
+}
+
+static void become_safe(struct safepoint_thread* thread) {
+  atomic_store(&thread->state, SAFEPOINT_SAFE);
+  if (atomic_load(&armed)) {
+    futex_wake(&thread->state, 1);
+  }
+}
+
+void safepoint_enter(struct safepoint_thread* thread) {
+  if (thread->depth++ == 0) {
+    self = thread;
+    if (thread->blocked == 0) {
+      become_running(thread);
+    }
+  }
+}
+
+void safepoint_leave(struct safepoint_thread* thread) {
+  if (--thread->depth == 0) {
+    if (thread->blocked == 0) {
+      become_safe(thread);
+    }
+    self = NULL;
+  }
+}
+
+void safepoint_block(void) {
+  struct safepoint_thread* thread = self;
+
+  if (thread != NULL && thread->blocked++ == 0) {
+    become_safe(thread);
+  }
+}
+
+void safepoint_unblock(void) {
+  struct safepoint_thread* thread = self;
+
+  if (thread != NULL && --thread->blocked == 0) {
+    become_running(thread);
+  }
+}
+
+void safepoint_begin(const char* name) {
+  struct safepoint_thread* thread;
+  uint64_t start = now_ns();
+  uint32_t parked;
+
+  safepoint_block();
+  pthread_mutex_lock(&registry_lock);
+  operation = name;
+  requested_ns = start;
+  if (safepoint_init() != 0) {
+    /* nobody can be stopped, the operation runs as it used to */
+    reached_ns = now_ns();
+    return;
+  }
+  atomic_store(&armed, 1);
+  mprotect(page, page_size, PROT_NONE);
+  /* only safepoint_end() moves the epoch, under the lock */
+  parked = SAFEPOINT_PARKED_IN(atomic_load(&epoch));
+  for (thread = threads; thread != NULL; thread = thread->next) {
+    uint32_t state;
+
+    while ((state = atomic_load(&thread->state)) != SAFEPOINT_SAFE &&
+           state != parked) {
+      futex_wait(&thread->state, state);
+    }
+  }
+  reached_ns = now_ns();
+}
+
+static void record(uint64_t end) {
+  struct safepoint_stats* entry = NULL;
+  uint64_t ttsp = reached_ns - requested_ns;
+  uint32_t i;
+
+  for (i = 0; i < stats_count && entry == NULL; i++) {
+    if (strcmp(stats[i].operation, operation) == 0) {
+      entry = &stats[i];
+    }
+  }
+  if (entry == NULL) {
+    if (stats_count == SAFEPOINT_MAX_OPERATIONS) {
+      return;
+    }
+    entry = &stats[stats_count++];
+    entry->operation = operation;
+  }
+  entry->count++;
+  entry->ttsp_ns += ttsp;
+  if (ttsp > entry->max_ttsp_ns) {
+    entry->max_ttsp_ns = ttsp;
+  }
+  entry->total_ns += end - requested_ns;
+}
+
+void safepoint_end(void) {
+  record(now_ns());
+  if (page != NULL) {
+    mprotect(page, page_size, PROT_READ);
+    atomic_store(&armed, 0);
+    atomic_fetch_add(&epoch, 1);
+    futex_wake(&epoch, INT_MAX);
+  }
+  pthread_mutex_unlock(&registry_lock);
+  safepoint_unblock();
+}
+
+void safepoint_for_each_thread(void (*visit)(struct safepoint_thread* thread,
+                                             void* ctx),
+                               void* ctx) {
+  struct safepoint_thread* thread;
+
+  for (thread = threads; thread != NULL; thread = thread->next) {
+    visit(thread, ctx);
+  }
+}
+
+uint32_t safepoint_get_stats(struct safepoint_stats* out, uint32_t max) {
+  uint32_t count;
+
+  pthread_mutex_lock(&registry_lock);
+  count = stats_count < max ? stats_count : max;
+  memcpy(out, stats, count * sizeof(struct safepoint_stats));
+  pthread_mutex_unlock(&registry_lock);
+  return count;
+}
+
+void safepoint_print_stats(void) {
+  struct safepoint_stats copy[SAFEPOINT_MAX_OPERATIONS];
+  uint32_t count = safepoint_get_stats(copy, SAFEPOINT_MAX_OPERATIONS);
+  uint32_t i;
+
+  for (i = 0; i < count; i++) {
+    printf("safepoint %s: count=%llu time to safepoint avg=%.3f us "
+           "max=%.3f us, operation avg=%.3f us\n",
+           copy[i].operation, (unsigned long long)copy[i].count,
+           (double)copy[i].ttsp_ns / (double)copy[i].count / 1e3,
+           (double)copy[i].max_ttsp_ns / 1e3,
+           (double)copy[i].total_ns / (double)copy[i].count / 1e3);
+  }
+}
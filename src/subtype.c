@@ -0,0 +1,119 @@
+#include "subtype.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "attribute_info.h"
+
+static int is_interface(const struct class_file* class) {
+  return (class->access_flags & ACC_INTERFACE) != 0;
+}
+
+/* Appends `type` unless it is there already */
+static void add(struct class_file** list, uint32_t* count,
+               struct class_file* type) {
+  uint32_t i;
+
+  for (i = 0; i < *count; i++) {
+    if (list[i] == type) {
+      return;
+    }
+  }
+  list[(*count)++] = type;
+}
+
+int subtype_link(struct class_file* class, struct class_runtime* runtime) {
+  const struct class_runtime* super =
+      runtime->super != NULL ? runtime->super->runtime : NULL;
+  struct class_file** secondary;
+  uint32_t capacity = 1;
+  uint32_t count = 0;
+  uint32_t i;
+  uint16_t j;
+
+  memset(runtime->primary, 0, sizeof(runtime->primary));
+  runtime->depth = 0;
+  if (super != NULL) {
+    memcpy(runtime->primary, super->primary, sizeof(runtime->primary));
+    runtime->depth = super->depth + 1;
+    capacity += super->secondary_count;
+  }
+  for (j = 0; j < class->interfaces_count; j++) {
+    struct class_file* interface = runtime->interfaces[j];
+    if (interface != NULL) {
+      capacity += 1 + interface->runtime->secondary_count;
+    }
+  }
+
+  secondary = malloc(capacity * sizeof(struct class_file*));
+  if (secondary == NULL) {
+    printf("ERROR: can't allocate memory for the supertypes\n");
+    return ENOMEM;
+  }
+  for (i = 0; super != NULL && i < super->secondary_count; i++) {
+    secondary[count++] = super->secondary[i];
+  }
+  /* interfaces are only ever found among the secondary supertypes */
+  if (!is_interface(class)) {
+    if (runtime->depth < PRIMARY_SUPERS) {
+      runtime->primary[runtime->depth] = class;
+    } else {
+      /* for the subclasses, which copy the list */
+      add(secondary, &count, class);
+    }
+  }
+  for (j = 0; j < class->interfaces_count; j++) {
+    struct class_file* interface = runtime->interfaces[j];
+    const struct class_runtime* inherited;
+
+    if (interface == NULL) {
+      continue;
+    }
+    inherited = interface->runtime;
+    add(secondary, &count, interface);
+    for (i = 0; i < inherited->secondary_count; i++) {
+      add(secondary, &count, inherited->secondary[i]);
+    }
+  }
+  runtime->secondary = secondary;
+  runtime->secondary_count = count;
+  atomic_init(&runtime->secondary_hit, NULL);
+  return 0;
+}
+
+void subtype_free(struct class_runtime* runtime) {
+  free(runtime->secondary);
+  runtime->secondary = NULL;
+  runtime->secondary_count = 0;
+}
+
+int subtype_of(struct class_file* class, struct class_runtime* runtime,
+               struct class_file* of) {
+  const struct class_runtime* target = of->runtime;
+  uint32_t i;
+
+  if (class == of) {
+    return 1;
+  }
+  /* supertypes of a linked class are linked */
+  if (target == NULL) {
+    return 0;
+  }
+  if (!is_interface(of) && target->depth < PRIMARY_SUPERS) {
+    return runtime->primary[target->depth] == of;
+  }
+  if (atomic_load_explicit(&runtime->secondary_hit, memory_order_relaxed) ==
+      of) {
+    return 1;
+  }
+  for (i = 0; i < runtime->secondary_count; i++) {
+    if (runtime->secondary[i] == of) {
+      atomic_store_explicit(&runtime->secondary_hit, of,
+                            memory_order_relaxed);
+      return 1;
+    }
+  }
+  return 0;
+}
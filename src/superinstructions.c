@@ -0,0 +1,126 @@
+#include "superinstructions.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "attribute_info.h"
+#include "opcodes.h"
+
+/* Instruction classes a sequence is made of */
+enum piece {
+  PIECE_END,
+  PIECE_ILOAD,
+  PIECE_PUSH, /* int push */
+  PIECE_IOP,  /* int op that can't throw */
+  PIECE_ISTORE,
+  PIECE_IF_ICMP,
+  PIECE_ALOAD,
+  PIECE_GETFIELD,
+  PIECE_IINC,
+  PIECE_GOTO,
+};
+
+#define MAX_PIECES 4
+
+struct sequence {
+  uint8_t opcode;
+  uint8_t pieces[MAX_PIECES + 1]; /* PIECE_END terminated */
+};
+
+/* Longest first, the first match at a bci wins */
+static const struct sequence sequences[] = {
+    {OP_LOAD_PUSH_IOP_STORE,
+     {PIECE_ILOAD, PIECE_PUSH, PIECE_IOP, PIECE_ISTORE, PIECE_END}},
+    {OP_LOAD_PUSH_IOP, {PIECE_ILOAD, PIECE_PUSH, PIECE_IOP, PIECE_END}},
+    {OP_LOAD_PUSH_IF, {PIECE_ILOAD, PIECE_PUSH, PIECE_IF_ICMP, PIECE_END}},
+    {OP_PUSH_IOP, {PIECE_PUSH, PIECE_IOP, PIECE_END}},
+    {OP_IOP_STORE, {PIECE_IOP, PIECE_ISTORE, PIECE_END}},
+    {OP_ALOAD_GETFIELD, {PIECE_ALOAD, PIECE_GETFIELD, PIECE_END}},
+    {OP_IINC_GOTO, {PIECE_IINC, PIECE_GOTO, PIECE_END}},
+};
+
+static int is_piece(uint8_t piece, uint8_t opcode) {
+  switch (piece) {
+    case PIECE_ILOAD:
+      return opcode == OP_ILOAD ||
+             (opcode >= OP_ILOAD_0 && opcode <= OP_ILOAD_3);
+    case PIECE_PUSH:
+      return opcode == OP_ILOAD ||
+             (opcode >= OP_ILOAD_0 && opcode <= OP_ILOAD_3) ||
+             (opcode >= OP_ICONST_M1 && opcode <= OP_ICONST_5) ||
+             opcode == OP_BIPUSH || opcode == OP_SIPUSH;
+    case PIECE_IOP:
+      return opcode == OP_IADD || opcode == OP_ISUB || opcode == OP_IMUL ||
+             opcode == OP_IAND || opcode == OP_IOR || opcode == OP_IXOR ||
+             opcode == OP_ISHL || opcode == OP_ISHR || opcode == OP_IUSHR;
+    case PIECE_ISTORE:
+      return opcode == OP_ISTORE ||
+             (opcode >= OP_ISTORE_0 && opcode <= OP_ISTORE_3);
+    case PIECE_IF_ICMP:
+      return opcode >= OP_IF_ICMPEQ && opcode <= OP_IF_ICMPLE;
+    case PIECE_ALOAD:
+      return opcode == OP_ALOAD ||
+             (opcode >= OP_ALOAD_0 && opcode <= OP_ALOAD_3);
+    case PIECE_GETFIELD:
+      return opcode == OP_GETFIELD;
+    case PIECE_IINC:
+      return opcode == OP_IINC;
+    case PIECE_GOTO:
+      return opcode == OP_GOTO;
+    default:
+      return 0;
+  }
+}
+
+/* Length of the sequence at bci, 0 if it doesn't start there */
+static uint32_t match(const struct sequence* s, const uint8_t* code,
+                      uint32_t length, uint32_t bci) {
+  uint32_t end = bci;
+  int i;
+
+  for (i = 0; s->pieces[i] != PIECE_END; i++) {
+    if (end >= length || !is_piece(s->pieces[i], code[end])) {
+      return 0;
+    }
+    /* none of the pieces is a switch or wide, their length is fixed */
+    end += (uint32_t)opcode_table[code[end]].length;
+  }
+  return end <= length ? end - bci : 0;
+}
+
+uint8_t* superinstructions_rewrite(const struct Code_attribute* code,
+                                   uint32_t* count) {
+  uint8_t* copy = NULL;
+  uint32_t bci = 0;
+
+  while (bci < code->code_length) {
+    uint32_t length = opcode_length(code->code, code->code_length, bci);
+    uint32_t fused = 0;
+    size_t i;
+
+    if (length == 0) {
+      /* malformed, the verifier rejects it anyway */
+      break;
+    }
+    for (i = 0; fused == 0 && i < sizeof(sequences) / sizeof(*sequences);
+         i++) {
+      fused = match(&sequences[i], code->code, code->code_length, bci);
+    }
+    if (fused == 0) {
+      bci += length;
+      continue;
+    }
+    if (copy == NULL) {
+      copy = malloc(code->code_length);
+      if (copy == NULL) {
+        return NULL;
+      }
+      memcpy(copy, code->code, code->code_length);
+    }
+    copy[bci] = sequences[i - 1].opcode;
+    (*count)++;
+    /* sequences don't overlap */
+    bci += fused;
+  }
+  return copy;
+}
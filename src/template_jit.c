@@ -0,0 +1,984 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "template_jit.h"
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "descriptor.h"
+#include "opcodes.h"
+#include "safepoint.h"
+#include "x86_64.h"
+
+#define JIT_START 0x1  /* an instruction starts here */
+#define JIT_TARGET 0x2 /* a branch lands here */
+
+/* Fixup targets past any bci, code_length is at most 65535 */
+#define JIT_LABEL_RETURN 0x10000
+#define JIT_LABEL_EXIT 0x10001
+#define JIT_LABEL_ARITHMETIC 0x10002
+#define JIT_LABEL_OVERFLOW 0x10003
+#define JIT_LABEL_COUNT 4
+
+struct jit_fixup {
+  size_t at; /* displacement of the jump */
+  uint32_t target;
+};
+
+/* State of one compilation */
+struct jit_compiler {
+  const struct template_jit* jit;
+  struct class_file* class;
+  struct method_info* method;
+  struct method_runtime* mr;
+  const struct Code_attribute* code;
+  struct x86_asm a;
+
+  int32_t* depth; /* stack depth before each instruction, -1 if unseen */
+  uint8_t* flags; /* JIT_* */
+  size_t* native; /* offset of the template of each instruction */
+  uint32_t* worklist;
+  size_t labels[JIT_LABEL_COUNT];
+
+  struct jit_fixup* fixups;
+  size_t fixup_count;
+  size_t fixup_capacity;
+
+  struct jit_call_site* sites; /* size = site_count */
+  uint32_t site_count;
+  uint32_t next_site;
+
+  int32_t slot_base; /* rbp displacement of local 0 */
+  int32_t sp;        /* operand stack depth */
+  int cached;        /* top of stack is in eax, not in its slot */
+};
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static uint16_t read_u2(const uint8_t* p) {
+  return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static int is_int_kind(char kind) {
+  return kind == 'I' || kind == 'Z' || kind == 'B' || kind == 'C' ||
+         kind == 'S';
+}
+
+/* Descriptor with only int arguments and an int or void result */
+static int int_descriptor(struct UTF8_info* descriptor,
+                          struct method_descriptor* desc) {
+  uint8_t i;
+
+  if (parse_method_descriptor(descriptor, desc) != 0 ||
+      (!is_int_kind(desc->ret) && desc->ret != 'V')) {
+    return 0;
+  }
+  for (i = 0; i < desc->arg_count; i++) {
+    if (!is_int_kind(desc->args[i])) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/*
+ * Operand stack effect of an instruction of the int subset,
+ * -1 when the instruction is outside of it
+ */
+static int stack_effect(struct jit_compiler* c, uint32_t bci, int32_t* pops,
+                        int32_t* pushes) {
+  const uint8_t* code = c->code->code;
+  uint8_t opcode = code[bci];
+  struct method_descriptor desc;
+
+  *pops = 0;
+  *pushes = 0;
+  switch (opcode) {
+    case OP_NOP:
+    case OP_IINC:
+    case OP_GOTO:
+    case OP_RETURN:
+      return 0;
+    case OP_ICONST_M1:
+    case OP_ICONST_0:
+    case OP_ICONST_1:
+    case OP_ICONST_2:
+    case OP_ICONST_3:
+    case OP_ICONST_4:
+    case OP_ICONST_5:
+    case OP_BIPUSH:
+    case OP_SIPUSH:
+    case OP_ILOAD:
+    case OP_ILOAD_0:
+    case OP_ILOAD_1:
+    case OP_ILOAD_2:
+    case OP_ILOAD_3:
+      *pushes = 1;
+      return 0;
+    case OP_LDC:
+    case OP_LDC_W: {
+      struct cp_info* cp_info;
+      uint16_t index = opcode == OP_LDC ? code[bci + 1]
+                                        : read_u2(code + bci + 1);
+      if (get_constant(c->class, index, &cp_info) != 0 ||
+          cp_info->tag != INTEGER) {
+        return -1;
+      }
+      *pushes = 1;
+      return 0;
+    }
+    case OP_ISTORE:
+    case OP_ISTORE_0:
+    case OP_ISTORE_1:
+    case OP_ISTORE_2:
+    case OP_ISTORE_3:
+    case OP_POP:
+    case OP_IFEQ:
+    case OP_IFNE:
+    case OP_IFLT:
+    case OP_IFGE:
+    case OP_IFGT:
+    case OP_IFLE:
+    case OP_IRETURN:
+      *pops = 1;
+      return 0;
+    case OP_INEG:
+    case OP_I2B:
+    case OP_I2C:
+    case OP_I2S:
+      *pops = 1;
+      *pushes = 1;
+      return 0;
+    case OP_DUP:
+      *pops = 1;
+      *pushes = 2;
+      return 0;
+    case OP_IADD:
+    case OP_ISUB:
+    case OP_IMUL:
+    case OP_IDIV:
+    case OP_IREM:
+    case OP_ISHL:
+    case OP_ISHR:
+    case OP_IUSHR:
+    case OP_IAND:
+    case OP_IOR:
+    case OP_IXOR:
+      *pops = 2;
+      *pushes = 1;
+      return 0;
+    case OP_IF_ICMPEQ:
+    case OP_IF_ICMPNE:
+    case OP_IF_ICMPLT:
+    case OP_IF_ICMPGE:
+    case OP_IF_ICMPGT:
+    case OP_IF_ICMPLE:
+      *pops = 2;
+      return 0;
+    case OP_INVOKESTATIC: {
+      struct UTF8_info* descriptor =
+          constant_member_descriptor(c->class, read_u2(code + bci + 1));
+      if (descriptor == NULL || !int_descriptor(descriptor, &desc)) {
+        return -1;
+      }
+      *pops = desc.arg_slots;
+      *pushes = desc.ret != 'V';
+      return 0;
+    }
+    default:
+      return -1;
+  }
+}
+
+static int local_index(const uint8_t* code, uint32_t bci) {
+  uint8_t opcode = code[bci];
+
+  if (opcode >= OP_ILOAD_0 && opcode <= OP_ILOAD_3) {
+    return opcode - OP_ILOAD_0;
+  }
+  if (opcode >= OP_ISTORE_0 && opcode <= OP_ISTORE_3) {
+    return opcode - OP_ISTORE_0;
+  }
+  if (opcode == OP_ILOAD || opcode == OP_ISTORE || opcode == OP_IINC) {
+    return code[bci + 1];
+  }
+  return -1;
+}
+
+static int enqueue(struct jit_compiler* c, uint32_t* count, uint32_t bci,
+                   int32_t depth) {
+  if (bci >= c->code->code_length || !(c->flags[bci] & JIT_START)) {
+    return EINVAL;
+  }
+  if (c->depth[bci] < 0) {
+    c->depth[bci] = depth;
+    c->worklist[(*count)++] = bci;
+  } else if (c->depth[bci] != depth) {
+    return EINVAL;
+  }
+  return 0;
+}
+
+/*
+ * Finds instruction boundaries and the stack depth at every reachable
+ * instruction, rejects methods outside the int subset
+ */
+static int analyze(struct jit_compiler* c) {
+  const uint8_t* code = c->code->code;
+  uint32_t length = c->code->code_length;
+  uint32_t count = 0;
+  uint32_t bci;
+  int err;
+
+  for (bci = 0; bci < length;) {
+    uint32_t size = opcode_length(code, length, bci);
+    if (size == 0) {
+      return EINVAL;
+    }
+    c->flags[bci] |= JIT_START;
+    c->depth[bci] = -1;
+    bci += size;
+  }
+
+  err = enqueue(c, &count, 0, 0);
+  while (err == 0 && count > 0) {
+    uint8_t opcode;
+    int32_t pops;
+    int32_t pushes;
+    int32_t depth;
+    int local;
+
+    bci = c->worklist[--count];
+    opcode = code[bci];
+    if (stack_effect(c, bci, &pops, &pushes) != 0) {
+      return ENOTSUP;
+    }
+    local = local_index(code, bci);
+    if (local >= c->code->max_locals) {
+      return EINVAL;
+    }
+    depth = c->depth[bci] - pops;
+    if (depth < 0 || depth + pushes > c->code->max_stack) {
+      return EINVAL;
+    }
+    depth += pushes;
+    if (opcode == OP_INVOKESTATIC) {
+      c->site_count++;
+    }
+
+    if (opcode_table[opcode].flags & OPF_BRANCH) {
+      uint32_t target = bci + (uint32_t)opcode_branch_offset(code, bci);
+      err = enqueue(c, &count, target, depth);
+      if (err == 0) {
+        c->flags[target] |= JIT_TARGET;
+      }
+    }
+    if (err == 0 && !(opcode_table[opcode].flags & OPF_NO_FALLTHROUGH)) {
+      err = enqueue(c, &count, bci + opcode_table[opcode].length, depth);
+    }
+  }
+  return err;
+}
+
+static int32_t local_disp(const struct jit_compiler* c, int32_t index) {
+  return c->slot_base + 8 * index;
+}
+
+static int32_t stack_disp(const struct jit_compiler* c, int32_t depth) {
+  return local_disp(c, c->code->max_locals + depth);
+}
+
+static void add_fixup(struct jit_compiler* c, size_t at, uint32_t target) {
+  if (c->fixup_count == c->fixup_capacity) {
+    size_t capacity = c->fixup_capacity != 0 ? c->fixup_capacity * 2 : 64;
+    struct jit_fixup* fixups =
+        realloc(c->fixups, capacity * sizeof(struct jit_fixup));
+    if (fixups == NULL) {
+      c->a.error = 1;
+      return;
+    }
+    c->fixups = fixups;
+    c->fixup_capacity = capacity;
+  }
+  c->fixups[c->fixup_count].at = at;
+  c->fixups[c->fixup_count].target = target;
+  c->fixup_count++;
+}
+
+static void jump(struct jit_compiler* c, uint32_t target) {
+  add_fixup(c, x86_jmp(&c->a, X86_NO_TARGET), target);
+}
+
+static void jump_if(struct jit_compiler* c, enum x86_cond cond,
+                    uint32_t target) {
+  add_fixup(c, x86_jcc(&c->a, cond, X86_NO_TARGET), target);
+}
+
+/* Writes the cached top of stack back to its slot */
+static void flush(struct jit_compiler* c) {
+  if (c->cached) {
+    x86_mov_mr(&c->a, 0, X86_RBP, stack_disp(c, c->sp - 1), X86_RAX);
+    c->cached = 0;
+  }
+}
+
+static void pop(struct jit_compiler* c, enum x86_reg reg) {
+  if (c->cached) {
+    if (reg != X86_RAX) {
+      x86_mov_rr(&c->a, 0, reg, X86_RAX);
+    }
+    c->cached = 0;
+  } else {
+    x86_mov_rm(&c->a, 0, reg, X86_RBP, stack_disp(c, c->sp - 1));
+  }
+  c->sp--;
+}
+
+/* The value in eax becomes the new top of stack */
+static void push_rax(struct jit_compiler* c) {
+  c->sp++;
+  c->cached = 1;
+}
+
+static void push_constant(struct jit_compiler* c, int32_t value) {
+  flush(c);
+  x86_mov_ri(&c->a, X86_RAX, value);
+  push_rax(c);
+}
+
+static enum x86_cond negate(enum x86_cond cond) {
+  return (enum x86_cond)(cond ^ 1);
+}
+
+static enum x86_cond branch_condition(uint8_t opcode) {
+  static const enum x86_cond conditions[] = {
+      X86_CC_E, X86_CC_NE, X86_CC_L, X86_CC_GE, X86_CC_G, X86_CC_LE,
+  };
+  if (opcode >= OP_IF_ICMPEQ) {
+    return conditions[opcode - OP_IF_ICMPEQ];
+  }
+  return conditions[opcode - OP_IFEQ];
+}
+
+static void call_runtime(struct jit_compiler* c, uint64_t function) {
+  x86_mov_ri64(&c->a, X86_RAX, function);
+  x86_call_r(&c->a, X86_RAX);
+}
+
+/*
+ * Bumps a counter of the method and tells the interpreter once it
+ * reaches `threshold`. The operand stack must be in its slots
+ */
+static void emit_count(struct jit_compiler* c, _Atomic(uint32_t)* counter,
+                       uint32_t threshold) {
+  size_t skip;
+
+  x86_mov_ri64(&c->a, X86_RCX, (uint64_t)(uintptr_t)counter);
+  x86_alu_mi(&c->a, 0, X86_ADD, X86_RCX, 0, 1);
+  x86_alu_mi(&c->a, 0, X86_CMP, X86_RCX, 0, (int32_t)threshold);
+  skip = x86_jcc(&c->a, X86_CC_NE, X86_NO_TARGET);
+  x86_mov_rr(&c->a, 1, X86_RDI, X86_RBX);
+  x86_mov_ri64(&c->a, X86_RSI, (uint64_t)(uintptr_t)c->class);
+  x86_mov_ri64(&c->a, X86_RDX, (uint64_t)(uintptr_t)c->method);
+  call_runtime(c, (uint64_t)(uintptr_t)interp_notify_hot);
+  x86_patch_jump(&c->a, skip, c->a.size);
+}
+
+/* Branch to `target`, polled and counted when it goes backwards */
+static void emit_branch(struct jit_compiler* c, uint32_t bci, int conditional,
+                        enum x86_cond cond) {
+  uint32_t target = bci + (uint32_t)opcode_branch_offset(c->code->code, bci);
+  size_t skip = 0;
+
+  if (target > bci) {
+    if (conditional) {
+      jump_if(c, cond, target);
+    } else {
+      jump(c, target);
+    }
+    return;
+  }
+  if (conditional) {
+    skip = x86_jcc(&c->a, negate(cond), X86_NO_TARGET);
+  }
+  /* the frame holds only ints, a parked thread has nothing to report */
+  x86_test_abs(&c->a, safepoint_poll_address(), X86_RAX);
+  if (c->jit->hot_backedges != 0) {
+    emit_count(c, &c->mr->backedges, c->jit->hot_backedges);
+  }
+  jump(c, target);
+  if (conditional) {
+    x86_patch_jump(&c->a, skip, c->a.size);
+  }
+}
+
+static void emit_division(struct jit_compiler* c, int remainder) {
+  size_t divide;
+  size_t done;
+
+  pop(c, X86_RCX);
+  pop(c, X86_RAX);
+  x86_test_rr(&c->a, 0, X86_RCX, X86_RCX);
+  jump_if(c, X86_CC_E, JIT_LABEL_ARITHMETIC);
+  /* MIN_VALUE / -1 overflows in idiv, Java wraps it */
+  x86_alu_ri(&c->a, 0, X86_CMP, X86_RCX, -1);
+  divide = x86_jcc(&c->a, X86_CC_NE, X86_NO_TARGET);
+  if (remainder) {
+    x86_mov_ri(&c->a, X86_RAX, 0);
+  } else {
+    x86_neg(&c->a, 0, X86_RAX);
+  }
+  done = x86_jmp(&c->a, X86_NO_TARGET);
+  x86_patch_jump(&c->a, divide, c->a.size);
+  x86_idiv(&c->a, 0, X86_RCX);
+  if (remainder) {
+    x86_mov_rr(&c->a, 0, X86_RAX, X86_RDX);
+  }
+  x86_patch_jump(&c->a, done, c->a.size);
+  push_rax(c);
+}
+
+static void emit_invoke(struct jit_compiler* c, uint32_t bci) {
+  struct jit_call_site* site = &c->sites[c->next_site++];
+  int32_t pops;
+  int32_t pushes;
+
+  stack_effect(c, bci, &pops, &pushes);
+  jit_call_site_init(site, c->class, read_u2(c->code->code + bci + 1));
+  flush(c);
+  /* arguments stay in the caller's stack slots */
+  x86_lea(&c->a, X86_RSI, X86_RBP, stack_disp(c, c->sp - pops));
+  x86_mov_rr(&c->a, 1, X86_RDI, X86_RBX);
+  x86_mov_ri64(&c->a, X86_RDX, (uint64_t)(uintptr_t)site);
+  x86_call_m(&c->a, X86_RDX, (int32_t)offsetof(struct jit_call_site, target));
+  x86_alu_mi(&c->a, 1, X86_CMP, X86_RBX,
+             (int32_t)offsetof(struct interp_thread, exception_class), 0);
+  jump_if(c, X86_CC_NE, JIT_LABEL_EXIT);
+  c->sp -= pops;
+  if (pushes != 0) {
+    push_rax(c);
+  }
+}
+
+static void emit_instruction(struct jit_compiler* c, uint32_t bci) {
+  const uint8_t* code = c->code->code;
+  uint8_t opcode = code[bci];
+
+  switch (opcode) {
+    case OP_NOP:
+      break;
+    case OP_ICONST_M1:
+    case OP_ICONST_0:
+    case OP_ICONST_1:
+    case OP_ICONST_2:
+    case OP_ICONST_3:
+    case OP_ICONST_4:
+    case OP_ICONST_5:
+      push_constant(c, opcode - OP_ICONST_0);
+      break;
+    case OP_BIPUSH:
+      push_constant(c, (int8_t)code[bci + 1]);
+      break;
+    case OP_SIPUSH:
+      push_constant(c, (int16_t)read_u2(code + bci + 1));
+      break;
+    case OP_LDC:
+    case OP_LDC_W: {
+      struct cp_info* cp_info = NULL;
+      /* checked to be an Integer by analyze() */
+      get_constant(c->class,
+                   opcode == OP_LDC ? code[bci + 1] : read_u2(code + bci + 1),
+                   &cp_info);
+      push_constant(c, (int32_t)cp_info->integer_info.info.bytes);
+      break;
+    }
+
+    case OP_ILOAD:
+    case OP_ILOAD_0:
+    case OP_ILOAD_1:
+    case OP_ILOAD_2:
+    case OP_ILOAD_3:
+      flush(c);
+      x86_mov_rm(&c->a, 0, X86_RAX, X86_RBP,
+                 local_disp(c, local_index(code, bci)));
+      push_rax(c);
+      break;
+    case OP_ISTORE:
+    case OP_ISTORE_0:
+    case OP_ISTORE_1:
+    case OP_ISTORE_2:
+    case OP_ISTORE_3:
+      pop(c, X86_RAX);
+      x86_mov_mr(&c->a, 0, X86_RBP, local_disp(c, local_index(code, bci)),
+                 X86_RAX);
+      break;
+    case OP_IINC:
+      x86_alu_mi(&c->a, 0, X86_ADD, X86_RBP, local_disp(c, code[bci + 1]),
+                 (int8_t)code[bci + 2]);
+      break;
+
+    case OP_POP:
+      if (c->cached) {
+        c->cached = 0;
+      }
+      c->sp--;
+      break;
+    case OP_DUP:
+      if (!c->cached) {
+        x86_mov_rm(&c->a, 0, X86_RAX, X86_RBP, stack_disp(c, c->sp - 1));
+      } else {
+        x86_mov_mr(&c->a, 0, X86_RBP, stack_disp(c, c->sp - 1), X86_RAX);
+      }
+      c->cached = 0;
+      push_rax(c);
+      break;
+
+    case OP_IADD:
+    case OP_ISUB:
+    case OP_IAND:
+    case OP_IOR:
+    case OP_IXOR: {
+      static const enum x86_alu ops[] = {X86_ADD, X86_SUB, X86_AND, X86_OR,
+                                         X86_XOR};
+      enum x86_alu op = ops[opcode == OP_IADD   ? 0
+                            : opcode == OP_ISUB ? 1
+                            : opcode == OP_IAND ? 2
+                            : opcode == OP_IOR  ? 3
+                                                : 4];
+      pop(c, X86_RCX);
+      pop(c, X86_RAX);
+      x86_alu_rr(&c->a, 0, op, X86_RAX, X86_RCX);
+      push_rax(c);
+      break;
+    }
+    case OP_IMUL:
+      pop(c, X86_RCX);
+      pop(c, X86_RAX);
+      x86_imul_rr(&c->a, 0, X86_RAX, X86_RCX);
+      push_rax(c);
+      break;
+    case OP_IDIV:
+    case OP_IREM:
+      emit_division(c, opcode == OP_IREM);
+      break;
+    case OP_INEG:
+      pop(c, X86_RAX);
+      x86_neg(&c->a, 0, X86_RAX);
+      push_rax(c);
+      break;
+    case OP_ISHL:
+    case OP_ISHR:
+    case OP_IUSHR:
+      /* x86 masks 32-bit shift counts to 5 bits like Java */
+      pop(c, X86_RCX);
+      pop(c, X86_RAX);
+      x86_shift_cl(&c->a, 0,
+                   opcode == OP_ISHL   ? X86_SHL
+                   : opcode == OP_ISHR ? X86_SAR
+                                       : X86_SHR,
+                   X86_RAX);
+      push_rax(c);
+      break;
+    case OP_I2B:
+      pop(c, X86_RAX);
+      x86_movsx8(&c->a, X86_RAX, X86_RAX);
+      push_rax(c);
+      break;
+    case OP_I2C:
+      pop(c, X86_RAX);
+      x86_movzx16(&c->a, X86_RAX, X86_RAX);
+      push_rax(c);
+      break;
+    case OP_I2S:
+      pop(c, X86_RAX);
+      x86_movsx16(&c->a, X86_RAX, X86_RAX);
+      push_rax(c);
+      break;
+
+    case OP_IFEQ:
+    case OP_IFNE:
+    case OP_IFLT:
+    case OP_IFGE:
+    case OP_IFGT:
+    case OP_IFLE:
+      pop(c, X86_RAX);
+      x86_test_rr(&c->a, 0, X86_RAX, X86_RAX);
+      emit_branch(c, bci, 1, branch_condition(opcode));
+      break;
+    case OP_IF_ICMPEQ:
+    case OP_IF_ICMPNE:
+    case OP_IF_ICMPLT:
+    case OP_IF_ICMPGE:
+    case OP_IF_ICMPGT:
+    case OP_IF_ICMPLE:
+      pop(c, X86_RCX);
+      pop(c, X86_RAX);
+      x86_alu_rr(&c->a, 0, X86_CMP, X86_RAX, X86_RCX);
+      emit_branch(c, bci, 1, branch_condition(opcode));
+      break;
+    case OP_GOTO:
+      flush(c);
+      emit_branch(c, bci, 0, X86_CC_E);
+      break;
+
+    case OP_IRETURN:
+      pop(c, X86_RAX);
+      jump(c, JIT_LABEL_RETURN);
+      break;
+    case OP_RETURN:
+      x86_mov_ri(&c->a, X86_RAX, 0);
+      jump(c, JIT_LABEL_RETURN);
+      break;
+
+    case OP_INVOKESTATIC:
+      emit_invoke(c, bci);
+      break;
+  }
+}
+
+static void emit_throw(struct jit_compiler* c, const char* class_name) {
+  x86_mov_rr(&c->a, 1, X86_RDI, X86_RBX);
+  x86_mov_ri64(&c->a, X86_RSI, (uint64_t)(uintptr_t)class_name);
+  call_runtime(c, (uint64_t)(uintptr_t)interp_throw);
+  jump(c, JIT_LABEL_EXIT);
+}
+
+/*
+ *   push rbp; mov rbp, rsp; push rbx; sub rsp, frame
+ *   | saved rbp | saved rbx | stack slots ... locals |  <- rsp
+ * frame keeps rsp 16-byte aligned for calls into the runtime
+ */
+static void emit_method(struct jit_compiler* c, uint16_t arg_slots) {
+  const struct Code_attribute* code = c->code;
+  int32_t slots = code->max_locals + code->max_stack;
+  int32_t frame = ((8 * slots + 8 + 15) & ~15) - 8;
+  int32_t depth_disp = (int32_t)offsetof(struct interp_thread, depth);
+  uint32_t bci;
+  uint16_t i;
+  size_t k;
+
+  c->slot_base = -8 - frame;
+
+  x86_push(&c->a, X86_RBP);
+  x86_mov_rr(&c->a, 1, X86_RBP, X86_RSP);
+  x86_push(&c->a, X86_RBX);
+  x86_alu_ri(&c->a, 1, X86_SUB, X86_RSP, frame);
+  x86_mov_rr(&c->a, 1, X86_RBX, X86_RDI);
+  x86_alu_mi(&c->a, 0, X86_ADD, X86_RBX, depth_disp, 1);
+  x86_alu_mi(&c->a, 0, X86_CMP, X86_RBX, depth_disp, INTERP_MAX_DEPTH);
+  jump_if(c, X86_CC_A, JIT_LABEL_OVERFLOW);
+  for (i = 0; i < arg_slots; i++) {
+    x86_mov_rm(&c->a, 1, X86_RAX, X86_RSI, 8 * i);
+    x86_mov_mr(&c->a, 1, X86_RBP, local_disp(c, i), X86_RAX);
+  }
+  if (c->jit->hot_invocations != 0) {
+    emit_count(c, &c->mr->invocations, c->jit->hot_invocations);
+  }
+
+  for (bci = 0; bci < code->code_length; bci++) {
+    if (!(c->flags[bci] & JIT_START) || c->depth[bci] < 0) {
+      continue;
+    }
+    if (c->flags[bci] & JIT_TARGET) {
+      flush(c);
+    }
+    c->native[bci] = c->a.size;
+    c->sp = c->depth[bci];
+    emit_instruction(c, bci);
+    if (opcode_table[code->code[bci]].flags & OPF_NO_FALLTHROUGH) {
+      c->cached = 0;
+    }
+  }
+
+  c->labels[JIT_LABEL_OVERFLOW - JIT_LABEL_RETURN] = c->a.size;
+  emit_throw(c, "java/lang/StackOverflowError");
+  c->labels[JIT_LABEL_ARITHMETIC - JIT_LABEL_RETURN] = c->a.size;
+  emit_throw(c, "java/lang/ArithmeticException");
+  c->labels[JIT_LABEL_EXIT - JIT_LABEL_RETURN] = c->a.size;
+  x86_mov_ri(&c->a, X86_RAX, 0);
+  c->labels[JIT_LABEL_RETURN - JIT_LABEL_RETURN] = c->a.size;
+  x86_test_abs(&c->a, safepoint_poll_address(), X86_RAX);
+  x86_alu_mi(&c->a, 0, X86_SUB, X86_RBX, depth_disp, 1);
+  x86_lea(&c->a, X86_RSP, X86_RBP, -8);
+  x86_pop(&c->a, X86_RBX);
+  x86_pop(&c->a, X86_RBP);
+  x86_ret(&c->a);
+
+  for (k = 0; k < c->fixup_count; k++) {
+    uint32_t target = c->fixups[k].target;
+    x86_patch_jump(&c->a, c->fixups[k].at,
+                   target >= JIT_LABEL_RETURN
+                       ? c->labels[target - JIT_LABEL_RETURN]
+                       : c->native[target]);
+  }
+}
+
+/*
+ * First call through a site: resolves and initializes the callee,
+ * then runs it. Once the callee is compiled the site calls it directly
+ */
+static int64_t call_slow(struct interp_thread* thread, union java_value* args,
+                         struct jit_call_site* site) {
+  struct class_file* holder = site->holder;
+  struct method_info* method = site->method;
+  struct method_runtime* mr;
+  compiled_entry compiled;
+  union java_value result;
+  int err;
+
+  /* the receiver of a devirtualized call has initialized the holder */
+  if (method == NULL) {
+    struct cp_cache_entry* entry =
+        interp_resolve_member(thread, site->class, site->index, 0);
+    if (entry == NULL) {
+      return 0;
+    }
+    if (!(entry->method->access_flags & ACC_STATIC)) {
+      interp_throw(thread, "java/lang/IncompatibleClassChangeError");
+      return 0;
+    }
+    if (interp_init_class(thread, entry->class) != 0) {
+      return 0;
+    }
+    holder = entry->class;
+    method = entry->method;
+  }
+
+  mr = method_runtime_of(holder, method);
+  compiled = atomic_load_explicit(&mr->entry, memory_order_acquire);
+  if (compiled != NULL && holder->runtime->init_state == CLASS_INITIALIZED) {
+    /* the entry ignores the site argument in rdx */
+    atomic_store_explicit(&site->target,
+                          (jit_call_target)(void (*)(void))compiled,
+                          memory_order_release);
+    return compiled(thread, args);
+  }
+
+  result.j = 0;
+  err = interpret(thread, holder, method, args, &result);
+  if (err != 0 && err != INTERP_EXCEPTION) {
+    interp_throw(thread, "java/lang/InternalError");
+  }
+  return err == 0 && mr->ret != 'V' ? result.i : 0;
+}
+
+void jit_call_site_init(struct jit_call_site* site, struct class_file* class,
+                        uint16_t index) {
+  atomic_init(&site->target, call_slow);
+  site->class = class;
+  site->index = index;
+  site->method = NULL;
+  site->holder = NULL;
+}
+
+void jit_retarget_sites(struct jit_method* methods, compiled_entry from,
+                        compiled_entry to) {
+  jit_call_target old = (jit_call_target)(void (*)(void))from;
+  struct jit_method* compiled;
+
+  for (compiled = methods; compiled != NULL; compiled = compiled->next) {
+    uint32_t i;
+    for (i = 0; i < compiled->site_count; i++) {
+      jit_call_target expected = old;
+      /* sites still at call_slow or at another callee keep their target */
+      atomic_compare_exchange_strong_explicit(
+          &compiled->sites[i].target, &expected,
+          (jit_call_target)(void (*)(void))to, memory_order_release,
+          memory_order_relaxed);
+    }
+  }
+}
+
+static void free_compiler(struct jit_compiler* c) {
+  x86_destroy(&c->a);
+  free(c->depth);
+  free(c->flags);
+  free(c->native);
+  free(c->worklist);
+  free(c->fixups);
+}
+
+static int compile_method(struct template_jit* jit, struct class_file* class,
+                          struct method_info* method) {
+  struct method_runtime* mr = method_runtime_of(class, method);
+  struct jit_compiler c;
+  struct method_descriptor desc;
+  struct jit_method* compiled;
+  uint32_t length;
+  void* code;
+  int err;
+
+  if (method->code == NULL || method->code->exception_table_length != 0 ||
+      (method->access_flags & (ACC_SYNCHRONIZED | ACC_STATIC)) !=
+          ACC_STATIC ||
+      !int_descriptor(validate_constant(class, method->descriptor_index),
+                      &desc)) {
+    return ENOTSUP;
+  }
+
+  memset(&c, 0, sizeof(c));
+  c.jit = jit;
+  c.class = class;
+  c.method = method;
+  c.mr = mr;
+  c.code = method->code;
+  x86_init(&c.a);
+  length = c.code->code_length;
+  c.depth = malloc((length + 1u) * sizeof(int32_t));
+  c.flags = calloc(length + 1u, 1);
+  c.native = calloc(length + 1u, sizeof(size_t));
+  c.worklist = malloc((length + 1u) * sizeof(uint32_t));
+  if (c.depth == NULL || c.flags == NULL || c.native == NULL ||
+      c.worklist == NULL) {
+    free_compiler(&c);
+    printf("ERROR: can't allocate memory for compiler\n");
+    return ENOMEM;
+  }
+
+  err = analyze(&c);
+  if (err != 0) {
+    free_compiler(&c);
+    return err == EINVAL ? ENOTSUP : err;
+  }
+
+  compiled = calloc(1, sizeof(struct jit_method));
+  c.sites = calloc(c.site_count + 1u, sizeof(struct jit_call_site));
+  if (compiled == NULL || c.sites == NULL) {
+    free(compiled);
+    free(c.sites);
+    free_compiler(&c);
+    printf("ERROR: can't allocate memory for compiled method\n");
+    return ENOMEM;
+  }
+  emit_method(&c, mr->arg_slots);
+  code = c.a.error ? NULL
+                   : code_cache_install(&jit->cache, c.a.code, c.a.size);
+  if (code == NULL) {
+    if (!c.a.error) {
+      printf("ERROR: code cache is full\n");
+    }
+    free(compiled);
+    free(c.sites);
+    free_compiler(&c);
+    return ENOMEM;
+  }
+
+  compiled->class = class;
+  compiled->method = method;
+  compiled->code = code;
+  compiled->code_size = c.a.size;
+  compiled->sites = c.sites;
+  compiled->site_count = c.site_count;
+  compiled->next = jit->methods;
+  jit->methods = compiled;
+  jit->stats.code_bytes += c.a.size;
+  free_compiler(&c);
+
+  atomic_store_explicit(&mr->entry, (compiled_entry)code,
+                        memory_order_release);
+  return 0;
+}
+
+int template_jit_compile(struct template_jit* jit, struct class_file* class,
+                         struct method_info* method) {
+  struct method_runtime* mr = method_runtime_of(class, method);
+  uint64_t start = now_ns();
+  int err = 0;
+
+  pthread_mutex_lock(&jit->lock);
+  if (atomic_load_explicit(&mr->entry, memory_order_relaxed) == NULL &&
+      !(atomic_load_explicit(&mr->flags, memory_order_relaxed) &
+        METHOD_NOT_COMPILABLE)) {
+    err = compile_method(jit, class, method);
+    if (err == 0) {
+      jit->stats.compiled++;
+    } else if (err == ENOTSUP) {
+      atomic_fetch_or_explicit(&mr->flags, METHOD_NOT_COMPILABLE,
+                               memory_order_relaxed);
+      jit->stats.rejected++;
+    }
+    jit->stats.compile_ns += now_ns() - start;
+  }
+  pthread_mutex_unlock(&jit->lock);
+  return err;
+}
+
+void template_jit_retarget(struct template_jit* jit, compiled_entry from,
+                           compiled_entry to) {
+  pthread_mutex_lock(&jit->lock);
+  jit_retarget_sites(jit->methods, from, to);
+  pthread_mutex_unlock(&jit->lock);
+}
+
+static void compile_hot(struct interp_thread* thread, struct class_file* class,
+                        struct method_info* method, void* ctx) {
+  (void)thread;
+  template_jit_compile(ctx, class, method);
+}
+
+int template_jit_init(struct template_jit* jit, struct interpreter* interp,
+                      size_t code_size) {
+  int err;
+
+  memset(jit, 0, sizeof(*jit));
+  jit->interp = interp;
+  err = code_cache_init(&jit->cache, code_size);
+  if (err != 0) {
+    return err;
+  }
+  err = pthread_mutex_init(&jit->lock, NULL);
+  if (err != 0) {
+    code_cache_destroy(&jit->cache);
+    return err;
+  }
+  interp->hot_method = compile_hot;
+  interp->hot_loop = NULL;
+  interp->hot_ctx = jit;
+  return 0;
+}
+
+void template_jit_destroy(struct template_jit* jit) {
+  struct jit_method* compiled = jit->methods;
+
+  while (compiled != NULL) {
+    struct jit_method* next = compiled->next;
+    /* the class may outlive the compiler, send it back to interpreter */
+    if (compiled->class->runtime != NULL) {
+      compiled_entry entry = (compiled_entry)compiled->code;
+      /* unless the optimizing compiler replaced it */
+      atomic_compare_exchange_strong_explicit(
+          &method_runtime_of(compiled->class, compiled->method)->entry,
+          &entry, NULL, memory_order_release, memory_order_relaxed);
+    }
+    free(compiled->sites);
+    free(compiled);
+    compiled = next;
+  }
+  if (jit->interp->hot_ctx == jit) {
+    jit->interp->hot_method = NULL;
+    jit->interp->hot_loop = NULL;
+    jit->interp->hot_ctx = NULL;
+  }
+  pthread_mutex_destroy(&jit->lock);
+  code_cache_destroy(&jit->cache);
+  memset(jit, 0, sizeof(*jit));
+}
+
+void template_jit_print_stats(const struct template_jit* jit) {
+  const struct template_jit_stats* stats = &jit->stats;
+
+  printf("template jit: compiled=%llu rejected=%llu code=%llu bytes "
+         "(%zu of %zu used) compile time=%.3f ms\n",
+         (unsigned long long)stats->compiled,
+         (unsigned long long)stats->rejected,
+         (unsigned long long)stats->code_bytes, jit->cache.used,
+         jit->cache.size, (double)stats->compile_ns / 1e6);
+}
@@ -0,0 +1,431 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "tiering.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static uint32_t or_default(uint32_t value, uint32_t fallback) {
+  return value != 0 ? value : fallback;
+}
+
+static uint64_t hotness(struct method_runtime* mr) {
+  return (uint64_t)atomic_load_explicit(&mr->invocations,
+                                        memory_order_relaxed) +
+         atomic_load_explicit(&mr->backedges, memory_order_relaxed);
+}
+
+/* Tier the method should be compiled for next, TIER_INTERPRETED if none */
+static int next_tier(const struct tier_policy* policy,
+                     struct method_runtime* mr) {
+  int flags = atomic_load_explicit(&mr->flags, memory_order_relaxed);
+
+  if (flags & METHOD_OPTIMIZED) {
+    return TIER_INTERPRETED;
+  }
+  if (policy->baseline != NULL && !(flags & METHOD_NOT_COMPILABLE) &&
+      atomic_load_explicit(&mr->entry, memory_order_relaxed) == NULL) {
+    return TIER_BASELINE;
+  }
+  if (policy->opt != NULL && !(flags & METHOD_NOT_OPTIMIZABLE)) {
+    return TIER_OPTIMIZED;
+  }
+  return TIER_INTERPRETED;
+}
+
+/* The max-heap is ordered on hotness, the hottest request is at 0 */
+static void sift_up(struct tier_request* queue, uint32_t i) {
+  while (i > 0) {
+    uint32_t parent = (i - 1) / 2;
+    struct tier_request swap;
+
+    if (queue[parent].hotness >= queue[i].hotness) {
+      break;
+    }
+    swap = queue[parent];
+    queue[parent] = queue[i];
+    queue[i] = swap;
+    i = parent;
+  }
+}
+
+static void sift_down(struct tier_request* queue, uint32_t length,
+                      uint32_t i) {
+  for (;;) {
+    uint32_t largest = i;
+    uint32_t left = 2 * i + 1;
+    uint32_t right = left + 1;
+    struct tier_request swap;
+
+    if (left < length && queue[left].hotness > queue[largest].hotness) {
+      largest = left;
+    }
+    if (right < length && queue[right].hotness > queue[largest].hotness) {
+      largest = right;
+    }
+    if (largest == i) {
+      break;
+    }
+    swap = queue[largest];
+    queue[largest] = queue[i];
+    queue[i] = swap;
+    i = largest;
+  }
+}
+
+static int queued_flag(int32_t osr_bci) {
+  return osr_bci < 0 ? METHOD_QUEUED : METHOD_OSR_QUEUED;
+}
+
+/*
+ * Queues the method, the caller holds the lock and has set its queued
+ * flag. A full queue drops the request and restarts the counters so
+ * that the method asks again later
+ */
+static void push_request(struct tier_policy* policy, struct class_file* class,
+                         struct method_info* method, int tier,
+                         int32_t osr_bci) {
+  struct method_runtime* mr = method_runtime_of(class, method);
+  struct tier_request* request;
+
+  if (policy->queue_length == policy->config.queue_capacity ||
+      policy->stopping) {
+    policy->stats.dropped++;
+    atomic_store_explicit(&mr->invocations, 0, memory_order_relaxed);
+    atomic_store_explicit(&mr->backedges, 0, memory_order_relaxed);
+    atomic_fetch_and_explicit(&mr->flags, ~queued_flag(osr_bci),
+                              memory_order_relaxed);
+    return;
+  }
+  request = &policy->queue[policy->queue_length];
+  request->class = class;
+  request->method = method;
+  request->hotness = hotness(mr);
+  request->tier = tier;
+  request->osr_bci = osr_bci;
+  sift_up(policy->queue, policy->queue_length);
+  policy->queue_length++;
+  policy->stats.queued++;
+  policy->stats.queue_length = policy->queue_length;
+  if (policy->queue_length > policy->stats.max_queue_length) {
+    policy->stats.max_queue_length = policy->queue_length;
+  }
+  pthread_cond_signal(&policy->wake);
+}
+
+/* Hot method hook, runs on the mutator and never compiles */
+static void on_hot(struct interp_thread* thread, struct class_file* class,
+                   struct method_info* method, void* ctx) {
+  struct tier_policy* policy = ctx;
+  struct method_runtime* mr = method_runtime_of(class, method);
+  int tier = next_tier(policy, mr);
+
+  (void)thread;
+  if (tier == TIER_INTERPRETED ||
+      (atomic_fetch_or_explicit(&mr->flags, METHOD_QUEUED,
+                                memory_order_relaxed) &
+       METHOD_QUEUED)) {
+    return;
+  }
+  pthread_mutex_lock(&policy->lock);
+  push_request(policy, class, method, tier, -1);
+  pthread_mutex_unlock(&policy->lock);
+}
+
+/* Hot loop hook, asks for an OSR entry at the loop header */
+static void on_hot_loop(struct interp_thread* thread, struct class_file* class,
+                        struct method_info* method, uint32_t bci, void* ctx) {
+  struct tier_policy* policy = ctx;
+  struct method_runtime* mr = method_runtime_of(class, method);
+
+  (void)thread;
+  if (policy->opt == NULL ||
+      (atomic_fetch_or_explicit(&mr->flags, METHOD_OSR_QUEUED,
+                                memory_order_relaxed) &
+       METHOD_OSR_QUEUED)) {
+    return;
+  }
+  pthread_mutex_lock(&policy->lock);
+  push_request(policy, class, method, TIER_OPTIMIZED, (int32_t)bci);
+  pthread_mutex_unlock(&policy->lock);
+}
+
+static int compile(struct tier_policy* policy,
+                   const struct tier_request* request) {
+  if (request->osr_bci >= 0) {
+    return opt_jit_compile_osr(policy->opt, request->class, request->method,
+                               (uint32_t)request->osr_bci);
+  }
+  if (request->tier == TIER_BASELINE) {
+    return template_jit_compile(policy->baseline, request->class,
+                                request->method);
+  }
+  return opt_jit_compile(policy->opt, request->class, request->method);
+}
+
+/*
+ * Bookkeeping after a compile, under the lock. Returns the tier to
+ * queue the method for again, TIER_INTERPRETED if none
+ */
+static int finish_request(struct tier_policy* policy,
+                          const struct tier_request* request, int from,
+                          int err, uint64_t elapsed) {
+  struct method_runtime* mr =
+      method_runtime_of(request->class, request->method);
+  struct tier_stats* stats = &policy->stats;
+  int tier = request->tier;
+
+  if (request->osr_bci >= 0) {
+    stats->osr_compile_ns += elapsed;
+    if (err != 0) {
+      stats->osr_failed++;
+    } else {
+      stats->osr_compiled++;
+    }
+    return TIER_INTERPRETED;
+  }
+  stats->compile_ns[tier] += elapsed;
+  if (elapsed > stats->max_compile_ns[tier]) {
+    stats->max_compile_ns[tier] = elapsed;
+  }
+  if (err != 0) {
+    stats->failed[tier]++;
+    /* the optimizing compiler covers more than the baseline one */
+    return err == ENOTSUP ? next_tier(policy, mr) : TIER_INTERPRETED;
+  }
+  stats->compiled[tier]++;
+  stats->transitions[from][tier]++;
+  /*
+   * Baseline code counts from zero up to the optimizing thresholds.
+   * Frames still in the interpreter cross the baseline thresholds
+   * again and ask for the next tier
+   */
+  if (tier == TIER_BASELINE) {
+    atomic_store_explicit(&mr->invocations, 0, memory_order_relaxed);
+    atomic_store_explicit(&mr->backedges, 0, memory_order_relaxed);
+  }
+  return TIER_INTERPRETED;
+}
+
+static void* compiler_main(void* arg) {
+  struct tier_policy* policy = arg;
+
+  pthread_mutex_lock(&policy->lock);
+  for (;;) {
+    struct tier_request request;
+    struct method_runtime* mr;
+    compiled_entry previous;
+    compiled_entry entry;
+    uint64_t start;
+    int again;
+    int err;
+
+    while (policy->queue_length == 0 && !policy->stopping) {
+      pthread_cond_wait(&policy->wake, &policy->lock);
+    }
+    if (policy->stopping) {
+      break;
+    }
+    request = policy->queue[0];
+    policy->queue_length--;
+    policy->queue[0] = policy->queue[policy->queue_length];
+    sift_down(policy->queue, policy->queue_length, 0);
+    policy->stats.queue_length = policy->queue_length;
+    policy->active++;
+    pthread_mutex_unlock(&policy->lock);
+
+    mr = method_runtime_of(request.class, request.method);
+    previous = atomic_load_explicit(&mr->entry, memory_order_acquire);
+    start = now_ns();
+    err = compile(policy, &request);
+    entry = atomic_load_explicit(&mr->entry, memory_order_acquire);
+    /* baseline callers that bound the old code move on */
+    if (err == 0 && request.tier == TIER_OPTIMIZED && request.osr_bci < 0 &&
+        previous != NULL && policy->baseline != NULL) {
+      template_jit_retarget(policy->baseline, previous, entry);
+    }
+
+    pthread_mutex_lock(&policy->lock);
+    again = finish_request(policy, &request,
+                           previous != NULL ? TIER_BASELINE : TIER_INTERPRETED,
+                           err, now_ns() - start);
+    if (again != TIER_INTERPRETED) {
+      push_request(policy, request.class, request.method, again, -1);
+    } else {
+      atomic_fetch_and_explicit(&mr->flags, ~queued_flag(request.osr_bci),
+                                memory_order_relaxed);
+    }
+    policy->active--;
+    if (policy->queue_length == 0 && policy->active == 0) {
+      pthread_cond_broadcast(&policy->idle);
+    }
+  }
+  pthread_mutex_unlock(&policy->lock);
+  return NULL;
+}
+
+static void stop_threads(struct tier_policy* policy) {
+  uint32_t i;
+
+  pthread_mutex_lock(&policy->lock);
+  policy->stopping = 1;
+  pthread_cond_broadcast(&policy->wake);
+  pthread_mutex_unlock(&policy->lock);
+  for (i = 0; i < policy->thread_count; i++) {
+    pthread_join(policy->threads[i], NULL);
+  }
+  policy->thread_count = 0;
+}
+
+int tier_policy_init(struct tier_policy* policy, struct interpreter* interp,
+                     struct template_jit* baseline, struct opt_jit* opt,
+                     const struct tier_config* config) {
+  struct tier_config* c = &policy->config;
+  uint32_t threads;
+  int err;
+
+  memset(policy, 0, sizeof(*policy));
+  policy->interp = interp;
+  policy->baseline = baseline;
+  policy->opt = opt;
+  if (config != NULL) {
+    *c = *config;
+  }
+  c->baseline_invocations =
+      or_default(c->baseline_invocations, TIER_DEFAULT_BASELINE_INVOCATIONS);
+  c->baseline_backedges =
+      or_default(c->baseline_backedges, TIER_DEFAULT_BASELINE_BACKEDGES);
+  c->opt_invocations =
+      or_default(c->opt_invocations, TIER_DEFAULT_OPT_INVOCATIONS);
+  c->opt_backedges = or_default(c->opt_backedges, TIER_DEFAULT_OPT_BACKEDGES);
+  c->osr_backedges = or_default(c->osr_backedges, TIER_DEFAULT_OSR_BACKEDGES);
+  c->compiler_threads =
+      or_default(c->compiler_threads, TIER_DEFAULT_COMPILER_THREADS);
+  c->queue_capacity =
+      or_default(c->queue_capacity, TIER_DEFAULT_QUEUE_CAPACITY);
+
+  policy->queue = calloc(c->queue_capacity, sizeof(struct tier_request));
+  policy->threads = calloc(c->compiler_threads, sizeof(pthread_t));
+  if (policy->queue == NULL || policy->threads == NULL) {
+    free(policy->queue);
+    free(policy->threads);
+    printf("ERROR: can't allocate memory for compile queue\n");
+    return ENOMEM;
+  }
+  pthread_mutex_init(&policy->lock, NULL);
+  pthread_cond_init(&policy->wake, NULL);
+  pthread_cond_init(&policy->idle, NULL);
+
+  for (threads = 0; threads < c->compiler_threads; threads++) {
+    err = pthread_create(&policy->threads[threads], NULL, compiler_main,
+                         policy);
+    if (err != 0) {
+      printf("ERROR: can't start compiler thread\n");
+      policy->thread_count = threads;
+      stop_threads(policy);
+      pthread_cond_destroy(&policy->idle);
+      pthread_cond_destroy(&policy->wake);
+      pthread_mutex_destroy(&policy->lock);
+      free(policy->queue);
+      free(policy->threads);
+      return err;
+    }
+  }
+  policy->thread_count = threads;
+
+  /* the interpreter leads to the lowest tier there is */
+  if (baseline != NULL) {
+    interp->hot_invocations = c->baseline_invocations;
+    interp->hot_backedges = c->baseline_backedges;
+    baseline->hot_invocations = opt != NULL ? c->opt_invocations : 0;
+    baseline->hot_backedges = opt != NULL ? c->opt_backedges : 0;
+  } else {
+    interp->hot_invocations = c->opt_invocations;
+    interp->hot_backedges = c->opt_backedges;
+  }
+  interp->osr_backedges = c->osr_backedges;
+  interp->hot_method = on_hot;
+  interp->hot_loop = on_hot_loop;
+  interp->hot_ctx = policy;
+  return 0;
+}
+
+void tier_policy_destroy(struct tier_policy* policy) {
+  uint32_t i;
+
+  if (policy->interp->hot_ctx == policy) {
+    policy->interp->hot_method = NULL;
+    policy->interp->hot_loop = NULL;
+    policy->interp->hot_ctx = NULL;
+  }
+  if (policy->baseline != NULL) {
+    policy->baseline->hot_invocations = 0;
+    policy->baseline->hot_backedges = 0;
+  }
+  stop_threads(policy);
+  for (i = 0; i < policy->queue_length; i++) {
+    struct tier_request* request = &policy->queue[i];
+    atomic_fetch_and_explicit(
+        &method_runtime_of(request->class, request->method)->flags,
+        ~queued_flag(request->osr_bci), memory_order_relaxed);
+  }
+  pthread_cond_destroy(&policy->idle);
+  pthread_cond_destroy(&policy->wake);
+  pthread_mutex_destroy(&policy->lock);
+  free(policy->queue);
+  free(policy->threads);
+  memset(policy, 0, sizeof(*policy));
+}
+
+void tier_policy_drain(struct tier_policy* policy) {
+  pthread_mutex_lock(&policy->lock);
+  while (policy->queue_length != 0 || policy->active != 0) {
+    pthread_cond_wait(&policy->idle, &policy->lock);
+  }
+  pthread_mutex_unlock(&policy->lock);
+}
+
+void tier_policy_stats(struct tier_policy* policy, struct tier_stats* stats) {
+  pthread_mutex_lock(&policy->lock);
+  *stats = policy->stats;
+  pthread_mutex_unlock(&policy->lock);
+}
+
+void tier_policy_print_stats(struct tier_policy* policy) {
+  static const char* const names[] = {"interpreter", "baseline", "opt"};
+  struct tier_stats stats;
+  int tier;
+
+  tier_policy_stats(policy, &stats);
+  printf("tiering: queued=%llu dropped=%llu queue=%u (max %u) threads=%u\n",
+         (unsigned long long)stats.queued, (unsigned long long)stats.dropped,
+         stats.queue_length, stats.max_queue_length, policy->thread_count);
+  for (tier = TIER_BASELINE; tier < TIER_COUNT; tier++) {
+    printf("  %-8s compiled=%llu failed=%llu time=%.3f ms (max %.3f ms)\n",
+           names[tier], (unsigned long long)stats.compiled[tier],
+           (unsigned long long)stats.failed[tier],
+           (double)stats.compile_ns[tier] / 1e6,
+           (double)stats.max_compile_ns[tier] / 1e6);
+  }
+  printf("  osr      compiled=%llu failed=%llu time=%.3f ms\n",
+         (unsigned long long)stats.osr_compiled,
+         (unsigned long long)stats.osr_failed,
+         (double)stats.osr_compile_ns / 1e6);
+  printf("  transitions: %s->%s=%llu %s->%s=%llu %s->%s=%llu\n", names[0],
+         names[1],
+         (unsigned long long)stats.transitions[TIER_INTERPRETED][TIER_BASELINE],
+         names[1], names[2],
+         (unsigned long long)stats.transitions[TIER_BASELINE][TIER_OPTIMIZED],
+         names[0], names[2],
+         (unsigned long long)
+             stats.transitions[TIER_INTERPRETED][TIER_OPTIMIZED]);
+}
@@ -0,0 +1,1692 @@
+#include "verifier.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "attribute_info.h"
+#include "class_layout.h"
+#include "classfile_parser.h"
+#include "hash.h"
+#include "opcodes.h"
+
+/*
+ * Names every class has ids for: the primitive array elements, which
+ * have no bytes so no class name matches them, then the supertypes of
+ * all arrays
+ */
+enum {
+  NAME_B,
+  NAME_C,
+  NAME_D,
+  NAME_F,
+  NAME_I,
+  NAME_J,
+  NAME_S,
+  NAME_Z,
+  NAME_OBJECT,
+  NAME_CLONEABLE,
+  NAME_SERIALIZABLE,
+  NAME_PRESET,
+};
+
+static const char primitive_letters[] = "BCDFIJSZ";
+static const char* const preset_names[NAME_PRESET] = {
+    [NAME_OBJECT] = "java/lang/Object",
+    [NAME_CLONEABLE] = "java/lang/Cloneable",
+    [NAME_SERIALIZABLE] = "java/io/Serializable",
+};
+
+#define VT_TOP VTYPE(ITEM_Top, 0)
+#define VT_INT VTYPE(ITEM_Integer, 0)
+#define VT_FLOAT VTYPE(ITEM_Float, 0)
+#define VT_LONG VTYPE(ITEM_Long, 0)
+#define VT_DOUBLE VTYPE(ITEM_Double, 0)
+#define VT_NULL VTYPE(ITEM_Null, 0)
+#define VT_UNINIT_THIS VTYPE(ITEM_UninitializedThis, 0)
+#define VT_OBJECT VTYPE_OBJECT(NAME_OBJECT, 0)
+
+/*
+ * Stack effect of the instructions with fixed operand types:
+ * popped types from the bottom up, ':' and the pushed type.
+ * I int, F float, J long, D double, A initialized reference, N null.
+ * Array instructions depend on the array type, see array_instruction()
+ */
+static const char* const signatures[OPCODE_COUNT] = {
+    [OP_NOP] = ":",
+    [OP_ACONST_NULL] = ":N",
+    [OP_ICONST_M1] = ":I",
+    [OP_ICONST_0] = ":I",
+    [OP_ICONST_1] = ":I",
+    [OP_ICONST_2] = ":I",
+    [OP_ICONST_3] = ":I",
+    [OP_ICONST_4] = ":I",
+    [OP_ICONST_5] = ":I",
+    [OP_LCONST_0] = ":J",
+    [OP_LCONST_1] = ":J",
+    [OP_FCONST_0] = ":F",
+    [OP_FCONST_1] = ":F",
+    [OP_FCONST_2] = ":F",
+    [OP_DCONST_0] = ":D",
+    [OP_DCONST_1] = ":D",
+    [OP_BIPUSH] = ":I",
+    [OP_SIPUSH] = ":I",
+    [OP_IADD] = "II:I",
+    [OP_LADD] = "JJ:J",
+    [OP_FADD] = "FF:F",
+    [OP_DADD] = "DD:D",
+    [OP_ISUB] = "II:I",
+    [OP_LSUB] = "JJ:J",
+    [OP_FSUB] = "FF:F",
+    [OP_DSUB] = "DD:D",
+    [OP_IMUL] = "II:I",
+    [OP_LMUL] = "JJ:J",
+    [OP_FMUL] = "FF:F",
+    [OP_DMUL] = "DD:D",
+    [OP_IDIV] = "II:I",
+    [OP_LDIV] = "JJ:J",
+    [OP_FDIV] = "FF:F",
+    [OP_DDIV] = "DD:D",
+    [OP_IREM] = "II:I",
+    [OP_LREM] = "JJ:J",
+    [OP_FREM] = "FF:F",
+    [OP_DREM] = "DD:D",
+    [OP_INEG] = "I:I",
+    [OP_LNEG] = "J:J",
+    [OP_FNEG] = "F:F",
+    [OP_DNEG] = "D:D",
+    [OP_ISHL] = "II:I",
+    [OP_LSHL] = "JI:J",
+    [OP_ISHR] = "II:I",
+    [OP_LSHR] = "JI:J",
+    [OP_IUSHR] = "II:I",
+    [OP_LUSHR] = "JI:J",
+    [OP_IAND] = "II:I",
+    [OP_LAND] = "JJ:J",
+    [OP_IOR] = "II:I",
+    [OP_LOR] = "JJ:J",
+    [OP_IXOR] = "II:I",
+    [OP_LXOR] = "JJ:J",
+    [OP_I2L] = "I:J",
+    [OP_I2F] = "I:F",
+    [OP_I2D] = "I:D",
+    [OP_L2I] = "J:I",
+    [OP_L2F] = "J:F",
+    [OP_L2D] = "J:D",
+    [OP_F2I] = "F:I",
+    [OP_F2L] = "F:J",
+    [OP_F2D] = "F:D",
+    [OP_D2I] = "D:I",
+    [OP_D2L] = "D:J",
+    [OP_D2F] = "D:F",
+    [OP_I2B] = "I:I",
+    [OP_I2C] = "I:I",
+    [OP_I2S] = "I:I",
+    [OP_LCMP] = "JJ:I",
+    [OP_FCMPL] = "FF:I",
+    [OP_FCMPG] = "FF:I",
+    [OP_DCMPL] = "DD:I",
+    [OP_DCMPG] = "DD:I",
+    [OP_IFEQ] = "I:",
+    [OP_IFNE] = "I:",
+    [OP_IFLT] = "I:",
+    [OP_IFGE] = "I:",
+    [OP_IFGT] = "I:",
+    [OP_IFLE] = "I:",
+    [OP_IF_ICMPEQ] = "II:",
+    [OP_IF_ICMPNE] = "II:",
+    [OP_IF_ICMPLT] = "II:",
+    [OP_IF_ICMPGE] = "II:",
+    [OP_IF_ICMPGT] = "II:",
+    [OP_IF_ICMPLE] = "II:",
+    [OP_IF_ACMPEQ] = "AA:",
+    [OP_IF_ACMPNE] = "AA:",
+    [OP_GOTO] = ":",
+    [OP_TABLESWITCH] = "I:",
+    [OP_LOOKUPSWITCH] = "I:",
+    [OP_ATHROW] = "A:",
+    [OP_INSTANCEOF] = "A:I",
+    [OP_MONITORENTER] = "A:",
+    [OP_MONITOREXIT] = "A:",
+    [OP_IFNULL] = "A:",
+    [OP_IFNONNULL] = "A:",
+    [OP_GOTO_W] = ":",
+};
+
+static int fail(struct verifier* v, uint32_t bci, const char* message) {
+  struct UTF8_info* name = validate_constant(v->class, v->method->name_index);
+
+  printf("ERROR: VerifyError in %.*s at bci %u: %s\n",
+         name != NULL ? name->lenght : 0,
+         name != NULL ? (const char*)name->bytes : "", bci, message);
+  return EINVAL;
+}
+
+static int is_wide(vtype type) {
+  return type == VT_LONG || type == VT_DOUBLE;
+}
+
+static int is_reference(vtype type) {
+  uint8_t tag = VTYPE_TAG(type);
+  return tag == ITEM_Object || tag == ITEM_Null ||
+         tag == ITEM_UninitializedThis || tag == ITEM_Uninitialized;
+}
+
+static int is_initialized_reference(vtype type) {
+  return VTYPE_TAG(type) == ITEM_Object || type == VT_NULL;
+}
+
+static int is_primitive_name(uint16_t name) {
+  return name < NAME_OBJECT;
+}
+
+static vtype kind_type(char kind) {
+  switch (kind) {
+    case 'J':
+      return VT_LONG;
+    case 'D':
+      return VT_DOUBLE;
+    case 'F':
+      return VT_FLOAT;
+    case 'L':
+    case 'A':
+      return VT_OBJECT;
+    case 'N':
+      return VT_NULL;
+    default:
+      return VT_INT;
+  }
+}
+
+/* Grows a reused buffer, NULL when out of memory */
+static void* ensure_capacity(void* buffer, size_t* capacity, size_t needed,
+                             size_t element) {
+  void* grown;
+
+  if (needed <= *capacity) {
+    return buffer;
+  }
+  if (needed < *capacity * 2) {
+    needed = *capacity * 2;
+  }
+  grown = realloc(buffer, needed * element);
+  if (grown == NULL) {
+    printf("ERROR: can't allocate memory for the verifier\n");
+    return NULL;
+  }
+  *capacity = needed;
+  return grown;
+}
+
+void verifier_init(struct verifier* verifier) {
+  memset(verifier, 0, sizeof(*verifier));
+}
+
+void verifier_destroy(struct verifier* verifier) {
+  free(verifier->frames);
+  free(verifier->frame_types);
+  free(verifier->locals);
+  free(verifier->names);
+  free(verifier->name_slots);
+  memset(verifier, 0, sizeof(*verifier));
+}
+
+/* Class names */
+
+static uint32_t name_slot(const uint8_t* bytes, uint16_t length,
+                          uint32_t mask) {
+  return (uint32_t)hash64(bytes, length, 0) & mask;
+}
+
+/* Doubles the hash slots, the primitive names have none */
+static int grow_name_slots(struct verifier* v) {
+  uint32_t mask = v->name_slots_mask * 2 + 1;
+  uint32_t* slots = calloc((size_t)mask + 1, sizeof(uint32_t));
+  uint32_t i;
+
+  if (slots == NULL) {
+    printf("ERROR: can't allocate memory for the verifier\n");
+    return ENOMEM;
+  }
+  for (i = 0; i < v->name_count; i++) {
+    const struct verifier_name* name = &v->names[i];
+    uint32_t slot;
+
+    if (name->bytes == NULL) {
+      continue;
+    }
+    slot = name_slot(name->bytes, name->length, mask);
+    while (slots[slot] != 0) {
+      slot = (slot + 1) & mask;
+    }
+    slots[slot] = i + 1;
+  }
+  free(v->name_slots);
+  v->name_slots = slots;
+  v->name_slots_mask = mask;
+  return 0;
+}
+
+static int intern_name(struct verifier* v, const uint8_t* bytes,
+                       uint16_t length, uint16_t* id) {
+  struct verifier_name* names;
+  uint32_t slot = name_slot(bytes, length, v->name_slots_mask);
+
+  while (v->name_slots[slot] != 0) {
+    const struct verifier_name* name = &v->names[v->name_slots[slot] - 1];
+    if (name->length == length && memcmp(name->bytes, bytes, length) == 0) {
+      *id = (uint16_t)(v->name_slots[slot] - 1);
+      return 0;
+    }
+    slot = (slot + 1) & v->name_slots_mask;
+  }
+
+  if (v->name_count > UINT16_MAX) {
+    printf("ERROR: too many class names to verify\n");
+    return EINVAL;
+  }
+  names = ensure_capacity(v->names, &v->names_capacity, v->name_count + 1u,
+                          sizeof(struct verifier_name));
+  if (names == NULL) {
+    return ENOMEM;
+  }
+  v->names = names;
+  /* keep the slots at most half full */
+  if ((v->name_count + 1) * 2 > v->name_slots_mask + 1) {
+    int err = grow_name_slots(v);
+    if (err != 0) {
+      return err;
+    }
+    slot = name_slot(bytes, length, v->name_slots_mask);
+    while (v->name_slots[slot] != 0) {
+      slot = (slot + 1) & v->name_slots_mask;
+    }
+  }
+  *id = (uint16_t)v->name_count;
+  v->names[v->name_count++] = (struct verifier_name){bytes, length};
+  v->name_slots[slot] = v->name_count;
+  return 0;
+}
+
+/* Drops the names of the last class, they point into its constant pool */
+static int reset_names(struct verifier* v, const struct class_file* class) {
+  struct verifier_name* names;
+  uint32_t i;
+
+  names = ensure_capacity(v->names, &v->names_capacity, NAME_PRESET,
+                          sizeof(struct verifier_name));
+  if (names == NULL) {
+    return ENOMEM;
+  }
+  v->names = names;
+  if (v->name_slots == NULL) {
+    v->name_slots = malloc(256 * sizeof(uint32_t));
+    if (v->name_slots == NULL) {
+      printf("ERROR: can't allocate memory for the verifier\n");
+      return ENOMEM;
+    }
+    v->name_slots_mask = 255;
+  }
+  memset(v->name_slots, 0, (v->name_slots_mask + 1) * sizeof(uint32_t));
+  v->name_count = 0;
+  v->names_class = NULL;
+  for (i = 0; i < NAME_PRESET; i++) {
+    const char* name = preset_names[i];
+    uint16_t id;
+
+    if (name == NULL) {
+      v->names[v->name_count++] = (struct verifier_name){NULL, 0};
+    } else if (intern_name(v, (const uint8_t*)name, (uint16_t)strlen(name),
+                           &id) != 0) {
+      return ENOMEM;
+    }
+  }
+  v->names_class = class;
+  return 0;
+}
+
+/*
+ * Type of the field descriptor at p, returns where it ends or NULL.
+ * Arrays of a primitive keep the id of its name
+ */
+static const uint8_t* descriptor_type(struct verifier* v, const uint8_t* p,
+                                      const uint8_t* end, vtype* type) {
+  const uint8_t* next;
+  uint32_t dims = 0;
+  uint16_t id;
+  char kind;
+
+  next = skip_field_descriptor(p, end, &kind);
+  if (next == NULL) {
+    return NULL;
+  }
+  while (*p == '[') {
+    dims++;
+    p++;
+  }
+  if (dims > UINT8_MAX) {
+    return NULL;
+  }
+  if (*p == 'L') {
+    if (intern_name(v, p + 1, (uint16_t)(next - p - 2), &id) != 0) {
+      return NULL;
+    }
+    *type = VTYPE_OBJECT(id, dims);
+  } else if (dims == 0) {
+    *type = kind_type(kind);
+  } else {
+    id = (uint16_t)(strchr(primitive_letters, *p) - primitive_letters);
+    *type = VTYPE_OBJECT(id, dims);
+  }
+  return next;
+}
+
+/* Type of a CONSTANT_Class, array classes are named by descriptor */
+static int class_type(struct verifier* v, uint16_t index, vtype* type) {
+  struct UTF8_info* name = constant_class_name(v->class, index);
+  const uint8_t* end;
+  uint16_t id;
+  int err;
+
+  if (name == NULL) {
+    return EINVAL;
+  }
+  end = name->bytes + name->lenght;
+  if (name->lenght > 0 && name->bytes[0] == '[') {
+    return descriptor_type(v, name->bytes, end, type) == end ? 0 : EINVAL;
+  }
+  err = intern_name(v, name->bytes, name->lenght, &id);
+  if (err == 0) {
+    *type = VTYPE_OBJECT(id, 0);
+  }
+  return err;
+}
+
+static int literal_type(struct verifier* v, const char* name, vtype* type) {
+  uint16_t id;
+  int err = intern_name(v, (const uint8_t*)name, (uint16_t)strlen(name), &id);
+
+  if (err == 0) {
+    *type = VTYPE_OBJECT(id, 0);
+  }
+  return err;
+}
+
+/* Parameter types and the return type of a valid descriptor, Top for void */
+static int method_types(struct verifier* v, const struct UTF8_info* descriptor,
+                        vtype* args, vtype* ret) {
+  const uint8_t* p = descriptor->bytes + 1;
+  const uint8_t* end = descriptor->bytes + descriptor->lenght;
+
+  while (*p != ')') {
+    p = descriptor_type(v, p, end, args++);
+    if (p == NULL) {
+      return EINVAL;
+    }
+  }
+  if (p[1] == 'V') {
+    *ret = VT_TOP;
+    return 0;
+  }
+  return descriptor_type(v, p + 1, end, ret) == end ? 0 : EINVAL;
+}
+
+/* Class hierarchy */
+
+static int name_is(const struct verifier_name* name, const uint8_t* bytes,
+                   uint16_t length) {
+  return name->length == length && memcmp(name->bytes, bytes, length) == 0;
+}
+
+/* The class being verified or one the resolver knows, NULL if neither */
+static struct class_file* find_class(struct verifier* v, const uint8_t* bytes,
+                                     uint16_t length) {
+  struct UTF8_info* own = constant_class_name(v->class, v->class->this_class);
+
+  if (own != NULL && own->lenght == length &&
+      memcmp(own->bytes, bytes, length) == 0) {
+    return v->class;
+  }
+  return v->resolve(bytes, length, v->resolve_ctx);
+}
+
+/*
+ * Whether class `from` extends class `to`. Assumed until link time
+ * when there is no resolver. Classes the resolver doesn't know, as
+ * the ones the runtime provides itself, are taken on trust
+ */
+static int is_subclass(struct verifier* v, uint16_t from, uint16_t to) {
+  const struct verifier_name* target = &v->names[to];
+  struct class_file* class;
+  uint32_t depth;
+
+  if (from == to || to == NAME_OBJECT) {
+    return 1;
+  }
+  if (v->resolve == NULL) {
+    v->deferred++;
+    return 1;
+  }
+  class = find_class(v, target->bytes, target->length);
+  if (class == NULL || (class->access_flags & ACC_INTERFACE)) {
+    return 1;
+  }
+  class = find_class(v, v->names[from].bytes, v->names[from].length);
+  /* the bound stops a hierarchy that loops */
+  for (depth = 0; depth < UINT16_MAX; depth++) {
+    struct UTF8_info* super;
+
+    if (class == NULL) {
+      return 1;
+    }
+    super = class->super_class != 0
+                ? constant_class_name(class, class->super_class)
+                : NULL;
+    if (super == NULL ||
+        is_string_match((const char*)super->bytes, super->lenght,
+                        "java/lang/Object")) {
+      return 0;
+    }
+    if (name_is(target, super->bytes, super->lenght)) {
+      return 1;
+    }
+    class = find_class(v, super->bytes, super->lenght);
+  }
+  return 0;
+}
+
+/* JVMS 4.10.1.2, interfaces are treated as java/lang/Object */
+static int is_assignable(struct verifier* v, vtype from, vtype to) {
+  uint8_t from_dims = VTYPE_DIMS(from);
+  uint8_t to_dims = VTYPE_DIMS(to);
+  uint16_t from_name = VTYPE_PAYLOAD(from);
+  uint16_t to_name = VTYPE_PAYLOAD(to);
+
+  if (from == to || to == VT_TOP) {
+    return 1;
+  }
+  if (VTYPE_TAG(to) != ITEM_Object || !is_initialized_reference(from)) {
+    return 0;
+  }
+  if (from == VT_NULL) {
+    return 1;
+  }
+  if (to_name == NAME_OBJECT || to_name == NAME_CLONEABLE ||
+      to_name == NAME_SERIALIZABLE) {
+    /* every array is all three */
+    return from_dims > to_dims ||
+           (from_dims == to_dims && !is_primitive_name(from_name));
+  }
+  if (from_dims != to_dims || is_primitive_name(from_name) ||
+      is_primitive_name(to_name)) {
+    return 0;
+  }
+  return is_subclass(v, from_name, to_name);
+}
+
+
+/* Operand stack */
+
+static int push(struct verifier* v, vtype type) {
+  uint16_t slots = is_wide(type) ? 2 : 1;
+
+  if (v->depth + slots > v->code->max_stack) {
+    return fail(v, v->bci, "operand stack overflow");
+  }
+  v->stack[v->depth++] = type;
+  if (slots == 2) {
+    v->stack[v->depth++] = VT_TOP;
+  }
+  return 0;
+}
+
+/* Pops a value assignable to `expected`, returns Top on a mismatch */
+static vtype pop_type(struct verifier* v, vtype expected) {
+  vtype type;
+
+  if (is_wide(expected)) {
+    if (v->depth < 2 || v->stack[v->depth - 1] != VT_TOP ||
+        v->stack[v->depth - 2] != expected) {
+      return VT_TOP;
+    }
+    v->depth -= 2;
+    return expected;
+  }
+  if (v->depth < 1) {
+    return VT_TOP;
+  }
+  type = v->stack[v->depth - 1];
+  if (!is_assignable(v, type, expected) || type == VT_TOP) {
+    return VT_TOP;
+  }
+  v->depth--;
+  return type;
+}
+
+static int pop_kind(struct verifier* v, char kind) {
+  return pop_type(v, kind_type(kind)) == VT_TOP ? EINVAL : 0;
+}
+
+/* Popping a reference that may still be uninitialized */
+static vtype pop_reference(struct verifier* v) {
+  if (v->depth < 1 || !is_reference(v->stack[v->depth - 1])) {
+    return VT_TOP;
+  }
+  return v->stack[--v->depth];
+}
+
+/* A category 2 value must not be split at stack slot `index` */
+static int splits_wide(struct verifier* v, uint16_t index) {
+  return index < v->depth && v->stack[index] == VT_TOP;
+}
+
+/* dup family: copies the top `count` slots `below` slots down */
+static int dup(struct verifier* v, uint16_t count, uint16_t below) {
+  vtype* base;
+
+  if (v->depth < below || v->depth + count > v->code->max_stack ||
+      splits_wide(v, (uint16_t)(v->depth - count)) ||
+      splits_wide(v, (uint16_t)(v->depth - below))) {
+    return EINVAL;
+  }
+  base = v->stack + v->depth - below;
+  memmove(base + count, base, below * sizeof(vtype));
+  memcpy(base, base + below, count * sizeof(vtype));
+  v->depth += count;
+  return 0;
+}
+
+/* Local variables */
+
+static int load(struct verifier* v, uint16_t index, vtype expected) {
+  uint16_t slots = is_wide(expected) ? 2 : 1;
+  vtype type;
+
+  if (index + slots > v->code->max_locals) {
+    return EINVAL;
+  }
+  type = v->locals[index];
+  if (expected == VT_OBJECT) {
+    /* aload also moves uninitialized references */
+    return is_reference(type) ? push(v, type) : EINVAL;
+  }
+  if (type != expected) {
+    return EINVAL;
+  }
+  return push(v, type);
+}
+
+static void set_local(struct verifier* v, uint16_t index, vtype type) {
+  /* overwriting half of a long or double kills the other half */
+  if (index > 0 && is_wide(v->locals[index - 1])) {
+    v->locals[index - 1] = VT_TOP;
+  }
+  v->locals[index] = type;
+  if (index + 1 > v->locals_size) {
+    v->locals_size = (uint16_t)(index + 1);
+  }
+}
+
+static int store(struct verifier* v, uint16_t index, vtype expected) {
+  uint16_t slots = is_wide(expected) ? 2 : 1;
+  vtype type;
+
+  if (index + slots > v->code->max_locals) {
+    return EINVAL;
+  }
+  type = expected == VT_OBJECT ? pop_reference(v) : pop_type(v, expected);
+  if (type == VT_TOP) {
+    return EINVAL;
+  }
+  set_local(v, index, type);
+  if (slots == 2) {
+    set_local(v, (uint16_t)(index + 1), VT_TOP);
+  }
+  return 0;
+}
+
+/* Stack map frames */
+
+static vtype* frame_row(struct verifier* v, uint32_t index) {
+  return v->frame_types +
+         (size_t)index * (v->code->max_locals + v->code->max_stack);
+}
+
+static int32_t find_frame(struct verifier* v, uint32_t bci) {
+  uint32_t low = 0;
+  uint32_t high = v->frame_count;
+
+  while (low < high) {
+    uint32_t mid = (low + high) / 2;
+    if (v->frames[mid].bci < bci) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  if (low < v->frame_count && v->frames[low].bci == bci) {
+    return (int32_t)low;
+  }
+  return -1;
+}
+
+static int read_type(struct verifier* v, Loader* loader, vtype* type) {
+  uint8_t tag = loader_u1(loader);
+  uint16_t payload = 0;
+
+  if (tag == ITEM_Object || tag == ITEM_Uninitialized) {
+    payload = loader_u2(loader);
+  }
+  if (loader->error || tag > ITEM_Uninitialized) {
+    return EINVAL;
+  }
+  if (tag == ITEM_Object) {
+    return class_type(v, payload, type);
+  }
+  if (tag == ITEM_Uninitialized &&
+      (payload >= v->code->code_length || v->code->code[payload] != OP_NEW)) {
+    return EINVAL;
+  }
+  *type = VTYPE(tag, payload);
+  return 0;
+}
+
+/* Appends `count` types to slots[*size], long and double take two */
+static int read_types(struct verifier* v, Loader* loader, uint16_t count,
+                      vtype* slots, uint16_t* size, uint16_t limit) {
+  vtype type;
+
+  while (count-- > 0) {
+    if (read_type(v, loader, &type) != 0 ||
+        *size + (is_wide(type) ? 2 : 1) > limit) {
+      return EINVAL;
+    }
+    slots[(*size)++] = type;
+    if (is_wide(type)) {
+      slots[(*size)++] = VT_TOP;
+    }
+  }
+  return 0;
+}
+
+/*
+ * Decodes the StackMapTable deltas one after another,
+ * every frame starts as a copy of the previous one
+ */
+static int decode_frames(struct verifier* v, const struct attribute_info* attr,
+                         const vtype* entry_locals, uint16_t entry_size) {
+  Loader loader = {.buffer = attr->info, .size = attr->attribute_length};
+  uint16_t max_locals = v->code->max_locals;
+  uint16_t max_stack = v->code->max_stack;
+  size_t row = (size_t)max_locals + max_stack;
+  uint16_t count = loader_u2(&loader);
+  const vtype* previous = entry_locals;
+  uint16_t previous_size = entry_size;
+  uint32_t bci = 0;
+  struct verifier_frame* frames;
+  vtype* types;
+  uint32_t i;
+  int err = 0;
+
+  v->frame_count = 0;
+  if (loader.error) {
+    return EINVAL;
+  }
+  frames = ensure_capacity(v->frames, &v->frames_capacity, count + 1u,
+                           sizeof(struct verifier_frame));
+  if (frames == NULL) {
+    return ENOMEM;
+  }
+  v->frames = frames;
+  types = ensure_capacity(v->frame_types, &v->frame_types_capacity,
+                          count * row + 1, sizeof(vtype));
+  if (types == NULL) {
+    return ENOMEM;
+  }
+  v->frame_types = types;
+
+  for (i = 0; i < count; i++) {
+    struct verifier_frame* frame = &v->frames[i];
+    vtype* locals = frame_row(v, i);
+    vtype* stack = locals + max_locals;
+    uint8_t type = loader_u1(&loader);
+    uint16_t delta;
+    uint16_t k;
+
+    for (k = 0; k < max_locals; k++) {
+      locals[k] = k < previous_size ? previous[k] : VT_TOP;
+    }
+    frame->locals_size = previous_size;
+    frame->stack_depth = 0;
+
+    if (type <= SAME_FRAME_MAX) {
+      delta = type;
+    } else if (type <= SAME_LOCALS_1_STACK_ITEM_MAX) {
+      delta = (uint16_t)(type - SAME_LOCALS_1_STACK_ITEM_MIN);
+      err = read_types(v, &loader, 1, stack, &frame->stack_depth, max_stack);
+    } else if (type < SAME_LOCALS_1_STACK_ITEM_EXTENDED) {
+      return EINVAL;
+    } else {
+      delta = loader_u2(&loader);
+      if (type == SAME_LOCALS_1_STACK_ITEM_EXTENDED) {
+        err = read_types(v, &loader, 1, stack, &frame->stack_depth,
+                         max_stack);
+      } else if (type <= CHOP_FRAME_MAX) {
+        for (k = (uint16_t)(SAME_FRAME_EXTENDED - type); k > 0; k--) {
+          uint16_t size = frame->locals_size;
+          if (size == 0) {
+            return EINVAL;
+          }
+          size -= size >= 2 && locals[size - 1] == VT_TOP &&
+                          is_wide(locals[size - 2])
+                      ? 2
+                      : 1;
+          while (frame->locals_size > size) {
+            locals[--frame->locals_size] = VT_TOP;
+          }
+        }
+      } else if (type <= APPEND_FRAME_MAX) {
+        err = read_types(v, &loader, (uint16_t)(type - SAME_FRAME_EXTENDED),
+                         locals, &frame->locals_size, max_locals);
+      } else if (type == FULL_FRAME) {
+        frame->locals_size = 0;
+        for (k = 0; k < max_locals; k++) {
+          locals[k] = VT_TOP;
+        }
+        err = read_types(v, &loader, loader_u2(&loader), locals,
+                         &frame->locals_size, max_locals);
+        if (err == 0) {
+          err = read_types(v, &loader, loader_u2(&loader), stack,
+                           &frame->stack_depth, max_stack);
+        }
+      }
+    }
+    if (err != 0 || loader.error) {
+      return EINVAL;
+    }
+
+    bci = i == 0 ? delta : bci + delta + 1;
+    if (bci >= v->code->code_length) {
+      return EINVAL;
+    }
+    frame->bci = (uint16_t)bci;
+    previous = locals;
+    previous_size = frame->locals_size;
+  }
+
+  v->frame_count = count;
+  v->stats.frames += count;
+  return loader.position == loader.size ? 0 : EINVAL;
+}
+
+/* The current state must be assignable to the frame at `index` */
+static int matches_frame(struct verifier* v, uint32_t index, int with_stack) {
+  const struct verifier_frame* frame = &v->frames[index];
+  const vtype* locals = frame_row(v, index);
+  const vtype* stack = locals + v->code->max_locals;
+  uint16_t i;
+
+  for (i = 0; i < v->code->max_locals; i++) {
+    if (!is_assignable(v, v->locals[i], locals[i])) {
+      return 0;
+    }
+  }
+  if (!with_stack) {
+    return 1;
+  }
+  if (frame->stack_depth != v->depth) {
+    return 0;
+  }
+  for (i = 0; i < v->depth; i++) {
+    if (!is_assignable(v, v->stack[i], stack[i])) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static void load_frame(struct verifier* v, uint32_t index) {
+  const struct verifier_frame* frame = &v->frames[index];
+  const vtype* locals = frame_row(v, index);
+
+  memcpy(v->locals, locals, v->code->max_locals * sizeof(vtype));
+  memcpy(v->stack, locals + v->code->max_locals,
+         frame->stack_depth * sizeof(vtype));
+  v->locals_size = frame->locals_size;
+  v->depth = frame->stack_depth;
+}
+
+static int check_target(struct verifier* v, uint32_t bci, int64_t target) {
+  int32_t index;
+
+  if (target < 0 || target >= v->code->code_length) {
+    return fail(v, bci, "branch target outside of the code");
+  }
+  index = find_frame(v, (uint32_t)target);
+  if (index < 0) {
+    return fail(v, bci, "branch target has no stack map frame");
+  }
+  if (!matches_frame(v, (uint32_t)index, 1)) {
+    return fail(v, bci, "frame is not assignable to the branch target");
+  }
+  return 0;
+}
+
+static int32_t read_s4(const uint8_t* p) {
+  return (int32_t)(((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+                   ((uint32_t)p[2] << 8) | (uint32_t)p[3]);
+}
+
+static uint16_t read_u2(const uint8_t* p) {
+  return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static int check_switch(struct verifier* v, uint32_t bci) {
+  const uint8_t* operands = v->code->code + ((bci + 4) & ~(uint32_t)3);
+  int32_t count;
+  int32_t i;
+  int err = check_target(v, bci, (int64_t)bci + read_s4(operands));
+
+  if (v->code->code[bci] == OP_TABLESWITCH) {
+    count = read_s4(operands + 8) - read_s4(operands + 4) + 1;
+    for (i = 0; i < count && err == 0; i++) {
+      err = check_target(v, bci, (int64_t)bci + read_s4(operands + 12 + 4 * i));
+    }
+  } else {
+    count = read_s4(operands + 4);
+    for (i = 0; i < count && err == 0; i++) {
+      if (i > 0 && read_s4(operands + 8 + 8 * i) <=
+                       read_s4(operands + 8 + 8 * (i - 1))) {
+        return fail(v, bci, "lookupswitch keys are not sorted");
+      }
+      err = check_target(v, bci, (int64_t)bci + read_s4(operands + 12 + 8 * i));
+    }
+  }
+  return err;
+}
+
+/* Locals on entry to every handler covering bci must match its frame */
+static int check_handlers(struct verifier* v, uint32_t bci) {
+  uint16_t i;
+
+  for (i = 0; i < v->code->exception_table_length; i++) {
+    int32_t index;
+    vtype caught;
+
+    if (bci < v->code->exception_table[i].start_pc ||
+        bci >= v->code->exception_table[i].end_pc) {
+      continue;
+    }
+    index = find_frame(v, v->code->exception_table[i].handler_pc);
+    if (index < 0) {
+      return fail(v, bci, "exception handler has no stack map frame");
+    }
+    caught = frame_row(v, (uint32_t)index)[v->code->max_locals];
+    if (v->frames[index].stack_depth != 1 ||
+        VTYPE_TAG(caught) != ITEM_Object) {
+      return fail(v, bci, "exception handler frame must hold the exception");
+    }
+    if (!matches_frame(v, (uint32_t)index, 0)) {
+      return fail(v, bci, "locals are not assignable to the handler frame");
+    }
+  }
+  return 0;
+}
+
+/*
+ * JVMS 4.10.1.6, the handler frame must accept the caught class, which
+ * must be a Throwable. catch_type 0 catches any Throwable
+ */
+static int check_catch_type(struct verifier* v, uint16_t handler) {
+  uint16_t handler_pc = v->code->exception_table[handler].handler_pc;
+  uint16_t catch_type = v->code->exception_table[handler].catch_type;
+  int32_t index = find_frame(v, handler_pc);
+  vtype throwable;
+  vtype caught;
+  int err;
+
+  if (index < 0 || v->frames[index].stack_depth != 1) {
+    return 0; /* reported by check_handlers at the first covered bci */
+  }
+  err = literal_type(v, "java/lang/Throwable", &throwable);
+  if (err != 0) {
+    return err;
+  }
+  caught = throwable;
+  if (catch_type != 0 &&
+      (class_type(v, catch_type, &caught) != 0 || VTYPE_DIMS(caught) != 0 ||
+       !is_assignable(v, caught, throwable))) {
+    return fail(v, handler_pc, "catch type is not a Throwable");
+  }
+  if (!is_assignable(v, caught,
+                     frame_row(v, (uint32_t)index)[v->code->max_locals])) {
+    return fail(v, handler_pc,
+                "exception handler frame does not accept the catch type");
+  }
+  return 0;
+}
+
+/* Constant pool driven instructions */
+
+static int ldc(struct verifier* v, uint32_t bci, uint16_t index, int wide) {
+  struct cp_info* cp_info;
+  struct UTF8_info* descriptor;
+  vtype type;
+  int err = 0;
+
+  if (get_constant(v->class, index, &cp_info) != 0) {
+    return fail(v, bci, "bad constant index");
+  }
+  switch (cp_info->tag) {
+    case INTEGER:
+      type = VT_INT;
+      break;
+    case FLOAT:
+      type = VT_FLOAT;
+      break;
+    case LONG:
+      type = VT_LONG;
+      break;
+    case DOUBLE:
+      type = VT_DOUBLE;
+      break;
+    case STRING:
+      err = literal_type(v, "java/lang/String", &type);
+      break;
+    case CLASS:
+      err = literal_type(v, "java/lang/Class", &type);
+      break;
+    case METHOD_TYPE:
+      err = literal_type(v, "java/lang/invoke/MethodType", &type);
+      break;
+    case METHOD_HANDLE:
+      err = literal_type(v, "java/lang/invoke/MethodHandle", &type);
+      break;
+    case DYNAMIC:
+      descriptor = constant_member_descriptor(v->class, index);
+      if (descriptor == NULL ||
+          descriptor_type(v, descriptor->bytes,
+                          descriptor->bytes + descriptor->lenght,
+                          &type) != descriptor->bytes + descriptor->lenght) {
+        return fail(v, bci, "bad dynamic constant");
+      }
+      break;
+    default:
+      return fail(v, bci, "constant can't be loaded");
+  }
+  if (err != 0) {
+    return err;
+  }
+  if (is_wide(type) != wide) {
+    return fail(v, bci, "ldc of a constant with the wrong size");
+  }
+  return push(v, type);
+}
+
+static int field(struct verifier* v, uint32_t bci, uint8_t opcode,
+                 uint16_t index) {
+  struct cp_info* cp_info;
+  struct UTF8_info* descriptor;
+  vtype type;
+  vtype owner;
+  vtype object;
+
+  if (get_constant(v->class, index, &cp_info) != 0 ||
+      cp_info->tag != FIELD_REF) {
+    return fail(v, bci, "expected a field reference");
+  }
+  descriptor = constant_member_descriptor(v->class, index);
+  if (descriptor == NULL ||
+      descriptor_type(v, descriptor->bytes,
+                      descriptor->bytes + descriptor->lenght,
+                      &type) != descriptor->bytes + descriptor->lenght) {
+    return fail(v, bci, "bad field descriptor");
+  }
+
+  if (opcode == OP_PUTSTATIC || opcode == OP_PUTFIELD) {
+    if (pop_type(v, type) == VT_TOP) {
+      return fail(v, bci, "stored value doesn't match the field type");
+    }
+  }
+  if (opcode == OP_GETFIELD || opcode == OP_PUTFIELD) {
+    if (class_type(v, cp_info->fieldref_info.info.class_index, &owner) != 0) {
+      return fail(v, bci, "bad field class");
+    }
+    object = pop_reference(v);
+    if (opcode == OP_PUTFIELD && object == VT_UNINIT_THIS) {
+      /* a constructor may set its own fields before calling super */
+      if (owner != v->this_type) {
+        return fail(v, bci, "field of another class set before super()");
+      }
+    } else if (!is_initialized_reference(object)) {
+      return fail(v, bci, "field access needs an initialized object");
+    } else if (!is_assignable(v, object, owner)) {
+      return fail(v, bci, "object is not an instance of the field's class");
+    }
+  }
+  if (opcode == OP_GETSTATIC || opcode == OP_GETFIELD) {
+    return push(v, type);
+  }
+  return 0;
+}
+
+/* Replaces every copy of an uninitialized object once <init> ran */
+static void initialize(struct verifier* v, vtype uninitialized, vtype type) {
+  uint16_t i;
+
+  for (i = 0; i < v->code->max_locals; i++) {
+    if (v->locals[i] == uninitialized) {
+      v->locals[i] = type;
+    }
+  }
+  for (i = 0; i < v->depth; i++) {
+    if (v->stack[i] == uninitialized) {
+      v->stack[i] = type;
+    }
+  }
+}
+
+static int invoke(struct verifier* v, uint32_t bci, uint8_t opcode,
+                  uint16_t index) {
+  const uint8_t* code = v->code->code;
+  struct name_and_type_info* name_and_type;
+  struct method_descriptor desc;
+  struct cp_info* cp_info;
+  struct UTF8_info* name;
+  struct UTF8_info* descriptor;
+  vtype args[DESCRIPTOR_MAX_ARGS];
+  vtype ret;
+  vtype owner = VT_OBJECT;
+  vtype receiver;
+  uint16_t owner_index;
+  int is_init;
+  int i;
+
+  if (get_constant(v->class, index, &cp_info) != 0) {
+    return fail(v, bci, "bad constant index");
+  }
+  if (opcode == OP_INVOKEDYNAMIC
+          ? cp_info->tag != INVOKE_METHOD ||
+                read_u2(code + bci + 3) != 0
+          : cp_info->tag != METHOD_REF &&
+                cp_info->tag != INTERF_METHOD_REF) {
+    return fail(v, bci, "bad invoke operand");
+  }
+  name_and_type = constant_member_name_and_type(v->class, index);
+  name = name_and_type != NULL
+             ? validate_constant(v->class, name_and_type->name_index)
+             : NULL;
+  descriptor = name_and_type != NULL
+                   ? validate_constant(v->class, name_and_type->descripror_index)
+                   : NULL;
+  if (name == NULL || descriptor == NULL ||
+      parse_method_descriptor(descriptor, &desc) != 0 ||
+      method_types(v, descriptor, args, &ret) != 0) {
+    return fail(v, bci, "bad method descriptor");
+  }
+  if (opcode != OP_INVOKEDYNAMIC) {
+    owner_index = cp_info->tag == METHOD_REF
+                      ? cp_info->methodref_info.info.class_index
+                      : cp_info->interface_meth_ref_info.info.class_index;
+    if (class_type(v, owner_index, &owner) != 0) {
+      return fail(v, bci, "bad method class");
+    }
+  }
+  is_init = is_string_match((const char*)name->bytes, name->lenght, "<init>");
+  if ((is_init && opcode != OP_INVOKESPECIAL) ||
+      (name->lenght > 0 && name->bytes[0] == '<' && !is_init)) {
+    return fail(v, bci, "bad call of a special method");
+  }
+  if (opcode == OP_INVOKEINTERFACE &&
+      (code[bci + 3] != desc.arg_slots + 1 || code[bci + 4] != 0)) {
+    return fail(v, bci, "bad invokeinterface count");
+  }
+
+  for (i = desc.arg_count - 1; i >= 0; i--) {
+    if (pop_type(v, args[i]) == VT_TOP) {
+      return fail(v, bci, "argument doesn't match the descriptor");
+    }
+  }
+
+  if (opcode != OP_INVOKESTATIC && opcode != OP_INVOKEDYNAMIC) {
+    receiver = pop_reference(v);
+    if (is_init) {
+      if (desc.ret != 'V') {
+        return fail(v, bci, "<init> must return void");
+      }
+      if (receiver == VT_UNINIT_THIS) {
+        /* this() or super() */
+        if (owner != v->this_type && owner != v->super_type) {
+          return fail(v, bci, "<init> of another class called on this");
+        }
+        initialize(v, receiver, v->this_type);
+      } else if (VTYPE_TAG(receiver) == ITEM_Uninitialized) {
+        vtype created;
+        /* the operand of the `new` that created the object */
+        if (class_type(v, read_u2(code + VTYPE_PAYLOAD(receiver) + 1),
+                       &created) != 0 ||
+            created != owner) {
+          return fail(v, bci, "<init> of another class called on new");
+        }
+        initialize(v, receiver, created);
+      } else {
+        return fail(v, bci, "<init> called on an initialized object");
+      }
+    } else if (!is_initialized_reference(receiver)) {
+      return fail(v, bci, "receiver must be an initialized object");
+    } else if (!is_assignable(v, receiver, owner)) {
+      return fail(v, bci, "receiver is not an instance of the method's class");
+    } else if (opcode == OP_INVOKESPECIAL &&
+               !is_assignable(v, receiver, v->this_type)) {
+      return fail(v, bci, "invokespecial receiver must be this class");
+    }
+  }
+
+  if (ret != VT_TOP) {
+    return push(v, ret);
+  }
+  return 0;
+}
+
+static int return_value(struct verifier* v, uint32_t bci, uint8_t opcode) {
+  static const char returns[] = {'I', 'J', 'F', 'D', 'L', 'V'};
+  char kind = returns[opcode - OP_IRETURN];
+  vtype ret = v->return_type;
+  uint16_t i;
+
+  /* byte, char, short and boolean are returned as int */
+  if (kind == 'V' ? ret != VT_TOP
+                  : kind == 'L' ? VTYPE_TAG(ret) != ITEM_Object
+                                : kind_type(kind) != ret) {
+    return fail(v, bci, "return doesn't match the descriptor");
+  }
+  if (kind != 'V' && pop_type(v, ret) == VT_TOP) {
+    return fail(v, bci, "bad return value");
+  }
+  if (v->is_init) {
+    for (i = 0; i < v->code->max_locals; i++) {
+      if (v->locals[i] == VT_UNINIT_THIS) {
+        return fail(v, bci, "constructor returns before calling super");
+      }
+    }
+  }
+  return 0;
+}
+
+/* Instructions */
+
+static int local_instruction(struct verifier* v, uint8_t opcode,
+                             uint16_t index) {
+  static const char kinds[] = {'I', 'J', 'F', 'D', 'A'};
+
+  if (opcode >= OP_ILOAD && opcode <= OP_ALOAD) {
+    return load(v, index, kind_type(kinds[opcode - OP_ILOAD]));
+  }
+  if (opcode >= OP_ISTORE && opcode <= OP_ASTORE) {
+    return store(v, index, kind_type(kinds[opcode - OP_ISTORE]));
+  }
+  if (opcode >= OP_ILOAD_0 && opcode <= OP_ALOAD_3) {
+    return load(v, (uint16_t)((opcode - OP_ILOAD_0) % 4),
+                kind_type(kinds[(opcode - OP_ILOAD_0) / 4]));
+  }
+  if (opcode >= OP_ISTORE_0 && opcode <= OP_ASTORE_3) {
+    return store(v, (uint16_t)((opcode - OP_ISTORE_0) % 4),
+                 kind_type(kinds[(opcode - OP_ISTORE_0) / 4]));
+  }
+  if (opcode == OP_IINC) {
+    return index < v->code->max_locals && v->locals[index] == VT_INT
+               ? 0
+               : EINVAL;
+  }
+  return EINVAL;
+}
+
+static int simple_instruction(struct verifier* v, const char* signature) {
+  const char* push_kind = strchr(signature, ':');
+  const char* kind;
+
+  for (kind = push_kind; kind > signature; kind--) {
+    if (pop_kind(v, kind[-1]) != 0) {
+      return EINVAL;
+    }
+  }
+  if (push_kind[1] != '\0') {
+    return push(v, kind_type(push_kind[1]));
+  }
+  return 0;
+}
+
+/* The array popped by an array instruction, VT_NULL or with dims > 0 */
+static vtype pop_array(struct verifier* v) {
+  vtype array = pop_type(v, VT_OBJECT);
+
+  if (array != VT_NULL && VTYPE_DIMS(array) == 0) {
+    return VT_TOP;
+  }
+  return array;
+}
+
+/* Element loads and stores, newarray, anewarray and arraylength */
+static int array_instruction(struct verifier* v, uint32_t bci,
+                             uint8_t opcode) {
+  /* element of the loads and stores in opcode order and its stack type */
+  static const uint8_t elements[] = {NAME_I, NAME_J, NAME_F, NAME_D,
+                                     NAME_OBJECT, NAME_B, NAME_C, NAME_S};
+  static const char kinds[] = {'I', 'J', 'F', 'D', 'A', 'I', 'I', 'I'};
+  /* newarray types from T_BOOLEAN on */
+  static const uint8_t atypes[] = {NAME_Z, NAME_C, NAME_F, NAME_D,
+                                   NAME_B, NAME_S, NAME_I, NAME_J};
+  const uint8_t* code = v->code->code;
+  uint32_t element;
+  vtype array;
+  vtype type;
+
+  switch (opcode) {
+    case OP_NEWARRAY:
+      if (code[bci + 1] < T_BOOLEAN || code[bci + 1] > T_LONG) {
+        return fail(v, bci, "bad newarray type");
+      }
+      if (pop_kind(v, 'I') != 0) {
+        return fail(v, bci, "array length must be int");
+      }
+      return push(v, VTYPE_OBJECT(atypes[code[bci + 1] - T_BOOLEAN], 1));
+    case OP_ANEWARRAY:
+      if (class_type(v, read_u2(code + bci + 1), &type) != 0 ||
+          VTYPE_DIMS(type) == UINT8_MAX) {
+        return fail(v, bci, "anewarray needs a class constant");
+      }
+      if (pop_kind(v, 'I') != 0) {
+        return fail(v, bci, "array length must be int");
+      }
+      return push(v, VTYPE_OBJECT(VTYPE_PAYLOAD(type), VTYPE_DIMS(type) + 1));
+    case OP_ARRAYLENGTH:
+      if (pop_array(v) == VT_TOP) {
+        return fail(v, bci, "arraylength needs an array");
+      }
+      return push(v, VT_INT);
+    default:
+      break;
+  }
+
+  if (opcode >= OP_IASTORE) {
+    element = (uint32_t)(opcode - OP_IASTORE);
+    if (pop_kind(v, kinds[element]) != 0) {
+      return fail(v, bci, "stored value doesn't match the instruction");
+    }
+  } else {
+    element = (uint32_t)(opcode - OP_IALOAD);
+  }
+  if (pop_kind(v, 'I') != 0) {
+    return fail(v, bci, "array index must be int");
+  }
+  array = pop_array(v);
+  if (array == VT_TOP) {
+    return fail(v, bci, "array instruction needs an array");
+  }
+  if (array != VT_NULL) {
+    uint16_t name = VTYPE_PAYLOAD(array);
+    int matches =
+        elements[element] == NAME_OBJECT
+            ? VTYPE_DIMS(array) > 1 || !is_primitive_name(name)
+            : VTYPE_DIMS(array) == 1 &&
+                  (name == elements[element] ||
+                   (elements[element] == NAME_B && name == NAME_Z));
+    if (!matches) {
+      return fail(v, bci, "array element doesn't match the instruction");
+    }
+  }
+  if (opcode >= OP_IASTORE) {
+    /* aastore checks the element class at run time */
+    return 0;
+  }
+  if (elements[element] != NAME_OBJECT) {
+    return push(v, kind_type(kinds[element]));
+  }
+  if (array == VT_NULL) {
+    return push(v, VT_NULL);
+  }
+  return push(v, VTYPE_OBJECT(VTYPE_PAYLOAD(array), VTYPE_DIMS(array) - 1));
+}
+
+static int verify_instruction(struct verifier* v, uint32_t bci) {
+  const uint8_t* code = v->code->code;
+  uint8_t opcode = code[bci];
+  const char* signature = opcode < OPCODE_COUNT ? signatures[opcode] : NULL;
+  struct cp_info* cp_info;
+  uint8_t dimensions;
+  vtype type;
+
+  if (signature != NULL) {
+    if (simple_instruction(v, signature) != 0) {
+      return fail(v, bci, "operand types don't match the instruction");
+    }
+    return 0;
+  }
+  if ((opcode >= OP_IALOAD && opcode <= OP_SALOAD) ||
+      (opcode >= OP_IASTORE && opcode <= OP_SASTORE) ||
+      opcode == OP_NEWARRAY || opcode == OP_ANEWARRAY ||
+      opcode == OP_ARRAYLENGTH) {
+    return array_instruction(v, bci, opcode);
+  }
+
+  switch (opcode) {
+    case OP_LDC:
+      return ldc(v, bci, code[bci + 1], 0);
+    case OP_LDC_W:
+      return ldc(v, bci, read_u2(code + bci + 1), 0);
+    case OP_LDC2_W:
+      return ldc(v, bci, read_u2(code + bci + 1), 1);
+    case OP_POP:
+      if (v->depth < 1 || splits_wide(v, (uint16_t)(v->depth - 1))) {
+        return fail(v, bci, "pop of a category 2 value");
+      }
+      v->depth--;
+      return 0;
+    case OP_POP2:
+      if (v->depth < 2 || splits_wide(v, (uint16_t)(v->depth - 2))) {
+        return fail(v, bci, "pop2 splits a category 2 value");
+      }
+      v->depth -= 2;
+      return 0;
+    case OP_DUP:
+    case OP_DUP_X1:
+    case OP_DUP_X2:
+    case OP_DUP2:
+    case OP_DUP2_X1:
+    case OP_DUP2_X2: {
+      static const uint8_t counts[] = {1, 1, 1, 2, 2, 2};
+      static const uint8_t below[] = {1, 2, 3, 2, 3, 4};
+      if (dup(v, counts[opcode - OP_DUP], below[opcode - OP_DUP]) != 0) {
+        return fail(v, bci, "bad dup");
+      }
+      return 0;
+    }
+    case OP_SWAP:
+      if (dup(v, 1, 2) != 0) {
+        return fail(v, bci, "bad swap");
+      }
+      v->depth--;
+      return 0;
+    case OP_GETSTATIC:
+    case OP_PUTSTATIC:
+    case OP_GETFIELD:
+    case OP_PUTFIELD:
+      return field(v, bci, opcode, read_u2(code + bci + 1));
+    case OP_INVOKEVIRTUAL:
+    case OP_INVOKESPECIAL:
+    case OP_INVOKESTATIC:
+    case OP_INVOKEINTERFACE:
+    case OP_INVOKEDYNAMIC:
+      return invoke(v, bci, opcode, read_u2(code + bci + 1));
+    case OP_IRETURN:
+    case OP_LRETURN:
+    case OP_FRETURN:
+    case OP_DRETURN:
+    case OP_ARETURN:
+    case OP_RETURN:
+      return return_value(v, bci, opcode);
+    case OP_NEW:
+      if (get_constant(v->class, read_u2(code + bci + 1), &cp_info) != 0 ||
+          cp_info->tag != CLASS) {
+        return fail(v, bci, "new needs a class constant");
+      }
+      if (push(v, VTYPE(ITEM_Uninitialized, bci)) != 0) {
+        return fail(v, bci, "operand stack overflow");
+      }
+      return 0;
+    case OP_CHECKCAST:
+      if (class_type(v, read_u2(code + bci + 1), &type) != 0 ||
+          pop_kind(v, 'A') != 0) {
+        return fail(v, bci, "bad checkcast");
+      }
+      return push(v, type);
+    case OP_MULTIANEWARRAY:
+      dimensions = code[bci + 3];
+      if (class_type(v, read_u2(code + bci + 1), &type) != 0 ||
+          dimensions == 0 || VTYPE_DIMS(type) < dimensions) {
+        return fail(v, bci, "bad multianewarray");
+      }
+      while (dimensions-- > 0) {
+        if (pop_kind(v, 'I') != 0) {
+          return fail(v, bci, "array dimensions must be int");
+        }
+      }
+      return push(v, type);
+    case OP_WIDE:
+      if (code[bci + 1] == OP_RET ||
+          local_instruction(v, code[bci + 1], read_u2(code + bci + 2)) != 0) {
+        return fail(v, bci, "bad wide instruction");
+      }
+      return 0;
+    case OP_JSR:
+    case OP_JSR_W:
+    case OP_RET:
+      return fail(v, bci, "jsr/ret are not allowed with a StackMapTable");
+    default:
+      if (local_instruction(v, opcode, code[bci + 1]) != 0) {
+        return fail(v, bci, "bad local variable access");
+      }
+      return 0;
+  }
+}
+
+/* The implicit frame on method entry, JVMS 4.10.1.6 */
+static int entry_frame(struct verifier* v) {
+  struct UTF8_info* name = validate_constant(v->class, v->method->name_index);
+  struct UTF8_info* descriptor =
+      validate_constant(v->class, v->method->descriptor_index);
+  vtype args[DESCRIPTOR_MAX_ARGS];
+  uint16_t size = 0;
+  uint8_t i;
+
+  if (name == NULL || descriptor == NULL ||
+      parse_method_descriptor(descriptor, &v->desc) != 0 ||
+      method_types(v, descriptor, args, &v->return_type) != 0 ||
+      class_type(v, v->class->this_class, &v->this_type) != 0) {
+    return EINVAL;
+  }
+  v->super_type = VT_TOP;
+  if (v->class->super_class != 0 &&
+      class_type(v, v->class->super_class, &v->super_type) != 0) {
+    return EINVAL;
+  }
+  /* the constructor of java/lang/Object has no super() to call */
+  v->is_init =
+      is_string_match((const char*)name->bytes, name->lenght, "<init>") &&
+      v->class->super_class != 0;
+
+  for (i = 0; i < v->code->max_locals; i++) {
+    v->locals[i] = VT_TOP;
+  }
+  if (!(v->method->access_flags & ACC_STATIC)) {
+    if (v->code->max_locals == 0) {
+      return EINVAL;
+    }
+    v->locals[size++] = v->is_init ? VT_UNINIT_THIS : v->this_type;
+  }
+  for (i = 0; i < v->desc.arg_count; i++) {
+    vtype type = args[i];
+    if (size + (is_wide(type) ? 2 : 1) > v->code->max_locals) {
+      return EINVAL;
+    }
+    v->locals[size++] = type;
+    if (is_wide(type)) {
+      v->locals[size++] = VT_TOP;
+    }
+  }
+  v->locals_size = size;
+  v->depth = 0;
+  return 0;
+}
+
+static int verify_code(struct verifier* v) {
+  const struct Code_attribute* code = v->code;
+  uint32_t next_frame = 0;
+  uint32_t bci;
+  uint32_t length;
+  uint16_t i;
+  int live = 1;
+  int err;
+
+  for (i = 0; i < code->exception_table_length; i++) {
+    if (code->exception_table[i].start_pc >= code->exception_table[i].end_pc ||
+        code->exception_table[i].end_pc > code->code_length ||
+        code->exception_table[i].handler_pc >= code->code_length) {
+      return fail(v, code->exception_table[i].handler_pc,
+                  "bad exception table entry");
+    }
+    err = check_catch_type(v, i);
+    if (err != 0) {
+      return err;
+    }
+  }
+
+  for (bci = 0; bci < code->code_length; bci += length) {
+    uint8_t flags;
+
+    length = opcode_length(code->code, code->code_length, bci);
+    if (length == 0) {
+      return fail(v, bci, "bad instruction");
+    }
+    flags = opcode_table[code->code[bci]].flags;
+    v->bci = bci;
+
+    if (next_frame < v->frame_count && v->frames[next_frame].bci < bci) {
+      return fail(v, v->frames[next_frame].bci,
+                  "stack map frame is not at an instruction");
+    }
+    if (next_frame < v->frame_count && v->frames[next_frame].bci == bci) {
+      if (live && !matches_frame(v, next_frame, 1)) {
+        return fail(v, bci, "frame is not assignable to the stack map frame");
+      }
+      load_frame(v, next_frame++);
+    } else if (!live) {
+      return fail(v, bci, "expected a stack map frame");
+    }
+
+    err = check_handlers(v, bci);
+    if (err == 0) {
+      err = verify_instruction(v, bci);
+    }
+    if (err == 0 && (flags & OPF_BRANCH)) {
+      err = check_target(
+          v, bci, (int64_t)bci + opcode_branch_offset(code->code, bci));
+    }
+    if (err == 0 && (code->code[bci] == OP_TABLESWITCH ||
+                     code->code[bci] == OP_LOOKUPSWITCH)) {
+      err = check_switch(v, bci);
+    }
+    if (err != 0) {
+      return err;
+    }
+
+    live = !(flags & OPF_NO_FALLTHROUGH);
+    v->stats.instructions++;
+  }
+
+  if (next_frame < v->frame_count) {
+    return fail(v, v->frames[next_frame].bci,
+                "stack map frame is outside of the code");
+  }
+  if (live) {
+    return fail(v, code->code_length, "execution falls off the code");
+  }
+  return 0;
+}
+
+int verify_method(struct verifier* v, struct class_file* class,
+                  struct method_info* method) {
+  struct attribute_info* table;
+  vtype* locals;
+  size_t slots;
+  int err;
+
+  if (method->code == NULL) {
+    return 0;
+  }
+  if (v->names_class != class) {
+    err = reset_names(v, class);
+    if (err != 0) {
+      return err;
+    }
+  }
+  v->class = class;
+  v->method = method;
+  v->code = method->code;
+
+  slots = (size_t)v->code->max_locals + v->code->max_stack;
+  locals = ensure_capacity(v->locals, &v->state_capacity, slots + 1,
+                           sizeof(vtype));
+  if (locals == NULL) {
+    return ENOMEM;
+  }
+  v->locals = locals;
+  v->stack = v->locals + v->code->max_locals;
+
+  if (entry_frame(v) != 0) {
+    return fail(v, 0, "arguments don't match the method");
+  }
+
+  v->frame_count = 0;
+  table = find_attribute(class, v->code->attributes, v->code->attributes_count,
+                         "StackMapTable");
+  if (table != NULL) {
+    err = decode_frames(v, table, v->locals, v->locals_size);
+    if (err != 0) {
+      return err == ENOMEM ? err : fail(v, 0, "malformed StackMapTable");
+    }
+  }
+
+  v->stats.methods++;
+  v->stats.code_bytes += v->code->code_length;
+  return verify_code(v);
+}
+
+int verify_class(struct verifier* verifier, struct class_file* class) {
+  uint16_t i;
+  int err;
+
+  if (class->major_version < 50) {
+    printf("ERROR: class version %hu needs the inference verifier\n",
+           class->major_version);
+    return ENOTSUP;
+  }
+
+  /* the names may point into a class freed since */
+  err = reset_names(verifier, class);
+  if (err != 0) {
+    return err;
+  }
+  verifier->deferred = 0;
+  for (i = 0; i < class->methods_count; i++) {
+    err = verify_method(verifier, class, &class->methods[i]);
+    if (err != 0) {
+      return err;
+    }
+  }
+  if (verifier->resolve == NULL) {
+    class->verify_deferred = verifier->deferred != 0;
+    verifier->stats.deferred += verifier->deferred;
+    verifier->stats.classes++;
+  }
+  return 0;
+}
+
+int verify_class_links(struct verifier* verifier, struct class_file* class,
+                       verifier_class_resolver resolve, void* ctx) {
+  int err;
+
+  if (!class->verify_deferred) {
+    return 0;
+  }
+  verifier->resolve = resolve;
+  verifier->resolve_ctx = ctx;
+  err = verify_class(verifier, class);
+  verifier->resolve = NULL;
+  verifier->resolve_ctx = NULL;
+  if (err == 0) {
+    class->verify_deferred = 0;
+  }
+  return err;
+}
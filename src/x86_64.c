@@ -0,0 +1,390 @@
+#include "x86_64.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define X86_INITIAL_CAPACITY 4096
+
+void x86_init(struct x86_asm* a) { memset(a, 0, sizeof(*a)); }
+
+void x86_destroy(struct x86_asm* a) {
+  free(a->code);
+  memset(a, 0, sizeof(*a));
+}
+
+void x86_emit_u8(struct x86_asm* a, uint8_t value) {
+  if (a->size == a->capacity) {
+    size_t capacity = a->capacity != 0 ? a->capacity * 2 : X86_INITIAL_CAPACITY;
+    uint8_t* code;
+
+    if (a->error) {
+      return;
+    }
+    code = realloc(a->code, capacity);
+    if (code == NULL) {
+      printf("ERROR: can't allocate memory for machine code\n");
+      a->error = 1;
+      return;
+    }
+    a->code = code;
+    a->capacity = capacity;
+  }
+  a->code[a->size++] = value;
+}
+
+void x86_emit_u32(struct x86_asm* a, uint32_t value) {
+  int i;
+
+  for (i = 0; i < 4; i++) {
+    x86_emit_u8(a, (uint8_t)(value >> (8 * i)));
+  }
+}
+
+void x86_emit_u64(struct x86_asm* a, uint64_t value) {
+  x86_emit_u32(a, (uint32_t)value);
+  x86_emit_u32(a, (uint32_t)(value >> 32));
+}
+
+/* REX prefix, left out when it would carry no bits */
+static void rex(struct x86_asm* a, int wide, int reg, int base) {
+  uint8_t prefix = (uint8_t)(0x40 | (wide ? 8 : 0) | ((reg & 8) ? 4 : 0) |
+                             ((base & 8) ? 1 : 0));
+  if (prefix != 0x40) {
+    x86_emit_u8(a, prefix);
+  }
+}
+
+static void modrm_reg(struct x86_asm* a, int reg, int rm) {
+  x86_emit_u8(a, (uint8_t)(0xc0 | ((reg & 7) << 3) | (rm & 7)));
+}
+
+/* ModRM, SIB and displacement of [base + disp] */
+static void modrm_mem(struct x86_asm* a, int reg, int base, int32_t disp) {
+  uint8_t mod;
+
+  if (disp == 0 && (base & 7) != X86_RBP) {
+    mod = 0x00;
+  } else if (disp >= -128 && disp <= 127) {
+    mod = 0x40;
+  } else {
+    mod = 0x80;
+  }
+  x86_emit_u8(a, (uint8_t)(mod | ((reg & 7) << 3) | (base & 7)));
+  if ((base & 7) == X86_RSP) {
+    x86_emit_u8(a, 0x24);
+  }
+  if (mod == 0x40) {
+    x86_emit_u8(a, (uint8_t)(int8_t)disp);
+  } else if (mod == 0x80) {
+    x86_emit_u32(a, (uint32_t)disp);
+  }
+}
+
+void x86_push(struct x86_asm* a, enum x86_reg reg) {
+  rex(a, 0, 0, reg);
+  x86_emit_u8(a, (uint8_t)(0x50 | (reg & 7)));
+}
+
+void x86_push_m(struct x86_asm* a, enum x86_reg base, int32_t disp) {
+  rex(a, 0, 0, base);
+  x86_emit_u8(a, 0xff);
+  modrm_mem(a, 6, base, disp);
+}
+
+void x86_pop(struct x86_asm* a, enum x86_reg reg) {
+  rex(a, 0, 0, reg);
+  x86_emit_u8(a, (uint8_t)(0x58 | (reg & 7)));
+}
+
+void x86_ret(struct x86_asm* a) { x86_emit_u8(a, 0xc3); }
+
+void x86_mov_rr(struct x86_asm* a, int wide, enum x86_reg dst,
+                enum x86_reg src) {
+  rex(a, wide, src, dst);
+  x86_emit_u8(a, 0x89);
+  modrm_reg(a, src, dst);
+}
+
+void x86_mov_rm(struct x86_asm* a, int wide, enum x86_reg dst,
+                enum x86_reg base, int32_t disp) {
+  rex(a, wide, dst, base);
+  x86_emit_u8(a, 0x8b);
+  modrm_mem(a, dst, base, disp);
+}
+
+void x86_mov_mr(struct x86_asm* a, int wide, enum x86_reg base,
+                int32_t disp, enum x86_reg src) {
+  rex(a, wide, src, base);
+  x86_emit_u8(a, 0x89);
+  modrm_mem(a, src, base, disp);
+}
+
+void x86_mov_ri(struct x86_asm* a, enum x86_reg dst, int32_t imm) {
+  if (imm == 0) {
+    x86_alu_rr(a, 0, X86_XOR, dst, dst);
+    return;
+  }
+  rex(a, 0, 0, dst);
+  x86_emit_u8(a, (uint8_t)(0xb8 | (dst & 7)));
+  x86_emit_u32(a, (uint32_t)imm);
+}
+
+void x86_mov_ri64(struct x86_asm* a, enum x86_reg dst, uint64_t imm) {
+  rex(a, 1, 0, dst);
+  x86_emit_u8(a, (uint8_t)(0xb8 | (dst & 7)));
+  x86_emit_u64(a, imm);
+}
+
+/* 32-bit store of an immediate */
+void x86_mov_mi(struct x86_asm* a, enum x86_reg base, int32_t disp,
+                int32_t imm) {
+  rex(a, 0, 0, base);
+  x86_emit_u8(a, 0xc7);
+  modrm_mem(a, 0, base, disp);
+  x86_emit_u32(a, (uint32_t)imm);
+}
+
+void x86_lea(struct x86_asm* a, enum x86_reg dst, enum x86_reg base,
+             int32_t disp) {
+  rex(a, 1, dst, base);
+  x86_emit_u8(a, 0x8d);
+  modrm_mem(a, dst, base, disp);
+}
+
+void x86_alu_rr(struct x86_asm* a, int wide, enum x86_alu op,
+                enum x86_reg dst, enum x86_reg src) {
+  rex(a, wide, src, dst);
+  x86_emit_u8(a, (uint8_t)((op << 3) | 0x01));
+  modrm_reg(a, src, dst);
+}
+
+void x86_alu_ri(struct x86_asm* a, int wide, enum x86_alu op,
+                enum x86_reg dst, int32_t imm) {
+  rex(a, wide, 0, dst);
+  if (imm >= -128 && imm <= 127) {
+    x86_emit_u8(a, 0x83);
+    modrm_reg(a, op, dst);
+    x86_emit_u8(a, (uint8_t)(int8_t)imm);
+  } else {
+    x86_emit_u8(a, 0x81);
+    modrm_reg(a, op, dst);
+    x86_emit_u32(a, (uint32_t)imm);
+  }
+}
+
+void x86_alu_rm(struct x86_asm* a, int wide, enum x86_alu op,
+                enum x86_reg dst, enum x86_reg base, int32_t disp) {
+  rex(a, wide, dst, base);
+  x86_emit_u8(a, (uint8_t)((op << 3) | 0x03));
+  modrm_mem(a, dst, base, disp);
+}
+
+void x86_alu_mi(struct x86_asm* a, int wide, enum x86_alu op,
+                enum x86_reg base, int32_t disp, int32_t imm) {
+  rex(a, wide, 0, base);
+  if (imm >= -128 && imm <= 127) {
+    x86_emit_u8(a, 0x83);
+    modrm_mem(a, op, base, disp);
+    x86_emit_u8(a, (uint8_t)(int8_t)imm);
+  } else {
+    x86_emit_u8(a, 0x81);
+    modrm_mem(a, op, base, disp);
+    x86_emit_u32(a, (uint32_t)imm);
+  }
+}
+
+void x86_test_rr(struct x86_asm* a, int wide, enum x86_reg dst,
+                 enum x86_reg src) {
+  rex(a, wide, src, dst);
+  x86_emit_u8(a, 0x85);
+  modrm_reg(a, src, dst);
+}
+
+void x86_test_abs(struct x86_asm* a, uint32_t address, enum x86_reg reg) {
+  rex(a, 0, reg, 0);
+  x86_emit_u8(a, 0x85);
+  /* mod 00 with rm 100 and a SIB of no base and no index: disp32 */
+  x86_emit_u8(a, (uint8_t)(((reg & 7) << 3) | 0x04));
+  x86_emit_u8(a, 0x25);
+  x86_emit_u32(a, address);
+}
+
+void x86_imul_rr(struct x86_asm* a, int wide, enum x86_reg dst,
+                 enum x86_reg src) {
+  rex(a, wide, dst, src);
+  x86_emit_u8(a, 0x0f);
+  x86_emit_u8(a, 0xaf);
+  modrm_reg(a, dst, src);
+}
+
+void x86_neg(struct x86_asm* a, int wide, enum x86_reg reg) {
+  rex(a, wide, 0, reg);
+  x86_emit_u8(a, 0xf7);
+  modrm_reg(a, 3, reg);
+}
+
+void x86_shift_cl(struct x86_asm* a, int wide, enum x86_shift op,
+                  enum x86_reg reg) {
+  rex(a, wide, 0, reg);
+  x86_emit_u8(a, 0xd3);
+  modrm_reg(a, op, reg);
+}
+
+void x86_cdq(struct x86_asm* a) { x86_emit_u8(a, 0x99); }
+
+void x86_idiv(struct x86_asm* a, int wide, enum x86_reg divisor) {
+  if (wide) {
+    x86_emit_u8(a, 0x48); /* cqo */
+    x86_emit_u8(a, 0x99);
+  } else {
+    x86_cdq(a);
+  }
+  rex(a, wide, 0, divisor);
+  x86_emit_u8(a, 0xf7);
+  modrm_reg(a, 7, divisor);
+}
+
+static void extend(struct x86_asm* a, uint8_t opcode, enum x86_reg dst,
+                   enum x86_reg src) {
+  /* spl, bpl, sil and dil need a REX prefix to be told from ah..bh */
+  if ((opcode == 0xbe || opcode == 0xb6) && src >= X86_RSP &&
+      src <= X86_RDI) {
+    x86_emit_u8(a, (uint8_t)(0x40 | ((dst & 8) ? 4 : 0)));
+  } else {
+    rex(a, 0, dst, src);
+  }
+  x86_emit_u8(a, 0x0f);
+  x86_emit_u8(a, opcode);
+  modrm_reg(a, dst, src);
+}
+
+void x86_movsx8(struct x86_asm* a, enum x86_reg dst, enum x86_reg src) {
+  extend(a, 0xbe, dst, src);
+}
+
+void x86_movsx16(struct x86_asm* a, enum x86_reg dst, enum x86_reg src) {
+  extend(a, 0xbf, dst, src);
+}
+
+void x86_movzx8(struct x86_asm* a, enum x86_reg dst, enum x86_reg src) {
+  extend(a, 0xb6, dst, src);
+}
+
+void x86_movzx16(struct x86_asm* a, enum x86_reg dst, enum x86_reg src) {
+  extend(a, 0xb7, dst, src);
+}
+
+void x86_load_xmm(struct x86_asm* a, int wide, int xmm, enum x86_reg base,
+                  int32_t disp) {
+  /* the mandatory prefix goes before REX */
+  x86_emit_u8(a, wide ? 0xf2 : 0xf3);
+  rex(a, 0, xmm, base);
+  x86_emit_u8(a, 0x0f);
+  x86_emit_u8(a, 0x10);
+  modrm_mem(a, xmm, base, disp);
+}
+
+void x86_mov_rx(struct x86_asm* a, int wide, enum x86_reg dst, int xmm) {
+  x86_emit_u8(a, 0x66);
+  rex(a, wide, xmm, dst);
+  x86_emit_u8(a, 0x0f);
+  x86_emit_u8(a, 0x7e);
+  modrm_reg(a, xmm, dst);
+}
+
+/* ModRM, SIB and displacement of [base + index * size + disp] */
+static void modrm_indexed(struct x86_asm* a, int reg, int base, int index,
+                          int size, int32_t disp) {
+  uint8_t scale = size == 8 ? 3 : size == 4 ? 2 : size == 2 ? 1 : 0;
+
+  x86_emit_u8(a, (uint8_t)(0x84 | ((reg & 7) << 3)));
+  x86_emit_u8(a, (uint8_t)((scale << 6) | ((index & 7) << 3) | (base & 7)));
+  x86_emit_u32(a, (uint32_t)disp);
+}
+
+static void rex_indexed(struct x86_asm* a, int wide, int reg, int index,
+                        int base, int force) {
+  uint8_t prefix = (uint8_t)(0x40 | (wide ? 8 : 0) | ((reg & 8) ? 4 : 0) |
+                             ((index & 8) ? 2 : 0) | ((base & 8) ? 1 : 0));
+  if (prefix != 0x40 || force) {
+    x86_emit_u8(a, prefix);
+  }
+}
+
+void x86_load_indexed(struct x86_asm* a, int size, int sign,
+                      enum x86_reg dst, enum x86_reg base,
+                      enum x86_reg index, int32_t disp) {
+  rex_indexed(a, size == 8, dst, index, base, 0);
+  if (size == 1 || size == 2) {
+    x86_emit_u8(a, 0x0f);
+    x86_emit_u8(a, (uint8_t)((sign ? 0xbe : 0xb6) | (size == 2 ? 1 : 0)));
+  } else {
+    x86_emit_u8(a, 0x8b);
+  }
+  modrm_indexed(a, dst, base, index, size, disp);
+}
+
+void x86_store_indexed(struct x86_asm* a, int size, enum x86_reg base,
+                       enum x86_reg index, int32_t disp, enum x86_reg src) {
+  if (size == 2) {
+    x86_emit_u8(a, 0x66);
+  }
+  /* sil and dil need a REX prefix for byte stores */
+  rex_indexed(a, size == 8, src, index, base,
+              size == 1 && src >= X86_RSP && src <= X86_RDI);
+  x86_emit_u8(a, size == 1 ? 0x88 : 0x89);
+  modrm_indexed(a, src, base, index, size, disp);
+}
+
+void x86_call_r(struct x86_asm* a, enum x86_reg target) {
+  rex(a, 0, 0, target);
+  x86_emit_u8(a, 0xff);
+  modrm_reg(a, 2, target);
+}
+
+void x86_call_m(struct x86_asm* a, enum x86_reg base, int32_t disp) {
+  rex(a, 0, 0, base);
+  x86_emit_u8(a, 0xff);
+  modrm_mem(a, 2, base, disp);
+}
+
+void x86_jmp_r(struct x86_asm* a, enum x86_reg target) {
+  rex(a, 0, 0, target);
+  x86_emit_u8(a, 0xff);
+  modrm_reg(a, 4, target);
+}
+
+static size_t jump_displacement(struct x86_asm* a, size_t target) {
+  size_t at = a->size;
+
+  x86_emit_u32(a, 0);
+  if (target != X86_NO_TARGET) {
+    x86_patch_jump(a, at, target);
+  }
+  return at;
+}
+
+size_t x86_jmp(struct x86_asm* a, size_t target) {
+  x86_emit_u8(a, 0xe9);
+  return jump_displacement(a, target);
+}
+
+size_t x86_jcc(struct x86_asm* a, enum x86_cond cond, size_t target) {
+  x86_emit_u8(a, 0x0f);
+  x86_emit_u8(a, (uint8_t)(0x80 | cond));
+  return jump_displacement(a, target);
+}
+
+void x86_patch_jump(struct x86_asm* a, size_t at, size_t target) {
+  uint32_t displacement = (uint32_t)(int32_t)((int64_t)target -
+                                              (int64_t)(at + 4));
+  int i;
+
+  if (a->error || at + 4 > a->size) {
+    return;
+  }
+  for (i = 0; i < 4; i++) {
+    a->code[at + i] = (uint8_t)(displacement >> (8 * i));
+  }
+}